@@ -44,6 +44,9 @@
 #include "toolframework/itoolframework.h"
 #include "datacache/idatacache.h"
 #include "gamestringpool.h"
+#include "clientjobs.h"
+#include "studio_shared.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -2200,38 +2203,14 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 			// Setting this flag forces move children to keep their abs transform invalidated.
 			AddFlag( EFL_SETTING_UP_BONES );
 
-			// only allocate an ik block if the npc can use it
-			if ( !m_pIk && hdr->numikchains() > 0 && !(m_EntClientFlags & ENTCLIENTFLAG_DONTUSEIK) )
-				m_pIk = new CIKContext;
-
 			Vector		pos[MAXSTUDIOBONES];
 			Quaternion	q[MAXSTUDIOBONES];
 
 			int bonesMaskNeedRecalc = boneMask | oldReadableBones; // Hack to always recalc bones, to fix the arm jitter in the new CS player anims until Ken makes the real fix
 
-			if ( m_pIk )
-			{
-				m_pIk->Init( hdr, GetRenderAngles(), GetRenderOrigin(), currentTime, gpGlobals->framecount, bonesMaskNeedRecalc );
-			}
-
+			InitBoneSetupIK( hdr, bonesMaskNeedRecalc, currentTime );
 			StandardBlendingRules( hdr, pos, q, currentTime, bonesMaskNeedRecalc );
-
-			CBoneBitList boneComputed;
-			// don't calculate IK on ragdolls
-			if ( m_pIk && !IsRagdoll() )
-			{
-				UpdateIKLocks( currentTime );
-
-				m_pIk->UpdateTargets( pos, q, m_BoneAccessor.GetBoneArrayForWrite(), boneComputed );
-
-				CalculateIKLocks( currentTime );
-				m_pIk->SolveDependencies( pos, q, m_BoneAccessor.GetBoneArrayForWrite(), boneComputed );
-			}
-
-			BuildTransformations( hdr, pos, q, parentTransform, bonesMaskNeedRecalc, boneComputed );
-			
-			RemoveFlag( EFL_SETTING_UP_BONES );
-			ControlMouth( hdr );
+			FinishBoneSetup( hdr, pos, q, parentTransform, bonesMaskNeedRecalc, currentTime );
 		}
 		
 		if( !( oldReadableBones & BONE_USED_BY_ATTACHMENT ) && ( boneMask & BONE_USED_BY_ATTACHMENT ) )
@@ -2259,6 +2238,42 @@ bool C_BaseAnimating::SetupBones( matrix3x4_t *pBoneToWorldOut, int nMaxBones, i
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: The parts of SetupBones() before and after StandardBlendingRules()
+//-----------------------------------------------------------------------------
+void C_BaseAnimating::InitBoneSetupIK( CStudioHdr *hdr, int boneMask, float currentTime )
+{
+	// only allocate an ik block if the npc can use it
+	if ( !m_pIk && hdr->numikchains() > 0 && !(m_EntClientFlags & ENTCLIENTFLAG_DONTUSEIK) )
+		m_pIk = new CIKContext;
+
+	if ( m_pIk )
+	{
+		m_pIk->Init( hdr, GetRenderAngles(), GetRenderOrigin(), currentTime, gpGlobals->framecount, boneMask );
+	}
+}
+
+void C_BaseAnimating::FinishBoneSetup( CStudioHdr *hdr, Vector pos[], Quaternion q[], const matrix3x4_t &parentTransform, int boneMask, float currentTime )
+{
+	CBoneBitList boneComputed;
+	// don't calculate IK on ragdolls
+	if ( m_pIk && !IsRagdoll() )
+	{
+		UpdateIKLocks( currentTime );
+
+		m_pIk->UpdateTargets( pos, q, m_BoneAccessor.GetBoneArrayForWrite(), boneComputed );
+
+		CalculateIKLocks( currentTime );
+		m_pIk->SolveDependencies( pos, q, m_BoneAccessor.GetBoneArrayForWrite(), boneComputed );
+	}
+
+	BuildTransformations( hdr, pos, q, parentTransform, boneMask, boneComputed );
+	
+	RemoveFlag( EFL_SETTING_UP_BONES );
+	ControlMouth( hdr );
+}
+
+
 C_BaseAnimating* C_BaseAnimating::FindFollowedEntity()
 {
 
@@ -2361,6 +2376,328 @@ void C_BaseAnimating::InvalidateBoneCaches()
 }
 
 
+//-----------------------------------------------------------------------------
+// cl_parallel_bones
+//
+// Before the frame is rendered, the entities whose bones were asked for last
+// frame get them set up again, with StandardBlendingRules() spread across the
+// client job threads. Rendering, attachments and hitboxes then find them
+// already set up. The rest of SetupBones() (IK, bone merging, ragdolls,
+// building the matrices) runs on the main thread once the jobs are done, an
+// entity at a time, since it reads other entities' bones.
+//
+// What the jobs touch, and why no two threads race on it:
+//	- The entity's animation state (sequence, cycle, pose parameters,
+//	  controllers, layers, sequence transitions, IK rules). Each job has its
+//	  own entities, and the main thread runs nothing but jobs until they're
+//	  done. The layer history fix ups, which flip the global range check
+//	  switch, happen before the jobs; see C_BaseAnimatingOverlay.
+//	- Its render origin and angles, computed before the jobs. Entities with
+//	  a move parent or a ragdoll take theirs from something else, and stay
+//	  on the main thread.
+//	- Each job writes its own bones in s_BoneSetupPos and s_BoneSetupQ, its
+//	  stack, and its thread's BoneSetupScratch_t.
+//	- The decoded animation frames they share are behind their own lock.
+//	- Engine model info (animation blocks, autoplay lists, virtual models)
+//	  is answered from what the main thread looked up while it prefetched
+//	  the animations, so no job calls into the engine. A job that would have
+//	  needed anything else is thrown away, and SetupBones() sets the entity
+//	  up when it's asked. See studio_shared.cpp.
+//-----------------------------------------------------------------------------
+static ConVar cl_parallel_bones( "cl_parallel_bones", "1", 0, "Before rendering, blend the animations of the entities whose bones were set up last frame on the client job threads." );
+
+#define MIN_BONE_SETUPS_PER_JOB		2
+
+struct BoneSetupJob_t
+{
+	C_BaseAnimating	*m_pEntity;
+	CStudioHdr		*m_pStudioHdr;
+	int				m_boneMask;
+	int				m_iFirstBone;		// Into s_BoneSetupPos and s_BoneSetupQ
+	bool			m_bMissedLookups;	// Set by the job if it needed model info the main thread hadn't looked up
+};
+
+static CUtlVector< BoneSetupJob_t >	s_BoneSetupJobs;
+static CUtlVector< Vector >			s_BoneSetupPos;
+static CUtlVector< Quaternion >		s_BoneSetupQ;
+static unsigned long				s_iBoneCounterAtLastSetup;
+static int							s_nBoneSetupsMissed;		// For cl_bench_setupbones
+
+bool C_BaseAnimating::CanSetupBonesInJob()
+{
+	return !m_pRagdoll && !GetMoveParent();
+}
+
+bool C_BaseAnimating::PrefetchBlendingRules( CStudioHdr *hdr, float currentTime )
+{
+	bool bPrefetched = Studio_PrefetchPose( hdr, GetSequence() );
+	for ( int i = 0; i < m_SequenceTransitioner.m_animationQueue.Count(); i++ )
+	{
+		if ( !Studio_PrefetchPose( hdr, m_SequenceTransitioner.m_animationQueue[i].m_nSequence ) )
+		{
+			bPrefetched = false;
+		}
+	}
+	return Studio_PrefetchAutoplaySequences( hdr ) && bPrefetched;
+}
+
+void C_BaseAnimating::SetupBonesRange( void *pContext, int iFirst, int iLast )
+{
+	BoneSetupJob_t *pJobs = (BoneSetupJob_t *)pContext;
+	for ( int i = iFirst; i < iLast; i++ )
+	{
+		BoneSetupJob_t &job = pJobs[i];
+		int nMisses = Studio_ModelLookupMisses();
+
+		job.m_pEntity->StandardBlendingRules( job.m_pStudioHdr, s_BoneSetupPos.Base() + job.m_iFirstBone, 
+			s_BoneSetupQ.Base() + job.m_iFirstBone, gpGlobals->curtime, job.m_boneMask );
+
+		job.m_bMissedLookups = ( Studio_ModelLookupMisses() != nMisses );
+	}
+}
+
+void C_BaseAnimating::SetupBonesForFrame()
+{
+	// Entities whose bones were asked for since the last time through
+	unsigned long iLastSetup = s_iBoneCounterAtLastSetup;
+	s_iBoneCounterAtLastSetup = g_iModelBoneCounter;
+
+	if ( !cl_parallel_bones.GetBool() || ClientJobThreadCount() <= 1 || cl_SetupAllBones.GetInt() )
+		return;
+
+	VPROF_BUDGET( "C_BaseAnimating::SetupBonesForFrame", VPROF_BUDGETGROUP_CLIENT_ANIMATION );
+
+	MDLCACHE_CRITICAL_SECTION();
+
+	float currentTime = gpGlobals->curtime;
+	int nBones = 0;
+
+	// Everything that touches the entity outside of its pose happens here,
+	// and so do the model info lookups the jobs will need
+	Studio_RecordModelLookups( true );
+	s_BoneSetupJobs.RemoveAll();
+	for ( C_BaseEntity *pEntity = ClientEntityList().FirstBaseEntity(); pEntity; pEntity = ClientEntityList().NextBaseEntity( pEntity ) )
+	{
+		C_BaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		if ( !pAnimating || pAnimating->IsMarkedForDeletion() || !pAnimating->m_iAccumulatedBoneMask )
+			continue;
+
+		if ( pAnimating->m_iMostRecentModelBoneCounter == g_iModelBoneCounter || pAnimating->m_iMostRecentModelBoneCounter < iLastSetup )
+			continue;
+
+		if ( pAnimating->GetSequence() == -1 || !pAnimating->IsBoneAccessAllowed() || pAnimating->IsToolRecording() || 
+			pAnimating->IsEFlagSet( EFL_SETTING_UP_BONES ) || !pAnimating->CanSetupBonesInJob() )
+			continue;
+
+		CStudioHdr *hdr = pAnimating->GetModelPtr();
+		if ( !hdr || ( hdr->flags() & STUDIOHDR_FLAGS_STATIC_PROP ) )
+			continue;
+
+		// The jobs can't wait for animations to load. Leave SetupBones() to do it.
+		hdr->ResolveGroups();
+		if ( !hdr->SequencesAvailable() || pAnimating->GetSequence() >= hdr->GetNumSeq() || !pAnimating->PrefetchBlendingRules( hdr, currentTime ) )
+			continue;
+
+		// What SetupBones() does the first time it sees the entity in a frame.
+		// It asks for everything that was asked for last frame.
+		pAnimating->m_BoneAccessor.SetReadableBones( 0 );
+		pAnimating->m_BoneAccessor.SetWritableBones( 0 );
+		pAnimating->m_iPrevBoneMask = pAnimating->m_iAccumulatedBoneMask;
+		pAnimating->m_iAccumulatedBoneMask = 0;
+		pAnimating->m_iMostRecentModelBoneCounter = g_iModelBoneCounter;
+
+		BoneSetupJob_t &job = s_BoneSetupJobs[ s_BoneSetupJobs.AddToTail() ];
+		job.m_pEntity = pAnimating;
+		job.m_pStudioHdr = hdr;
+		job.m_boneMask = pAnimating->m_iPrevBoneMask;
+		job.m_iFirstBone = nBones;
+		job.m_bMissedLookups = false;
+
+		// Computes the abs transform, so the jobs only read it
+		pAnimating->GetRenderOrigin();
+		pAnimating->GetRenderAngles();
+		pAnimating->InitBoneSetupIK( hdr, job.m_boneMask, currentTime );
+
+		nBones += hdr->numbones();
+	}
+
+	Studio_RecordModelLookups( false );
+
+	if ( !s_BoneSetupJobs.Count() )
+		return;
+
+	s_BoneSetupPos.EnsureCount( nBones );
+	s_BoneSetupQ.EnsureCount( nBones );
+
+	Studio_BeginModelLookupJobs();
+	ClientJobs_ParallelFor( s_BoneSetupJobs.Count(), MIN_BONE_SETUPS_PER_JOB, SetupBonesRange, s_BoneSetupJobs.Base(), 1 );
+	Studio_EndModelLookupJobs();
+
+	for ( int i = 0; i < s_BoneSetupJobs.Count(); i++ )
+	{
+		BoneSetupJob_t &job = s_BoneSetupJobs[i];
+		C_BaseAnimating *pAnimating = job.m_pEntity;
+
+		// Left for SetupBones() to set up when it's asked
+		if ( job.m_bMissedLookups )
+		{
+			s_nBoneSetupsMissed++;
+			continue;
+		}
+
+		// Already set up by an entity that came before it here, for its IK
+		// or its attachments
+		if ( ( pAnimating->m_BoneAccessor.GetReadableBones() & job.m_boneMask ) == job.m_boneMask )
+			continue;
+
+		TrackBoneSetupEnt( pAnimating );
+		pAnimating->AddFlag( EFL_SETTING_UP_BONES );
+		pAnimating->m_BoneAccessor.SetWritableBones( job.m_boneMask );
+		pAnimating->m_BoneAccessor.SetReadableBones( job.m_boneMask );
+
+		matrix3x4_t parentTransform;
+		AngleMatrix( pAnimating->GetRenderAngles(), pAnimating->GetRenderOrigin(), parentTransform );
+
+		pAnimating->FinishBoneSetup( job.m_pStudioHdr, s_BoneSetupPos.Base() + job.m_iFirstBone, 
+			s_BoneSetupQ.Base() + job.m_iFirstBone, parentTransform, job.m_boneMask, currentTime );
+
+		if ( job.m_boneMask & BONE_USED_BY_ATTACHMENT )
+		{
+			pAnimating->SetupBones_AttachmentHelper( job.m_pStudioHdr );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// cl_bench_setupbones
+//
+// Sets up the bones of the animating entities one at a time, the way
+// rendering asks for them, and then all at once through the phase that
+// spreads their blending across the client job threads
+//-----------------------------------------------------------------------------
+void C_BaseAnimating::BenchSetupBones( int nPasses )
+{
+	MDLCACHE_CRITICAL_SECTION();
+	PushAllowBoneAccess( true, false );
+
+	// Entities the phase leaves to the main thread would only dilute the comparison
+	CUtlVector<C_BaseAnimating *> entities;
+	int nBones = 0;
+	int nSkipped = 0;
+	for ( C_BaseEntity *pEntity = ClientEntityList().FirstBaseEntity(); pEntity; pEntity = ClientEntityList().NextBaseEntity( pEntity ) )
+	{
+		C_BaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		CStudioHdr *hdr = pAnimating ? pAnimating->GetModelPtr() : NULL;
+		if ( !hdr || pAnimating->IsMarkedForDeletion() || pAnimating->GetSequence() == -1 || 
+			( hdr->flags() & STUDIOHDR_FLAGS_STATIC_PROP ) || !pAnimating->IsBoneAccessAllowed() )
+			continue;
+
+		if ( !pAnimating->CanSetupBonesInJob() )
+		{
+			nSkipped++;
+			continue;
+		}
+
+		entities.AddToTail( pAnimating );
+		nBones += hdr->numbones();
+	}
+
+	if ( !entities.Count() )
+	{
+		Msg( "No animating entities to set up\n" );
+		PopBoneAccess();
+		return;
+	}
+
+	Msg( "%d animating entities (%d skipped), %d bones, %d threads, %d passes\n", entities.Count(), nSkipped, nBones, ClientJobThreadCount(), nPasses );
+	if ( ClientJobThreadCount() <= 1 )
+	{
+		Msg( "  no job threads, so the parallel pass does nothing\n" );
+	}
+
+	CUtlVector<matrix3x4_t> serialBones;
+	serialBones.SetCount( nBones );
+
+	int nWasMissed = s_nBoneSetupsMissed;
+	bool bWasParallel = cl_parallel_bones.GetBool();
+	cl_parallel_bones.SetValue( 1 );
+
+	CFastTimer timer;
+	double flSerial = 0;
+	double flParallel = 0;
+	float flMaxDiff = 0;
+	int i, j;
+
+	for ( int iPass = 0; iPass < nPasses; iPass++ )
+	{
+		// One at a time, which also leaves every entity for the phase to set up
+		InvalidateBoneCaches();
+		timer.Start();
+		for ( i = 0; i < entities.Count(); i++ )
+		{
+			entities[i]->SetupBones( NULL, -1, BONE_USED_BY_ANYTHING, gpGlobals->curtime );
+		}
+		timer.End();
+		flSerial += timer.GetDuration().GetSeconds();
+
+		int iBone = 0;
+		for ( i = 0; i < entities.Count(); i++ )
+		{
+			int nEntityBones = entities[i]->GetModelPtr()->numbones();
+			for ( j = 0; j < nEntityBones; j++, iBone++ )
+			{
+				if ( j < entities[i]->m_CachedBoneData.Count() )
+				{
+					MatrixCopy( entities[i]->m_CachedBoneData[j], serialBones[iBone] );
+				}
+			}
+		}
+
+		InvalidateBoneCaches();
+		timer.Start();
+		SetupBonesForFrame();
+		timer.End();
+		flParallel += timer.GetDuration().GetSeconds();
+
+		iBone = 0;
+		for ( i = 0; i < entities.Count(); i++ )
+		{
+			int nEntityBones = entities[i]->GetModelPtr()->numbones();
+			for ( j = 0; j < nEntityBones; j++, iBone++ )
+			{
+				if ( j >= entities[i]->m_CachedBoneData.Count() )
+					continue;
+
+				const matrix3x4_t &bone = entities[i]->m_CachedBoneData[j];
+				for ( int k = 0; k < 12; k++ )
+				{
+					flMaxDiff = max( flMaxDiff, fabs( bone.Base()[k] - serialBones[iBone].Base()[k] ) );
+				}
+			}
+		}
+	}
+
+	cl_parallel_bones.SetValue( bWasParallel ? 1 : 0 );
+	int nMissed = s_nBoneSetupsMissed - nWasMissed;
+
+	// Leave the next frame to set everything up as it's asked for
+	InvalidateBoneCaches();
+	PopBoneAccess();
+
+	Msg( "  main thread  %8.3f ms/pass\n", flSerial * 1000.0 / nPasses );
+	Msg( "  job threads  %8.3f ms/pass  %.2fx  max diff %g\n", flParallel * 1000.0 / nPasses, flParallel > 0 ? flSerial / flParallel : 0.0, flMaxDiff );
+	if ( nMissed )
+	{
+		Msg( "  %d set ups thrown away for missing model lookups\n", nMissed );
+	}
+}
+
+CON_COMMAND_F( cl_bench_setupbones, "Times setting up the bones of the animating entities one at a time, and with cl_parallel_bones across the client job threads. Usage: cl_bench_setupbones [passes]", FCVAR_CHEAT )
+{
+	C_BaseAnimating::BenchSetupBones( max( 1, ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 20 ) );
+}
+
+
 ConVar r_drawothermodels( "r_drawothermodels", "1", FCVAR_CHEAT, "0=Off, 1=Normal, 2=Wireframe" );
 
 //-----------------------------------------------------------------------------
@@ -3277,44 +3614,31 @@ void C_BaseAnimating::ResetLatched( void )
 
 //-----------------------------------------------------------------------------
 // Purpose: 
-// Output : Returns true on success, false on failure.
+// Output : Returns false if there's nothing to interpolate.
 //-----------------------------------------------------------------------------
 
-bool C_BaseAnimating::Interpolate( float flCurrentTime )
+bool C_BaseAnimating::InterpolateBegin( float flCurrentTime, InterpolationBatchState_t &state )
 {
 	// ragdolls don't need interpolation
 	if ( m_pRagdoll )
-		return true;
-
-	VPROF( "C_BaseAnimating::Interpolate" );
+		return false;
 
-	Vector oldOrigin;
-	QAngle oldAngles;
-	float flOldCycle = GetCycle();
-	int nChangeFlags = 0;
+	state.m_flOldCycle = GetCycle();
 
 	if ( !m_bClientSideAnimation )
 		m_iv_flCycle.SetLooping( IsSequenceLooping( GetSequence() ) );
 
-	int bNoMoreChanges;
-	int retVal = BaseInterpolatePart1( flCurrentTime, oldOrigin, oldAngles, bNoMoreChanges );
-	if ( retVal == INTERPOLATE_STOP )
-	{
-		if ( bNoMoreChanges )
-			RemoveFromInterpolationList();
-		return true;
-	}
+	return BaseClass::InterpolateBegin( flCurrentTime, state );
+}
 
 
+void C_BaseAnimating::InterpolateEnd( InterpolationBatchState_t &state )
+{
 	// Did cycle change?
-	if( GetCycle() != flOldCycle )
-		nChangeFlags |= ANIMATION_CHANGED;
+	if( GetCycle() != state.m_flOldCycle )
+		state.m_nChangeFlags |= ANIMATION_CHANGED;
 
-	if ( bNoMoreChanges )
-		RemoveFromInterpolationList();
-	
-	BaseInterpolatePart2( oldOrigin, oldAngles, nChangeFlags );
-	return true;
+	BaseClass::InterpolateEnd( state );
 }
 
 
@@ -93,7 +93,8 @@ public:
 
 	bool UsesFrameBufferTexture( void );
 
-	virtual bool	Interpolate( float currentTime );
+	virtual bool	InterpolateBegin( float currentTime, InterpolationBatchState_t &state );
+	virtual void	InterpolateEnd( InterpolationBatchState_t &state );
 	virtual void	Simulate();	
 	virtual void	Release();	
 
@@ -326,6 +327,11 @@ public:
 	// Invalidate bone caches so all SetupBones() calls force bone transforms to be regenerated.
 	static void						InvalidateBoneCaches();
 
+	// Sets up the bones of the entities whose bones were asked for last frame,
+	// blending their animations on the client job threads. See cl_parallel_bones.
+	static void						SetupBonesForFrame();
+	static void						BenchSetupBones( int nPasses );
+
 	// Purpose: My physics object has been updated, react or extract data
 	virtual void					VPhysicsUpdate( IPhysicsObject *pPhysics );
 
@@ -378,7 +384,17 @@ protected:
 	// Allow studio models to tell C_BaseEntity what their m_nBody value is
 	virtual int						GetStudioBody( void ) { return m_nBody; }
 
+	// Whether SetupBonesForFrame() can run StandardBlendingRules() off the main thread.
+	// PrefetchBlendingRules() looks up what it will need there, and returns false if
+	// any of it isn't loaded.
+	virtual bool					CanSetupBonesInJob();
+	virtual bool					PrefetchBlendingRules( CStudioHdr *pStudioHdr, float currentTime );
+
 private:
+	void							InitBoneSetupIK( CStudioHdr *pStudioHdr, int boneMask, float currentTime );
+	void							FinishBoneSetup( CStudioHdr *pStudioHdr, Vector pos[], Quaternion q[], const matrix3x4_t &parentTransform, int boneMask, float currentTime );
+	static void						SetupBonesRange( void *pContext, int iFirst, int iLast );
+
 	CBoneList*						RecordBones( CStudioHdr *hdr );
 
 	virtual bool					CalcAttachments();
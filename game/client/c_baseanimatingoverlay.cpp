@@ -284,6 +284,23 @@ void C_BaseAnimatingOverlay::CheckForLayerChanges( CStudioHdr *hdr, float curren
 
 
 
+bool C_BaseAnimatingOverlay::PrefetchBlendingRules( CStudioHdr *hdr, float currentTime )
+{
+	CheckForLayerChanges( hdr, currentTime );
+
+	bool bPrefetched = BaseClass::PrefetchBlendingRules( hdr, currentTime );
+	for ( int i = 0; i < m_AnimOverlay.Count(); i++ )
+	{
+		if ( m_AnimOverlay[i].m_flWeight > 0 && m_AnimOverlay[i].m_nSequence < hdr->GetNumSeq() && 
+			!Studio_PrefetchPose( hdr, m_AnimOverlay[i].m_nSequence ) )
+		{
+			bPrefetched = false;
+		}
+	}
+	return bPrefetched;
+}
+
+
 void C_BaseAnimatingOverlay::AccumulateLayers( CStudioHdr *hdr, Vector pos[], Quaternion q[], float poseparam[], float currentTime, int boneMask )
 {
 	BaseClass::AccumulateLayers( hdr, pos, q, poseparam, currentTime, boneMask );
@@ -315,7 +332,12 @@ void C_BaseAnimatingOverlay::AccumulateLayers( CStudioHdr *hdr, Vector pos[], Qu
 		}
 	}
 
-	CheckForLayerChanges( hdr, currentTime );
+	// CDisableRangeChecks flips a global switch, so SetupBonesForFrame() checks
+	// before its jobs start instead. See PrefetchBlendingRules().
+	if ( ThreadInMainThread() )
+	{
+		CheckForLayerChanges( hdr, currentTime );
+	}
 
 	int nSequences = hdr->GetNumSeq();
 
@@ -352,7 +374,7 @@ void C_BaseAnimatingOverlay::AccumulateLayers( CStudioHdr *hdr, Vector pos[], Qu
 				// if ( m_AnimOverlay[i].m_nSequence != m_iv_AnimOverlay.GetPrev( i )->nSequence )
 				float fCycle = m_AnimOverlay[ i ].m_flCycle;
 
-				fCycle = ClampCycle( fCycle, IsSequenceLooping( m_AnimOverlay[i].m_nSequence ) );
+				fCycle = ClampCycle( fCycle, IsSequenceLooping( hdr, m_AnimOverlay[i].m_nSequence ) );
 
 				if (fWeight > 1)
 					fWeight = 1;
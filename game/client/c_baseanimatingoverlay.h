@@ -37,6 +37,7 @@ public:
 
 	// model specific
 	virtual void	AccumulateLayers( CStudioHdr *hdr, Vector pos[], Quaternion q[], float poseparam[], float currentTime, int boneMask );
+	virtual bool	PrefetchBlendingRules( CStudioHdr *hdr, float currentTime );
 
 	virtual void DoAnimationEvents( CStudioHdr *pStudioHdr );
 
@@ -81,6 +81,7 @@ static ConVar  cl_interpolate( "cl_interpolate", "1.0", FCVAR_USERINFO, "Interpo
 static ConVar  cl_interp	 ( "cl_interp", "0.1", FCVAR_USERINFO | FCVAR_DEMO, "Interpolate object positions starting this many seconds in past", true, 0.01, true, 1.0, cc_cl_interp_changed );  
 static ConVar  cl_interp_npcs( "cl_interp_npcs", "0.0", FCVAR_USERINFO, "Interpolate NPC positions starting this many seconds in past (or cl_interp, if greater)", 0, 0, 0, 0, cc_cl_interp_changed );  
 static ConVar  cl_interp_all( "cl_interp_all", "0", 0, "Disable interpolation list optimizations.", 0, 0, 0, 0, cc_cl_interp_all_changed );
+static ConVar  cl_interp_batch( "cl_interp_batch", "1", 0, "Interpolate the vars of all the entities that need it a type at a time, rather than an entity at a time." );
 //APSFIXME - Temp until I fix
 ConVar  r_drawmodeldecals( "r_drawmodeldecals", IsXbox() ? "0" : "1" );
 extern ConVar	cl_showerror;
@@ -759,6 +760,21 @@ inline int C_BaseEntity::Interp_Interpolate( VarMapping_t *map, float currentTim
 	return bNoMoreChanges;
 }
 
+inline void C_BaseEntity::Interp_AddToBatch( VarMapping_t *map, float currentTime, CInterpolatedVarBatch &batch, int *pNoMoreChanges )
+{
+	*pNoMoreChanges = 1;
+	for ( int i = 0; i < map->m_nInterpolatedEntries; i++ )
+	{
+		VarMapEntry_t *e = &map->m_Entries[ i ];
+
+		if ( !e->m_bNeedsToInterpolate )
+			continue;
+
+		Assert( !( e->watcher->GetType() & EXCLUDE_AUTO_INTERPOLATE ) );
+		batch.Add( e->watcher, e->m_iBatchType, currentTime, &e->m_bNeedsToInterpolate, pNoMoreChanges );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Functions.
 //-----------------------------------------------------------------------------
@@ -2454,8 +2470,20 @@ int CBaseEntity::BaseInterpolatePart1( float &currentTime, Vector &oldOrigin, QA
 {
 	// Don't mess with the world!!!
 	bNoMoreChanges = 1;
-	
 
+	if ( BaseInterpolatePrepare( currentTime, oldOrigin, oldAngles ) == INTERPOLATE_STOP )
+		return INTERPOLATE_STOP;
+
+	bNoMoreChanges = Interp_Interpolate( GetVarMapping(), currentTime );
+	if ( cl_interp_all.GetInt() || (m_EntClientFlags & ENTCLIENTFLAG_ALWAYS_INTERPOLATE) )
+		bNoMoreChanges = 0;
+
+	return INTERPOLATE_CONTINUE;
+}
+
+
+int CBaseEntity::BaseInterpolatePrepare( float &currentTime, Vector &oldOrigin, QAngle &oldAngles )
+{
 	// These get moved to the parent position automatically
 	if ( IsFollowingEntity() || !IsInterpolationEnabled() )
 	{
@@ -2479,10 +2507,6 @@ int CBaseEntity::BaseInterpolatePart1( float &currentTime, Vector &oldOrigin, QA
 	oldOrigin = m_vecOrigin;
 	oldAngles = m_angRotation;
 
-	bNoMoreChanges = Interp_Interpolate( GetVarMapping(), currentTime );
-	if ( cl_interp_all.GetInt() || (m_EntClientFlags & ENTCLIENTFLAG_ALWAYS_INTERPOLATE) )
-		bNoMoreChanges = 0;
-
 	return INTERPOLATE_CONTINUE;
 }
 
@@ -2514,26 +2538,45 @@ bool C_BaseEntity::Interpolate( float currentTime )
 {
 	VPROF( "C_BaseEntity::Interpolate" );
 
-	Vector oldOrigin;
-	QAngle oldAngles;
+	InterpolationBatchState_t state;
+	if ( InterpolateBegin( currentTime, state ) )
+	{
+		state.m_bNoMoreChanges = Interp_Interpolate( GetVarMapping(), state.m_flCurrentTime );
+		InterpolateEnd( state );
+	}
 
-	int bNoMoreChanges;
-	int retVal = BaseInterpolatePart1( currentTime, oldOrigin, oldAngles, bNoMoreChanges );
+	return true;
+}
 
-	// If all the Interpolate() calls returned that their values aren't going to
-	// change anymore, then get us out of the interpolation list.
-	if ( bNoMoreChanges )
-		RemoveFromInterpolationList();
 
-	if ( retVal == INTERPOLATE_STOP )
-		return true;
+bool C_BaseEntity::InterpolateBegin( float currentTime, InterpolationBatchState_t &state )
+{
+	state.m_flCurrentTime = currentTime;
+	state.m_nChangeFlags = 0;
 
-	int nChangeFlags = 0;
-	BaseInterpolatePart2( oldOrigin, oldAngles, nChangeFlags );
+	if ( BaseInterpolatePrepare( state.m_flCurrentTime, state.m_vecOldOrigin, state.m_angOldAngles ) == INTERPOLATE_STOP )
+	{
+		RemoveFromInterpolationList();
+		return false;
+	}
 
 	return true;
 }
 
+
+void C_BaseEntity::InterpolateEnd( InterpolationBatchState_t &state )
+{
+	if ( cl_interp_all.GetInt() || (m_EntClientFlags & ENTCLIENTFLAG_ALWAYS_INTERPOLATE) )
+		state.m_bNoMoreChanges = 0;
+
+	// If all the Interpolate() calls returned that their values aren't going to
+	// change anymore, then get us out of the interpolation list.
+	if ( state.m_bNoMoreChanges )
+		RemoveFromInterpolationList();
+
+	BaseInterpolatePart2( state.m_vecOldOrigin, state.m_angOldAngles, state.m_nChangeFlags );
+}
+
 // force all entries to interpolate (optimization may skip some that are necessary for special effects like ragdolls)
 void C_BaseEntity::ForceAllInterpolate()
 {
@@ -2725,6 +2768,12 @@ void C_BaseEntity::ProcessInterpolatedList()
 {
 	CheckInterpolatedVarParanoidMeasurement();
 
+	if ( cl_interp_batch.GetBool() )
+	{
+		ProcessInterpolatedListBatched();
+		return;
+	}
+
 	// Interpolate the minimal set of entities that need it.
 	int iNext;
 	for ( int iCur=g_InterpolationList.Head(); iCur != g_InterpolationList.InvalidIndex(); iCur=iNext )
@@ -2737,6 +2786,50 @@ void C_BaseEntity::ProcessInterpolatedList()
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: ProcessInterpolatedList(), with the vars of all the entities
+//			interpolated together a type at a time
+//-----------------------------------------------------------------------------
+void C_BaseEntity::ProcessInterpolatedListBatched()
+{
+	static CUtlVector< C_BaseEntity * > s_Entities;
+	static CUtlVector< InterpolationBatchState_t > s_States;
+	static CInterpolatedVarBatch s_Batch;
+
+	// The batch points into the states, so they mustn't move once it has
+	s_Entities.RemoveAll();
+	s_States.SetCount( g_InterpolationList.Count() );
+
+	int iNext;
+	for ( int iCur=g_InterpolationList.Head(); iCur != g_InterpolationList.InvalidIndex(); iCur=iNext )
+	{
+		iNext = g_InterpolationList.Next( iCur );
+		C_BaseEntity *pCur = g_InterpolationList[iCur];
+
+		if ( !pCur->CanInterpolateInBatch() || s_Entities.Count() == s_States.Count() )
+		{
+			pCur->m_bReadyToDraw = pCur->Interpolate( gpGlobals->curtime );
+			continue;
+		}
+
+		InterpolationBatchState_t &state = s_States[ s_Entities.Count() ];
+		pCur->m_bReadyToDraw = true;
+		if ( !pCur->InterpolateBegin( gpGlobals->curtime, state ) )
+			continue;
+
+		pCur->Interp_AddToBatch( pCur->GetVarMapping(), state.m_flCurrentTime, s_Batch, &state.m_bNoMoreChanges );
+		s_Entities.AddToTail( pCur );
+	}
+
+	s_Batch.Interpolate();
+
+	for ( int i = 0; i < s_Entities.Count(); i++ )
+	{
+		s_Entities[i]->InterpolateEnd( s_States[i] );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Add entity to visibile entities list
 //-----------------------------------------------------------------------------
@@ -5695,6 +5788,7 @@ void C_BaseEntity::AddVar( void *data, IInterpolatedVar *watcher, int type, bool
 		map.watcher = watcher;
 		map.type = type;
 		map.m_bNeedsToInterpolate = true;
+		map.m_iBatchType = watcher->GetBatchType();
 		if ( type & EXCLUDE_AUTO_INTERPOLATE )
 		{
 			m_VarMap.m_Entries.AddToTail( map );
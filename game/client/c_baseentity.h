@@ -81,6 +81,7 @@ public:
 												// need Interpolate() called on it anymore.
 	void				*data;
 	IInterpolatedVar	*watcher;
+	int					m_iBatchType;			// watcher->GetBatchType()
 };
 
 struct VarMapping_t
@@ -94,6 +95,17 @@ struct VarMapping_t
 	int m_nInterpolatedEntries;
 };
 
+// What C_BaseEntity::InterpolateBegin() keeps for InterpolateEnd().
+struct InterpolationBatchState_t
+{
+	float	m_flCurrentTime;		// The time the entity's vars are interpolated to
+	Vector	m_vecOldOrigin;
+	QAngle	m_angOldAngles;
+	float	m_flOldCycle;			// C_BaseAnimating's cycle before interpolating
+	int		m_nChangeFlags;
+	int		m_bNoMoreChanges;		// Set to 1 if none of the entity's vars will change again
+};
+
 																	
 
 #define DECLARE_INTERPOLATION
@@ -222,6 +234,9 @@ public:
 	
 	// Returns 1 if there are no more changes (ie: we could call RemoveFromInterpolationList).
 	int								Interp_Interpolate( VarMapping_t *map, float currentTime );
+	// Adds the vars Interp_Interpolate() would interpolate to the batch. *pNoMoreChanges is
+	// what Interp_Interpolate() would return, once the batch has been interpolated.
+	void							Interp_AddToBatch( VarMapping_t *map, float currentTime, CInterpolatedVarBatch &batch, int *pNoMoreChanges );
 	
 	void							Interp_RestoreToLastNetworked( VarMapping_t *map );
 	void							Interp_UpdateInterpolationAmounts( VarMapping_t *map );
@@ -682,6 +697,14 @@ public:
 	// Interpolate the position for rendering
 	virtual bool					Interpolate( float currentTime );
 
+	// Interpolate() in two parts, either side of interpolating the entity's vars, so
+	// ProcessInterpolatedList() can interpolate the vars of every entity a type at a
+	// time. InterpolateBegin() returns false if there's nothing to interpolate.
+	// Entities that override Interpolate() should return false from CanInterpolateInBatch().
+	virtual bool					CanInterpolateInBatch()	{ return true; }
+	virtual bool					InterpolateBegin( float currentTime, InterpolationBatchState_t &state );
+	virtual void					InterpolateEnd( InterpolationBatchState_t &state );
+
 	// reset interpolant optimizations to force stuff to interpolate 
 	void							ForceAllInterpolate();
 	// Did the object move so far that it shouldn't interpolate?
@@ -1115,6 +1138,7 @@ protected:
 	// Interpolate entity
 	static void ProcessTeleportList();
 	static void ProcessInterpolatedList();
+	static void ProcessInterpolatedListBatched();
 	static void CheckInterpolatedVarParanoidMeasurement();
 
 	// overrideable rules if an entity should interpolate
@@ -1143,6 +1167,8 @@ protected:
 	// Returns INTERPOLATE_STOP or INTERPOLATE_CONTINUE.
 	// bNoMoreChanges is set to 1 if you can call RemoveFromInterpolationList on the entity.
 	int BaseInterpolatePart1( float &currentTime, Vector &oldOrigin, QAngle &oldAngles, int &bNoMoreChanges );
+	// Part1 up to interpolating the vars.
+	int BaseInterpolatePrepare( float &currentTime, Vector &oldOrigin, QAngle &oldAngles );
 	void BaseInterpolatePart2( Vector &oldOrigin, QAngle &oldAngles, int nChangeFlags );
 
 
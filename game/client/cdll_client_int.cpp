@@ -85,6 +85,8 @@
 #include "tier2/tier2.h"
 #include "avi/iavi.h"
 #include "hltvcamera.h"
+#include "tier1/keyvaluesview.h"
+#include "bone_setup.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -636,6 +638,13 @@ int CHLClient::Init( CreateInterfaceFn appSystemFactory, CreateInterfaceFn physi
 	if ( CommandLine()->FindParm( "-makedevshots" ) )
 		g_MakingDevShots = true;
 
+	// Keep compiled copies of the text KeyValues files we load, so unchanged
+	// scripts and .res files aren't parsed again on the next run
+	if ( !CommandLine()->FindParm( "-nokvcache" ) )
+	{
+		KeyValuesFileCache()->Init( filesystem, "cache/keyvalues_client.bin" );
+	}
+
 #ifndef _XBOX
 	// Not fatal if the material system stub isn't around.
 	materials_stub = (IMaterialSystemStub*)appSystemFactory( MATERIAL_SYSTEM_STUB_INTERFACE_VERSION, NULL );
@@ -772,6 +781,7 @@ void CHLClient::Shutdown( void )
 	VGui_Shutdown();
 	
 	ClearKeyValuesCache();
+	KeyValuesFileCache()->Shutdown();
 
 	g_pMatSystemSurface = NULL;
 
@@ -1136,6 +1146,9 @@ void CHLClient::LevelShutdown( void )
 	// Now do the post-entity shutdown of all systems
 	IGameSystem::LevelShutdownPostEntityAllSystems();
 
+	// The level's models may be unloaded after this
+	Studio_FlushAnimCaches();
+
 	view->LevelShutdown();
 
 	tempents->LevelShutdown();
@@ -1514,6 +1527,10 @@ void OnRenderStart()
 	// their positions so they're in the leaf system correctly.
 	C_BaseEntity::CalcAimEntPositions();
 
+	// Everything is where it will be drawn, so set up the bones that were asked for
+	// last frame before rendering asks for them one at a time
+	C_BaseAnimating::SetupBonesForFrame();
+
 	// For entities marked for recording, post bone messages to IToolSystems
 	if ( ToolsEnabled() )
 		C_BaseEntity::ToolRecordEntities();
@@ -0,0 +1,165 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: The client's shared job pool. See clientjobs.h.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cbase.h"
+#include "clientjobs.h"
+#include "igamesystem.h"
+#include "bone_setup.h"
+#include "tier1/jobthread.h"
+#include "tier1/mempool.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+#define MAX_PARALLEL_FOR_JOBS	32
+
+static void CL_JobThreadsChanged( ConVar *var, char const *pOldString );
+ConVar cl_jobthreads( "cl_jobthreads", "-1", 0, "Worker threads for parallel client work. -1 uses one per logical processor, less one for the main thread. 0 runs everything on the main thread.", CL_JobThreadsChanged );
+
+
+class CClientJobs : public CAutoGameSystem
+{
+public:
+	CClientJobs() : CAutoGameSystem( "CClientJobs" ) {}
+
+	virtual bool Init()
+	{
+		Restart();
+		return true;
+	}
+
+	virtual void Shutdown()
+	{
+		m_Pool.Stop();
+		Studio_FreeBoneSetupScratch();
+	}
+
+	void Restart()
+	{
+		// The threads that are going away leave their scratch bones behind
+		m_Pool.Stop();
+		Studio_FreeBoneSetupScratch();
+
+		int nThreads = cl_jobthreads.GetInt();
+		if ( nThreads < 0 )
+		{
+			nThreads = GetCPUInformation().m_nLogicalProcessors - 1;
+		}
+		if ( nThreads > 0 )
+		{
+			m_Pool.Start( nThreads );
+		}
+	}
+
+	CAsyncJobPool *GetPool()
+	{
+		return m_Pool.IsRunning() ? &m_Pool : NULL;
+	}
+
+private:
+	CAsyncJobPool m_Pool;
+};
+
+static CClientJobs g_ClientJobs;
+
+
+static void CL_JobThreadsChanged( ConVar *var, char const *pOldString )
+{
+	g_ClientJobs.Restart();
+}
+
+
+CAsyncJobPool *ClientJobPool()
+{
+	return g_ClientJobs.GetPool();
+}
+
+
+int ClientJobThreadCount()
+{
+	CAsyncJobPool *pPool = ClientJobPool();
+	return pPool ? pPool->NumThreads() + 1 : 1;
+}
+
+
+//-----------------------------------------------------------------------------
+// One range of a ClientJobs_ParallelFor() loop. Created on the calling thread,
+// but whichever of it and the worker lets go last frees it.
+//-----------------------------------------------------------------------------
+class CClientRangeJob : public CAsyncJob
+{
+public:
+	CClientRangeJob( ClientJobRangeFn_t pfnRange, void *pContext, int iFirst, int iLast )
+	  : m_pfnRange( pfnRange ),
+		m_pContext( pContext ),
+		m_iFirst( iFirst ),
+		m_iLast( iLast )
+	{
+	}
+
+private:
+	virtual AsyncStatus_t DoExecute()
+	{
+		(*m_pfnRange)( m_pContext, m_iFirst, m_iLast );
+		return ASYNC_OK;
+	}
+
+	ClientJobRangeFn_t	m_pfnRange;
+	void				*m_pContext;
+	int					m_iFirst;
+	int					m_iLast;
+
+	DECLARE_FIXEDSIZE_ALLOCATOR_MT( CClientRangeJob );
+};
+
+DEFINE_FIXEDSIZE_ALLOCATOR_MT( CClientRangeJob, MAX_PARALLEL_FOR_JOBS, CMemoryPool::GROW_FAST );
+
+
+void ClientJobs_ParallelFor( int nItems, int nMinPerJob, ClientJobRangeFn_t pfnRange, void *pContext, int nAlign )
+{
+	if ( nItems <= 0 )
+		return;
+
+	CAsyncJobPool *pPool = ClientJobPool();
+	int nJobs = min( ClientJobThreadCount(), nItems / max( nMinPerJob, 1 ) );
+	nJobs = min( nJobs, MAX_PARALLEL_FOR_JOBS );
+	if ( !pPool || nJobs <= 1 )
+	{
+		(*pfnRange)( pContext, 0, nItems );
+		return;
+	}
+
+	int nPerJob = ( nItems + nJobs - 1 ) / nJobs;
+	if ( nAlign > 1 )
+	{
+		nPerJob = AlignValue( nPerJob, nAlign );
+	}
+
+	CClientRangeJob *jobs[MAX_PARALLEL_FOR_JOBS];
+	int nQueued = 0;
+	for ( int iFirst = nPerJob; iFirst < nItems; iFirst += nPerJob )
+	{
+		jobs[nQueued] = new CClientRangeJob( pfnRange, pContext, iFirst, min( iFirst + nPerJob, nItems ) );
+		pPool->AddJob( jobs[nQueued] );
+		nQueued++;
+	}
+
+	(*pfnRange)( pContext, 0, min( nPerJob, nItems ) );
+
+	// Wait for our own ranges only. WaitForJob() would run whatever else is
+	// queued on this thread, in the middle of the caller's work.
+	for ( int i = 0; i < nQueued; i++ )
+	{
+		while ( !jobs[i]->IsFinished() )
+		{
+			ThreadPause();
+			ThreadSleep( 0 );
+		}
+		jobs[i]->Release();
+	}
+}
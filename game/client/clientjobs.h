@@ -0,0 +1,41 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: The client's shared job pool, and a helper that splits a loop
+//			across it.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef CLIENTJOBS_H
+#define CLIENTJOBS_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+class CAsyncJobPool;
+
+// The pool shared by client systems. NULL when cl_jobthreads is 0 or the
+// machine has a single logical processor.
+CAsyncJobPool *ClientJobPool();
+
+// Number of threads a parallel loop can use, including the calling thread.
+int ClientJobThreadCount();
+
+//-----------------------------------------------------------------------------
+// Calls pfnRange( pContext, iFirst, iLast ) on consecutive ranges that cover
+// [0, nItems), with at least nMinPerJob items in each range but the last.
+// The calling thread runs the first range itself and returns once all of
+// them are done, without picking up other jobs from the pool while it waits.
+// Ranges run concurrently, so pfnRange may only write state that belongs to
+// its own range.
+//
+// Range boundaries fall on multiples of nAlign items (a power of two), so
+// per-item arrays of bytes or bits don't share cache lines between ranges.
+// Loops over a few expensive items should pass 1.
+//-----------------------------------------------------------------------------
+typedef void (*ClientJobRangeFn_t)( void *pContext, int iFirst, int iLast );
+
+void ClientJobs_ParallelFor( int nItems, int nMinPerJob, ClientJobRangeFn_t pfnRange, void *pContext, int nAlign = 64 );
+
+#endif // CLIENTJOBS_H
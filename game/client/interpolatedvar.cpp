@@ -6,6 +6,7 @@
 
 #include "cbase.h"
 #include "interpolatedvar.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -28,3 +29,196 @@ float g_flLastPacketTimestamp = 0;
 
 ConVar cl_extrapolate_amount( "cl_extrapolate_amount", "0.25", FCVAR_CHEAT, "Set how many seconds the client will extrapolate entities for." );
 
+
+void CInterpolatedVarBatch::Interpolate()
+{
+	CInterpolatedVarArrayBase< float >::InterpolateBatch( m_Items[INTERPOLATE_BATCH_FLOAT].Base(), m_Items[INTERPOLATE_BATCH_FLOAT].Count() );
+	CInterpolatedVarArrayBase< Vector >::InterpolateBatch( m_Items[INTERPOLATE_BATCH_VECTOR].Base(), m_Items[INTERPOLATE_BATCH_VECTOR].Count() );
+	CInterpolatedVarArrayBase< QAngle >::InterpolateBatch( m_Items[INTERPOLATE_BATCH_QANGLE].Base(), m_Items[INTERPOLATE_BATCH_QANGLE].Count() );
+
+	CUtlVector< InterpolatedVarBatchItem_t > &others = m_Items[INTERPOLATE_BATCH_OTHER];
+	for ( int i = 0; i < others.Count(); i++ )
+	{
+		const InterpolatedVarBatchItem_t &item = others[i];
+		if ( item.m_pVar->Interpolate( item.m_flCurrentTime ) )
+			*item.m_pNeedsToInterpolate = false;
+		else
+			*item.m_pNoMoreChanges = 0;
+	}
+
+	for ( int iType = 0; iType < NUM_INTERPOLATE_BATCH_TYPES; iType++ )
+	{
+		m_Items[iType].RemoveAll();
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Benchmark: interpolating a crowd of entities' vars one virtual call at a
+// time, the way C_BaseEntity::Interpolate() does, and a type at a time with
+// CInterpolatedVarBatch, the way C_BaseEntity::ProcessInterpolatedList() does
+//-----------------------------------------------------------------------------
+#define BENCH_INTERP_POSES	24
+
+struct BenchInterpEntity_t
+{
+	Vector		m_vecOrigin;
+	QAngle		m_angRotation;
+	float		m_flPoses[BENCH_INTERP_POSES];
+	float		m_flCycle;
+
+	CInterpolatedVar< Vector >							m_iv_vecOrigin;
+	CInterpolatedVar< QAngle >							m_iv_angRotation;
+	CInterpolatedVarArray< float, BENCH_INTERP_POSES >	m_iv_flPoses;
+	CInterpolatedVar< float >							m_iv_flCycle;
+};
+
+static void BenchInterpNetworkUpdate( BenchInterpEntity_t *pEntities, int nEntities, int iUpdate, float flTime )
+{
+	for ( int i = 0; i < nEntities; i++ )
+	{
+		BenchInterpEntity_t &ent = pEntities[i];
+		float flPhase = iUpdate * 0.1f + i;
+		ent.m_vecOrigin.Init( i * 64.0f + 100.0f * sinf( flPhase ), 100.0f * cosf( flPhase ), 8.0f * sinf( flPhase * 3.0f ) );
+		ent.m_angRotation.Init( 10.0f * sinf( flPhase ), anglemod( flPhase * 20.0f ), 0.0f );
+		for ( int j = 0; j < BENCH_INTERP_POSES; j++ )
+		{
+			ent.m_flPoses[j] = 0.5f + 0.5f * sinf( flPhase + j );
+		}
+		ent.m_flCycle = fmodf( flPhase * 0.25f, 1.0f );
+
+		ent.m_iv_vecOrigin.NoteChanged( flTime );
+		ent.m_iv_angRotation.NoteChanged( flTime );
+		ent.m_iv_flPoses.NoteChanged( flTime );
+		ent.m_iv_flCycle.NoteChanged( flTime );
+	}
+}
+
+static float BenchInterpMaxDiff( const float *pLeft, const float *pRight, int nCount )
+{
+	float flMaxDiff = 0;
+	for ( int i = 0; i < nCount; i++ )
+	{
+		flMaxDiff = max( flMaxDiff, fabsf( pLeft[i] - pRight[i] ) );
+	}
+	return flMaxDiff;
+}
+
+CON_COMMAND_F( cl_bench_interpolate, "Times interpolating a crowd of synthetic entities' origin, angles, pose parameters and cycle, one var at a time and a type at a time, and checks both give the same values. Usage: cl_bench_interpolate [entities] [frames]", FCVAR_CHEAT )
+{
+	int nEntities = max( 1, engine->Cmd_Argc() > 1 ? atoi( engine->Cmd_Argv( 1 ) ) : 500 );
+	int nFrames = max( 10, engine->Cmd_Argc() > 2 ? atoi( engine->Cmd_Argv( 2 ) ) : 2000 );
+
+	const float flFrameTime = 0.01f;		// 100 fps
+	const int nFramesPerUpdate = 5;			// 20 updates a second
+	const float flInterpAmount = 0.1f;
+
+	BenchInterpEntity_t *pEntities = new BenchInterpEntity_t[nEntities];
+
+	CUtlVector< IInterpolatedVar * > vars;
+	int i;
+	for ( i = 0; i < nEntities; i++ )
+	{
+		BenchInterpEntity_t &ent = pEntities[i];
+		ent.m_iv_vecOrigin.Setup( &ent.m_vecOrigin, LATCH_SIMULATION_VAR );
+		ent.m_iv_angRotation.Setup( &ent.m_angRotation, LATCH_SIMULATION_VAR );
+		ent.m_iv_flPoses.Setup( ent.m_flPoses, LATCH_ANIMATION_VAR );
+		ent.m_iv_flCycle.Setup( &ent.m_flCycle, LATCH_ANIMATION_VAR );
+
+		vars.AddToTail( &ent.m_iv_vecOrigin );
+		vars.AddToTail( &ent.m_iv_angRotation );
+		vars.AddToTail( &ent.m_iv_flPoses );
+		vars.AddToTail( &ent.m_iv_flCycle );
+	}
+	// C_BaseEntity looks up each var's batch type once, when the var is added
+	CUtlVector< int > batchTypes;
+	for ( i = 0; i < vars.Count(); i++ )
+	{
+		vars[i]->SetInterpolationAmount( flInterpAmount );
+		batchTypes.AddToTail( vars[i]->GetBatchType() );
+	}
+
+	// The history is pruned against the client clock, so run it on the synthetic one
+	float flSavedCurtime = gpGlobals->curtime;
+	float flStartTime = max( flSavedCurtime, 1.0f );
+
+	// Every float either pass writes, so the two can be compared
+	const int nFloatsPerEntity = 3 + 3 + BENCH_INTERP_POSES + 1;
+	CUtlVector< float > virtualValues;
+	virtualValues.SetCount( nEntities * nFloatsPerEntity );
+
+	CInterpolatedVarBatch batch;
+	unsigned short bNeedsToInterpolate;
+	int bNoMoreChanges;
+
+	CFastTimer timer;
+	double flVirtual = 0;
+	double flBatch = 0;
+	float flMaxDiff = 0;
+	int nHistorySize = 0;
+
+	for ( int iFrame = 0; iFrame < nFrames; iFrame++ )
+	{
+		float flTime = flStartTime + iFrame * flFrameTime;
+		gpGlobals->curtime = flTime;
+
+		if ( ( iFrame % nFramesPerUpdate ) == 0 )
+		{
+			BenchInterpNetworkUpdate( pEntities, nEntities, iFrame / nFramesPerUpdate, flTime );
+		}
+
+		timer.Start();
+		for ( i = 0; i < vars.Count(); i++ )
+		{
+			vars[i]->Interpolate( flTime );
+		}
+		timer.End();
+		flVirtual += timer.GetDuration().GetSeconds();
+
+		float *pValues = virtualValues.Base();
+		for ( i = 0; i < nEntities; i++ )
+		{
+			BenchInterpEntity_t &ent = pEntities[i];
+			memcpy( pValues, ent.m_vecOrigin.Base(), 3 * sizeof( float ) );
+			memcpy( pValues + 3, ent.m_angRotation.Base(), 3 * sizeof( float ) );
+			memcpy( pValues + 6, ent.m_flPoses, BENCH_INTERP_POSES * sizeof( float ) );
+			pValues[nFloatsPerEntity - 1] = ent.m_flCycle;
+			pValues += nFloatsPerEntity;
+		}
+
+		// Collecting the vars is part of the batched pass's cost
+		timer.Start();
+		for ( i = 0; i < vars.Count(); i++ )
+		{
+			batch.Add( vars[i], batchTypes[i], flTime, &bNeedsToInterpolate, &bNoMoreChanges );
+		}
+		batch.Interpolate();
+		timer.End();
+		flBatch += timer.GetDuration().GetSeconds();
+
+		pValues = virtualValues.Base();
+		for ( i = 0; i < nEntities; i++ )
+		{
+			BenchInterpEntity_t &ent = pEntities[i];
+			flMaxDiff = max( flMaxDiff, BenchInterpMaxDiff( pValues, ent.m_vecOrigin.Base(), 3 ) );
+			flMaxDiff = max( flMaxDiff, BenchInterpMaxDiff( pValues + 3, ent.m_angRotation.Base(), 3 ) );
+			flMaxDiff = max( flMaxDiff, BenchInterpMaxDiff( pValues + 6, ent.m_flPoses, BENCH_INTERP_POSES ) );
+			flMaxDiff = max( flMaxDiff, BenchInterpMaxDiff( pValues + nFloatsPerEntity - 1, &ent.m_flCycle, 1 ) );
+			pValues += nFloatsPerEntity;
+		}
+	}
+
+	for ( i = 0; i < nEntities; i++ )
+	{
+		nHistorySize = max( nHistorySize, pEntities[i].m_iv_flPoses.GetHistorySize() );
+	}
+
+	gpGlobals->curtime = flSavedCurtime;
+	delete [] pEntities;
+
+	double flCalls = (double)vars.Count() * nFrames;
+	Msg( "%d entities, %d vars, %d frames, history holds %d samples\n", nEntities, vars.Count(), nFrames, nHistorySize );
+	Msg( "  one at a time: %8.3f ms/frame  %6.1f ns/var\n", flVirtual * 1000.0 / nFrames, flVirtual * 1e9 / flCalls );
+	Msg( "  by type:       %8.3f ms/frame  %6.1f ns/var  (%.2fx)\n", flBatch * 1000.0 / nFrames, flBatch * 1e9 / flCalls, flBatch > 0 ? flVirtual / flBatch : 0.0 );
+	Msg( "  max difference %g\n", flMaxDiff );
+}
@@ -10,17 +10,17 @@
 #pragma once
 #endif
 
-#include "tier1/utllinkedlist.h"
 #include "rangecheckedvar.h"
 #include "lerp_functions.h"
 #include "animationlayer.h"
 #include "convar.h"
+#include "utlvector.h"
 
 
 #include "tier0/memdbgon.h"
 
 #define COMPARE_HISTORY(a,b) \
-	( memcmp( m_VarHistory[a].value, m_VarHistory[b].value, sizeof(Type)*m_nMaxCount ) == 0 ) 			
+	( memcmp( HistoryEntry(a).value, HistoryEntry(b).value, sizeof(Type)*m_nMaxCount ) == 0 ) 			
 
 // Define this to have it measure whether or not the interpolated entity list
 // is accurate.
@@ -42,6 +42,8 @@
 													// in the past from your last call and be able to 
 													// get an interpolated value.
 
+#define MIN_INTERPOLATION_HISTORY_SIZE	8			// Samples each var's history starts with room for
+
 // this global keeps the last known server packet tick (to avoid calling engine->GetLastTimestamp() all the time)
 extern float g_flLastPacketTimestamp;
 
@@ -144,6 +146,18 @@ inline QAngle ExtrapolateInterpolatedVarType( const QAngle &oldVal, const QAngle
 }
 
 
+// Vars of these types are interpolated a type at a time by CInterpolatedVarBatch
+enum
+{
+	INTERPOLATE_BATCH_FLOAT=0,
+	INTERPOLATE_BATCH_VECTOR,
+	INTERPOLATE_BATCH_QANGLE,
+	INTERPOLATE_BATCH_OTHER,			// interpolated through IInterpolatedVar
+
+	NUM_INTERPOLATE_BATCH_TYPES
+};
+
+
 // -------------------------------------------------------------------------------------------------------------- //
 // IInterpolatedVar interface.
 // -------------------------------------------------------------------------------------------------------------- //
@@ -169,9 +183,54 @@ public:
 
 	virtual const char *GetDebugName() = 0;
 	virtual void SetDebugName( const char* pName )	= 0;
+
+	// Which batch of CInterpolatedVarBatch the var goes in.
+	virtual int GetBatchType() const { return INTERPOLATE_BATCH_OTHER; }
 };
 
 
+// -------------------------------------------------------------------------------------------------------------- //
+// CInterpolatedVarBatch - interpolates vars a type at a time.
+// -------------------------------------------------------------------------------------------------------------- //
+
+template< typename Type > struct InterpolatedVarBatchType			{ enum { value = INTERPOLATE_BATCH_OTHER }; };
+template<> struct InterpolatedVarBatchType< float >					{ enum { value = INTERPOLATE_BATCH_FLOAT }; };
+template<> struct InterpolatedVarBatchType< Vector >				{ enum { value = INTERPOLATE_BATCH_VECTOR }; };
+template<> struct InterpolatedVarBatchType< QAngle >				{ enum { value = INTERPOLATE_BATCH_QANGLE }; };
+
+struct InterpolatedVarBatchItem_t
+{
+	IInterpolatedVar	*m_pVar;
+	float				m_flCurrentTime;
+	unsigned short		*m_pNeedsToInterpolate;		// cleared if the var won't change again
+	int					*m_pNoMoreChanges;			// cleared if it will
+};
+
+// Collects vars from any number of entities, then interpolates all the vars of
+// a type together, without a virtual call per var.
+class CInterpolatedVarBatch
+{
+public:
+	void Add( IInterpolatedVar *pVar, int iBatchType, float currentTime, unsigned short *pNeedsToInterpolate, int *pNoMoreChanges );
+
+	// Interpolates everything added since the last call.
+	void Interpolate();
+
+private:
+	CUtlVector< InterpolatedVarBatchItem_t > m_Items[NUM_INTERPOLATE_BATCH_TYPES];
+};
+
+inline void CInterpolatedVarBatch::Add( IInterpolatedVar *pVar, int iBatchType, float currentTime, unsigned short *pNeedsToInterpolate, int *pNoMoreChanges )
+{
+	Assert( iBatchType >= 0 && iBatchType < NUM_INTERPOLATE_BATCH_TYPES );
+	InterpolatedVarBatchItem_t &item = m_Items[iBatchType][ m_Items[iBatchType].AddToTail() ];
+	item.m_pVar = pVar;
+	item.m_flCurrentTime = currentTime;
+	item.m_pNeedsToInterpolate = pNeedsToInterpolate;
+	item.m_pNoMoreChanges = pNoMoreChanges;
+}
+
+
 // -------------------------------------------------------------------------------------------------------------- //
 // CInterpolatedVarArrayBase - the main implementation of IInterpolatedVar.
 // -------------------------------------------------------------------------------------------------------------- //
@@ -198,6 +257,7 @@ public:
 	virtual void RestoreToLastNetworked();
 	virtual void Copy( IInterpolatedVar *pInSrc );
 	virtual const char *GetDebugName() { return m_pDebugName; }
+	virtual int GetBatchType() const { return InterpolatedVarBatchType< Type >::value; }
 
 
 public:
@@ -206,6 +266,9 @@ public:
 	bool NoteChanged( float changetime, float interpolation_amount );
 	int Interpolate( float currentTime, float interpolation_amount );
 
+	// Interpolates vars of this type that CInterpolatedVarBatch collected.
+	static void InterpolateBatch( const InterpolatedVarBatchItem_t *pItems, int nItems );
+
 	void GetDerivative( Type *pOut, float currentTime );
 	void GetDerivative_SmoothVelocity( Type *pOut, float currentTime );	// See notes on ::Derivative_HermiteLinearVelocity for info.
 
@@ -229,6 +292,9 @@ public:
 	// Get the time of the oldest entry.
 	float GetOldestEntry();
 
+	// Number of samples the history has room for before it has to grow.
+	int GetHistorySize() const { return m_nHistorySize; }
+
 	// set a debug name (if not provided by constructor)
 	void	SetDebugName(const char *pName ) { m_pDebugName = pName; }
 
@@ -247,16 +313,16 @@ protected:
 		Type *		value;
 	};
 
-	typedef CUtlPtrLinkedList< CInterpolatedVarEntry > CVarHistory;
 	friend class CInterpolationInfo;
 
+	// Indices are into the history, newest first. -1 is invalid.
 	class CInterpolationInfo
 	{
 	public:
 		bool m_bHermite;
-		typename CInterpolatedVarArrayBase::CVarHistory::IndexType_t oldest;	// Only set if using hermite.
-		typename CInterpolatedVarArrayBase::CVarHistory::IndexType_t older;
-		typename CInterpolatedVarArrayBase::CVarHistory::IndexType_t newer;
+		int oldest;	// Only set if using hermite.
+		int older;
+		int newer;
 		float frac;
 	};
 
@@ -266,6 +332,21 @@ protected:
 	void RemoveOldEntries( float oldesttime );
 	void RemoveEntriesPreviousTo( float flTime );
 
+	// The history is a ring of samples, newest first, whose values live in
+	// one block allocated with it. Sample i of the history is in slot
+	// ( m_iHistoryHead + i ) & ( m_nHistorySize - 1 ), and the slots past the
+	// oldest sample keep the value arrays the next samples will use.
+	int HistorySlot( int i ) const { return ( m_iHistoryHead + i ) & ( m_nHistorySize - 1 ); }
+	CInterpolatedVarEntry &HistoryEntry( int i ) { return m_pHistory[ HistorySlot( i ) ]; }
+	const CInterpolatedVarEntry &HistoryEntry( int i ) const { return m_pHistory[ HistorySlot( i ) ]; }
+	void ReserveHistory( int nSamples );
+	void FreeHistory();
+
+	// The first sample whose change time is at or before flTime, or the sample count if there's none.
+	int FindSampleAtOrBefore( float flTime ) const;
+	// The first sample whose change time is before flTime, or the sample count if there's none.
+	int FindSampleBefore( float flTime ) const;
+
 	bool GetInterpolationInfo( 
 		CInterpolationInfo *pInfo,
 		float currentTime, 
@@ -310,7 +391,11 @@ protected:
 protected:
 	// The underlying data element
 	Type								*m_pValue;
-	CVarHistory							m_VarHistory;
+	CInterpolatedVarEntry				*m_pHistory;
+	Type								*m_pHistoryValues;		// m_nMaxCount values for each slot of m_pHistory
+	unsigned short						m_iHistoryHead;			// Slot of the newest sample
+	unsigned short						m_nHistoryCount;
+	unsigned short						m_nHistorySize;			// A power of two, or 0 until the first sample
 	// Store networked values so when we latch we can detect which values were changed via networking
 	Type *								m_LastNetworkedValue;
 	float								m_LastNetworkedTime;
@@ -325,10 +410,13 @@ protected:
 template< typename Type > 
 inline CInterpolatedVarArrayBase<Type>::CInterpolatedVarArrayBase( const char *pDebugName )
 {
-	COMPILE_TIME_ASSERT( sizeof(CVarHistory::IndexType_t) == sizeof(int) );
-
 	m_pDebugName = pDebugName;
 	m_pValue = NULL;
+	m_pHistory = NULL;
+	m_pHistoryValues = NULL;
+	m_iHistoryHead = 0;
+	m_nHistoryCount = 0;
+	m_nHistorySize = 0;
 	m_fType = LATCH_ANIMATION_VAR;
 	m_InterpolationAmount = 0.0f;
 	m_nMaxCount = 0;
@@ -340,7 +428,7 @@ inline CInterpolatedVarArrayBase<Type>::CInterpolatedVarArrayBase( const char *p
 template< typename Type > 
 inline CInterpolatedVarArrayBase<Type>::~CInterpolatedVarArrayBase()
 {
-	ClearHistory();
+	FreeHistory();
 	delete [] m_bLooping;
 	delete [] m_LastNetworkedValue;
 }
@@ -356,6 +444,12 @@ template< typename Type >
 inline void CInterpolatedVarArrayBase<Type>::SetInterpolationAmount( float seconds )
 {
 	m_InterpolationAmount = seconds;
+
+	// Make room for a window's worth of updates at the tick rate, plus the three samples that are always kept
+	if ( m_nHistorySize && gpGlobals->interval_per_tick > 0.0f )
+	{
+		ReserveHistory( (int)( ( seconds + EXTRA_INTERPOLATION_HISTORY_STORED ) / gpGlobals->interval_per_tick ) + 4 );
+	}
 }
 
 template< typename Type > 
@@ -373,10 +467,9 @@ inline bool CInterpolatedVarArrayBase<Type>::NoteChanged( float changetime, floa
 	// This is a big optimization where it can potentially avoid expensive interpolation
 	// involving this variable if it didn't get an actual new value in here.
 	bool bRet = true;
-	CVarHistory::IndexType_t iHead = m_VarHistory.Head();
 
-	if ( iHead != CVarHistory::InvalidIndex() && 
-		 memcmp( m_pValue, m_VarHistory[iHead].value, sizeof( Type ) * m_nMaxCount ) == 0 )
+	if ( m_nHistoryCount && 
+		 memcmp( m_pValue, HistoryEntry( 0 ).value, sizeof( Type ) * m_nMaxCount ) == 0 )
 	{
 		bRet = false;
 	}
@@ -411,70 +504,114 @@ inline void CInterpolatedVarArrayBase<Type>::RestoreToLastNetworked()
 template< typename Type > 
 inline void CInterpolatedVarArrayBase<Type>::ClearHistory()
 {
-	CVarHistory::IndexType_t i = m_VarHistory.Head();
-	while ( i != CVarHistory::InvalidIndex() )
+	m_iHistoryHead = 0;
+	m_nHistoryCount = 0;
+}
+
+template< typename Type > 
+inline void CInterpolatedVarArrayBase<Type>::FreeHistory()
+{
+	delete [] m_pHistory;
+	delete [] m_pHistoryValues;
+	m_pHistory = NULL;
+	m_pHistoryValues = NULL;
+	m_iHistoryHead = 0;
+	m_nHistoryCount = 0;
+	m_nHistorySize = 0;
+}
+
+template< typename Type > 
+inline void CInterpolatedVarArrayBase<Type>::ReserveHistory( int nSamples )
+{
+	if ( nSamples <= m_nHistorySize )
+		return;
+
+	MEM_ALLOC_CREDIT_CLASS();
+
+	int nSize = max( (int)m_nHistorySize, MIN_INTERPOLATION_HISTORY_SIZE );
+	while ( nSize < nSamples )
 	{
-		delete [] m_VarHistory[i].value;
-		i = m_VarHistory.Next( i );
+		nSize *= 2;
 	}
-	m_VarHistory.RemoveAll();
+	Assert( nSize <= 0x8000 );
+
+	// Move the samples to the start of the new ring, in order
+	CInterpolatedVarEntry *pHistory = new CInterpolatedVarEntry[nSize];
+	Type *pValues = new Type[nSize * m_nMaxCount];
+	for ( int i = 0; i < nSize; i++ )
+	{
+		pHistory[i].value = &pValues[i * m_nMaxCount];
+		if ( i < m_nHistoryCount )
+		{
+			const CInterpolatedVarEntry &entry = HistoryEntry( i );
+			pHistory[i].changetime = entry.changetime;
+			memcpy( pHistory[i].value, entry.value, m_nMaxCount * sizeof( Type ) );
+		}
+	}
+
+	delete [] m_pHistory;
+	delete [] m_pHistoryValues;
+	m_pHistory = pHistory;
+	m_pHistoryValues = pValues;
+	m_iHistoryHead = 0;
+	m_nHistorySize = nSize;
 }
 
 template< typename Type > 
 inline void CInterpolatedVarArrayBase<Type>::AddToHead( float changeTime, const Type* values, bool bFlushNewer )
 {
-	MEM_ALLOC_CREDIT_CLASS();
-	CVarHistory::IndexType_t newslot;
+	int insertSpot;
 	
 	if ( bFlushNewer )
 	{
 		// Get rid of anything that has a timestamp after this sample. The server might have
 		// corrected our clock and moved us back, so our current changeTime is less than a 
 		// changeTime we added samples during previously.
-		CVarHistory::IndexType_t insertSpot = m_VarHistory.Head();
-		while ( insertSpot != CVarHistory::InvalidIndex() )
+		while ( m_nHistoryCount && (HistoryEntry( 0 ).changetime+0.0001f) >= changeTime )
 		{
-			CVarHistory::IndexType_t next = m_VarHistory.Next( insertSpot );
-			CInterpolatedVarEntry *check = &m_VarHistory[ insertSpot ];
-			if ( (check->changetime+0.0001f) >= changeTime )
-			{
-				delete [] m_VarHistory[insertSpot].value;
-				m_VarHistory.Remove( insertSpot );
-			}
-			else
-			{
-				break;
-			}
-			insertSpot = next;
+			m_iHistoryHead = HistorySlot( 1 );
+			m_nHistoryCount--;
 		}
 
-		newslot = m_VarHistory.AddToHead();
+		insertSpot = 0;
 	}
 	else
 	{
-		CVarHistory::IndexType_t insertSpot = m_VarHistory.Head();
-		while ( insertSpot != CVarHistory::InvalidIndex() )
-		{
-			CInterpolatedVarEntry *check = &m_VarHistory[ insertSpot ];
-			if ( check->changetime <= changeTime )
-				break;
-
-			insertSpot = m_VarHistory.Next( insertSpot );
-		}
+		insertSpot = FindSampleAtOrBefore( changeTime );
+	}
 
-		if ( insertSpot == CVarHistory::InvalidIndex() )
+	if ( m_nHistoryCount == m_nHistorySize )
+	{
+		// Starts out sized for the interpolation window, like SetInterpolationAmount() does
+		int nSamples = m_nHistoryCount + 1;
+		if ( !m_nHistorySize && gpGlobals->interval_per_tick > 0.0f )
 		{
-			newslot = m_VarHistory.AddToTail();
+			nSamples = max( nSamples, (int)( ( m_InterpolationAmount + EXTRA_INTERPOLATION_HISTORY_STORED ) / gpGlobals->interval_per_tick ) + 4 );
 		}
-		else
+		ReserveHistory( nSamples );
+	}
+
+	CInterpolatedVarEntry *e;
+	if ( insertSpot == 0 )
+	{
+		m_iHistoryHead = HistorySlot( -1 );
+		m_nHistoryCount++;
+		e = &HistoryEntry( 0 );
+	}
+	else
+	{
+		// Shift the older samples back a slot, into the first free one
+		CInterpolatedVarEntry spare = HistoryEntry( m_nHistoryCount );
+		for ( int i = m_nHistoryCount; i > insertSpot; i-- )
 		{
-			newslot = m_VarHistory.InsertBefore( insertSpot );
+			HistoryEntry( i ) = HistoryEntry( i - 1 );
 		}
+		m_nHistoryCount++;
+		e = &HistoryEntry( insertSpot );
+		*e = spare;
 	}
 
-	CInterpolatedVarEntry *e = &m_VarHistory[ newslot ];
 	e->changetime	= changeTime;
-	e->value = new Type[m_nMaxCount];
 	memcpy( e->value, values, m_nMaxCount*sizeof(Type) );
 }
 
@@ -497,37 +634,65 @@ inline void CInterpolatedVarArrayBase<Type>::Reset()
 template< typename Type > 
 inline float CInterpolatedVarArrayBase<Type>::GetOldestEntry()
 {
-	float lastVal = 0;
-	for ( CVarHistory::IndexType_t i = m_VarHistory.Head(); i != CVarHistory::InvalidIndex(); i = m_VarHistory.Next( i ) )
+	if ( !m_nHistoryCount )
+		return 0;
+
+	return HistoryEntry( m_nHistoryCount - 1 ).changetime;
+}
+
+
+template< typename Type > 
+inline int CInterpolatedVarArrayBase<Type>::FindSampleAtOrBefore( float flTime ) const
+{
+	// Change times only decrease from the newest sample to the oldest
+	int lo = 0;
+	int hi = m_nHistoryCount;
+	while ( lo < hi )
 	{
-		lastVal = m_VarHistory[i].changetime;
+		int mid = ( lo + hi ) >> 1;
+		if ( HistoryEntry( mid ).changetime <= flTime )
+		{
+			hi = mid;
+		}
+		else
+		{
+			lo = mid + 1;
+		}
 	}
-	return lastVal;
+	return lo;
 }
 
 
 template< typename Type > 
-inline void CInterpolatedVarArrayBase<Type>::RemoveOldEntries( float oldesttime )
+inline int CInterpolatedVarArrayBase<Type>::FindSampleBefore( float flTime ) const
 {
-	int c = 0;
-	CVarHistory::IndexType_t next;
-	// Always leave three of entries in the list...
-	for ( CVarHistory::IndexType_t i = m_VarHistory.Head(); i != CVarHistory::InvalidIndex(); c++, i = next )
+	int lo = 0;
+	int hi = m_nHistoryCount;
+	while ( lo < hi )
 	{
-		next = m_VarHistory.Next( i );
-
-		// Always leave elements 0 1 and 2 alone...
-		if ( c <= 2 )
-			continue;
+		int mid = ( lo + hi ) >> 1;
+		if ( HistoryEntry( mid ).changetime < flTime )
+		{
+			hi = mid;
+		}
+		else
+		{
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
 
-		CInterpolatedVarEntry *h = &m_VarHistory[ i ];
-		// Remove everything off the end until we find the first one that's not too old
-		if ( h->changetime > oldesttime )
-			continue;
 
-		// Unlink rest of chain
-		delete [] m_VarHistory[i].value;
-		m_VarHistory.Remove( i );
+template< typename Type > 
+inline void CInterpolatedVarArrayBase<Type>::RemoveOldEntries( float oldesttime )
+{
+	// Always leave elements 0 1 and 2 alone, and remove everything 
+	// off the end until we find the first one that's not too old
+	int i = max( FindSampleAtOrBefore( oldesttime ), 3 );
+	if ( i < m_nHistoryCount )
+	{
+		m_nHistoryCount = i;
 	}
 }
 
@@ -545,30 +710,14 @@ inline int CInterpolatedVarArrayBase<Type>::SafeNext( int i )
 template< typename Type > 
 inline void CInterpolatedVarArrayBase<Type>::RemoveEntriesPreviousTo( float flTime )
 {
-	CVarHistory::IndexType_t i = m_VarHistory.Head();
 	// Find the 2 samples spanning this time.
-	for ( ; i != CVarHistory::InvalidIndex(); i=m_VarHistory.Next( i ) )
+	int i = FindSampleBefore( flTime );
+	if ( i < m_nHistoryCount )
 	{
-		if ( m_VarHistory[i].changetime < flTime )
-		{
-			// We need to preserve this sample (ie: the one right before this timestamp)
-			// and the sample right before it (for hermite blending), and we can get rid
-			// of everything else.
-			i = (CVarHistory::IndexType_t)SafeNext( (int)i );
-			i = (CVarHistory::IndexType_t)SafeNext( (int)i );
-			i = (CVarHistory::IndexType_t)SafeNext( (int)i );	// We keep this one for _Derivative_Hermite_SmoothVelocity.
-			
-			break;
-		}
-	}
-
-	// Now remove all samples starting with i.
-	CVarHistory::IndexType_t next;
-	for ( ; i != CVarHistory::InvalidIndex(); i=next )
-	{
-		next = m_VarHistory.Next( i );
-		delete [] m_VarHistory[i].value;
-		m_VarHistory.Remove( i );
+		// We need to preserve this sample (ie: the one right before this timestamp)
+		// and the sample right before it (for hermite blending), and the one after
+		// that for _Derivative_Hermite_SmoothVelocity. We can get rid of everything else.
+		m_nHistoryCount = min( i + 3, (int)m_nHistoryCount );
 	}
 }
 
@@ -583,87 +732,98 @@ inline bool CInterpolatedVarArrayBase<Type>::GetInterpolationInfo(
 {
 	Assert( m_pValue );
 
-	CVarHistory &varHistory = m_VarHistory;
-
 	float targettime = currentTime - interpolation_amount;
-	CVarHistory::IndexType_t i;
+	int nSamples = m_nHistoryCount;
 
 	pInfo->m_bHermite = false;
 	pInfo->frac = 0;
-	pInfo->oldest = pInfo->older = pInfo->newer = varHistory.InvalidIndex();
-	
-	for ( i = m_VarHistory.Head(); i != varHistory.InvalidIndex(); i = varHistory.Next( i ) )
-	{
-		pInfo->older = i;
-		
-		float older_change_time = m_VarHistory[ i ].changetime;
-		if ( older_change_time == 0.0f )
-			break;
+	pInfo->oldest = pInfo->older = pInfo->newer = -1;
 
-		if ( targettime < older_change_time )
-		{
-			pInfo->newer = pInfo->older;
-			continue;
-		}
+	if ( !nSamples )
+		return false;
 
-		if ( pInfo->newer == varHistory.InvalidIndex() )
+	// The older of the two samples spanning the target time is the first one
+	// at or before it. A sample with no change time stops the search, and can
+	// only come before that one when the target time is negative.
+	int i;
+	if ( targettime >= 0.0f )
+	{
+		i = FindSampleAtOrBefore( targettime );
+	}
+	else
+	{
+		for ( i = 0; i < nSamples; i++ )
 		{
-			// Have it linear interpolate between the newest 2 entries.
-			pInfo->newer = pInfo->older; 
-
-			// Since the time given is PAST all of our entries, then as long
-			// as time continues to increase, we'll be returning the same value.
-			if ( pNoMoreChanges )
-				*pNoMoreChanges = 1;
-			return true;
+			float change_time = HistoryEntry( i ).changetime;
+			if ( change_time == 0.0f || targettime >= change_time )
+				break;
 		}
+	}
 
-		float newer_change_time = varHistory[ pInfo->newer ].changetime;
-		float dt = newer_change_time - older_change_time;
-		if ( dt > 0.0001f )
-		{
-			pInfo->frac = ( targettime - older_change_time ) / ( newer_change_time - older_change_time );
-			pInfo->frac = min( pInfo->frac, 2.0f );
+	// Didn't find any, return last entry???
+	if ( i == nSamples )
+	{
+		pInfo->newer = pInfo->older = nSamples - 1;
+		return true;
+	}
 
-			CVarHistory::IndexType_t oldestindex = varHistory.Next( i );
-														    
-			if ( !(m_fType & INTERPOLATE_LINEAR_ONLY) && oldestindex != varHistory.InvalidIndex() )
-			{
-				pInfo->oldest = oldestindex;
-				float oldest_change_time = varHistory[ oldestindex ].changetime;
-				float dt2 = older_change_time - oldest_change_time;
-				if ( dt2 > 0.0001f )
-				{
-					pInfo->m_bHermite = true;
-				}
-			}
+	pInfo->older = i;
 
-			// If pInfo->newer is the most recent entry we have, and all 2 or 3 other
-			// entries are identical, then we're always going to return the same value
-			// if currentTime increases.
-			if ( pNoMoreChanges && pInfo->newer == m_VarHistory.Head() )
-			{
-				 if ( COMPARE_HISTORY( pInfo->newer, pInfo->older ) )
-				 {
-					if ( !pInfo->m_bHermite || COMPARE_HISTORY( pInfo->newer, pInfo->oldest ) )
-						*pNoMoreChanges = 1;
-				 }
-			}
-		}
+	float older_change_time = HistoryEntry( i ).changetime;
+	if ( older_change_time == 0.0f )
+	{
+		// Use the sample before it, or this one if it's the only one
+		pInfo->newer = pInfo->older = max( i - 1, 0 );
 		return true;
 	}
 
-	// Didn't find any, return last entry???
-	if ( pInfo->newer != varHistory.InvalidIndex() )
+	if ( i == 0 )
 	{
-		pInfo->older = pInfo->newer;
+		// Have it linear interpolate between the newest 2 entries.
+		pInfo->newer = pInfo->older; 
+
+		// Since the time given is PAST all of our entries, then as long
+		// as time continues to increase, we'll be returning the same value.
+		if ( pNoMoreChanges )
+			*pNoMoreChanges = 1;
 		return true;
 	}
 
+	pInfo->newer = i - 1;
+
+	float newer_change_time = HistoryEntry( pInfo->newer ).changetime;
+	float dt = newer_change_time - older_change_time;
+	if ( dt > 0.0001f )
+	{
+		pInfo->frac = ( targettime - older_change_time ) / ( newer_change_time - older_change_time );
+		pInfo->frac = min( pInfo->frac, 2.0f );
 
-	// This is the single-element case
-	pInfo->newer = pInfo->older;
-	return (pInfo->older != varHistory.InvalidIndex());
+		int oldestindex = i + 1;
+												    
+		if ( !(m_fType & INTERPOLATE_LINEAR_ONLY) && oldestindex < nSamples )
+		{
+			pInfo->oldest = oldestindex;
+			float oldest_change_time = HistoryEntry( oldestindex ).changetime;
+			float dt2 = older_change_time - oldest_change_time;
+			if ( dt2 > 0.0001f )
+			{
+				pInfo->m_bHermite = true;
+			}
+		}
+
+		// If pInfo->newer is the most recent entry we have, and all 2 or 3 other
+		// entries are identical, then we're always going to return the same value
+		// if currentTime increases.
+		if ( pNoMoreChanges && pInfo->newer == 0 )
+		{
+			 if ( COMPARE_HISTORY( pInfo->newer, pInfo->older ) )
+			 {
+				if ( !pInfo->m_bHermite || COMPARE_HISTORY( pInfo->newer, pInfo->oldest ) )
+					*pNoMoreChanges = 1;
+			 }
+		}
+	}
+	return true;
 }
 
 
@@ -697,8 +857,6 @@ inline int CInterpolatedVarArrayBase<Type>::Interpolate( float currentTime, floa
 		return noMoreChanges;
 
 	
-	CVarHistory &history = m_VarHistory;
-
 #ifdef INTERPOLATEDVAR_PARANOID_MEASUREMENT
 	Type *backupValues = (Type*)_alloca( m_nMaxCount * sizeof(Type) );
 	memcpy( backupValues, m_pValue, sizeof( Type ) * m_nMaxCount );
@@ -707,7 +865,7 @@ inline int CInterpolatedVarArrayBase<Type>::Interpolate( float currentTime, floa
 	if ( info.m_bHermite )
 	{
 		// base cast, we have 3 valid sample point
-		_Interpolate_Hermite( m_pValue, info.frac, &history[info.oldest], &history[info.older], &history[info.newer] );
+		_Interpolate_Hermite( m_pValue, info.frac, &HistoryEntry( info.oldest ), &HistoryEntry( info.older ), &HistoryEntry( info.newer ) );
 	}
 	else if ( info.newer == info.older  )
 	{
@@ -716,7 +874,7 @@ inline int CInterpolatedVarArrayBase<Type>::Interpolate( float currentTime, floa
 		int realOlder = SafeNext( (int)info.newer );
 		if ( CInterpolationContext::IsExtrapolationAllowed() &&
 			IsValidIndex( realOlder ) &&
-			history[(CVarHistory::IndexType_t)realOlder].changetime != 0.0 &&
+			HistoryEntry( realOlder ).changetime != 0.0 &&
 			interpolation_amount > 0.000001f &&
 			CInterpolationContext::GetLastTimeStamp() <= m_LastNetworkedTime )
 		{
@@ -736,16 +894,16 @@ inline int CInterpolatedVarArrayBase<Type>::Interpolate( float currentTime, floa
 			// The End
 
 			// Use the velocity here (extrapolate up to 1/4 of a second).
-			_Extrapolate( m_pValue, &history[(CVarHistory::IndexType_t)realOlder], &history[info.newer], currentTime - interpolation_amount, cl_extrapolate_amount.GetFloat() );
+			_Extrapolate( m_pValue, &HistoryEntry( realOlder ), &HistoryEntry( info.newer ), currentTime - interpolation_amount, cl_extrapolate_amount.GetFloat() );
 		}
 		else
 		{
-			_Interpolate( m_pValue, info.frac, &history[info.older], &history[info.newer] );
+			_Interpolate( m_pValue, info.frac, &HistoryEntry( info.older ), &HistoryEntry( info.newer ) );
 		}
 	}
 	else
 	{
-		_Interpolate( m_pValue, info.frac, &history[info.older], &history[info.newer] );
+		_Interpolate( m_pValue, info.frac, &HistoryEntry( info.older ), &HistoryEntry( info.newer ) );
 	}
 
 #ifdef INTERPOLATEDVAR_PARANOID_MEASUREMENT
@@ -783,11 +941,11 @@ void CInterpolatedVarArrayBase<Type>::GetDerivative( Type *pOut, float currentTi
 
 	if ( info.m_bHermite )
 	{
-		_Derivative_Hermite( pOut, info.frac, &m_VarHistory[info.oldest], &m_VarHistory[info.older], &m_VarHistory[info.newer] );
+		_Derivative_Hermite( pOut, info.frac, &HistoryEntry( info.oldest ), &HistoryEntry( info.older ), &HistoryEntry( info.newer ) );
 	}
 	else
 	{
-		_Derivative_Linear( pOut, &m_VarHistory[info.older], &m_VarHistory[info.newer] );
+		_Derivative_Linear( pOut, &HistoryEntry( info.older ), &HistoryEntry( info.newer ) );
 	}
 }
 
@@ -799,13 +957,12 @@ void CInterpolatedVarArrayBase<Type>::GetDerivative_SmoothVelocity( Type *pOut,
 	if (!GetInterpolationInfo( &info, currentTime, m_InterpolationAmount, NULL ))
 		return;
 
-	CVarHistory &history = m_VarHistory;
 	bool bExtrapolate = false;
 	int realOlder = 0;
 	
 	if ( info.m_bHermite )
 	{
-		_Derivative_Hermite_SmoothVelocity( pOut, info.frac, &history[info.oldest], &history[info.older], &history[info.newer] );
+		_Derivative_Hermite_SmoothVelocity( pOut, info.frac, &HistoryEntry( info.oldest ), &HistoryEntry( info.older ), &HistoryEntry( info.newer ) );
 		return;
 	}
 	else if ( info.newer == info.older && CInterpolationContext::IsExtrapolationAllowed() )
@@ -813,7 +970,7 @@ void CInterpolatedVarArrayBase<Type>::GetDerivative_SmoothVelocity( Type *pOut,
 		// This means the server clock got way behind the client clock. Extrapolate the value here based on its
 		// previous velocity (out to a certain amount).
 		realOlder = SafeNext( (int)info.newer );
-		if ( IsValidIndex( realOlder ) && history[(CVarHistory::IndexType_t)realOlder].changetime != 0.0 )
+		if ( IsValidIndex( realOlder ) && HistoryEntry( realOlder ).changetime != 0.0 )
 		{
 			// At this point, we know we're out of data and we have the ability to get a velocity to extrapolate with.
 			//
@@ -839,11 +996,11 @@ void CInterpolatedVarArrayBase<Type>::GetDerivative_SmoothVelocity( Type *pOut,
 	if ( bExtrapolate )
 	{
 		// Get the velocity from the last segment.
-		_Derivative_Linear( pOut, &history[(CVarHistory::IndexType_t)realOlder], &history[info.newer] );
+		_Derivative_Linear( pOut, &HistoryEntry( realOlder ), &HistoryEntry( info.newer ) );
 
 		// Now ramp it to zero after cl_extrapolate_amount..
 		float flDestTime = currentTime - m_InterpolationAmount;
-		float diff = flDestTime - history[info.newer].changetime;
+		float diff = flDestTime - HistoryEntry( info.newer ).changetime;
 		diff = clamp( diff, 0, cl_extrapolate_amount.GetFloat() * 2 );
 		if ( diff > cl_extrapolate_amount.GetFloat() )
 		{
@@ -856,7 +1013,7 @@ void CInterpolatedVarArrayBase<Type>::GetDerivative_SmoothVelocity( Type *pOut,
 	}
 	else
 	{
-		_Derivative_Linear( pOut, &history[info.older], &history[info.newer] );
+		_Derivative_Linear( pOut, &HistoryEntry( info.older ), &HistoryEntry( info.newer ) );
 	}
 
 }
@@ -868,6 +1025,20 @@ inline int CInterpolatedVarArrayBase<Type>::Interpolate( float currentTime )
 	return Interpolate( currentTime, m_InterpolationAmount );
 }
 
+template< typename Type > 
+inline void CInterpolatedVarArrayBase<Type>::InterpolateBatch( const InterpolatedVarBatchItem_t *pItems, int nItems )
+{
+	for ( int i = 0; i < nItems; i++ )
+	{
+		const InterpolatedVarBatchItem_t &item = pItems[i];
+		CInterpolatedVarArrayBase<Type> *pVar = static_cast< CInterpolatedVarArrayBase<Type>* >( item.m_pVar );
+		if ( pVar->Interpolate( item.m_flCurrentTime, pVar->m_InterpolationAmount ) )
+			*item.m_pNeedsToInterpolate = false;
+		else
+			*item.m_pNoMoreChanges = 0;
+	}
+}
+
 template< typename Type > 
 inline void CInterpolatedVarArrayBase<Type>::Copy( IInterpolatedVar *pInSrc )
 {
@@ -891,19 +1062,17 @@ inline void CInterpolatedVarArrayBase<Type>::Copy( IInterpolatedVar *pInSrc )
 	m_LastNetworkedTime = pSrc->m_LastNetworkedTime;
 
 	// Copy the entries.
-	m_VarHistory.RemoveAll();
+	ClearHistory();
+	ReserveHistory( pSrc->m_nHistoryCount );
 
-	CVarHistory::IndexType_t newslot;
-	for ( CVarHistory::IndexType_t srcCur=pSrc->m_VarHistory.Head(); srcCur != CVarHistory::InvalidIndex(); srcCur = pSrc->m_VarHistory.Next( srcCur ) )
+	for ( int i = 0; i < pSrc->m_nHistoryCount; i++ )
 	{
-		newslot = m_VarHistory.AddToTail();
-
-		CInterpolatedVarEntry *dest = &m_VarHistory[newslot];
-		CInterpolatedVarEntry *src	= &pSrc->m_VarHistory[srcCur];
+		CInterpolatedVarEntry *dest = &HistoryEntry( i );
+		const CInterpolatedVarEntry *src = &pSrc->HistoryEntry( i );
 		dest->changetime = src->changetime;
-		dest->value = new Type[m_nMaxCount];
 		memcpy( dest->value, src->value, m_nMaxCount*sizeof(Type) );
 	}
+	m_nHistoryCount = pSrc->m_nHistoryCount;
 }
 
 template< typename Type > 
@@ -912,15 +1081,10 @@ inline const Type& CInterpolatedVarArrayBase<Type>::GetPrev( int iArrayIndex ) c
 	Assert( m_pValue );
 	Assert( iArrayIndex >= 0 && iArrayIndex < m_nMaxCount );
 
-	CVarHistory::IndexType_t ihead = m_VarHistory.Head();
-	if ( ihead != CVarHistory::InvalidIndex() )
+	if ( m_nHistoryCount > 1 )
 	{
-		ihead = m_VarHistory.Next( ihead );
-		if ( ihead != CVarHistory::InvalidIndex() )
-		{
-			CInterpolatedVarEntry const *h = &m_VarHistory[ ihead ];
-			return h->value[ iArrayIndex ];
-		}
+		CInterpolatedVarEntry const *h = &HistoryEntry( 1 );
+		return h->value[ iArrayIndex ];
 	}
 	return m_pValue[ iArrayIndex ];
 }
@@ -931,10 +1095,9 @@ inline const Type& CInterpolatedVarArrayBase<Type>::GetCurrent( int iArrayIndex
 	Assert( m_pValue );
 	Assert( iArrayIndex >= 0 && iArrayIndex < m_nMaxCount );
 
-	CVarHistory::IndexType_t ihead = m_VarHistory.Head();
-	if ( ihead != CVarHistory::InvalidIndex() )
+	if ( m_nHistoryCount )
 	{
-		CInterpolatedVarEntry const *h = &m_VarHistory[ ihead ];
+		CInterpolatedVarEntry const *h = &HistoryEntry( 0 );
 		return h->value[ iArrayIndex ];
 	}
 	return m_pValue[ iArrayIndex ];
@@ -943,17 +1106,12 @@ inline const Type& CInterpolatedVarArrayBase<Type>::GetCurrent( int iArrayIndex
 template< typename Type > 
 inline float CInterpolatedVarArrayBase<Type>::GetInterval() const
 {	
-	CVarHistory::IndexType_t head = m_VarHistory.Head();
-	if ( head != CVarHistory::InvalidIndex() )
+	if ( m_nHistoryCount > 1 )
 	{
-		int next = m_VarHistory.Next( head );
-		if ( next != CVarHistory::InvalidIndex() )
-		{
-			CInterpolatedVarEntry const *h = &m_VarHistory[ head ];
-			CInterpolatedVarEntry const *n = &m_VarHistory[ next ];
-			
-			return ( h->changetime - n->changetime );
-		}
+		CInterpolatedVarEntry const *h = &HistoryEntry( 0 );
+		CInterpolatedVarEntry const *n = &HistoryEntry( 1 );
+		
+		return ( h->changetime - n->changetime );
 	}
 
 	return 0.0f;
@@ -962,20 +1120,20 @@ inline float CInterpolatedVarArrayBase<Type>::GetInterval() const
 template< typename Type > 
 inline bool	CInterpolatedVarArrayBase<Type>::IsValidIndex( int i )
 {
-	return m_VarHistory.IsValidIndex( (CVarHistory::IndexType_t)i );
+	return ( i >= 0 && i < m_nHistoryCount );
 }
 
 template< typename Type > 
 inline Type	*CInterpolatedVarArrayBase<Type>::GetHistoryValue( int index, float& changetime, int iArrayIndex )
 {
 	Assert( iArrayIndex >= 0 && iArrayIndex < m_nMaxCount );
-	if ( (CVarHistory::IndexType_t)index == CVarHistory::InvalidIndex() )
+	if ( !IsValidIndex( index ) )
 	{
 		changetime = 0.0f;
 		return NULL;
 	}
 
-	CInterpolatedVarEntry *entry = &m_VarHistory[ (CVarHistory::IndexType_t)index ];
+	CInterpolatedVarEntry *entry = &HistoryEntry( index );
 	changetime = entry->changetime;
 	return &entry->value[ iArrayIndex ];
 }
@@ -983,13 +1141,13 @@ inline Type	*CInterpolatedVarArrayBase<Type>::GetHistoryValue( int index, float&
 template< typename Type > 
 inline int CInterpolatedVarArrayBase<Type>::GetHead()
 {
-	return (int)m_VarHistory.Head();
+	return m_nHistoryCount ? 0 : -1;
 }
 
 template< typename Type > 
 inline int CInterpolatedVarArrayBase<Type>::GetNext( int i )
 {
-	return (int)m_VarHistory.Next( (CVarHistory::IndexType_t)i );
+	return ( i + 1 < m_nHistoryCount ) ? i + 1 : -1;
 }
 
 template< typename Type > 
@@ -997,10 +1155,9 @@ inline void CInterpolatedVarArrayBase<Type>::SetHistoryValuesForItem( int item,
 {
 	Assert( item >= 0 && item < m_nMaxCount );
 
-	CVarHistory::IndexType_t i;
-	for ( i = m_VarHistory.Head(); i != CVarHistory::InvalidIndex(); i = m_VarHistory.Next( i ) )
+	for ( int i = 0; i < m_nHistoryCount; i++ )
 	{
-		CInterpolatedVarEntry *entry = &m_VarHistory[ i ];
+		CInterpolatedVarEntry *entry = &HistoryEntry( i );
 		entry->value[ item ] = value;
 	}
 }
@@ -1020,6 +1177,7 @@ inline void	CInterpolatedVarArrayBase<Type>::SetMaxCount( int newmax )
 	// Wipe everything any time this changes!!!
 	if ( changed )
 	{
+		FreeHistory();
 		delete [] m_bLooping;
 		delete [] m_LastNetworkedValue;
 		m_bLooping = new byte[m_nMaxCount];
@@ -1264,7 +1422,7 @@ inline bool CInterpolatedVarArrayBase<Type>::ValidOrder()
 	bool first = true;
 	for ( int i = GetHead(); IsValidIndex( i ); i = GetNext( i ) )
 	{
-		CInterpolatedVarEntry *entry = &m_VarHistory[ i ];
+		CInterpolatedVarEntry *entry = &HistoryEntry( i );
 		if ( first )
 		{
 			first = false;
@@ -361,6 +361,7 @@ public:
 	void GetRenderBounds( Vector& theMins, Vector& theMaxs );
 	virtual void AddEntity( void );
 	virtual void AccumulateLayers( CStudioHdr *hdr, Vector pos[], Quaternion q[], float poseparam[], float currentTime, int boneMask );
+	virtual bool PrefetchBlendingRules( CStudioHdr *hdr, float currentTime );
 	virtual void BuildTransformations( CStudioHdr *pStudioHdr, Vector *pos, Quaternion q[], const matrix3x4_t &cameraTransform, int boneMask, CBoneBitList &boneComputed );
 	IPhysicsObject *GetElement( int elementNum );
 	virtual void UpdateOnRemove();
@@ -536,6 +537,16 @@ void C_ServerRagdoll::AccumulateLayers( CStudioHdr *hdr, Vector pos[], Quaternio
 	}
 }
 
+bool C_ServerRagdoll::PrefetchBlendingRules( CStudioHdr *hdr, float currentTime )
+{
+	bool bPrefetched = BaseClass::PrefetchBlendingRules( hdr, currentTime );
+	if ( m_nOverlaySequence >= 0 && m_nOverlaySequence < hdr->GetNumSeq() && !Studio_PrefetchPose( hdr, m_nOverlaySequence ) )
+	{
+		bPrefetched = false;
+	}
+	return bPrefetched;
+}
+
 void C_ServerRagdoll::BuildTransformations( CStudioHdr *hdr, Vector *pos, Quaternion q[], const matrix3x4_t &cameraTransform, int boneMask, CBoneBitList &boneComputed )
 {
 	if ( !hdr )
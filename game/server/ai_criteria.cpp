@@ -105,6 +105,33 @@ int AI_CriteriaSet::FindCriterionIndex( const char *name ) const
 	return idx;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Output : int
+//-----------------------------------------------------------------------------
+int AI_CriteriaSet::Head() const
+{
+	int idx = m_Lookup.FirstInorder();
+	if ( idx == m_Lookup.InvalidIndex() )
+		return -1;
+
+	return idx;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : index - 
+// Output : int
+//-----------------------------------------------------------------------------
+int AI_CriteriaSet::Next( int index ) const
+{
+	int idx = m_Lookup.NextInorder( index );
+	if ( idx == m_Lookup.InvalidIndex() )
+		return -1;
+
+	return idx;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : index - 
@@ -33,6 +33,10 @@ public:
 	int GetCount() const;
 	int			FindCriterionIndex( const char *name ) const;
 
+	// Walks the valid indices, returns -1 at the end
+	int			Head() const;
+	int			Next( int index ) const;
+
 	const char *GetName( int index ) const;
 	const char *GetValue( int index ) const;
 	float		GetWeight( int index ) const;
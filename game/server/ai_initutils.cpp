@@ -116,6 +116,26 @@ void CAI_TestHull::ReturnTestHull(void)
 	UTIL_SetSize(CAI_TestHull::pTestHull, vec3_origin, vec3_origin);
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Create a test hull that stays at one hull size, so connections
+//			can be tested with it off the main thread without resizing it.
+//			It's solid, like the hull GetTestHull() hands out.
+// Input  : hull - 
+// Output : The new hull, which the caller removes with UTIL_RemoveImmediate()
+//-----------------------------------------------------------------------------
+CAI_TestHull* CAI_TestHull::CreateFixedTestHull( Hull_t hull )
+{
+	CAI_TestHull *pHull = CREATE_ENTITY( CAI_TestHull, "aitesthull" );
+	pHull->Spawn();
+	pHull->AddFlag( FL_NPC | FL_ONGROUND );
+	pHull->RemoveSolidFlags( FSOLID_NOT_SOLID );
+	pHull->bInUse = true;
+	pHull->SetHullType( hull );
+	pHull->SetHullSizeNormal( true );
+
+	return pHull;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 // Input  : &startPos - 
@@ -130,6 +150,19 @@ bool CAI_TestHull::IsJumpLegal(const Vector &startPos, const Vector &apex, const
 
 	return BaseClass::IsJumpLegal( startPos, apex, endPos, MAX_JUMP_RISE, MAX_JUMP_DISTANCE, MAX_JUMP_DROP );
 }
+
+//-----------------------------------------------------------------------------
+// Purpose: A parallel build has a hull of each size for every thread. They
+//			must not block each other's probes, so that each hull sees the
+//			world as the single serial hull does.
+//-----------------------------------------------------------------------------
+bool CAI_TestHull::ShouldProbeCollideAgainstEntity( CBaseEntity *pEntity )
+{
+	if ( dynamic_cast<CAI_TestHull *>( pEntity ) != NULL )
+		return false;
+
+	return BaseClass::ShouldProbeCollideAgainstEntity( pEntity );
+}
 //-----------------------------------------------------------------------------
 // Purpose:
 // Input  :
@@ -137,7 +170,10 @@ bool CAI_TestHull::IsJumpLegal(const Vector &startPos, const Vector &apex, const
 //-----------------------------------------------------------------------------
 CAI_TestHull::~CAI_TestHull(void)
 {
-	CAI_TestHull::pTestHull = NULL;
+	if ( CAI_TestHull::pTestHull == this )
+	{
+		CAI_TestHull::pTestHull = NULL;
+	}
 }
 
 //###########################################################
@@ -90,6 +90,7 @@ private:
 public:
 	static CAI_TestHull*	GetTestHull(void);						// Get the test hull
 	static void				ReturnTestHull(void);					// Return the test hull
+	static CAI_TestHull*	CreateFixedTestHull( Hull_t hull );		// A hull of one size for a build thread, removed by the caller
 
 	bool					bInUse;
 	virtual void			Precache();
@@ -97,6 +98,7 @@ public:
 	virtual int				ObjectCaps( void ) { return BaseClass::ObjectCaps() & ~(FCAP_ACROSS_TRANSITION|FCAP_DONT_SAVE); }
 
 	virtual bool			IsJumpLegal(const Vector &startPos, const Vector &apex, const Vector &endPos) const;
+	virtual bool			ShouldProbeCollideAgainstEntity( CBaseEntity *pEntity );
 
 	~CAI_TestHull(void);
 };
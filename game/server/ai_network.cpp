@@ -120,6 +120,9 @@ CAI_Network::CAI_Network()
 #ifdef AI_NODE_TREE
 	m_pNodeTree = NULL;
 #endif
+
+	m_iSearch = 0;
+	m_bHullZonesValid = false;
 }
 
 //-----------------------------------------------------------------------------
@@ -533,6 +536,7 @@ CAI_Node *CAI_Network::AddNode( const Vector &origin, float yaw )
 	}
 
 	m_pAInode[m_iNumNodes] = new CAI_Node( m_iNumNodes, origin, yaw );
+	m_bHullZonesValid = false;
 
 #ifdef AI_NODE_TREE
 	if ( !m_pNodeTree )
@@ -592,6 +596,7 @@ CAI_Link *CAI_Network::CreateLink( int srcID, int destID, CAI_DynamicLink *pDyna
 
 	pSrcNode->AddLink(pLink);
 	pDestNode->AddLink(pLink);
+	m_bHullZonesValid = false;
 
 	return pLink;
 }
@@ -631,6 +636,113 @@ bool CAI_Network::IsConnected(int srcID, int destID)
 	return ( srcZone == destZone );
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Returns false if there's no route between two nodes for a hull,
+//			whatever the NPC's capabilities and the state of dynamic links
+//-----------------------------------------------------------------------------
+
+bool CAI_Network::IsConnected(int srcID, int destID, Hull_t hull)
+{
+	if ( !IsConnected( srcID, destID ) )
+		return false;
+
+	// Links are changed without telling us while editing
+	if ( srcID == destID || hull < 0 || hull >= NUM_HULLS || engine->IsInEditMode() )
+		return true;
+
+	return ( GetHullZone( srcID, hull ) == GetHullZone( destID, hull ) );
+}
+
+//-----------------------------------------------------------------------------
+
+int CAI_Network::GetHullZone( int nodeID, Hull_t hull )
+{
+	Assert( nodeID >= 0 && nodeID < m_iNumNodes && hull >= 0 && hull < NUM_HULLS );
+
+	if ( !m_bHullZonesValid )
+	{
+		BuildHullZones();
+	}
+
+	return m_HullZones[nodeID * NUM_HULLS + hull];
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Flood fills the links each hull is accepted on. Whether a link
+//			can actually be used also depends on the NPC and dynamic link
+//			state, so these zones only tell us where there's no route at all.
+//-----------------------------------------------------------------------------
+
+void CAI_Network::BuildHullZones()
+{
+	m_HullZones.SetCount( m_iNumNodes * NUM_HULLS );
+
+	CUtlVector<int> stack;
+	for ( int hull = 0; hull < NUM_HULLS; hull++ )
+	{
+		int node;
+		for ( node = 0; node < m_iNumNodes; node++ )
+		{
+			m_HullZones[node * NUM_HULLS + hull] = AI_NODE_ZONE_UNKNOWN;
+		}
+
+		int curZone = AI_NODE_FIRST_ZONE;
+		for ( node = 0; node < m_iNumNodes; node++ )
+		{
+			if ( m_HullZones[node * NUM_HULLS + hull] != AI_NODE_ZONE_UNKNOWN )
+				continue;
+
+			m_HullZones[node * NUM_HULLS + hull] = curZone;
+			stack.AddToTail( node );
+			while ( stack.Count() )
+			{
+				int iCur = stack[stack.Count() - 1];
+				stack.Remove( stack.Count() - 1 );
+
+				CAI_Node *pNode = m_pAInode[iCur];
+				for ( int link = 0; link < pNode->NumLinks(); link++ )
+				{
+					CAI_Link *pLink = pNode->GetLinkByIndex( link );
+					if ( !pLink->m_iAcceptedMoveTypes[hull] )
+						continue;
+
+					int iDest = pLink->DestNodeID( iCur );
+					if ( m_HullZones[iDest * NUM_HULLS + hull] == AI_NODE_ZONE_UNKNOWN )
+					{
+						m_HullZones[iDest * NUM_HULLS + hull] = curZone;
+						stack.AddToTail( iDest );
+					}
+				}
+			}
+			curZone++;
+		}
+	}
+
+	m_bHullZonesValid = true;
+}
+
+//-----------------------------------------------------------------------------
+
+AI_NodeSearchState_t *CAI_Network::BeginSearch( int *pSearchId, int **ppParents )
+{
+	if ( m_SearchState.Count() < m_iNumNodes || ++m_iSearch <= 0 )
+	{
+		m_SearchState.SetCount( m_iNumNodes );
+		m_SearchParents.SetCount( m_iNumNodes );
+		for ( int node = 0; node < m_iNumNodes; node++ )
+		{
+			m_SearchState[node].iSearch = 0;
+		}
+		m_iSearch = 1;
+	}
+
+	m_OpenList.RemoveAll();
+
+	*pSearchId = m_iSearch;
+	*ppParents = m_SearchParents.Base();
+	return m_SearchState.Base();
+}
+
 //-----------------------------------------------------------------------------
 
 IterationRetval_t CAI_Network::EnumElement( IHandleEntity *pHandleEntity )
@@ -14,6 +14,8 @@
 
 #include "ispatialpartition.h"
 #include "utlpriorityqueue.h"
+#include "utlvector.h"
+#include "ai_hull.h"
 
 // ------------------------------------
 
@@ -78,6 +80,49 @@ public:
 	CNodeList( AI_NearNode_t *pMemory, int count ) : CUtlPriorityQueue<AI_NearNode_t>( pMemory, count, IsLowerPriority ) {}
 };
 
+//-------------------------------------
+// Per node state of a CAI_Pathfinder::FindBestPath() search. Entries are
+// stamped with the search that wrote them, so a new search doesn't have to
+// clear them.
+
+struct AI_NodeSearchState_t
+{
+	float	g;					// Cost from the start node
+	float	h;					// Estimated cost to the end node
+	float	f;					// g + h
+	int		iSearch;			// Search that last wrote this entry
+	bool	bOpen;
+	bool	bHasH;				// h has been computed this search
+};
+
+//-------------------------------------
+
+struct AI_OpenNode_t
+{
+	AI_OpenNode_t() {}
+	AI_OpenNode_t( int index, float nodef ) { f = nodef; nodeIndex = index; }
+	float	f;
+	int		nodeIndex;
+};
+
+//-------------------------------------
+// A* open list. Nodes aren't removed when their F improves; the old entry
+// is left behind and skipped when it reaches the head.
+
+class CAI_OpenList : public CUtlPriorityQueue<AI_OpenNode_t>
+{
+public:
+	static bool IsLowerPriority( const AI_OpenNode_t &node1, const AI_OpenNode_t &node2 )
+	{
+		// lowest F first, then lowest node index, the same order FindBSSmallest() gives
+		if ( node1.f != node2.f )
+			return node1.f > node2.f;
+		return node1.nodeIndex > node2.nodeIndex;
+	}
+
+	CAI_OpenList( int growSize = 0, int initSize = 0 ) : CUtlPriorityQueue<AI_OpenNode_t>( growSize, initSize, IsLowerPriority ) {}
+};
+
 //-----------------------------------------------------------------------------
 // CAI_Network
 //
@@ -94,6 +139,12 @@ public:
 	CAI_Link *		CreateLink( int srcID, int destID, CAI_DynamicLink *pDynamicLink = NULL );
 
 	bool			IsConnected(int srcID, int destID);	// Use during run time
+	bool			IsConnected(int srcID, int destID, Hull_t hull);	// Also false if no link between them accepts the hull
+
+	// Connected components of the links each hull can use. Built on demand,
+	// and rebuilt after InvalidateHullZones().
+	int				GetHullZone( int nodeID, Hull_t hull );
+	void			InvalidateHullZones()	{ m_bHullZonesValid = false; }
 	void			TestIsConnected(int startID, int endID);	// Use only for initialization!
 	
 	Vector			GetNodePosition( CBaseCombatCharacter *pNPC, int nodeID );
@@ -127,6 +178,12 @@ public:
 	}
 	
 	CAI_Node**		AccessNodes() const	{ return m_pAInode; }
+
+	// Search state for FindBestPath(), kept between searches. Returns state
+	// for every node, all of it stale with respect to the returned search id,
+	// and an array for the parent of each node the search reaches.
+	AI_NodeSearchState_t *BeginSearch( int *pSearchId, int **ppParents );
+	CAI_OpenList &	AccessOpenList()	{ return m_OpenList; }
 	
 private:
 	friend class CAI_NetworkManager;
@@ -137,6 +194,8 @@ private:
 	void			SetCachedNearestNode(const Vector &checkPos, int nodeID, Hull_t nHull);
 	int				GetCachedNode(const Vector &checkPos, Hull_t nHull, int *pCachePos);
 
+	void			BuildHullZones();
+
 	int				ListNodesInBox( CNodeList &list, int maxListCount, const Vector &mins, const Vector &maxs, INodeListFilter *pFilter );
 
 	//---------------------------------
@@ -167,6 +226,14 @@ private:
 	NearNodeCache_T		m_NearestCache[NEARNODE_CACHE_SIZE];	// Cache of nearest nodes
 	int					m_iNearestCacheNext;					// Oldest record in the cache
 
+	CUtlVector<AI_NodeSearchState_t> m_SearchState;
+	CUtlVector<int>		m_SearchParents;
+	int					m_iSearch;
+	CAI_OpenList		m_OpenList;
+
+	CUtlVector<short>	m_HullZones;				// NUM_HULLS entries per node
+	bool				m_bHullZonesValid;
+
 #ifdef AI_NODE_TREE
 	ISpatialPartition * m_pNodeTree;
 	CUtlVector<int>		m_GatheredNodes;
@@ -21,6 +21,9 @@
 #include "ai_initutils.h"
 #include "ai_moveprobe.h"
 #include "ai_hull.h"
+#include "serverjobs.h"
+#include "tier0/threadtools.h"
+#include "tier0/fasttimer.h"
 
 #ifdef _XBOX
 #include "xbox/xbox_platform.h"
@@ -68,6 +71,23 @@ CON_COMMAND(ai_debug_node_connect, "Debug the attempted connection between two n
 
 ConVar g_ai_norebuildgraph( "ai_norebuildgraph", "0" );
 
+// Spreads the node graph build across the server job pool. The graph should
+// come out the same either way, which ai_graph_build_compare checks.
+// Experimental, and off by default: the jobs trace through the engine from
+// the worker threads, and engine traces aren't known to be thread safe.
+ConVar ai_parallel_graph_build( "ai_parallel_graph_build", "0" );
+
+CON_COMMAND_F( ai_graph_build_compare, "Rebuilds every node of the graph serially and with ai_parallel_graph_build, and compares the .ain data the two builds write.", FCVAR_CHEAT )
+{
+	if ( !g_pAINetworkManager || !g_pBigAINet || !g_pBigAINet->NumNodes() )
+	{
+		Msg( "No node graph to build\n" );
+		return;
+	}
+
+	g_pAINetworkManager->CompareGraphBuilds();
+}
+
 
 //-----------------------------------------------------------------------------
 #ifndef _XBOX
@@ -260,7 +280,29 @@ void CAI_NetworkManager::SaveNetworkGraph( void )
 	Q_strncat( szNrpFilename, ".ain", sizeof( szNrpFilename ), COPY_ALL_CHARACTERS  );
 
 	CUtlBuffer buf;
+	WriteNetworkGraph( buf );
+
+	// -------------------------------
+	// Write the file out
+	// -------------------------------
+
+	FileHandle_t fh = filesystem->Open( szNrpFilename, "wb" );
+	if ( !fh )
+	{
+		DevWarning( 2, "Couldn't create %s!\n", szNrpFilename );
+		return;
+	}
+
+	filesystem->Write( buf.Base(), buf.TellPut(), fh );
+	filesystem->Close(fh);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose:  Writes the network as SaveNetworkGraph() stores it
+//-----------------------------------------------------------------------------
 
+void CAI_NetworkManager::WriteNetworkGraph( CUtlBuffer &buf )
+{
 	// ---------------------------
 	// Save the version number
 	// ---------------------------
@@ -326,20 +368,71 @@ void CAI_NetworkManager::SaveNetworkGraph( void )
 	{
 		buf.PutInt( GetEditOps()->m_pNodeIndexTable[node] );
 	}
+}
 
-	// -------------------------------
-	// Write the file out
-	// -------------------------------
+//-----------------------------------------------------------------------------
+// Purpose:  Rebuilds the links of every node, once on the main thread and
+//			 once across the server job pool, and compares what
+//			 SaveNetworkGraph() would write after each. The graph is left as
+//			 the parallel build made it.
+//-----------------------------------------------------------------------------
 
-	FileHandle_t fh = filesystem->Open( szNrpFilename, "wb" );
-	if ( !fh )
+void CAI_NetworkManager::CompareGraphBuilds()
+{
+	bool bWasParallel = ai_parallel_graph_build.GetBool();
+
+	CUtlBuffer graphs[2];
+	double flSeconds[2];
+	CFastTimer timer;
+
+	CAI_DynamicLink::gm_bInitialized = false;
+
+	for ( int iBuild = 0; iBuild < 2; iBuild++ )
 	{
-		DevWarning( 2, "Couldn't create %s!\n", szNrpFilename );
-		return;
+		ai_parallel_graph_build.SetValue( iBuild );
+
+		for ( int i = 0; i < m_pNetwork->NumNodes(); i++ )
+		{
+			m_pNetwork->GetNode( i )->SetNeedsRebuild();
+		}
+
+		timer.Start();
+		g_AINetworkBuilder.Rebuild( m_pNetwork );
+		timer.End();
+		flSeconds[iBuild] = timer.GetDuration().GetSeconds();
+
+		GetEditOps()->ClearRebuildFlags();
+		WriteNetworkGraph( graphs[iBuild] );
 	}
 
-	filesystem->Write( buf.Base(), buf.TellPut(), fh );
-	filesystem->Close(fh);
+	ai_parallel_graph_build.SetValue( bWasParallel ? 1 : 0 );
+
+	CAI_DynamicLink::PurgeDynamicLinks();
+	CAI_DynamicLink::ResetDynamicLinks();
+	GetEditOps()->RecalcUsableNodesForHull();
+
+	Msg( "%d nodes, %d job threads\n", m_pNetwork->NumNodes(), ServerJobThreadCount() );
+	Msg( "  serial    %8.3f s  %d bytes\n", flSeconds[0], graphs[0].TellPut() );
+	Msg( "  parallel  %8.3f s  %d bytes  %.2fx\n", flSeconds[1], graphs[1].TellPut(), flSeconds[1] > 0 ? flSeconds[0] / flSeconds[1] : 0.0 );
+
+	int nBytes = min( graphs[0].TellPut(), graphs[1].TellPut() );
+	const unsigned char *pSerial = (const unsigned char *)graphs[0].Base();
+	const unsigned char *pParallel = (const unsigned char *)graphs[1].Base();
+	int iDiffer;
+	for ( iDiffer = 0; iDiffer < nBytes; iDiffer++ )
+	{
+		if ( pSerial[iDiffer] != pParallel[iDiffer] )
+			break;
+	}
+
+	if ( iDiffer == nBytes && graphs[0].TellPut() == graphs[1].TellPut() )
+	{
+		Msg( "  identical\n" );
+	}
+	else
+	{
+		Warning( "  graphs differ from byte %d\n", iDiffer );
+	}
 }
 
 /* Keep this around for debugging
@@ -1929,6 +2022,8 @@ void CAI_NetworkBuilder::InitZones( CAI_Network *pNetwork )
 	int nNodes = pNetwork->NumNodes();
 	CAI_Node **ppNodes = pNetwork->AccessNodes();
 
+	pNetwork->InvalidateHullZones();
+
 	if ( !nNodes )
 		return;
 		
@@ -2040,14 +2135,16 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 	{
 		m_NeighborsTable[i].Resize( nNodes );
 	}
+	// Only the nodes near the point of change are recalculated
+	CUtlVector<int> rebuildNodes;
 	for (i = 0; i < nNodes; i++)
 	{
-		// If near point of change recalculate
 		if (ppNodes[i]->NeedsRebuild())
 		{
-			InitNeighbors( pNetwork, ppNodes[i] );
+			rebuildNodes.AddToTail( i );
 		}
 	}
+	InitNeighborsForNodes( pNetwork, rebuildNodes );
 
 	// ---------------------------
 	// Force node neighbors for dynamic links
@@ -2064,13 +2161,7 @@ void CAI_NetworkBuilder::Rebuild( CAI_Network *pNetwork )
 			ppNodes[i]->ClearLinks();
 		}
 	}
-	for (i = 0; i < nNodes; i++)
-	{	
-		if (ppNodes[i]->NeedsRebuild())
-		{
-			InitLinks( pNetwork, ppNodes[i] );
-		}
-	}
+	InitLinksForNodes( pNetwork, rebuildNodes );
 
 	g_pAINetworkManager->FixupHints();
 
@@ -2148,10 +2239,13 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		m_NeighborsTable[i].Resize( nNodes );
 		m_NeighborsTable[i].ClearAllBits();
 	}
+	CUtlVector<int> buildNodes;
+	buildNodes.EnsureCapacity( nNodes );
 	for (i = 0; i < nNodes; i++)
-	{	
-		InitNeighbors( pNetwork, ppNodes[i] );
+	{
+		buildNodes.AddToTail( i );
 	}
+	InitNeighborsForNodes( pNetwork, buildNodes );
 	timer.End();
 	DevMsg( "...done initializing node neighbors. %f seconds\n", timer.GetDuration().GetSeconds() );
 
@@ -2174,10 +2268,7 @@ void CAI_NetworkBuilder::Build( CAI_Network *pNetwork )
 		// Make sure all the links are clear
 		ppNodes[i]->ClearLinks();
 	}
-	for (i = 0; i < nNodes; i++)
-	{	
-		InitLinks( pNetwork, ppNodes[i] );
-	}
+	InitLinksForNodes( pNetwork, buildNodes );
 	timer.End();
 	DevMsg( "...done determining links. %f seconds\n", timer.GetDuration().GetSeconds() );
 
@@ -2478,6 +2569,87 @@ void CAI_NetworkBuilder::InitNodePosition(CAI_Network *pNetwork, CAI_Node *pNode
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Whether two nodes are close enough and can see each other with a
+//			line trace.  Only traces, so it can run on a worker thread.
+//-----------------------------------------------------------------------------
+static bool NodesAreVisible( CAI_Node *pNode, CAI_Node *testNode )
+{
+	// The actual position of some nodes may be inside geometry as they have
+	// hull specific position offsets (e.g. climb nodes).  Get the hull specific 
+	// position using the smallest hull to make sure were not in geometry
+	Vector srcPos = pNode->GetPosition(HULL_SMALL_CENTERED);
+
+	float flDistToCheckNode = ( testNode->GetOrigin() - pNode->GetOrigin() ).LengthSqr(); 
+
+	if ( testNode->GetType() == NODE_AIR )
+	{
+		if (flDistToCheckNode > MAX_AIR_NODE_LINK_DIST_SQ) 
+			return false;
+	}
+	else
+	{
+		if (flDistToCheckNode > MAX_NODE_LINK_DIST_SQ) 
+			return false;
+	}
+
+	Vector destPos = testNode->GetPosition(HULL_SMALL_CENTERED);
+
+	trace_t	tr;
+	tr.m_pEnt = NULL;
+
+	// Try several line of sight checks
+
+	bool isVisible = false;
+
+	// ------------------
+	//  Bottom to bottom
+	// ------------------
+	AI_TraceLine ( srcPos, destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+	if (!tr.startsolid && tr.fraction == 1.0)
+	{
+		isVisible = true;
+	}
+
+	// ------------------
+	//  Top to top
+	// ------------------
+	if (!isVisible)
+	{
+		AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+		if (!tr.startsolid && tr.fraction == 1.0)
+		{	
+			isVisible = true;
+		}
+	}
+
+	// ------------------
+	//  Top to Bottom
+	// ------------------
+	if (!isVisible)
+	{
+		AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+		if (!tr.startsolid && tr.fraction == 1.0)
+		{	
+			isVisible = true;
+		}
+	}
+
+	// ------------------
+	//  Bottom to Top
+	// ------------------
+	if (!isVisible)
+	{
+		AI_TraceLine ( srcPos,destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
+		if (!tr.startsolid && tr.fraction == 1.0)
+		{	
+			isVisible = true;
+		}
+	}
+
+	return isVisible;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Set the visibility for this node.  (What nodes it can see with a
 //			line trace)
@@ -2493,10 +2665,6 @@ void CAI_NetworkBuilder::InitVisibility(CAI_Network *pNetwork, CAI_Node *pNode)
 	{
 		return;
 	}
-	// The actual position of some nodes may be inside geometry as they have
-	// hull specific position offsets (e.g. climb nodes).  Get the hull specific 
-	// position using the smallest hull to make sure were not in geometry
-	Vector srcPos = pNode->GetPosition(HULL_SMALL_CENTERED);
 
 	// Check the visibility on every other node in the network
 	for (int testnode = 0; testnode < pNetwork->NumNodes(); testnode++ )
@@ -2537,80 +2705,7 @@ void CAI_NetworkBuilder::InitVisibility(CAI_Network *pNetwork, CAI_Node *pNode)
 			continue;
 		}
 
-		float flDistToCheckNode = ( testNode->GetOrigin() - pNode->GetOrigin() ).LengthSqr(); 
-
-		if ( testNode->GetType() == NODE_AIR )
-		{
-			if (flDistToCheckNode > MAX_AIR_NODE_LINK_DIST_SQ) 
-				continue;
-		}
-		else
-		{
-			if (flDistToCheckNode > MAX_NODE_LINK_DIST_SQ) 
-				continue;
-		}
-
-		// The actual position of some nodes may be inside geometry as they have
-		// hull specific position offsets (e.g. climb nodes).  Get the hull specific 
-		// position using the smallest hull to make sure were not in geometry
-		Vector destPos = pNetwork->GetNode( testnode )->GetPosition(HULL_SMALL_CENTERED);
-
-		trace_t	tr;
-		tr.m_pEnt = NULL;
-
-		// Try several line of sight checks
-
-		bool isVisible = false;
-
-		// ------------------
-		//  Bottom to bottom
-		// ------------------
-		AI_TraceLine ( srcPos, destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-		if (!tr.startsolid && tr.fraction == 1.0)
-		{
-			isVisible = true;
-		}
-
-		// ------------------
-		//  Top to top
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Top to Bottom
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos + Vector( 0, 0, 70 ),destPos,MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Bottom to Top
-		// ------------------
-		if (!isVisible)
-		{
-			AI_TraceLine ( srcPos,destPos + Vector( 0, 0, 70 ),MASK_NPCWORLDSTATIC,NULL,COLLISION_GROUP_NONE, &tr );
-			if (!tr.startsolid && tr.fraction == 1.0)
-			{	
-				isVisible = true;
-			}
-		}
-
-		// ------------------
-		//  Failure
-		// ------------------
-		if (!isVisible)
+		if ( !NodesAreVisible( pNode, testNode ) )
 		{
 			continue;
 		}
@@ -2678,6 +2773,20 @@ void CAI_NetworkBuilder::InitNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
 	// Begin by establishing viewability to limit the number of nodes tested
 	InitVisibility( pNetwork, pNode );
 
+	PruneNeighbors( pNetwork, pNode );
+
+	m_DidSetNeighborsTable.SetBit(pNode->m_iID);
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Removes the visible nodes that are in about the same direction as
+//			a closer one
+// Input  :
+// Output :
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkBuilder::PruneNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
+{
 	AI_PROFILE_SCOPE_BEGIN( CAI_Node_InitNeighbors );
 
 	// Now check each neighbor against all other neighbors to see if one of
@@ -2783,8 +2892,6 @@ void CAI_NetworkBuilder::InitNeighbors(CAI_Network *pNetwork, CAI_Node *pNode)
 	}
 	
 	AI_PROFILE_SCOPE_END();
-
-	m_DidSetNeighborsTable.SetBit(pNode->m_iID);
 }
 
 //-----------------------------------------------------------------------------
@@ -2828,9 +2935,39 @@ static bool IsInLineForClimb( const Vector &srcPos, const Vector &srcFacing, con
 	return true;
 }
 
+//-----------------------------------------------------------------------------
+// A connection tested ahead of time by a worker thread
+//-----------------------------------------------------------------------------
+struct CAI_NetworkBuilder::ConnectionResult_t
+{
+	int		iDestNode;
+	bool	bConnected;
+	int		acceptedMotions[NUM_HULLS];
+};
+
+//-----------------------------------------------------------------------------
+// Shared by the worker threads of a parallel build. Positions are indices
+// into the list of nodes being built, which is the order the serial build
+// handles them in.
+//-----------------------------------------------------------------------------
+struct CAI_NetworkBuilder::BuildJob_t
+{
+	CAI_NetworkBuilder	*pBuilder;
+	CAI_Network			*pNetwork;
+	const int			*pNodes;		// Node id at each position
+	int					nPositions;
+	const int			*pPositions;	// Position of each node id, nPositions if it isn't being built
+	const int			*pDeletedAt;	// By node id: position that deletes it as a duplicate, -1 if already deleted, nPositions if never
+
+	CUtlVector<ConnectionResult_t> *pResults;	// Two lists per position, sorted by destination
+	CAI_TestHull		**ppTestHulls;	// NUM_HULLS per slot, one of each size
+	int					iPass;
+	long volatile		iNextPosition;
+};
+
 //-------------------------------------
 
-int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull )
+int CAI_NetworkBuilder::ComputeConnection( CAI_TestHull *pTestHull, CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull )
 {
 	int srcId = pSrcNode->m_iID;
 	int destId = pDestNode->m_iID;
@@ -2838,31 +2975,31 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 	trace_t tr;
 	
 	// Set the size of the test hull
-	if ( m_pTestHull->GetHullType() != hull ) 
+	if ( pTestHull->GetHullType() != hull ) 
 	{
-		m_pTestHull->SetHullType( hull );
-		m_pTestHull->SetHullSizeNormal( true );
+		pTestHull->SetHullType( hull );
+		pTestHull->SetHullSizeNormal( true );
 	}
 
-	if ( !( m_pTestHull->GetFlags() & FL_ONGROUND ) )
+	if ( !( pTestHull->GetFlags() & FL_ONGROUND ) )
 	{
 		DevWarning( 2, "OFFGROUND!\n" );
 	}
-	m_pTestHull->AddFlag( FL_ONGROUND );
+	pTestHull->AddFlag( FL_ONGROUND );
 
 	// ==============================================================
 	// FIRST CHECK IF HULL CAN EVEN FIT AT THESE NODES
 	// ==============================================================
 	// @Note (toml 02-10-03): this should be optimized, caching the results of CanFitAtNode() 
 	if ( !( pSrcNode->m_eNodeInfo & ( HullToBit( hull ) << NODE_ENT_FLAGS_SHIFT ) ) &&
-		 !m_pTestHull->GetNavigator()->CanFitAtNode(srcId,MASK_NPCWORLDSTATIC) )
+		 !pTestHull->GetNavigator()->CanFitAtNode(srcId,MASK_NPCWORLDSTATIC) )
 	{
 		DebugConnectMsg( srcId, destId, "      Cannot fit at node %d\n", srcId );
 		return 0;
 	}
 	
 	if (  !( pDestNode->m_eNodeInfo & ( HullToBit( hull ) << NODE_ENT_FLAGS_SHIFT ) ) &&
-		 !m_pTestHull->GetNavigator()->CanFitAtNode(destId,MASK_NPCWORLDSTATIC) )
+		 !pTestHull->GetNavigator()->CanFitAtNode(destId,MASK_NPCWORLDSTATIC) )
 	{
 		DebugConnectMsg( srcId, destId, "      Cannot fit at node %d\n", destId );
 		return 0;
@@ -2878,7 +3015,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 		// Air nodes only connect to other air nodes and nothing else
 		if (pSrcNode->m_eNodeType == NODE_AIR && pDestNode->GetType() == NODE_AIR)
 		{
-			AI_TraceHull( pSrcNode->GetOrigin(), pDestNode->GetOrigin(), NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, m_pTestHull, COLLISION_GROUP_NONE, &tr );
+			AI_TraceHull( pSrcNode->GetOrigin(), pDestNode->GetOrigin(), NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, pTestHull, COLLISION_GROUP_NONE, &tr );
 			if (!tr.startsolid && tr.fraction == 1.0)
 			{
 				result |= bits_CAP_MOVE_FLY;
@@ -2903,7 +3040,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 		{
 			AI_TraceHull( srcPos, destPos, 
 							NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), 
-							MASK_NPCWORLDSTATIC, m_pTestHull, COLLISION_GROUP_NONE, &tr );
+							MASK_NPCWORLDSTATIC, pTestHull, COLLISION_GROUP_NONE, &tr );
 			if (!tr.startsolid && tr.fraction == 1.0)
 			{
 				result |= bits_CAP_MOVE_CLIMB;
@@ -2919,7 +3056,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 				return 0;
 			}
 
-			AI_TraceHull( srcPos, destPos, NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, m_pTestHull, COLLISION_GROUP_NONE, &tr );
+			AI_TraceHull( srcPos, destPos, NAI_Hull::Mins(hull),NAI_Hull::Maxs(hull), MASK_NPCWORLDSTATIC, pTestHull, COLLISION_GROUP_NONE, &tr );
 			if (!tr.startsolid && tr.fraction == 1.0)
 			{
 				result |= bits_CAP_MOVE_CLIMB;
@@ -2947,13 +3084,13 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 		Vector srcPos	 = pSrcNode->GetPosition(hull);
 		Vector destPos	 = pDestNode->GetPosition(hull);
 
-		if (!m_pTestHull->GetMoveProbe()->CheckStandPosition( srcPos, MASK_NPCWORLDSTATIC))
+		if (!pTestHull->GetMoveProbe()->CheckStandPosition( srcPos, MASK_NPCWORLDSTATIC))
 		{
 			DebugConnectMsg( srcId, destId, "      Failed to stand at %d\n", srcId );
 			fStandFailed = true;
 		}
 
-		if (!m_pTestHull->GetMoveProbe()->CheckStandPosition( destPos, MASK_NPCWORLDSTATIC))
+		if (!pTestHull->GetMoveProbe()->CheckStandPosition( destPos, MASK_NPCWORLDSTATIC))
 		{
 			DebugConnectMsg( srcId, destId, "      Failed to stand at %d\n", destId );
 			fStandFailed = true;
@@ -2964,7 +3101,7 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 
 		if ( !fStandFailed )
 		{
-			fWalkFailed = !m_pTestHull->GetMoveProbe()->TestGroundMove( srcPos, destPos, MASK_NPCWORLDSTATIC, AITGM_IGNORE_INITIAL_STAND_POS, NULL );
+			fWalkFailed = !pTestHull->GetMoveProbe()->TestGroundMove( srcPos, destPos, MASK_NPCWORLDSTATIC, AITGM_IGNORE_INITIAL_STAND_POS, NULL );
 			if ( fWalkFailed )
 				DebugConnectMsg( srcId, destId, "      Failed to walk between nodes\n" );
 		}
@@ -2990,15 +3127,15 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 
 			// Jumps aren't bi-directional.  We can jump down further than we can jump up so
 			// we have to test for either one
-			bool canDestJump = m_pTestHull->IsJumpLegal(srcPos, destPos, destPos);
-			bool canSrcJump  = m_pTestHull->IsJumpLegal(destPos, srcPos, srcPos);
+			bool canDestJump = pTestHull->IsJumpLegal(srcPos, destPos, destPos);
+			bool canSrcJump  = pTestHull->IsJumpLegal(destPos, srcPos, srcPos);
 
 			if (canDestJump || canSrcJump) 
 			{
-				CAI_MoveProbe *pMoveProbe = m_pTestHull->GetMoveProbe();
+				CAI_MoveProbe *pMoveProbe = pTestHull->GetMoveProbe();
 
 				bool fJumpLegal = false;
-				m_pTestHull->SetGravity(1.0);
+				pTestHull->SetGravity(1.0);
 
 				AIMoveTrace_t moveTrace;
 				pMoveProbe->MoveLimit( NAV_JUMP, srcPos,destPos, MASK_NPCWORLDSTATIC, NULL, &moveTrace);
@@ -3028,7 +3165,33 @@ int CAI_NetworkBuilder::ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNo
 
 //-------------------------------------
 
-void CAI_NetworkBuilder::InitLinks(CAI_Network *pNetwork, CAI_Node *pNode)
+bool CAI_NetworkBuilder::ComputeConnections( CAI_TestHull **ppTestHulls, CAI_Node *pSrcNode, CAI_Node *pDestNode, int *pAcceptedMotions )
+{
+	bool bAllFailed = true;
+
+	if ( !(pSrcNode->m_eNodeInfo & bits_NODE_FALLEN) && !(pDestNode->m_eNodeInfo & bits_NODE_FALLEN) )
+	{
+		for (int hull = 0 ; hull < NUM_HULLS; hull++ )
+		{
+			DebugConnectMsg( pSrcNode->m_iID, pDestNode->m_iID, "   Testing for hull %s\n", NAI_Hull::Name( (Hull_t)hull  ) );
+			
+			pAcceptedMotions[hull] = ComputeConnection( ppTestHulls[hull], pSrcNode, pDestNode, (Hull_t)hull );
+			if ( pAcceptedMotions[hull] != 0 )
+				bAllFailed = false;
+		}
+	}
+	else
+	{
+		DebugConnectMsg( pSrcNode->m_iID, pDestNode->m_iID, "   No connection: one or both are fallen nodes\n" );
+		memset( pAcceptedMotions, 0, NUM_HULLS * sizeof( int ) );
+	}
+
+	return !bAllFailed;
+}
+
+//-------------------------------------
+
+void CAI_NetworkBuilder::InitLinks(CAI_Network *pNetwork, CAI_Node *pNode, const CUtlVector<ConnectionResult_t> *pComputed )
 {
 	AI_PROFILE_SCOPE( CAI_Node_InitLinks );
 
@@ -3074,24 +3237,36 @@ void CAI_NetworkBuilder::InitLinks(CAI_Network *pNetwork, CAI_Node *pNode)
 
 			bool bAllFailed = true;
 
-			if ( DebuggingConnect( pNode->m_iID, i ) )
+			// Use the connection the worker threads tested, if any
+			const ConnectionResult_t *pResult = NULL;
+			if ( pComputed )
 			{
-				DevMsg( "" ); // break here..
+				pResult = FindConnectionResult( pComputed[0], i );
+				if ( !pResult )
+				{
+					pResult = FindConnectionResult( pComputed[1], i );
+				}
 			}
 
-			if ( !(pNode->m_eNodeInfo & bits_NODE_FALLEN) && !(pDestNode->m_eNodeInfo & bits_NODE_FALLEN) )
+			if ( pResult )
+			{
+				memcpy( acceptedMotions, pResult->acceptedMotions, sizeof( acceptedMotions ) );
+				bAllFailed = !pResult->bConnected;
+			}
+			else
 			{
+				if ( DebuggingConnect( pNode->m_iID, i ) )
+				{
+					DevMsg( "" ); // break here..
+				}
+
+				CAI_TestHull *testHulls[NUM_HULLS];
 				for (int hull = 0 ; hull < NUM_HULLS; hull++ )
 				{
-					DebugConnectMsg( pNode->m_iID, i, "   Testing for hull %s\n", NAI_Hull::Name( (Hull_t)hull  ) );
-					
-					acceptedMotions[hull] = ComputeConnection( pNode, pDestNode, (Hull_t)hull );
-					if ( acceptedMotions[hull] != 0 )
-						bAllFailed = false;
+					testHulls[hull] = m_pTestHull;
 				}
+				bAllFailed = !ComputeConnections( testHulls, pNode, pDestNode, acceptedMotions );
 			}
-			else
-				DebugConnectMsg( pNode->m_iID, i, "   No connection: one or both are fallen nodes\n" );
 
 			// If there were any passible hulls create link
 			if (!bAllFailed) 
@@ -3118,3 +3293,329 @@ void CAI_NetworkBuilder::InitLinks(CAI_Network *pNetwork, CAI_Node *pNode)
 }
 
 //-----------------------------------------------------------------------------
+// Purpose: Spreading the build across threads is only worth it with more
+//			than one, and the connection debugging messages only make sense
+//			in order
+//-----------------------------------------------------------------------------
+
+bool CAI_NetworkBuilder::UseParallelBuild() const
+{
+	return ( ai_parallel_graph_build.GetBool() && ServerJobThreadCount() > 1 &&
+			 g_DebugConnectNode1 == -1 && g_DebugConnectNode2 == -1 );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Initializes the neighbors of the given nodes, as calling
+//			InitNeighbors() on each of them in order would.
+//
+//			The visibility traces run on the worker threads first. A node only
+//			traces to the nodes InitVisibility() would trace it to: those that
+//			come after it and that haven't been deleted as duplicates by then.
+//			The rest of InitNeighbors() then runs on each node in order.
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkBuilder::InitNeighborsForNodes( CAI_Network *pNetwork, const CUtlVector<int> &nodes )
+{
+	int nPositions = nodes.Count();
+	if ( !UseParallelBuild() || !nPositions )
+	{
+		for ( int iPosition = 0; iPosition < nPositions; iPosition++ )
+		{
+			InitNeighbors( pNetwork, pNetwork->GetNode( nodes[iPosition] ) );
+		}
+		return;
+	}
+
+	int nNodes = pNetwork->NumNodes();
+	CAI_Node **ppNodes = pNetwork->AccessNodes();
+
+	CUtlVector<int> positions;
+	CUtlVector<int> deletedAt;
+	CUtlVector<NodeType_e> types;
+	positions.SetCount( nNodes );
+	deletedAt.SetCount( nNodes );
+	types.SetCount( nNodes );
+
+	int i;
+	for ( i = 0; i < nNodes; i++ )
+	{
+		positions[i] = nPositions;
+		types[i] = ppNodes[i]->GetType();
+		deletedAt[i] = ( types[i] == NODE_DELETED ) ? -1 : nPositions;
+	}
+
+	// Work out which duplicates InitVisibility() will delete, and when
+	int iPosition;
+	for ( iPosition = 0; iPosition < nPositions; iPosition++ )
+	{
+		int iNode = nodes[iPosition];
+		positions[iNode] = iPosition;
+		if ( types[iNode] == NODE_DELETED )
+			continue;
+
+		const Vector &origin = ppNodes[iNode]->GetOrigin();
+		for ( i = 0; i < nNodes; i++ )
+		{
+			if ( i != iNode && types[i] != NODE_CLIMB && ppNodes[i]->GetOrigin() == origin )
+			{
+				if ( types[i] != NODE_DELETED )
+				{
+					deletedAt[i] = iPosition;
+				}
+				types[i] = NODE_DELETED;
+			}
+		}
+	}
+
+	BuildJob_t job;
+	job.pBuilder = this;
+	job.pNetwork = pNetwork;
+	job.pNodes = nodes.Base();
+	job.nPositions = nPositions;
+	job.pPositions = positions.Base();
+	job.pDeletedAt = deletedAt.Base();
+	job.pResults = NULL;
+	job.ppTestHulls = NULL;
+	job.iPass = 0;
+	job.iNextPosition = 0;
+
+	// Traces would otherwise update the partition from the worker threads
+	UpdateDirtySpatialPartitionEntities();
+	ServerJobs_ParallelFor( nPositions, 8, InitVisibilityJob, &job, 1 );
+
+	// Now finish each node in order. This deletes the duplicates, and copies
+	// the visibility of the nodes that were done before
+	for ( iPosition = 0; iPosition < nPositions; iPosition++ )
+	{
+		int iNode = nodes[iPosition];
+		CAI_Node *pNode = ppNodes[iNode];
+
+		if ( pNode->GetType() != NODE_DELETED )
+		{
+			Assert( deletedAt[iNode] >= iPosition );
+
+			for ( i = 0; i < nNodes; i++ )
+			{
+				if ( i == iNode )
+					continue;
+
+				CAI_Node *testNode = ppNodes[i];
+				if ( testNode->GetOrigin() == pNode->GetOrigin() && testNode->GetType() != NODE_CLIMB )
+				{
+					testNode->SetType( NODE_DELETED );
+					DevMsg( 2, "Probable duplicate node placed at %s\n", VecToString(testNode->GetOrigin()) );
+					continue;
+				}
+
+				if ( testNode->GetType() == NODE_DELETED )
+					continue;
+
+				if ( m_DidSetNeighborsTable.GetBit( i ) && m_NeighborsTable[i].GetBit( iNode ) )
+				{
+					m_NeighborsTable[iNode].SetBit( i );
+				}
+			}
+		}
+		else
+		{
+			Assert( deletedAt[iNode] < iPosition );
+		}
+
+		PruneNeighbors( pNetwork, pNode );
+
+		m_DidSetNeighborsTable.SetBit( iNode );
+	}
+}
+
+//-------------------------------------
+
+void CAI_NetworkBuilder::InitVisibilityJob( void *pContext, int iFirst, int iLast )
+{
+	BuildJob_t *pJob = (BuildJob_t *)pContext;
+	CAI_Node **ppNodes = pJob->pNetwork->AccessNodes();
+	int nNodes = pJob->pNetwork->NumNodes();
+
+	for ( int iPosition = iFirst; iPosition < iLast; iPosition++ )
+	{
+		int iNode = pJob->pNodes[iPosition];
+		CBitString &neighbors = pJob->pBuilder->m_NeighborsTable[iNode];
+
+		neighbors.ClearAllBits();
+		if ( pJob->pDeletedAt[iNode] < iPosition )
+			continue;
+
+		neighbors.SetBit( iNode );
+		for ( int i = 0; i < nNodes; i++ )
+		{
+			if ( i == iNode || pJob->pDeletedAt[i] <= iPosition || pJob->pPositions[i] < iPosition )
+				continue;
+
+			if ( NodesAreVisible( ppNodes[iNode], ppNodes[i] ) )
+			{
+				neighbors.SetBit( i );
+			}
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Initializes the links of the given nodes, as calling InitLinks()
+//			on each of them in order would.
+//
+//			The connections are tested on the worker threads first, in two
+//			passes. The first tests each node against the nodes that come
+//			after it. The second tests it against the nodes before it that
+//			the first pass didn't connect it to, which the serial build tests
+//			again from this side. InitLinks() then makes the links in order.
+//-----------------------------------------------------------------------------
+
+void CAI_NetworkBuilder::InitLinksForNodes( CAI_Network *pNetwork, const CUtlVector<int> &nodes )
+{
+	int nPositions = nodes.Count();
+	if ( !UseParallelBuild() || !nPositions )
+	{
+		for ( int iPosition = 0; iPosition < nPositions; iPosition++ )
+		{
+			InitLinks( pNetwork, pNetwork->GetNode( nodes[iPosition] ) );
+		}
+		return;
+	}
+
+	int nNodes = pNetwork->NumNodes();
+
+	CUtlVector<int> positions;
+	positions.SetCount( nNodes );
+
+	int i;
+	for ( i = 0; i < nNodes; i++ )
+	{
+		positions[i] = nPositions;
+	}
+	for ( i = 0; i < nPositions; i++ )
+	{
+		positions[nodes[i]] = i;
+	}
+
+	// Each thread gets a hull of every size, so none of them are resized
+	int nSlots = ServerJobThreadCount();
+	CUtlVector<CAI_TestHull *> testHulls;
+	testHulls.SetCount( nSlots * NUM_HULLS );
+	for ( i = 0; i < testHulls.Count(); i++ )
+	{
+		testHulls[i] = CAI_TestHull::CreateFixedTestHull( (Hull_t)( i % NUM_HULLS ) );
+		testHulls[i]->GetNavigator()->SetNetwork( pNetwork );
+	}
+
+	CUtlVector< CUtlVector<ConnectionResult_t> > results;
+	results.SetCount( 2 * nPositions );
+
+	BuildJob_t job;
+	job.pBuilder = this;
+	job.pNetwork = pNetwork;
+	job.pNodes = nodes.Base();
+	job.nPositions = nPositions;
+	job.pPositions = positions.Base();
+	job.pDeletedAt = NULL;
+	job.pResults = results.Base();
+	job.ppTestHulls = testHulls.Base();
+
+	// Nodes take very different times to connect, so each thread takes the
+	// next one nobody has started rather than a fixed range
+	for ( job.iPass = 0; job.iPass < 2; job.iPass++ )
+	{
+		job.iNextPosition = 0;
+
+		// The test hulls were just sized, and traces would otherwise update
+		// the partition from the worker threads
+		UpdateDirtySpatialPartitionEntities();
+		ServerJobs_ParallelFor( nSlots, 1, ComputeConnectionsJob, &job, 1 );
+	}
+
+	for ( i = 0; i < nPositions; i++ )
+	{
+		InitLinks( pNetwork, pNetwork->GetNode( nodes[i] ), &results[2 * i] );
+	}
+
+	for ( i = 0; i < testHulls.Count(); i++ )
+	{
+		UTIL_RemoveImmediate( testHulls[i] );
+	}
+}
+
+//-------------------------------------
+
+void CAI_NetworkBuilder::ComputeConnectionsJob( void *pContext, int iFirst, int iLast )
+{
+	BuildJob_t *pJob = (BuildJob_t *)pContext;
+
+	for ( int iSlot = iFirst; iSlot < iLast; iSlot++ )
+	{
+		CAI_TestHull **ppTestHulls = pJob->ppTestHulls + iSlot * NUM_HULLS;
+		for ( ;; )
+		{
+			int iPosition = ThreadInterlockedIncrement( &pJob->iNextPosition ) - 1;
+			if ( iPosition >= pJob->nPositions )
+				break;
+
+			pJob->pBuilder->ComputeNodeConnections( pJob, ppTestHulls, iPosition );
+		}
+	}
+}
+
+//-------------------------------------
+
+void CAI_NetworkBuilder::ComputeNodeConnections( BuildJob_t *pJob, CAI_TestHull **ppTestHulls, int iPosition )
+{
+	int iNode = pJob->pNodes[iPosition];
+	CAI_Node *pNode = pJob->pNetwork->GetNode( iNode );
+	const CBitString &neighbors = m_NeighborsTable[iNode];
+	CUtlVector<ConnectionResult_t> &results = pJob->pResults[2 * iPosition + pJob->iPass];
+
+	for ( int i = 0; i < pJob->pNetwork->NumNodes(); i++ )
+	{
+		if ( !neighbors.GetBit( i ) )
+			continue;
+
+		int iDestPosition = pJob->pPositions[i];
+		bool bAfter = ( iDestPosition >= iPosition );
+		if ( bAfter != ( pJob->iPass == 0 ) )
+			continue;
+
+		CAI_Node *pDestNode = pJob->pNetwork->GetNode( i );
+		if ( pNode->HasLink( i ) || pDestNode->HasLink( iNode ) )
+			continue;
+
+		// The other node links to this one when it's done first
+		if ( !bAfter )
+		{
+			const ConnectionResult_t *pFirst = FindConnectionResult( pJob->pResults[2 * iDestPosition], iNode );
+			if ( pFirst && pFirst->bConnected )
+				continue;
+		}
+
+		ConnectionResult_t &result = results[ results.AddToTail() ];
+		result.iDestNode = i;
+		result.bConnected = ComputeConnections( ppTestHulls, pNode, pDestNode, result.acceptedMotions );
+	}
+}
+
+//-------------------------------------
+
+const CAI_NetworkBuilder::ConnectionResult_t *CAI_NetworkBuilder::FindConnectionResult( const CUtlVector<ConnectionResult_t> &results, int iDestNode )
+{
+	int low = 0;
+	int high = results.Count() - 1;
+	while ( low <= high )
+	{
+		int mid = ( low + high ) / 2;
+		if ( results[mid].iDestNode < iDestNode )
+			low = mid + 1;
+		else if ( results[mid].iDestNode > iDestNode )
+			high = mid - 1;
+		else
+			return &results[mid];
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
@@ -19,6 +19,7 @@ class CAI_Network;
 class CAI_Node;
 class CAI_Link;
 class CAI_TestHull;
+class CUtlBuffer;
 
 //-----------------------------------------------------------------------------
 // CAI_NetworkManager
@@ -58,6 +59,8 @@ public:
 	void			FixupHints();
 	void			MarkDontSaveGraph();
 
+	void			CompareGraphBuilds();	// Rebuilds every node serially and in parallel, and compares the results
+
 public:
 	CAI_NetworkEditTools *	GetEditOps() { return m_pEditOps; }
 	CAI_Network *			GetNetwork() { return m_pNetwork; }
@@ -67,6 +70,7 @@ private:
 	void			DelayedInit();
 	void			RebuildThink();
 	void			SaveNetworkGraph( void) ;	
+	void			WriteNetworkGraph( CUtlBuffer &buf );	// The contents of the .ain file
 	static bool		IsAIFileCurrent( const char *szMapName );		
 	
 	static bool				gm_fNetworksLoaded;							// Have AINetworks been loaded
@@ -103,16 +107,32 @@ public:
 	void			InitZones( CAI_Network *pNetwork );
 
 private:
+	struct ConnectionResult_t;
+	struct BuildJob_t;
+
 	void			InitVisibility( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitNeighbors( CAI_Network *pNetwork, CAI_Node *pNode );
+	void			PruneNeighbors( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitClimbNodePosition( CAI_Network *pNetwork, CAI_Node *pNode );
 	void			InitGroundNodePosition( CAI_Network *pNetwork, CAI_Node *pNode );
-	void			InitLinks( CAI_Network *pNetwork, CAI_Node *pNode );
+	void			InitLinks( CAI_Network *pNetwork, CAI_Node *pNode, const CUtlVector<ConnectionResult_t> *pComputed = NULL );
 	void			ForceDynamicLinkNeighbors();
 	
+	// Run InitNeighbors() or InitLinks() on the given nodes, in order, spreading
+	// the traces across the server job pool when UseParallelBuild() is true
+	void			InitNeighborsForNodes( CAI_Network *pNetwork, const CUtlVector<int> &nodes );
+	void			InitLinksForNodes( CAI_Network *pNetwork, const CUtlVector<int> &nodes );
+	bool			UseParallelBuild() const;
+
+	static void		InitVisibilityJob( void *pContext, int iFirst, int iLast );
+	static void		ComputeConnectionsJob( void *pContext, int iFirst, int iLast );
+	void			ComputeNodeConnections( BuildJob_t *pJob, CAI_TestHull **ppTestHulls, int iPosition );
+	static const ConnectionResult_t *FindConnectionResult( const CUtlVector<ConnectionResult_t> &results, int iDestNode );
+
 	void			FloodFillZone( CAI_Node **ppNodes, CAI_Node *pNode, int zone );
 
-	int				ComputeConnection( CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull );
+	int				ComputeConnection( CAI_TestHull *pTestHull, CAI_Node *pSrcNode, CAI_Node *pDestNode, Hull_t hull );
+	bool			ComputeConnections( CAI_TestHull **ppTestHulls, CAI_Node *pSrcNode, CAI_Node *pDestNode, int *pAcceptedMotions );
 	
 	void 			BeginBuild();
 	void			EndBuild();
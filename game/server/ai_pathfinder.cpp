@@ -21,6 +21,9 @@
 #include "ai_dynamiclink.h"
 #include "ai_hint.h"
 #include "bitstring.h"
+#include "filesystem.h"
+#include "utlbuffer.h"
+#include "tier0/fasttimer.h"
 
 //@todo: bad dependency!
 #include "ai_navigator.h"
@@ -258,6 +261,26 @@ int CAI_Pathfinder::NearestNodeToPoint( const Vector &vecOrigin )
 	return GetNetwork()->NearestNodeToPoint( GetOuter(), vecOrigin );
 }
 
+//-----------------------------------------------------------------------------
+// Recorded FindBestPath() queries, for ai_bench_pathfind
+//-----------------------------------------------------------------------------
+
+#define AI_PATH_QUERY_FILE_VERSION	1
+
+struct AI_PathQuery_t
+{
+	int		startID;
+	int		endID;
+	int		hull;
+	int		capabilities;
+};
+
+ConVar ai_pathfind_heap( "ai_pathfind_heap", "1", FCVAR_CHEAT, "FindBestPath() keeps its open list in a heap. 0 uses the original linear scan, for comparison." );
+ConVar ai_pathfind_record( "ai_pathfind_record", "0", FCVAR_CHEAT, "Records FindBestPath() queries for ai_pathfind_save_queries and ai_bench_pathfind" );
+
+static CUtlVector<AI_PathQuery_t> g_RecordedPathQueries;
+static bool g_bReplayingPathQueries;
+
 //-----------------------------------------------------------------------------
 // Purpose: Build a path between two nodes
 //-----------------------------------------------------------------------------
@@ -273,6 +296,130 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	m_nPerfStatPB++;
 #endif
 
+	if ( ai_pathfind_record.GetBool() && !g_bReplayingPathQueries )
+	{
+		AI_PathQuery_t query;
+		query.startID = startID;
+		query.endID = endID;
+		query.hull = GetHullType();
+		query.capabilities = CapabilitiesGet();
+		g_RecordedPathQueries.AddToTail( query );
+	}
+
+	if ( !ai_pathfind_heap.GetBool() )
+		return FindBestPathLinear( startID, endID );
+
+	// If no link this hull fits through joins the two nodes there's no
+	// point searching everything reachable from the start to find that out
+	if ( !GetNetwork()->IsConnected( startID, endID, GetHullType() ) )
+		return NULL;
+
+	CAI_Node **pAInode = GetNetwork()->AccessNodes();
+	Hull_t hull = GetHullType();
+	CAI_Navigator *pNavigator = GetOuter()->GetNavigator();
+
+	// ------------- INITIALIZE ------------------------
+	int iSearch;
+	int *nodeP;
+	AI_NodeSearchState_t *pState = GetNetwork()->BeginSearch( &iSearch, &nodeP );
+	CAI_OpenList &openList = GetNetwork()->AccessOpenList();
+
+	Vector vecEnd = pAInode[endID]->GetPosition( hull );
+
+	AI_NodeSearchState_t &startState = pState[startID];
+	startState.g = 0;
+	startState.h = 0.1*(pAInode[startID]->GetPosition( hull ) - vecEnd).Length(); // Don't want to over estimate
+	startState.f = startState.g + startState.h;
+	startState.iSearch = iSearch;
+	startState.bOpen = true;
+	startState.bHasH = false;		// The start's estimate is only used for the start
+	nodeP[startID] = NO_NODE;
+
+	openList.Insert( AI_OpenNode_t( startID, startState.f ) );
+
+	// --------------- FIND BEST PATH ------------------
+	while ( openList.Count() ) 
+	{
+		AI_OpenNode_t head = openList.ElementAtHead();
+		openList.RemoveAtHead();
+
+		// Skip entries left behind when a node's F improved
+		int smallestID = head.nodeIndex;
+		AI_NodeSearchState_t &smallestState = pState[smallestID];
+		if ( !smallestState.bOpen || smallestState.f != head.f )
+			continue;
+
+		smallestState.bOpen = false;
+
+		CAI_Node *pSmallestNode = pAInode[smallestID];
+		
+		if (GetOuter()->IsUnusableNode(smallestID, pSmallestNode->GetHint()))
+			continue;
+
+		if (smallestID == endID) 
+		{
+			AI_Waypoint_t* route = MakeRouteFromParents(nodeP, endID);
+			return route;
+		}
+
+		Vector r1 = pSmallestNode->GetPosition( hull );
+
+		// Check this if the node is immediately in the path after the startNode 
+		// that it isn't blocked
+		for (int link=0; link < pSmallestNode->NumLinks();link++) 
+		{
+			CAI_Link *nodeLink = pSmallestNode->GetLinkByIndex(link);
+			
+			if (!IsLinkUsable(nodeLink,smallestID))
+				continue;
+
+			// FIXME: the cost function should take into account Node costs (danger, flanking, etc).
+			int moveType = nodeLink->m_iAcceptedMoveTypes[hull] & CapabilitiesGet();
+			int testID	 = nodeLink->DestNodeID(smallestID);
+
+			Vector r2 = pAInode[testID]->GetPosition( hull );
+			float dist   = pNavigator->MovementCost( moveType, r1, r2 ); // MovementCost takes ref parameters!!
+
+			if ( dist == FLT_MAX )
+				continue;
+
+			float new_g  = smallestState.g + dist;
+
+			AI_NodeSearchState_t &testState = pState[testID];
+			bool bSeen = ( testState.iSearch == iSearch );
+			if ( !bSeen || (new_g < testState.g) ) 
+			{
+				if ( !bSeen )
+				{
+					testState.iSearch = iSearch;
+					testState.bHasH = false;
+				}
+				if ( !testState.bHasH )
+				{
+					testState.h = (r2 - vecEnd).Length();
+					testState.bHasH = true;
+				}
+
+				nodeP[testID] = smallestID;
+				testState.g = new_g;
+				testState.f = testState.g + testState.h;
+				testState.bOpen = true;
+
+				openList.Insert( AI_OpenNode_t( testID, testState.f ) );
+			}
+		}
+	}
+
+	return NULL;   
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: The original FindBestPath(), which scans every node for the
+//			lowest F each step. Kept for comparison (ai_pathfind_heap 0).
+//-----------------------------------------------------------------------------
+
+AI_Waypoint_t *CAI_Pathfinder::FindBestPathLinear(int startID, int endID) 
+{
 	int nNodes = GetNetwork()->NumNodes();
 	CAI_Node **pAInode = GetNetwork()->AccessNodes();
 
@@ -355,6 +502,202 @@ AI_Waypoint_t *CAI_Pathfinder::FindBestPath(int startID, int endID)
 	return NULL;   
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Saved path queries live next to the map's node graph
+//-----------------------------------------------------------------------------
+
+static void GetPathQueryFilename( char *pszFilename, int nMaxLen )
+{
+	Q_snprintf( pszFilename, nMaxLen, "maps/graphs/%s.aiq", STRING( gpGlobals->mapname ) );
+}
+
+CON_COMMAND_F( ai_pathfind_save_queries, "Saves the queries recorded with ai_pathfind_record to maps/graphs/<map>.aiq", FCVAR_CHEAT )
+{
+	if ( !g_pBigAINet )
+		return;
+
+	char szFilename[MAX_PATH];
+	GetPathQueryFilename( szFilename, sizeof( szFilename ) );
+
+	CUtlBuffer buf;
+	buf.PutInt( AI_PATH_QUERY_FILE_VERSION );
+	buf.PutInt( g_pBigAINet->NumNodes() );
+	buf.PutInt( g_RecordedPathQueries.Count() );
+	for ( int i = 0; i < g_RecordedPathQueries.Count(); i++ )
+	{
+		const AI_PathQuery_t &query = g_RecordedPathQueries[i];
+		buf.PutShort( query.startID );
+		buf.PutShort( query.endID );
+		buf.PutChar( query.hull );
+		buf.PutInt( query.capabilities );
+	}
+
+	if ( !filesystem->WriteFile( szFilename, "DEFAULT_WRITE_PATH", buf ) )
+	{
+		Warning( "Couldn't write %s\n", szFilename );
+		return;
+	}
+
+	Msg( "Saved %d path queries to %s\n", g_RecordedPathQueries.Count(), szFilename );
+}
+
+//-----------------------------------------------------------------------------
+
+static bool LoadPathQueries( CUtlVector<AI_PathQuery_t> &queries )
+{
+	char szFilename[MAX_PATH];
+	GetPathQueryFilename( szFilename, sizeof( szFilename ) );
+
+	CUtlBuffer buf;
+	if ( !filesystem->ReadFile( szFilename, "GAME", buf ) )
+		return false;
+
+	if ( buf.GetInt() != AI_PATH_QUERY_FILE_VERSION || buf.GetInt() != g_pBigAINet->NumNodes() )
+	{
+		Warning( "%s doesn't match this map's node graph\n", szFilename );
+		return false;
+	}
+
+	int nQueries = buf.GetInt();
+	for ( int i = 0; i < nQueries && buf.IsValid(); i++ )
+	{
+		AI_PathQuery_t query;
+		query.startID = buf.GetShort();
+		query.endID = buf.GetShort();
+		query.hull = buf.GetChar();
+		query.capabilities = buf.GetInt();
+		if ( buf.IsValid() && 
+			 query.startID >= 0 && query.startID < g_pBigAINet->NumNodes() &&
+			 query.endID >= 0 && query.endID < g_pBigAINet->NumNodes() )
+		{
+			queries.AddToTail( query );
+		}
+	}
+
+	Msg( "Loaded %d path queries from %s\n", queries.Count(), szFilename );
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+static unsigned int PathQueryChecksum( AI_Waypoint_t *pRoute )
+{
+	unsigned int checksum = 1;
+	for ( ; pRoute; pRoute = pRoute->GetNext() )
+	{
+		checksum = checksum * 31 + pRoute->iNodeID + 1;
+	}
+	return checksum;
+}
+
+CON_COMMAND_F( ai_bench_pathfind, "Replays saved or recorded FindBestPath() queries through the linear scan and heap open lists. Without any, makes random queries for the NPCs in the map. Usage: ai_bench_pathfind [passes]", FCVAR_CHEAT )
+{
+	if ( !g_pBigAINet || !g_pBigAINet->NumNodes() )
+	{
+		Msg( "ai_bench_pathfind: no node graph\n" );
+		return;
+	}
+
+	int nPasses = ( engine->Cmd_Argc() > 1 ) ? clamp( atoi( engine->Cmd_Argv( 1 ) ), 1, 1000 ) : 10;
+
+	CUtlVector<AI_PathQuery_t> queries;
+	if ( !LoadPathQueries( queries ) )
+	{
+		queries.AddVectorToTail( g_RecordedPathQueries );
+	}
+
+	// Each query runs on an NPC with the hull and capabilities it was made for
+	CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+	int nAIs = g_AI_Manager.NumAIs();
+	if ( !queries.Count() )
+	{
+		for ( int i = 0; i < nAIs && i < 32; i++ )
+		{
+			for ( int j = 0; j < 32; j++ )
+			{
+				AI_PathQuery_t query;
+				query.startID = random->RandomInt( 0, g_pBigAINet->NumNodes() - 1 );
+				query.endID = random->RandomInt( 0, g_pBigAINet->NumNodes() - 1 );
+				query.hull = ppAIs[i]->GetHullType();
+				query.capabilities = ppAIs[i]->CapabilitiesGet();
+				queries.AddToTail( query );
+			}
+		}
+	}
+
+	CUtlVector<CAI_BaseNPC *> queryNPCs;
+	int i, j;
+	for ( i = 0; i < queries.Count(); i++ )
+	{
+		CAI_BaseNPC *pNPC = NULL;
+		for ( j = 0; j < nAIs; j++ )
+		{
+			if ( ppAIs[j]->GetHullType() == queries[i].hull && ppAIs[j]->GetPathfinder() )
+			{
+				pNPC = ppAIs[j];
+				if ( (int)ppAIs[j]->CapabilitiesGet() == queries[i].capabilities )
+					break;
+			}
+		}
+		queryNPCs.AddToTail( pNPC );
+	}
+
+	CUtlVector<unsigned int> checksums[2];
+	double flMS[2];
+	int nRun = 0, nFound = 0;
+	bool bWasHeap = ai_pathfind_heap.GetBool();
+	g_bReplayingPathQueries = true;
+
+	for ( int iMethod = 0; iMethod < 2; iMethod++ )
+	{
+		ai_pathfind_heap.SetValue( iMethod );
+
+		CFastTimer timer;
+		timer.Start();
+		for ( int iPass = 0; iPass < nPasses; iPass++ )
+		{
+			for ( i = 0; i < queries.Count(); i++ )
+			{
+				if ( !queryNPCs[i] )
+					continue;
+
+				AI_Waypoint_t *pRoute = queryNPCs[i]->GetPathfinder()->FindBestPath( queries[i].startID, queries[i].endID );
+				if ( iPass == 0 )
+				{
+					checksums[iMethod].AddToTail( PathQueryChecksum( pRoute ) );
+					if ( iMethod == 0 )
+					{
+						nRun++;
+						nFound += ( pRoute != NULL );
+					}
+				}
+				DeleteAll( pRoute );
+			}
+		}
+		timer.End();
+		flMS[iMethod] = timer.GetDuration().GetMillisecondsF() / nPasses;
+	}
+
+	g_bReplayingPathQueries = false;
+	ai_pathfind_heap.SetValue( bWasHeap );
+
+	int nDifferent = 0;
+	for ( i = 0; i < checksums[0].Count(); i++ )
+	{
+		nDifferent += ( checksums[0][i] != checksums[1][i] );
+	}
+
+	Msg( "ai_bench_pathfind: %d nodes, %d queries (%d without an NPC to run them), %d found a path\n", 
+		g_pBigAINet->NumNodes(), queries.Count(), queries.Count() - nRun, nFound );
+	Msg( "  linear scan  %8.3f ms per pass\n", flMS[0] );
+	Msg( "  heap         %8.3f ms per pass (%.1fx)\n", flMS[1], flMS[0] / max( flMS[1], 0.001 ) );
+	if ( nDifferent )
+	{
+		// Stale link checks and node locks change between runs, so a few can differ
+		Msg( "  %d routes differ\n", nDifferent );
+	}
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Find a short random path of at least pathLength distance.  If
 //			vDirection is given random path will expand in the given direction,
@@ -113,6 +113,7 @@ private:
 
 	//---------------------------------
 	
+	AI_Waypoint_t*	FindBestPathLinear	(int startID, int endID);
 	AI_Waypoint_t*	MakeRouteFromParents(int *parentArray, int endID);
 	AI_Waypoint_t*	CreateNodeWaypoint( Hull_t hullType, int nodeID, int nodeFlags = 0 );
 
@@ -20,6 +20,7 @@
 #include "isaverestore.h"
 #include "utlbuffer.h"
 #include "stringpool.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -27,6 +28,8 @@
 ConVar rr_debugresponses( "rr_debugresponses", "0", FCVAR_NONE, "Show verbose matching output (1 for simple, 2 for rule scoring). If set to 3, it will only show response success/failure for npc_selected NPCs." );
 ConVar rr_debugrule( "rr_debugrule", "", FCVAR_NONE, "If set to the name of the rule, that rule's score will be shown whenever a concept is passed into the response rules system.");
 ConVar rr_dumpresponses( "rr_dumpresponses", "0", FCVAR_NONE, "Dump all response_rules.txt and rules (requires restart)" );
+ConVar rr_useruleindex( "rr_useruleindex", "1", FCVAR_NONE, "Only score the rules for the concept being spoken, skipping rules that need criteria the speaker doesn't have." );
+ConVar rr_capturecriteria( "rr_capturecriteria", "0", FCVAR_CHEAT, "Keep this many of the most recent criteria sets, for rr_benchrules to replay." );
 
 static CUtlSymbolTable g_RS;
 
@@ -57,6 +60,7 @@ public:
 		maxequals = false;
 		maxval = 0.0f;
 		minval = 0.0f;
+		tokenval = 0.0f;
 
 		token = UTL_INVAL_SYMBOL;
 		rawtoken = UTL_INVAL_SYMBOL;
@@ -108,6 +112,7 @@ public:
 
 	float	maxval;
 	float	minval;
+	float	tokenval;		// The token as a number, for numeric equality
 
 	bool	valid : 1;      //1
 	bool	isnumeric : 1;  //2
@@ -120,6 +125,7 @@ public:
 	void	SetToken( char const *s )
 	{
 		token = g_RS.AddString( s );
+		tokenval = (float)atof( s );
 	}
 
 	char const *GetToken()
@@ -394,6 +400,7 @@ struct Criteria
 		value = NULL;
 		weight.SetFloat( 1.0f );
 		required = false;
+		nameindex = -1;
 	}
 	Criteria& operator =(const Criteria& src )
 	{
@@ -404,6 +411,7 @@ struct Criteria
 		value = CopyString( src.value );
 		weight = src.weight;
 		required = src.required;
+		nameindex = src.nameindex;
 
 		matcher = src.matcher;
 
@@ -421,6 +429,7 @@ struct Criteria
 		value = CopyString( src.value );
 		weight = src.weight;
 		required = src.required;
+		nameindex = src.nameindex;
 
 		matcher = src.matcher;
 
@@ -446,6 +455,9 @@ struct Criteria
 	float16						weight;
 	bool						required;
 
+	// Index into the response system's interned criteria names
+	short						nameindex;
+
 	Matcher						matcher;
 
 	// Indices into sub criteria
@@ -565,6 +577,9 @@ public:
 	
 	void		Clear();
 
+	// Replays captured (or made up) criteria sets through the rule index and a full scan of the rules
+	void		BenchmarkRuleIndex( int nIterations );
+
 protected:
 
 	virtual const char *GetScriptFile( void ) = 0;
@@ -583,6 +598,21 @@ private:
 		float		value;
 	};
 
+	// Range of m_ConceptRules
+	struct ConceptRules
+	{
+		int			first;
+		int			count;
+	};
+
+	// A criteria set with its names resolved against the interned criteria names
+	struct ResolvedCriteria
+	{
+		short		*setindex;		// By name index, -1 if the set doesn't have the criterion
+		float		*value;			// The set's value as a number, by name index
+		uint64		present;		// Bits of the prefiltered names the set has
+	};
+
 	struct ResponseSearchResult
 	{
 		ResponseSearchResult()
@@ -660,17 +690,25 @@ private:
 
 	int			ParseOneCriterion( const char *criterionName );
 	
-	bool		Compare( const char *setValue, Criteria *c, bool verbose = false );
+	bool		Compare( const char *setValue, float v, Criteria *c, bool verbose = false );
 	bool		CompareUsingMatcher( const char *setValue, Matcher& m, bool verbose = false );
+	bool		CompareUsingMatcher( const char *setValue, float v, Matcher& m );
+	float		ComputeValue( const char *setValue );
 	void		ComputeMatcher( Criteria *c, Matcher& matcher );
 	void		ResolveToken( Matcher& matcher, char *token, size_t bufsize, char const *rawtoken );
 	float		LookupEnumeration( const char *name, bool& found );
 
 	int			FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose );
+	int			FindBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool useindex, CUtlVector< int >& bestrules );
+
+	int			InternCriterionName( const char *name );
+	void		BuildRuleIndex();
+	void		ResolveCriteria( const AI_CriteriaSet& set, ResolvedCriteria& resolved );
+	void		CaptureCriteria( const AI_CriteriaSet& set );
 
-	float		ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose = false );
-	float		RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/ );
-	float		ScoreCriteriaAgainstRuleCriteria( const AI_CriteriaSet& set, int icriterion, bool& exclude, bool verbose = false );
+	float		ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose = false, const ResolvedCriteria *resolved = NULL );
+	float		RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/, const ResolvedCriteria *resolved );
+	float		ScoreCriteriaAgainstRuleCriteria( const AI_CriteriaSet& set, int icriterion, bool& exclude, bool verbose = false, const ResolvedCriteria *resolved = NULL );
 	bool		GetBestResponse( ResponseSearchResult& result, Rule *rule, bool verbose = false, IResponseFilter *pFilter = NULL );
 	bool		ResolveResponse( ResponseSearchResult& result, int depth, const char *name, bool verbose = false, IResponseFilter *pFilter = NULL );
 	int			SelectWeightedResponseFromResponseGroup( ResponseGroup *g, IResponseFilter *pFilter );
@@ -696,6 +734,21 @@ private:
 	CUtlDict< Rule, short >	m_Rules;
 	CUtlDict< Enumeration, short > m_Enumerations;
 
+	// Rule index, built once the scripts are loaded.  Rules that require a
+	// concept are listed under it, and are only scored for sets with that
+	// concept.  Rules that require a criterion the set doesn't have are
+	// skipped using a bit per criterion name.
+	CUtlDict< int, short >	m_CriteriaNames;
+	CUtlVector< int >		m_CriteriaNameBits;		// By name index, -1 if it has no bit
+	CUtlDict< ConceptRules, short >	m_RulesByConcept;
+	CUtlVector< unsigned short >	m_ConceptRules;			// Grouped by concept, in rule order
+	CUtlVector< unsigned short >	m_RulesWithoutConcept;
+	CUtlVector< uint64 >	m_RuleRequiredNames;	// By rule
+	int			m_iConceptName;
+
+	CUtlVector< AI_CriteriaSet * >	m_CapturedCriteria;
+	int			m_iNextCapturedCriteria;
+
 	char		token[ 1204 ];
 
 	bool		m_bUnget;
@@ -745,6 +798,8 @@ CResponseSystem::CResponseSystem()
 	token[0] = 0;
 	m_bUnget = false;
 	m_bPrecache = true;
+	m_iConceptName = -1;
+	m_iNextCapturedCriteria = 0;
 }
 
 //-----------------------------------------------------------------------------
@@ -752,6 +807,7 @@ CResponseSystem::CResponseSystem()
 //-----------------------------------------------------------------------------
 CResponseSystem::~CResponseSystem()
 {
+	m_CapturedCriteria.PurgeAndDeleteElements();
 }
 
 //-----------------------------------------------------------------------------
@@ -800,6 +856,14 @@ void CResponseSystem::Clear()
 	m_Criteria.RemoveAll();
 	m_Rules.RemoveAll();
 	m_Enumerations.RemoveAll();
+
+	m_CriteriaNames.RemoveAll();
+	m_CriteriaNameBits.Purge();
+	m_RulesByConcept.RemoveAll();
+	m_ConceptRules.Purge();
+	m_RulesWithoutConcept.Purge();
+	m_RuleRequiredNames.Purge();
+	m_iConceptName = -1;
 }
 
 //-----------------------------------------------------------------------------
@@ -974,18 +1038,36 @@ void CResponseSystem::ComputeMatcher( Criteria *c, Matcher& matcher )
 	matcher.valid = true;
 }
 
-bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, bool verbose /*=false*/ )
+//-----------------------------------------------------------------------------
+// Purpose: Converts a criteria set value to the number matchers compare against
+//-----------------------------------------------------------------------------
+float CResponseSystem::ComputeValue( const char *setValue )
 {
-	if ( !m.valid )
-		return false;
-
 	float v = (float)atof( setValue );
 	if ( setValue[0] == '[' )
 	{
 		bool found = false;
 		v = LookupEnumeration( setValue, found );
 	}
-	
+	return v;
+}
+
+bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, bool verbose /*=false*/ )
+{
+	if ( !m.valid )
+		return false;
+
+	return CompareUsingMatcher( setValue, ComputeValue( setValue ), m );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Same as above, with the value already converted by ComputeValue()
+//-----------------------------------------------------------------------------
+bool CResponseSystem::CompareUsingMatcher( const char *setValue, float v, Matcher& m )
+{
+	if ( !m.valid )
+		return false;
+
 	int minmaxcount = 0;
 
 	if ( m.usemin )
@@ -1030,7 +1112,7 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 	{
 		if ( m.isnumeric )
 		{
-			if ( v == (float)atof( m.GetToken() ) )
+			if ( v == m.tokenval )
 				return false;
 		}
 		else
@@ -1049,18 +1131,18 @@ bool CResponseSystem::CompareUsingMatcher( const char *setValue, Matcher& m, boo
 		if ( !setValue || !setValue[0] )
 			return false;
 
-		return v == (float)atof( m.GetToken() );
+		return v == m.tokenval;
 	}
 
 	return !Q_stricmp( setValue, m.GetToken() ) ? true : false;
 }
 
-bool CResponseSystem::Compare( const char *setValue, Criteria *c, bool verbose /*= false*/ )
+bool CResponseSystem::Compare( const char *setValue, float v, Criteria *c, bool verbose /*= false*/ )
 {
 	Assert( c );
 	Assert( setValue );
 
-	bool bret = CompareUsingMatcher( setValue, c->matcher, verbose );
+	bool bret = CompareUsingMatcher( setValue, v, c->matcher );
 
 	if ( verbose )
 	{
@@ -1074,7 +1156,7 @@ bool CResponseSystem::Compare( const char *setValue, Criteria *c, bool verbose /
 	return bret;
 }
 
-float CResponseSystem::RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/ )
+float CResponseSystem::RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSet& set, Criteria *parent, bool& exclude, bool verbose /*=false*/, const ResolvedCriteria *resolved )
 {
 	float score = 0.0f;
 	int subcount = parent->subcriteria.Count();
@@ -1087,7 +1169,7 @@ float CResponseSystem::RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSe
 		{
 			DevMsg( "\n" );
 		}
-		score += ScoreCriteriaAgainstRuleCriteria( set, icriterion, excludesubrule, verbose );
+		score += ScoreCriteriaAgainstRuleCriteria( set, icriterion, excludesubrule, verbose, resolved );
 	}
 
 	exclude = ( parent->required && score == 0.0f ) ? true : false;
@@ -1095,13 +1177,13 @@ float CResponseSystem::RecursiveScoreSubcriteriaAgainstRule( const AI_CriteriaSe
 	return score * parent->weight.GetFloat();
 }
 
-float CResponseSystem::ScoreCriteriaAgainstRuleCriteria( const AI_CriteriaSet& set, int icriterion, bool& exclude, bool verbose /*=false*/ )
+float CResponseSystem::ScoreCriteriaAgainstRuleCriteria( const AI_CriteriaSet& set, int icriterion, bool& exclude, bool verbose /*=false*/, const ResolvedCriteria *resolved /*=NULL*/ )
 {
 	Criteria *c = &m_Criteria[ icriterion ];
 
 	if ( c->IsSubCriteriaType() )
 	{
-		return RecursiveScoreSubcriteriaAgainstRule( set, c, exclude, verbose );
+		return RecursiveScoreSubcriteriaAgainstRule( set, c, exclude, verbose, resolved );
 	}
 
 	if ( verbose )
@@ -1115,7 +1197,16 @@ float CResponseSystem::ScoreCriteriaAgainstRuleCriteria( const AI_CriteriaSet& s
 
 	const char *actualValue = "";
 
-	int found = set.FindCriterionIndex( c->name );
+	int found;
+	if ( resolved )
+	{
+		found = ( c->nameindex != -1 ) ? resolved->setindex[ c->nameindex ] : -1;
+	}
+	else
+	{
+		found = set.FindCriterionIndex( c->name );
+	}
+
 	if ( found != -1 )
 	{
 		actualValue = set.GetValue( found );
@@ -1128,7 +1219,8 @@ float CResponseSystem::ScoreCriteriaAgainstRuleCriteria( const AI_CriteriaSet& s
 
 	Assert( actualValue );
 
-	if ( Compare( actualValue, c, verbose ) )
+	float v = ( resolved && found != -1 ) ? resolved->value[ c->nameindex ] : ComputeValue( actualValue );
+	if ( Compare( actualValue, v, c, verbose ) )
 	{
 		float w = set.GetWeight( found );
 		score = w * c->weight.GetFloat();
@@ -1161,7 +1253,7 @@ float CResponseSystem::ScoreCriteriaAgainstRuleCriteria( const AI_CriteriaSet& s
 	return score;
 }
 
-float CResponseSystem::ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose /*=false*/ )
+float CResponseSystem::ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int irule, bool verbose /*=false*/, const ResolvedCriteria *resolved /*=NULL*/ )
 {
 	Rule *rule = &m_Rules[ irule ];
 	float score = 0.0f;
@@ -1202,7 +1294,7 @@ float CResponseSystem::ScoreCriteriaAgainstRule( const AI_CriteriaSet& set, int
 		int icriterion = rule->m_Criteria[ i ];
 
 		bool exclude = false;
-		score += ScoreCriteriaAgainstRuleCriteria( set, icriterion, exclude, verbose );
+		score += ScoreCriteriaAgainstRuleCriteria( set, icriterion, exclude, verbose, resolved );
 
 		if ( verbose )
 		{
@@ -1628,36 +1720,276 @@ bool CResponseSystem::GetBestResponse( ResponseSearchResult& searchResult, Rule
 }
 
 //-----------------------------------------------------------------------------
-// Purpose: 
-// Input  : set - 
-//			verbose - 
-// Output : int
+// Purpose: Returns the index of a criterion name, adding it if it's new
 //-----------------------------------------------------------------------------
-int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+int CResponseSystem::InternCriterionName( const char *name )
 {
-	CUtlVector< int >	bestrules;
-	float bestscore = 0.001f;
+	if ( !name )
+		return -1;
+
+	int idx = m_CriteriaNames.Find( name );
+	if ( idx == m_CriteriaNames.InvalidIndex() )
+	{
+		idx = m_CriteriaNames.Insert( name, m_CriteriaNames.Count() );
+	}
+	return m_CriteriaNames[ idx ];
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Files each rule under the concept it requires, and gives the names
+//  of the other criteria the rule can't match without a bit each.
+//-----------------------------------------------------------------------------
+void CResponseSystem::BuildRuleIndex()
+{
+	m_RulesByConcept.RemoveAll();
+	m_ConceptRules.Purge();
+	m_RulesWithoutConcept.Purge();
+	m_RuleRequiredNames.Purge();
+
+	m_iConceptName = -1;
+	int idx = m_CriteriaNames.Find( "concept" );
+	if ( idx != m_CriteriaNames.InvalidIndex() )
+	{
+		m_iConceptName = m_CriteriaNames[ idx ];
+	}
+
+	m_CriteriaNameBits.SetCount( m_CriteriaNames.Count() );
+	for ( int i = 0; i < m_CriteriaNameBits.Count(); i++ )
+	{
+		m_CriteriaNameBits[ i ] = -1;
+	}
+	int nBits = 0;
 
 	int c = m_Rules.Count();
-	int i;
-	for ( i = 0; i < c; i++ )
+	CUtlVector< short > ruleConcepts;
+	ruleConcepts.SetCount( c );
+	m_RuleRequiredNames.SetCount( c );
+
+	for ( int irule = 0; irule < c; irule++ )
 	{
-		float score = ScoreCriteriaAgainstRule( set, i, verbose );
-		// Check equals so that we keep track of all matching rules
-		if ( score >= bestscore )
+		Rule *rule = &m_Rules[ irule ];
+
+		ruleConcepts[ irule ] = m_RulesByConcept.InvalidIndex();
+		m_RuleRequiredNames[ irule ] = 0;
+
+		for ( int i = 0; i < rule->m_Criteria.Count(); i++ )
 		{
-			// Reset bucket
-			if( score != bestscore )
+			Criteria *crit = &m_Criteria[ rule->m_Criteria[ i ] ];
+			if ( !crit->required || crit->IsSubCriteriaType() || crit->nameindex == -1 )
+				continue;
+
+			// Only a plain equality test fails for a set without the criterion
+			Matcher *m = &crit->matcher;
+			if ( !m->valid || m->usemin || m->usemax || m->notequal )
+				continue;
+			if ( !m->isnumeric && !m->GetToken()[0] )
+				continue;
+
+			if ( crit->nameindex == m_iConceptName && !m->isnumeric && 
+				ruleConcepts[ irule ] == m_RulesByConcept.InvalidIndex() )
 			{
-				bestscore = score;
-				bestrules.RemoveAll();
+				int iconcept = m_RulesByConcept.Find( m->GetToken() );
+				if ( iconcept == m_RulesByConcept.InvalidIndex() )
+				{
+					ConceptRules empty = { 0, 0 };
+					iconcept = m_RulesByConcept.Insert( m->GetToken(), empty );
+				}
+				m_RulesByConcept[ iconcept ].count++;
+				ruleConcepts[ irule ] = iconcept;
+				continue;
 			}
 
-			// Add to bucket
-			bestrules.AddToTail( i );
+			int &bit = m_CriteriaNameBits[ crit->nameindex ];
+			if ( bit == -1 )
+			{
+				if ( nBits >= 64 )
+					continue;
+				bit = nBits++;
+			}
+			m_RuleRequiredNames[ irule ] |= ( (uint64)1 << bit );
+		}
+	}
+
+	// Lay the concepts' rules out end to end, keeping them in rule order
+	int first = 0;
+	for ( int i = m_RulesByConcept.First(); i != m_RulesByConcept.InvalidIndex(); i = m_RulesByConcept.Next( i ) )
+	{
+		m_RulesByConcept[ i ].first = first;
+		first += m_RulesByConcept[ i ].count;
+		m_RulesByConcept[ i ].count = 0;
+	}
+	m_ConceptRules.SetCount( first );
+
+	for ( int irule = 0; irule < c; irule++ )
+	{
+		int iconcept = ruleConcepts[ irule ];
+		if ( iconcept == m_RulesByConcept.InvalidIndex() )
+		{
+			m_RulesWithoutConcept.AddToTail( irule );
+			continue;
+		}
+
+		ConceptRules *conceptRules = &m_RulesByConcept[ iconcept ];
+		m_ConceptRules[ conceptRules->first + conceptRules->count++ ] = irule;
+	}
+
+	DevMsg( 2, "CResponseSystem:  indexed %i rules under %i concepts, %i without a concept\n",
+		m_ConceptRules.Count(), m_RulesByConcept.Count(), m_RulesWithoutConcept.Count() );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Looks up the set's criteria in the interned names.  The caller
+//  provides setindex and value arrays with room for every name.
+//-----------------------------------------------------------------------------
+void CResponseSystem::ResolveCriteria( const AI_CriteriaSet& set, ResolvedCriteria& resolved )
+{
+	int c = m_CriteriaNames.Count();
+	for ( int i = 0; i < c; i++ )
+	{
+		resolved.setindex[ i ] = -1;
+	}
+	resolved.present = 0;
+
+	for ( int i = set.Head(); i != -1; i = set.Next( i ) )
+	{
+		int idx = m_CriteriaNames.Find( set.GetName( i ) );
+		if ( idx == m_CriteriaNames.InvalidIndex() )
+			continue;
+
+		int nameindex = m_CriteriaNames[ idx ];
+		resolved.setindex[ nameindex ] = i;
+		resolved.value[ nameindex ] = ComputeValue( set.GetValue( i ) );
+
+		if ( m_CriteriaNameBits[ nameindex ] != -1 )
+		{
+			resolved.present |= ( (uint64)1 << m_CriteriaNameBits[ nameindex ] );
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Keeps the last rr_capturecriteria criteria sets for rr_benchrules
+//-----------------------------------------------------------------------------
+void CResponseSystem::CaptureCriteria( const AI_CriteriaSet& set )
+{
+	int nMax = rr_capturecriteria.GetInt();
+	while ( m_CapturedCriteria.Count() > nMax )
+	{
+		delete m_CapturedCriteria[ m_CapturedCriteria.Count() - 1 ];
+		m_CapturedCriteria.Remove( m_CapturedCriteria.Count() - 1 );
+	}
+
+	if ( m_CapturedCriteria.Count() < nMax )
+	{
+		m_CapturedCriteria.AddToTail( new AI_CriteriaSet( set ) );
+		return;
+	}
+
+	m_iNextCapturedCriteria %= nMax;
+	delete m_CapturedCriteria[ m_iNextCapturedCriteria ];
+	m_CapturedCriteria[ m_iNextCapturedCriteria++ ] = new AI_CriteriaSet( set );
+}
+
+static void AddToBestRules( int irule, float score, float &bestscore, CUtlVector< int >& bestrules )
+{
+	// Check equals so that we keep track of all matching rules
+	if ( score >= bestscore )
+	{
+		// Reset bucket
+		if( score != bestscore )
+		{
+			bestscore = score;
+			bestrules.RemoveAll();
+		}
+
+		// Add to bucket
+		bestrules.AddToTail( irule );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Fills in the rules tied for the best score, in rule order.  The
+//  index is skipped when scoring is being shown, so every rule gets shown.
+// Output : The number of rules scored
+//-----------------------------------------------------------------------------
+int CResponseSystem::FindBestMatchingRules( const AI_CriteriaSet& set, bool verbose, bool useindex, CUtlVector< int >& bestrules )
+{
+	float bestscore = 0.001f;
+
+	bestrules.RemoveAll();
+
+	const char *pszDebugRule = rr_debugrule.GetString();
+	if ( !useindex || verbose || ( pszDebugRule && pszDebugRule[0] ) || 
+		m_RuleRequiredNames.Count() != m_Rules.Count() )
+	{
+		int c = m_Rules.Count();
+		for ( int i = 0; i < c; i++ )
+		{
+			AddToBestRules( i, ScoreCriteriaAgainstRule( set, i, verbose ), bestscore, bestrules );
+		}
+		return c;
+	}
+
+	int nNames = m_CriteriaNames.Count();
+	ResolvedCriteria resolved;
+	resolved.setindex = (short *)stackalloc( nNames * sizeof( short ) );
+	resolved.value = (float *)stackalloc( nNames * sizeof( float ) );
+	ResolveCriteria( set, resolved );
+
+	const unsigned short *conceptRules = NULL;
+	int nConceptRules = 0;
+	if ( m_iConceptName != -1 && resolved.setindex[ m_iConceptName ] != -1 )
+	{
+		int iconcept = m_RulesByConcept.Find( set.GetValue( resolved.setindex[ m_iConceptName ] ) );
+		if ( iconcept != m_RulesByConcept.InvalidIndex() )
+		{
+			conceptRules = m_ConceptRules.Base() + m_RulesByConcept[ iconcept ].first;
+			nConceptRules = m_RulesByConcept[ iconcept ].count;
 		}
 	}
 
+	// Walk the concept's rules and the rules without a concept together, in rule order
+	const unsigned short *otherRules = m_RulesWithoutConcept.Base();
+	int nOtherRules = m_RulesWithoutConcept.Count();
+	int nScored = 0;
+	int i = 0;
+	int j = 0;
+	while ( i < nConceptRules || j < nOtherRules )
+	{
+		int irule;
+		if ( j >= nOtherRules || ( i < nConceptRules && conceptRules[ i ] < otherRules[ j ] ) )
+		{
+			irule = conceptRules[ i++ ];
+		}
+		else
+		{
+			irule = otherRules[ j++ ];
+		}
+
+		if ( m_RuleRequiredNames[ irule ] & ~resolved.present )
+			continue;
+
+		AddToBestRules( irule, ScoreCriteriaAgainstRule( set, irule, false, &resolved ), bestscore, bestrules );
+		++nScored;
+	}
+
+	stackfree( resolved.value );
+	stackfree( resolved.setindex );
+
+	return nScored;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : set - 
+//			verbose - 
+// Output : int
+//-----------------------------------------------------------------------------
+int CResponseSystem::FindBestMatchingRule( const AI_CriteriaSet& set, bool verbose )
+{
+	CUtlVector< int >	bestrules;
+	FindBestMatchingRules( set, verbose, rr_useruleindex.GetBool(), bestrules );
+
 	int bestCount = bestrules.Count();
 	if ( bestCount <= 0 )
 		return -1;
@@ -1687,6 +2019,11 @@ bool CResponseSystem::FindBestResponse( const AI_CriteriaSet& set, AI_Response&
 	bool showRules = ( iDbgResponse == 2 );
 	bool showResult = ( iDbgResponse == 1 || iDbgResponse == 2 );
 
+	if ( rr_capturecriteria.GetInt() > 0 )
+	{
+		CaptureCriteria( set );
+	}
+
 	// Look for match
 	int bestRule = FindBestMatchingRule( set, showRules );
 
@@ -1743,6 +2080,102 @@ bool CResponseSystem::FindBestResponse( const AI_CriteriaSet& set, AI_Response&
 	return valid;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: 
+// Input  : nIterations - 
+//-----------------------------------------------------------------------------
+void CResponseSystem::BenchmarkRuleIndex( int nIterations )
+{
+	// Replay the captured criteria sets, or make up one from each rule's criteria
+	CUtlVector< AI_CriteriaSet * > madeUp;
+	CUtlVector< AI_CriteriaSet * > *pSets = &m_CapturedCriteria;
+	if ( !m_CapturedCriteria.Count() )
+	{
+		for ( int irule = 0; irule < m_Rules.Count(); irule++ )
+		{
+			Rule *rule = &m_Rules[ irule ];
+			AI_CriteriaSet *set = new AI_CriteriaSet;
+			for ( int i = 0; i < rule->m_Criteria.Count(); i++ )
+			{
+				Criteria *crit = &m_Criteria[ rule->m_Criteria[ i ] ];
+				Matcher *m = &crit->matcher;
+				if ( crit->IsSubCriteriaType() || !crit->name || !m->valid || m->notequal )
+					continue;
+
+				char value[ 32 ];
+				if ( m->usemin || m->usemax )
+				{
+					float f = ( m->usemin && m->usemax ) ? 0.5f * ( m->minval + m->maxval ) : ( m->usemin ? m->minval + 1.0f : m->maxval - 1.0f );
+					Q_snprintf( value, sizeof( value ), "%f", f );
+					set->AppendCriteria( crit->name, value );
+				}
+				else
+				{
+					set->AppendCriteria( crit->name, m->GetToken() );
+				}
+			}
+			madeUp.AddToTail( set );
+		}
+		pSets = &madeUp;
+	}
+
+	int nSets = pSets->Count();
+	if ( !nSets )
+	{
+		Msg( "rr_benchrules: no rules loaded.\n" );
+		return;
+	}
+
+	// The index has to pick the same rules as scoring all of them
+	CUtlVector< int > scanned;
+	CUtlVector< int > indexed;
+	int nScored = 0;
+	int nMismatches = 0;
+	for ( int i = 0; i < nSets; i++ )
+	{
+		const AI_CriteriaSet &set = *(*pSets)[ i ];
+		FindBestMatchingRules( set, false, false, scanned );
+		nScored += FindBestMatchingRules( set, false, true, indexed );
+
+		bool bSame = ( scanned.Count() == indexed.Count() );
+		for ( int j = 0; bSame && j < scanned.Count(); j++ )
+		{
+			bSame = ( scanned[ j ] == indexed[ j ] );
+		}
+
+		if ( !bSame && nMismatches++ == 0 )
+		{
+			Msg( "rr_benchrules: set %i matched '%s' by scoring every rule, '%s' with the index\n", i,
+				scanned.Count() ? m_Rules.GetElementName( scanned[ 0 ] ) : "nothing",
+				indexed.Count() ? m_Rules.GetElementName( indexed[ 0 ] ) : "nothing" );
+		}
+	}
+
+	Msg( "rr_benchrules: %i %s criteria sets, %i rules, %i concepts\n", nSets,
+		( pSets == &madeUp ) ? "made up" : "captured", m_Rules.Count(), m_RulesByConcept.Count() );
+
+	for ( int iPass = 0; iPass < 2; iPass++ )
+	{
+		CFastTimer timer;
+		timer.Start();
+		for ( int iter = 0; iter < nIterations; iter++ )
+		{
+			for ( int i = 0; i < nSets; i++ )
+			{
+				FindBestMatchingRules( *(*pSets)[ i ], false, ( iPass != 0 ), scanned );
+			}
+		}
+		timer.End();
+
+		Msg( "  %s: %.2f ms, %.1f rules scored per set\n", iPass ? "index    " : "full scan",
+			timer.GetDuration().GetMillisecondsF(), iPass ? (float)nScored / nSets : (float)m_Rules.Count() );
+	}
+
+	Msg( "  %i sets matched different rules\n", nMismatches );
+
+	madeUp.PurgeAndDeleteElements();
+}
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 void CResponseSystem::GetAllResponses( CUtlVector<AI_Response *> *pResponses )
@@ -1987,6 +2420,8 @@ void CResponseSystem::LoadRuleSet( const char *basescript )
 
 	Assert( m_ScriptStack.Count() == 0 );
 
+	BuildRuleIndex();
+
 	//TouchReferencedScenes();
 }
 
@@ -2369,6 +2804,7 @@ int CResponseSystem::ParseOneCriterion( const char *criterionName )
 	if ( !newCriterion.IsSubCriteriaType() )
 	{
 		ComputeMatcher( &newCriterion, newCriterion.matcher );
+		newCriterion.nameindex = InternCriterionName( newCriterion.name );
 	}
 
 	if ( m_Criteria.Find( criterionName ) != m_Criteria.InvalidIndex() )
@@ -2775,6 +3211,12 @@ CON_COMMAND( rr_reloadresponsesystems, "Reload all response system scripts." )
 	defaultresponsesytem.ReloadAllResponseSystems();
 }
 
+CON_COMMAND_F( rr_benchrules, "Times rule matching with and without the rule index, replaying the sets kept by rr_capturecriteria or sets made up from the rules. Usage: rr_benchrules [iterations]", FCVAR_CHEAT )
+{
+	int nIterations = ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 10;
+	defaultresponsesytem.BenchmarkRuleIndex( max( nIterations, 1 ) );
+}
+
 static short RESPONSESYSTEM_SAVE_RESTORE_VERSION = 1;
 
 // note:  this won't save/restore settings from instanced response systems.  Could add that with a CDefSaveRestoreOps implementation if needed
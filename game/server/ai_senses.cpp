@@ -13,6 +13,7 @@
 #include "team.h"
 #include "ai_basenpc.h"
 #include "saverestore_utlvector.h"
+#include "mathlib/ssemath.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -31,10 +32,184 @@ const float AI_EFFICIENT_NPC_SEARCH_TIME = .35;
 const float AI_HIGH_PRIORITY_SEARCH_TIME = 0.15;
 const float AI_MISC_SEARCH_TIME  = 0.45;
 
+ConVar ai_shared_sense_candidates( "ai_shared_sense_candidates", "1", 0, "Distance cull sight candidates against positions gathered once per tick, four at a time" );
+
 //-----------------------------------------------------------------------------
 
 CAI_SensedObjectsManager g_AI_SensedObjectsManager;
 
+//-----------------------------------------------------------------------------
+// class CAI_SenseCandidates
+//
+// Purpose: The players, NPCs and objects that NPCs look for, with their
+//			positions in structure-of-arrays form. Each set is gathered by the
+//			first NPC to look for it in a tick and shared by the rest, so a
+//			distance check covers four candidates at a time. Positions can be
+//			up to a tick old, which is well inside the search intervals above.
+//-----------------------------------------------------------------------------
+
+class CAI_SenseCandidates
+{
+public:
+	enum
+	{
+		SET_PLAYERS = SEEN_HIGH_PRIORITY,
+		SET_NPCS = SEEN_NPCS,
+		SET_OBJECTS = SEEN_MISC,
+		NUM_SETS
+	};
+
+	CAI_SenseCandidates()
+	{
+		Invalidate();
+	}
+
+	void Invalidate()
+	{
+		for ( int i = 0; i < NUM_SETS; i++ )
+		{
+			m_Sets[i].m_iTick = -1;
+		}
+	}
+
+	// Gathers the set if this is its first use this tick. Returns the number of groups of four.
+	int Update( int iSet );
+
+	// Mask of the candidates in a group that are closer than distSq to the origin,
+	// or that are never distance culled
+	int CullGroup( int iSet, int iGroup, const FourVectors &origin, const __m128 &distSq ) const;
+
+	CBaseEntity *Get( int iSet, int i ) const	{ return m_Sets[iSet].m_Handles[i]; }
+
+private:
+	struct Set_t
+	{
+		int						m_iTick;
+		CUtlVector<EHANDLE>		m_Handles;
+		CUtlVector<float>		m_Pos[3];		// One axis each, padded to a multiple of four
+		CUtlVector<unsigned char> m_NoCullMask;	// One per group
+	};
+
+	void Add( Set_t &set, CBaseEntity *pEntity, bool bNoDistanceCull );
+
+	Set_t m_Sets[NUM_SETS];
+};
+
+static CAI_SenseCandidates g_AI_SenseCandidates;
+
+//-------------------------------------
+
+void CAI_SenseCandidates::Add( Set_t &set, CBaseEntity *pEntity, bool bNoDistanceCull )
+{
+	int i = set.m_Handles.AddToTail( pEntity );
+	if ( ( i & 3 ) == 0 )
+	{
+		// Padding lanes are never in range
+		for ( int iAxis = 0; iAxis < 3; iAxis++ )
+		{
+			set.m_Pos[iAxis].AddMultipleToTail( 4 );
+			for ( int j = i; j < i + 4; j++ )
+			{
+				set.m_Pos[iAxis][j] = FLT_MAX;
+			}
+		}
+		set.m_NoCullMask.AddToTail( 0 );
+	}
+
+	const Vector &vecOrigin = pEntity->GetAbsOrigin();
+	for ( int iAxis = 0; iAxis < 3; iAxis++ )
+	{
+		set.m_Pos[iAxis][i] = vecOrigin[iAxis];
+	}
+	if ( bNoDistanceCull )
+	{
+		set.m_NoCullMask[i >> 2] |= ( 1 << ( i & 3 ) );
+	}
+}
+
+//-------------------------------------
+
+int CAI_SenseCandidates::Update( int iSet )
+{
+	Set_t &set = m_Sets[iSet];
+	if ( set.m_iTick != gpGlobals->tickcount )
+	{
+		AI_PROFILE_SENSES(CAI_Senses_GatherCandidates);
+
+		set.m_iTick = gpGlobals->tickcount;
+		set.m_Handles.RemoveAll();
+		for ( int iAxis = 0; iAxis < 3; iAxis++ )
+		{
+			set.m_Pos[iAxis].RemoveAll();
+		}
+		set.m_NoCullMask.RemoveAll();
+
+		switch ( iSet )
+		{
+		case SET_PLAYERS:
+			{
+				for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+				{
+					CBaseEntity *pPlayer = UTIL_PlayerByIndex( i );
+					if ( pPlayer )
+					{
+						Add( set, pPlayer, false );
+					}
+				}
+				break;
+			}
+
+		case SET_NPCS:
+			{
+				CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+				for ( int i = 0; i < g_AI_Manager.NumAIs(); i++ )
+				{
+					Add( set, ppAIs[i], ppAIs[i]->ShouldNotDistanceCull() );
+				}
+				break;
+			}
+
+		case SET_OBJECTS:
+			{
+				int iter;
+				CBaseEntity *pEnt = g_AI_SensedObjectsManager.GetFirst( &iter );
+				while ( pEnt )
+				{
+					Add( set, pEnt, false );
+					pEnt = g_AI_SensedObjectsManager.GetNext( &iter );
+				}
+				break;
+			}
+		}
+	}
+
+	return set.m_NoCullMask.Count();
+}
+
+//-------------------------------------
+
+int CAI_SenseCandidates::CullGroup( int iSet, int iGroup, const FourVectors &origin, const __m128 &distSq ) const
+{
+	const Set_t &set = m_Sets[iSet];
+	int iFirst = iGroup * 4;
+
+	FourVectors delta;
+	delta.x = _mm_loadu_ps( &set.m_Pos[0][iFirst] );
+	delta.y = _mm_loadu_ps( &set.m_Pos[1][iFirst] );
+	delta.z = _mm_loadu_ps( &set.m_Pos[2][iFirst] );
+	delta -= origin;
+
+	int mask = _mm_movemask_ps( _mm_cmplt_ps( delta.length2(), distSq ) ) | set.m_NoCullMask[iGroup];
+
+	// Drop the padding at the end of the set
+	int nInGroup = set.m_Handles.Count() - iFirst;
+	if ( nInGroup < 4 )
+	{
+		mask &= ( 1 << nInGroup ) - 1;
+	}
+	return mask;
+}
+
 //-----------------------------------------------------------------------------
 
 #pragma pack(push)
@@ -374,15 +549,22 @@ int CAI_Senses::LookForHighPriorityEntities( int iDistance )
 		const Vector &origin = GetAbsOrigin();
 		
 		// Players
-		for ( int i = 1; i <= gpGlobals->maxClients; i++ )
+		if ( ai_shared_sense_candidates.GetBool() )
 		{
-			CBaseEntity *pPlayer = UTIL_PlayerByIndex( i );
-
-			if ( pPlayer )
+			nSeen = LookForCandidates( CAI_SenseCandidates::SET_PLAYERS, distSq );
+		}
+		else
+		{
+			for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 			{
-				if ( origin.DistToSqr(pPlayer->GetAbsOrigin()) < distSq && Look( pPlayer ) )
+				CBaseEntity *pPlayer = UTIL_PlayerByIndex( i );
+
+				if ( pPlayer )
 				{
-					nSeen++;
+					if ( origin.DistToSqr(pPlayer->GetAbsOrigin()) < distSq && Look( pPlayer ) )
+					{
+						nSeen++;
+					}
 				}
 			}
 		}
@@ -423,15 +605,22 @@ int CAI_Senses::LookForNPCs( int iDistance )
 
 			BeginGather();
 
-			CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
-			
-			for ( i = 0; i < g_AI_Manager.NumAIs(); i++ )
+			if ( ai_shared_sense_candidates.GetBool() )
+			{
+				nSeen = LookForCandidates( CAI_SenseCandidates::SET_NPCS, distSq );
+			}
+			else
 			{
-				if ( ppAIs[i] != GetOuter() && ( ppAIs[i]->ShouldNotDistanceCull() || origin.DistToSqr(ppAIs[i]->GetAbsOrigin()) < distSq ) )
+				CAI_BaseNPC **ppAIs = g_AI_Manager.AccessAIs();
+				
+				for ( i = 0; i < g_AI_Manager.NumAIs(); i++ )
 				{
-					if ( Look( ppAIs[i] ) )
+					if ( ppAIs[i] != GetOuter() && ( ppAIs[i]->ShouldNotDistanceCull() || origin.DistToSqr(ppAIs[i]->GetAbsOrigin()) < distSq ) )
 					{
-						nSeen++;
+						if ( Look( ppAIs[i] ) )
+						{
+							nSeen++;
+						}
 					}
 				}
 			}
@@ -481,18 +670,25 @@ int CAI_Senses::LookForObjects( int iDistance )
 
 		float distSq = ( iDistance * iDistance );
 		const Vector &origin = GetAbsOrigin();
-		int iter;
-		CBaseEntity *pEnt = g_AI_SensedObjectsManager.GetFirst( &iter );
-		while ( pEnt )
+		if ( ai_shared_sense_candidates.GetBool() )
 		{
-			if ( pEnt->GetFlags() & BOX_QUERY_MASK )
+			nSeen = LookForCandidates( CAI_SenseCandidates::SET_OBJECTS, distSq, BOX_QUERY_MASK );
+		}
+		else
+		{
+			int iter;
+			CBaseEntity *pEnt = g_AI_SensedObjectsManager.GetFirst( &iter );
+			while ( pEnt )
 			{
-				if ( origin.DistToSqr(pEnt->GetAbsOrigin()) < distSq && Look( pEnt) )
+				if ( pEnt->GetFlags() & BOX_QUERY_MASK )
 				{
-					nSeen++;
+					if ( origin.DistToSqr(pEnt->GetAbsOrigin()) < distSq && Look( pEnt) )
+					{
+						nSeen++;
+					}
 				}
+				pEnt = g_AI_SensedObjectsManager.GetNext( &iter );
 			}
-			pEnt = g_AI_SensedObjectsManager.GetNext( &iter );
 		}
 		
 		EndGather( nSeen, &m_SeenMisc );
@@ -510,6 +706,44 @@ int CAI_Senses::LookForObjects( int iDistance )
 	return nSeen;
 }
 
+//-----------------------------------------------------------------------------
+// Looks at the candidates of a shared set that are in range, in the order the
+// set was gathered. With a flag mask, only candidates with one of the flags.
+
+int CAI_Senses::LookForCandidates( int iSet, float distSq, int flagMask )
+{
+	int nSeen = 0;
+	int nGroups = g_AI_SenseCandidates.Update( iSet );
+
+	FourVectors origin;
+	origin.DuplicateVector( GetAbsOrigin() );
+	__m128 distSqPacked = MMReplicate( distSq );
+
+	for ( int iGroup = 0; iGroup < nGroups; iGroup++ )
+	{
+		int mask = g_AI_SenseCandidates.CullGroup( iSet, iGroup, origin, distSqPacked );
+		for ( int i = iGroup * 4; mask; i++, mask >>= 1 )
+		{
+			if ( !( mask & 1 ) )
+				continue;
+
+			CBaseEntity *pEnt = g_AI_SenseCandidates.Get( iSet, i );
+			if ( !pEnt || pEnt == GetOuter() )
+				continue;
+
+			if ( flagMask && !( pEnt->GetFlags() & flagMask ) )
+				continue;
+
+			if ( Look( pEnt ) )
+			{
+				nSeen++;
+			}
+		}
+	}
+
+	return nSeen;
+}
+
 //-----------------------------------------------------------------------------
 
 float CAI_Senses::GetTimeLastUpdate( CBaseEntity *pEntity )
@@ -646,6 +880,7 @@ void CAI_SensedObjectsManager::Term()
 {
 	gEntList.RemoveListenerEntity( this );
 	m_SensedObjects.RemoveAll();
+	g_AI_SenseCandidates.Invalidate();
 }
 
 //-----------------------------------------------------------------------------
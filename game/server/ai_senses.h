@@ -103,6 +103,7 @@ private:
 	int 			LookForHighPriorityEntities( int iDistance );
 	int 			LookForNPCs( int iDistance );
 	int 			LookForObjects( int iDistance );
+	int				LookForCandidates( int iSet, float distSq, int flagMask = 0 );
 	
 	bool			SeeEntity( CBaseEntity *pEntity );
 	
@@ -25,6 +25,9 @@
 #include "ai_basenpc.h"
 #include "physics_prop_ragdoll.h"
 #include "datacache/idatacache.h"
+#include "serverjobs.h"
+#include "studio_shared.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -280,6 +283,10 @@ CBaseAnimating::CBaseAnimating()
 	m_fadeMaxDist = 0;
 	m_flFadeScale = 0.0f;
 	m_fBoneCacheFlags = 0;
+	m_flBoneCacheUsedTime = 0;
+	m_flBoneSetupWatchTime = 0;
+	m_fBoneSetupWatch = 0;
+	m_nBoneCacheSurvival = 0xFF;
 }
 
 CBaseAnimating::~CBaseAnimating()
@@ -1512,11 +1519,10 @@ void CBaseAnimating::BuildMatricesWithBoneMerge(
 	const Vector pos[MAXSTUDIOBONES],
 	const Quaternion q[MAXSTUDIOBONES],
 	matrix3x4_t bonetoworld[MAXSTUDIOBONES],
-	CBaseAnimating *pParent,
+	const CStudioHdr *pParentStudioHdr,
 	CBoneCache *pParentCache
 	)
 {
-	CStudioHdr *fhdr = pParent->GetModelPtr();
 	mstudiobone_t *pbones = pStudioHdr->pBone( 0 );
 
 	matrix3x4_t rotationmatrix; // model to world transformation
@@ -1526,7 +1532,7 @@ void CBaseAnimating::BuildMatricesWithBoneMerge(
 	{
 		// Now find the bone in the parent entity.
 		bool merged = false;
-		int parentBoneIndex = Studio_BoneIndexByName( fhdr, pbones[i].pszName() );
+		int parentBoneIndex = Studio_BoneIndexByName( pParentStudioHdr, pbones[i].pszName() );
 		if ( parentBoneIndex >= 0 )
 		{
 			matrix3x4_t *pMat = pParentCache->GetCachedBone( parentBoneIndex );
@@ -1644,7 +1650,7 @@ void CBaseAnimating::SetupBones( matrix3x4_t *pBoneToWorld, int boneMask )
 				pos, 
 				q, 
 				pBoneToWorld, 
-				pParent, 
+				pParent->GetModelPtr(), 
 				pParentCache );
 			
 			RemoveEFlags( EFL_SETTING_UP_BONES );
@@ -2378,6 +2384,12 @@ CStudioHdr *CBaseAnimating::GetModelPtr( void )
 	return NULL;
 }
 
+// m_fBoneSetupWatch, see SetupBonesForFrame()
+#define BONE_SETUP_WATCHED			0x01
+#define BONE_SETUP_PREPARED			0x02	// Its bones were set up, not just considered
+
+#define BONE_CACHE_VALID_TIME		0.1f	// CBoneCache::IsValid()'s default
+
 //-----------------------------------------------------------------------------
 // Purpose: return the index to the shared bone cache
 // Output :
@@ -2387,37 +2399,59 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 	CStudioHdr *pStudioHdr = GetModelPtr( );
 	Assert(pStudioHdr);
 
+	m_flBoneCacheUsedTime = gpGlobals->curtime;
+
 	CBoneCache *pcache = Studio_GetBoneCache( m_boneCacheHandle );
 	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
-	if ( pcache )
+
+	// Would what SetupBonesForFrame() set up, or could have, still be good?
+	if ( m_fBoneSetupWatch & BONE_SETUP_PREPARED )
 	{
-		if ( pcache->IsValid( gpGlobals->curtime ) )
-		{
-			// in memory and still valid, use it!
-			return pcache;
-		}
-		// in memory, but not the same bone set, destroy & rebuild
-		if ( pcache->m_boneMask != boneMask )
-		{
-			Studio_DestroyBoneCache( m_boneCacheHandle );
-			m_boneCacheHandle = 0;
-			pcache = NULL;
-		}
+		RecordBoneCacheSurvival( pcache && pcache->IsValid( gpGlobals->curtime ) );
+	}
+	else if ( m_fBoneSetupWatch )
+	{
+		RecordBoneCacheSurvival( gpGlobals->curtime - m_flBoneSetupWatchTime <= BONE_CACHE_VALID_TIME );
+	}
+	if ( pcache && pcache->IsValid( gpGlobals->curtime ) )
+	{
+		// in memory and still valid, use it!
+		return pcache;
 	}
 
 	matrix3x4_t bonetoworld[MAXSTUDIOBONES];
 	SetupBones( bonetoworld, boneMask );
 
+	return UpdateBoneCache( pcache, bonetoworld, boneMask );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Stores newly set up bones in the bone cache
+// Input  : pcache - the current cache, or NULL if it's been evicted
+//-----------------------------------------------------------------------------
+CBoneCache *CBaseAnimating::UpdateBoneCache( CBoneCache *pcache, matrix3x4_t *pBoneToWorld, int boneMask )
+{
+	CStudioHdr *pStudioHdr = GetModelPtr( );
+
+	// in memory, but not the same bone set, destroy & rebuild
+	if ( pcache && pcache->m_boneMask != boneMask )
+	{
+		Studio_DestroyBoneCache( m_boneCacheHandle );
+		m_boneCacheHandle = 0;
+		pcache = NULL;
+	}
+
 	if ( pcache )
 	{
 		// still in memory but out of date, refresh the bones.
-		pcache->UpdateBones( bonetoworld, pStudioHdr->numbones(), gpGlobals->curtime );
+		pcache->UpdateBones( pBoneToWorld, pStudioHdr->numbones(), gpGlobals->curtime );
 	}
 	else
 	{
 		bonecacheparams_t params;
 		params.pStudioHdr = pStudioHdr;
-		params.pBoneToWorld = bonetoworld;
+		params.pBoneToWorld = pBoneToWorld;
 		params.curtime = gpGlobals->curtime;
 		params.boneMask = boneMask;
 
@@ -2431,9 +2465,838 @@ CBoneCache *CBaseAnimating::GetBoneCache( void )
 
 void CBaseAnimating::InvalidateBoneCache( void )
 {
+	if ( m_fBoneSetupWatch )
+	{
+		RecordBoneCacheSurvival( false );
+	}
+
 	Studio_InvalidateBoneCache( m_boneCacheHandle );
 }
 
+
+//-----------------------------------------------------------------------------
+// Bone setup on the server job pool
+//
+// At the end of the frame, the entities that used their bone caches in the
+// last second, and whose caches have run out, get their bones set up across
+// the job threads. The next frame's hitbox traces and bone lookups then find
+// them in the cache, unless the entity animates first. Entities that bone
+// merge with a move parent that's also set up go in a later wave than it.
+//
+// Many entities throw the cache away before they next read it: NPCs when
+// they move, anything when it animates, players when they're lag
+// compensated. Each time an entity is considered, it's watched until its
+// next read or invalidation, whether it was set up or not. Only entities
+// whose caches lasted at least half of the last eight times get set up.
+//
+// What the jobs touch, and why no two threads race on it:
+//	- Everything about the entity they read (sequence, cycle, pose
+//	  parameters, layers, controllers, its model's CStudioHdr) is only
+//	  written by game code, and the main thread runs nothing but jobs
+//	  until they're done. Anything that needs more (IK, which traces and
+//	  keeps state in the entity) stays on the main thread.
+//	- Each job writes its own bones in s_BoneSetupMatrices, its stack, and
+//	  its thread's BoneSetupScratch_t. Bone caches are only created and
+//	  updated on the main thread, between waves.
+//	- The decoded animation frames they share are behind their own lock.
+//	- Engine model info (animation blocks, autoplay lists, virtual models)
+//	  is answered from what the main thread looked up while it prefetched
+//	  the animations, so no job calls into the engine. A job that would have
+//	  needed anything else is thrown away. See studio_shared.cpp.
+//-----------------------------------------------------------------------------
+ConVar sv_parallel_bones( "sv_parallel_bones", "1", 0, "At the end of each frame, set up the bones of entities that used their bone caches recently on the server job threads." );
+
+#define BONE_CACHE_USE_WINDOW		1.0f	// Seconds since an entity last used its bone cache
+#define MIN_BONE_SETUPS_PER_JOB		2
+
+// How the caches SetupBonesForFrame() set up have fared, for sv_parallel_bones_stats
+static int s_nBoneSetupsPrepared;
+static int s_nBoneSetupsLasted;
+static int s_nBoneSetupsSkipped;
+static int s_nBoneSetupsMissed;
+
+static bool BoneCacheUsuallyLasts( unsigned char nSurvival )
+{
+	int nLasted = 0;
+	for ( ; nSurvival; nSurvival &= nSurvival - 1 )
+	{
+		nLasted++;
+	}
+	return ( nLasted >= 4 );
+}
+
+void CBaseAnimating::RecordBoneCacheSurvival( bool bSurvived )
+{
+	if ( ( m_fBoneSetupWatch & BONE_SETUP_PREPARED ) && bSurvived )
+	{
+		s_nBoneSetupsLasted++;
+	}
+
+	m_nBoneCacheSurvival = ( m_nBoneCacheSurvival << 1 ) | ( bSurvived ? 1 : 0 );
+	m_fBoneSetupWatch = 0;
+}
+
+CON_COMMAND( sv_parallel_bones_stats, "Reports how many of the bone caches sv_parallel_bones set up lasted until they were read, and resets the counts." )
+{
+	Msg( "%d bone caches set up, %d (%.1f%%) read before they were invalidated or expired, %d skipped as unlikely to last, %d thrown away for missing model lookups\n",
+		s_nBoneSetupsPrepared, s_nBoneSetupsLasted, s_nBoneSetupsPrepared ? 100.0f * s_nBoneSetupsLasted / s_nBoneSetupsPrepared : 0.0f,
+		s_nBoneSetupsSkipped, s_nBoneSetupsMissed );
+
+	s_nBoneSetupsPrepared = 0;
+	s_nBoneSetupsLasted = 0;
+	s_nBoneSetupsSkipped = 0;
+	s_nBoneSetupsMissed = 0;
+}
+
+struct BoneSetupJob_t
+{
+	CBaseAnimating	*m_pEntity;
+	CStudioHdr		*m_pStudioHdr;
+	CBaseAnimating	*m_pParent;			// Animating move parent, if any
+	CStudioHdr		*m_pParentStudioHdr;
+	CBoneCache		*m_pParentCache;	// Filled in just before the job's wave
+	Vector			m_vecOrigin;		// Includes the IK offset
+	QAngle			m_angAngles;
+	int				m_iFirstBone;		// Into s_BoneSetupMatrices
+	int				m_nDepth;			// Move parents above it that have jobs
+	bool			m_bSkipAnimation;
+	bool			m_bMissedLookups;	// Set by the job if it needed model info the main thread hadn't looked up
+};
+
+static CUtlVector< BoneSetupJob_t >	s_BoneSetupJobs;
+static CUtlVector< CBaseAnimating* >	s_BoneSetupWatched;
+static CUtlVector< matrix3x4_t >	s_BoneSetupMatrices;
+static unsigned short				s_BoneSetupJobIndex[NUM_ENT_ENTRIES];	// Job index + 1, by entity entry
+
+static int __cdecl CompareBoneSetupDepth( const BoneSetupJob_t *pLeft, const BoneSetupJob_t *pRight )
+{
+	return pLeft->m_nDepth - pRight->m_nDepth;
+}
+
+bool CBaseAnimating::CanSetupBonesInJob()
+{
+	// IK traces against the world and keeps its state in the entity
+	return ( m_pIk == NULL );
+}
+
+bool CBaseAnimating::PrefetchSkeleton( CStudioHdr *pStudioHdr )
+{
+	bool bPrefetched = Studio_PrefetchPose( pStudioHdr, GetSequence() );
+	return Studio_PrefetchAutoplaySequences( pStudioHdr ) && bPrefetched;
+}
+
+void CBaseAnimating::SetupBonesRange( void *pContext, int iFirst, int iLast )
+{
+	BoneSetupJob_t *pJobs = (BoneSetupJob_t *)pContext;
+	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
+
+	Vector pos[MAXSTUDIOBONES];
+	Quaternion q[MAXSTUDIOBONES];
+
+	for ( int i = iFirst; i < iLast; i++ )
+	{
+		BoneSetupJob_t &job = pJobs[i];
+		matrix3x4_t *pBoneToWorld = &s_BoneSetupMatrices[job.m_iFirstBone];
+		int nMisses = Studio_ModelLookupMisses();
+
+		// Same as SetupBones(), without IK
+		if ( job.m_bSkipAnimation )
+		{
+			InitPose( job.m_pStudioHdr, pos, q );
+		}
+		else
+		{
+			job.m_pEntity->GetSkeleton( job.m_pStudioHdr, pos, q, boneMask );
+		}
+
+		if ( job.m_pParentCache )
+		{
+			job.m_pEntity->BuildMatricesWithBoneMerge( job.m_pStudioHdr, job.m_angAngles, job.m_vecOrigin, 
+				pos, q, pBoneToWorld, job.m_pParentStudioHdr, job.m_pParentCache );
+		}
+		else
+		{
+			Studio_BuildMatrices( job.m_pStudioHdr, job.m_angAngles, job.m_vecOrigin, pos, q, -1, pBoneToWorld, boneMask );
+		}
+
+		job.m_bMissedLookups = ( Studio_ModelLookupMisses() != nMisses );
+	}
+}
+
+void CBaseAnimating::WatchBoneSetups()
+{
+	int i;
+	for ( i = 0; i < s_BoneSetupWatched.Count(); i++ )
+	{
+		s_BoneSetupWatched[i]->m_flBoneSetupWatchTime = gpGlobals->curtime;
+		s_BoneSetupWatched[i]->m_fBoneSetupWatch = BONE_SETUP_WATCHED;
+	}
+
+	for ( i = 0; i < s_BoneSetupJobs.Count(); i++ )
+	{
+		if ( !s_BoneSetupJobs[i].m_bMissedLookups )
+		{
+			s_BoneSetupJobs[i].m_pEntity->m_fBoneSetupWatch |= BONE_SETUP_PREPARED;
+			s_nBoneSetupsPrepared++;
+		}
+	}
+}
+
+void CBaseAnimating::SetupBonesForFrame()
+{
+	if ( !sv_parallel_bones.GetBool() || ServerJobThreadCount() <= 1 || ai_setupbones_debug.GetBool() )
+		return;
+
+	VPROF_BUDGET( "CBaseAnimating::SetupBonesForFrame", VPROF_BUDGETGROUP_SERVER_ANIM );
+
+	MDLCACHE_CRITICAL_SECTION();
+
+	int boneMask = BONE_USED_BY_HITBOX | BONE_USED_BY_ATTACHMENT;
+	int nBones = 0;
+	int nMaxBones = 0;
+
+	// Everything that touches the entity outside of its pose happens here,
+	// and so do the model info lookups the jobs will need
+	Studio_RecordModelLookups( true );
+	s_BoneSetupJobs.RemoveAll();
+	s_BoneSetupWatched.RemoveAll();
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		if ( !pAnimating || !pAnimating->m_boneCacheHandle || pAnimating->IsMarkedForDeletion() )
+			continue;
+
+		if ( gpGlobals->curtime - pAnimating->m_flBoneCacheUsedTime > BONE_CACHE_USE_WINDOW )
+			continue;
+
+		CBoneCache *pcache = Studio_GetBoneCache( pAnimating->m_boneCacheHandle );
+		if ( pcache && pcache->IsValid( gpGlobals->curtime ) )
+			continue;
+
+		CStudioHdr *pStudioHdr = pAnimating->GetModelPtr();
+		if ( !pStudioHdr || pAnimating->IsEFlagSet( EFL_SETTING_UP_BONES ) || !pAnimating->CanSetupBonesInJob() )
+			continue;
+
+		// Still watching from the last frame end, so whatever was set up then
+		// has run out without being read
+		if ( pAnimating->m_fBoneSetupWatch )
+		{
+			pAnimating->RecordBoneCacheSurvival( false );
+		}
+
+		// Watched once the jobs are done, so parents' lookups don't count as reads
+		s_BoneSetupWatched.AddToTail( pAnimating );
+
+		if ( !BoneCacheUsuallyLasts( pAnimating->m_nBoneCacheSurvival ) )
+		{
+			s_nBoneSetupsSkipped++;
+			continue;
+		}
+
+		// The jobs can't wait for animations to load. Leave the lazy path to do it.
+		pStudioHdr->ResolveGroups();
+		if ( !pStudioHdr->SequencesAvailable() || !pAnimating->PrefetchSkeleton( pStudioHdr ) )
+			continue;
+
+		CBaseAnimating *pParent = dynamic_cast< CBaseAnimating* >( pAnimating->GetMoveParent() );
+		CStudioHdr *pParentStudioHdr = pParent ? pParent->GetModelPtr() : NULL;
+		if ( pParent && !pParentStudioHdr )
+			continue;
+
+		BoneSetupJob_t &job = s_BoneSetupJobs[ s_BoneSetupJobs.AddToTail() ];
+		job.m_pEntity = pAnimating;
+		job.m_pStudioHdr = pStudioHdr;
+		job.m_pParent = pParent;
+		job.m_pParentStudioHdr = pParentStudioHdr;
+		job.m_pParentCache = NULL;
+		job.m_vecOrigin = pAnimating->GetAbsOrigin() + Vector( 0, 0, pAnimating->m_flEstIkOffset );
+		job.m_angAngles = pAnimating->GetAbsAngles();
+		job.m_iFirstBone = nBones;
+		job.m_nDepth = 0;
+		job.m_bSkipAnimation = pAnimating->CanSkipAnimation();
+		job.m_bMissedLookups = false;
+
+		nBones += pStudioHdr->numbones();
+		nMaxBones = max( nMaxBones, pStudioHdr->numbones() );
+		s_BoneSetupJobIndex[ pAnimating->GetRefEHandle().GetEntryIndex() ] = s_BoneSetupJobs.Count();
+	}
+
+	Studio_RecordModelLookups( false );
+
+	if ( !s_BoneSetupJobs.Count() )
+	{
+		WatchBoneSetups();
+		return;
+	}
+
+	// Count the move parents with jobs above each entity. Parents without
+	// jobs get their bones set up on this thread, as their children ask.
+	int nCaches = s_BoneSetupJobs.Count();
+	int i;
+	for ( i = 0; i < s_BoneSetupJobs.Count(); i++ )
+	{
+		BoneSetupJob_t &job = s_BoneSetupJobs[i];
+		CBaseAnimating *pParent = job.m_pParent;
+		while ( pParent )
+		{
+			int iParentJob = s_BoneSetupJobIndex[ pParent->GetRefEHandle().GetEntryIndex() ];
+			if ( !iParentJob )
+				break;
+
+			job.m_nDepth++;
+			pParent = s_BoneSetupJobs[iParentJob - 1].m_pParent;
+		}
+
+		if ( job.m_pParent && !job.m_nDepth )
+		{
+			nCaches++;
+			nMaxBones = MAXSTUDIOBONES;
+		}
+	}
+
+	for ( i = 0; i < s_BoneSetupJobs.Count(); i++ )
+	{
+		s_BoneSetupJobIndex[ s_BoneSetupJobs[i].m_pEntity->GetRefEHandle().GetEntryIndex() ] = 0;
+	}
+
+	// Creating a cache mustn't evict one that a job reads from
+	Studio_ReserveBoneCaches( nCaches, nMaxBones );
+
+	s_BoneSetupJobs.Sort( CompareBoneSetupDepth );
+	s_BoneSetupMatrices.EnsureCount( nBones );
+
+	int iWave = 0;
+	while ( iWave < s_BoneSetupJobs.Count() )
+	{
+		int iWaveEnd = iWave + 1;
+		while ( iWaveEnd < s_BoneSetupJobs.Count() && s_BoneSetupJobs[iWaveEnd].m_nDepth == s_BoneSetupJobs[iWave].m_nDepth )
+		{
+			iWaveEnd++;
+		}
+
+		for ( i = iWave; i < iWaveEnd; i++ )
+		{
+			BoneSetupJob_t &job = s_BoneSetupJobs[i];
+			if ( job.m_pParent )
+			{
+				job.m_pParentCache = job.m_pParent->GetBoneCache();
+			}
+		}
+
+		Studio_BeginModelLookupJobs();
+		ServerJobs_ParallelFor( iWaveEnd - iWave, MIN_BONE_SETUPS_PER_JOB, SetupBonesRange, s_BoneSetupJobs.Base() + iWave, 1 );
+		Studio_EndModelLookupJobs();
+
+		for ( i = iWave; i < iWaveEnd; i++ )
+		{
+			// Left for GetBoneCache() to set up, like one that wasn't prefetched
+			if ( s_BoneSetupJobs[i].m_bMissedLookups )
+			{
+				s_nBoneSetupsMissed++;
+				continue;
+			}
+
+			CBaseAnimating *pAnimating = s_BoneSetupJobs[i].m_pEntity;
+			pAnimating->UpdateBoneCache( Studio_GetBoneCache( pAnimating->m_boneCacheHandle ), 
+				&s_BoneSetupMatrices[s_BoneSetupJobs[i].m_iFirstBone], boneMask );
+		}
+
+		iWave = iWaveEnd;
+	}
+
+	Studio_ReleaseBoneCaches();
+	WatchBoneSetups();
+}
+
+//-----------------------------------------------------------------------------
+// bench_setupbones
+//
+// Sets up the bone caches of the map's animating entities one at a time, the
+// way GetBoneCache() does, and then all at once through the end of frame phase
+// that spreads them across the server job threads
+//-----------------------------------------------------------------------------
+void CBaseAnimating::InvalidateBoneBenchCaches( CUtlVector<CBaseAnimating *> &entities )
+{
+	for ( int i = 0; i < entities.Count(); i++ )
+	{
+		// The passes aren't real frames, so don't let them count for or against the entity
+		entities[i]->m_fBoneSetupWatch = 0;
+		entities[i]->m_nBoneCacheSurvival = 0xFF;
+		entities[i]->InvalidateBoneCache();
+	}
+}
+
+void CBaseAnimating::BenchSetupBones( int nPasses )
+{
+	MDLCACHE_CRITICAL_SECTION();
+
+	// Entities the phase leaves to the main thread (IK, ragdolls) would only dilute the comparison
+	CUtlVector<CBaseAnimating *> entities;
+	int nBones = 0;
+	int nSkipped = 0;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+		CStudioHdr *pStudioHdr = pAnimating ? pAnimating->GetModelPtr() : NULL;
+		if ( !pStudioHdr || pAnimating->IsMarkedForDeletion() )
+			continue;
+
+		if ( !pAnimating->CanSetupBonesInJob() )
+		{
+			nSkipped++;
+			continue;
+		}
+
+		entities.AddToTail( pAnimating );
+		nBones += pStudioHdr->numbones();
+	}
+
+	if ( !entities.Count() )
+	{
+		Msg( "No animating entities to set up\n" );
+		return;
+	}
+
+	Msg( "%d animating entities (%d skipped), %d bones, %d threads, %d passes\n", entities.Count(), nSkipped, nBones, ServerJobThreadCount(), nPasses );
+	if ( ServerJobThreadCount() <= 1 )
+	{
+		Msg( "  no job threads, so the parallel pass does nothing\n" );
+	}
+
+	CUtlVector<matrix3x4_t> serialBones;
+	serialBones.SetCount( nBones );
+
+	CUtlVector<unsigned char> survival;
+	survival.SetCount( entities.Count() );
+	for ( int iEntity = 0; iEntity < entities.Count(); iEntity++ )
+	{
+		survival[iEntity] = entities[iEntity]->m_nBoneCacheSurvival;
+	}
+	int nWasPrepared = s_nBoneSetupsPrepared;
+	int nWasLasted = s_nBoneSetupsLasted;
+	int nWasSkipped = s_nBoneSetupsSkipped;
+	int nWasMissed = s_nBoneSetupsMissed;
+
+	bool bWasParallel = sv_parallel_bones.GetBool();
+	sv_parallel_bones.SetValue( 1 );
+
+	CFastTimer timer;
+	double flSerial = 0;
+	double flParallel = 0;
+	float flMaxDiff = 0;
+	int i, j;
+
+	for ( int iPass = 0; iPass < nPasses; iPass++ )
+	{
+		// One at a time, which also marks every cache as recently used
+		InvalidateBoneBenchCaches( entities );
+		timer.Start();
+		for ( i = 0; i < entities.Count(); i++ )
+		{
+			entities[i]->GetBoneCache();
+		}
+		timer.End();
+		flSerial += timer.GetDuration().GetSeconds();
+
+		int iBone = 0;
+		for ( i = 0; i < entities.Count(); i++ )
+		{
+			CBoneCache *pCache = entities[i]->GetBoneCache();
+			for ( j = 0; j < entities[i]->GetModelPtr()->numbones(); j++, iBone++ )
+			{
+				matrix3x4_t *pMatrix = pCache->GetCachedBone( j );
+				if ( pMatrix )
+				{
+					MatrixCopy( *pMatrix, serialBones[iBone] );
+				}
+			}
+		}
+
+		InvalidateBoneBenchCaches( entities );
+		timer.Start();
+		CBaseAnimating::SetupBonesForFrame();
+		timer.End();
+		flParallel += timer.GetDuration().GetSeconds();
+
+		iBone = 0;
+		for ( i = 0; i < entities.Count(); i++ )
+		{
+			CBoneCache *pCache = entities[i]->GetBoneCache();
+			for ( j = 0; j < entities[i]->GetModelPtr()->numbones(); j++, iBone++ )
+			{
+				matrix3x4_t *pMatrix = pCache->GetCachedBone( j );
+				if ( !pMatrix )
+					continue;
+
+				for ( int k = 0; k < 12; k++ )
+				{
+					flMaxDiff = max( flMaxDiff, fabs( pMatrix->Base()[k] - serialBones[iBone].Base()[k] ) );
+				}
+			}
+		}
+	}
+
+	sv_parallel_bones.SetValue( bWasParallel ? 1 : 0 );
+
+	for ( i = 0; i < entities.Count(); i++ )
+	{
+		entities[i]->m_fBoneSetupWatch = 0;
+		entities[i]->m_nBoneCacheSurvival = survival[i];
+	}
+	s_nBoneSetupsPrepared = nWasPrepared;
+	s_nBoneSetupsLasted = nWasLasted;
+	s_nBoneSetupsSkipped = nWasSkipped;
+	int nMissed = s_nBoneSetupsMissed - nWasMissed;
+	s_nBoneSetupsMissed = nWasMissed;
+
+	Msg( "  main thread  %8.3f ms/pass\n", flSerial * 1000.0 / nPasses );
+	Msg( "  job threads  %8.3f ms/pass  %.2fx  max diff %g\n", flParallel * 1000.0 / nPasses, flParallel > 0 ? flSerial / flParallel : 0.0, flMaxDiff );
+	if ( nMissed )
+	{
+		Msg( "  %d set ups thrown away for missing model lookups\n", nMissed );
+	}
+}
+
+CON_COMMAND_F( bench_setupbones, "Times setting up the bone caches of the map's animating entities on the main thread, and with sv_parallel_bones on the job threads. Usage: bench_setupbones [passes]", FCVAR_CHEAT )
+{
+	CBaseAnimating::BenchSetupBones( max( 1, ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 20 ) );
+}
+
+//-----------------------------------------------------------------------------
+// bench_calcpose
+//
+// CalcPose over every sequence of a set of models, decoding the compressed
+// animations from frame 0 every time, and through the shared seek index and
+// frame cache both cold (just flushed) and warm
+//-----------------------------------------------------------------------------
+#define CALCPOSE_BENCH_CYCLES	32
+
+static int s_nCalcPoseBenchSink;
+
+// Poses every sequence at evenly spaced cycles, and returns the number of bones posed
+static int64 RunCalcPoseBench( CUtlVector<CStudioHdr *> &models )
+{
+	static Vector pos[MAXSTUDIOBONES];
+	static Quaternion q[MAXSTUDIOBONES];
+	float poseParameter[MAXSTUDIOPOSEPARAM];
+	int64 nBones = 0;
+
+	for ( int i = 0; i < models.Count(); i++ )
+	{
+		CStudioHdr *pStudioHdr = models[i];
+
+		int iParam;
+		for ( iParam = 0; iParam < pStudioHdr->GetNumPoseParameters(); iParam++ )
+		{
+			Studio_SetPoseParameter( pStudioHdr, iParam, 0.0f, poseParameter[iParam] );
+		}
+
+		for ( int iSequence = 0; iSequence < pStudioHdr->GetNumSeq(); iSequence++ )
+		{
+			for ( int iCycle = 0; iCycle < CALCPOSE_BENCH_CYCLES; iCycle++ )
+			{
+				float flCycle = (float)iCycle / CALCPOSE_BENCH_CYCLES;
+				CalcPose( pStudioHdr, NULL, pos, q, iSequence, flCycle, poseParameter, BONE_USED_BY_ANYTHING );
+				nBones += pStudioHdr->numbones();
+			}
+		}
+
+		s_nCalcPoseBenchSink += (int)pos[0].x;
+	}
+
+	return nBones;
+}
+
+static void PrintCalcPoseBenchResult( const char *pszLabel, const CFastTimer &timer, int64 nBones )
+{
+	double flSeconds = timer.GetDuration().GetSeconds();
+	Msg( "  %-24s %10.1f ns/bone %10.1f ms\n", pszLabel, nBones ? flSeconds * 1e9 / nBones : 0.0, flSeconds * 1000.0 );
+}
+
+CON_COMMAND_F( bench_calcpose, "Times CalcPose over every sequence of the given models (or of the map's animated entities), with and without the animation frame cache. Usage: bench_calcpose [passes] [model ...]", FCVAR_CHEAT )
+{
+	int nPasses = max( 1, ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 4 );
+
+	ConVar *pAnimCache = cvar->FindVar( "studio_anim_cache" );
+	if ( !pAnimCache )
+	{
+		Msg( "studio_anim_cache not found\n" );
+		return;
+	}
+
+	// Gather the model set
+	CUtlVector<const model_t *> modelSet;
+	if ( engine->Cmd_Argc() > 2 )
+	{
+		for ( int iArg = 2; iArg < engine->Cmd_Argc(); iArg++ )
+		{
+			int iModel = modelinfo->GetModelIndex( engine->Cmd_Argv( iArg ) );
+			const model_t *pModel = ( iModel != -1 ) ? modelinfo->GetModel( iModel ) : NULL;
+			if ( !pModel || modelinfo->GetModelType( pModel ) != mod_studio )
+			{
+				Msg( "  %s isn't a precached studio model, skipped\n", engine->Cmd_Argv( iArg ) );
+				continue;
+			}
+			if ( modelSet.Find( pModel ) == -1 )
+			{
+				modelSet.AddToTail( pModel );
+			}
+		}
+	}
+	else
+	{
+		for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+		{
+			const model_t *pModel = pEntity->GetBaseAnimating() ? pEntity->GetModel() : NULL;
+			if ( pModel && modelinfo->GetModelType( pModel ) == mod_studio && modelSet.Find( pModel ) == -1 )
+			{
+				modelSet.AddToTail( pModel );
+			}
+		}
+	}
+
+	CUtlVector<CStudioHdr *> models;
+	int nSequences = 0;
+	int i;
+	for ( i = 0; i < modelSet.Count(); i++ )
+	{
+		CStudioHdr *pStudioHdr = new CStudioHdr( modelinfo->GetStudiomodel( modelSet[i] ), mdlcache );
+		if ( !pStudioHdr->IsValid() )
+		{
+			delete pStudioHdr;
+			continue;
+		}
+		nSequences += pStudioHdr->GetNumSeq();
+		models.AddToTail( pStudioHdr );
+	}
+
+	if ( !models.Count() )
+	{
+		Msg( "No models to pose\n" );
+		return;
+	}
+
+	Msg( "%d models, %d sequences, %d cycles each, %d passes\n", models.Count(), nSequences, CALCPOSE_BENCH_CYCLES, nPasses );
+
+	bool bWasCached = pAnimCache->GetBool();
+	CFastTimer timer;
+	int64 nBones = 0;
+	int iPass;
+
+	// Every frame walked from the start of its channel
+	pAnimCache->SetValue( 0 );
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		nBones += RunCalcPoseBench( models );
+	}
+	timer.End();
+	PrintCalcPoseBenchResult( "frame 0 walk", timer, nBones );
+
+	// Builds the seek indices and decodes every frame once
+	pAnimCache->SetValue( 1 );
+	Studio_FlushAnimCaches();
+	timer.Start();
+	nBones = RunCalcPoseBench( models );
+	timer.End();
+	PrintCalcPoseBenchResult( "frame cache, cold", timer, nBones );
+
+	nBones = 0;
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		nBones += RunCalcPoseBench( models );
+	}
+	timer.End();
+	PrintCalcPoseBenchResult( "frame cache, warm", timer, nBones );
+
+	pAnimCache->SetValue( bWasCached ? 1 : 0 );
+
+	for ( i = 0; i < models.Count(); i++ )
+	{
+		delete models[i];
+	}
+}
+
+//-----------------------------------------------------------------------------
+// bench_bonesimd
+//
+// SlerpBones, BlendBones, ScaleBones and Studio_BuildMatrices over one model's
+// bones, with random poses, through the scalar and SSE paths
+//-----------------------------------------------------------------------------
+enum
+{
+	BONE_BENCH_SLERP = 0,
+	BONE_BENCH_BLEND,
+	BONE_BENCH_SCALE,
+	BONE_BENCH_MATRICES,
+	BONE_BENCH_COUNT,
+};
+
+static const char *s_pszBoneBenchNames[BONE_BENCH_COUNT] =
+{
+	"SlerpBones",
+	"BlendBones",
+	"ScaleBones",
+	"Studio_BuildMatrices",
+};
+
+struct BoneBenchPose_t
+{
+	Quaternion	q[MAXSTUDIOBONES];
+	Vector		pos[MAXSTUDIOBONES];
+};
+
+// Runs the function on a fresh copy of the start pose every iteration, and leaves the last result
+static void RunBoneBench( int iFunc, const CStudioHdr *pStudioHdr, int iSequence, const BoneBenchPose_t &start, const BoneBenchPose_t &other, int nIterations, BoneBenchPose_t &result, matrix3x4_t *pMatrices )
+{
+	mstudioseqdesc_t &seqdesc = pStudioHdr->pSeqdesc( iSequence );
+	for ( int i = 0; i < nIterations; i++ )
+	{
+		result = start;
+		switch ( iFunc )
+		{
+		case BONE_BENCH_SLERP:
+			SlerpBones( pStudioHdr, result.q, result.pos, seqdesc, iSequence, other.q, other.pos, 0.3f, BONE_USED_BY_ANYTHING );
+			break;
+		case BONE_BENCH_BLEND:
+			BlendBones( pStudioHdr, result.q, result.pos, seqdesc, iSequence, other.q, other.pos, 0.3f, BONE_USED_BY_ANYTHING );
+			break;
+		case BONE_BENCH_SCALE:
+			ScaleBones( pStudioHdr, result.q, result.pos, iSequence, 0.3f, BONE_USED_BY_ANYTHING );
+			break;
+		case BONE_BENCH_MATRICES:
+			Studio_BuildMatrices( pStudioHdr, vec3_angle, vec3_origin, result.pos, result.q, -1, pMatrices, BONE_USED_BY_ANYTHING );
+			break;
+		}
+	}
+}
+
+static void RandomBoneBenchPose( int nBones, BoneBenchPose_t &pose )
+{
+	for ( int i = 0; i < nBones; i++ )
+	{
+		RadianEuler angles( RandomFloat( -M_PI, M_PI ), RandomFloat( -M_PI, M_PI ), RandomFloat( -M_PI, M_PI ) );
+		AngleQuaternion( angles, pose.q[i] );
+		pose.pos[i].Init( RandomFloat( -32, 32 ), RandomFloat( -32, 32 ), RandomFloat( -32, 32 ) );
+	}
+}
+
+CON_COMMAND_F( bench_bonesimd, "Times the bone blending functions and Studio_BuildMatrices with studio_simd_bones 0 and 1, on the given model or the map's model with the most bones. Usage: bench_bonesimd [iterations] [model]", FCVAR_CHEAT )
+{
+	int nIterations = max( 1, ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 10000 );
+
+	ConVar *pSIMDBones = cvar->FindVar( "studio_simd_bones" );
+	if ( !pSIMDBones )
+	{
+		Msg( "studio_simd_bones not found\n" );
+		return;
+	}
+
+	const model_t *pModel = NULL;
+	if ( engine->Cmd_Argc() > 2 )
+	{
+		int iModel = modelinfo->GetModelIndex( engine->Cmd_Argv( 2 ) );
+		pModel = ( iModel != -1 ) ? modelinfo->GetModel( iModel ) : NULL;
+	}
+	else
+	{
+		int nMostBones = 0;
+		for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+		{
+			CBaseAnimating *pAnimating = pEntity->GetBaseAnimating();
+			CStudioHdr *pStudioHdr = pAnimating ? pAnimating->GetModelPtr() : NULL;
+			if ( pStudioHdr && pStudioHdr->numbones() > nMostBones )
+			{
+				nMostBones = pStudioHdr->numbones();
+				pModel = pAnimating->GetModel();
+			}
+		}
+	}
+
+	if ( !pModel || modelinfo->GetModelType( pModel ) != mod_studio )
+	{
+		Msg( "No precached studio model to pose\n" );
+		return;
+	}
+
+	CStudioHdr studioHdr( modelinfo->GetStudiomodel( pModel ), mdlcache );
+	if ( !studioHdr.IsValid() )
+	{
+		Msg( "%s isn't a valid studio model\n", modelinfo->GetModelName( pModel ) );
+		return;
+	}
+
+	// Blends need a sequence that isn't a delta or world space one
+	int iSequence;
+	for ( iSequence = 0; iSequence < studioHdr.GetNumSeq(); iSequence++ )
+	{
+		if ( !( studioHdr.pSeqdesc( iSequence ).flags & ( STUDIO_DELTA | STUDIO_WORLD ) ) )
+			break;
+	}
+	if ( iSequence == studioHdr.GetNumSeq() )
+	{
+		Msg( "%s has no sequence to blend\n", modelinfo->GetModelName( pModel ) );
+		return;
+	}
+
+	int nBones = studioHdr.numbones();
+	Msg( "%s: %d bones, %d iterations\n", modelinfo->GetModelName( pModel ), nBones, nIterations );
+	Msg( "function                 scalar (ns/bone)   SSE (ns/bone)   speedup   max diff\n" );
+
+	static BoneBenchPose_t start, other, scalarResult, simdResult;
+	static matrix3x4_t scalarMatrices[MAXSTUDIOBONES], simdMatrices[MAXSTUDIOBONES];
+	RandomSeed( 1 );
+	RandomBoneBenchPose( nBones, start );
+	RandomBoneBenchPose( nBones, other );
+
+	bool bWasSIMD = pSIMDBones->GetBool();
+	CFastTimer timer;
+
+	for ( int iFunc = 0; iFunc < BONE_BENCH_COUNT; iFunc++ )
+	{
+		pSIMDBones->SetValue( 0 );
+		timer.Start();
+		RunBoneBench( iFunc, &studioHdr, iSequence, start, other, nIterations, scalarResult, scalarMatrices );
+		timer.End();
+		double flScalar = timer.GetDuration().GetSeconds();
+
+		pSIMDBones->SetValue( 1 );
+		timer.Start();
+		RunBoneBench( iFunc, &studioHdr, iSequence, start, other, nIterations, simdResult, simdMatrices );
+		timer.End();
+		double flSIMD = timer.GetDuration().GetSeconds();
+
+		float flMaxDiff = 0.0f;
+		for ( int i = 0; i < nBones; i++ )
+		{
+			int j;
+			if ( iFunc == BONE_BENCH_MATRICES )
+			{
+				for ( j = 0; j < 12; j++ )
+				{
+					flMaxDiff = max( flMaxDiff, fabs( scalarMatrices[i].Base()[j] - simdMatrices[i].Base()[j] ) );
+				}
+				continue;
+			}
+			for ( j = 0; j < 4; j++ )
+			{
+				flMaxDiff = max( flMaxDiff, fabs( scalarResult.q[i][j] - simdResult.q[i][j] ) );
+			}
+			for ( j = 0; j < 3; j++ )
+			{
+				flMaxDiff = max( flMaxDiff, fabs( scalarResult.pos[i][j] - simdResult.pos[i][j] ) );
+			}
+		}
+
+		double flBones = (double)nBones * nIterations;
+		Msg( "%-24s %16.1f %15.1f %8.2fx %10.2g\n", s_pszBoneBenchNames[iFunc],
+			flScalar * 1e9 / flBones, flSIMD * 1e9 / flBones, flSIMD > 0 ? flScalar / flSIMD : 0.0, flMaxDiff );
+	}
+
+	pSIMDBones->SetValue( bWasSIMD ? 1 : 0 );
+}
+
 bool CBaseAnimating::TestCollision( const Ray_t &ray, unsigned int fContentsMask, trace_t& tr )
 {
 	if ( ray.m_IsRay && IsSolidFlagSet( FSOLID_CUSTOMRAYTEST ))
@@ -237,6 +237,16 @@ public:
 	class CBoneCache *GetBoneCache( void );
 	void InvalidateBoneCache();
 	void InvalidateBoneCacheIfOlderThan( float deltaTime );
+
+	// Sets up the bones of the entities that used their bone caches recently
+	// and whose caches have run out, on the server job pool
+	static void SetupBonesForFrame();
+	// bench_setupbones
+	static void BenchSetupBones( int nPasses );
+	// Can SetupBones() run on a job thread?
+	virtual bool CanSetupBonesInJob();
+	// Loads the animations GetSkeleton() reads. Returns true if they're all resident.
+	virtual bool PrefetchSkeleton( CStudioHdr *pStudioHdr );
 	virtual int DrawDebugTextOverlays( void );
 	
 	// See note in code re: bandwidth usage!!!
@@ -292,7 +302,7 @@ public:
 	void BuildMatricesWithBoneMerge( const CStudioHdr *pStudioHdr, const QAngle& angles, 
 		const Vector& origin, const Vector pos[MAXSTUDIOBONES],
 		const Quaternion q[MAXSTUDIOBONES], matrix3x4_t bonetoworld[MAXSTUDIOBONES],
-		CBaseAnimating *pParent, CBoneCache *pParentCache );
+		const CStudioHdr *pParentStudioHdr, CBoneCache *pParentCache );
 
 	void	SetFadeDistance( float minFadeDist, float maxFadeDist );
 
@@ -309,6 +319,12 @@ private:
 
 	bool CanSkipAnimation( void );
 
+	CBoneCache *UpdateBoneCache( CBoneCache *pcache, matrix3x4_t *pBoneToWorld, int boneMask );
+	void RecordBoneCacheSurvival( bool bSurvived );
+	static void WatchBoneSetups();
+	static void InvalidateBoneBenchCaches( CUtlVector<CBaseAnimating *> &entities );
+	static void SetupBonesRange( void *pContext, int iFirst, int iLast );
+
 public:
 	CNetworkVar( int, m_nForceBone );
 	CNetworkVector( m_vecForce );
@@ -372,6 +388,10 @@ private:
 
 	memhandle_t		m_boneCacheHandle;
 	unsigned short	m_fBoneCacheFlags;		// Used for bone cache state on model
+	float			m_flBoneCacheUsedTime;	// Last time GetBoneCache() was called
+	float			m_flBoneSetupWatchTime;	// End of the frame SetupBonesForFrame() last considered it at
+	unsigned char	m_fBoneSetupWatch;		// BONE_SETUP_* while it waits to see if the cache lasts
+	unsigned char	m_nBoneCacheSurvival;	// Bit per recent wait, set if a cache set up then lasted to its next use
 
 protected:
 	CNetworkVar( float, m_fadeMinDist );	// Point at which fading is absolute
@@ -471,6 +471,22 @@ void CBaseAnimatingOverlay::GetSkeleton( CStudioHdr *pStudioHdr, Vector pos[], Q
 	CalcBoneAdj( pStudioHdr, pos, q, GetEncodedControllerArray(), boneMask );
 }
 
+bool CBaseAnimatingOverlay::PrefetchSkeleton( CStudioHdr *pStudioHdr )
+{
+	bool bPrefetched = BaseClass::PrefetchSkeleton( pStudioHdr );
+
+	for (int i = 0; i < m_AnimOverlay.Count(); i++)
+	{
+		CAnimationLayer &pLayer = m_AnimOverlay[i];
+		if( (pLayer.m_flWeight > 0) && pLayer.IsActive() && !Studio_PrefetchPose( pStudioHdr, pLayer.m_nSequence ) )
+		{
+			bPrefetched = false;
+		}
+	}
+
+	return bPrefetched;
+}
+
 
 
 //-----------------------------------------------------------------------------
@@ -36,6 +36,7 @@
 #include "movevars_shared.h"
 #include "RagdollBoogie.h"
 #include "rumble_shared.h"
+#include "utlflatmap.h"
 
 #ifdef HL2_DLL
 #include "weapon_physcannon.h"
@@ -275,27 +276,47 @@ void CBaseCombatCharacter::CorpseFade( void )
 // Visibility caching
 //-----------------------------------------------------------------------------
 
-struct VisibilityCacheEntry_t
+// The pair is stored lower pointer first, so both directions share an entry
+struct VisibilityCachePair_t
 {
 	CBaseEntity *pEntity1;
 	CBaseEntity *pEntity2;
-	EHANDLE		pBlocker;
-	float		time;
+
+	bool operator==( const VisibilityCachePair_t &other ) const { return pEntity1 == other.pEntity1 && pEntity2 == other.pEntity2; }
 };
 
-class CVisibilityCacheEntryLess
+class CVisibilityCachePairHashFunctor
 {
 public:
-	CVisibilityCacheEntryLess( int ) {}
-	bool operator!() const { return false; }
-	bool operator()( const VisibilityCacheEntry_t &lhs, const VisibilityCacheEntry_t &rhs ) const
+	unsigned operator()( const VisibilityCachePair_t &pair ) const
 	{
-		return ( memcmp( &lhs, &rhs, offsetof( VisibilityCacheEntry_t, pBlocker ) ) < 0 );
+		return HashIntConventional( (int)FlatHashKey( pair.pEntity1 ) ^ (int)FlatHashKey( pair.pEntity2 ) * 31 );
 	}
 };
 
-static CUtlRBTree<VisibilityCacheEntry_t, unsigned short, CVisibilityCacheEntryLess> g_VisibilityCache;
+struct VisibilityCacheEntry_t
+{
+	EHANDLE		pBlocker;
+	float		time;
+};
+
+static CUtlFlatMap<VisibilityCachePair_t, VisibilityCacheEntry_t, CVisibilityCachePairHashFunctor> g_VisibilityCache;
 const float VIS_CACHE_ENTRY_LIFE = ( !IsXbox() ) ? .090 : .500;
+const int VIS_CACHE_MAX_ENTRIES = 65535;
+
+//-----------------------------------------------------------------------------
+// Makes room in a full cache by dropping the entries that have expired
+//-----------------------------------------------------------------------------
+static void RemoveExpiredVisibilityCacheEntries()
+{
+	for ( int i = g_VisibilityCache.First(); i != g_VisibilityCache.InvalidIndex(); i = g_VisibilityCache.Next( i ) )
+	{
+		if ( gpGlobals->curtime - g_VisibilityCache[i].time >= VIS_CACHE_ENTRY_LIFE )
+		{
+			g_VisibilityCache.RemoveAt( i );
+		}
+	}
+}
 
 bool CBaseCombatCharacter::FVisible( CBaseEntity *pEntity, int traceMask, CBaseEntity **ppBlocker )
 {
@@ -306,20 +327,20 @@ bool CBaseCombatCharacter::FVisible( CBaseEntity *pEntity, int traceMask, CBaseE
 		return BaseClass::FVisible( pEntity, traceMask, ppBlocker );
 	}
 
-	VisibilityCacheEntry_t cacheEntry;
+	VisibilityCachePair_t cachePair;
 
 	if ( this < pEntity )
 	{
-		cacheEntry.pEntity1 = this;
-		cacheEntry.pEntity2 = pEntity;
+		cachePair.pEntity1 = this;
+		cachePair.pEntity2 = pEntity;
 	}
 	else
 	{
-		cacheEntry.pEntity1 = pEntity;
-		cacheEntry.pEntity2 = this;
+		cachePair.pEntity1 = pEntity;
+		cachePair.pEntity2 = this;
 	}
 
-	int iCache = g_VisibilityCache.Find( cacheEntry );
+	int iCache = g_VisibilityCache.Find( cachePair );
 
 	if ( iCache != g_VisibilityCache.InvalidIndex() )
 	{
@@ -349,9 +370,14 @@ bool CBaseCombatCharacter::FVisible( CBaseEntity *pEntity, int traceMask, CBaseE
 	}
 	else
 	{
-		if ( g_VisibilityCache.Count() != g_VisibilityCache.InvalidIndex() )
+		if ( (int)g_VisibilityCache.Count() >= VIS_CACHE_MAX_ENTRIES )
 		{
-			iCache = g_VisibilityCache.Insert( cacheEntry );
+			RemoveExpiredVisibilityCacheEntries();
+		}
+
+		if ( (int)g_VisibilityCache.Count() < VIS_CACHE_MAX_ENTRIES )
+		{
+			iCache = g_VisibilityCache.Insert( cachePair );
 		}
 		else
 		{
@@ -390,20 +416,14 @@ void CBaseCombatCharacter::ResetVisibilityCache( CBaseCombatCharacter *pBCC )
 		return;
 	}
 
-	int i = g_VisibilityCache.FirstInorder();
-	CUtlVector<unsigned short> removals;
-	while ( i != g_VisibilityCache.InvalidIndex() )
+	// Removing an entry doesn't move the others, so this can remove as it goes
+	for ( int i = g_VisibilityCache.First(); i != g_VisibilityCache.InvalidIndex(); i = g_VisibilityCache.Next( i ) )
 	{
-		if ( g_VisibilityCache[i].pEntity1 == pBCC || g_VisibilityCache[i].pEntity2 == pBCC )
+		const VisibilityCachePair_t &pair = g_VisibilityCache.Key( i );
+		if ( pair.pEntity1 == pBCC || pair.pEntity2 == pBCC )
 		{
-			removals.AddToTail( i );
+			g_VisibilityCache.RemoveAt( i );
 		}
-		i = g_VisibilityCache.NextInorder( i );
-	}
-
-	for ( i = 0; i < removals.Count(); i++ )
-	{
-		g_VisibilityCache.RemoveAt( removals[i] );
 	}
 }
 
@@ -507,6 +507,53 @@ CBaseEntity *CBaseEntity::GetFollowedEntity()
 void CBaseEntity::SetClassname( const char *className )
 {
 	m_iClassname = AllocPooledString( className );
+	gEntList.ReportEntityNameChanged( this );
+}
+
+void CBaseEntity::SetName( string_t newName )
+{
+	m_iName = newName;
+	gEntList.ReportEntityNameChanged( this );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns the earliest tick the base think or a think context is due
+//			on, 0 if none of them will think.
+//-----------------------------------------------------------------------------
+int CBaseEntity::GetEarliestNextThinkTick()
+{
+	int nTick = ( m_nNextThinkTick > 0 ) ? m_nNextThinkTick : 0;
+	for ( int i = 0; i < m_aThinkFunctions.Count(); i++ )
+	{
+		int nContextTick = m_aThinkFunctions[i].m_nNextThinkTick;
+		if ( nContextTick > 0 && ( nTick == 0 || nContextTick < nTick ) )
+		{
+			nTick = nContextTick;
+		}
+	}
+	return nTick;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: True if a frame of simulation does nothing for this entity but run
+//			its due thinks (see Physics_SimulateEntity() and PhysicsSimulate()),
+//			so it only needs to run on the frames a think is due.
+//-----------------------------------------------------------------------------
+bool CBaseEntity::CanScheduleThinks()
+{
+	if ( !IsEFlagSet( EFL_NO_GAME_PHYSICS_SIMULATION ) )
+		return false;
+
+	if ( !edict() )
+		return true;
+
+#if !defined( NO_ENTITY_PREDICTION )
+	if ( IsPlayerSimulated() )
+		return false;
+#endif
+
+	// Parented MOVETYPE_NONE entities also touch triggers and move their shadow
+	return ( GetMoveType() == MOVETYPE_VPHYSICS ) || ( GetMoveType() == MOVETYPE_NONE && !GetMoveParent() );
 }
 
 // position to shoot at
@@ -2757,6 +2804,7 @@ int CBaseEntity::Restore( IRestore &restore )
 
 	// loops through the data description list, restoring each data desc block in order
 	int status = RestoreDataDescBlock( restore, GetDataDescMap() );
+	gEntList.ReportEntityNameChanged( this );
 
 	// ---------------------------------------------------------------
 	// HACKHACK: We don't know the space of these vectors until now
@@ -3032,6 +3080,10 @@ void CBaseEntity::SetMoveType( MoveType_t val, MoveCollide_t moveCollide )
 	// This will probably go away or be handled in a better way once I remove the cvar that controls the test code
 	CheckStepSimulationChanged();
 	CheckHasGamePhysicsSimulation();
+
+	// Whether the entity can wait in the think schedule depends on the movetype itself,
+	// not only on whether it simulates
+	SimThink_EntityChanged( this );
 }
 
 void CBaseEntity::Spawn( void ) 
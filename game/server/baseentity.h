@@ -706,6 +706,11 @@ public:
 	int		GetNextThinkTick( const char *szContext = NULL );
 	int		GetLastThinkTick( const char *szContext = NULL );
 
+	// For the think schedule: the earliest tick any think function is due on (0 if none),
+	// and whether the entity can be skipped on the frames none are due
+	int		GetEarliestNextThinkTick();
+	bool	CanScheduleThinks();
+
 	float				GetAnimTime() const;
 	void				SetAnimTime( float at );
 
@@ -1781,11 +1786,6 @@ inline string_t CBaseEntity::GetEntityName()
 	return m_iName; 
 }
 
-inline void CBaseEntity::SetName( string_t newName )
-{
-	m_iName = newName;
-}
-
 
 inline bool CBaseEntity::NameMatches( const char *pszNameOrWildcard )
 {
@@ -86,6 +86,7 @@ OUTPUTS:
 #include "env_debughistory.h"
 
 #include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -594,10 +595,15 @@ DEFINE_FIXEDSIZE_ALLOCATOR( EventQueuePrioritizedEvent_t, 128, CMemoryPool::GROW
 
 CEventQueue g_EventQueue;
 
+// Children per node of the event heap
+#define EVENTQUEUE_HEAP_ARITY	4
+
 CEventQueue::CEventQueue()
 {
-	m_Events.m_flFireTime = -FLT_MAX;
-	m_Events.m_pNext = NULL;
+	m_nNextOrder = 0;
+	m_pFiringEvent = NULL;
+	memset( m_pEventsByCaller, 0, sizeof( m_pEventsByCaller ) );
+	memset( m_pEventsByTarget, 0, sizeof( m_pEventsByTarget ) );
 
 	Init();
 }
@@ -711,27 +717,57 @@ void CEventQueue::Init( void )
 void CEventQueue::Clear( void )
 {
 	// delete all the events in the queue
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
-	
-	while ( pe != NULL )
+	for ( int i = 0; i < m_Heap.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
-		delete pe;
-		pe = next;
+		if ( m_Heap[i] == m_pFiringEvent )
+		{
+			// ServiceEvents() deletes it; it's no longer in the queue
+			m_pFiringEvent->m_iHeapIndex = -1;
+			continue;
+		}
+
+		delete m_Heap[i];
 	}
 
-	m_Events.m_pNext = NULL;
+	m_Heap.RemoveAll();
+	m_nNextOrder = 0;
+	memset( m_pEventsByCaller, 0, sizeof( m_pEventsByCaller ) );
+	memset( m_pEventsByTarget, 0, sizeof( m_pEventsByTarget ) );
+}
+
+static int __cdecl CompareEventFireOrder( EventQueuePrioritizedEvent_t * const *ppLeft, EventQueuePrioritizedEvent_t * const *ppRight )
+{
+	const EventQueuePrioritizedEvent_t *pLeft = *ppLeft;
+	const EventQueuePrioritizedEvent_t *pRight = *ppRight;
+
+	if ( pLeft->m_flFireTime != pRight->m_flFireTime )
+		return ( pLeft->m_flFireTime < pRight->m_flFireTime ) ? -1 : 1;
+
+	if ( pLeft->m_nOrder != pRight->m_nOrder )
+		return ( pLeft->m_nOrder < pRight->m_nOrder ) ? -1 : 1;
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: returns the events in the order they will fire
+//-----------------------------------------------------------------------------
+void CEventQueue::GetSortedEvents( CUtlVector<EventQueuePrioritizedEvent_t *> &events )
+{
+	events.CopyArray( m_Heap.Base(), m_Heap.Count() );
+	events.Sort( CompareEventFireOrder );
 }
 
 void CEventQueue::Dump( void )
 {
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
+	CUtlVector<EventQueuePrioritizedEvent_t *> events;
+	GetSortedEvents( events );
 
 	Msg("Dumping event queue. Current time is: %.2f\n", gpGlobals->curtime );
 
-	while ( pe != NULL )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
-		EventQueuePrioritizedEvent_t *next = pe->m_pNext;
+		EventQueuePrioritizedEvent_t *pe = events[i];
 
 		Msg("   (%.2f) Target: '%s', Input: '%s', Parameter '%s'. Activator: '%s', Caller '%s'.  \n", 
 			pe->m_flFireTime, 
@@ -740,8 +776,6 @@ void CEventQueue::Dump( void )
 			pe->m_VariantValue.String(),
 			pe->m_pActivator ? pe->m_pActivator->GetDebugName() : "None", 
 			pe->m_pCaller ? pe->m_pCaller->GetDebugName() : "None"  );
-
-		pe = next;
 	}
 
 	Msg("Finished dump.\n");
@@ -795,41 +829,218 @@ void CEventQueue::AddEvent( CBaseEntity *target, const char *action, float fireD
 
 
 //-----------------------------------------------------------------------------
-// Purpose: private function, adds an event into the list
+// Purpose: heap order: earlier fire time first, then first added first
+//-----------------------------------------------------------------------------
+bool CEventQueue::FiresBefore( const EventQueuePrioritizedEvent_t *pLeft, const EventQueuePrioritizedEvent_t *pRight )
+{
+	if ( pLeft->m_flFireTime != pRight->m_flFireTime )
+		return pLeft->m_flFireTime < pRight->m_flFireTime;
+
+	return pLeft->m_nOrder < pRight->m_nOrder;
+}
+
+void CEventQueue::HeapMoveUp( int i )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Heap[i];
+	while ( i > 0 )
+	{
+		int iParent = ( i - 1 ) / EVENTQUEUE_HEAP_ARITY;
+		if ( !FiresBefore( pe, m_Heap[iParent] ) )
+			break;
+
+		m_Heap[i] = m_Heap[iParent];
+		m_Heap[i]->m_iHeapIndex = i;
+		i = iParent;
+	}
+
+	m_Heap[i] = pe;
+	pe->m_iHeapIndex = i;
+}
+
+void CEventQueue::HeapMoveDown( int i )
+{
+	EventQueuePrioritizedEvent_t *pe = m_Heap[i];
+	int nCount = m_Heap.Count();
+	while ( 1 )
+	{
+		int iFirstChild = i * EVENTQUEUE_HEAP_ARITY + 1;
+		if ( iFirstChild >= nCount )
+			break;
+
+		int iLastChild = min( iFirstChild + EVENTQUEUE_HEAP_ARITY, nCount );
+		int iBest = iFirstChild;
+		for ( int iChild = iFirstChild + 1; iChild < iLastChild; iChild++ )
+		{
+			if ( FiresBefore( m_Heap[iChild], m_Heap[iBest] ) )
+			{
+				iBest = iChild;
+			}
+		}
+
+		if ( !FiresBefore( m_Heap[iBest], pe ) )
+			break;
+
+		m_Heap[i] = m_Heap[iBest];
+		m_Heap[i]->m_iHeapIndex = i;
+		i = iBest;
+	}
+
+	m_Heap[i] = pe;
+	pe->m_iHeapIndex = i;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: private function, adds an event into the queue
 // Input  : *newEvent - the (already built) event to add
 //-----------------------------------------------------------------------------
 void CEventQueue::AddEvent( EventQueuePrioritizedEvent_t *newEvent )
 {
-	// loop through the actions looking for a place to insert
-	EventQueuePrioritizedEvent_t *pe;
-	for ( pe = &m_Events; pe->m_pNext != NULL; pe = pe->m_pNext )
+	// events due at the same time fire in the order they were added
+	newEvent->m_nOrder = m_nNextOrder++;
+
+	// link into the lists for its caller and direct target
+	newEvent->m_iCallerSlot = newEvent->m_pCaller.IsValid() ? newEvent->m_pCaller.GetEntryIndex() : -1;
+	newEvent->m_pPrevByCaller = NULL;
+	newEvent->m_pNextByCaller = NULL;
+	if ( newEvent->m_iCallerSlot != -1 )
 	{
-		if ( pe->m_pNext->m_flFireTime > newEvent->m_flFireTime )
+		newEvent->m_pNextByCaller = m_pEventsByCaller[newEvent->m_iCallerSlot];
+		if ( newEvent->m_pNextByCaller )
 		{
-			break;
+			newEvent->m_pNextByCaller->m_pPrevByCaller = newEvent;
 		}
+		m_pEventsByCaller[newEvent->m_iCallerSlot] = newEvent;
 	}
 
-	Assert( pe );
+	newEvent->m_iTargetSlot = newEvent->m_pEntTarget.IsValid() ? newEvent->m_pEntTarget.GetEntryIndex() : -1;
+	newEvent->m_pPrevByTarget = NULL;
+	newEvent->m_pNextByTarget = NULL;
+	if ( newEvent->m_iTargetSlot != -1 )
+	{
+		newEvent->m_pNextByTarget = m_pEventsByTarget[newEvent->m_iTargetSlot];
+		if ( newEvent->m_pNextByTarget )
+		{
+			newEvent->m_pNextByTarget->m_pPrevByTarget = newEvent;
+		}
+		m_pEventsByTarget[newEvent->m_iTargetSlot] = newEvent;
+	}
 
 	// insert
-	newEvent->m_pNext = pe->m_pNext;
-	newEvent->m_pPrev = pe;
-	pe->m_pNext = newEvent;
-	if ( newEvent->m_pNext )
+	newEvent->m_iHeapIndex = m_Heap.AddToTail( newEvent );
+	HeapMoveUp( newEvent->m_iHeapIndex );
+}
+
+void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
+{
+	Assert( pe->m_iHeapIndex >= 0 && m_Heap[pe->m_iHeapIndex] == pe );
+
+	if ( pe->m_iCallerSlot != -1 )
+	{
+		if ( pe->m_pPrevByCaller )
+		{
+			pe->m_pPrevByCaller->m_pNextByCaller = pe->m_pNextByCaller;
+		}
+		else
+		{
+			m_pEventsByCaller[pe->m_iCallerSlot] = pe->m_pNextByCaller;
+		}
+		if ( pe->m_pNextByCaller )
+		{
+			pe->m_pNextByCaller->m_pPrevByCaller = pe->m_pPrevByCaller;
+		}
+		pe->m_iCallerSlot = -1;
+	}
+
+	if ( pe->m_iTargetSlot != -1 )
+	{
+		if ( pe->m_pPrevByTarget )
+		{
+			pe->m_pPrevByTarget->m_pNextByTarget = pe->m_pNextByTarget;
+		}
+		else
+		{
+			m_pEventsByTarget[pe->m_iTargetSlot] = pe->m_pNextByTarget;
+		}
+		if ( pe->m_pNextByTarget )
+		{
+			pe->m_pNextByTarget->m_pPrevByTarget = pe->m_pPrevByTarget;
+		}
+		pe->m_iTargetSlot = -1;
+	}
+
+	// fill the hole with the last event and move that into place
+	int i = pe->m_iHeapIndex;
+	int iLast = m_Heap.Count() - 1;
+	pe->m_iHeapIndex = -1;
+	if ( i != iLast )
+	{
+		EventQueuePrioritizedEvent_t *pMoved = m_Heap[iLast];
+		m_Heap[i] = pMoved;
+		pMoved->m_iHeapIndex = i;
+		m_Heap.Remove( iLast );
+
+		HeapMoveUp( i );
+		HeapMoveDown( pMoved->m_iHeapIndex );
+	}
+	else
 	{
-		newEvent->m_pNext->m_pPrev = newEvent;
+		m_Heap.Remove( iLast );
 	}
 }
 
-void CEventQueue::RemoveEvent( EventQueuePrioritizedEvent_t *pe )
+//-----------------------------------------------------------------------------
+// Purpose: removes an event from the queue and frees it, unless it's the one
+//			being fired, which ServiceEvents() frees when it's done with it
+//-----------------------------------------------------------------------------
+void CEventQueue::DeleteEvent( EventQueuePrioritizedEvent_t *pe )
+{
+	RemoveEvent( pe );
+
+	if ( pe != m_pFiringEvent )
+	{
+		delete pe;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: checks the heap order and the caller and target lists
+//-----------------------------------------------------------------------------
+void CEventQueue::ValidateQueue( void )
 {
-	Assert( pe->m_pPrev );
-	pe->m_pPrev->m_pNext = pe->m_pNext;
-	if ( pe->m_pNext )
+	int i;
+	for ( i = 0; i < m_Heap.Count(); i++ )
 	{
-		pe->m_pNext->m_pPrev = pe->m_pPrev;
+		Assert( m_Heap[i]->m_iHeapIndex == i );
+		Assert( i == 0 || !FiresBefore( m_Heap[i], m_Heap[( i - 1 ) / EVENTQUEUE_HEAP_ARITY] ) );
+	}
+
+	int nLinked = 0;
+	for ( i = 0; i < NUM_ENT_ENTRIES; i++ )
+	{
+		EventQueuePrioritizedEvent_t *pe;
+		for ( pe = m_pEventsByCaller[i]; pe != NULL; pe = pe->m_pNextByCaller )
+		{
+			Assert( pe->m_iCallerSlot == i && pe->m_pCaller.GetEntryIndex() == i );
+			Assert( pe->m_iHeapIndex >= 0 && m_Heap[pe->m_iHeapIndex] == pe );
+			Assert( !pe->m_pNextByCaller || pe->m_pNextByCaller->m_pPrevByCaller == pe );
+			nLinked++;
+		}
+
+		for ( pe = m_pEventsByTarget[i]; pe != NULL; pe = pe->m_pNextByTarget )
+		{
+			Assert( pe->m_iTargetSlot == i && pe->m_pEntTarget.GetEntryIndex() == i );
+			Assert( pe->m_iHeapIndex >= 0 && m_Heap[pe->m_iHeapIndex] == pe );
+			Assert( !pe->m_pNextByTarget || pe->m_pNextByTarget->m_pPrevByTarget == pe );
+			nLinked++;
+		}
 	}
+
+	int nExpected = 0;
+	for ( i = 0; i < m_Heap.Count(); i++ )
+	{
+		nExpected += ( m_Heap[i]->m_iCallerSlot != -1 ) + ( m_Heap[i]->m_iTargetSlot != -1 );
+	}
+	Assert( nLinked == nExpected );
 }
 
 
@@ -843,12 +1054,15 @@ void CEventQueue::ServiceEvents( void )
 		return;
 	}
 
-	EventQueuePrioritizedEvent_t *pe = m_Events.m_pNext;
-
-	while ( pe != NULL && pe->m_flFireTime <= gpGlobals->curtime )
+	while ( m_Heap.Count() && m_Heap[0]->m_flFireTime <= gpGlobals->curtime )
 	{
 		MDLCACHE_CRITICAL_SECTION();
 
+		// the event stays queued while it fires, but can't be freed by an input
+		// that cancels it or clears the queue
+		EventQueuePrioritizedEvent_t *pe = m_Heap[0];
+		m_pFiringEvent = pe;
+
 		bool targetFound = false;
 
 		// find the targets
@@ -912,8 +1126,12 @@ void CEventQueue::ServiceEvents( void )
 			ADD_DEBUG_HISTORY( HISTORY_ENTITY_IO, szBuffer );
 		}
 
-		// remove the event from the list (remembering that the queue may have been added to)
-		RemoveEvent( pe );
+		// remove the event from the queue (remembering that the queue may have been added to, or cleared)
+		m_pFiringEvent = NULL;
+		if ( pe->m_iHeapIndex != -1 )
+		{
+			RemoveEvent( pe );
+		}
 		delete pe;
 
 		//
@@ -926,9 +1144,6 @@ void CEventQueue::ServiceEvents( void )
 				break;
 			}
 		}
-
-		// restart the list (to catch any new items have probably been added to the queue)
-		pe = m_Events.m_pNext;	
 	}
 }
 
@@ -941,6 +1156,117 @@ void CC_DumpEventQueue()
 }
 static ConCommand dumpeventqueue( "dumpeventqueue", CC_DumpEventQueue, "Dump the contents of the Entity I/O event queue to the console." );
 
+//-----------------------------------------------------------------------------
+// Purpose: Times queueing, looking up, cancelling and firing pending entity
+//			I/O events. Uses a queue of its own, so the game's queue is untouched.
+//-----------------------------------------------------------------------------
+struct BenchEventListNode_t
+{
+	float m_flFireTime;
+	BenchEventListNode_t *m_pNext;
+};
+
+CON_COMMAND_F( bench_eventqueue, "Times adding, looking up, cancelling and firing pending entity I/O events, against the old sorted list. Usage: bench_eventqueue [events]", FCVAR_CHEAT )
+{
+	int nEvents = ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 100000;
+	nEvents = clamp( nEvents, 1, 1000000 );
+
+	// callers and targets are existing entities, and the input is one none of them handles
+	CUtlVector<CBaseEntity *> entities;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity != NULL && entities.Count() < 256; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		entities.AddToTail( pEntity );
+	}
+
+	if ( !entities.Count() )
+	{
+		Msg( "bench_eventqueue: no entities, load a map first.\n" );
+		return;
+	}
+
+	CEventQueue *pQueue = new CEventQueue;
+	CFastTimer timer;
+	int i;
+
+	// 64 distinct fire times, so most events tie with others. All of them are due now.
+	timer.Start();
+	for ( i = 0; i < nEvents; i++ )
+	{
+		CBaseEntity *pTarget = entities[i % entities.Count()];
+		CBaseEntity *pCaller = entities[( i / 7 ) % entities.Count()];
+		pQueue->AddEvent( pTarget, "BenchEventQueue", -( i % 64 ) * TICK_INTERVAL, NULL, pCaller );
+	}
+	timer.End();
+	float flAddMs = timer.GetDuration().GetMillisecondsF();
+
+	pQueue->ValidateQueue();
+
+	timer.Start();
+	int nPending = 0;
+	for ( i = 0; i < nEvents; i++ )
+	{
+		nPending += pQueue->HasEventPending( entities[i % entities.Count()], "BenchEventQueue" ) ? 1 : 0;
+	}
+	timer.End();
+	float flLookupMs = timer.GetDuration().GetMillisecondsF();
+
+	// cancel everything sent by a quarter of the callers
+	timer.Start();
+	for ( i = 0; i < entities.Count(); i += 4 )
+	{
+		pQueue->CancelEvents( entities[i] );
+	}
+	timer.End();
+	float flCancelMs = timer.GetDuration().GetMillisecondsF();
+	int nCancelled = nEvents - pQueue->GetEventCount();
+
+	pQueue->ValidateQueue();
+
+	int nFired = pQueue->GetEventCount();
+	timer.Start();
+	pQueue->ServiceEvents();
+	timer.End();
+	float flFireMs = timer.GetDuration().GetMillisecondsF();
+	int nLeft = pQueue->GetEventCount();
+
+	delete pQueue;
+
+	// the old queue walked a sorted linked list from the front on every insert
+	int nListEvents = min( nEvents, 20000 );
+	BenchEventListNode_t *pNodes = new BenchEventListNode_t[nListEvents];
+	BenchEventListNode_t head;
+	head.m_flFireTime = -FLT_MAX;
+	head.m_pNext = NULL;
+
+	timer.Start();
+	for ( i = 0; i < nListEvents; i++ )
+	{
+		BenchEventListNode_t *pNew = &pNodes[i];
+		pNew->m_flFireTime = gpGlobals->curtime - ( i % 64 ) * TICK_INTERVAL;
+
+		BenchEventListNode_t *pe;
+		for ( pe = &head; pe->m_pNext != NULL; pe = pe->m_pNext )
+		{
+			if ( pe->m_pNext->m_flFireTime > pNew->m_flFireTime )
+				break;
+		}
+
+		pNew->m_pNext = pe->m_pNext;
+		pe->m_pNext = pNew;
+	}
+	timer.End();
+	float flListAddMs = timer.GetDuration().GetMillisecondsF();
+
+	delete [] pNodes;
+
+	Msg( "bench_eventqueue: %d events, %d callers/targets\n", nEvents, entities.Count() );
+	Msg( "  add:       %9.3f ms (%.3f us/event)\n", flAddMs, 1000.0f * flAddMs / nEvents );
+	Msg( "  lookup:    %9.3f ms for %d HasEventPending calls (%d true)\n", flLookupMs, nEvents, nPending );
+	Msg( "  cancel:    %9.3f ms for %d callers, %d events\n", flCancelMs, ( entities.Count() + 3 ) / 4, nCancelled );
+	Msg( "  fire:      %9.3f ms for %d events (%d left)\n", flFireMs, nFired, nLeft );
+	Msg( "  old list add: %9.3f ms for %d events (%.3f us/event)\n", flListAddMs, nListEvents, 1000.0f * flListAddMs / nListEvents );
+}
+
 //-----------------------------------------------------------------------------
 // Purpose: Removes all pending events from the I/O queue that were added by the
 //			given caller.
@@ -950,10 +1276,11 @@ static ConCommand dumpeventqueue( "dumpeventqueue", CC_DumpEventQueue, "Dump the
 //-----------------------------------------------------------------------------
 void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 {
-	if (!pCaller)
+	if (!pCaller || !pCaller->GetRefEHandle().IsValid())
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	// only events in the caller's slot can match
+	EventQueuePrioritizedEvent_t *pCur = m_pEventsByCaller[pCaller->GetRefEHandle().GetEntryIndex()];
 
 	while (pCur != NULL)
 	{
@@ -970,12 +1297,11 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextByCaller;
 
 		if (bDelete)
 		{
-			RemoveEvent( pCurSave );
-			delete pCurSave;
+			DeleteEvent( pCurSave );
 		}
 	}
 }
@@ -988,10 +1314,11 @@ void CEventQueue::CancelEvents( CBaseEntity *pCaller )
 //-----------------------------------------------------------------------------
 void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 {
-	if (!pTarget)
+	if (!pTarget || !pTarget->GetRefEHandle().IsValid())
 		return;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	// only events in the target's slot can match
+	EventQueuePrioritizedEvent_t *pCur = m_pEventsByTarget[pTarget->GetRefEHandle().GetEntryIndex()];
 
 	while (pCur != NULL)
 	{
@@ -1006,12 +1333,11 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 		}
 
 		EventQueuePrioritizedEvent_t *pCurSave = pCur;
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextByTarget;
 
 		if (bDelete)
 		{
-			RemoveEvent( pCurSave );
-			delete pCurSave;
+			DeleteEvent( pCurSave );
 		}
 	}
 }
@@ -1023,10 +1349,11 @@ void CEventQueue::CancelEventOn( CBaseEntity *pTarget, const char *sInputName )
 //-----------------------------------------------------------------------------
 bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName )
 {
-	if (!pTarget)
+	if (!pTarget || !pTarget->GetRefEHandle().IsValid())
 		return false;
 
-	EventQueuePrioritizedEvent_t *pCur = m_Events.m_pNext;
+	// only events in the target's slot can match
+	EventQueuePrioritizedEvent_t *pCur = m_pEventsByTarget[pTarget->GetRefEHandle().GetEntryIndex()];
 
 	while (pCur != NULL)
 	{
@@ -1039,7 +1366,7 @@ bool CEventQueue::HasEventPending( CBaseEntity *pTarget, const char *sInputName
 				return true;
 		}
 
-		pCur = pCur->m_pNext;
+		pCur = pCur->m_pNextByTarget;
 	}
 
 	return false;
@@ -1057,7 +1384,7 @@ void ServiceEventQueue( void )
 // save data description for the event queue
 BEGIN_SIMPLE_DATADESC( CEventQueue )
 	// These are saved explicitly in CEventQueue::Save below
-	// DEFINE_FIELD( m_Events, EventQueuePrioritizedEvent_t ),
+	// DEFINE_FIELD( m_Heap, EventQueuePrioritizedEvent_t ),
 
 	DEFINE_FIELD( m_iListCount, FIELD_INTEGER ),	// this value is only used during save/restore
 END_DATADESC()
@@ -1074,29 +1401,28 @@ BEGIN_SIMPLE_DATADESC( EventQueuePrioritizedEvent_t )
 	DEFINE_FIELD( m_iOutputID, FIELD_INTEGER ),
 	DEFINE_CUSTOM_FIELD( m_VariantValue, variantFuncs ),
 
-//	DEFINE_FIELD( m_pNext, FIELD_??? ),
-//	DEFINE_FIELD( m_pPrev, FIELD_??? ),
+//	DEFINE_FIELD( m_nOrder, FIELD_INTEGER ),			// restored events are added back in fire order
+//	DEFINE_FIELD( m_iHeapIndex, FIELD_INTEGER ),
 END_DATADESC()
 
 
 int CEventQueue::Save( ISave &save )
 {
-	// count the number of items in the queue
-	EventQueuePrioritizedEvent_t *pe;
+	// save in firing order, so restoring them in turn keeps events due at the same time in order
+	CUtlVector<EventQueuePrioritizedEvent_t *> events;
+	GetSortedEvents( events );
 
-	m_iListCount = 0;
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
-	{
-		m_iListCount++;
-	}
+	// count the number of items in the queue
+	m_iListCount = events.Count();
 
 	// save that value out to disk, so we know how many to restore
 	if ( !save.WriteFields( "EventQueue", this, NULL, m_DataMap.dataDesc, m_DataMap.dataNumFields ) )
 		return 0;
 	
 	// cycle through all the events, saving them all
-	for ( pe = m_Events.m_pNext; pe != NULL; pe = pe->m_pNext )
+	for ( int i = 0; i < events.Count(); i++ )
 	{
+		EventQueuePrioritizedEvent_t *pe = events[i];
 		if ( !save.WriteFields( "PEvent", pe, NULL, pe->m_DataMap.dataDesc, pe->m_DataMap.dataNumFields ) )
 			return 0;
 	}
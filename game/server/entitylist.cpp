@@ -17,6 +17,10 @@
 #include "ai_initutils.h"
 #include "globalstate.h"
 #include "datacache/imdlcache.h"
+#include "utlflatmap.h"
+#include "tier0/fasttimer.h"
+#include "utlstring.h"
+#include "entityspatialindex.h"
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
@@ -118,6 +122,11 @@ void AimTarget_ForceRepopulateList()
 }
 
 
+// Position of each entity in the active list. Entities are always added to
+// the tail, so the list is in ascending order of these numbers.
+static unsigned int g_EntityListOrder[NUM_ENT_ENTRIES];
+static unsigned int g_nNextEntityListOrder = 0;
+
 // used to sort the think list by nextthink
 int __cdecl CompareEntityThinkTimes( const unsigned short *pIndex0, const unsigned short *pIndex1 )
 {
@@ -132,23 +141,53 @@ int __cdecl CompareEntityThinkTimes( const unsigned short *pIndex0, const unsign
 	return 0;
 }
 
+// Tick each scheduled thinker is filed under in the think schedule
+static int g_ScheduledThinkTick[NUM_ENT_ENTRIES];
+
+// The think pass each entity was last copied into, so none runs twice in one frame
+static unsigned int g_ThinkPassCopied[NUM_ENT_ENTRIES];
+
+// Scheduled thinkers run in order of their next think, and then of their
+// position in the entity list, so a frame's order doesn't depend on the heap
+inline bool ScheduledThinkLess( unsigned short index0, unsigned short index1 )
+{
+	if ( g_ScheduledThinkTick[index0] != g_ScheduledThinkTick[index1] )
+		return g_ScheduledThinkTick[index0] < g_ScheduledThinkTick[index1];
+	return g_EntityListOrder[index0] < g_EntityListOrder[index1];
+}
+
+int __cdecl CompareScheduledThinks( const unsigned short *pIndex0, const unsigned short *pIndex1 )
+{
+	if ( ScheduledThinkLess( *pIndex0, *pIndex1 ) )
+		return -1;
+	if ( ScheduledThinkLess( *pIndex1, *pIndex0 ) )
+		return 1;
+	return 0;
+}
+
 // Manages a list of all entities currently doing game simulation or thinking
 // NOTE: This is usually a small subset of the global entity list, so it's
 // an optimization to maintain this list incrementally rather than polling each
 // frame.
+// Entities that simulate game physics are in the sim list and run every frame.
+// Entities that only think are kept in a heap ordered by their earliest next
+// think, and only run on the frames a think is due.
 class CSimThinkManager : public IEntityListener
 {
 public:
 	CSimThinkManager()
 	{
+		m_thinkPass = 0;
 		Clear();
 	}
 	void Clear()
 	{
 		m_simThinkList.Purge();
+		m_thinkHeap.Purge();
 		for ( int i = 0; i < ARRAYSIZE(m_entinfoIndex); i++ )
 		{
 			m_entinfoIndex[i] = 0xFFFF;
+			m_thinkHeapIndex[i] = 0xFFFF;
 		}
 	}
 	void LevelInitPreEntity()
@@ -165,10 +204,12 @@ public:
 	void OnEntityCreated( CBaseEntity *pEntity )
 	{
 		Assert( m_entinfoIndex[pEntity->GetRefEHandle().GetEntryIndex()] == 0xFFFF );
+		Assert( m_thinkHeapIndex[pEntity->GetRefEHandle().GetEntryIndex()] == 0xFFFF );
 	}
 	void OnEntityDeleted( CBaseEntity *pEntity )
 	{
 		RemoveEntinfoIndex( pEntity->GetRefEHandle().GetEntryIndex() );
+		UnscheduleThinks( pEntity->GetRefEHandle().GetEntryIndex() );
 	}
 
 	void RemoveEntinfoIndex( int index )
@@ -193,12 +234,16 @@ public:
 		return m_simThinkList.Count();
 	}
 
+	// Starts a new think pass with the entities that simulate
 	int ListCopy( CBaseEntity *pList[], int listMax )
 	{
+		m_thinkPass++;
+
 		int count = min(listMax, ListCount());
 		for ( int i = 0; i < count; i++ )
 		{
 			int entinfoIndex = m_simThinkList[i];
+			g_ThinkPassCopied[entinfoIndex] = m_thinkPass;
 			const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( entinfoIndex );
 			pList[i] = (CBaseEntity *)pInfo->m_pEntity;
 			Assert( gEntList.IsEntityPtr( pList[i] ) );
@@ -207,6 +252,57 @@ public:
 		return count;
 	}
 
+	int ScheduledThinkCount()
+	{
+		return m_thinkHeap.Count();
+	}
+
+	// Copies the thinkers with a think due by the given tick that aren't in the
+	// current pass yet, in the order they should run
+	int ScheduledThinkCopy( CBaseEntity *pList[], int listMax, int tick )
+	{
+		if ( !m_thinkHeap.Count() )
+			return 0;
+
+		// The due thinkers are a subtree at the top of the heap
+		unsigned short *pDue = (unsigned short *)stackalloc( sizeof(unsigned short) * m_thinkHeap.Count() );
+		int *pStack = (int *)stackalloc( sizeof(int) * m_thinkHeap.Count() );
+		int nDue = 0;
+		int nStack = 0;
+		pStack[nStack++] = 0;
+		while ( nStack )
+		{
+			int i = pStack[--nStack];
+			unsigned short index = m_thinkHeap[i];
+			if ( g_ScheduledThinkTick[index] > tick )
+				continue;
+
+			if ( g_ThinkPassCopied[index] != m_thinkPass )
+			{
+				pDue[nDue++] = index;
+			}
+			for ( int child = 2 * i + 1; child <= 2 * i + 2 && child < m_thinkHeap.Count(); child++ )
+			{
+				pStack[nStack++] = child;
+			}
+		}
+
+		qsort( pDue, nDue, sizeof(unsigned short), (int (__cdecl *)(const void *, const void *))CompareScheduledThinks );
+
+		int count = min( listMax, nDue );
+		for ( int i = 0; i < count; i++ )
+		{
+			g_ThinkPassCopied[pDue[i]] = m_thinkPass;
+			const CEntInfo *pInfo = gEntList.GetEntInfoPtrByIndex( pDue[i] );
+			pList[i] = (CBaseEntity *)pInfo->m_pEntity;
+			Assert( gEntList.IsEntityPtr( pList[i] ) );
+		}
+
+		stackfree( pStack );
+		stackfree( pDue );
+		return count;
+	}
+
 	void EntityChanged( CBaseEntity *pEntity )
 	{
 		// might change after deletion, don't put back into the list
@@ -218,16 +314,30 @@ public:
 			return;
 
 		int index = eh.GetEntryIndex();
-		// UNDONE: Maintain separate lists for "no think/no sim" and just "no sim"
-		// UNDONE: Keep "no sim" list sorted by thinktime
-		// UNDONE: Add query for "no sim" list that includes a time and just get ents that will think by that time
 		if ( pEntity->IsEFlagSet( EFL_NO_THINK_FUNCTION ) && pEntity->IsEFlagSet( EFL_NO_GAME_PHYSICS_SIMULATION ) )
 		{
 			Assert( !pEntity->IsPlayer() );
 			RemoveEntinfoIndex( index );
+			UnscheduleThinks( index );
+		}
+		else if ( pEntity->CanScheduleThinks() )
+		{
+			RemoveEntinfoIndex( index );
+
+			int tick = pEntity->GetEarliestNextThinkTick();
+			if ( tick > 0 )
+			{
+				ScheduleThinks( index, tick );
+			}
+			else
+			{
+				UnscheduleThinks( index );
+			}
 		}
 		else
 		{
+			UnscheduleThinks( index );
+
 			// already in the list? (had think or sim last time, now has both - or had both last time, now just one)
 			if ( m_entinfoIndex[index] == 0xFFFF )
 			{
@@ -254,8 +364,104 @@ public:
 		}
 	}
 private:
+	void ScheduleThinks( int index, int tick )
+	{
+		int heapIndex = m_thinkHeapIndex[index];
+		if ( heapIndex == 0xFFFF )
+		{
+			MEM_ALLOC_CREDIT();
+			g_ScheduledThinkTick[index] = tick;
+			heapIndex = m_thinkHeap.AddToTail( (unsigned short)index );
+			m_thinkHeapIndex[index] = heapIndex;
+			HeapMoveUp( heapIndex );
+		}
+		else if ( tick < g_ScheduledThinkTick[index] )
+		{
+			g_ScheduledThinkTick[index] = tick;
+			HeapMoveUp( heapIndex );
+		}
+		else if ( tick > g_ScheduledThinkTick[index] )
+		{
+			g_ScheduledThinkTick[index] = tick;
+			HeapMoveDown( heapIndex );
+		}
+	}
+
+	void UnscheduleThinks( int index )
+	{
+		int heapIndex = m_thinkHeapIndex[index];
+		if ( heapIndex == 0xFFFF )
+			return;
+
+		Assert( m_thinkHeap[heapIndex] == index );
+		m_thinkHeapIndex[index] = 0xFFFF;
+
+		int last = m_thinkHeap.Count() - 1;
+		if ( heapIndex != last )
+		{
+			unsigned short moved = m_thinkHeap[last];
+			m_thinkHeap[heapIndex] = moved;
+			m_thinkHeapIndex[moved] = heapIndex;
+			m_thinkHeap.Remove( last );
+
+			HeapMoveUp( heapIndex );
+			HeapMoveDown( m_thinkHeapIndex[moved] );
+		}
+		else
+		{
+			m_thinkHeap.Remove( last );
+		}
+	}
+
+	void HeapMoveUp( int heapIndex )
+	{
+		unsigned short index = m_thinkHeap[heapIndex];
+		while ( heapIndex > 0 )
+		{
+			int parent = ( heapIndex - 1 ) / 2;
+			if ( !ScheduledThinkLess( index, m_thinkHeap[parent] ) )
+				break;
+
+			m_thinkHeap[heapIndex] = m_thinkHeap[parent];
+			m_thinkHeapIndex[m_thinkHeap[heapIndex]] = heapIndex;
+			heapIndex = parent;
+		}
+		m_thinkHeap[heapIndex] = index;
+		m_thinkHeapIndex[index] = heapIndex;
+	}
+
+	void HeapMoveDown( int heapIndex )
+	{
+		unsigned short index = m_thinkHeap[heapIndex];
+		int count = m_thinkHeap.Count();
+		for ( ;; )
+		{
+			int child = 2 * heapIndex + 1;
+			if ( child >= count )
+				break;
+
+			if ( child + 1 < count && ScheduledThinkLess( m_thinkHeap[child + 1], m_thinkHeap[child] ) )
+			{
+				child++;
+			}
+
+			if ( !ScheduledThinkLess( m_thinkHeap[child], index ) )
+				break;
+
+			m_thinkHeap[heapIndex] = m_thinkHeap[child];
+			m_thinkHeapIndex[m_thinkHeap[heapIndex]] = heapIndex;
+			heapIndex = child;
+		}
+		m_thinkHeap[heapIndex] = index;
+		m_thinkHeapIndex[index] = heapIndex;
+	}
+
 	unsigned short m_entinfoIndex[NUM_ENT_ENTRIES];
 	CUtlVector<unsigned short>	m_simThinkList;
+
+	unsigned short m_thinkHeapIndex[NUM_ENT_ENTRIES];
+	CUtlVector<unsigned short>	m_thinkHeap;			// thinkers that don't simulate, by next think
+	unsigned int				m_thinkPass;
 };
 
 CSimThinkManager g_SimThinkManager;
@@ -270,6 +476,16 @@ int SimThink_ListCopy( CBaseEntity *pList[], int listMax )
 	return g_SimThinkManager.ListCopy( pList, listMax );
 }
 
+int SimThink_ScheduledThinkCount()
+{
+	return g_SimThinkManager.ScheduledThinkCount();
+}
+
+int SimThink_ScheduledThinkCopy( CBaseEntity *pList[], int listMax, int tick )
+{
+	return g_SimThinkManager.ScheduledThinkCopy( pList, listMax, tick );
+}
+
 void SimThink_EntityChanged( CBaseEntity *pEntity )
 {
 	g_SimThinkManager.EntityChanged( pEntity );
@@ -313,6 +529,174 @@ private:
 
 static CPostClientMessageManager g_PostClientManager;
 
+// Indexes the entities in the list by one of their names (classname or
+// targetname). Names are keyed by their pooled string, which is the same for
+// every capitalization of a name, and the entities filed under a name are kept
+// in list order so a search can continue from any entity the way a walk of the
+// list does.
+class CEntityNameIndex
+{
+public:
+	CEntityNameIndex()
+	{
+		memset( m_pszFiledName, 0, sizeof(m_pszFiledName) );
+	}
+
+	void Clear()
+	{
+		m_BucketByName.Purge();
+		m_Buckets.Purge();
+		m_SortedBuckets.Purge();
+		memset( m_pszFiledName, 0, sizeof(m_pszFiledName) );
+	}
+
+	// Files the entity in a slot under a new name, NULL_STRING to take it out of the index
+	void Update( int iSlot, string_t name )
+	{
+		const char *pszName = ( name != NULL_STRING ) ? STRING( AllocPooledString( STRING(name) ) ) : NULL;
+		if ( pszName == m_pszFiledName[iSlot] )
+			return;
+
+		if ( m_pszFiledName[iSlot] )
+		{
+			Bucket_t &bucket = m_Buckets[ m_BucketByName[ m_BucketByName.Find( m_pszFiledName[iSlot] ) ] ];
+			int i = FirstAfter( bucket, g_EntityListOrder[iSlot] - 1 );
+			Assert( bucket.m_Slots[i] == iSlot );
+			bucket.m_Slots.Remove( i );
+		}
+
+		if ( pszName )
+		{
+			Bucket_t &bucket = m_Buckets[ FindOrAddBucket( pszName ) ];
+			bucket.m_Slots.InsertBefore( FirstAfter( bucket, g_EntityListOrder[iSlot] ), (unsigned short)iSlot );
+		}
+
+		m_pszFiledName[iSlot] = pszName;
+	}
+
+	// Queries that can match unnamed entities, or every name, have to walk the whole list
+	static bool CanSearch( const char *pszName )
+	{
+		return pszName[0] != 0 && pszName[0] != '*';
+	}
+
+	// Returns the slot of the first entity after the given list position that
+	// is filed under a name pszName can match, -1 if there isn't one. Only a
+	// trailing '*' is a wildcard, as in NamesMatch().
+	int FindNext( const char *pszName, unsigned int nAfterOrder ) const
+	{
+		Assert( CanSearch( pszName ) );
+
+		const char *pszWildcard = strchr( pszName, '*' );
+		if ( !pszWildcard )
+		{
+			string_t pooledName = FindPooledString( pszName );
+			if ( pooledName == NULL_STRING )
+				return -1;
+
+			int iBucket = m_BucketByName.Find( STRING(pooledName) );
+			if ( iBucket == m_BucketByName.InvalidIndex() )
+				return -1;
+
+			const Bucket_t &bucket = m_Buckets[ m_BucketByName[iBucket] ];
+			int i = FirstAfter( bucket, nAfterOrder );
+			return ( i < bucket.m_Slots.Count() ) ? bucket.m_Slots[i] : -1;
+		}
+
+		// Every name with the prefix is a candidate, take the earliest entity among them
+		int nPrefix = pszWildcard - pszName;
+		int iBest = -1;
+		for ( int i = FirstWithPrefix( pszName, nPrefix ); i < m_SortedBuckets.Count(); i++ )
+		{
+			const Bucket_t &bucket = m_Buckets[ m_SortedBuckets[i] ];
+			if ( Q_strncasecmp( bucket.m_pszName, pszName, nPrefix ) != 0 )
+				break;
+
+			int j = FirstAfter( bucket, nAfterOrder );
+			if ( j < bucket.m_Slots.Count() )
+			{
+				int iSlot = bucket.m_Slots[j];
+				if ( iBest == -1 || g_EntityListOrder[iSlot] < g_EntityListOrder[iBest] )
+				{
+					iBest = iSlot;
+				}
+			}
+		}
+		return iBest;
+	}
+
+private:
+	struct Bucket_t
+	{
+		const char *m_pszName;
+		CUtlVector<unsigned short> m_Slots;		// in list order
+	};
+
+	int FindOrAddBucket( const char *pszName )
+	{
+		int iBucket = m_BucketByName.Find( pszName );
+		if ( iBucket != m_BucketByName.InvalidIndex() )
+			return m_BucketByName[iBucket];
+
+		// Buckets stay around when they empty out, names are reused a lot
+		MEM_ALLOC_CREDIT();
+		int iNew = m_Buckets.AddToTail();
+		m_Buckets[iNew].m_pszName = pszName;
+		m_BucketByName.Insert( pszName, iNew );
+
+		int lo = 0, hi = m_SortedBuckets.Count();
+		while ( lo < hi )
+		{
+			int mid = ( lo + hi ) / 2;
+			if ( Q_strcasecmp( m_Buckets[ m_SortedBuckets[mid] ].m_pszName, pszName ) < 0 )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		m_SortedBuckets.InsertBefore( lo, iNew );
+		return iNew;
+	}
+
+	// Index of the first sorted bucket whose name starts with the prefix, or
+	// sorts after it. Sorting and matching fold case the same way.
+	int FirstWithPrefix( const char *pszPrefix, int nPrefix ) const
+	{
+		int lo = 0, hi = m_SortedBuckets.Count();
+		while ( lo < hi )
+		{
+			int mid = ( lo + hi ) / 2;
+			if ( Q_strncasecmp( m_Buckets[ m_SortedBuckets[mid] ].m_pszName, pszPrefix, nPrefix ) < 0 )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	// Index of the first entity in the bucket that comes after the given list position
+	static int FirstAfter( const Bucket_t &bucket, unsigned int nAfterOrder )
+	{
+		int lo = 0, hi = bucket.m_Slots.Count();
+		while ( lo < hi )
+		{
+			int mid = ( lo + hi ) / 2;
+			if ( g_EntityListOrder[ bucket.m_Slots[mid] ] <= nAfterOrder )
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo;
+	}
+
+	CUtlFlatMap<const void *, int>	m_BucketByName;		// pooled name -> bucket
+	CUtlVector<Bucket_t>			m_Buckets;
+	CUtlVector<int>					m_SortedBuckets;	// by name ignoring case, for prefix searches
+	const char						*m_pszFiledName[NUM_ENT_ENTRIES];	// pooled name each slot is filed under
+};
+
+static CEntityNameIndex g_ClassnameIndex;
+static CEntityNameIndex g_TargetnameIndex;
+
 static CBaseEntityClassList *s_pClassLists = NULL;
 CBaseEntityClassList::CBaseEntityClassList()
 {
@@ -413,6 +797,10 @@ void CGlobalEntityList::Clear( void )
 	// free the memory
 	g_DeleteList.Purge();
 
+	// Every entity is gone, drop the names before the string pool frees them
+	g_ClassnameIndex.Clear();
+	g_TargetnameIndex.Clear();
+
 	CBaseEntity::m_nDebugPlayer = -1;
 	CBaseEntity::m_bInDebugSelect = false; 
 	m_iHighestEnt = 0;
@@ -491,6 +879,26 @@ void CGlobalEntityList::ReportEntityFlagsChanged( CBaseEntity *pEntity, unsigned
 	}
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Refiles an entity in the name indexes after its classname or
+//			targetname changed. Anything that sets m_iName or m_iClassname
+//			must call this, or name searches will miss the entity.
+//-----------------------------------------------------------------------------
+void CGlobalEntityList::ReportEntityNameChanged( CBaseEntity *pEntity )
+{
+	const CBaseHandle &eh = pEntity->GetRefEHandle();
+	if ( !eh.IsValid() )
+		return;
+
+	// Not in the list yet, OnAddEntity() will file it
+	int iSlot = eh.GetEntryIndex();
+	if ( GetEntInfoPtrByIndex( iSlot )->m_pEntity != pEntity )
+		return;
+
+	g_ClassnameIndex.Update( iSlot, pEntity->m_iClassname );
+	g_TargetnameIndex.Update( iSlot, pEntity->m_iName );
+}
+
 void CGlobalEntityList::AddPostClientMessageEntity( CBaseEntity *pEntity )
 {
 	g_PostClientManager.AddEntity( pEntity );
@@ -526,6 +934,21 @@ bool CGlobalEntityList::IsEntityPtr( void *pTest )
 //-----------------------------------------------------------------------------
 CBaseEntity *CGlobalEntityList::FindEntityByClassname( CBaseEntity *pStartEntity, const char *szName )
 {
+	if ( g_ClassnameIndex.CanSearch( szName ) )
+	{
+		unsigned int nAfterOrder = pStartEntity ? g_EntityListOrder[ pStartEntity->GetRefEHandle().GetEntryIndex() ] : 0;
+		int iSlot;
+		while ( ( iSlot = g_ClassnameIndex.FindNext( szName, nAfterOrder ) ) != -1 )
+		{
+			CBaseEntity *pEntity = (CBaseEntity *)GetEntInfoPtrByIndex( iSlot )->m_pEntity;
+			if ( pEntity->ClassMatches(szName) )
+				return pEntity;
+
+			nAfterOrder = g_EntityListOrder[iSlot];
+		}
+		return NULL;
+	}
+
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
 	for ( ;pInfo; pInfo = pInfo->m_pNext )
@@ -545,6 +968,128 @@ CBaseEntity *CGlobalEntityList::FindEntityByClassname( CBaseEntity *pStartEntity
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Walks the whole list the way the searches did before the name
+//			indexes, for bench_entitysearch to compare against.
+//-----------------------------------------------------------------------------
+static CBaseEntity *BenchFindByWalk( CBaseEntity *pStartEntity, const char *szName, bool bClassname )
+{
+	for ( CBaseEntity *pEntity = gEntList.NextEnt( pStartEntity ); pEntity != NULL; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		if ( bClassname ? pEntity->ClassMatches( szName ) : ( pEntity->GetEntityName() != NULL_STRING && pEntity->NameMatches( szName ) ) )
+			return pEntity;
+	}
+	return NULL;
+}
+
+static int BenchFindAll( const CUtlVector<const char *> &queries, bool bClassname, bool bWalk, int *pnMismatches )
+{
+	int nFound = 0;
+	for ( int i = 0; i < queries.Count(); i++ )
+	{
+		CBaseEntity *pEntity = NULL;
+		CBaseEntity *pCheck = NULL;
+		for ( ;; )
+		{
+			if ( bWalk )
+			{
+				pEntity = BenchFindByWalk( pEntity, queries[i], bClassname );
+			}
+			else
+			{
+				pEntity = bClassname ? gEntList.FindEntityByClassname( pEntity, queries[i] ) : gEntList.FindEntityByName( pEntity, queries[i] );
+				if ( pnMismatches )
+				{
+					pCheck = BenchFindByWalk( pCheck, queries[i], bClassname );
+					if ( pCheck != pEntity )
+					{
+						Warning( "bench_entitysearch: %s search for \"%s\" differs from a walk of the list\n", bClassname ? "classname" : "targetname", queries[i] );
+						(*pnMismatches)++;
+						break;
+					}
+				}
+			}
+
+			if ( !pEntity )
+				break;
+			nFound++;
+		}
+	}
+	return nFound;
+}
+
+CON_COMMAND_F( bench_entitysearch, "Times FindEntityByClassname and FindEntityByName for every name in the map, against a walk of the entity list, and checks they agree. Usage: bench_entitysearch [passes]", FCVAR_CHEAT )
+{
+	int nPasses = ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 10;
+	nPasses = clamp( nPasses, 1, 1000 );
+
+	// Every distinct name, plus a wildcard for the first few characters of each classname
+	CUtlVector<const char *> queries[2];
+	CUtlVector<CUtlString> wildcards;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity != NULL; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		const char *pszClassname = pEntity->GetClassname();
+		if ( pszClassname[0] && gEntList.FindEntityByClassname( NULL, pszClassname ) == pEntity )
+		{
+			queries[0].AddToTail( pszClassname );
+			if ( Q_strlen( pszClassname ) > 5 )
+			{
+				char szWildcard[8];
+				Q_strncpy( szWildcard, pszClassname, 6 );
+				Q_strncat( szWildcard, "*", sizeof(szWildcard), COPY_ALL_CHARACTERS );
+				wildcards.AddToTail( CUtlString( szWildcard ) );
+			}
+		}
+
+		const char *pszName = STRING( pEntity->GetEntityName() );
+		if ( pszName[0] && pszName[0] != '!' && gEntList.FindEntityByName( NULL, pszName ) == pEntity )
+		{
+			queries[1].AddToTail( pszName );
+		}
+	}
+
+	if ( !queries[0].Count() )
+	{
+		Msg( "bench_entitysearch: no entities, load a map first.\n" );
+		return;
+	}
+
+	for ( int i = 0; i < wildcards.Count(); i++ )
+	{
+		queries[0].AddToTail( wildcards[i].Get() );
+	}
+
+	Msg( "bench_entitysearch: %d entities, %d passes\n", gEntList.NumberOfEntities(), nPasses );
+
+	CFastTimer timer;
+	for ( int iType = 0; iType < 2; iType++ )
+	{
+		bool bClassname = ( iType == 0 );
+		int nMismatches = 0;
+		int nFound = BenchFindAll( queries[iType], bClassname, false, &nMismatches );
+
+		timer.Start();
+		for ( int iPass = 0; iPass < nPasses; iPass++ )
+		{
+			BenchFindAll( queries[iType], bClassname, false, NULL );
+		}
+		timer.End();
+		float flIndexMs = timer.GetDuration().GetMillisecondsF();
+
+		timer.Start();
+		for ( int iPass = 0; iPass < nPasses; iPass++ )
+		{
+			BenchFindAll( queries[iType], bClassname, true, NULL );
+		}
+		timer.End();
+		float flWalkMs = timer.GetDuration().GetMillisecondsF();
+
+		Msg( "  %-10s %4d queries, %5d found: indexed %9.3f ms, walk %9.3f ms, %d mismatches\n",
+			bClassname ? "classname" : "targetname", queries[iType].Count(), nFound, flIndexMs, flWalkMs, nMismatches );
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: Finds an entity given a procedural name.
 // Input  : szName - The procedural name to search for, should start with '!'.
@@ -635,6 +1180,26 @@ CBaseEntity *CGlobalEntityList::FindEntityByName( CBaseEntity *pStartEntity, con
 
 		return NULL;
 	}
+
+	if ( g_TargetnameIndex.CanSearch( szName ) )
+	{
+		unsigned int nAfterOrder = pStartEntity ? g_EntityListOrder[ pStartEntity->GetRefEHandle().GetEntryIndex() ] : 0;
+		int iSlot;
+		while ( ( iSlot = g_TargetnameIndex.FindNext( szName, nAfterOrder ) ) != -1 )
+		{
+			nAfterOrder = g_EntityListOrder[iSlot];
+
+			CBaseEntity *ent = (CBaseEntity *)GetEntInfoPtrByIndex( iSlot )->m_pEntity;
+			if ( ent->NameMatches( szName ) )
+			{
+				if ( pFilter && !pFilter->ShouldFindEntity(ent) )
+					continue;
+
+				return ent;
+			}
+		}
+		return NULL;
+	}
 	
 	const CEntInfo *pInfo = pStartEntity ? GetEntInfoPtr( pStartEntity->GetRefEHandle() )->m_pNext : FirstEntInfo();
 
@@ -1107,6 +1672,13 @@ void CGlobalEntityList::OnAddEntity( IHandleEntity *pEnt, CBaseHandle handle )
 	
 	// NOTE: Must be a CBaseEntity on server
 	Assert( pBaseEnt );
+
+	// The new entity is at the tail of the list
+	int iSlot = handle.GetEntryIndex();
+	g_EntityListOrder[iSlot] = ++g_nNextEntityListOrder;
+	g_ClassnameIndex.Update( iSlot, pBaseEnt->m_iClassname );
+	g_TargetnameIndex.Update( iSlot, pBaseEnt->m_iName );
+
 	//DevMsg(2,"Created %s\n", pBaseEnt->GetClassname() );
 	for ( i = m_entityListeners.Count()-1; i >= 0; i-- )
 	{
@@ -1137,6 +1709,11 @@ void CGlobalEntityList::OnRemoveEntity( IHandleEntity *pEnt, CBaseHandle handle
 	if ( pBaseEnt->edict() )
 		m_iNumEdicts--;
 
+	int iSlot = handle.GetEntryIndex();
+	g_ClassnameIndex.Update( iSlot, NULL_STRING );
+	g_TargetnameIndex.Update( iSlot, NULL_STRING );
+	g_EntitySpatialIndex.RemoveEntityAtSlot( iSlot );
+
 	m_iNumEnts--;
 }
 
@@ -106,6 +106,7 @@ public:
 	void RemoveListenerEntity( IEntityListener *pListener );
 
 	void ReportEntityFlagsChanged( CBaseEntity *pEntity, unsigned int flagsOld, unsigned int flagsNow );
+	void ReportEntityNameChanged( CBaseEntity *pEntity );
 	// Schedule this entity for notification once client messages have been sent
 	void AddPostClientMessageEntity( CBaseEntity *pEntity );
 	void PostClientMessagesSent();
@@ -360,7 +361,9 @@ void AimTarget_ForceRepopulateList();
 
 void SimThink_EntityChanged( CBaseEntity *pEntity );
 int SimThink_ListCount();
-int SimThink_ListCopy( CBaseEntity *pList[], int listMax );
+int SimThink_ListCopy( CBaseEntity *pList[], int listMax );		// starts a new think pass
+int SimThink_ScheduledThinkCount();
+int SimThink_ScheduledThinkCopy( CBaseEntity *pList[], int listMax, int tick );	// only thinkers not yet in the pass
 void SimThink_SortThinkList();
 
 #endif // ENTITYLIST_H
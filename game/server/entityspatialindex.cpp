@@ -0,0 +1,650 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Game-side copy of the spatial partition's non-static edict list.
+//			See entityspatialindex.h.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "cbase.h"
+#include "entityspatialindex.h"
+#include "collisionutils.h"
+#include "serverjobs.h"
+#include "vstdlib/random.h"
+#include "tier0/fasttimer.h"
+#include "tier0/threadtools.h"
+#include <xmmintrin.h>
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+// Entities are at most a cell wide, so anything that touches an entity
+// touches the cell its center is in, or one within half a cell of it
+#define ENTITY_INDEX_CELL_REACH		( ENTITY_INDEX_CELL_SIZE / 2 )
+
+// Hits kept on the stack before Enumerate() moves to the heap
+#define ENTITY_INDEX_STACK_HITS		256
+
+CEntitySpatialIndex g_EntitySpatialIndex;
+
+
+//-----------------------------------------------------------------------------
+// Queries
+//-----------------------------------------------------------------------------
+void EntitySpatialQuery_t::InitBox( const Vector &mins, const Vector &maxs )
+{
+	m_nType = ENTITY_QUERY_BOX;
+	m_vecMins = mins;
+	m_vecMaxs = maxs;
+}
+
+void EntitySpatialQuery_t::InitSphere( const Vector &center, float radius )
+{
+	m_nType = ENTITY_QUERY_SPHERE;
+	m_vecCenter = center;
+	m_flRadius = radius;
+	m_vecMins = center - Vector( radius, radius, radius );
+	m_vecMaxs = center + Vector( radius, radius, radius );
+}
+
+void EntitySpatialQuery_t::InitRay( const Ray_t &ray )
+{
+	m_nType = ENTITY_QUERY_RAY;
+	m_vecCenter = ray.m_Start;
+	m_vecDelta = ray.m_Delta;
+	m_vecExtents = ray.m_Extents;
+
+	Vector vecEnd = m_vecCenter + m_vecDelta;
+	VectorMin( m_vecCenter, vecEnd, m_vecMins );
+	VectorMax( m_vecCenter, vecEnd, m_vecMaxs );
+	m_vecMins -= m_vecExtents;
+	m_vecMaxs += m_vecExtents;
+}
+
+void EntitySpatialQuery_t::SetList( CBaseEntity **pList, int listMax, int flagMask )
+{
+	m_pList = pList;
+	m_nListMax = listMax;
+	m_nFlagMask = flagMask;
+	m_nCount = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Constructor
+//-----------------------------------------------------------------------------
+CEntitySpatialIndex::CEntitySpatialIndex()
+{
+	for ( int i = 0; i < MAX_EDICTS; i++ )
+	{
+		m_Entries[i].m_pEntity = NULL;
+		m_Entries[i].m_iCell = -1;
+		m_Entries[i].m_iLane = -1;
+	}
+	m_nEntities = 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// Returns the entity's entry. If the slot held another entity, the entry is
+// claimed for this one, or NULL is returned if bClaim is false.
+//-----------------------------------------------------------------------------
+CEntitySpatialIndex::Entry_t *CEntitySpatialIndex::GetEntry( CBaseEntity *pEntity, bool bClaim )
+{
+	const CBaseHandle &handle = pEntity->GetRefEHandle();
+	if ( !handle.IsValid() )
+		return NULL;
+
+	int iSlot = handle.GetEntryIndex();
+	if ( iSlot >= MAX_EDICTS )
+	{
+		// Only entities with edicts are in the partition
+		Assert( 0 );
+		return NULL;
+	}
+
+	Entry_t *pEntry = &m_Entries[iSlot];
+	if ( pEntry->m_pEntity != pEntity )
+	{
+		if ( !bClaim )
+			return NULL;
+
+		if ( pEntry->m_iCell >= 0 )
+		{
+			UnfileEntry( iSlot );
+		}
+		pEntry->m_pEntity = pEntity;
+		pEntry->m_vecMins = pEntry->m_vecMaxs = pEntity->CollisionProp()->GetCollisionOrigin();
+	}
+	return pEntry;
+}
+
+
+//-----------------------------------------------------------------------------
+// Cells
+//-----------------------------------------------------------------------------
+static inline int CellCoord( float flCoord )
+{
+	int iCoord = (int)( ( flCoord + MAX_COORD_INTEGER ) * ( 1.0f / ENTITY_INDEX_CELL_SIZE ) );
+	return clamp( iCoord, 0, ENTITY_INDEX_GRID_SIZE - 1 );
+}
+
+int CEntitySpatialIndex::CellForBounds( const Vector &mins, const Vector &maxs )
+{
+	if ( maxs.x - mins.x > ENTITY_INDEX_CELL_SIZE || maxs.y - mins.y > ENTITY_INDEX_CELL_SIZE )
+		return ENTITY_INDEX_LARGE_CELL;
+
+	int x = CellCoord( ( mins.x + maxs.x ) * 0.5f );
+	int y = CellCoord( ( mins.y + maxs.y ) * 0.5f );
+	return y * ENTITY_INDEX_GRID_SIZE + x;
+}
+
+void CEntitySpatialIndex::WriteLane( int iCell, int iLane, int iSlot )
+{
+	BoxGroup_t &group = m_Cells[iCell].m_Groups[iLane >> 2];
+	int i = iLane & 3;
+	if ( iSlot < 0 )
+	{
+		// Empty lanes never touch anything
+		for ( int iAxis = 0; iAxis < 3; iAxis++ )
+		{
+			group.m_flMins[iAxis][i] = FLT_MAX;
+			group.m_flMaxs[iAxis][i] = -FLT_MAX;
+		}
+		group.m_Slots[i] = 0;
+		return;
+	}
+
+	const Entry_t &entry = m_Entries[iSlot];
+	for ( int iAxis = 0; iAxis < 3; iAxis++ )
+	{
+		group.m_flMins[iAxis][i] = entry.m_vecMins[iAxis];
+		group.m_flMaxs[iAxis][i] = entry.m_vecMaxs[iAxis];
+	}
+	group.m_Slots[i] = iSlot;
+}
+
+void CEntitySpatialIndex::FileEntry( int iSlot )
+{
+	Entry_t &entry = m_Entries[iSlot];
+	Assert( entry.m_iCell < 0 );
+
+	int iCell = CellForBounds( entry.m_vecMins, entry.m_vecMaxs );
+	Cell_t &cell = m_Cells[iCell];
+	int iLane = cell.m_nCount++;
+	if ( ( iLane >> 2 ) == cell.m_Groups.Count() )
+	{
+		cell.m_Groups.AddToTail();
+		for ( int i = 0; i < 4; i++ )
+		{
+			WriteLane( iCell, iLane + i, -1 );
+		}
+	}
+
+	entry.m_iCell = iCell;
+	entry.m_iLane = iLane;
+	WriteLane( iCell, iLane, iSlot );
+	m_nEntities++;
+}
+
+void CEntitySpatialIndex::UnfileEntry( int iSlot )
+{
+	Entry_t &entry = m_Entries[iSlot];
+	Assert( entry.m_iCell >= 0 );
+
+	// The cell's last entity takes this one's lane
+	Cell_t &cell = m_Cells[entry.m_iCell];
+	int iLastLane = --cell.m_nCount;
+	if ( entry.m_iLane != iLastLane )
+	{
+		int iLastSlot = cell.m_Groups[iLastLane >> 2].m_Slots[iLastLane & 3];
+		m_Entries[iLastSlot].m_iLane = entry.m_iLane;
+		WriteLane( entry.m_iCell, entry.m_iLane, iLastSlot );
+	}
+	WriteLane( entry.m_iCell, iLastLane, -1 );
+
+	entry.m_iCell = -1;
+	entry.m_iLane = -1;
+	m_nEntities--;
+}
+
+
+//-----------------------------------------------------------------------------
+// Updates from CCollisionProperty
+//-----------------------------------------------------------------------------
+void CEntitySpatialIndex::InsertEntity( CBaseEntity *pEntity )
+{
+	Assert( ThreadInMainThread() );
+	Entry_t *pEntry = GetEntry( pEntity, true );
+	if ( pEntry && pEntry->m_iCell < 0 )
+	{
+		FileEntry( pEntry - m_Entries );
+	}
+}
+
+void CEntitySpatialIndex::RemoveEntity( CBaseEntity *pEntity )
+{
+	Assert( ThreadInMainThread() );
+	Entry_t *pEntry = GetEntry( pEntity, false );
+	if ( pEntry && pEntry->m_iCell >= 0 )
+	{
+		UnfileEntry( pEntry - m_Entries );
+	}
+}
+
+void CEntitySpatialIndex::MoveEntity( CBaseEntity *pEntity, const Vector &mins, const Vector &maxs )
+{
+	Assert( ThreadInMainThread() );
+	Entry_t *pEntry = GetEntry( pEntity, true );
+	if ( !pEntry )
+		return;
+
+	int iSlot = pEntry - m_Entries;
+	pEntry->m_vecMins = mins;
+	pEntry->m_vecMaxs = maxs;
+	if ( pEntry->m_iCell < 0 )
+		return;
+
+	if ( CellForBounds( mins, maxs ) == pEntry->m_iCell )
+	{
+		WriteLane( pEntry->m_iCell, pEntry->m_iLane, iSlot );
+	}
+	else
+	{
+		UnfileEntry( iSlot );
+		FileEntry( iSlot );
+	}
+}
+
+void CEntitySpatialIndex::RemoveEntityAtSlot( int iSlot )
+{
+	if ( iSlot >= MAX_EDICTS )
+		return;
+
+	if ( m_Entries[iSlot].m_iCell >= 0 )
+	{
+		UnfileEntry( iSlot );
+	}
+	m_Entries[iSlot].m_pEntity = NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Calls func( pEntity ) for each entity the query touches, until it returns false
+//-----------------------------------------------------------------------------
+template< class FUNCTOR >
+void CEntitySpatialIndex::ForEachHit( const EntitySpatialQuery_t &query, FUNCTOR &func ) const
+{
+	__m128 queryMins[3], queryMaxs[3], center[3], radiusSqr;
+	for ( int iAxis = 0; iAxis < 3; iAxis++ )
+	{
+		queryMins[iAxis] = _mm_set1_ps( query.m_vecMins[iAxis] );
+		queryMaxs[iAxis] = _mm_set1_ps( query.m_vecMaxs[iAxis] );
+		center[iAxis] = _mm_set1_ps( query.m_vecCenter[iAxis] );
+	}
+	radiusSqr = _mm_set1_ps( query.m_flRadius * query.m_flRadius );
+
+	int x0 = CellCoord( query.m_vecMins.x - ENTITY_INDEX_CELL_REACH );
+	int x1 = CellCoord( query.m_vecMaxs.x + ENTITY_INDEX_CELL_REACH );
+	int y0 = CellCoord( query.m_vecMins.y - ENTITY_INDEX_CELL_REACH );
+	int y1 = CellCoord( query.m_vecMaxs.y + ENTITY_INDEX_CELL_REACH );
+
+	// Walk the cells in range, then the large entities
+	int x = x0, y = y0;
+	while ( true )
+	{
+		int iCell;
+		if ( y <= y1 )
+		{
+			iCell = y * ENTITY_INDEX_GRID_SIZE + x;
+			if ( ++x > x1 )
+			{
+				x = x0;
+				y++;
+			}
+		}
+		else if ( y == y1 + 1 )
+		{
+			iCell = ENTITY_INDEX_LARGE_CELL;
+			y++;
+		}
+		else
+		{
+			break;
+		}
+
+		const Cell_t &cell = m_Cells[iCell];
+		int nGroups = ( cell.m_nCount + 3 ) >> 2;
+		const BoxGroup_t *pGroup = cell.m_Groups.Base();
+		for ( int iGroup = 0; iGroup < nGroups; iGroup++, pGroup++ )
+		{
+			__m128 mins[3], maxs[3];
+			for ( int iAxis = 0; iAxis < 3; iAxis++ )
+			{
+				mins[iAxis] = _mm_loadu_ps( pGroup->m_flMins[iAxis] );
+				maxs[iAxis] = _mm_loadu_ps( pGroup->m_flMaxs[iAxis] );
+			}
+
+			__m128 hit = _mm_and_ps( _mm_cmple_ps( mins[0], queryMaxs[0] ), _mm_cmpge_ps( maxs[0], queryMins[0] ) );
+			hit = _mm_and_ps( hit, _mm_and_ps( _mm_cmple_ps( mins[1], queryMaxs[1] ), _mm_cmpge_ps( maxs[1], queryMins[1] ) ) );
+			hit = _mm_and_ps( hit, _mm_and_ps( _mm_cmple_ps( mins[2], queryMaxs[2] ), _mm_cmpge_ps( maxs[2], queryMins[2] ) ) );
+
+			// Lanes past the end of the cell are empty
+			int nHitMask = _mm_movemask_ps( hit ) & ( 0xF >> max( 4 - ( cell.m_nCount - iGroup * 4 ), 0 ) );
+			if ( !nHitMask )
+				continue;
+
+			if ( query.m_nType == ENTITY_QUERY_SPHERE )
+			{
+				// Same as IsBoxIntersectingSphere(), four at a time
+				__m128 distSqr = _mm_setzero_ps();
+				for ( int iAxis = 0; iAxis < 3; iAxis++ )
+				{
+					__m128 delta = _mm_max_ps( _mm_sub_ps( mins[iAxis], center[iAxis] ), _mm_sub_ps( center[iAxis], maxs[iAxis] ) );
+					delta = _mm_max_ps( delta, _mm_setzero_ps() );
+					distSqr = _mm_add_ps( distSqr, _mm_mul_ps( delta, delta ) );
+				}
+				nHitMask &= _mm_movemask_ps( _mm_cmplt_ps( distSqr, radiusSqr ) );
+			}
+
+			for ( int i = 0; nHitMask; i++, nHitMask >>= 1 )
+			{
+				if ( !( nHitMask & 1 ) )
+					continue;
+
+				const Entry_t &entry = m_Entries[pGroup->m_Slots[i]];
+				if ( query.m_nType == ENTITY_QUERY_RAY )
+				{
+					// Rays only got the box around them tested
+					if ( !IsBoxIntersectingRay( entry.m_vecMins - query.m_vecExtents, entry.m_vecMaxs + query.m_vecExtents, query.m_vecCenter, query.m_vecDelta ) )
+						continue;
+				}
+
+				if ( !func( entry.m_pEntity ) )
+					return;
+			}
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Enumerations
+//-----------------------------------------------------------------------------
+class CCollectSpatialHits
+{
+public:
+	CCollectSpatialHits() : m_nStackHits( 0 ) {}
+
+	bool operator()( CBaseEntity *pEntity )
+	{
+		if ( m_nStackHits < ENTITY_INDEX_STACK_HITS )
+		{
+			m_StackHits[m_nStackHits++] = pEntity->GetRefEHandle();
+		}
+		else
+		{
+			m_HeapHits.AddToTail( pEntity->GetRefEHandle() );
+		}
+		return true;
+	}
+
+	int Count() const { return m_nStackHits + m_HeapHits.Count(); }
+	const CBaseHandle &operator[]( int i ) const { return ( i < m_nStackHits ) ? m_StackHits[i] : m_HeapHits[i - m_nStackHits]; }
+
+private:
+	CBaseHandle m_StackHits[ENTITY_INDEX_STACK_HITS];
+	int m_nStackHits;
+	CUtlVector< CBaseHandle > m_HeapHits;
+};
+
+void CEntitySpatialIndex::Enumerate( const EntitySpatialQuery_t &query, IPartitionEnumerator *pIterator )
+{
+	if ( ThreadInMainThread() )
+	{
+		UpdateDirtySpatialPartitionEntities();
+	}
+
+	// Callbacks can move, remove or query entities, so they run after the walk
+	CCollectSpatialHits hits;
+	ForEachHit( query, hits );
+
+	for ( int i = 0; i < hits.Count(); i++ )
+	{
+		CBaseEntity *pEntity = gEntList.GetBaseEntity( hits[i] );
+		if ( pEntity && pIterator->EnumElement( pEntity ) == ITERATION_STOP )
+			break;
+	}
+}
+
+void CEntitySpatialIndex::EnumerateElementsInBox( const Vector &mins, const Vector &maxs, IPartitionEnumerator *pIterator )
+{
+	EntitySpatialQuery_t query;
+	query.InitBox( mins, maxs );
+	Enumerate( query, pIterator );
+}
+
+void CEntitySpatialIndex::EnumerateElementsInSphere( const Vector &center, float radius, IPartitionEnumerator *pIterator )
+{
+	EntitySpatialQuery_t query;
+	query.InitSphere( center, radius );
+	Enumerate( query, pIterator );
+}
+
+void CEntitySpatialIndex::EnumerateElementsAlongRay( const Ray_t &ray, IPartitionEnumerator *pIterator )
+{
+	EntitySpatialQuery_t query;
+	query.InitRay( ray );
+	Enumerate( query, pIterator );
+}
+
+
+//-----------------------------------------------------------------------------
+// Batches
+//-----------------------------------------------------------------------------
+class CFillSpatialQueryList
+{
+public:
+	CFillSpatialQueryList( EntitySpatialQuery_t &query ) : m_Query( query ) {}
+
+	bool operator()( CBaseEntity *pEntity )
+	{
+		if ( m_Query.m_nFlagMask && !( pEntity->GetFlags() & m_Query.m_nFlagMask ) )
+			return true;
+
+		if ( m_Query.m_nCount >= m_Query.m_nListMax )
+		{
+			AssertMsgOnce( 0, "reached enumerated list limit.  Increase limit, decrease radius, or make it so entity flags will work for you" );
+			return false;
+		}
+		m_Query.m_pList[m_Query.m_nCount++] = pEntity;
+		return true;
+	}
+
+private:
+	EntitySpatialQuery_t &m_Query;
+};
+
+struct SpatialQueryBatch_t
+{
+	CEntitySpatialIndex *m_pIndex;
+	EntitySpatialQuery_t *m_pQueries;
+};
+
+void CEntitySpatialIndex::RunQueryRange( void *pContext, int iFirst, int iLast )
+{
+	SpatialQueryBatch_t *pBatch = (SpatialQueryBatch_t *)pContext;
+	for ( int i = iFirst; i < iLast; i++ )
+	{
+		EntitySpatialQuery_t &query = pBatch->m_pQueries[i];
+		query.m_nCount = 0;
+
+		CFillSpatialQueryList fill( query );
+		pBatch->m_pIndex->ForEachHit( query, fill );
+	}
+}
+
+void CEntitySpatialIndex::RunQueries( EntitySpatialQuery_t *pQueries, int nQueries )
+{
+	Assert( ThreadInMainThread() );
+	UpdateDirtySpatialPartitionEntities();
+
+	SpatialQueryBatch_t batch;
+	batch.m_pIndex = this;
+	batch.m_pQueries = pQueries;
+	ServerJobs_ParallelFor( nQueries, 16, RunQueryRange, &batch, 1 );
+}
+
+
+//-----------------------------------------------------------------------------
+// Compares the index with the partition, and times them both
+//-----------------------------------------------------------------------------
+class CBenchSpatialEnum : public IPartitionEnumerator
+{
+public:
+	virtual IterationRetval_t EnumElement( IHandleEntity *pHandleEntity )
+	{
+		m_Hits.AddToTail( pHandleEntity->GetRefEHandle().ToInt() );
+		return ITERATION_CONTINUE;
+	}
+
+	CUtlVector< unsigned long > m_Hits;
+};
+
+static int CompareHits( const unsigned long *a, const unsigned long *b )
+{
+	return ( *a < *b ) ? -1 : ( *a > *b );
+}
+
+static void BenchEnumerate( const EntitySpatialQuery_t &query, bool bIndex, CBenchSpatialEnum *pEnum )
+{
+	Ray_t ray;
+	switch ( query.m_nType )
+	{
+	case ENTITY_QUERY_BOX:
+		if ( bIndex )
+			g_EntitySpatialIndex.EnumerateElementsInBox( query.m_vecMins, query.m_vecMaxs, pEnum );
+		else
+			partition->EnumerateElementsInBox( PARTITION_ENGINE_NON_STATIC_EDICTS, query.m_vecMins, query.m_vecMaxs, false, pEnum );
+		break;
+
+	case ENTITY_QUERY_SPHERE:
+		if ( bIndex )
+			g_EntitySpatialIndex.EnumerateElementsInSphere( query.m_vecCenter, query.m_flRadius, pEnum );
+		else
+			partition->EnumerateElementsInSphere( PARTITION_ENGINE_NON_STATIC_EDICTS, query.m_vecCenter, query.m_flRadius, false, pEnum );
+		break;
+
+	case ENTITY_QUERY_RAY:
+		ray.Init( query.m_vecCenter, query.m_vecCenter + query.m_vecDelta, -query.m_vecExtents, query.m_vecExtents );
+		if ( bIndex )
+			g_EntitySpatialIndex.EnumerateElementsAlongRay( ray, pEnum );
+		else
+			partition->EnumerateElementsAlongRay( PARTITION_ENGINE_NON_STATIC_EDICTS, ray, false, pEnum );
+		break;
+	}
+}
+
+CON_COMMAND_F( bench_entityquery, "Times box, sphere and ray queries around the map's entities against the spatial partition, and checks they agree. Usage: bench_entityquery [queries]", FCVAR_CHEAT )
+{
+	int nQueries = ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 3000;
+	nQueries = clamp( nQueries, 3, 20000 );
+
+	CUtlVector< Vector > origins;
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity != NULL; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		if ( pEntity->edict() && pEntity->entindex() != 0 )
+		{
+			origins.AddToTail( pEntity->GetAbsOrigin() );
+		}
+	}
+
+	if ( !origins.Count() )
+	{
+		Msg( "bench_entityquery: no entities, load a map first.\n" );
+		return;
+	}
+
+	CUtlVector< EntitySpatialQuery_t > queries;
+	queries.SetCount( nQueries );
+	for ( int i = 0; i < nQueries; i++ )
+	{
+		const Vector &vecOrigin = origins[ RandomInt( 0, origins.Count() - 1 ) ];
+		Vector vecOffset = RandomVector( -256.0f, 256.0f );
+		switch ( i % 3 )
+		{
+		case 0:
+			queries[i].InitBox( vecOrigin - vecOffset, vecOrigin + vecOffset );
+			break;
+		case 1:
+			queries[i].InitSphere( vecOrigin, RandomFloat( 16.0f, 512.0f ) );
+			break;
+		case 2:
+			{
+				Ray_t ray;
+				Vector vecHull( 16, 16, 36 );
+				ray.Init( vecOrigin - vecOffset * 4.0f, vecOrigin + vecOffset * 4.0f, -vecHull, vecHull );
+				queries[i].InitRay( ray );
+			}
+			break;
+		}
+	}
+
+	// Check the index finds what the partition finds
+	int nMismatches = 0;
+	int nHits = 0;
+	for ( int i = 0; i < nQueries; i++ )
+	{
+		CBenchSpatialEnum partitionHits, indexHits;
+		BenchEnumerate( queries[i], false, &partitionHits );
+		BenchEnumerate( queries[i], true, &indexHits );
+		partitionHits.m_Hits.Sort( CompareHits );
+		indexHits.m_Hits.Sort( CompareHits );
+
+		nHits += partitionHits.m_Hits.Count();
+		bool bMatch = ( partitionHits.m_Hits.Count() == indexHits.m_Hits.Count() );
+		for ( int j = 0; bMatch && j < indexHits.m_Hits.Count(); j++ )
+		{
+			bMatch = ( partitionHits.m_Hits[j] == indexHits.m_Hits[j] );
+		}
+		if ( !bMatch )
+		{
+			nMismatches++;
+		}
+	}
+
+	Msg( "bench_entityquery: %d entities indexed, %d of them large, %d queries, %d hits\n",
+		g_EntitySpatialIndex.GetEntityCount(), g_EntitySpatialIndex.GetLargeEntityCount(), nQueries, nHits );
+
+	CFastTimer timer;
+	for ( int iPass = 0; iPass < 2; iPass++ )
+	{
+		CBenchSpatialEnum hits;
+		hits.m_Hits.EnsureCapacity( nHits );
+		timer.Start();
+		for ( int i = 0; i < nQueries; i++ )
+		{
+			hits.m_Hits.RemoveAll();
+			BenchEnumerate( queries[i], iPass != 0, &hits );
+		}
+		timer.End();
+		Msg( "  %s: %.2f ms\n", iPass ? "index    " : "partition", timer.GetDuration().GetMillisecondsF() );
+	}
+
+	CUtlVector< CBaseEntity * > lists;
+	lists.SetCount( nQueries * MAX_SPHERE_QUERY );
+	for ( int i = 0; i < nQueries; i++ )
+	{
+		queries[i].SetList( &lists[i * MAX_SPHERE_QUERY], MAX_SPHERE_QUERY, 0 );
+	}
+	timer.Start();
+	g_EntitySpatialIndex.RunQueries( queries.Base(), nQueries );
+	timer.End();
+	Msg( "  batched  : %.2f ms on %d threads\n", timer.GetDuration().GetMillisecondsF(), ServerJobThreadCount() );
+
+	if ( nMismatches )
+	{
+		Warning( "bench_entityquery: %d queries found different entities than the partition\n", nMismatches );
+	}
+}
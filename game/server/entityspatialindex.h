@@ -0,0 +1,139 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Game-side copy of the spatial partition's non-static edict list,
+//			kept in a loose grid for UTIL_EntitiesInBox() and friends.
+//
+//			CCollisionProperty keeps it in step with the partition, so queries
+//			find the same entities the partition would, in a different order.
+//			Queries test four boxes at a time and don't take the partition's
+//			lock. Only the main thread changes the index: worker threads may
+//			query it while the main thread waits on their jobs, and see the
+//			entities as they were when the jobs started.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef ENTITYSPATIALINDEX_H
+#define ENTITYSPATIALINDEX_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "ispatialpartition.h"
+#include "worldsize.h"
+#include "utlvector.h"
+
+class CBaseEntity;
+
+
+enum EntitySpatialQueryType_t
+{
+	ENTITY_QUERY_BOX = 0,
+	ENTITY_QUERY_SPHERE,
+	ENTITY_QUERY_RAY,
+};
+
+
+//-----------------------------------------------------------------------------
+// One query of a batch. Fills in m_pList like UTIL_EntitiesInBox(), with the
+// entities that have one of the flags in m_nFlagMask, or all of them if it's 0.
+//-----------------------------------------------------------------------------
+struct EntitySpatialQuery_t
+{
+	void InitBox( const Vector &mins, const Vector &maxs );
+	void InitSphere( const Vector &center, float radius );
+	void InitRay( const Ray_t &ray );
+	void SetList( CBaseEntity **pList, int listMax, int flagMask );
+
+	EntitySpatialQueryType_t m_nType;
+	Vector		m_vecMins;			// Bounds of the whole query
+	Vector		m_vecMaxs;
+	Vector		m_vecCenter;		// Sphere center or ray start
+	Vector		m_vecDelta;			// Ray only
+	Vector		m_vecExtents;		// Ray only
+	float		m_flRadius;			// Sphere only
+
+	CBaseEntity	**m_pList;
+	int			m_nListMax;
+	int			m_nFlagMask;
+	int			m_nCount;			// Filled in by the query
+};
+
+
+//-----------------------------------------------------------------------------
+// Entities are filed in the grid cell that holds the center of their bounds.
+// Entities wider than a cell go in a list that every query tests.
+//-----------------------------------------------------------------------------
+#define ENTITY_INDEX_CELL_SIZE		512
+#define ENTITY_INDEX_GRID_SIZE		( COORD_EXTENT / ENTITY_INDEX_CELL_SIZE )
+#define ENTITY_INDEX_LARGE_CELL		( ENTITY_INDEX_GRID_SIZE * ENTITY_INDEX_GRID_SIZE )
+
+class CEntitySpatialIndex
+{
+public:
+	CEntitySpatialIndex();
+
+	// Called by CCollisionProperty as it updates the partition
+	void		InsertEntity( CBaseEntity *pEntity );		// Joined PARTITION_ENGINE_NON_STATIC_EDICTS
+	void		RemoveEntity( CBaseEntity *pEntity );		// Left it
+	void		MoveEntity( CBaseEntity *pEntity, const Vector &mins, const Vector &maxs );
+
+	// Called by the entity list, once the entity's handle has been cleared
+	void		RemoveEntityAtSlot( int iSlot );
+
+	// Same as the partition's enumerations of PARTITION_ENGINE_NON_STATIC_EDICTS
+	void		EnumerateElementsInBox( const Vector &mins, const Vector &maxs, IPartitionEnumerator *pIterator );
+	void		EnumerateElementsInSphere( const Vector &center, float radius, IPartitionEnumerator *pIterator );
+	void		EnumerateElementsAlongRay( const Ray_t &ray, IPartitionEnumerator *pIterator );
+
+	// Answers a batch of queries, spread across the server job pool
+	void		RunQueries( EntitySpatialQuery_t *pQueries, int nQueries );
+
+	int			GetEntityCount() const		{ return m_nEntities; }
+	int			GetLargeEntityCount() const	{ return m_Cells[ENTITY_INDEX_LARGE_CELL].m_nCount; }
+
+private:
+	// Four entities' bounds, one axis per row
+	struct BoxGroup_t
+	{
+		float			m_flMins[3][4];
+		float			m_flMaxs[3][4];
+		unsigned short	m_Slots[4];
+	};
+
+	struct Cell_t
+	{
+		Cell_t() : m_nCount( 0 ) {}
+
+		CUtlVector< BoxGroup_t > m_Groups;
+		int				m_nCount;
+	};
+
+	struct Entry_t
+	{
+		CBaseEntity		*m_pEntity;
+		Vector			m_vecMins;
+		Vector			m_vecMaxs;
+		int				m_iCell;		// -1 while it's not in the list
+		int				m_iLane;		// Group * 4 + lane
+	};
+
+	Entry_t		*GetEntry( CBaseEntity *pEntity, bool bClaim );
+	static int	CellForBounds( const Vector &mins, const Vector &maxs );
+	void		FileEntry( int iSlot );
+	void		UnfileEntry( int iSlot );
+	void		WriteLane( int iCell, int iLane, int iSlot );
+
+	void		Enumerate( const EntitySpatialQuery_t &query, IPartitionEnumerator *pIterator );
+	template< class FUNCTOR > void ForEachHit( const EntitySpatialQuery_t &query, FUNCTOR &func ) const;
+
+	static void	RunQueryRange( void *pContext, int iFirst, int iLast );
+
+	Entry_t		m_Entries[MAX_EDICTS];
+	Cell_t		m_Cells[ENTITY_INDEX_LARGE_CELL + 1];
+	int			m_nEntities;
+};
+
+extern CEntitySpatialIndex g_EntitySpatialIndex;
+
+#endif // ENTITYSPATIALINDEX_H
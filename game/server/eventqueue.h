@@ -6,6 +6,12 @@
 //
 //			The queue is serviced once per server frame.
 //
+//			Events are kept in a 4-ary heap ordered by fire time, then by the
+//			order they were added, so events due at the same time fire first
+//			in, first out. Each event is also linked into a list per caller
+//			and a list per direct target entity, so cancelling and checking
+//			for pending events doesn't search the whole queue.
+//
 //=============================================================================//
 
 #ifndef EVENTQUEUE_H
@@ -28,8 +34,17 @@ struct EventQueuePrioritizedEvent_t
 
 	variant_t m_VariantValue;	// variable-type parameter
 
-	EventQueuePrioritizedEvent_t *m_pNext;
-	EventQueuePrioritizedEvent_t *m_pPrev;
+	unsigned int m_nOrder;		// breaks ties in fire time, in the order events were added
+	int m_iHeapIndex;
+
+	// lists of the events with the same caller or direct target entity slot,
+	// the slot being the handle's entry index (-1 when not in a list)
+	int m_iCallerSlot;
+	EventQueuePrioritizedEvent_t *m_pNextByCaller;
+	EventQueuePrioritizedEvent_t *m_pPrevByCaller;
+	int m_iTargetSlot;
+	EventQueuePrioritizedEvent_t *m_pNextByTarget;
+	EventQueuePrioritizedEvent_t *m_pPrevByTarget;
 
 	DECLARE_SIMPLE_DATADESC();
 
@@ -53,6 +68,7 @@ public:
 
 	// debugging
 	void ValidateQueue( void );
+	int GetEventCount( void ) const;
 
 	// serialization
 	int Save( ISave &save );
@@ -70,12 +86,31 @@ private:
 
 	void AddEvent( EventQueuePrioritizedEvent_t *event );
 	void RemoveEvent( EventQueuePrioritizedEvent_t *pe );
+	void DeleteEvent( EventQueuePrioritizedEvent_t *pe );
+
+	// heap
+	static bool FiresBefore( const EventQueuePrioritizedEvent_t *pLeft, const EventQueuePrioritizedEvent_t *pRight );
+	void HeapMoveUp( int i );
+	void HeapMoveDown( int i );
+	void GetSortedEvents( CUtlVector<EventQueuePrioritizedEvent_t *> &events );
 
 	DECLARE_SIMPLE_DATADESC();
-	EventQueuePrioritizedEvent_t m_Events;
+	CUtlVector<EventQueuePrioritizedEvent_t *> m_Heap;
+	unsigned int m_nNextOrder;
+	EventQueuePrioritizedEvent_t *m_pFiringEvent;	// ServiceEvents() deletes it once it has fired
+
+	// heads of the per-slot lists
+	EventQueuePrioritizedEvent_t *m_pEventsByCaller[NUM_ENT_ENTRIES];
+	EventQueuePrioritizedEvent_t *m_pEventsByTarget[NUM_ENT_ENTRIES];
+
 	int m_iListCount;
 };
 
+inline int CEventQueue::GetEventCount( void ) const
+{
+	return m_Heap.Count();
+}
+
 extern CEventQueue g_EventQueue;
 
 
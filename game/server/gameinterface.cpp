@@ -41,6 +41,7 @@
 #include "saverestoretypes.h"
 #include "physics_saverestore.h"
 #include "tier0/vprof.h"
+#include "tier0/fasttimer.h"
 #include "effect_dispatch_data.h"
 #include "engine/IStaticPropMgr.h"
 #include "TemplateEntities.h"
@@ -66,7 +67,10 @@
 #include "util.h"
 #include "vstdlib/ICommandLine.h"
 #include "datacache/imdlcache.h"
+#include "serverjobs.h"
+#include "tier1/keyvaluesview.h"
 #include "engine/iserverplugin.h"
+#include "bone_setup.h"
 #ifdef _WIN32
 #include "ienginevgui.h"
 #include "vgui_gamedll_int.h"
@@ -524,6 +528,13 @@ bool CServerGameDLL::DLLInit(CreateInterfaceFn engineFactory,
 	
 	MathLib_Init( 2.2f, 2.2f, 0.0f, 2.0f );
 
+	// Keep compiled copies of the text KeyValues files we load, so unchanged
+	// scripts aren't parsed again on the next run
+	if ( !CommandLine()->CheckParm( "-nokvcache" ) )
+	{
+		KeyValuesFileCache()->Init( filesystem, "cache/keyvalues_server.bin" );
+	}
+
 	// save these in case other system inits need them
 	factorylist_t factories;
 	factories.engineFactory = engineFactory;
@@ -676,6 +687,8 @@ void CServerGameDLL::DLLShutdown( void )
 		TheNavMesh = NULL;
 	}
 #endif
+
+	KeyValuesFileCache()->Shutdown();
 }
 
 //-----------------------------------------------------------------------------
@@ -1001,6 +1014,9 @@ void CServerGameDLL::GameFrame( bool simulating )
 	// free all ents marked in think functions
 	gEntList.CleanupDeleteList();
 
+	// set up the bones the next frame's traces will want, across the job threads
+	CBaseAnimating::SetupBonesForFrame();
+
 	// FIXME:  Should this only occur on the final tick?
 	UpdateAllClientData();
 
@@ -1117,6 +1133,9 @@ void CServerGameDLL::LevelShutdown( void )
 
 	IGameSystem::LevelShutdownPostEntityAllSystems();
 
+	// The level's models may be unloaded after this
+	Studio_FlushAnimCaches();
+
 	// In case we quit out during initial load
 	CBaseEntity::SetAllowPrecache( false );
 }
@@ -1706,6 +1725,180 @@ CBaseEntity* CServerGameEnts::EdictToBaseEntity( edict_t *pEdict )
 }
 
 
+//-----------------------------------------------------------------------------
+// Parallel PVS culling for CheckTransmit. The area and PVS tests of entities
+// that only want a PVS check don't touch any game state, so they run across
+// the server job pool before the serial walk, which then just reads the
+// answers. ShouldTransmit(), SetTransmit() and the move parent fallback still
+// run in order on the main thread.
+//-----------------------------------------------------------------------------
+ConVar sv_parallel_checktransmit( "sv_parallel_checktransmit", "1", 0, "Run the CheckTransmit PVS tests on the server job threads." );
+ConVar sv_parallel_checktransmit_min( "sv_parallel_checktransmit_min", "256", 0, "Smallest edict count that CheckTransmit splits across threads." );
+
+enum
+{
+	TRANSMIT_CULL_UNKNOWN = 0,		// The serial walk does the full test
+	TRANSMIT_CULL_SKYBOX,			// In the recipient's 3d skybox area
+	TRANSMIT_CULL_IN_PVS,
+	TRANSMIT_CULL_NOT_IN_PVS,
+};
+
+struct TransmitCullContext_t
+{
+	const CCheckTransmitInfo	*m_pInfo;
+	const unsigned short		*m_pEdictIndices;
+	edict_t						*m_pBaseEdict;
+	int							m_iSkyBoxArea;
+	int							m_nMapAreas;
+	const unsigned char			*m_pAreaConnected;	// Per map area: connected to one of the recipient's areas
+	unsigned char				*m_pResults;		// Per entry of m_pEdictIndices
+};
+
+static unsigned char s_TransmitCullResults[MAX_EDICTS];
+static unsigned char s_TransmitAreaConnected[MAX_MAP_AREAS];
+
+// Same answers as CServerNetworkProperty::AreaNum() and IsInPVS(), without the engine calls
+static inline unsigned char ClassifyTransmitPVS( const TransmitCullContext_t *pContext, const PVSInfo_t *pPVSInfo )
+{
+	if ( pPVSInfo->m_nAreaNum == pContext->m_iSkyBoxArea )
+		return TRANSMIT_CULL_SKYBOX;
+
+	int nArea = pPVSInfo->m_nAreaNum;
+	int nArea2 = pPVSInfo->m_nAreaNum2;
+	if ( (unsigned)nArea >= (unsigned)pContext->m_nMapAreas || (unsigned)nArea2 >= (unsigned)pContext->m_nMapAreas )
+		return TRANSMIT_CULL_UNKNOWN;
+
+	// doors can legally straddle two areas
+	if ( !pContext->m_pAreaConnected[nArea] && !( nArea2 && pContext->m_pAreaConnected[nArea2] ) )
+		return TRANSMIT_CULL_NOT_IN_PVS;
+
+	// too many clusters, the headnode test goes through the engine
+	if ( pPVSInfo->m_nClusterCount < 0 )
+		return TRANSMIT_CULL_UNKNOWN;
+
+	const byte *pPVS = pContext->m_pInfo->m_PVS;
+	for ( int i = pPVSInfo->m_nClusterCount; --i >= 0; )
+	{
+		if ( pPVS[pPVSInfo->m_pClusters[i] >> 3] & ( 1 << ( pPVSInfo->m_pClusters[i] & 7 ) ) )
+			return TRANSMIT_CULL_IN_PVS;
+	}
+
+	return TRANSMIT_CULL_NOT_IN_PVS;
+}
+
+static void CullTransmitRange( void *pContextPtr, int iFirst, int iLast )
+{
+	TransmitCullContext_t *pContext = (TransmitCullContext_t *)pContextPtr;
+
+	for ( int i = iFirst; i < iLast; i++ )
+	{
+		unsigned char result = TRANSMIT_CULL_UNKNOWN;
+
+		edict_t *pEdict = &pContext->m_pBaseEdict[pContext->m_pEdictIndices[i]];
+		int nFlags = pEdict->m_fStateFlags & (FL_EDICT_DONTSEND|FL_EDICT_ALWAYS|FL_EDICT_PVSCHECK|FL_EDICT_FULLCHECK);
+		if ( nFlags == FL_EDICT_PVSCHECK )
+		{
+			// Entities that moved get their PVS information recomputed by the serial walk
+			CBaseEntity *pEnt = ( CBaseEntity * )pEdict->GetUnknown();
+			if ( pEnt && !( pEnt->GetEFlags() & EFL_DIRTY_PVS_INFORMATION ) )
+			{
+				result = ClassifyTransmitPVS( pContext, pEnt->NetworkProp()->GetPVSInfo() );
+			}
+		}
+
+		pContext->m_pResults[i] = result;
+	}
+}
+
+// Returns one TRANSMIT_CULL_ value per edict index, or NULL if the serial walk should do everything
+static const unsigned char *CullTransmitEdicts( const CCheckTransmitInfo *pInfo, const unsigned short *pEdictIndices, int nEdicts, edict_t *pBaseEdict, int skyBoxArea )
+{
+	if ( !sv_parallel_checktransmit.GetBool() || nEdicts < sv_parallel_checktransmit_min.GetInt() || !ServerJobPool() )
+		return NULL;
+
+	int nMapAreas = pInfo->m_nMapAreas;
+	if ( nMapAreas <= 0 || nMapAreas > MAX_MAP_AREAS )
+		return NULL;
+
+	// One engine call per map area instead of one per entity
+	for ( int nArea = 0; nArea < nMapAreas; nArea++ )
+	{
+		s_TransmitAreaConnected[nArea] = 0;
+		for ( int i = 0; i < pInfo->m_AreasNetworked; i++ )
+		{
+			if ( engine->CheckAreasConnected( pInfo->m_Areas[i], nArea ) )
+			{
+				s_TransmitAreaConnected[nArea] = 1;
+				break;
+			}
+		}
+	}
+
+	TransmitCullContext_t context;
+	context.m_pInfo = pInfo;
+	context.m_pEdictIndices = pEdictIndices;
+	context.m_pBaseEdict = pBaseEdict;
+	context.m_iSkyBoxArea = skyBoxArea;
+	context.m_nMapAreas = nMapAreas;
+	context.m_pAreaConnected = s_TransmitAreaConnected;
+	context.m_pResults = s_TransmitCullResults;
+
+	ServerJobs_ParallelFor( nEdicts, 128, CullTransmitRange, &context );
+	return s_TransmitCullResults;
+}
+
+//-----------------------------------------------------------------------------
+// CheckTransmit time per tick, summed over all clients
+//-----------------------------------------------------------------------------
+#define TRANSMIT_TIMING_TICKS	64
+
+static CCycleCount	s_TransmitTickTime;
+static int			s_nTransmitTickClients;
+static int			s_iTransmitTick = -1;
+static float		s_TransmitHistoryMS[TRANSMIT_TIMING_TICKS];
+static int			s_TransmitHistoryClients[TRANSMIT_TIMING_TICKS];
+static int			s_nTransmitHistory;
+
+static void UpdateTransmitTiming()
+{
+	if ( s_iTransmitTick == gpGlobals->tickcount )
+		return;
+
+	if ( s_nTransmitTickClients )
+	{
+		int iSlot = s_nTransmitHistory++ % TRANSMIT_TIMING_TICKS;
+		s_TransmitHistoryMS[iSlot] = s_TransmitTickTime.GetMillisecondsF();
+		s_TransmitHistoryClients[iSlot] = s_nTransmitTickClients;
+	}
+
+	s_iTransmitTick = gpGlobals->tickcount;
+	s_TransmitTickTime.Init();
+	s_nTransmitTickClients = 0;
+}
+
+CON_COMMAND( sv_checktransmit_stats, "Reports CheckTransmit time per tick over the last 64 ticks." )
+{
+	int nTicks = min( s_nTransmitHistory, TRANSMIT_TIMING_TICKS );
+	if ( !nTicks )
+	{
+		Msg( "No CheckTransmit calls yet\n" );
+		return;
+	}
+
+	float flTotal = 0, flMax = 0;
+	int nClients = 0;
+	for ( int i = 0; i < nTicks; i++ )
+	{
+		flTotal += s_TransmitHistoryMS[i];
+		flMax = max( flMax, s_TransmitHistoryMS[i] );
+		nClients += s_TransmitHistoryClients[i];
+	}
+
+	Msg( "CheckTransmit over %d ticks: %.3f ms/tick average, %.3f ms max, %.1f clients/tick (%s)\n",
+		nTicks, flTotal / nTicks, flMax, (float)nClients / nTicks,
+		( sv_parallel_checktransmit.GetBool() && ServerJobPool() ) ? "parallel" : "serial" );
+}
+
 /* Yuck.. ideally this would be in CServerNetworkProperty's header, but it requires CBaseEntity and
 // inlining it gives a nice speedup.
 inline void CServerNetworkProperty::CheckTransmit( CCheckTransmitInfo *pInfo )
@@ -1747,6 +1940,13 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 	// m_pTransmitAlways must be set if HLTV client
 	Assert( bIsHLTV == ( pInfo->m_pTransmitAlways != NULL) );
 
+	UpdateTransmitTiming();
+	CTimeAdder timer( &s_TransmitTickTime );
+	s_nTransmitTickClients++;
+
+	// for the HLTV we don't cull against PVS
+	const unsigned char *pCullResults = bIsHLTV ? NULL : CullTransmitEdicts( pInfo, pEdictIndices, nEdicts, pBaseEdict, skyBoxArea );
+
 	// int dontSend = 0; int always = 0; int fullCheck = 0; int PVS = 0;
 
 
@@ -1843,7 +2043,8 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 		}
 
 	
-		bool bSameAreaAsSky = netProp->AreaNum() == skyBoxArea;
+		int nCullResult = pCullResults ? pCullResults[i] : TRANSMIT_CULL_UNKNOWN;
+		bool bSameAreaAsSky = ( nCullResult != TRANSMIT_CULL_UNKNOWN ) ? ( nCullResult == TRANSMIT_CULL_SKYBOX ) : ( netProp->AreaNum() == skyBoxArea );
 		// Always send entities in the player's 3d skybox.
 		// Sidenote: call of AreaNum() ensures that PVS data is up to date for this entity
 		if ( bSameAreaAsSky )
@@ -1852,7 +2053,7 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 		}
 		else
 		{
-			bool bInPVS = netProp->IsInPVS( pInfo );
+			bool bInPVS = ( nCullResult != TRANSMIT_CULL_UNKNOWN ) ? ( nCullResult == TRANSMIT_CULL_IN_PVS ) : netProp->IsInPVS( pInfo );
 			if ( bInPVS )
 			{
 				// only send if entity is in PVS
@@ -1926,6 +2127,109 @@ void CServerGameEnts::CheckTransmit( CCheckTransmitInfo *pInfo, const unsigned s
 }
 
 
+//-----------------------------------------------------------------------------
+// Simulates 32, 64 and 128 clients by running CheckTransmit for viewpoints
+// spread over the map. Every simulated client is the local player seen from
+// somewhere else, so ShouldTransmit() overrides behave as they do for them.
+//-----------------------------------------------------------------------------
+CON_COMMAND_F( bench_checktransmit, "Times CheckTransmit per tick for 32/64/128 simulated clients, serial and on the job threads. Usage: bench_checktransmit [ticks]", FCVAR_CHEAT )
+{
+	CBasePlayer *pPlayer = UTIL_GetCommandClient();
+	if ( !pPlayer )
+	{
+		pPlayer = UTIL_PlayerByIndex( 1 );
+	}
+	if ( !pPlayer || pPlayer->IsHLTV() )
+	{
+		Msg( "bench_checktransmit needs a player in the game\n" );
+		return;
+	}
+
+	int nTicks = max( 1, ( engine->Cmd_Argc() > 1 ) ? atoi( engine->Cmd_Argv( 1 ) ) : 100 );
+
+	// The engine passes every edict in use
+	CUtlVector<unsigned short> edictIndices;
+	CUtlVector<Vector> viewpoints;
+	int nMapAreas = 0;
+	for ( int i = 0; i < gpGlobals->maxEntities; i++ )
+	{
+		edict_t *pEdict = engine->PEntityOfEntIndex( i );
+		if ( !pEdict || pEdict->IsFree() || !pEdict->GetUnknown() )
+			continue;
+
+		edictIndices.AddToTail( i );
+
+		CBaseEntity *pEnt = CBaseEntity::Instance( pEdict );
+		if ( !pEnt )
+			continue;
+
+		PVSInfo_t *pPVSInfo = pEnt->NetworkProp()->GetPVSInfo();
+		nMapAreas = max( nMapAreas, max( pPVSInfo->m_nAreaNum, pPVSInfo->m_nAreaNum2 ) + 1 );
+		if ( i > gpGlobals->maxClients && engine->GetClusterForOrigin( pEnt->GetAbsOrigin() ) >= 0 )
+		{
+			viewpoints.AddToTail( pEnt->GetAbsOrigin() );
+		}
+	}
+
+	if ( !viewpoints.Count() )
+	{
+		viewpoints.AddToTail( pPlayer->EyePosition() );
+	}
+
+	Msg( "%d edicts, %d viewpoints, %d job threads\n", edictIndices.Count(), viewpoints.Count(), ServerJobThreadCount() );
+	Msg( "clients   serial (ms/tick)   parallel (ms/tick)\n" );
+
+	const int nMaxClients = 128;
+	CCheckTransmitInfo *pInfos = new CCheckTransmitInfo[nMaxClients];
+	CBitVec<MAX_EDICTS> *pTransmitEdicts = new CBitVec<MAX_EDICTS>[nMaxClients];
+	for ( int i = 0; i < nMaxClients; i++ )
+	{
+		const Vector &vecOrigin = viewpoints[ ( i * 7919 ) % viewpoints.Count() ];
+
+		CCheckTransmitInfo *pInfo = &pInfos[i];
+		memset( pInfo, 0, sizeof( *pInfo ) );
+		pInfo->m_pClientEnt = pPlayer->edict();
+		pInfo->m_nPVSSize = engine->GetPVSForCluster( engine->GetClusterForOrigin( vecOrigin ), sizeof( pInfo->m_PVS ), pInfo->m_PVS );
+		pInfo->m_pTransmitEdict = &pTransmitEdicts[i];
+		pInfo->m_pTransmitAlways = NULL;
+		pInfo->m_AreasNetworked = 1;
+		pInfo->m_Areas[0] = engine->GetArea( vecOrigin );
+		pInfo->m_nMapAreas = max( nMapAreas, pInfo->m_Areas[0] + 1 );
+	}
+
+	CServerGameEnts gameEnts;
+	bool bParallel = sv_parallel_checktransmit.GetBool();
+	for ( int nClients = 32; nClients <= nMaxClients; nClients *= 2 )
+	{
+		double flMSPerTick[2];
+		for ( int iMode = 0; iMode < 2; iMode++ )
+		{
+			sv_parallel_checktransmit.SetValue( iMode );
+
+			CFastTimer timer;
+			timer.Start();
+			for ( int iTick = 0; iTick < nTicks; iTick++ )
+			{
+				for ( int i = 0; i < nClients; i++ )
+				{
+					pInfos[i].m_pTransmitEdict->ClearAll();
+					gameEnts.CheckTransmit( &pInfos[i], edictIndices.Base(), edictIndices.Count() );
+				}
+			}
+			timer.End();
+
+			flMSPerTick[iMode] = timer.GetDuration().GetMillisecondsF() / nTicks;
+		}
+
+		Msg( "%7d %18.3f %20.3f\n", nClients, flMSPerTick[0], flMSPerTick[1] );
+	}
+
+	sv_parallel_checktransmit.SetValue( bParallel );
+	delete[] pInfos;
+	delete[] pTransmitEdicts;
+}
+
+
 CServerGameClients g_ServerGameClients;
 EXPOSE_SINGLE_INTERFACE_GLOBALVAR(CServerGameClients, IServerGameClients, INTERFACEVERSION_SERVERGAMECLIENTS, g_ServerGameClients );
 
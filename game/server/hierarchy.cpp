@@ -38,6 +38,7 @@ void UnlinkChild( CBaseEntity *pParent, CBaseEntity *pChild )
 			pList->m_hMovePeer.Set( NULL );
 			pList->DispatchUpdateTransmitState();	
 			pList->OnEntityEvent( ENTITY_EVENT_PARENT_CHANGED, NULL );
+			SimThink_EntityChanged( pList );
 			
 			pParent->RecalcHasPlayerChildBit();
 			return;
@@ -60,6 +61,7 @@ void LinkChild( CBaseEntity *pParent, CBaseEntity *pChild )
 	pChild->m_hMoveParent.Set( pParent );
 	pChild->DispatchUpdateTransmitState();
 	pChild->OnEntityEvent( ENTITY_EVENT_PARENT_CHANGED, NULL );
+	SimThink_EntityChanged( pChild );
 	pParent->RecalcHasPlayerChildBit();
 }
 
@@ -14,6 +14,7 @@
 #include "nav_mesh.h"
 #include "nav_node.h"
 #include "nav_pathfind.h"
+#include "nav_pathrequest.h"
 #include "nav_colors.h"
 #include "fmtstr.h"
 #include "props_shared.h"
@@ -30,8 +31,10 @@ extern void HintMessageToAllPlayers( const char *message );
 unsigned int CNavArea::m_nextID = 1;
 NavAreaList TheNavAreaList;
 
-unsigned int CNavArea::m_masterMarker = 1;
-CNavArea *CNavArea::m_openList = NULL;
+int CNavSearchContext::m_currentGeneration = 0;
+
+static CNavSearchContext s_mainSearchContext;
+static CThreadLocalPtr< CNavSearchContext > s_activeSearchContext;
 
 bool CNavArea::m_isReset = false;
 
@@ -54,6 +57,8 @@ void CNavArea::CompressIDs( void )
 		TheNavMesh->RemoveNavArea( area );
 		TheNavMesh->AddNavArea( area );
 	}
+
+	CNavSearchContext::InvalidateAll();
 }
 
 
@@ -63,9 +68,6 @@ void CNavArea::CompressIDs( void )
  */
 void CNavArea::Initialize( void )
 {
-	m_marker = 0;
-	m_parent = NULL;
-	m_parentHow = GO_NORTH;
 	m_attributeFlags = 0;
 	m_place = TheNavMesh->GetNavPlace();
 	m_isBlocked = false;
@@ -214,6 +216,8 @@ CNavArea::~CNavArea()
 	if (m_isReset)
 		return;
 
+	TheNavPathRequests.OnAreaDestroyed( this );
+
 	// tell the other areas we are going away
 	FOR_EACH_LL( TheNavAreaList, it )
 	{
@@ -2239,113 +2243,222 @@ void CNavArea::DrawConnectedAreas( void ) const
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+CNavSearchContext::CNavSearchContext( void )
+{
+	m_masterMarker = 1;
+	m_nextOpenOrder = 0;
+	m_generation = m_currentGeneration;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+CNavSearchContext *CNavSearchContext::GetActive( void )
+{
+	CNavSearchContext *context = s_activeSearchContext;
+	if (context)
+		return context;
+
+	AssertMsg( ThreadInMainThread(), "Nav mesh search on a thread without a search context" );
+	return &s_mainSearchContext;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::SetActive( CNavSearchContext *context )
+{
+	s_activeSearchContext = context;
+}
+
 //--------------------------------------------------------------------------------------------------------------
 /**
- * Add to open list in decreasing value order
+ * Contexts notice the change at the start of their next search, so this must not be called while
+ * any search is running
  */
-void CNavArea::AddToOpenList( void )
+void CNavSearchContext::InvalidateAll( void )
 {
-	// mark as being on open list for quick check
-	m_openMarker = m_masterMarker;
+	++m_currentGeneration;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::GrowState( unsigned int id )
+{
+	int oldCount = m_state.Count();
+	m_state.AddMultipleToTail( id + 1 - oldCount );
+
+	// a marker of zero is never current
+	memset( &m_state[ oldCount ], 0, (m_state.Count() - oldCount) * sizeof( AreaState ) );
+}
 
-	// if list is empty, add and return
-	if (m_openList == NULL)
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::MakeNewMarker( void )
+{
+	if (m_generation != m_currentGeneration)
 	{
-		m_openList = this;
-		this->m_prevOpen = NULL;
-		this->m_nextOpen = NULL;
-		return;
+		m_state.RemoveAll();
+		m_generation = m_currentGeneration;
 	}
 
-	// insert self in ascending cost order
-	CNavArea *area, *last = NULL;
-	for( area = m_openList; area; area = area->m_nextOpen )
+	++m_masterMarker;
+	if (m_masterMarker == 0)
 	{
-		if (this->GetTotalCost() < area->GetTotalCost())
-			break;
-
-		last = area;
+		// old marks would look current again
+		m_state.RemoveAll();
+		m_masterMarker = 1;
 	}
+}
 
-	if (area)
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Clears the open and closed lists for a new search
+ */
+void CNavSearchContext::ClearSearchLists( void )
+{
+	// effectively clears all open list flags and closed flags
+	MakeNewMarker();
+
+	m_openList.RemoveAll();
+	m_nextOpenOrder = 0;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Open list order is by total cost, then by the order areas were added or updated. This is the order
+ * the sorted list this heap replaced kept.
+ */
+bool CNavSearchContext::IsCheaper( const OpenEntry &a, const OpenEntry &b )
+{
+	if (a.totalCost != b.totalCost)
+		return a.totalCost < b.totalCost;
+
+	return a.order < b.order;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::MoveOpenEntry( int from, int to )
+{
+	m_openList[ to ] = m_openList[ from ];
+	State( m_openList[ to ].area ).openIndex = to;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::SiftUp( int index )
+{
+	OpenEntry entry = m_openList[ index ];
+
+	while( index > 0 )
 	{
-		// insert before this area
-		this->m_prevOpen = area->m_prevOpen;
-		if (this->m_prevOpen)
-			this->m_prevOpen->m_nextOpen = this;
-		else
-			m_openList = this;
+		int parent = (index - 1) / 2;
+		if (!IsCheaper( entry, m_openList[ parent ] ))
+			break;
 
-		this->m_nextOpen = area;
-		area->m_prevOpen = this;
+		MoveOpenEntry( parent, index );
+		index = parent;
 	}
-	else
+
+	m_openList[ index ] = entry;
+	State( entry.area ).openIndex = index;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavSearchContext::SiftDown( int index )
+{
+	OpenEntry entry = m_openList[ index ];
+	int count = m_openList.Count();
+
+	while( true )
 	{
-		// append to end of list
-		last->m_nextOpen = this;
+		int child = 2 * index + 1;
+		if (child >= count)
+			break;
+
+		if (child + 1 < count && IsCheaper( m_openList[ child + 1 ], m_openList[ child ] ))
+			++child;
+
+		if (!IsCheaper( m_openList[ child ], entry ))
+			break;
 
-		this->m_prevOpen = last;
-		this->m_nextOpen = NULL;
+		MoveOpenEntry( child, index );
+		index = child;
 	}
+
+	m_openList[ index ] = entry;
+	State( entry.area ).openIndex = index;
 }
 
 //--------------------------------------------------------------------------------------------------------------
 /**
- * A smaller value has been found, update this area on the open list
- * @todo "bubbling" does unnecessary work, since the order of all other nodes will be unchanged - only this node is altered
+ * Add to the open list, a binary heap keyed on total cost. The area's total cost must be set first.
  */
-void CNavArea::UpdateOnOpenList( void )
+void CNavSearchContext::AddToOpenList( CNavArea *area )
 {
-	// since value can only decrease, bubble this area up from current spot
-	while( m_prevOpen && 
-				 this->GetTotalCost() < m_prevOpen->GetTotalCost() )
-	{
-		// swap position with predecessor
-		CNavArea *other = m_prevOpen;
-		CNavArea *before = other->m_prevOpen;
-		CNavArea *after  = this->m_nextOpen;
+	AreaState &state = State( area );
 
-		this->m_nextOpen = other;
-		this->m_prevOpen = before;
+	// mark as being on open list for quick check
+	state.openMarker = m_masterMarker;
 
-		other->m_prevOpen = this;
-		other->m_nextOpen = after;
+	int index = m_openList.AddToTail();
+	m_openList[ index ].totalCost = state.totalCost;
+	m_openList[ index ].order = m_nextOpenOrder++;
+	m_openList[ index ].area = area;
 
-		if (before)
-			before->m_nextOpen = this;
-		else
-			m_openList = this;
+	SiftUp( index );
+}
 
-		if (after)
-			after->m_prevOpen = other;
-	}
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A smaller total cost has been found, move this area up the open list heap
+ */
+void CNavSearchContext::UpdateOnOpenList( CNavArea *area )
+{
+	const AreaState &state = State( area );
+	Assert( state.openMarker == m_masterMarker );
+
+	OpenEntry &entry = m_openList[ state.openIndex ];
+	Assert( state.totalCost <= entry.totalCost );
+
+	// the old list put an updated area behind the areas of equal cost already on it
+	entry.totalCost = state.totalCost;
+	entry.order = m_nextOpenOrder++;
+
+	SiftUp( state.openIndex );
 }
 
 //--------------------------------------------------------------------------------------------------------------
-void CNavArea::RemoveFromOpenList( void )
+void CNavSearchContext::RemoveFromOpenList( CNavArea *area )
 {
-	if (m_prevOpen)
-		m_prevOpen->m_nextOpen = m_nextOpen;
-	else
-		m_openList = m_nextOpen;
+	AreaState &state = State( area );
+	Assert( state.openMarker == m_masterMarker );
 
-	if (m_nextOpen)
-		m_nextOpen->m_prevOpen = m_prevOpen;
+	int index = state.openIndex;
+	int last = m_openList.Count() - 1;
+	if (index != last)
+	{
+		// fill the hole with the last entry, then restore heap order around it
+		CNavArea *moved = m_openList[ last ].area;
+		MoveOpenEntry( last, index );
+		m_openList.Remove( last );
+
+		SiftUp( index );
+		SiftDown( State( moved ).openIndex );
+	}
+	else
+	{
+		m_openList.Remove( last );
+	}
 
 	// zero is an invalid marker
-	m_openMarker = 0;
+	state.openMarker = 0;
 }
 
 //--------------------------------------------------------------------------------------------------------------
-/**
- * Clears the open and closed lists for a new search
- */
-void CNavArea::ClearSearchLists( void )
+CNavArea *CNavSearchContext::PopOpenList( void )
 {
-	// effectively clears all open list pointers and closed flags
-	CNavArea::MakeNewMarker();
+	if (m_openList.Count() == 0)
+		return NULL;
 
-	m_openList = NULL;
+	CNavArea *area = m_openList[0].area;
+	RemoveFromOpenList( area );
+
+	return area;
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -2547,6 +2660,19 @@ static Vector FindPositionInArea( CNavArea *area, NavCornerType corner )
  * Analyze local area neighborhood to find "hiding spots" for this area
  */
 void CNavArea::ComputeHidingSpots( void )
+{
+	HidingSpotCandidate spots[ NUM_CORNERS ];
+	int count = FindHidingSpots( spots );
+
+	AddHidingSpots( spots, count );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Find where this area's hiding spots go and whether they are in cover.  Neither this area nor the mesh is
+ * changed, so areas can be searched at the same time on the job threads.  Returns the number of spots.
+ */
+int CNavArea::FindHidingSpots( HidingSpotCandidate *spots )
 {
 	struct
 	{
@@ -2554,16 +2680,15 @@ void CNavArea::ComputeHidingSpots( void )
 	}
 	extent;
 
-	m_hidingSpotList.PurgeAndDeleteElements();
-
+	int count = 0;
 
 	// "jump areas" cannot have hiding spots
 	if ( GetAttributes() & NAV_MESH_JUMP )
-		return;
+		return count;
 
 	// "don't hide areas" cannot have hiding spots
 	if ( GetAttributes() & NAV_MESH_DONT_HIDE )
-		return;
+		return count;
 
 	int cornerCount[NUM_CORNERS];
 	for( int i=0; i<NUM_CORNERS; ++i )
@@ -2652,15 +2777,43 @@ void CNavArea::ComputeHidingSpots( void )
 		if (cornerCount[c] == 2)
 		{
 			Vector pos = FindPositionInArea( this, (NavCornerType)c );
-			if ( !c || !IsHidingSpotCollision( pos ) )
+
+			// the spots found so far are the ones this area will have, like IsHidingSpotCollision() checks
+			bool isCollision = false;
+			for( int s=0; c && s<count; ++s )
 			{
-				HidingSpot *spot = TheNavMesh->CreateHidingSpot();
-				spot->SetPosition( pos );
-				spot->SetFlags( IsHidingSpotInCover( pos ) ? HidingSpot::IN_COVER : HidingSpot::EXPOSED );
-				m_hidingSpotList.AddToTail( spot );
+				if ((spots[s].pos - pos).IsLengthLessThan( 30.0f ))
+					isCollision = true;
+			}
+
+			if ( !isCollision )
+			{
+				spots[ count ].pos = pos;
+				spots[ count ].flags = IsHidingSpotInCover( pos ) ? HidingSpot::IN_COVER : HidingSpot::EXPOSED;
+				++count;
 			}
 		}
 	}
+
+	return count;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Replace this area's hiding spots with the given ones.  Spots get their IDs as they are created, so areas
+ * must be given their spots in the same order to come out the same.
+ */
+void CNavArea::AddHidingSpots( const HidingSpotCandidate *spots, int count )
+{
+	m_hidingSpotList.PurgeAndDeleteElements();
+
+	for( int s=0; s<count; ++s )
+	{
+		HidingSpot *spot = TheNavMesh->CreateHidingSpot();
+		spot->SetPosition( spots[s].pos );
+		spot->SetFlags( spots[s].flags );
+		m_hidingSpotList.AddToTail( spot );
+	}
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -2831,8 +2984,14 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 	Vector dir = e->path.to - e->path.from;
 	float length = dir.NormalizeInPlace();
 
-	// create unique marker to flag used spots
-	HidingSpot::ChangeMasterMarker();
+	// flag used spots by their index in TheHidingSpotList rather than with the spots' own markers,
+	// so several areas can compute their encounters at once
+	CUtlVector< bool > isSpotUsed;
+	isSpotUsed.SetCount( TheHidingSpotList.MaxElementIndex() );
+	for( int i=0; i<isSpotUsed.Count(); ++i )
+	{
+		isSpotUsed[i] = false;
+	}
 
 	const float stepSize = 25.0f;		// 50
 	const float seeSpotRange = 2000.0f;	// 3000
@@ -2865,7 +3024,7 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 			if (!spot->HasGoodCover())
 				continue;
 
-			if (spot->IsMarked())
+			if (isSpotUsed[ it ])
 				continue;
 
 			const Vector &spotPos = spot->GetPosition();
@@ -2901,7 +3060,7 @@ void CNavArea::AddSpotEncounters( const CNavArea *from, NavDirType fromDir, cons
 			}
 
 			// mark spot as encountered
-			spot->Mark();
+			isSpotUsed[ it ] = true;
 		}
 	}
 
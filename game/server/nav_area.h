@@ -115,6 +115,15 @@ extern HidingSpotList TheHidingSpotList;
 
 extern HidingSpot *GetHidingSpotByID( unsigned int id );
 
+/**
+ * Where a hiding spot goes, found ahead of creating the spot
+ */
+struct HidingSpotCandidate
+{
+	Vector pos;
+	int flags;
+};
+
 
 //--------------------------------------------------------------------------------------------------------------
 /**
@@ -226,6 +235,8 @@ public:
 	//- hiding spots ------------------------------------------------------------------------------------
 	const HidingSpotList *GetHidingSpotList( void ) const	{ return &m_hidingSpotList; }
 	void ComputeHidingSpots( void );							///< analyze local area neighborhood to find "hiding spots" in this area - for map learning
+	int FindHidingSpots( HidingSpotCandidate *spots );			///< find up to NUM_CORNERS spots ComputeHidingSpots() would create, without creating them - only traces, so safe on the job threads
+	void AddHidingSpots( const HidingSpotCandidate *spots, int count );	///< replace this area's hiding spots with spots found by FindHidingSpots()
 	void ComputeSniperSpots( void );							///< analyze local area neighborhood to find "sniper spots" in this area - for map learning
 
 	SpotEncounter *GetSpotEncounter( const CNavArea *from, const CNavArea *to );	///< given the areas we are moving between, return the spots we will encounter
@@ -269,20 +280,21 @@ public:
 	unsigned char GetPlayerCount( int teamID = 0 ) const;		///< return number of players of given team currently within this area (team of zero means any/all)
 
 	//- A* pathfinding algorithm ------------------------------------------------------------------------
-	static void MakeNewMarker( void )	{ ++m_masterMarker; if (m_masterMarker == 0) m_masterMarker = 1; }
-	void Mark( void )					{ m_marker = m_masterMarker; }
-	BOOL IsMarked( void ) const			{ return (m_marker == m_masterMarker) ? true : false; }
+	// Search state is kept in the CNavSearchContext active on the calling thread (see below)
+	static void MakeNewMarker( void );
+	void Mark( void );
+	BOOL IsMarked( void ) const;
 	
-	void SetParent( CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES )	{ m_parent = parent; m_parentHow = how; }
-	CNavArea *GetParent( void ) const	{ return m_parent; }
-	NavTraverseType GetParentHow( void ) const	{ return m_parentHow; }
+	void SetParent( CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES );
+	CNavArea *GetParent( void ) const;
+	NavTraverseType GetParentHow( void ) const;
 
 	bool IsOpen( void ) const;									///< true if on "open list"
-	void AddToOpenList( void );									///< add to open list in decreasing value order
+	void AddToOpenList( void );									///< add to the open list, a binary heap keyed on total cost
 	void UpdateOnOpenList( void );								///< a smaller value has been found, update this area on the open list
 	void RemoveFromOpenList( void );
 	static bool IsOpenListEmpty( void );
-	static CNavArea *PopOpenList( void );						///< remove and return the first element of the open list													
+	static CNavArea *PopOpenList( void );						///< remove and return the cheapest area on the open list													
 
 	bool IsClosed( void ) const;								///< true if on "closed list"
 	void AddToClosedList( void );								///< add to the closed list
@@ -290,11 +302,11 @@ public:
 
 	static void ClearSearchLists( void );						///< clears the open and closed lists for a new search
 
-	void SetTotalCost( float value )	{ m_totalCost = value; }
-	float GetTotalCost( void ) const	{ return m_totalCost; }
+	void SetTotalCost( float value );
+	float GetTotalCost( void ) const;
 
-	void SetCostSoFar( float value )	{ m_costSoFar = value; }
-	float GetCostSoFar( void ) const	{ return m_costSoFar; }
+	void SetCostSoFar( float value );
+	float GetCostSoFar( void ) const;
 
 	//- editing -----------------------------------------------------------------------------------------
 	void Draw( void ) const;					///< draw area for debugging & editing
@@ -375,18 +387,6 @@ private:
 
 	void Strip( void );											///< remove "analyzed" data from nav area
 
-	//- A* pathfinding algorithm ------------------------------------------------------------------------
-	static unsigned int m_masterMarker;
-	unsigned int m_marker;										///< used to flag the area as visited
-	CNavArea *m_parent;											///< the area just prior to this on in the search path
-	NavTraverseType m_parentHow;								///< how we get from parent to us
-	float m_totalCost;											///< the distance so far plus an estimate of the distance left
-	float m_costSoFar;											///< distance travelled so far
-
-	static CNavArea *m_openList;
-	CNavArea *m_nextOpen, *m_prevOpen;							///< only valid if m_openMarker == m_masterMarker
-	unsigned int m_openMarker;									///< if this equals the current marker value, we are on the open list
-
 	//- connections to adjacent areas -------------------------------------------------------------------
 	NavConnectList m_connect[ NUM_DIRECTIONS ];					///< a list of adjacent areas for each direction
 	NavLadderConnectList m_ladder[ CNavLadder::NUM_LADDER_DIRECTIONS ];	///< list of ladders leading up and down from this area
@@ -415,6 +415,86 @@ typedef CUtlLinkedList< CNavArea *, int > NavAreaList;
 extern NavAreaList TheNavAreaList;
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Scratch state for searching the nav mesh: the visited marks, parents and costs of each area, indexed
+ * by area ID, and the open list.
+ * The CNavArea search methods use the context that is active on the calling thread. The main thread
+ * has a default context. Other threads must activate a context of their own before searching, and
+ * nothing may change the mesh while they search.
+ */
+class CNavSearchContext
+{
+public:
+	CNavSearchContext( void );
+
+	static CNavSearchContext *GetActive( void );				///< the context searches on the calling thread use
+	static void SetActive( CNavSearchContext *context );		///< use 'context' on the calling thread, or the default if NULL
+	static void InvalidateAll( void );							///< area IDs have been reassigned - forget the state of every area, in every context
+
+	void MakeNewMarker( void );
+	void Mark( const CNavArea *area )							{ State( area ).marker = m_masterMarker; }
+	bool IsMarked( const CNavArea *area )						{ return State( area ).marker == m_masterMarker; }
+
+	void SetParent( const CNavArea *area, CNavArea *parent, NavTraverseType how = NUM_TRAVERSE_TYPES );
+	CNavArea *GetParent( const CNavArea *area )					{ return State( area ).parent; }
+	NavTraverseType GetParentHow( const CNavArea *area )		{ return State( area ).parentHow; }
+
+	bool IsOpen( const CNavArea *area )							{ return State( area ).openMarker == m_masterMarker; }
+	void AddToOpenList( CNavArea *area );						///< add to the open list, a binary heap keyed on total cost
+	void UpdateOnOpenList( CNavArea *area );					///< a smaller total cost has been found, update the area's place on the open list
+	void RemoveFromOpenList( CNavArea *area );
+	bool IsOpenListEmpty( void ) const							{ return m_openList.Count() == 0; }
+	CNavArea *PopOpenList( void );								///< remove and return the cheapest area on the open list
+
+	bool IsClosed( const CNavArea *area );						///< true if visited and not on the open list
+	void AddToClosedList( const CNavArea *area )				{ Mark( area ); }
+
+	void ClearSearchLists( void );								///< clears the open and closed lists for a new search
+
+	void SetTotalCost( const CNavArea *area, float value )		{ State( area ).totalCost = value; }
+	float GetTotalCost( const CNavArea *area )					{ return State( area ).totalCost; }
+
+	void SetCostSoFar( const CNavArea *area, float value )		{ State( area ).costSoFar = value; }
+	float GetCostSoFar( const CNavArea *area )					{ return State( area ).costSoFar; }
+
+private:
+	struct AreaState
+	{
+		unsigned int marker;									///< used to flag the area as visited
+		unsigned int openMarker;								///< if this equals the current marker value, the area is on the open list
+		CNavArea *parent;										///< the area just prior to this on in the search path
+		NavTraverseType parentHow;								///< how we get from parent to us
+		float totalCost;										///< the distance so far plus an estimate of the distance left
+		float costSoFar;										///< distance travelled so far
+		int openIndex;											///< position in m_openList, only valid while open
+	};
+
+	struct OpenEntry
+	{
+		float totalCost;
+		unsigned int order;										///< areas of equal cost come off the list in the order they went on
+		CNavArea *area;
+	};
+
+	AreaState &State( const CNavArea *area );
+	void GrowState( unsigned int id );
+
+	static bool IsCheaper( const OpenEntry &a, const OpenEntry &b );
+	void MoveOpenEntry( int from, int to );
+	void SiftUp( int index );
+	void SiftDown( int index );
+
+	CUtlVector< AreaState > m_state;							///< indexed by area ID
+	CUtlVector< OpenEntry > m_openList;							///< binary heap, cheapest area first
+	unsigned int m_masterMarker;
+	unsigned int m_nextOpenOrder;
+	int m_generation;											///< InvalidateAll() count when m_state was last cleared
+
+	static int m_currentGeneration;
+};
+
+
 //--------------------------------------------------------------------------------------------------------------
 //--------------------------------------------------------------------------------------------------------------
 //
@@ -441,41 +521,107 @@ inline CNavArea *CNavArea::GetAdjacentArea( NavDirType dir, int i ) const
 	return NULL;
 }
 
+//--------------------------------------------------------------------------------------------------------------
+inline CNavSearchContext::AreaState &CNavSearchContext::State( const CNavArea *area )
+{
+	unsigned int id = area->GetID();
+	if (id >= (unsigned int)m_state.Count())
+		GrowState( id );
+
+	return m_state[ id ];
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavSearchContext::SetParent( const CNavArea *area, CNavArea *parent, NavTraverseType how )
+{
+	AreaState &state = State( area );
+	state.parent = parent;
+	state.parentHow = how;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavSearchContext::IsClosed( const CNavArea *area )
+{
+	const AreaState &state = State( area );
+	return (state.marker == m_masterMarker && state.openMarker != m_masterMarker);
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::MakeNewMarker( void )
+{
+	CNavSearchContext::GetActive()->MakeNewMarker();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::Mark( void )
+{
+	CNavSearchContext::GetActive()->Mark( this );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline BOOL CNavArea::IsMarked( void ) const
+{
+	return CNavSearchContext::GetActive()->IsMarked( this );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::SetParent( CNavArea *parent, NavTraverseType how )
+{
+	CNavSearchContext::GetActive()->SetParent( this, parent, how );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline CNavArea *CNavArea::GetParent( void ) const
+{
+	return CNavSearchContext::GetActive()->GetParent( this );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline NavTraverseType CNavArea::GetParentHow( void ) const
+{
+	return CNavSearchContext::GetActive()->GetParentHow( this );
+}
+
 //--------------------------------------------------------------------------------------------------------------
 inline bool CNavArea::IsOpen( void ) const
 {
-	return (m_openMarker == m_masterMarker) ? true : false;
+	return CNavSearchContext::GetActive()->IsOpen( this );
 }
 
 //--------------------------------------------------------------------------------------------------------------
-inline bool CNavArea::IsOpenListEmpty( void )
+inline void CNavArea::AddToOpenList( void )
 {
-	return (m_openList) ? false : true;
+	CNavSearchContext::GetActive()->AddToOpenList( this );
 }
 
 //--------------------------------------------------------------------------------------------------------------
-inline CNavArea *CNavArea::PopOpenList( void )
+inline void CNavArea::UpdateOnOpenList( void )
 {
-	if (m_openList)
-	{
-		CNavArea *area = m_openList;
-	
-		// disconnect from list
-		area->RemoveFromOpenList();
+	CNavSearchContext::GetActive()->UpdateOnOpenList( this );
+}
 
-		return area;
-	}
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::RemoveFromOpenList( void )
+{
+	CNavSearchContext::GetActive()->RemoveFromOpenList( this );
+}
 
-	return NULL;
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavArea::IsOpenListEmpty( void )
+{
+	return CNavSearchContext::GetActive()->IsOpenListEmpty();
 }
 
 //--------------------------------------------------------------------------------------------------------------
-inline bool CNavArea::IsClosed( void ) const
+inline CNavArea *CNavArea::PopOpenList( void )
 {
-	if (IsMarked() && !IsOpen())
-		return true;
+	return CNavSearchContext::GetActive()->PopOpenList();
+}
 
-	return false;
+//--------------------------------------------------------------------------------------------------------------
+inline bool CNavArea::IsClosed( void ) const
+{
+	return CNavSearchContext::GetActive()->IsClosed( this );
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -490,6 +636,36 @@ inline void CNavArea::RemoveFromClosedList( void )
 	// since "closed" is defined as visited (marked) and not on open list, do nothing
 }
 
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::ClearSearchLists( void )
+{
+	CNavSearchContext::GetActive()->ClearSearchLists();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::SetTotalCost( float value )
+{
+	CNavSearchContext::GetActive()->SetTotalCost( this, value );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetTotalCost( void ) const
+{
+	return CNavSearchContext::GetActive()->GetTotalCost( this );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline void CNavArea::SetCostSoFar( float value )
+{
+	CNavSearchContext::GetActive()->SetCostSoFar( this, value );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+inline float CNavArea::GetCostSoFar( void ) const
+{
+	return CNavSearchContext::GetActive()->GetCostSoFar( this );
+}
+
 //--------------------------------------------------------------------------------------------------------------
 inline void CNavArea::SetClearedTimestamp( int teamID )
 {
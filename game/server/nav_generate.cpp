@@ -15,6 +15,10 @@
 #include "nav_node.h"
 #include "nav_pathfind.h"
 #include "viewport_panel_names.h"
+#include "serverjobs.h"
+#include "utlmap.h"
+#include "utlbuffer.h"
+#include "filesystem.h"
 
 enum { MAX_BLOCKED_AREAS = 256 };
 static unsigned int blockedID[ MAX_BLOCKED_AREAS ];
@@ -24,6 +28,155 @@ static float lastMsgTime = 0.0f;
 
 ConVar nav_slope_limit( "nav_slope_limit", "0.7", FCVAR_GAMEDLL, "The ground unit normal's Z component must be greater than this for nav areas to be generated." );
 ConVar nav_restart_after_analysis( "nav_restart_after_analysis", "1", FCVAR_GAMEDLL, "When nav nav_restart_after_analysis finishes, restart the server.  Turning this off can cause crashes, but is useful for incremental generation." );
+ConVar nav_generate_parallel( "nav_generate_parallel", "0", FCVAR_GAMEDLL, "Sample walkable space and analyze areas on the server's job threads while generating a Navigation Mesh. Experimental: the jobs trace through the engine from the job threads. nav_generate_compare checks the mesh comes out the same." );
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return true if generation work should be spread across the server's job threads
+ */
+static bool UseParallelGeneration( void )
+{
+	return nav_generate_parallel.GetBool() && ServerJobThreadCount() > 1;
+}
+
+
+static bool TestSampleStep( const Vector &from, NavDirType dir, Vector *stepTo, Vector *stepToNormal );
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The outcome of a sampling step from a position in one direction
+ */
+struct SampleStepResult
+{
+	Vector to;
+	Vector toNormal;
+	bool isWalkable;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Sampling steps, tested ahead of the node search by flood filling the walkable space from where the
+ * search starts, a batch of positions at a time on the server's job threads.  A step only depends on the
+ * position it is taken from, so the search builds the same nodes from these as it would testing the steps
+ * itself.
+ */
+class CSampleStepCache
+{
+public:
+	CSampleStepCache( void ) : m_index( 0, 0, PositionLessFunc )
+	{
+		m_nextToTest = 0;
+	}
+
+	bool IsKnown( const Vector &pos ) const		{ return m_index.Find( pos ) != m_index.InvalidIndex(); }
+	void AddSeed( const Vector &pos )				{ AddPosition( pos ); }	///< flood fill from this position
+	bool IsFilling( void ) const					{ return m_nextToTest < m_positions.Count(); }
+	void Fill( void );															///< test the steps from the next batch of positions
+
+	const SampleStepResult *GetSteps( const Vector &from ) const;				///< the step in each direction from 'from', or NULL if not tested
+
+private:
+	static bool PositionLessFunc( const Vector &lhs, const Vector &rhs );
+	static void TestRange( void *context, int first, int last );
+
+	void AddPosition( const Vector &pos );
+
+	CUtlMap< Vector, int, int > m_index;						///< where each position is in m_positions
+	CUtlVector< Vector > m_positions;							///< positions in the order the flood fill reached them
+	CUtlVector< SampleStepResult > m_steps;						///< NUM_DIRECTIONS steps for each tested position
+	int m_nextToTest;											///< positions before this have had their steps tested
+};
+
+static CSampleStepCache *s_sampleStepCache = NULL;				///< non-NULL while sampling on the job threads
+
+
+//--------------------------------------------------------------------------------------------------------------
+bool CSampleStepCache::PositionLessFunc( const Vector &lhs, const Vector &rhs )
+{
+	if (lhs.x != rhs.x)
+		return lhs.x < rhs.x;
+
+	if (lhs.y != rhs.y)
+		return lhs.y < rhs.y;
+
+	return lhs.z < rhs.z;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CSampleStepCache::AddPosition( const Vector &pos )
+{
+	if (IsKnown( pos ))
+		return;
+
+	m_index.Insert( pos, m_positions.AddToTail( pos ) );
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Test the steps from a batch of the positions reached so far, and add the positions their walkable steps
+ * lead to
+ */
+void CSampleStepCache::Fill( void )
+{
+	int first = m_nextToTest;
+	int count = min( m_positions.Count() - first, 256 * ServerJobThreadCount() );
+
+	m_steps.SetCount( NUM_DIRECTIONS * (first + count) );
+
+	// generation spans live frames, so entities may have moved - don't let the traces
+	// update the partition from the job threads
+	UpdateDirtySpatialPartitionEntities();
+	ServerJobs_ParallelFor( count, 16, TestRange, this, 1 );
+
+	m_nextToTest = first + count;
+
+	for( int i=first; i<m_nextToTest; ++i )
+	{
+		for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+		{
+			const SampleStepResult &step = m_steps[ NUM_DIRECTIONS * i + dir ];
+			if (step.isWalkable)
+			{
+				AddPosition( step.to );
+			}
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CSampleStepCache::TestRange( void *context, int first, int last )
+{
+	CSampleStepCache *cache = (CSampleStepCache *)context;
+
+	for( int i=cache->m_nextToTest + first; i<cache->m_nextToTest + last; ++i )
+	{
+		for( int dir=0; dir<NUM_DIRECTIONS; ++dir )
+		{
+			SampleStepResult &step = cache->m_steps[ NUM_DIRECTIONS * i + dir ];
+			step.isWalkable = TestSampleStep( cache->m_positions[i], (NavDirType)dir, &step.to, &step.toNormal );
+		}
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+const SampleStepResult *CSampleStepCache::GetSteps( const Vector &from ) const
+{
+	int it = m_index.Find( from );
+	if (it == m_index.InvalidIndex())
+		return NULL;
+
+	int i = m_index[ it ];
+	if (i >= m_nextToTest)
+		return NULL;
+
+	return &m_steps[ NUM_DIRECTIONS * i ];
+}
 
 
 //--------------------------------------------------------------------------------------------------------------
@@ -1528,6 +1681,10 @@ void CNavMesh::BeginGeneration( bool incremental )
 	m_sampleTick = 0;
 	m_generationMode = (incremental) ? GENERATE_INCREMENTAL : GENERATE_FULL;
 	lastMsgTime = 0.0f;
+	ResetGenerationTimes();
+
+	delete s_sampleStepCache;
+	s_sampleStepCache = (UseParallelGeneration()) ? new CSampleStepCache : NULL;
 
 	// clear any previous mesh
 	DestroyNavigationMesh( incremental );
@@ -1604,6 +1761,7 @@ void CNavMesh::BeginAnalysis( void )
 	m_generationIndex = TheNavAreaList.Head();
 	m_generationMode = GENERATE_ANALYSIS_ONLY;
 	lastMsgTime = 0.0f;
+	ResetGenerationTimes();
 }
 
 
@@ -1683,11 +1841,157 @@ static void HideAnalysisProgress( void )
 }
 
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Runs one analysis method on a batch of areas
+ */
+struct AreaAnalysisBatch
+{
+	CNavArea **areas;
+	void (CNavArea::*analyze)( void );
+};
+
+static void AnalyzeAreaRange( void *context, int first, int last )
+{
+	AreaAnalysisBatch *batch = (AreaAnalysisBatch *)context;
+
+	for( int i=first; i<last; ++i )
+	{
+		(batch->areas[i]->*batch->analyze)();
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Run 'analyze' on the areas from 'index' on, until they are all done or 'maxTime' has passed since 'startTime'.
+ * Batches of areas are analyzed on the server's job threads, so 'analyze' may only change the area it is
+ * called on.  Returns the index of the next area to analyze.
+ */
+static int AnalyzeAreas( int index, void (CNavArea::*analyze)( void ), double startTime, float maxTime )
+{
+	int batchSize = (UseParallelGeneration()) ? 16 * ServerJobThreadCount() : 1;
+
+	CUtlVector< CNavArea * > areas;
+	areas.EnsureCapacity( batchSize );
+
+	while( index != TheNavAreaList.InvalidIndex() )
+	{
+		areas.RemoveAll();
+		while( index != TheNavAreaList.InvalidIndex() && areas.Count() < batchSize )
+		{
+			areas.AddToTail( TheNavAreaList[ index ] );
+			index = TheNavAreaList.Next( index );
+		}
+
+		AreaAnalysisBatch batch;
+		batch.areas = areas.Base();
+		batch.analyze = analyze;
+
+		UpdateDirtySpatialPartitionEntities();
+		ServerJobs_ParallelFor( areas.Count(), 1, AnalyzeAreaRange, &batch, 1 );
+
+		// don't go over our time allotment
+		if( Plat_FloatTime() - startTime > maxTime )
+			break;
+	}
+
+	return index;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The hiding spots found in a batch of areas, NUM_CORNERS for each area
+ */
+struct HidingSpotBatch
+{
+	CNavArea **areas;
+	HidingSpotCandidate *spots;
+	int *counts;
+};
+
+static void FindHidingSpotsRange( void *context, int first, int last )
+{
+	HidingSpotBatch *batch = (HidingSpotBatch *)context;
+
+	for( int i=first; i<last; ++i )
+	{
+		batch->counts[i] = batch->areas[i]->FindHidingSpots( &batch->spots[ NUM_CORNERS * i ] );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Compute the hiding spots of the areas from 'index' on, like AnalyzeAreas().  The traces for a batch of areas
+ * run on the server's job threads, then the spots are created here in area order, so they get the same IDs
+ * as they would one area at a time.  Returns the index of the next area.
+ */
+static int ComputeAreaHidingSpots( int index, double startTime, float maxTime )
+{
+	int batchSize = (UseParallelGeneration()) ? 16 * ServerJobThreadCount() : 1;
+
+	CUtlVector< CNavArea * > areas;
+	CUtlVector< HidingSpotCandidate > spots;
+	CUtlVector< int > counts;
+	areas.EnsureCapacity( batchSize );
+	spots.SetCount( NUM_CORNERS * batchSize );
+	counts.SetCount( batchSize );
+
+	while( index != TheNavAreaList.InvalidIndex() )
+	{
+		areas.RemoveAll();
+		while( index != TheNavAreaList.InvalidIndex() && areas.Count() < batchSize )
+		{
+			areas.AddToTail( TheNavAreaList[ index ] );
+			index = TheNavAreaList.Next( index );
+		}
+
+		HidingSpotBatch batch;
+		batch.areas = areas.Base();
+		batch.spots = spots.Base();
+		batch.counts = counts.Base();
+
+		UpdateDirtySpatialPartitionEntities();
+		ServerJobs_ParallelFor( areas.Count(), 1, FindHidingSpotsRange, &batch, 1 );
+
+		for( int i=0; i<areas.Count(); ++i )
+		{
+			areas[i]->AddHidingSpots( &spots[ NUM_CORNERS * i ], counts[i] );
+		}
+
+		// don't go over our time allotment
+		if( Plat_FloatTime() - startTime > maxTime )
+			break;
+	}
+
+	return index;
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Process the auto-generation for 'maxTime' seconds. return false if generation is complete.
  */
 bool CNavMesh::UpdateGeneration( float maxTime )
+{
+	GenerationStateType state = m_generationState;
+	double startTime = Plat_FloatTime();
+
+	bool isGenerating = UpdateGenerationState( maxTime );
+
+	m_generationTime[ state ] += Plat_FloatTime() - startTime;
+
+	return isGenerating;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Process the current generation state for 'maxTime' seconds. return false if generation is complete.
+ */
+bool CNavMesh::UpdateGenerationState( float maxTime )
 {
 	double startTime = Plat_FloatTime();
 
@@ -1699,14 +2003,27 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 			AnalysisProgress( "Sampling walkable space...", 100, m_sampleTick / 10, false );
 			m_sampleTick = ( m_sampleTick + 1 ) % 1000;
 
-			while ( SampleStep() )
+			while ( true )
 			{
+				// flood fill ahead of the search, if it has reached space that hasn't been filled yet
+				if ( s_sampleStepCache && s_sampleStepCache->IsFilling() )
+				{
+					s_sampleStepCache->Fill();
+				}
+				else if ( !SampleStep() )
+				{
+					break;
+				}
+
 				if ( Plat_FloatTime() - startTime > maxTime )
 				{
 					return true;
 				}
 			}
 
+			delete s_sampleStepCache;
+			s_sampleStepCache = NULL;
+
 			// sampling is complete, now build nav areas
 			m_generationState = CREATE_AREAS_FROM_SAMPLES;
 
@@ -1745,19 +2062,11 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		//---------------------------------------------------------------------------
 		case FIND_HIDING_SPOTS:
 		{
-			while( m_generationIndex != TheNavAreaList.InvalidIndex() )
+			m_generationIndex = ComputeAreaHidingSpots( m_generationIndex, startTime, maxTime );
+			if( m_generationIndex != TheNavAreaList.InvalidIndex() )
 			{
-				CNavArea *area = TheNavAreaList[ m_generationIndex ];
-				m_generationIndex = TheNavAreaList.Next( m_generationIndex );
-
-				area->ComputeHidingSpots();
-
-				// don't go over our time allotment
-				if( Plat_FloatTime() - startTime > maxTime )
-				{
-					AnalysisProgress( "Finding hiding spots...", 100, 100 * m_generationIndex / TheNavAreaList.Count() );
-					return true;
-				}
+				AnalysisProgress( "Finding hiding spots...", 100, 100 * m_generationIndex / TheNavAreaList.Count() );
+				return true;
 			}
 
 			Msg( "Finding hiding spots...DONE\n" );
@@ -1795,19 +2104,11 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		//---------------------------------------------------------------------------
 		case FIND_ENCOUNTER_SPOTS:
 		{
-			while( m_generationIndex != TheNavAreaList.InvalidIndex() )
+			m_generationIndex = AnalyzeAreas( m_generationIndex, &CNavArea::ComputeSpotEncounters, startTime, maxTime );
+			if( m_generationIndex != TheNavAreaList.InvalidIndex() )
 			{
-				CNavArea *area = TheNavAreaList[ m_generationIndex ];
-				m_generationIndex = TheNavAreaList.Next( m_generationIndex );
-
-				area->ComputeSpotEncounters();
-
-				// don't go over our time allotment
-				if( Plat_FloatTime() - startTime > maxTime )
-				{
-					AnalysisProgress( "Finding encounter spots...", 100, 100 * m_generationIndex / TheNavAreaList.Count() );
-					return true;
-				}
+				AnalysisProgress( "Finding encounter spots...", 100, 100 * m_generationIndex / TheNavAreaList.Count() );
+				return true;
 			}
 
 			Msg( "Finding encounter spots...DONE\n" );
@@ -1820,19 +2121,11 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 		//---------------------------------------------------------------------------
 		case FIND_SNIPER_SPOTS:
 		{
-			while( m_generationIndex != TheNavAreaList.InvalidIndex() )
+			m_generationIndex = AnalyzeAreas( m_generationIndex, &CNavArea::ComputeSniperSpots, startTime, maxTime );
+			if( m_generationIndex != TheNavAreaList.InvalidIndex() )
 			{
-				CNavArea *area = TheNavAreaList[ m_generationIndex ];
-				m_generationIndex = TheNavAreaList.Next( m_generationIndex );
-
-				area->ComputeSniperSpots();
-
-				// don't go over our time allotment
-				if( Plat_FloatTime() - startTime > maxTime )
-				{
-					AnalysisProgress( "Finding sniper spots...", 100, 100 * m_generationIndex / TheNavAreaList.Count() );
-					return true;
-				}
+				AnalysisProgress( "Finding sniper spots...", 100, 100 * m_generationIndex / TheNavAreaList.Count() );
+				return true;
 			}
 
 			Msg( "Finding sniper spots...DONE\n" );
@@ -1877,7 +2170,7 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 
 			HideAnalysisProgress();
 
-			if ( nav_restart_after_analysis.GetBool() )
+			if ( nav_restart_after_analysis.GetBool() || m_isBatchGeneration )
 			{
 				// save the mesh
 				if (Save())
@@ -1889,7 +2182,13 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 					const char *filename = GetFilename();
 					Msg( "ERROR: Cannot save navigation map '%s'.\n", (filename) ? filename : "(null)" );
 				}
+			}
 
+			m_generationTime[ SAVE_NAV_MESH ] = Plat_FloatTime() - startTime;
+			PrintGenerationTimes();
+
+			if ( nav_restart_after_analysis.GetBool() )
+			{
 				engine->ChangeLevel( STRING( gpGlobals->mapname ), NULL );
 			}
 
@@ -1900,6 +2199,135 @@ bool CNavMesh::UpdateGeneration( float maxTime )
 	return false;
 }
 
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Generate a Navigation Mesh for the current map and save it, all at once instead of a little on each frame.
+ * For generating meshes from scripts and on dedicated servers.
+ */
+void CNavMesh::GenerateBatch( void )
+{
+	BeginGeneration();
+
+	m_isBatchGeneration = true;
+
+	while( IsGenerating() && UpdateGeneration( FLT_MAX ) )
+	{
+	}
+
+	m_isBatchGeneration = false;
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Generate the Mesh twice in batch, first on the main thread alone and then with nav_generate_parallel, and
+ * compare the nav files the two save.  The Mesh is left as the parallel generation made it.
+ */
+void CNavMesh::CompareGeneration( void )
+{
+	const char *filename = GetFilename();
+	if (filename == NULL)
+		return;
+
+	if (ServerJobThreadCount() <= 1)
+	{
+		Warning( "The server has no job threads, so both generations run on the main thread\n" );
+	}
+
+	bool wasParallel = nav_generate_parallel.GetBool();
+	bool wasRestart = nav_restart_after_analysis.GetBool();
+	nav_restart_after_analysis.SetValue( 0 );
+
+	CUtlBuffer files[2];
+	double seconds[2];
+
+	for( int pass=0; pass<2; ++pass )
+	{
+		nav_generate_parallel.SetValue( pass );
+
+		double startTime = Plat_FloatTime();
+		GenerateBatch();
+		seconds[ pass ] = Plat_FloatTime() - startTime;
+
+		if (!filesystem->ReadFile( filename, "MOD", files[ pass ] ))
+		{
+			Warning( "Cannot read back navigation map '%s'\n", filename );
+			break;
+		}
+	}
+
+	nav_generate_parallel.SetValue( wasParallel );
+	nav_restart_after_analysis.SetValue( wasRestart );
+
+	Msg( "Generation with %d job threads:\n", ServerJobThreadCount() );
+	Msg( "  %-10s %8.2f seconds  %d bytes\n", "serial", seconds[0], files[0].TellPut() );
+	Msg( "  %-10s %8.2f seconds  %d bytes\n", "parallel", seconds[1], files[1].TellPut() );
+
+	int size = min( files[0].TellPut(), files[1].TellPut() );
+	const unsigned char *serial = (const unsigned char *)files[0].Base();
+	const unsigned char *parallel = (const unsigned char *)files[1].Base();
+
+	int differ;
+	for( differ=0; differ<size; ++differ )
+	{
+		if (serial[ differ ] != parallel[ differ ])
+			break;
+	}
+
+	if (differ == size && files[0].TellPut() == files[1].TellPut())
+	{
+		Msg( "The nav files are identical\n" );
+	}
+	else
+	{
+		Warning( "The nav files differ from byte %d\n", differ );
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavMesh::ResetGenerationTimes( void )
+{
+	for( int i=0; i<NUM_GENERATION_STATES; ++i )
+	{
+		m_generationTime[i] = 0.0;
+	}
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Report how long each phase of the generation process took
+ */
+void CNavMesh::PrintGenerationTimes( void ) const
+{
+	static const char *phaseName[ NUM_GENERATION_STATES ] =
+	{
+		"Sampling walkable space",
+		"Creating areas",
+		"Finding hiding spots",
+		"Finding approach areas",
+		"Finding encounter spots",
+		"Finding sniper spots",
+		"Finding earliest occupy times",
+		"Saving",
+	};
+
+	double total = 0.0;
+	for( int i=0; i<NUM_GENERATION_STATES; ++i )
+	{
+		total += m_generationTime[i];
+	}
+
+	Msg( "Generation time by phase:\n" );
+	for( int i=0; i<NUM_GENERATION_STATES; ++i )
+	{
+		Msg( "  %-32s %8.2f seconds\n", phaseName[i], m_generationTime[i] );
+	}
+	Msg( "  %-32s %8.2f seconds\n", "Total", total );
+}
+
+
 //--------------------------------------------------------------------------------------------------------------
 /**
  * Define the name of player spawn entities
@@ -2060,6 +2488,13 @@ bool CNavMesh::SampleStep( void )
 			}
 		}
 
+		// if the search has reached space the job threads haven't flood filled yet, fill it before going on
+		if (s_sampleStepCache && !s_sampleStepCache->IsKnown( *m_currentNode->GetPosition() ))
+		{
+			s_sampleStepCache->AddSeed( *m_currentNode->GetPosition() );
+			return true;
+		}
+
 		//
 		// Take a step from this node
 		//
@@ -2068,145 +2503,172 @@ bool CNavMesh::SampleStep( void )
 			if (!m_currentNode->HasVisited( (NavDirType)dir ))
 			{
 				// have not searched in this direction yet
+				m_generationDir = (NavDirType)dir;
 
-				// start at current node position
-				Vector pos = *m_currentNode->GetPosition();
+				// mark direction as visited
+				m_currentNode->MarkAsVisited( m_generationDir );
 
-				// snap to grid
-				int cx = SnapToGrid( pos.x );
-				int cy = SnapToGrid( pos.y );
+				// test if we can move to new position, unless the flood fill already has
+				Vector to, toNormal;
+				bool walkable;
 
-				// attempt to move to adjacent node
-				switch( dir )
+				const SampleStepResult *steps = (s_sampleStepCache) ? s_sampleStepCache->GetSteps( *m_currentNode->GetPosition() ) : NULL;
+				if (steps)
 				{
-					case NORTH:		cy -= GenerationStepSize; break;
-					case SOUTH:		cy += GenerationStepSize; break;
-					case EAST:		cx += GenerationStepSize; break;
-					case WEST:		cx -= GenerationStepSize; break;
+					to = steps[ dir ].to;
+					toNormal = steps[ dir ].toNormal;
+					walkable = steps[ dir ].isWalkable;
+				}
+				else
+				{
+					walkable = TestSampleStep( *m_currentNode->GetPosition(), m_generationDir, &to, &toNormal );
 				}
 
-				pos.x = cx;
-				pos.y = cy;
+				if (walkable)
+				{
+					// we can move here
+					// create a new navigation node, and update current node pointer
+					AddNode( to, toNormal, m_generationDir, m_currentNode );
+				}
 
-				m_generationDir = (NavDirType)dir;
+				return true;
+			}
+		}
 
-				// mark direction as visited
-				m_currentNode->MarkAsVisited( m_generationDir );
+		// all directions have been searched from this node - pop back to its parent and continue
+		m_currentNode = m_currentNode->GetParent();
+	}
+}
 
-				// test if we can move to new position
-				trace_t result;
-				Vector from, to;
 
-				// modify position to account for change in ground level during step
-				to.x = pos.x;
-				to.y = pos.y;
-				Vector toNormal;
-				if (GetGroundHeight( pos, &to.z, &toNormal ) == false)
-				{
-					return true;
-				}
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Test a sampling step from 'from' to the next grid point in direction 'dir'.
+ * Returns true if the step is walkable, along with the ground position and normal it leads to.
+ * Only reads the world and the mesh, so it can run on the server's job threads.
+ */
+static bool TestSampleStep( const Vector &from, NavDirType dir, Vector *stepTo, Vector *stepToNormal )
+{
+	// start at current node position
+	Vector pos = from;
 
-				from = *m_currentNode->GetPosition();
+	// snap to grid
+	int cx = TheNavMesh->SnapToGrid( pos.x );
+	int cy = TheNavMesh->SnapToGrid( pos.y );
 
-				Vector fromOrigin = from + Vector( 0, 0, HalfHumanHeight );
-				Vector toOrigin = to + Vector( 0, 0, HalfHumanHeight );
+	// attempt to move to adjacent node
+	switch( dir )
+	{
+		case NORTH:		cy -= GenerationStepSize; break;
+		case SOUTH:		cy += GenerationStepSize; break;
+		case EAST:		cx += GenerationStepSize; break;
+		case WEST:		cx -= GenerationStepSize; break;
+	}
 
-				CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
-				UTIL_TraceLine( fromOrigin, toOrigin, MASK_PLAYERSOLID_BRUSHONLY, &filter, &result );
+	pos.x = cx;
+	pos.y = cy;
 
-				bool walkable;
+	trace_t result;
+	Vector to;
 
-				if (result.fraction == 1.0f && !result.startsolid)
-				{
-					// the trace didnt hit anything - clear
+	// modify position to account for change in ground level during step
+	to.x = pos.x;
+	to.y = pos.y;
+	Vector toNormal;
+	if (TheNavMesh->GetGroundHeight( pos, &to.z, &toNormal ) == false)
+	{
+		return false;
+	}
 
-					float toGround = to.z;
-					float fromGround = from.z;
+	*stepTo = to;
+	*stepToNormal = toNormal;
 
-					float epsilon = 0.1f;
+	Vector fromOrigin = from + Vector( 0, 0, HalfHumanHeight );
+	Vector toOrigin = to + Vector( 0, 0, HalfHumanHeight );
 
-					// check if ledge is too high to reach or will cause us to fall to our death
-					if (toGround - fromGround > JumpCrouchHeight + epsilon || fromGround - toGround > DeathDrop)
-					{
-						walkable = false;
-					}
-					else
-					{
-						// check surface normals along this step to see if we would cross any impassable slopes
-						Vector delta = to - from;
-						const float inc = 2.0f;
-						float along = inc;
-						bool done = false;
-						float ground;
-						Vector normal;
+	CTraceFilterWalkableEntities filter( NULL, COLLISION_GROUP_NONE, WALK_THRU_EVERYTHING );
+	UTIL_TraceLine( fromOrigin, toOrigin, MASK_PLAYERSOLID_BRUSHONLY, &filter, &result );
 
-						walkable = true;
+	bool walkable;
 
-						while( !done )
-						{
-							Vector p;
-
-							// need to guarantee that we test the exact edges
-							if (along >= GenerationStepSize)
-							{
-								p = to;
-								done = true;
-							}
-							else
-							{
-								p = from + delta * (along/GenerationStepSize);
-							}
-
-							if (GetGroundHeight( p, &ground, &normal ) == false)
-							{
-								walkable = false;
-								break;
-							}
-
-							// check for maximum allowed slope
-							if (normal.z < nav_slope_limit.GetFloat())
-							{
-								walkable = false;
-								break;
-							}
-
-							along += inc;					
-						}
-					}
+	if (result.fraction == 1.0f && !result.startsolid)
+	{
+		// the trace didnt hit anything - clear
+
+		float toGround = to.z;
+		float fromGround = from.z;
+
+		float epsilon = 0.1f;
+
+		// check if ledge is too high to reach or will cause us to fall to our death
+		if (toGround - fromGround > JumpCrouchHeight + epsilon || fromGround - toGround > DeathDrop)
+		{
+			walkable = false;
+		}
+		else
+		{
+			// check surface normals along this step to see if we would cross any impassable slopes
+			Vector delta = to - from;
+			const float inc = 2.0f;
+			float along = inc;
+			bool done = false;
+			float ground;
+			Vector normal;
+
+			walkable = true;
+
+			while( !done )
+			{
+				Vector p;
+
+				// need to guarantee that we test the exact edges
+				if (along >= GenerationStepSize)
+				{
+					p = to;
+					done = true;
 				}
-				else	// TraceLine hit something...
+				else
 				{
-					if (IsEntityWalkable( result.m_pEnt, WALK_THRU_EVERYTHING ))
-					{
-						walkable = true;
-					}
-					else
-					{
-						walkable = false;
-					}
+					p = from + delta * (along/GenerationStepSize);
 				}
 
-				// if we're incrementally generating, don't overlap existing nav areas
-				CNavArea *overlap = GetNavArea( to, HumanHeight );
-				if ( overlap )
+				if (TheNavMesh->GetGroundHeight( p, &ground, &normal ) == false)
 				{
 					walkable = false;
+					break;
 				}
 
-				if (walkable)
+				// check for maximum allowed slope
+				if (normal.z < nav_slope_limit.GetFloat())
 				{
-					// we can move here
-					// create a new navigation node, and update current node pointer
-					AddNode( to, toNormal, m_generationDir, m_currentNode );
+					walkable = false;
+					break;
 				}
 
-				return true;
+				along += inc;					
 			}
 		}
+	}
+	else	// TraceLine hit something...
+	{
+		if (IsEntityWalkable( result.m_pEnt, WALK_THRU_EVERYTHING ))
+		{
+			walkable = true;
+		}
+		else
+		{
+			walkable = false;
+		}
+	}
 
-		// all directions have been searched from this node - pop back to its parent and continue
-		m_currentNode = m_currentNode->GetParent();
+	// if we're incrementally generating, don't overlap existing nav areas
+	CNavArea *overlap = TheNavMesh->GetNavArea( to, HumanHeight );
+	if ( overlap )
+	{
+		walkable = false;
 	}
+
+return walkable;
 }
 
 
@@ -13,6 +13,7 @@
 #include "filesystem.h"
 #include "nav_mesh.h"
 #include "nav_node.h"
+#include "nav_pathrequest.h"
 #include "fmtstr.h"
 #include "tier0/vprof.h"
 
@@ -67,6 +68,7 @@ void CNavMesh::Reset( void )
 	DestroyNavigationMesh();
 
 	m_generationMode = GENERATE_NONE;
+	m_isBatchGeneration = false;
 	m_currentNode = NULL;
 	ClearWalkableSeeds();
 
@@ -117,6 +119,10 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 
 		CNavArea::m_isReset = false;
 
+		// area IDs will be reused
+		TheNavPathRequests.OnMeshDestroyed();
+		CNavSearchContext::InvalidateAll();
+
 
 		// destroy ladder representations
 		DestroyLadders();
@@ -142,6 +148,7 @@ void CNavMesh::DestroyNavigationMesh( bool incremental )
 	CNavNode::m_list = NULL;
 	CNavNode::m_listLength = 0;
 	CNavNode::m_nextID = 1;
+	Q_memset( CNavNode::m_hashTable, 0, sizeof( CNavNode::m_hashTable ) );
 
 	if ( !incremental )
 	{
@@ -202,6 +209,9 @@ void CNavMesh::Update( void )
 		return; // don't bother trying to draw stuff while we're generating
 	}
 
+	// answer last frame's path requests
+	TheNavPathRequests.Update();
+
 	if (nav_edit.GetBool())
 	{
 		if (m_isEditing == false)
@@ -1038,8 +1048,8 @@ void CNavMesh::IncreaseDangerNearby( int teamID, float amount, CNavArea *startAr
 	CNavArea::MakeNewMarker();
 	CNavArea::ClearSearchLists();
 
-	startArea->AddToOpenList();
 	startArea->SetTotalCost( 0.0f );
+	startArea->AddToOpenList();
 	startArea->Mark();
 	startArea->IncreaseDanger( teamID, amount );
 
@@ -1062,8 +1072,8 @@ void CNavMesh::IncreaseDangerNearby( int teamID, float amount, CNavArea *startAr
 					float cost = (adjArea->GetCenter() - pos).Length();
 					if (cost <= maxRadius)
 					{
-						adjArea->AddToOpenList();
 						adjArea->SetTotalCost( cost );
+						adjArea->AddToOpenList();
 						adjArea->Mark();
 						adjArea->IncreaseDanger( teamID, amount * cost/maxRadius );
 					}
@@ -1662,6 +1672,28 @@ void CommandNavGenerateIncremental( void )
 static ConCommand nav_generate_incremental( "nav_generate_incremental", CommandNavGenerateIncremental, "Generate a Navigation Mesh for the current map and save it to disk.", FCVAR_GAMEDLL | FCVAR_CHEAT );
 
 
+//--------------------------------------------------------------------------------------------------------------
+void CommandNavGenerateBatch( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavMesh->GenerateBatch();
+}
+static ConCommand nav_generate_batch( "nav_generate_batch", CommandNavGenerateBatch, "Generate a Navigation Mesh for the current map and save it to disk, all at once rather than over many frames. Reports the time each phase took.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+
+
+//--------------------------------------------------------------------------------------------------------------
+void CommandNavGenerateCompare( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	TheNavMesh->CompareGeneration();
+}
+static ConCommand nav_generate_compare( "nav_generate_compare", CommandNavGenerateCompare, "Generate a Navigation Mesh for the current map twice, on the main thread and with nav_generate_parallel, and compare the nav files they save.", FCVAR_GAMEDLL | FCVAR_CHEAT );
+
+
 //--------------------------------------------------------------------------------------------------------------
 void CommandNavAnalyze( void )
 {
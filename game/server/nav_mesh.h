@@ -84,6 +84,8 @@ public:
 	//
 	void BeginGeneration( bool incremental = false );					///< initiate the generation process
 	void BeginAnalysis( void );											///< re-analyze an existing Mesh.  Determine Hiding Spots, Encounter Spots, etc.
+	void GenerateBatch( void );											///< generate and save a Mesh all at once, instead of a little each frame
+	void CompareGeneration( void );										///< generate a Mesh with and without the job threads, and compare the results
 
 	bool IsGenerating( void ) const		{ return m_generationMode != GENERATE_NONE; }	///< return true while a Navigation Mesh is being generated
 	const char *GetPlayerSpawnName( void ) const;						///< return name of player spawn entity
@@ -265,6 +267,7 @@ private:
 	// Auto-generation
 	//
 	bool UpdateGeneration( float maxTime = 0.25f );				///< process the auto-generation for 'maxTime' seconds. return false if generation is complete.
+	bool UpdateGenerationState( float maxTime );				///< process the current state of the auto-generation, for UpdateGeneration()
 
 	CNavNode *m_currentNode;									///< the current node we are sampling from
 	NavDirType m_generationDir;
@@ -310,6 +313,11 @@ private:
 	m_generationMode;						///< true while a Navigation Mesh is being generated
 	int m_generationIndex;										///< used for iterating nav areas during generation process
 	int m_sampleTick;											///< counter for displaying pseudo-progress while sampling walkable space
+	bool m_isBatchGeneration;									///< true while GenerateBatch() is running
+
+	double m_generationTime[ NUM_GENERATION_STATES ];			///< seconds spent in each state of the generation process
+	void ResetGenerationTimes( void );
+	void PrintGenerationTimes( void ) const;
 
 	char *m_spawnName;											///< name of player spawn entity, used to initiate sampling
 
@@ -19,6 +19,7 @@ NavDirType Opposite[ NUM_DIRECTIONS ] = { SOUTH, WEST, NORTH, EAST };
 CNavNode *CNavNode::m_list = NULL;
 unsigned int CNavNode::m_listLength = 0;
 unsigned int CNavNode::m_nextID = 1;
+CNavNode *CNavNode::m_hashTable[ CNavNode::HASH_TABLE_SIZE ];
 
 ConVar nav_show_nodes( "nav_show_nodes", "0" );
 
@@ -77,6 +78,10 @@ CNavNode::CNavNode( const Vector &pos, const Vector &normal, CNavNode *parent )
 	m_list = this;
 	m_listLength++;
 
+	int key = ComputeHashKey( WorldToGrid( m_pos.x ), WorldToGrid( m_pos.y ) );
+	m_nextHash = m_hashTable[ key ];
+	m_hashTable[ key ] = this;
+
 	m_isCovered = false;
 	m_area = NULL;
 
@@ -334,17 +339,42 @@ CNavNode *CNavNode::GetNode( const Vector &pos )
 {
 	const float tolerance = 0.45f * GenerationStepSize;			// 1.0f
 
-	for( CNavNode *node = m_list; node; node = node->m_next )
+	// a node within tolerance is in one of the grid cells the tolerance box touches.
+	// the master list is newest first, so return the newest match like a search of the list would
+	CNavNode *found = NULL;
+
+	int hiX = WorldToGrid( pos.x + tolerance );
+	int hiY = WorldToGrid( pos.y + tolerance );
+	for( int x = WorldToGrid( pos.x - tolerance ); x <= hiX; ++x )
 	{
-		float dx = fabs( node->m_pos.x - pos.x );
-		float dy = fabs( node->m_pos.y - pos.y );
-		float dz = fabs( node->m_pos.z - pos.z );
+		for( int y = WorldToGrid( pos.y - tolerance ); y <= hiY; ++y )
+		{
+			for( CNavNode *node = m_hashTable[ ComputeHashKey( x, y ) ]; node; node = node->m_nextHash )
+			{
+				float dx = fabs( node->m_pos.x - pos.x );
+				float dy = fabs( node->m_pos.y - pos.y );
+				float dz = fabs( node->m_pos.z - pos.z );
 
-		if (dx < tolerance && dy < tolerance && dz < tolerance)
-			return node;
+				if (dx < tolerance && dy < tolerance && dz < tolerance)
+				{
+					if (found == NULL || node->m_id > found->m_id)
+						found = node;
+				}
+			}
+		}
 	}
 
-	return NULL;
+	return found;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Return the hash bucket for the given generation grid cell
+ */
+int CNavNode::ComputeHashKey( int gridX, int gridY )
+{
+	unsigned int key = (unsigned int)gridX * 73856093u ^ (unsigned int)gridY * 19349663u;
+	return key & (HASH_TABLE_SIZE-1);
 }
 
 //--------------------------------------------------------------------------------------------------------------
@@ -79,6 +79,12 @@ private:
 	static unsigned int m_nextID;
 	CNavNode *m_next;												///< next link in master list
 
+	enum { HASH_TABLE_SIZE = 16384 };
+	static CNavNode *m_hashTable[ HASH_TABLE_SIZE ];				///< nodes by the generation grid cell they are in, to speed up GetNode()
+	static int ComputeHashKey( int gridX, int gridY );
+	static int WorldToGrid( float w )		{ return (int)floor( w / GenerationStepSize ); }
+	CNavNode *m_nextHash;											///< next node in the same hash bucket
+
 	// below are only needed when generating
 	unsigned char m_visited;										///< flags for automatic node generation. If direction bit is clear, that direction hasn't been explored yet.
 	CNavNode *m_parent;												///< the node prior to this in the search, which we pop back to when this node's search is done (a stack)
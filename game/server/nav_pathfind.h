@@ -91,12 +91,15 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	if (goalArea == NULL && goalPos == NULL)
 		return false;
 
-	startArea->SetParent( NULL );
+	// all search state lives in the calling thread's context
+	CNavSearchContext *search = CNavSearchContext::GetActive();
+
+	search->SetParent( startArea, NULL );
 
 	// if we are already in the goal area, build trivial path
 	if (startArea == goalArea)
 	{
-		goalArea->SetParent( NULL );
+		search->SetParent( goalArea, NULL );
 		return true;
 	}
 
@@ -104,29 +107,29 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 	Vector actualGoalPos = (goalPos) ? *goalPos : goalArea->GetCenter();
 
 	// start search
-	CNavArea::ClearSearchLists();
+	search->ClearSearchLists();
 
 	// compute estimate of path length
 	/// @todo Cost might work as "manhattan distance"
-	startArea->SetTotalCost( (startArea->GetCenter() - actualGoalPos).Length() );
+	search->SetTotalCost( startArea, (startArea->GetCenter() - actualGoalPos).Length() );
 
 	float initCost = costFunc( startArea, NULL, NULL );	
 	if (initCost < 0.0f)
 		return false;
-	startArea->SetCostSoFar( initCost );
+	search->SetCostSoFar( startArea, initCost );
 
-	startArea->AddToOpenList();
+	search->AddToOpenList( startArea );
 
 	// keep track of the area we visit that is closest to the goal
 	if (closestArea)
 		*closestArea = startArea;
-	float closestAreaDist = startArea->GetTotalCost();
+	float closestAreaDist = search->GetTotalCost( startArea );
 
 	// do A* search
-	while( !CNavArea::IsOpenListEmpty() )
+	while( !search->IsOpenListEmpty() )
 	{
 		// get next area to check
-		CNavArea *area = CNavArea::PopOpenList();
+		CNavArea *area = search->PopOpenList();
 
 		// don't consider blocked areas
 		if ( area->IsBlocked() )
@@ -260,7 +263,7 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 			if (newCostSoFar < 0.0f)
 				continue;
 
-			if ((newArea->IsOpen() || newArea->IsClosed()) && newArea->GetCostSoFar() <= newCostSoFar)
+			if ((search->IsOpen( newArea ) || search->IsClosed( newArea )) && search->GetCostSoFar( newArea ) <= newCostSoFar)
 			{
 				// this is a worse path - skip it
 				continue;
@@ -277,27 +280,26 @@ bool NavAreaBuildPath( CNavArea *startArea, CNavArea *goalArea, const Vector *go
 					closestAreaDist = newCostRemaining;
 				}
 				
-				newArea->SetParent( area, how );
-				newArea->SetCostSoFar( newCostSoFar );
-				newArea->SetTotalCost( newCostSoFar + newCostRemaining );
+				search->SetParent( newArea, area, how );
+				search->SetCostSoFar( newArea, newCostSoFar );
+				search->SetTotalCost( newArea, newCostSoFar + newCostRemaining );
 
-				if (newArea->IsClosed())
-					newArea->RemoveFromClosedList();
+				// since "closed" is defined as visited (marked) and not on open list, there is nothing to remove it from
 
-				if (newArea->IsOpen())
+				if (search->IsOpen( newArea ))
 				{
 					// area already on open list, update the list order to keep costs sorted
-					newArea->UpdateOnOpenList();
+					search->UpdateOnOpenList( newArea );
 				}
 				else
 				{
-					newArea->AddToOpenList();
+					search->AddToOpenList( newArea );
 				}
 			}
 		}
 
 		// we have searched this area
-		area->AddToClosedList();
+		search->AddToClosedList( area );
 	}
 
 	return false;
@@ -397,16 +399,16 @@ float NavAreaTravelDistance( const Vector &startPos, const Vector &goalPos, Cost
  */
 
 // helper function
-inline void AddAreaToOpenList( CNavArea *area, CNavArea *parent, const Vector &startPos, float maxRange )
+inline void AddAreaToOpenList( CNavSearchContext *search, CNavArea *area, CNavArea *parent, const Vector &startPos, float maxRange )
 {
 	if (area == NULL)
 		return;
 
-	if (!area->IsMarked())
+	if (!search->IsMarked( area ))
 	{
-		area->Mark();
-		area->SetTotalCost( 0.0f );
-		area->SetParent( parent );
+		search->Mark( area );
+		search->SetTotalCost( area, 0.0f );
+		search->SetParent( area, parent );
 
 		if (maxRange > 0.0f)
 		{
@@ -416,19 +418,19 @@ inline void AddAreaToOpenList( CNavArea *area, CNavArea *parent, const Vector &s
 			if ((closePos - startPos).AsVector2D().IsLengthLessThan( maxRange ))
 			{
 				// compute approximate distance along path to limit travel range, too
-				float distAlong = parent->GetCostSoFar();
+				float distAlong = search->GetCostSoFar( parent );
 				distAlong += (area->GetCenter() - parent->GetCenter()).Length();
-				area->SetCostSoFar( distAlong );
+				search->SetCostSoFar( area, distAlong );
 
 				// allow for some fudge due to large size areas
 				if (distAlong <= 1.5f * maxRange)
-					area->AddToOpenList();
+					search->AddToOpenList( area );
 			}
 		}
 		else
 		{
 			// infinite range
-			area->AddToOpenList();
+			search->AddToOpenList( area );
 		}
 	}
 }
@@ -440,19 +442,21 @@ void SearchSurroundingAreas( CNavArea *startArea, const Vector &startPos, Functo
 	if (startArea == NULL)
 		return;
 
-	CNavArea::MakeNewMarker();
-	CNavArea::ClearSearchLists();
+	// all search state lives in the calling thread's context
+	CNavSearchContext *search = CNavSearchContext::GetActive();
+
+	search->ClearSearchLists();
 
-	startArea->AddToOpenList();
-	startArea->SetTotalCost( 0.0f );
-	startArea->SetCostSoFar( 0.0f );
-	startArea->SetParent( NULL );
-	startArea->Mark();
+	search->SetTotalCost( startArea, 0.0f );
+	search->SetCostSoFar( startArea, 0.0f );
+	search->SetParent( startArea, NULL );
+	search->Mark( startArea );
+	search->AddToOpenList( startArea );
 
-	while( !CNavArea::IsOpenListEmpty() )
+	while( !search->IsOpenListEmpty() )
 	{
 		// get next area to check
-		CNavArea *area = CNavArea::PopOpenList();
+		CNavArea *area = search->PopOpenList();
 
 		// don't use blocked areas
 		if ( area->IsBlocked() )
@@ -469,7 +473,7 @@ void SearchSurroundingAreas( CNavArea *startArea, const Vector &startPos, Functo
 				{
 					CNavArea *adjArea = area->GetAdjacentArea( (NavDirType)dir, i );
 					
-					AddAreaToOpenList( adjArea, area, startPos, maxRange );
+					AddAreaToOpenList( search, adjArea, area, startPos, maxRange );
 				}
 			}
 
@@ -485,9 +489,9 @@ void SearchSurroundingAreas( CNavArea *startArea, const Vector &startPos, Functo
 					const CNavLadder *ladder = (*ladderList)[ it ].ladder;
 
 					// do not use BEHIND connection, as its very hard to get to when going up a ladder
-					AddAreaToOpenList( ladder->m_topForwardArea, area, startPos, maxRange );
-					AddAreaToOpenList( ladder->m_topLeftArea, area, startPos, maxRange );
-					AddAreaToOpenList( ladder->m_topRightArea, area, startPos, maxRange );
+					AddAreaToOpenList( search, ladder->m_topForwardArea, area, startPos, maxRange );
+					AddAreaToOpenList( search, ladder->m_topLeftArea, area, startPos, maxRange );
+					AddAreaToOpenList( search, ladder->m_topRightArea, area, startPos, maxRange );
 				}
 			}
 
@@ -499,7 +503,7 @@ void SearchSurroundingAreas( CNavArea *startArea, const Vector &startPos, Functo
 				{
 					const CNavLadder *ladder = (*ladderList)[ it ].ladder;
 
-					AddAreaToOpenList( ladder->m_bottomArea, area, startPos, maxRange );
+					AddAreaToOpenList( search, ladder->m_bottomArea, area, startPos, maxRange );
 				}
 			}
 		}
@@ -0,0 +1,395 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_pathrequest.cpp
+// Batched path queries, run on the server job pool and answered on the next frame
+
+#include "cbase.h"
+#include "nav_mesh.h"
+#include "nav_pathfind.h"
+#include "nav_pathrequest.h"
+#include "serverjobs.h"
+#include "vstdlib/random.h"
+#include "tier0/fasttimer.h"
+#include "tier0/vprof.h"
+
+
+CNavPathRequests TheNavPathRequests;
+
+ConVar nav_parallel_paths( "nav_parallel_paths", "1", FCVAR_GAMEDLL | FCVAR_CHEAT, "If nonzero, batched path requests are searched on the server job pool." );
+
+enum { MIN_PATH_REQUESTS_PER_JOB = 2 };
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * ShortestPathCost, for requests that don't give a cost functor
+ */
+class CNavShortestPathCost : public INavPathCost
+{
+public:
+	virtual float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder )
+	{
+		return m_cost( area, fromArea, ladder );
+	}
+
+private:
+	ShortestPathCost m_cost;
+};
+
+static CNavShortestPathCost s_shortestPathCost;
+
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathRequests::CNavPathRequests( void )
+{
+	m_nextHandle = NAV_PATH_REQUEST_INVALID + 1;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+CNavPathRequests::~CNavPathRequests()
+{
+	m_contextLock.Lock();
+	m_freeContexts.PurgeAndDeleteElements();
+	m_contextLock.Unlock();
+}
+
+//--------------------------------------------------------------------------------------------------------------
+NavPathRequestHandle CNavPathRequests::RequestPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, INavPathListener *listener, INavPathCost *costFunc )
+{
+	Assert( listener );
+
+	Request &request = m_pending[ m_pending.AddToTail() ];
+	request.handle = m_nextHandle++;
+	if (m_nextHandle == NAV_PATH_REQUEST_INVALID)
+		m_nextHandle = NAV_PATH_REQUEST_INVALID + 1;
+
+	request.startArea = startArea;
+	request.goalArea = goalArea;
+	request.hasGoalPos = (goalPos != NULL);
+	request.goalPos = (goalPos) ? *goalPos : vec3_origin;
+	request.listener = listener;
+	request.costFunc = (costFunc) ? costFunc : &s_shortestPathCost;
+	request.isComplete = false;
+
+	return request.handle;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * A cancelled request keeps its place, but no one hears its answer
+ */
+void CNavPathRequests::CancelPath( NavPathRequestHandle handle )
+{
+	int i;
+	for( i=0; i<m_pending.Count(); ++i )
+	{
+		if (m_pending[i].handle == handle)
+			m_pending[i].listener = NULL;
+	}
+
+	for( i=0; i<m_batch.Count(); ++i )
+	{
+		if (m_batch[i].handle == handle)
+			m_batch[i].listener = NULL;
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathRequests::CancelPaths( INavPathListener *listener )
+{
+	int i;
+	for( i=0; i<m_pending.Count(); ++i )
+	{
+		if (m_pending[i].listener == listener)
+			m_pending[i].listener = NULL;
+	}
+
+	for( i=0; i<m_batch.Count(); ++i )
+	{
+		if (m_batch[i].listener == listener)
+			m_batch[i].listener = NULL;
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Areas are only destroyed between updates, so only pending requests can refer to them
+ */
+void CNavPathRequests::OnAreaDestroyed( CNavArea *area )
+{
+	FOR_EACH_VEC( m_pending, it )
+	{
+		Request &request = m_pending[ it ];
+		if (request.startArea == area || request.goalArea == area)
+		{
+			request.startArea = NULL;
+			request.goalArea = NULL;
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathRequests::OnMeshDestroyed( void )
+{
+	FOR_EACH_VEC( m_pending, it )
+	{
+		m_pending[ it ].startArea = NULL;
+		m_pending[ it ].goalArea = NULL;
+	}
+}
+
+//--------------------------------------------------------------------------------------------------------------
+CNavSearchContext *CNavPathRequests::AcquireContext( void )
+{
+	AUTO_LOCK_FM( m_contextLock );
+
+	if (m_freeContexts.Count() == 0)
+		return new CNavSearchContext;
+
+	CNavSearchContext *search = m_freeContexts[ m_freeContexts.Count()-1 ];
+	m_freeContexts.Remove( m_freeContexts.Count()-1 );
+	return search;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathRequests::ReleaseContext( CNavSearchContext *search )
+{
+	AUTO_LOCK_FM( m_contextLock );
+
+	m_freeContexts.AddToTail( search );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Search for one request of the batch, and copy its path out of the search context
+ */
+void CNavPathRequests::Search( int i, CNavSearchContext *search )
+{
+	Request &request = m_batch[i];
+	CUtlVector< NavPathSegment > &path = m_paths[i];
+
+	path.RemoveAll();
+	request.isComplete = false;
+
+	if (request.startArea == NULL || request.listener == NULL)
+		return;
+
+	CNavArea *closestArea = NULL;
+	const Vector *goalPos = (request.hasGoalPos) ? &request.goalPos : NULL;
+	request.isComplete = NavAreaBuildPath( request.startArea, request.goalArea, goalPos, *request.costFunc, &closestArea );
+
+	// a trivial path doesn't report a closest area
+	CNavArea *endArea = closestArea;
+	if (request.isComplete && request.startArea == request.goalArea)
+		endArea = request.goalArea;
+
+	if (endArea == NULL)
+		return;
+
+	int count = 0;
+	CNavArea *area;
+	for( area = endArea; area; area = search->GetParent( area ) )
+		++count;
+
+	path.SetCount( count );
+	for( area = endArea; area; area = search->GetParent( area ) )
+	{
+		--count;
+		path[ count ].area = area;
+		path[ count ].how = search->GetParentHow( area );
+	}
+
+	path[0].how = NUM_TRAVERSE_TYPES;
+}
+
+//--------------------------------------------------------------------------------------------------------------
+void CNavPathRequests::SearchRange( void *context, int first, int last )
+{
+	CNavPathRequests *requests = (CNavPathRequests *)context;
+
+	// search with a context of our own, so other jobs and the main thread's searches don't interfere
+	CNavSearchContext *search = requests->AcquireContext();
+	CNavSearchContext::SetActive( search );
+
+	for( int i=first; i<last; ++i )
+	{
+		requests->Search( i, search );
+	}
+
+	CNavSearchContext::SetActive( NULL );
+	requests->ReleaseContext( search );
+}
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Invoked on each game frame, while the mesh isn't being generated
+ */
+void CNavPathRequests::Update( void )
+{
+	if (m_pending.Count() == 0)
+		return;
+
+	VPROF( "CNavPathRequests::Update" );
+
+	// requests made by listeners during delivery go to the next batch
+	m_batch.Swap( m_pending );
+	m_pending.RemoveAll();
+
+	// the outer vector keeps its elements between batches, so paths reuse their memory
+	if (m_paths.Count() < m_batch.Count())
+		m_paths.AddMultipleToTail( m_batch.Count() - m_paths.Count() );
+
+	if (nav_parallel_paths.GetBool())
+	{
+		ServerJobs_ParallelFor( m_batch.Count(), MIN_PATH_REQUESTS_PER_JOB, SearchRange, this, 1 );
+	}
+	else
+	{
+		SearchRange( this, 0, m_batch.Count() );
+	}
+
+	for( int i=0; i<m_batch.Count(); ++i )
+	{
+		// a listener can cancel requests of this batch that haven't been delivered yet
+		if (m_batch[i].listener == NULL)
+			continue;
+
+		NavPathResult result;
+		result.handle = m_batch[i].handle;
+		result.isComplete = m_batch[i].isComplete;
+		result.path = m_paths[i].Base();
+		result.segmentCount = m_paths[i].Count();
+
+		m_batch[i].listener->OnNavPathResult( result );
+	}
+
+	m_batch.RemoveAll();
+}
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Records the answers to the benchmark's batched requests
+ */
+class CNavBenchPathListener : public INavPathListener
+{
+public:
+	virtual void OnNavPathResult( const NavPathResult &result )
+	{
+		int i = result.handle - m_firstHandle;
+		if (i < 0 || i >= m_endAreas.Count())
+			return;
+
+		m_endAreas[i] = (result.segmentCount) ? result.path[ result.segmentCount-1 ].area : NULL;
+		m_segmentCounts[i] = result.segmentCount;
+	}
+
+	NavPathRequestHandle m_firstHandle;
+	CUtlVector< CNavArea * > m_endAreas;
+	CUtlVector< int > m_segmentCounts;
+};
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Time random paths searched one after another on the main thread, then as one batch of requests
+ */
+void CommandNavBenchPaths( void )
+{
+	if ( !UTIL_IsCommandIssuedByServerAdmin() )
+		return;
+
+	int areaCount = TheNavAreaList.Count();
+	if (areaCount < 2)
+	{
+		Msg( "nav_bench_paths: the navigation mesh isn't loaded.\n" );
+		return;
+	}
+
+	int pathCount = (engine->Cmd_Argc() > 1) ? atoi( engine->Cmd_Argv(1) ) : 256;
+	pathCount = clamp( pathCount, 1, 65536 );
+
+	CUtlVector< CNavArea * > areas;
+	FOR_EACH_LL( TheNavAreaList, it )
+	{
+		areas.AddToTail( TheNavAreaList[ it ] );
+	}
+
+	CUniformRandomStream random;
+	random.SetSeed( 0 );
+
+	CUtlVector< CNavArea * > starts, goals;
+	int i;
+	for( i=0; i<pathCount; ++i )
+	{
+		starts.AddToTail( areas[ random.RandomInt( 0, areaCount-1 ) ] );
+		goals.AddToTail( areas[ random.RandomInt( 0, areaCount-1 ) ] );
+	}
+
+	// one after another on the main thread
+	CUtlVector< CNavArea * > serialEndAreas;
+	CUtlVector< int > serialSegmentCounts;
+	serialEndAreas.SetCount( pathCount );
+	serialSegmentCounts.SetCount( pathCount );
+
+	ShortestPathCost cost;
+	int completeCount = 0;
+
+	CFastTimer timer;
+	timer.Start();
+	for( i=0; i<pathCount; ++i )
+	{
+		CNavArea *closestArea = NULL;
+		if (NavAreaBuildPath( starts[i], goals[i], NULL, cost, &closestArea ))
+		{
+			++completeCount;
+			if (starts[i] == goals[i])
+				closestArea = goals[i];
+		}
+
+		int count = 0;
+		for( CNavArea *area = closestArea; area; area = area->GetParent() )
+			++count;
+
+		serialEndAreas[i] = closestArea;
+		serialSegmentCounts[i] = count;
+	}
+	timer.End();
+	float serialTime = timer.GetDuration().GetMillisecondsF();
+
+	// as one batch
+	CNavBenchPathListener listener;
+	listener.m_endAreas.SetCount( pathCount );
+	listener.m_segmentCounts.SetCount( pathCount );
+
+	// deliver anything already waiting, so it isn't timed
+	TheNavPathRequests.Update();
+
+	timer.Start();
+	for( i=0; i<pathCount; ++i )
+	{
+		NavPathRequestHandle handle = TheNavPathRequests.RequestPath( starts[i], goals[i], NULL, &listener );
+		if (i == 0)
+			listener.m_firstHandle = handle;
+	}
+	TheNavPathRequests.Update();
+	timer.End();
+	float batchTime = timer.GetDuration().GetMillisecondsF();
+
+	int mismatchCount = 0;
+	for( i=0; i<pathCount; ++i )
+	{
+		if (listener.m_endAreas[i] != serialEndAreas[i] || listener.m_segmentCounts[i] != serialSegmentCounts[i])
+			++mismatchCount;
+	}
+
+	Msg( "nav_bench_paths: %d paths between %d areas, %d reach their goal\n", pathCount, areaCount, completeCount );
+	Msg( "  serial:  %8.3f ms\n", serialTime );
+	Msg( "  batched: %8.3f ms (%s, %d threads)\n", batchTime, nav_parallel_paths.GetBool() ? "parallel" : "serial", nav_parallel_paths.GetBool() ? ServerJobThreadCount() : 1 );
+	Msg( "  %d paths differ\n", mismatchCount );
+}
+static ConCommand nav_bench_paths( "nav_bench_paths", CommandNavBenchPaths, "Times random paths searched one at a time, then as a batch of path requests. Usage: nav_bench_paths [paths]", FCVAR_GAMEDLL | FCVAR_CHEAT );
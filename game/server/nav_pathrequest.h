@@ -0,0 +1,128 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose:
+//
+// $NoKeywords: $
+//
+//=============================================================================//
+// nav_pathrequest.h
+// Batched path queries, run on the server job pool and answered on the next frame
+
+#ifndef _NAV_PATHREQUEST_H_
+#define _NAV_PATHREQUEST_H_
+
+#include "nav_area.h"
+
+typedef unsigned int NavPathRequestHandle;
+#define NAV_PATH_REQUEST_INVALID 0
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Cost functor for path requests, with the same contract as the functors given to NavAreaBuildPath().
+ * It is called on worker threads, so it may only read the nav mesh and its own data.
+ */
+class INavPathCost
+{
+public:
+	virtual float operator() ( CNavArea *area, CNavArea *fromArea, const CNavLadder *ladder ) = 0;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * One step of a path: an area, and how it is reached from the previous step
+ */
+struct NavPathSegment
+{
+	CNavArea *area;
+	NavTraverseType how;										///< NUM_TRAVERSE_TYPES for the first step
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * The answer to a path request. The path runs from the start area to the goal, or to the area closest
+ * to the goal if the goal can't be reached. It is only valid during OnNavPathResult().
+ */
+struct NavPathResult
+{
+	NavPathRequestHandle handle;
+	bool isComplete;											///< true if the path reaches the goal
+	const NavPathSegment *path;
+	int segmentCount;											///< zero if there was no start area, or the mesh changed under the request
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Receives the answers to path requests, on the main thread.
+ * Cancel outstanding requests before a listener is destroyed.
+ */
+class INavPathListener
+{
+public:
+	virtual void OnNavPathResult( const NavPathResult &result ) = 0;
+};
+
+
+//--------------------------------------------------------------------------------------------------------------
+/**
+ * Path requests made during a frame are searched together at the start of the next one, spread across
+ * the server job pool, and each listener is called with its answer before the frame's entities think.
+ */
+class CNavPathRequests
+{
+public:
+	CNavPathRequests( void );
+	~CNavPathRequests();
+
+	/**
+	 * Request a path from 'startArea' to 'goalArea', or to 'goalPos' if 'goalArea' is NULL.
+	 * If 'goalPos' is NULL, the center of 'goalArea' is used as the goal position.
+	 * 'costFunc' must stay valid until the answer arrives. If NULL, ShortestPathCost is used.
+	 */
+	NavPathRequestHandle RequestPath( CNavArea *startArea, CNavArea *goalArea, const Vector *goalPos, INavPathListener *listener, INavPathCost *costFunc = NULL );
+
+	void CancelPath( NavPathRequestHandle handle );
+	void CancelPaths( INavPathListener *listener );				///< cancel all of a listener's requests
+
+	int GetPendingCount( void ) const	{ return m_pending.Count(); }
+
+	void Update( void );										///< search the pending requests and deliver their answers - invoked on each game frame
+
+	void OnAreaDestroyed( CNavArea *area );						///< fail pending requests that use the given area
+	void OnMeshDestroyed( void );								///< fail all pending requests
+
+private:
+	struct Request
+	{
+		NavPathRequestHandle handle;
+		CNavArea *startArea;
+		CNavArea *goalArea;
+		Vector goalPos;
+		bool hasGoalPos;
+		INavPathListener *listener;
+		INavPathCost *costFunc;
+		bool isComplete;
+	};
+
+	static void SearchRange( void *context, int first, int last );
+	void Search( int i, CNavSearchContext *search );
+
+	CNavSearchContext *AcquireContext( void );
+	void ReleaseContext( CNavSearchContext *search );
+
+	CUtlVector< Request > m_pending;							///< requested since the last update
+	CUtlVector< Request > m_batch;								///< being searched and delivered
+	CUtlVector< CUtlVector< NavPathSegment > > m_paths;			///< paths found for m_batch
+
+	CUtlVector< CNavSearchContext * > m_freeContexts;			///< one per job that has run at the same time
+	CThreadFastMutex m_contextLock;
+
+	NavPathRequestHandle m_nextHandle;
+};
+
+extern CNavPathRequests TheNavPathRequests;
+
+#endif // _NAV_PATHREQUEST_H_
@@ -0,0 +1,1160 @@
+//===== Copyright  1996-2005, Valve Corporation, All rights reserved. ======//
+//
+// Purpose: Developer console commands that benchmark engine-independent
+//			systems (tier0/tier1 containers, threading, allocators) from
+//			inside a running server.
+//
+//===========================================================================//
+
+#include "cbase.h"
+#include "tier0/fasttimer.h"
+#include "tier0/tslist.h"
+#include "tier1/jobthread.h"
+#include "tier1/bitbuf.h"
+#include "tier1/utlflatmap.h"
+#include "tier1/utlhash.h"
+#include "tier1/keyvaluesview.h"
+#include "tier1/keyvaluesarena.h"
+#include "tier1/utlstring.h"
+#include "filesystem.h"
+#include "igameevents.h"
+#include "tier0/memalloc.h"
+#include "utldict.h"
+#include "serverjobs.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// Shared helpers
+//-----------------------------------------------------------------------------
+static int BenchArgInt( int iArg, int nDefault )
+{
+	if ( engine->Cmd_Argc() > iArg )
+		return atoi( engine->Cmd_Argv( iArg ) );
+	return nDefault;
+}
+
+static int __cdecl BenchCompareInt64( const int64 *pLeft, const int64 *pRight )
+{
+	if ( *pLeft < *pRight )
+		return -1;
+	return ( *pLeft > *pRight ) ? 1 : 0;
+}
+
+// Sorts the samples and returns the value at the given fraction, in microseconds
+static double BenchPercentileUS( CUtlVector<int64> &samples, float flFraction )
+{
+	if ( !samples.Count() )
+		return 0;
+
+	int i = clamp( (int)( flFraction * samples.Count() ), 0, samples.Count() - 1 );
+	return (double)samples[i] * g_ClockSpeedMicrosecondsMultiplier;
+}
+
+//-----------------------------------------------------------------------------
+// Job pool: throughput and queue latency (submit to start of execution)
+//-----------------------------------------------------------------------------
+class CBenchmarkJob : public CAsyncJob
+{
+public:
+	CBenchmarkJob() : m_Submitted( 0 ), m_Started( 0 ), m_nResult( 0 ) {}
+
+	int64			m_Submitted;
+	int64			m_Started;
+	volatile int	m_nResult;
+
+private:
+	virtual AsyncStatus_t DoExecute()
+	{
+		m_Started = CCycleCount::GetTimestamp();
+
+		// A token amount of work, so the benchmark measures the scheduler
+		int nSum = 0;
+		for ( int i = 0; i < 64; i++ )
+		{
+			nSum += i * i;
+		}
+		m_nResult = nSum;
+		return ASYNC_OK;
+	}
+};
+
+CON_COMMAND_F( bench_jobpool, "Reports CAsyncJobPool jobs/sec and queue latency for 1-64 threads. Usage: bench_jobpool [jobs]", FCVAR_CHEAT )
+{
+	int nJobs = max( 1000, BenchArgInt( 1, 100000 ) );
+
+	CUtlVector<CBenchmarkJob *> jobs;
+	CUtlVector<int64> latencies;
+	jobs.SetCount( nJobs );
+	latencies.SetCount( nJobs );
+
+	Msg( "threads     jobs/sec    p50 (us)    p99 (us)  p99.9 (us)    max (us)\n" );
+
+	for ( int nThreads = 1; nThreads <= 64; nThreads *= 2 )
+	{
+		CAsyncJobPool pool;
+		pool.Start( nThreads );
+
+		int i;
+		for ( i = 0; i < nJobs; i++ )
+		{
+			jobs[i] = new CBenchmarkJob;
+		}
+
+		CFastTimer timer;
+		timer.Start();
+
+		for ( i = 0; i < nJobs; i++ )
+		{
+			jobs[i]->m_Submitted = CCycleCount::GetTimestamp();
+			pool.AddJob( jobs[i] );
+		}
+		pool.WaitForIdle();
+
+		timer.End();
+
+		for ( i = 0; i < nJobs; i++ )
+		{
+			latencies[i] = jobs[i]->m_Started - jobs[i]->m_Submitted;
+			jobs[i]->Release();
+		}
+		latencies.Sort( BenchCompareInt64 );
+
+		pool.Stop();
+
+		Msg( "%7d %12.0f %11.1f %11.1f %11.1f %11.1f\n",
+			nThreads,
+			(double)nJobs / timer.GetDuration().GetSeconds(),
+			BenchPercentileUS( latencies, 0.5f ),
+			BenchPercentileUS( latencies, 0.99f ),
+			BenchPercentileUS( latencies, 0.999f ),
+			BenchPercentileUS( latencies, 1.0f ) );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// CTSQueue vs CTSRingQueue with N producers and N consumers
+//-----------------------------------------------------------------------------
+typedef CTSRingQueue<int, 4096> BenchRingQueue_t;
+
+struct QueueBenchContext_t
+{
+	CTSQueue<int> *		pQueue;
+	BenchRingQueue_t *	pRing;
+	int					nBatch;
+	int					nPerProducer;
+	int					nTotal;
+	CInterlockedInt		nPopped;
+	CInterlockedInt		nStarted;
+	volatile bool		bGo;
+};
+
+struct QueueBenchThread_t
+{
+	QueueBenchContext_t *	pContext;
+	bool					bProducer;
+	CThreadManualEvent		done;
+};
+
+static unsigned QueueBenchThreadFunc( void *pParam )
+{
+	QueueBenchThread_t *pThread = (QueueBenchThread_t *)pParam;
+	QueueBenchContext_t *pContext = pThread->pContext;
+	int buffer[64];
+	int i;
+
+	++pContext->nStarted;
+	while ( !pContext->bGo )
+	{
+		ThreadPause();
+	}
+
+	if ( pThread->bProducer )
+	{
+		for ( i = 0; i < pContext->nPerProducer; )
+		{
+			if ( pContext->pRing )
+			{
+				int nWant = min( pContext->nBatch, pContext->nPerProducer - i );
+				for ( int j = 0; j < nWant; j++ )
+				{
+					buffer[j] = i + j;
+				}
+				int nPushed = pContext->pRing->PushItems( buffer, nWant );
+				if ( !nPushed )
+				{
+					ThreadPause();
+				}
+				i += nPushed;
+			}
+			else
+			{
+				pContext->pQueue->PushItem( i++ );
+			}
+		}
+	}
+	else
+	{
+		while ( pContext->nPopped < pContext->nTotal )
+		{
+			int nPopped;
+			if ( pContext->pRing )
+			{
+				nPopped = pContext->pRing->PopItems( buffer, pContext->nBatch );
+			}
+			else
+			{
+				nPopped = ( pContext->pQueue->PopItem( buffer ) ) ? 1 : 0;
+			}
+
+			if ( nPopped )
+			{
+				pContext->nPopped += nPopped;
+			}
+			else
+			{
+				ThreadPause();
+			}
+		}
+	}
+
+	pThread->done.Set();
+	return 0;
+}
+
+static double RunQueueBench( CTSQueue<int> *pQueue, BenchRingQueue_t *pRing, int nBatch, int nPairs, int nPerProducer )
+{
+	QueueBenchContext_t context;
+	context.pQueue = pQueue;
+	context.pRing = pRing;
+	context.nBatch = nBatch;
+	context.nPerProducer = nPerProducer;
+	context.nTotal = nPairs * nPerProducer;
+	context.bGo = false;
+
+	int nThreads = nPairs * 2;
+	QueueBenchThread_t *pThreads = new QueueBenchThread_t[nThreads];
+
+	int i;
+	for ( i = 0; i < nThreads; i++ )
+	{
+		pThreads[i].pContext = &context;
+		pThreads[i].bProducer = ( i % 2 ) == 0;
+		CreateSimpleThread( QueueBenchThreadFunc, &pThreads[i] );
+	}
+
+	while ( context.nStarted < nThreads )
+	{
+		ThreadSleep( 0 );
+	}
+
+	CFastTimer timer;
+	timer.Start();
+	context.bGo = true;
+
+	for ( i = 0; i < nThreads; i++ )
+	{
+		pThreads[i].done.Wait();
+	}
+	timer.End();
+
+	delete [] pThreads;
+
+	return (double)context.nTotal / timer.GetDuration().GetSeconds();
+}
+
+CON_COMMAND_F( bench_tsqueue, "Compares CTSQueue and CTSRingQueue throughput for 1-32 producer/consumer pairs. Usage: bench_tsqueue [items per producer]", FCVAR_CHEAT )
+{
+	int nPerProducer = max( 1000, BenchArgInt( 1, 200000 ) );
+
+	CTSQueue<int> *pQueue = new CTSQueue<int>;
+	BenchRingQueue_t *pRing = new BenchRingQueue_t;
+
+	Msg( "pairs   CTSQueue ops/s    ring ops/s  ring x16 ops/s\n" );
+
+	for ( int nPairs = 1; nPairs <= 32; nPairs *= 2 )
+	{
+		double flQueue = RunQueueBench( pQueue, NULL, 1, nPairs, nPerProducer );
+		double flRing = RunQueueBench( NULL, pRing, 1, nPairs, nPerProducer );
+		double flRingBatch = RunQueueBench( NULL, pRing, 16, nPairs, nPerProducer );
+
+		Msg( "%5d %16.0f %13.0f %15.0f\n", nPairs, flQueue, flRing, flRingBatch );
+	}
+
+	delete pRing;
+	delete pQueue;
+}
+
+//-----------------------------------------------------------------------------
+// CUtlFlatMap vs CUtlMap/CUtlHash (int keys) and CUtlDict (string keys)
+//-----------------------------------------------------------------------------
+struct HashBenchResult_t
+{
+	double	flInsert;
+	double	flFindHit;
+	double	flFindMiss;
+	double	flIterate;
+};
+
+struct HashBenchKeys_t
+{
+	CUtlVector<int>			hits;
+	CUtlVector<int>			misses;
+	CUtlVector<char>		stringPool;
+	CUtlVector<int>			hitStrings;
+	CUtlVector<int>			missStrings;
+
+	const char *HitString( int i ) const	{ return &stringPool[ hitStrings[i] ]; }
+	const char *MissString( int i ) const	{ return &stringPool[ missStrings[i] ]; }
+};
+
+static int s_nHashBenchSink;
+
+static void BuildHashBenchKeys( HashBenchKeys_t &keys, int nElements )
+{
+	keys.hits.SetCount( nElements );
+	keys.misses.SetCount( nElements );
+	keys.hitStrings.SetCount( nElements );
+	keys.missStrings.SetCount( nElements );
+	keys.stringPool.RemoveAll();
+
+	// Multiplying by an odd constant is a bijection, so hits and misses never collide
+	for ( int i = 0; i < nElements; i++ )
+	{
+		keys.hits[i] = (int)( (unsigned)( i * 2 ) * 0x9E3779B1 );
+		keys.misses[i] = (int)( (unsigned)( i * 2 + 1 ) * 0x9E3779B1 );
+	}
+
+	char szName[32];
+	for ( int i = 0; i < nElements; i++ )
+	{
+		int nLen = Q_snprintf( szName, sizeof( szName ), "npc_entity_%d", i ) + 1;
+		keys.hitStrings[i] = keys.stringPool.AddMultipleToTail( nLen, szName );
+
+		nLen = Q_snprintf( szName, sizeof( szName ), "npc_missing_%d", i ) + 1;
+		keys.missStrings[i] = keys.stringPool.AddMultipleToTail( nLen, szName );
+	}
+}
+
+// Nanoseconds per operation
+static double HashBenchNS( CFastTimer &timer, int nOps )
+{
+	return timer.GetDuration().GetSeconds() * 1e9 / nOps;
+}
+
+static HashBenchResult_t BenchUtlMap( const HashBenchKeys_t &keys )
+{
+	HashBenchResult_t result;
+	CUtlMap<int, int, int> map( DefLessFunc( int ) );
+	int nElements = keys.hits.Count();
+	int nSum = 0;
+	CFastTimer timer;
+	int i;
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		map.Insert( keys.hits[i], i );
+	}
+	timer.End();
+	result.flInsert = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += map[ map.Find( keys.hits[i] ) ];
+	}
+	timer.End();
+	result.flFindHit = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += map.Find( keys.misses[i] );
+	}
+	timer.End();
+	result.flFindMiss = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = map.FirstInorder(); i != map.InvalidIndex(); i = map.NextInorder( i ) )
+	{
+		nSum += map[i];
+	}
+	timer.End();
+	result.flIterate = HashBenchNS( timer, nElements );
+
+	s_nHashBenchSink += nSum;
+	return result;
+}
+
+static bool HashBenchIntCompare( int const &left, int const &right )
+{
+	return left == right;
+}
+
+static unsigned int HashBenchIntKey( int const &key )
+{
+	return HashIntConventional( key );
+}
+
+static HashBenchResult_t BenchUtlHash( const HashBenchKeys_t &keys )
+{
+	HashBenchResult_t result;
+	int nElements = keys.hits.Count();
+
+	// Handles only have 16 bits for the bucket
+	int nBuckets = 16;
+	while ( nBuckets < nElements && nBuckets < 65536 )
+	{
+		nBuckets *= 2;
+	}
+
+	CUtlHash<int> hash( nBuckets, 0, 0, HashBenchIntCompare, HashBenchIntKey );
+	int nSum = 0;
+	CFastTimer timer;
+	int i;
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		hash.Insert( keys.hits[i] );
+	}
+	timer.End();
+	result.flInsert = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += hash[ hash.Find( keys.hits[i] ) ];
+	}
+	timer.End();
+	result.flFindHit = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += hash.Find( keys.misses[i] );
+	}
+	timer.End();
+	result.flFindMiss = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( UtlHashHandle_t h = hash.GetFirstHandle(); h != hash.InvalidHandle(); h = hash.GetNextHandle( h ) )
+	{
+		nSum += hash[h];
+	}
+	timer.End();
+	result.flIterate = HashBenchNS( timer, nElements );
+
+	s_nHashBenchSink += nSum;
+	return result;
+}
+
+static HashBenchResult_t BenchFlatMapInt( const HashBenchKeys_t &keys )
+{
+	HashBenchResult_t result;
+	CUtlFlatMap<int, int> map;
+	int nElements = keys.hits.Count();
+	int nSum = 0;
+	CFastTimer timer;
+	int i;
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		map.Insert( keys.hits[i], i );
+	}
+	timer.End();
+	result.flInsert = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += map[ map.Find( keys.hits[i] ) ];
+	}
+	timer.End();
+	result.flFindHit = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += map.Find( keys.misses[i] );
+	}
+	timer.End();
+	result.flFindMiss = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = map.First(); i != map.InvalidIndex(); i = map.Next( i ) )
+	{
+		nSum += map[i];
+	}
+	timer.End();
+	result.flIterate = HashBenchNS( timer, nElements );
+
+	s_nHashBenchSink += nSum;
+	return result;
+}
+
+static HashBenchResult_t BenchUtlDict( const HashBenchKeys_t &keys )
+{
+	HashBenchResult_t result;
+	CUtlDict<int, int> dict;
+	int nElements = keys.hits.Count();
+	int nSum = 0;
+	CFastTimer timer;
+	int i;
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		dict.Insert( keys.HitString( i ), i );
+	}
+	timer.End();
+	result.flInsert = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += dict[ dict.Find( keys.HitString( i ) ) ];
+	}
+	timer.End();
+	result.flFindHit = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += dict.Find( keys.MissString( i ) );
+	}
+	timer.End();
+	result.flFindMiss = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = dict.First(); i != dict.InvalidIndex(); i = dict.Next( i ) )
+	{
+		nSum += dict[i];
+	}
+	timer.End();
+	result.flIterate = HashBenchNS( timer, nElements );
+
+	s_nHashBenchSink += nSum;
+	return result;
+}
+
+static HashBenchResult_t BenchFlatMapString( const HashBenchKeys_t &keys )
+{
+	typedef CUtlFlatMap<const char *, int, CFlatCaselessStringHashFunctor, CFlatCaselessStringEqualFunctor> StringMap_t;
+
+	HashBenchResult_t result;
+	StringMap_t map;
+	int nElements = keys.hits.Count();
+	int nSum = 0;
+	CFastTimer timer;
+	int i;
+
+	// Copies the names, like CUtlDict does, so the comparison is fair
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		map.Insert( strdup( keys.HitString( i ) ), i );
+	}
+	timer.End();
+	result.flInsert = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += map[ map.Find( keys.HitString( i ) ) ];
+	}
+	timer.End();
+	result.flFindHit = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = 0; i < nElements; i++ )
+	{
+		nSum += map.Find( keys.MissString( i ) );
+	}
+	timer.End();
+	result.flFindMiss = HashBenchNS( timer, nElements );
+
+	timer.Start();
+	for ( i = map.First(); i != map.InvalidIndex(); i = map.Next( i ) )
+	{
+		nSum += map[i];
+	}
+	timer.End();
+	result.flIterate = HashBenchNS( timer, nElements );
+
+	for ( i = map.First(); i != map.InvalidIndex(); i = map.Next( i ) )
+	{
+		free( (void *)map.Key( i ) );
+	}
+
+	s_nHashBenchSink += nSum;
+	return result;
+}
+
+static void PrintHashBenchResult( int nElements, const char *pszContainer, const HashBenchResult_t &result )
+{
+	Msg( "%9d %-16s %9.1f %9.1f %9.1f %9.1f\n", nElements, pszContainer,
+		result.flInsert, result.flFindHit, result.flFindMiss, result.flIterate );
+}
+
+CON_COMMAND_F( bench_hashmap, "Compares CUtlFlatMap with CUtlMap, CUtlHash and CUtlDict at 1K-1M elements. Usage: bench_hashmap [max elements]", FCVAR_CHEAT )
+{
+	int nMaxElements = clamp( BenchArgInt( 1, 1000000 ), 1000, 1000000 );
+
+	HashBenchKeys_t keys;
+
+	Msg( " elements container           insert  find hit find miss   iterate   (ns/op)\n" );
+
+	for ( int nElements = 1000; nElements <= nMaxElements; nElements *= 10 )
+	{
+		BuildHashBenchKeys( keys, nElements );
+
+		PrintHashBenchResult( nElements, "CUtlMap<int>", BenchUtlMap( keys ) );
+		PrintHashBenchResult( nElements, "CUtlHash<int>", BenchUtlHash( keys ) );
+		PrintHashBenchResult( nElements, "CUtlFlatMap<int>", BenchFlatMapInt( keys ) );
+		PrintHashBenchResult( nElements, "CUtlDict", BenchUtlDict( keys ) );
+		PrintHashBenchResult( nElements, "CUtlFlatMap<str>", BenchFlatMapString( keys ) );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// bf_write/bf_read: per-field calls vs CBitWriteAccumulator/CBitReadAccumulator,
+// plus a randomized check that both produce the same stream
+//-----------------------------------------------------------------------------
+#define BITBENCH_FIELDS		4096
+
+static unsigned int s_nBitBenchSink;
+
+struct BitBenchFields_t
+{
+	unsigned int	nValue[BITBENCH_FIELDS];
+	int				nBits[BITBENCH_FIELDS];
+	int				nTotalBits;
+};
+
+static void BuildBitBenchFields( BitBenchFields_t &fields, unsigned int nSeed )
+{
+	fields.nTotalBits = 0;
+	for ( int i = 0; i < BITBENCH_FIELDS; i++ )
+	{
+		nSeed = nSeed * 1664525 + 1013904223;
+
+		// Mostly small fields, like entity deltas
+		int nBits = ( nSeed >> 28 ) < 12 ? 1 + ( ( nSeed >> 8 ) % 12 ) : 1 + ( ( nSeed >> 8 ) % 32 );
+		fields.nBits[i] = nBits;
+		fields.nValue[i] = ( nSeed * 0x9E3779B1 ) & ( 0xFFFFFFFFu >> ( 32 - nBits ) );
+		fields.nTotalBits += nBits;
+	}
+}
+
+// Writes the fields both ways from the given start bit, then reads them back both ways
+static bool CheckBitBenchFields( const BitBenchFields_t &fields, unsigned int *pBufA, unsigned int *pBufB, int nBytes, int iStartBit )
+{
+	memset( pBufA, 0x5A, nBytes );
+	memset( pBufB, 0x5A, nBytes );
+
+	bf_write writeA( pBufA, nBytes );
+	bf_write writeB( pBufB, nBytes );
+	writeA.SeekToBit( iStartBit );
+	writeB.SeekToBit( iStartBit );
+
+	int i;
+	{
+		CBitWriteAccumulator writer( writeB );
+		for ( i = 0; i < BITBENCH_FIELDS; i++ )
+		{
+			writeA.WriteUBitLong( fields.nValue[i], fields.nBits[i] );
+			writer.WriteUBitLong( fields.nValue[i], fields.nBits[i] );
+		}
+	}
+
+	if ( writeA.GetNumBitsWritten() != writeB.GetNumBitsWritten() || memcmp( pBufA, pBufB, writeA.GetNumBytesWritten() ) )
+		return false;
+
+	bf_read readA( pBufB, nBytes );
+	bf_read readB( pBufB, nBytes );
+	readA.Seek( iStartBit );
+	readB.Seek( iStartBit );
+
+	CBitReadAccumulator reader( readB );
+	for ( i = 0; i < BITBENCH_FIELDS; i++ )
+	{
+		if ( readA.ReadUBitLong( fields.nBits[i] ) != fields.nValue[i] || reader.ReadUBitLong( fields.nBits[i] ) != fields.nValue[i] )
+			return false;
+	}
+	reader.Flush();
+
+	return readA.GetNumBitsRead() == readB.GetNumBitsRead();
+}
+
+// Megabytes per second
+static double BitBenchMBS( CFastTimer &timer, int nBits )
+{
+	return ( nBits / 8.0 ) / ( 1024.0 * 1024.0 ) / timer.GetDuration().GetSeconds();
+}
+
+CON_COMMAND_F( bench_bitbuf, "Checks and times the bf_write/bf_read accumulators, coords and bulk bit copies. Usage: bench_bitbuf [passes]", FCVAR_CHEAT )
+{
+	int nPasses = clamp( BenchArgInt( 1, 200 ), 1, 100000 );
+
+	int nBytes = BITBENCH_FIELDS * 4 + 16;
+	unsigned int *pBufA = new unsigned int[nBytes / 4];
+	unsigned int *pBufB = new unsigned int[nBytes / 4];
+	BitBenchFields_t *pFields = new BitBenchFields_t;
+
+	// Roundtrip check at every start alignment
+	int nFailed = 0;
+	for ( int iSeed = 0; iSeed < 64; iSeed++ )
+	{
+		BuildBitBenchFields( *pFields, iSeed );
+		if ( !CheckBitBenchFields( *pFields, pBufA, pBufB, nBytes, iSeed ) )
+		{
+			nFailed++;
+		}
+	}
+	Msg( "bench_bitbuf: roundtrip check %s (%d failures)\n", nFailed ? "FAILED" : "passed", nFailed );
+
+	BuildBitBenchFields( *pFields, 12345 );
+
+	CFastTimer timer;
+	int nTotalBits = pFields->nTotalBits * nPasses;
+	unsigned int nSum = 0;
+	int iPass, i;
+
+	Msg( "fields (avg %.1f bits)          MB/s\n", (float)pFields->nTotalBits / BITBENCH_FIELDS );
+
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		bf_write buf( pBufA, nBytes );
+		for ( i = 0; i < BITBENCH_FIELDS; i++ )
+		{
+			buf.WriteUBitLong( pFields->nValue[i], pFields->nBits[i] );
+		}
+	}
+	timer.End();
+	Msg( "  bf_write::WriteUBitLong  %9.1f\n", BitBenchMBS( timer, nTotalBits ) );
+
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		bf_write buf( pBufA, nBytes );
+		CBitWriteAccumulator writer( buf );
+		for ( i = 0; i < BITBENCH_FIELDS; i++ )
+		{
+			writer.WriteUBitLong( pFields->nValue[i], pFields->nBits[i] );
+		}
+	}
+	timer.End();
+	Msg( "  CBitWriteAccumulator     %9.1f\n", BitBenchMBS( timer, nTotalBits ) );
+
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		bf_read buf( pBufA, nBytes );
+		for ( i = 0; i < BITBENCH_FIELDS; i++ )
+		{
+			nSum += buf.ReadUBitLong( pFields->nBits[i] );
+		}
+	}
+	timer.End();
+	Msg( "  bf_read::ReadUBitLong    %9.1f\n", BitBenchMBS( timer, nTotalBits ) );
+
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		bf_read buf( pBufA, nBytes );
+		CBitReadAccumulator reader( buf );
+		for ( i = 0; i < BITBENCH_FIELDS; i++ )
+		{
+			nSum += reader.ReadUBitLong( pFields->nBits[i] );
+		}
+	}
+	timer.End();
+	Msg( "  CBitReadAccumulator      %9.1f\n", BitBenchMBS( timer, nTotalBits ) );
+
+	// Coordinates, as sent for origins
+	int nVectors = BITBENCH_FIELDS / 4;
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		bf_write buf( pBufA, nBytes );
+		for ( i = 0; i < nVectors; i++ )
+		{
+			Vector vec( pFields->nValue[i] & 0x3FFF, ( pFields->nValue[i] >> 4 ) * 0.03125f, 0 );
+			buf.WriteBitVec3Coord( vec );
+		}
+	}
+	timer.End();
+	double flWriteUS = timer.GetDuration().GetMicrosecondsF();
+
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		bf_read buf( pBufA, nBytes );
+		for ( i = 0; i < nVectors; i++ )
+		{
+			Vector vec;
+			buf.ReadBitVec3Coord( vec );
+			nSum += (unsigned int)vec.x;
+		}
+	}
+	timer.End();
+	Msg( "  BitVec3Coord write/read  %9.1f / %.1f ns per vector\n",
+		flWriteUS * 1000.0 / ( nVectors * nPasses ), timer.GetDuration().GetMicrosecondsF() * 1000.0 / ( nVectors * nPasses ) );
+
+	// Bulk copies, byte aligned and not
+	for ( int iOffset = 0; iOffset < 2; iOffset++ )
+	{
+		int nCopyBits = ( nBytes - 8 ) * 8 - iOffset * 3;
+
+		timer.Start();
+		for ( iPass = 0; iPass < nPasses; iPass++ )
+		{
+			bf_write buf( pBufB, nBytes );
+			buf.SeekToBit( iOffset * 3 );
+			buf.WriteBits( pBufA, nCopyBits );
+		}
+		timer.End();
+		double flWriteMBS = BitBenchMBS( timer, nCopyBits * nPasses );
+
+		timer.Start();
+		for ( iPass = 0; iPass < nPasses; iPass++ )
+		{
+			bf_read buf( pBufB, nBytes );
+			buf.Seek( iOffset * 3 );
+			buf.ReadBits( pBufA, nCopyBits );
+		}
+		timer.End();
+		Msg( "  Write/ReadBits %-9s %9.1f / %.1f\n", iOffset ? "unaligned" : "aligned", flWriteMBS, BitBenchMBS( timer, nCopyBits * nPasses ) );
+	}
+
+	s_nBitBenchSink += nSum;
+
+	delete pFields;
+	delete [] pBufA;
+	delete [] pBufB;
+}
+
+//-----------------------------------------------------------------------------
+// KeyValues: text parsing vs. the compiled file cache
+//-----------------------------------------------------------------------------
+static void FindKeyValuesBenchFiles( const char *pWildCard, CUtlVector<CUtlString> &files )
+{
+	char szDir[MAX_PATH];
+	Q_ExtractFilePath( pWildCard, szDir, sizeof( szDir ) );
+
+	FileFindHandle_t hFind;
+	for ( const char *pName = filesystem->FindFirst( pWildCard, &hFind ); pName; pName = filesystem->FindNext( hFind ) )
+	{
+		if ( !filesystem->FindIsDirectory( hFind ) )
+		{
+			char szPath[MAX_PATH];
+			Q_snprintf( szPath, sizeof( szPath ), "%s%s", szDir, pName );
+			files.AddToTail( szPath );
+		}
+	}
+	filesystem->FindClose( hFind );
+}
+
+// Approximate heap bytes held by a tree: nodes plus string values. Names are
+// interned by the KeyValues system and aren't counted.
+static int KeyValuesTreeBytes( KeyValues *pKV, int &nNodes )
+{
+	int nBytes = 0;
+	for ( ; pKV; pKV = pKV->GetNextKey() )
+	{
+		nNodes++;
+		nBytes += sizeof( KeyValues );
+		if ( pKV->GetDataType() == KeyValues::TYPE_STRING )
+		{
+			nBytes += Q_strlen( pKV->GetString() ) + 1;
+		}
+		nBytes += KeyValuesTreeBytes( pKV->GetFirstSubKey(), nNodes );
+	}
+	return nBytes;
+}
+
+static int KeyValuesViewWalk( CKeyValuesView view )
+{
+	int nNodes = 0;
+	for ( ; view.IsValid(); view = view.GetNextKey() )
+	{
+		nNodes++;
+		nNodes += KeyValuesViewWalk( view.GetFirstSubKey() );
+	}
+	return nNodes;
+}
+
+CON_COMMAND_F( bench_keyvalues, "Times loading scripts/*.txt and resource/*.res from text and from the compiled KeyValues cache. Usage: bench_keyvalues [passes]", FCVAR_CHEAT )
+{
+	int nPasses = clamp( BenchArgInt( 1, 10 ), 1, 1000 );
+
+	CKeyValuesFileCache *pCache = KeyValuesFileCache();
+	if ( !pCache->IsEnabled() )
+	{
+		Msg( "bench_keyvalues: the KeyValues cache is off (-nokvcache)\n" );
+		return;
+	}
+
+	CUtlVector<CUtlString> files;
+	FindKeyValuesBenchFiles( "scripts/*.txt", files );
+	FindKeyValuesBenchFiles( "resource/*.res", files );
+	if ( !files.Count() )
+	{
+		Msg( "bench_keyvalues: no files found\n" );
+		return;
+	}
+
+	CFastTimer timer;
+	int iPass, i;
+
+	// Text: what every load cost before the cache
+	pCache->SetEnabled( false );
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		for ( i = 0; i < files.Count(); i++ )
+		{
+			KeyValues *pKV = new KeyValues( "bench" );
+			pKV->LoadFromFile( filesystem, files[i].Get() );
+			pKV->deleteThis();
+		}
+	}
+	timer.End();
+	double flTextMS = timer.GetDuration().GetMillisecondsF() / nPasses;
+	pCache->SetEnabled( true );
+
+	// Make sure everything is compiled, and measure what the trees hold
+	int nTreeBytes = 0, nTreeNodes = 0;
+	int nHits = pCache->GetNumHits();
+	for ( i = 0; i < files.Count(); i++ )
+	{
+		KeyValues *pKV = new KeyValues( "bench" );
+		pKV->LoadFromFile( filesystem, files[i].Get() );
+		nTreeBytes += KeyValuesTreeBytes( pKV, nTreeNodes );
+		pKV->deleteThis();
+	}
+	int nCompiledOnFirstLoad = files.Count() - ( pCache->GetNumHits() - nHits );
+
+	// Compiled, copied into mutable trees
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		for ( i = 0; i < files.Count(); i++ )
+		{
+			KeyValues *pKV = new KeyValues( "bench" );
+			pKV->LoadFromFile( filesystem, files[i].Get() );
+			pKV->deleteThis();
+		}
+	}
+	timer.End();
+	double flCachedMS = timer.GetDuration().GetMillisecondsF() / nPasses;
+
+	// Compiled, read in place
+	int nViewNodes = 0;
+	timer.Start();
+	for ( iPass = 0; iPass < nPasses; iPass++ )
+	{
+		for ( i = 0; i < files.Count(); i++ )
+		{
+			const char *pFile = files[i].Get();
+			CKeyValuesView view = pCache->Find( pFile, NULL, false, filesystem->Size( pFile ), filesystem->GetFileTime( pFile ) );
+			nViewNodes += KeyValuesViewWalk( view );
+		}
+	}
+	timer.End();
+	double flViewMS = timer.GetDuration().GetMillisecondsF() / nPasses;
+
+	Msg( "bench_keyvalues: %d files, %d compiled on first load, %d nodes\n", files.Count(), nCompiledOnFirstLoad, nTreeNodes );
+	Msg( "  text parse             %8.2f ms\n", flTextMS );
+	Msg( "  compiled -> KeyValues  %8.2f ms (%.1fx)\n", flCachedMS, flTextMS / max( flCachedMS, 0.001 ) );
+	Msg( "  compiled view          %8.2f ms (%.1fx, %d nodes walked)\n", flViewMS, flTextMS / max( flViewMS, 0.001 ), nViewNodes / nPasses );
+	Msg( "  KeyValues trees        %8d bytes\n", nTreeBytes );
+	Msg( "  compiled cache         %8d bytes in %d entries, %d hits / %d misses so far\n",
+		pCache->GetDataSize(), pCache->GetNumEntries(), pCache->GetNumHits(), pCache->GetNumMisses() );
+}
+
+
+//-----------------------------------------------------------------------------
+// bench_gameevents
+//-----------------------------------------------------------------------------
+#if !defined(NO_MALLOC_OVERRIDE)
+
+// Passes everything through to the real allocator and counts heap calls.
+// g_pMemAlloc is shared by every module, so other threads are counted too.
+class CBenchCountingMemAlloc : public IMemAlloc
+{
+public:
+	CBenchCountingMemAlloc() : m_pActual( NULL ), m_nAllocs( 0 ), m_nFrees( 0 ) {}
+
+	void Install()
+	{
+		m_nAllocs = m_nFrees = 0;
+		m_pActual = g_pMemAlloc;
+		g_pMemAlloc = this;
+	}
+
+	void Remove()
+	{
+		g_pMemAlloc = m_pActual;
+	}
+
+	int GetNumCalls() const { return m_nAllocs + m_nFrees; }
+
+	virtual void *Alloc( size_t nSize )													{ ThreadInterlockedIncrement( &m_nAllocs ); return m_pActual->Alloc( nSize ); }
+	virtual void *Realloc( void *pMem, size_t nSize )									{ ThreadInterlockedIncrement( &m_nAllocs ); return m_pActual->Realloc( pMem, nSize ); }
+	virtual void Free( void *pMem )														{ ThreadInterlockedIncrement( &m_nFrees ); m_pActual->Free( pMem ); }
+	virtual void *Expand_NoLongerSupported( void *pMem, size_t nSize )					{ return m_pActual->Expand_NoLongerSupported( pMem, nSize ); }
+	virtual void *Alloc( size_t nSize, const char *pFileName, int nLine )				{ ThreadInterlockedIncrement( &m_nAllocs ); return m_pActual->Alloc( nSize, pFileName, nLine ); }
+	virtual void *Realloc( void *pMem, size_t nSize, const char *pFileName, int nLine )	{ ThreadInterlockedIncrement( &m_nAllocs ); return m_pActual->Realloc( pMem, nSize, pFileName, nLine ); }
+	virtual void Free( void *pMem, const char *pFileName, int nLine )					{ ThreadInterlockedIncrement( &m_nFrees ); m_pActual->Free( pMem, pFileName, nLine ); }
+	virtual void *Expand_NoLongerSupported( void *pMem, size_t nSize, const char *pFileName, int nLine ) { return m_pActual->Expand_NoLongerSupported( pMem, nSize, pFileName, nLine ); }
+	virtual size_t GetSize( void *pMem )												{ return m_pActual->GetSize( pMem ); }
+	virtual void PushAllocDbgInfo( const char *pFileName, int nLine )					{ m_pActual->PushAllocDbgInfo( pFileName, nLine ); }
+	virtual void PopAllocDbgInfo()														{ m_pActual->PopAllocDbgInfo(); }
+	virtual long CrtSetBreakAlloc( long lNewBreakAlloc )								{ return m_pActual->CrtSetBreakAlloc( lNewBreakAlloc ); }
+	virtual	int CrtSetReportMode( int nReportType, int nReportMode )					{ return m_pActual->CrtSetReportMode( nReportType, nReportMode ); }
+	virtual int CrtIsValidHeapPointer( const void *pMem )								{ return m_pActual->CrtIsValidHeapPointer( pMem ); }
+	virtual int CrtIsValidPointer( const void *pMem, unsigned int size, int access )	{ return m_pActual->CrtIsValidPointer( pMem, size, access ); }
+	virtual int CrtCheckMemory( void )													{ return m_pActual->CrtCheckMemory(); }
+	virtual int CrtSetDbgFlag( int nNewFlag )											{ return m_pActual->CrtSetDbgFlag( nNewFlag ); }
+	virtual void CrtMemCheckpoint( _CrtMemState *pState )								{ m_pActual->CrtMemCheckpoint( pState ); }
+	virtual void DumpStats()															{ m_pActual->DumpStats(); }
+	virtual void* CrtSetReportFile( int nRptType, void* hFile )							{ return m_pActual->CrtSetReportFile( nRptType, hFile ); }
+	virtual void* CrtSetReportHook( void* pfnNewHook )									{ return m_pActual->CrtSetReportHook( pfnNewHook ); }
+	virtual int CrtDbgReport( int nRptType, const char * szFile, int nLine, const char * szModule, const char * pMsg ) { return m_pActual->CrtDbgReport( nRptType, szFile, nLine, szModule, pMsg ); }
+	virtual int heapchk()																{ return m_pActual->heapchk(); }
+	virtual bool IsDebugHeap()															{ return m_pActual->IsDebugHeap(); }
+	virtual void GetActualDbgInfo( const char *&pFileName, int &nLine )					{ m_pActual->GetActualDbgInfo( pFileName, nLine ); }
+	virtual void RegisterAllocation( const char *pFileName, int nLine, int nLogicalSize, int nActualSize, unsigned nTime )		{ m_pActual->RegisterAllocation( pFileName, nLine, nLogicalSize, nActualSize, nTime ); }
+	virtual void RegisterDeallocation( const char *pFileName, int nLine, int nLogicalSize, int nActualSize, unsigned nTime )	{ m_pActual->RegisterDeallocation( pFileName, nLine, nLogicalSize, nActualSize, nTime ); }
+	virtual int GetVersion()															{ return m_pActual->GetVersion(); }
+	virtual void CompactHeap()															{ m_pActual->CompactHeap(); }
+	virtual MemAllocFailHandler_t SetAllocFailHandler( MemAllocFailHandler_t pfnMemAllocFailHandler ) { return m_pActual->SetAllocFailHandler( pfnMemAllocFailHandler ); }
+
+private:
+	IMemAlloc		*m_pActual;
+	volatile long	m_nAllocs;
+	volatile long	m_nFrees;
+};
+
+static CBenchCountingMemAlloc s_BenchMemAlloc;
+
+static int s_nEventBenchSink;
+
+// The same payload as player_hurt, as a KeyValues tree
+static void BuildEventBenchKeys( KeyValues *pEvent, int i )
+{
+	pEvent->SetInt( "userid", i & 0xff );
+	pEvent->SetInt( "health", i % 100 );
+	pEvent->SetInt( "priority", 5 );
+	pEvent->SetInt( "attacker", ( i + 1 ) & 0xff );
+	pEvent->SetString( "weapon", "weapon_crowbar" );
+}
+
+// Round trips an event through its wire format, like a demo or client would
+static void RoundTripEventBenchKeys( KeyValues *pEvent, KeyValues *pCopy )
+{
+	CUtlBuffer buf;
+	pEvent->WriteAsBinary( buf );
+	pCopy->ReadAsBinary( buf );
+	s_nEventBenchSink += pCopy->GetInt( "health" );
+}
+
+static void PrintEventBenchResult( const char *pszPath, CFastTimer &timer, int nEvents, int nHeapCalls, int nKeys )
+{
+	Msg( "  %-28s %8.1f ns/event %8.2f heap calls/event", pszPath, timer.GetDuration().GetMicrosecondsF() * 1000.0 / nEvents, (float)nHeapCalls / nEvents );
+	if ( nKeys >= 0 )
+	{
+		Msg( " %6.1f keys/event", (float)nKeys / nEvents );
+	}
+	Msg( "\n" );
+}
+
+CON_COMMAND_F( bench_gameevents, "Compares heap and arena KeyValues for game event sized payloads, against IGameEvent. Usage: bench_gameevents [events]", FCVAR_CHEAT )
+{
+	int nEvents = clamp( BenchArgInt( 1, 100000 ), 100, 10000000 );
+
+	CFastTimer timer;
+	int i;
+	Msg( "bench_gameevents: %d events\n", nEvents );
+
+	// The engine's own events, created, serialized and freed the way player_hurt is
+	IGameEvent *pProbe = gameeventmanager->CreateEvent( "player_hurt", true );
+	if ( pProbe )
+	{
+		gameeventmanager->FreeEvent( pProbe );
+
+		unsigned char data[512];
+		s_BenchMemAlloc.Install();
+		timer.Start();
+		for ( i = 0; i < nEvents; i++ )
+		{
+			IGameEvent *pEvent = gameeventmanager->CreateEvent( "player_hurt", true );
+			pEvent->SetInt( "userid", i & 0xff );
+			pEvent->SetInt( "health", i % 100 );
+			pEvent->SetInt( "priority", 5 );
+			pEvent->SetInt( "attacker", ( i + 1 ) & 0xff );
+
+			bf_write write( data, sizeof( data ) );
+			gameeventmanager->SerializeEvent( pEvent, &write );
+			bf_read read( data, write.GetNumBytesWritten() );
+			IGameEvent *pCopy = gameeventmanager->UnserializeEvent( &read );
+			if ( pCopy )
+			{
+				s_nEventBenchSink += pCopy->GetInt( "health" );
+				gameeventmanager->FreeEvent( pCopy );
+			}
+			gameeventmanager->FreeEvent( pEvent );
+		}
+		timer.End();
+		s_BenchMemAlloc.Remove();
+		PrintEventBenchResult( "IGameEvent", timer, nEvents, s_BenchMemAlloc.GetNumCalls(), -1 );
+	}
+	else
+	{
+		Msg( "  IGameEvent: player_hurt isn't a registered event in this mod, skipped\n" );
+	}
+
+	// KeyValues on the heap, as most one-shot trees are made today
+	s_BenchMemAlloc.Install();
+	timer.Start();
+	for ( i = 0; i < nEvents; i++ )
+	{
+		KeyValues *pEvent = new KeyValues( "player_hurt" );
+		KeyValues *pCopy = new KeyValues( "" );
+		BuildEventBenchKeys( pEvent, i );
+		RoundTripEventBenchKeys( pEvent, pCopy );
+		pCopy->deleteThis();
+		pEvent->deleteThis();
+	}
+	timer.End();
+	s_BenchMemAlloc.Remove();
+	PrintEventBenchResult( "KeyValues, heap", timer, nEvents, s_BenchMemAlloc.GetNumCalls(), -1 );
+
+	// KeyValues in an arena, reset after every event
+	CKeyValuesArena arena;
+	int nKeys = 0;
+	s_BenchMemAlloc.Install();
+	timer.Start();
+	for ( i = 0; i < nEvents; i++ )
+	{
+		KeyValues *pEvent = arena.CreateKeyValues( "player_hurt" );
+		KeyValues *pCopy = arena.CreateKeyValues( "" );
+		BuildEventBenchKeys( pEvent, i );
+		RoundTripEventBenchKeys( pEvent, pCopy );
+		nKeys += arena.GetNumKeys();
+		arena.Reset();
+	}
+	timer.End();
+	s_BenchMemAlloc.Remove();
+	PrintEventBenchResult( "KeyValues, arena", timer, nEvents, s_BenchMemAlloc.GetNumCalls(), nKeys );
+	Msg( "  arena: %d blocks\n", arena.GetNumBlocks() );
+}
+
+#endif // !NO_MALLOC_OVERRIDE
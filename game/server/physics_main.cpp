@@ -2142,14 +2142,20 @@ void Physics_RunThinkFunctions( bool simulating )
 	else
 	{
 		UTIL_DisableRemoveImmediate();
-		int listMax = SimThink_ListCount();
+		int listMax = SimThink_ListCount() + SimThink_ScheduledThinkCount();
 		listMax = max(listMax,1);
 		CBaseEntity **list = (CBaseEntity **)stackalloc( sizeof(CBaseEntity *) * listMax );
-		// iterate through all entities and have them think or simulate
+		// iterate through all entities that simulate, and the thinkers that have a think due
 		
 		// UNDONE: This has problems with UTIL_RemoveImmediate() (now disabled during this loop).  
 		// Do we really need UTIL_RemoveImmediate()?
-		int count = SimThink_ListCopy( list, listMax );
+		int simulateCount = SimThink_ListCopy( list, listMax );
+		int thinkCount = SimThink_ScheduledThinkCopy( list + simulateCount, listMax - simulateCount, gpGlobals->tickcount );
+		int count = simulateCount + thinkCount;
+
+		VPROF_INCREMENT_COUNTER( "simulating entities", simulateCount );
+		VPROF_INCREMENT_COUNTER( "due thinkers", thinkCount );
+		VPROF_INCREMENT_COUNTER( "scheduled thinkers", SimThink_ScheduledThinkCount() );
 
 		//DevMsg(1, "Count: %d\n", count );
 		for ( int i = 0; i < count; i++ )
@@ -2162,6 +2168,23 @@ void Physics_RunThinkFunctions( bool simulating )
 		}
 
 		stackfree( list );
+
+		// Thinks the pass set for this tick on entities that weren't in it still run this frame
+		static CUtlVector<CBaseEntity *> lateThinkers;
+		for ( ;; )
+		{
+			lateThinkers.SetCount( SimThink_ScheduledThinkCount() );
+			int lateCount = SimThink_ScheduledThinkCopy( lateThinkers.Base(), lateThinkers.Count(), gpGlobals->tickcount );
+			if ( !lateCount )
+				break;
+
+			VPROF_INCREMENT_COUNTER( "due thinkers", lateCount );
+			for ( int i = 0; i < lateCount; i++ )
+			{
+				gpGlobals->curtime = starttime;
+				Physics_SimulateEntity( lateThinkers[i] );
+			}
+		}
 		UTIL_EnableRemoveImmediate();
 	}
 
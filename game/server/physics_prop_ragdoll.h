@@ -52,6 +52,7 @@ public:
 	virtual bool TestCollision( const Ray_t &ray, unsigned int mask, trace_t& trace );
 	virtual void Teleport( const Vector *newPosition, const QAngle *newAngles, const Vector *newVelocity );
 	virtual void SetupBones( matrix3x4_t *pBoneToWorld, int boneMask );
+	virtual bool CanSetupBonesInJob() { return false; }	// Reads the physics objects
 	virtual void VPhysicsUpdate( IPhysicsObject *pPhysics );
 	virtual int VPhysicsGetObjectList( IPhysicsObject **pList, int listMax );
 
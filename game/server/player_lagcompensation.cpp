@@ -10,7 +10,6 @@
 #include "igamesystem.h"
 #include "ilagcompensationmanager.h"
 #include "inetchannelinfo.h"
-#include "utlfixedlinkedlist.h"
 #include "BaseAnimatingOverlay.h"
 #include "tier0/vprof.h"
 
@@ -29,6 +28,13 @@
 #define LAG_COMPENSATION_EPS_SQR ( 0.1f * 0.1f )
 // Allow 4 units of error ( about 1 / 8 bbox width )
 #define LAG_COMPENSATION_ERROR_EPS_SQR ( 4.0f * 4.0f )
+// Hitboxes can reach a little past a player's bounds
+#define LAG_COMPENSATION_HITBOX_BLOAT 16.0f
+
+// Records are kept in a ring indexed by tick, with room for sv_maxunlag's
+// full second at up to 128 ticks a second
+#define LAG_RECORD_TICKS	128
+#define LAG_RECORD_MASK		( LAG_RECORD_TICKS - 1 )
 
 ConVar sv_unlag( "sv_unlag", "1", 0, "Enables player lag compensation" );
 ConVar sv_maxunlag( "sv_maxunlag", "1.0", 0, "Maximum lag compensation in seconds", true, 0.0f, true, 1.0f );
@@ -37,6 +43,9 @@ ConVar sv_showlagcompensation( "sv_showlagcompensation", "0", FCVAR_CHEAT, "Show
 
 ConVar sv_unlag_fixstuck( "sv_unlag_fixstuck", "0", 0, "Disallow backtracking a player for lag compensation if it will cause them to become stuck" );
 
+ConVar sv_unlag_prefilter( "sv_unlag_prefilter", "0", 0, "Skips lag compensating players whose recent positions are all outside a cone in front of the shooter" );
+ConVar sv_unlag_prefilter_cone( "sv_unlag_prefilter_cone", "45", 0, "Half angle in degrees of the cone sv_unlag_prefilter tests players against", true, 0.0f, true, 90.0f );
+
 //-----------------------------------------------------------------------------
 // Purpose: 
 //-----------------------------------------------------------------------------
@@ -115,6 +124,196 @@ public:
 };
 
 
+//-----------------------------------------------------------------------------
+// A player's lag records, in a ring indexed by the tick of their simulation
+// time. A slot only holds a record if its tick matches. The ticks and times
+// every usercmd looks up are kept apart from the records themselves.
+//-----------------------------------------------------------------------------
+struct LagTrack
+{
+	LagTrack()
+	{
+		Clear();
+	}
+
+	void Clear()
+	{
+		// The tick count starts over on a new map, so forget which ticks every slot
+		// held, including slots the tail has already moved past
+		for ( int i = 0; i < LAG_RECORD_TICKS; i++ )
+		{
+			m_nTicks[i] = -1;
+		}
+
+		m_nHeadTick = -1;
+		m_nTailTick = 0;
+		m_nReachableTick = 0;
+		m_vecSweptMins.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+		m_vecSweptMaxs.Init( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+	}
+
+	bool IsEmpty() const
+	{
+		return m_nHeadTick < m_nTailTick;
+	}
+
+	bool HasRecord( int tick ) const
+	{
+		return tick >= m_nTailTick && tick <= m_nHeadTick && m_nTicks[ tick & LAG_RECORD_MASK ] == tick;
+	}
+
+	// Drops records off the tail until it's one simulated at or after flTime
+	void RemoveRecordsBefore( float flTime )
+	{
+		while ( !IsEmpty() && ( !HasRecord( m_nTailTick ) || m_flSimulationTimes[ m_nTailTick & LAG_RECORD_MASK ] < flTime ) )
+		{
+			m_nTailTick++;
+		}
+	}
+
+	int						m_nHeadTick;		// Newest and oldest ticks with a record
+	int						m_nTailTick;
+
+	// Oldest tick BacktrackPlayer() can walk back to before losing track of the
+	// player, and the bounds of the records up to it
+	int						m_nReachableTick;
+	Vector					m_vecSweptMins;
+	Vector					m_vecSweptMaxs;
+
+	int						m_nTicks[ LAG_RECORD_TICKS ];
+	float					m_flSimulationTimes[ LAG_RECORD_TICKS ];
+	LagRecord				m_Records[ LAG_RECORD_TICKS ];
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Works out the animation between two records, like the player's
+//			position. Layers can't be blended across a sequence or order change.
+//-----------------------------------------------------------------------------
+static void InterpolateAnimation( LagRecord *pOut, const LagRecord *record, const LagRecord *prevRecord, float frac, int layerCount )
+{
+	bool interpolationAllowed = false;
+	if( prevRecord && (record->m_masterSequence == prevRecord->m_masterSequence) )
+	{
+		// If the master state changes, all layers will be invalid too, so don't interp (ya know, interp barely ever happens anyway)
+		interpolationAllowed = true;
+	}
+	
+	////////////////////////
+	// First do the master settings
+	pOut->m_masterSequence = record->m_masterSequence;
+	pOut->m_masterCycle = record->m_masterCycle;
+	if( frac > 0.0f && interpolationAllowed )
+	{
+		if( record->m_masterCycle > prevRecord->m_masterCycle )
+		{
+			// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
+			// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
+			float newCycle = Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle + 1 );
+			pOut->m_masterCycle = newCycle < 1 ? newCycle : newCycle - 1;// and make sure .9 to 1.2 does not end up 1.05
+		}
+		else
+		{
+			pOut->m_masterCycle = Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle );
+		}
+	}
+
+	////////////////////////
+	// Now do all the layers
+	for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
+	{
+		const LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
+		LayerRecord &outLayerRecord = pOut->m_layerRecords[layerIndex];
+
+		//Either no interp, or interp failed.  Just use record.
+		outLayerRecord = recordsLayerRecord;
+
+		if( (frac > 0.0f)  &&  interpolationAllowed )
+		{
+			const LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
+			if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
+				&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
+				)
+			{
+				// We can't interpolate across a sequence or order change
+				if( recordsLayerRecord.m_cycle > prevRecordsLayerRecord.m_cycle )
+				{
+					// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
+					// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
+					float newCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle + 1 );
+					outLayerRecord.m_cycle = newCycle < 1 ? newCycle : newCycle - 1;// and make sure .9 to 1.2 does not end up 1.05
+				}
+				else
+				{
+					outLayerRecord.m_cycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle  );
+				}
+				outLayerRecord.m_weight = Lerp( frac, recordsLayerRecord.m_weight, prevRecordsLayerRecord.m_weight  );
+			}
+		}
+	}
+}
+
+static void SaveAnimation( CBasePlayer *pPlayer, LagRecord *pRecord )
+{
+	pRecord->m_masterSequence = pPlayer->GetSequence();
+	pRecord->m_masterCycle = pPlayer->GetCycle();
+
+	int layerCount = pPlayer->GetNumAnimOverlays();
+	for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
+	{
+		CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
+		if( currentLayer )
+		{
+			pRecord->m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
+			pRecord->m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
+			pRecord->m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
+			pRecord->m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
+		}
+	}
+}
+
+static void ApplyAnimation( CBasePlayer *pPlayer, const LagRecord *pRecord )
+{
+	pPlayer->SetSequence(pRecord->m_masterSequence);
+	pPlayer->SetCycle(pRecord->m_masterCycle);
+
+	int layerCount = pPlayer->GetNumAnimOverlays();
+	for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
+	{
+		CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
+		if( currentLayer )
+		{
+			currentLayer->m_flCycle = pRecord->m_layerRecords[layerIndex].m_cycle;
+			currentLayer->m_nOrder = pRecord->m_layerRecords[layerIndex].m_order;
+			currentLayer->m_nSequence = pRecord->m_layerRecords[layerIndex].m_sequence;
+			currentLayer->m_flWeight = pRecord->m_layerRecords[layerIndex].m_weight;
+		}
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Could a shot fired from vecEye within the cone around vecForward
+//			come near these bounds? Tests the bounds' sphere, so it's generous.
+//-----------------------------------------------------------------------------
+static bool IsBoxInShotCone( const Vector &vecMins, const Vector &vecMaxs, const Vector &vecEye, const Vector &vecForward, float flCosHalfAngle, float flSinHalfAngle )
+{
+	Vector vecCenter = ( vecMins + vecMaxs ) * 0.5f;
+	float flRadius = ( vecMaxs - vecCenter ).Length() + LAG_COMPENSATION_HITBOX_BLOAT;
+
+	Vector vecDelta = vecCenter - vecEye;
+	float flDist = vecDelta.Length();
+	if ( flDist <= flRadius )
+		return true;
+
+	// Widen the cone by the angle the sphere takes up
+	float flSin = flRadius / flDist;
+	float flCos = sqrt( 1.0f - flSin * flSin );
+	float flCosWidened = flCosHalfAngle * flCos - flSinHalfAngle * flSin;
+	return DotProduct( vecDelta, vecForward ) >= flDist * flCosWidened;
+}
+
+
 //
 // Try to take the player from his current origin to vWantedPos.
 // If it can't get there, leave the player where he is.
@@ -195,16 +394,18 @@ public:
 	void			FinishLagCompensation( CBasePlayer *player );
 
 private:
+	void			RecordPlayer( LagTrack *track, CBasePlayer *pPlayer );
+	void			UpdateTrackWindow( LagTrack *track );
 	void			BacktrackPlayer( CBasePlayer *player, float flTargetTime );
 
 	void ClearHistory()
 	{
 		for ( int i=0; i<MAX_PLAYERS; i++ )
-			m_PlayerTrack[i].Purge();
+			m_PlayerTrack[i].Clear();
 	}
 
-	// keep a list of lag records for each player
-	CUtlFixedLinkedList< LagRecord >	m_PlayerTrack[ MAX_PLAYERS ];
+	// keep a ring of lag records for each player
+	LagTrack				m_PlayerTrack[ MAX_PLAYERS ];
 
 	// Scratchpad for determining what needs to be restored
 	CBitVec<MAX_PLAYERS>	m_RestorePlayer;
@@ -234,77 +435,115 @@ void CLagCompensationManager::FrameUpdatePostEntityThink()
 	VPROF_BUDGET( "FrameUpdatePostEntityThink", "CLagCompensationManager" );
 
 	// remove all records before that time:
-	int flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
+	float flDeadtime = gpGlobals->curtime - sv_maxunlag.GetFloat();
 
 	// Iterate all active players
 	for ( int i = 1; i <= gpGlobals->maxClients; i++ )
 	{
 		CBasePlayer *pPlayer = UTIL_PlayerByIndex( i );
 
-		CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[i-1];
+		LagTrack *track = &m_PlayerTrack[i-1];
 
 		if ( !pPlayer )
 		{
-			track->RemoveAll();
+			track->Clear();
 			continue;
 		}
 
-		Assert( track->Count() < 1000 ); // insanity check
-
 		// remove tail records that are too old
-		int tailIndex = track->Tail();
-		while ( track->IsValidIndex( tailIndex ) )
-		{
-			LagRecord &tail = track->Element( tailIndex );
+		track->RemoveRecordsBefore( flDeadtime );
 
-			// if tail is within limits, stop
-			if ( tail.m_flSimulationTime >= flDeadtime )
-				break;
-			
-			// remove tail, get new tail
-			track->Remove( tailIndex );
-			tailIndex = track->Tail();
+		// check if player changed simulation time since last time updated, 
+		// don't add new entry for same or older time
+		if ( track->IsEmpty() || 
+			 track->m_flSimulationTimes[ track->m_nHeadTick & LAG_RECORD_MASK ] < pPlayer->GetSimulationTime() )
+		{
+			RecordPlayer( track, pPlayer );
 		}
 
-		// check if head has same simulation time
-		if ( track->Count() > 0 )
-		{
-			LagRecord &head = track->Element( track->Head() );
+		UpdateTrackWindow( track );
+	}
+}
 
-			// check if player changed simulation time since last time updated
-			if ( head.m_flSimulationTime >= pPlayer->GetSimulationTime() )
-				continue; // don't add new entry for same or older time
-		}
+//-----------------------------------------------------------------------------
+// Purpose: Adds a record of where the player is now to the head of the track
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::RecordPlayer( LagTrack *track, CBasePlayer *pPlayer )
+{
+	// A record a fraction of a tick after the head replaces it
+	int tick = TIME_TO_TICKS( pPlayer->GetSimulationTime() );
+	if ( track->IsEmpty() )
+	{
+		track->m_nTailTick = tick;
+	}
+	else
+	{
+		tick = max( tick, track->m_nHeadTick );
+	}
+	track->m_nHeadTick = tick;
 
-		// add new record to player track
-		LagRecord &record = track->Element( track->AddToHead() );
+	// The ring wraps around on to the oldest records at very high tick rates
+	if ( track->m_nTailTick <= tick - LAG_RECORD_TICKS )
+	{
+		track->m_nTailTick = tick - LAG_RECORD_TICKS + 1;
+	}
 
-		record.m_fFlags = 0;
-		if ( pPlayer->IsAlive() )
-		{
-			record.m_fFlags |= LC_ALIVE;
-		}
+	int slot = tick & LAG_RECORD_MASK;
+	track->m_nTicks[slot] = tick;
+	track->m_flSimulationTimes[slot] = pPlayer->GetSimulationTime();
 
-		record.m_flSimulationTime	= pPlayer->GetSimulationTime();
-		record.m_vecAngles			= pPlayer->GetLocalAngles();
-		record.m_vecOrigin			= pPlayer->GetLocalOrigin();
-		record.m_vecMaxs			= pPlayer->WorldAlignMaxs();
-		record.m_vecMins			= pPlayer->WorldAlignMins();
+	// Make sure the tail is a record
+	track->RemoveRecordsBefore( -FLT_MAX );
 
-		int layerCount = pPlayer->GetNumAnimOverlays();
-		for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
-		{
-			CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
-			if( currentLayer )
-			{
-				record.m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-				record.m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-				record.m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-				record.m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
-			}
-		}
-		record.m_masterSequence = pPlayer->GetSequence();
-		record.m_masterCycle = pPlayer->GetCycle();
+	// add new record to player track
+	LagRecord &record = track->m_Records[slot];
+
+	record.m_fFlags = 0;
+	if ( pPlayer->IsAlive() )
+	{
+		record.m_fFlags |= LC_ALIVE;
+	}
+
+	record.m_flSimulationTime	= pPlayer->GetSimulationTime();
+	record.m_vecAngles			= pPlayer->GetLocalAngles();
+	record.m_vecOrigin			= pPlayer->GetLocalOrigin();
+	record.m_vecMaxs			= pPlayer->WorldAlignMaxs();
+	record.m_vecMins			= pPlayer->WorldAlignMins();
+
+	SaveAnimation( pPlayer, &record );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Walks back from the newest record like BacktrackPlayer() does, to
+//			find how far back it can go, and where it can move the player to
+//-----------------------------------------------------------------------------
+void CLagCompensationManager::UpdateTrackWindow( LagTrack *track )
+{
+	track->m_nReachableTick = track->m_nHeadTick + 1;
+	track->m_vecSweptMins.Init( FLT_MAX, FLT_MAX, FLT_MAX );
+	track->m_vecSweptMaxs.Init( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+
+	const LagRecord *prevRecord = NULL;
+	for ( int tick = track->m_nHeadTick; tick >= track->m_nTailTick; tick-- )
+	{
+		if ( !track->HasRecord( tick ) )
+			continue;
+
+		const LagRecord *record = &track->m_Records[ tick & LAG_RECORD_MASK ];
+
+		// player must be alive, lost track
+		if ( !(record->m_fFlags & LC_ALIVE) )
+			break;
+
+		// lost track, too much difference
+		if ( prevRecord && ( record->m_vecOrigin - prevRecord->m_vecOrigin ).LengthSqr() > LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
+			break;
+
+		track->m_nReachableTick = tick;
+		VectorMin( track->m_vecSweptMins, record->m_vecOrigin + record->m_vecMins, track->m_vecSweptMins );
+		VectorMax( track->m_vecSweptMaxs, record->m_vecOrigin + record->m_vecMaxs, track->m_vecSweptMaxs );
+
+		prevRecord = record;
 	}
 }
 
@@ -327,8 +566,9 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 
 	// NOTE: Put this here so that it won't show up in single player mode.
 	VPROF_BUDGET( "StartLagCompensation", VPROF_BUDGETGROUP_OTHER_NETWORKING );
-	Q_memset( m_RestoreData, 0, sizeof( m_RestoreData ) );
-	Q_memset( m_ChangeData, 0, sizeof( m_ChangeData ) );
+
+	// NOTE: m_RestoreData and m_ChangeData are only read for the players 
+	// BacktrackPlayer() fills them in for, so they don't need clearing.
 
 	// Get true latency
 
@@ -364,6 +604,15 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		// DevMsg("StartLagCompensation: delta too big (%.3f)\n", deltaTime );
 		targettick = gpGlobals->tickcount - TIME_TO_TICKS( correct );
 	}
+
+	// The cone the shooter is looking down
+	bool bPrefilter = sv_unlag_prefilter.GetBool();
+	Vector vecEye = player->EyePosition();
+	Vector vecForward;
+	AngleVectors( cmd->viewangles, &vecForward );
+	float flHalfAngle = DEG2RAD( sv_unlag_prefilter_cone.GetFloat() );
+	float flCosHalfAngle = cos( flHalfAngle );
+	float flSinHalfAngle = sin( flHalfAngle );
 	
 	// Iterate all active players
 	const CBitVec<MAX_EDICTS> *pEntityTransmitBits = engine->GetEntityTransmitBitsForClient( player->entindex() - 1 );
@@ -386,6 +635,18 @@ void CLagCompensationManager::StartLagCompensation( CBasePlayer *player, CUserCm
 		if ( !player->WantsLagCompensationOnEntity( pPlayer, cmd, pEntityTransmitBits ) )
 			continue;
 
+		// Don't bother if they'd be out of the line of fire both where they are and 
+		// anywhere they could be moved back to. Track bounds are in the parent's space.
+		if ( bPrefilter && !pPlayer->GetMoveParent() )
+		{
+			const LagTrack &track = m_PlayerTrack[ i - 1 ];
+			Vector vecMins, vecMaxs;
+			VectorMin( track.m_vecSweptMins, pPlayer->GetAbsOrigin() + pPlayer->WorldAlignMins(), vecMins );
+			VectorMax( track.m_vecSweptMaxs, pPlayer->GetAbsOrigin() + pPlayer->WorldAlignMaxs(), vecMaxs );
+			if ( !IsBoxInShotCone( vecMins, vecMaxs, vecEye, vecForward, flCosHalfAngle, flSinHalfAngle ) )
+				continue;
+		}
+
 		// Move other player back in time
 		BacktrackPlayer( pPlayer, TICKS_TO_TIME( targettick ) );
 	}
@@ -400,61 +661,55 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	int pl_index = pPlayer->entindex() - 1;
 
 	// get track history of this player
-	CUtlFixedLinkedList< LagRecord > *track = &m_PlayerTrack[ pl_index ];
+	LagTrack *track = &m_PlayerTrack[ pl_index ];
 
 	// check if we have at leat one entry
-	if ( track->Count() <= 0 )
+	if ( track->IsEmpty() )
 		return;
 
-	int curr = track->Head();
-
-	LagRecord *prevRecord = NULL;
-	LagRecord *record = NULL;
-
-	Vector prevOrg = pPlayer->GetLocalOrigin();
-	
-	// Walk context looking for any invalidating event
-	while( track->IsValidIndex(curr) )
+	// The walk back through the records starts from where the player is now
+	LagRecord *record = &track->m_Records[ track->m_nHeadTick & LAG_RECORD_MASK ];
+	if ( !(record->m_fFlags & LC_ALIVE) )
 	{
-		// remember last record
-		prevRecord = record;
-
-		// get next record
-		record = &track->Element( curr );
-
-		if ( !(record->m_fFlags & LC_ALIVE) )
-		{
-			// player most be alive, lost track
-			return;
-		}
-
-		Vector delta = record->m_vecOrigin - prevOrg;
-		if ( delta.LengthSqr() > LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
-		{
-			// lost track, too much difference
-			return; 
-		}
+		// player most be alive, lost track
+		return;
+	}
 
-		// did we find a context smaller than target time ?
-		if ( record->m_flSimulationTime <= flTargetTime )
-			break; // hurra, stop
+	Vector delta = record->m_vecOrigin - pPlayer->GetLocalOrigin();
+	if ( delta.LengthSqr() > LAG_COMPENSATION_TELEPORTED_DISTANCE_SQR )
+	{
+		// lost track, too much difference
+		return; 
+	}
 
-		prevOrg = record->m_vecOrigin;
+	// Find the newest record at or before the target time. Records from ticks 
+	// after the target's are always newer, so this is normally the first one looked at.
+	// If they're all newer, use the oldest.
+	int tick = min( TIME_TO_TICKS( flTargetTime ), track->m_nHeadTick );
+	while ( tick > track->m_nTailTick && 
+		    !( track->HasRecord( tick ) && track->m_flSimulationTimes[ tick & LAG_RECORD_MASK ] <= flTargetTime ) )
+	{
+		tick--;
+	}
+	tick = max( tick, track->m_nTailTick );
 
-		// go one step back
-		curr = track->Next( curr );
+	if ( tick < track->m_nReachableTick )
+	{
+		// The player died or teleported since then, lost track
+		return;
 	}
 
-	Assert( record );
+	record = &track->m_Records[ tick & LAG_RECORD_MASK ];
 
-	if ( !record )
+	// The next newer record, to interpolate towards
+	LagRecord *prevRecord = NULL;
+	for ( int newerTick = tick + 1; newerTick <= track->m_nHeadTick; newerTick++ )
 	{
-		if ( sv_unlag_debug.GetBool() )
+		if ( track->HasRecord( newerTick ) )
 		{
-			DevMsg( "No valid positions in history for BacktrackPlayer client ( %s )\n", pPlayer->GetPlayerName() );
+			prevRecord = &track->m_Records[ newerTick & LAG_RECORD_MASK ];
+			break;
 		}
-
-		return; // that should never happen
 	}
 
 	float frac = 0.0f;
@@ -489,6 +744,11 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 		maxs = record->m_vecMaxs;
 	}
 
+	LagRecord *restore = &m_RestoreData[ pl_index ];
+	LagRecord *change  = &m_ChangeData[ pl_index ];
+
+	InterpolateAnimation( change, record, prevRecord, frac, pPlayer->GetNumAnimOverlays() );
+
 	// See if this is still a valid position for us to teleport to
 	if ( sv_unlag_fixstuck.GetBool() )
 	{
@@ -550,8 +810,6 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	
 	// See if this represents a change for the player
 	int flags = 0;
-	LagRecord *restore = &m_RestoreData[ pl_index ];
-	LagRecord *change  = &m_ChangeData[ pl_index ];
 
 	QAngle angdiff = pPlayer->GetLocalAngles() - ang;
 	Vector orgdiff = pPlayer->GetLocalOrigin() - org;
@@ -592,93 +850,8 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 	// standing still, but you breathe even on the server.
 	// This is quicker than actually comparing all bazillion floats.
 	flags |= LC_ANIMATION_CHANGED;
-	restore->m_masterSequence = pPlayer->GetSequence();
-	restore->m_masterCycle = pPlayer->GetCycle();
-
-	bool interpolationAllowed = false;
-	if( prevRecord && (record->m_masterSequence == prevRecord->m_masterSequence) )
-	{
-		// If the master state changes, all layers will be invalid too, so don't interp (ya know, interp barely ever happens anyway)
-		interpolationAllowed = true;
-	}
-	
-	////////////////////////
-	// First do the master settings
-	bool interpolatedMasters = false;
-	if( frac > 0.0f && interpolationAllowed )
-	{
-		interpolatedMasters = true;
-		pPlayer->SetSequence( Lerp( frac, record->m_masterSequence, prevRecord->m_masterSequence ) );
-		pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
-
-		if( record->m_masterCycle > prevRecord->m_masterCycle )
-		{
-			// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
-			// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
-			float newCycle = Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle + 1 );
-			pPlayer->SetCycle(newCycle < 1 ? newCycle : newCycle - 1 );// and make sure .9 to 1.2 does not end up 1.05
-		}
-		else
-		{
-			pPlayer->SetCycle( Lerp( frac, record->m_masterCycle, prevRecord->m_masterCycle ) );
-		}
-	}
-	if( !interpolatedMasters )
-	{
-		pPlayer->SetSequence(record->m_masterSequence);
-		pPlayer->SetCycle(record->m_masterCycle);
-	}
-
-	////////////////////////
-	// Now do all the layers
-	int layerCount = pPlayer->GetNumAnimOverlays();
-	for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
-	{
-		CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
-		if( currentLayer )
-		{
-			restore->m_layerRecords[layerIndex].m_cycle = currentLayer->m_flCycle;
-			restore->m_layerRecords[layerIndex].m_order = currentLayer->m_nOrder;
-			restore->m_layerRecords[layerIndex].m_sequence = currentLayer->m_nSequence;
-			restore->m_layerRecords[layerIndex].m_weight = currentLayer->m_flWeight;
-
-			bool interpolated = false;
-			if( (frac > 0.0f)  &&  interpolationAllowed )
-			{
-				LayerRecord &recordsLayerRecord = record->m_layerRecords[layerIndex];
-				LayerRecord &prevRecordsLayerRecord = prevRecord->m_layerRecords[layerIndex];
-				if( (recordsLayerRecord.m_order == prevRecordsLayerRecord.m_order)
-					&& (recordsLayerRecord.m_sequence == prevRecordsLayerRecord.m_sequence)
-					)
-				{
-					// We can't interpolate across a sequence or order change
-					interpolated = true;
-					if( recordsLayerRecord.m_cycle > prevRecordsLayerRecord.m_cycle )
-					{
-						// the older record is higher in frame than the newer, it must have wrapped around from 1 back to 0
-						// add one to the newer so it is lerping from .9 to 1.1 instead of .9 to .1, for example.
-						float newCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle + 1 );
-						currentLayer->m_flCycle = newCycle < 1 ? newCycle : newCycle - 1;// and make sure .9 to 1.2 does not end up 1.05
-					}
-					else
-					{
-						currentLayer->m_flCycle = Lerp( frac, recordsLayerRecord.m_cycle, prevRecordsLayerRecord.m_cycle  );
-					}
-					currentLayer->m_nOrder = recordsLayerRecord.m_order;
-					currentLayer->m_nSequence = recordsLayerRecord.m_sequence;
-					currentLayer->m_flWeight = Lerp( frac, recordsLayerRecord.m_weight, prevRecordsLayerRecord.m_weight  );
-				}
-			}
-			if( !interpolated )
-			{
-				//Either no interp, or interp failed.  Just use record.
-				currentLayer->m_flCycle = record->m_layerRecords[layerIndex].m_cycle;
-				currentLayer->m_nOrder = record->m_layerRecords[layerIndex].m_order;
-				currentLayer->m_nSequence = record->m_layerRecords[layerIndex].m_sequence;
-				currentLayer->m_flWeight = record->m_layerRecords[layerIndex].m_weight;
-			}
-		}
-	}
+	SaveAnimation( pPlayer, restore );
+	ApplyAnimation( pPlayer, change );
 	
 	if ( !flags )
 		return; // we didn't change anything
@@ -706,6 +879,7 @@ void CLagCompensationManager::BacktrackPlayer( CBasePlayer *pPlayer, float flTar
 void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 {
 	VPROF_BUDGET_FLAGS( "FinishLagCompensation", VPROF_BUDGETGROUP_OTHER_NETWORKING, BUDGETFLAG_CLIENT|BUDGETFLAG_SERVER );
+
 	if ( !m_bNeedToRestore )
 		return; // no player was changed at all
 
@@ -773,21 +947,7 @@ void CLagCompensationManager::FinishLagCompensation( CBasePlayer *player )
 		{
 			restoreSimulationTime = true;
 
-			pPlayer->SetSequence(restore->m_masterSequence);
-			pPlayer->SetCycle(restore->m_masterCycle);
-
-			int layerCount = pPlayer->GetNumAnimOverlays();
-			for( int layerIndex = 0; layerIndex < layerCount; ++layerIndex )
-			{
-				CAnimationLayer *currentLayer = pPlayer->GetAnimOverlay(layerIndex);
-				if( currentLayer )
-				{
-					currentLayer->m_flCycle = restore->m_layerRecords[layerIndex].m_cycle;
-					currentLayer->m_nOrder = restore->m_layerRecords[layerIndex].m_order;
-					currentLayer->m_nSequence = restore->m_layerRecords[layerIndex].m_sequence;
-					currentLayer->m_flWeight = restore->m_layerRecords[layerIndex].m_weight;
-				}
-			}
+			ApplyAnimation( pPlayer, restore );
 		}
 
 		if ( restoreSimulationTime )
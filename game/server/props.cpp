@@ -23,6 +23,7 @@
 #include "vstdlib/strtools.h"
 #include "physics_impact_damage.h"
 #include "KeyValues.h"
+#include "tier1/keyvaluesarena.h"
 #include "filesystem.h"
 #include "scriptevent.h"
 #include "entityblocker.h"
@@ -323,23 +324,24 @@ void CBaseProp::CalculateBlockLOS( void )
 //-----------------------------------------------------------------------------
 int CBaseProp::ParsePropData( void )
 {
-	KeyValues *modelKeyValues = new KeyValues("");
-	if ( !modelKeyValues->LoadFromBuffer( modelinfo->GetModelName( GetModel() ), modelinfo->GetModelKeyValueText( GetModel() ) ) )
-	{
-		modelKeyValues->deleteThis();
-		return PARSE_FAILED_NO_DATA;
-	}
+	// The model's keyvalues only live until we've read them, so parse them
+	// into an arena instead of making a heap allocation per key and value.
+	static CKeyValuesArena s_PropDataArena;
+	KeyValuesArenaMark_t mark = s_PropDataArena.GetMark();
 
-	// Do we have a props section?
-	KeyValues *pkvPropData = modelKeyValues->FindKey("prop_data");
-	if ( !pkvPropData )
+	int iResult = PARSE_FAILED_NO_DATA;
+	KeyValues *modelKeyValues = s_PropDataArena.CreateKeyValues("");
+	if ( modelKeyValues->LoadFromBuffer( modelinfo->GetModelName( GetModel() ), modelinfo->GetModelKeyValueText( GetModel() ) ) )
 	{
-		modelKeyValues->deleteThis();
-		return PARSE_FAILED_NO_DATA;
+		// Do we have a props section?
+		KeyValues *pkvPropData = modelKeyValues->FindKey("prop_data");
+		if ( pkvPropData )
+		{
+			iResult = g_PropDataSystem.ParsePropFromKV( this, pkvPropData, modelKeyValues );
+		}
 	}
 
-	int iResult = g_PropDataSystem.ParsePropFromKV( this, pkvPropData, modelKeyValues );
-	modelKeyValues->deleteThis();
+	s_PropDataArena.FreeToMark( mark );
 	return iResult;
 }
 
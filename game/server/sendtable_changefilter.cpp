@@ -0,0 +1,360 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Narrows full network state changes down to the props that really
+//			changed.
+//
+//			Chained and embedded network vars, and any code that calls
+//			NetworkStateChanged() without a variable, mark the whole edict as
+//			changed. The engine then runs every send proxy of the entity for
+//			every client snapshot. Once an entity has been sent, we keep a
+//			packed copy of its props (see dt_send_compiled.h). Right before the
+//			engine packs entities, full changes are compared against that copy:
+//			an entity that didn't change at all is unmarked, and one that only
+//			changed a few props reports just their offsets.
+//
+//			The copy is only trusted while it matches what the engine last
+//			sent. If the engine didn't consume a change we reported, the entity
+//			gets its full change back and is captured again from scratch.
+//
+//=============================================================================//
+
+#include "cbase.h"
+#include "igamesystem.h"
+#include "dt_send_compiled.h"
+#include "tier1/utlflatmap.h"
+#include "tier0/vprof.h"
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+ConVar sv_sendtable_changefilter( "sv_sendtable_changefilter", "0", 0, "Compare fully changed entities against their last sent props and only report the props that changed." );
+
+
+class CSendTableChangeFilter : public CAutoGameSystemPerFrame
+{
+public:
+	CSendTableChangeFilter() : CAutoGameSystemPerFrame( "CSendTableChangeFilter" ), m_bEnabled( false )
+	{
+		memset( &m_Stats, 0, sizeof( m_Stats ) );
+	}
+
+	virtual void Shutdown();
+	virtual void LevelShutdownPostEntity();
+	virtual void FrameUpdatePreEntityThink();
+	virtual void PreClientUpdate();
+
+	void Report();
+
+private:
+	struct EntityState_t
+	{
+		EntityState_t() : m_pTable( NULL ), m_bSynced( false ), m_bNarrowed( false ) {}
+
+		CBaseHandle					m_hEntity;
+		const CCompiledSendTable	*m_pTable;
+		CUtlVector<unsigned char>	m_Snapshot;		// What the engine last sent, if m_bSynced
+		bool						m_bSynced;
+		bool						m_bNarrowed;	// We replaced a full change this frame
+	};
+
+	struct Stats_t
+	{
+		int		m_nFrames;
+		int		m_nFullChanges;			// Full changes seen while synced
+		int		m_nUnchanged;			// ...that turned out to change nothing
+		int		m_nNarrowed;			// ...that now report a few offsets
+		int		m_nTooManyChanges;		// ...that had to stay full
+		int		m_nReportedOffsets;
+		int		m_nResyncs;				// Full captures
+		int		m_nNotConsumed;			// Changes the engine didn't pack
+	};
+
+	const CCompiledSendTable *GetCompiledTable( SendTable *pTable );
+	EntityState_t *GetState( CBaseEntity *pEntity, edict_t *pEdict );
+	void Capture( EntityState_t *pState, CBaseEntity *pEntity );
+	void CheckPending();
+	void FilterEntity( EntityState_t *pState, CBaseEntity *pEntity, edict_t *pEdict );
+
+	CUtlFlatMap<SendTable *, CCompiledSendTable *> m_Tables;
+	EntityState_t			m_States[MAX_EDICTS];
+	CUtlVector<int>			m_Pending;		// Edicts we captured or narrowed since the last check
+	CUtlVector<unsigned char>	m_Scratch;
+	Stats_t					m_Stats;
+	bool					m_bEnabled;
+};
+
+static CSendTableChangeFilter g_SendTableChangeFilter;
+
+
+//-----------------------------------------------------------------------------
+// Purpose:
+//-----------------------------------------------------------------------------
+void CSendTableChangeFilter::Shutdown()
+{
+	LevelShutdownPostEntity();
+
+	for ( int i = m_Tables.MaxElement(); --i >= 0; )
+	{
+		if ( m_Tables.IsValidIndex( i ) )
+		{
+			delete m_Tables[i];
+		}
+	}
+	m_Tables.Purge();
+}
+
+
+void CSendTableChangeFilter::LevelShutdownPostEntity()
+{
+	for ( int i = 0; i < MAX_EDICTS; i++ )
+	{
+		m_States[i].m_pTable = NULL;
+		m_States[i].m_hEntity.Term();
+		m_States[i].m_Snapshot.Purge();
+		m_States[i].m_bSynced = false;
+		m_States[i].m_bNarrowed = false;
+	}
+	m_Pending.Purge();
+	m_Scratch.Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Compiled tables live as long as the SendTables, which is forever
+//-----------------------------------------------------------------------------
+const CCompiledSendTable *CSendTableChangeFilter::GetCompiledTable( SendTable *pTable )
+{
+	int i = m_Tables.Find( pTable );
+	if ( i != m_Tables.InvalidIndex() )
+		return m_Tables[i];
+
+	CCompiledSendTable *pCompiled = new CCompiledSendTable;
+	if ( !pCompiled->Compile( pTable ) )
+	{
+		DevMsg( 2, "sv_sendtable_changefilter: %s can't be tracked (%s)\n", pTable->GetName(), pCompiled->GetUntrackableReason() );
+	}
+	m_Tables.Insert( pTable, pCompiled );
+	return pCompiled;
+}
+
+
+CSendTableChangeFilter::EntityState_t *CSendTableChangeFilter::GetState( CBaseEntity *pEntity, edict_t *pEdict )
+{
+	EntityState_t *pState = &m_States[pEntity->entindex()];
+	if ( pState->m_hEntity != pEntity->GetRefEHandle() || !pState->m_pTable )
+	{
+		pState->m_hEntity = pEntity->GetRefEHandle();
+		pState->m_pTable = GetCompiledTable( pEntity->GetServerClass()->m_pTable );
+		pState->m_bSynced = false;
+		pState->m_bNarrowed = false;
+
+		// Padding bytes are never written, so they must start out equal
+		pState->m_Snapshot.SetCount( pState->m_pTable->GetSnapshotSize() );
+		if ( pState->m_Snapshot.Count() )
+		{
+			memset( pState->m_Snapshot.Base(), 0, pState->m_Snapshot.Count() );
+		}
+	}
+	return pState;
+}
+
+
+void CSendTableChangeFilter::Capture( EntityState_t *pState, CBaseEntity *pEntity )
+{
+	pState->m_pTable->Capture( pEntity, pState->m_Snapshot.Base() );
+	m_Stats.m_nResyncs++;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: The engine clears the change flags of every entity it packs. Any
+// entity we touched that still has them set wasn't sent, so the snapshot no
+// longer describes what the clients have.
+//-----------------------------------------------------------------------------
+void CSendTableChangeFilter::CheckPending()
+{
+	for ( int i = 0; i < m_Pending.Count(); i++ )
+	{
+		EntityState_t *pState = &m_States[m_Pending[i]];
+		CBaseEntity *pEntity = gEntList.GetBaseEntity( pState->m_hEntity );
+		edict_t *pEdict = pEntity ? pEntity->edict() : NULL;
+		if ( !pEdict )
+		{
+			pState->m_pTable = NULL;
+			continue;
+		}
+
+		if ( pEdict->HasStateChanged() )
+		{
+			m_Stats.m_nNotConsumed++;
+			pState->m_bSynced = false;
+
+			// Left alone, the full change would have stuck until the engine
+			// sent the entity, so put it back
+			if ( pState->m_bNarrowed )
+			{
+				pEdict->StateChanged();
+			}
+		}
+		else
+		{
+			pState->m_bSynced = true;
+		}
+
+		pState->m_bNarrowed = false;
+	}
+
+	m_Pending.RemoveAll();
+}
+
+
+void CSendTableChangeFilter::FrameUpdatePreEntityThink()
+{
+	CheckPending();
+}
+
+
+void CSendTableChangeFilter::FilterEntity( EntityState_t *pState, CBaseEntity *pEntity, edict_t *pEdict )
+{
+	if ( !pEdict->HasStateChanged() )
+		return;
+
+	// Changes reported by offset are merged with the previous ones by the
+	// engine, and we can't see which props they touched
+	if ( !( pEdict->m_fStateFlags & FL_FULL_EDICT_CHANGED ) )
+	{
+		pState->m_bSynced = false;
+		return;
+	}
+
+	const CCompiledSendTable *pTable = pState->m_pTable;
+	if ( !pState->m_bSynced )
+	{
+		Capture( pState, pEntity );
+		m_Pending.AddToTail( pEntity->entindex() );
+		return;
+	}
+
+	m_Stats.m_nFullChanges++;
+
+	m_Scratch.SetCount( pTable->GetSnapshotSize() );
+	memcpy( m_Scratch.Base(), pState->m_Snapshot.Base(), pTable->GetSnapshotSize() );
+	pTable->Capture( pEntity, m_Scratch.Base() );
+
+	unsigned short changeOffsets[MAX_CHANGE_OFFSETS];
+	int nChangeOffsets = pTable->FindChanges( pState->m_Snapshot.Base(), m_Scratch.Base(), changeOffsets, MAX_CHANGE_OFFSETS );
+
+	// The scratch copy is what the engine will send in every case but one
+	memcpy( pState->m_Snapshot.Base(), m_Scratch.Base(), pTable->GetSnapshotSize() );
+
+	if ( nChangeOffsets < 0 || ( nChangeOffsets == 0 && pTable->HasRecipientProxies() ) )
+	{
+		m_Stats.m_nTooManyChanges++;
+		m_Pending.AddToTail( pEntity->entindex() );
+		return;
+	}
+
+	pEdict->ClearStateChanged();
+
+	if ( nChangeOffsets == 0 )
+	{
+		// Nothing to send, and nothing for the engine to consume
+		m_Stats.m_nUnchanged++;
+		return;
+	}
+
+	for ( int i = 0; i < nChangeOffsets; i++ )
+	{
+		pEdict->StateChanged( changeOffsets[i] );
+	}
+
+	// StateChanged() falls back to a full change when the frame's change
+	// infos run out, which is still correct
+	m_Stats.m_nNarrowed++;
+	m_Stats.m_nReportedOffsets += nChangeOffsets;
+	pState->m_bNarrowed = !( pEdict->m_fStateFlags & FL_FULL_EDICT_CHANGED );
+	m_Pending.AddToTail( pEntity->entindex() );
+}
+
+
+void CSendTableChangeFilter::PreClientUpdate()
+{
+	// Catches frames where GameFrame() returned before the game systems ran
+	CheckPending();
+
+	if ( !sv_sendtable_changefilter.GetBool() )
+	{
+		// Whatever gets sent from now on isn't in the snapshots
+		if ( m_bEnabled )
+		{
+			for ( int i = 0; i < MAX_EDICTS; i++ )
+			{
+				m_States[i].m_bSynced = false;
+			}
+			m_bEnabled = false;
+		}
+		return;
+	}
+
+	m_bEnabled = true;
+
+	VPROF( "CSendTableChangeFilter::PreClientUpdate" );
+
+	m_Stats.m_nFrames++;
+
+	for ( CBaseEntity *pEntity = gEntList.FirstEnt(); pEntity; pEntity = gEntList.NextEnt( pEntity ) )
+	{
+		edict_t *pEdict = pEntity->edict();
+		if ( !pEdict || pEdict->IsFree() || ( pEdict->m_fStateFlags & FL_EDICT_DONTSEND ) )
+			continue;
+
+		EntityState_t *pState = GetState( pEntity, pEdict );
+		if ( pState->m_pTable->IsTrackable() )
+		{
+			FilterEntity( pState, pEntity, pEdict );
+		}
+	}
+}
+
+
+void CSendTableChangeFilter::Report()
+{
+	int nTrackable = 0, nProps = 0, nVolatile = 0;
+	for ( int i = 0; i < m_Tables.MaxElement(); i++ )
+	{
+		if ( !m_Tables.IsValidIndex( i ) )
+			continue;
+
+		const CCompiledSendTable *pTable = m_Tables[i];
+		if ( !pTable->IsTrackable() )
+		{
+			Msg( "  %-32s untrackable (%s)\n", pTable->GetName(), pTable->GetUntrackableReason() );
+			continue;
+		}
+
+		nTrackable++;
+		nProps += pTable->GetNumProps();
+		nVolatile += pTable->GetNumVolatileProps();
+	}
+
+	Msg( "%d of %d compiled tables trackable, %d props (%d volatile)\n", nTrackable, m_Tables.Count(), nProps, nVolatile );
+	Msg( "%d frames: %d full changes on synced entities\n", m_Stats.m_nFrames, m_Stats.m_nFullChanges );
+	if ( m_Stats.m_nFullChanges )
+	{
+		float flScale = 100.0f / m_Stats.m_nFullChanges;
+		Msg( "  unchanged %d (%.1f%%), narrowed %d (%.1f%%, %.1f offsets each), kept full %d (%.1f%%)\n",
+			m_Stats.m_nUnchanged, m_Stats.m_nUnchanged * flScale,
+			m_Stats.m_nNarrowed, m_Stats.m_nNarrowed * flScale, m_Stats.m_nNarrowed ? (float)m_Stats.m_nReportedOffsets / m_Stats.m_nNarrowed : 0.0f,
+			m_Stats.m_nTooManyChanges, m_Stats.m_nTooManyChanges * flScale );
+	}
+	Msg( "%d full captures, %d changes not packed by the engine\n", m_Stats.m_nResyncs, m_Stats.m_nNotConsumed );
+
+	memset( &m_Stats, 0, sizeof( m_Stats ) );
+}
+
+
+CON_COMMAND( sv_sendtable_changefilter_report, "Prints and resets the sv_sendtable_changefilter counters." )
+{
+	g_SendTableChangeFilter.Report();
+}
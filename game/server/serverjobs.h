@@ -0,0 +1,41 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: The server's shared job pool, and a helper that splits a loop
+//			across it.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef SERVERJOBS_H
+#define SERVERJOBS_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+class CAsyncJobPool;
+
+// The pool shared by server systems. NULL when sv_jobthreads is 0 or the
+// machine has a single logical processor.
+CAsyncJobPool *ServerJobPool();
+
+// Number of threads a parallel loop can use, including the calling thread.
+int ServerJobThreadCount();
+
+//-----------------------------------------------------------------------------
+// Calls pfnRange( pContext, iFirst, iLast ) on consecutive ranges that cover
+// [0, nItems), with at least nMinPerJob items in each range but the last.
+// The calling thread runs the first range itself and returns once all of
+// them are done, without picking up other jobs from the pool while it waits.
+// Ranges run concurrently, so pfnRange may only write state that belongs to
+// its own range.
+//
+// Range boundaries fall on multiples of nAlign items (a power of two), so
+// per-item arrays of bytes or bits don't share cache lines between ranges.
+// Loops over a few expensive items should pass 1.
+//-----------------------------------------------------------------------------
+typedef void (*ServerJobRangeFn_t)( void *pContext, int iFirst, int iLast );
+
+void ServerJobs_ParallelFor( int nItems, int nMinPerJob, ServerJobRangeFn_t pfnRange, void *pContext, int nAlign = 64 );
+
+#endif // SERVERJOBS_H
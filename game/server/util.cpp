@@ -20,6 +20,7 @@
 #include "vstdlib/random.h"
 #include "soundflags.h"
 #include "ispatialpartition.h"
+#include "entityspatialindex.h"
 #include "igamesystem.h"
 #include "saverestoretypes.h"
 #include "checksum_crc.h"
@@ -267,19 +268,19 @@ float UTIL_GetSimulationInterval()
 //-----------------------------------------------------------------------------
 int UTIL_EntitiesInBox( const Vector &mins, const Vector &maxs, CFlaggedEntitiesEnum *pEnum )
 {
-	partition->EnumerateElementsInBox( PARTITION_ENGINE_NON_STATIC_EDICTS, mins, maxs, false, pEnum );
+	g_EntitySpatialIndex.EnumerateElementsInBox( mins, maxs, pEnum );
 	return pEnum->GetCount();
 }
 
 int UTIL_EntitiesAlongRay( const Ray_t &ray, CFlaggedEntitiesEnum *pEnum )
 {
-	partition->EnumerateElementsAlongRay( PARTITION_ENGINE_NON_STATIC_EDICTS, ray, false, pEnum );
+	g_EntitySpatialIndex.EnumerateElementsAlongRay( ray, pEnum );
 	return pEnum->GetCount();
 }
 
 int UTIL_EntitiesInSphere( const Vector &center, float radius, CFlaggedEntitiesEnum *pEnum )
 {
-	partition->EnumerateElementsInSphere( PARTITION_ENGINE_NON_STATIC_EDICTS, center, radius, false, pEnum );
+	g_EntitySpatialIndex.EnumerateElementsInSphere( center, radius, pEnum );
 	return pEnum->GetCount();
 }
 
@@ -75,6 +75,9 @@ void CBaseEntity::SetPlayerSimulated( CBasePlayer *pOwner )
 	m_bIsPlayerSimulated = true;
 	pOwner->AddToPlayerSimulationList( this );
 	m_hPlayerSimulationOwner = pOwner;
+#if !defined( CLIENT_DLL )
+	SimThink_EntityChanged( this );
+#endif
 }
 
 void CBaseEntity::UnsetPlayerSimulated( void )
@@ -85,6 +88,9 @@ void CBaseEntity::UnsetPlayerSimulated( void )
 	}
 	m_hPlayerSimulationOwner = NULL;
 	m_bIsPlayerSimulated = false;
+#if !defined( CLIENT_DLL )
+	SimThink_EntityChanged( this );
+#endif
 }
 #endif
 
@@ -404,7 +410,14 @@ bool CBaseEntity::KeyValue( const char *szKeyName, const char *szValue )
 	
 	if ( FStrEq( szKeyName, "targetname" ) )
 	{
-		m_iName = AllocPooledString( szValue );
+		SetName( AllocPooledString( szValue ) );
+		return true;
+	}
+
+	// Set here rather than through the data description so the entity list sees the change
+	if ( FStrEq( szKeyName, "classname" ) )
+	{
+		SetClassname( szValue );
 		return true;
 	}
 
@@ -841,17 +854,16 @@ void CBaseEntity::CheckHasThinkFunction( bool isThinking )
 	if ( IsEFlagSet( EFL_NO_THINK_FUNCTION ) && isThinking )
 	{
 		RemoveEFlags( EFL_NO_THINK_FUNCTION );
-#if !defined( CLIENT_DLL )
-		SimThink_EntityChanged( this );
-#endif
 	}
 	else if ( !isThinking && !IsEFlagSet( EFL_NO_THINK_FUNCTION ) && !WillThink() )
 	{
 		AddEFlags( EFL_NO_THINK_FUNCTION );
+	}
+
 #if !defined( CLIENT_DLL )
-		SimThink_EntityChanged( this );
+	// Thinkers are scheduled by their next think tick, so this changes even when the flag doesn't
+	SimThink_EntityChanged( this );
 #endif
-	}
 }
 
 bool CBaseEntity::WillSimulateGamePhysics()
@@ -94,6 +94,8 @@ public:
 	virtual void			PostDataUpdate( DataUpdateType_t updateType );
 
 	virtual bool			Interpolate( float currentTime );
+	// Interpolate() extrapolates the cycle after the vars are interpolated
+	virtual bool			CanInterpolateInBatch()	{ return false; }
 
 	bool					ShouldFlipViewModel();
 	void					UpdateAnimationParity( void );
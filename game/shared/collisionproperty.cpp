@@ -22,6 +22,7 @@
 #include "baseanimating.h"
 #include "sendproxy.h"
 #include "hierarchy.h"
+#include "entityspatialindex.h"
 #endif
 
 #include "predictable_entity.h"
@@ -162,6 +163,12 @@ void CDirtySpatialPartitionEntityList::OnPreQuery()
 }
 
 
+void UpdateDirtySpatialPartitionEntities()
+{
+	s_DirtyKDTree.OnPreQuery();
+}
+
+
 
 //-----------------------------------------------------------------------------
 // Save/load
@@ -1124,6 +1131,9 @@ void CCollisionProperty::DestroyPartitionHandle()
 	{
 		partition->DestroyHandle( m_Partition );
 		m_Partition = PARTITION_INVALID_HANDLE;
+#ifndef CLIENT_DLL
+		g_EntitySpatialIndex.RemoveEntity( m_pOuter );
+#endif
 	}
 }
 
@@ -1141,6 +1151,7 @@ void CCollisionProperty::UpdateServerPartitionMask( )
 	// Remove it from whatever lists it may be in at the moment
 	// We'll re-add it below if we need to.
 	partition->Remove( handle );
+	g_EntitySpatialIndex.RemoveEntity( m_pOuter );
 
 	// Don't bother with deleted things
 	if ( !m_pOuter->edict() )
@@ -1155,6 +1166,7 @@ void CCollisionProperty::UpdateServerPartitionMask( )
 	if ( bIsSolid || m_pOuter->IsEFlagSet(EFL_USE_PARTITION_WHEN_NOT_SOLID) )
 	{
 		partition->Insert( PARTITION_ENGINE_NON_STATIC_EDICTS, handle );
+		g_EntitySpatialIndex.InsertEntity( m_pOuter );
 	}
 
 	if ( !bIsSolid )
@@ -1236,10 +1248,16 @@ void CCollisionProperty::UpdatePartition( )
 				vecSurroundMins -= Vector( 1, 1, 1 );
 				vecSurroundMaxs += Vector( 1, 1, 1 );
 				partition->ElementMoved( GetPartitionHandle(), vecSurroundMins,  vecSurroundMaxs );
+#ifndef CLIENT_DLL
+				g_EntitySpatialIndex.MoveEntity( m_pOuter, vecSurroundMins, vecSurroundMaxs );
+#endif
 			}
 			else
 			{
 				partition->ElementMoved( GetPartitionHandle(), GetCollisionOrigin(),  GetCollisionOrigin() );
+#ifndef CLIENT_DLL
+				g_EntitySpatialIndex.MoveEntity( m_pOuter, GetCollisionOrigin(), GetCollisionOrigin() );
+#endif
 			}
 		}
 	}
@@ -466,4 +466,11 @@ inline bool CCollisionProperty::DoesRotationInvalidateSurroundingBox( ) const
 }
 
 
+//-----------------------------------------------------------------------------
+// Updates the partition for every entity that has moved since the last query.
+// Partition queries do this themselves; other users of entity bounds call it.
+//-----------------------------------------------------------------------------
+void UpdateDirtySpatialPartitionEntities();
+
+
 #endif // COLLISIONPROPERTY_H
@@ -29,12 +29,13 @@ class CGameStringPool : public CStringPool,	public CBaseGameSystem
 public:
 	void CGameStringPool::Dump( void )
 	{
-		for ( int i = m_Strings.FirstInorder(); i != m_Strings.InvalidIndex(); i = m_Strings.NextInorder(i) )
+		for ( int i = 0; i < m_Strings.GetNumStrings(); i++ )
 		{
-			DevMsg( "  %d (0x%x) : %s\n", i, m_Strings[i], m_Strings[i] );
+			const char *pszString = m_Strings.String( i );
+			DevMsg( "  %d (0x%x) : %s\n", i, pszString, pszString );
 		}
 		DevMsg( "\n" );
-		DevMsg( "Size:  %d items\n", m_Strings.Count() );
+		DevMsg( "Size:  %d items\n", m_Strings.GetNumStrings() );
 	}
 };
 
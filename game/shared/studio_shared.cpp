@@ -6,15 +6,124 @@
 
 #include "cbase.h"
 #include "studio.h"
+#include "studio_shared.h"
 #include "engine/ivmodelinfo.h"
 #include "utlsymbol.h"
+#include "utlmap.h"
+#include "tier0/threadtools.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
 
+//-----------------------------------------------------------------------------
+// Model info lookups off the main thread
+//
+// The engine's model info is only safe to call on the main thread. Code that
+// sets up bones on job threads makes the lookups the jobs will need on the
+// main thread first (see the Studio_Prefetch*() functions), while
+// Studio_RecordModelLookups() is recording them. While the jobs run, between
+// Studio_BeginModelLookupJobs() and Studio_EndModelLookupJobs(), every
+// lookup is answered from that recording and none reach the engine. One
+// that wasn't recorded finds nothing and counts as a miss on its thread, so
+// the job can tell its result is no good.
+//
+// The recording only changes on the main thread while no jobs are running.
+// What it points at stays put for as long as the caller holds the MDL cache
+// critical section it made the lookups in.
+//-----------------------------------------------------------------------------
+enum
+{
+	// Animation blocks use their block number
+	MODEL_LOOKUP_VIRTUAL_MODEL = -1,
+	MODEL_LOOKUP_AUTOPLAY_LIST = -2,
+	MODEL_LOOKUP_GROUP_MODEL = -3,
+};
+
+struct modellookupkey_t
+{
+	const void		*m_pOwner;
+	int				m_nType;
+};
+
+struct modellookup_t
+{
+	void			*m_pResult;
+	int				m_nCount;
+};
+
+static bool ModelLookupLessFunc( const modellookupkey_t &lhs, const modellookupkey_t &rhs )
+{
+	if ( lhs.m_pOwner != rhs.m_pOwner )
+		return lhs.m_pOwner < rhs.m_pOwner;
+	return lhs.m_nType < rhs.m_nType;
+}
+
+static CUtlMap< modellookupkey_t, modellookup_t > s_ModelLookups( 0, 0, ModelLookupLessFunc );
+static bool s_bRecordModelLookups;
+static bool s_bModelLookupJobs;
+static CThreadLocalInt<> s_nModelLookupMisses;
+
+void Studio_RecordModelLookups( bool bRecord )
+{
+	Assert( ThreadInMainThread() && !s_bModelLookupJobs );
+	if ( bRecord )
+	{
+		s_ModelLookups.RemoveAll();
+	}
+	s_bRecordModelLookups = bRecord;
+}
+
+void Studio_BeginModelLookupJobs()
+{
+	Assert( ThreadInMainThread() && !s_bRecordModelLookups );
+	s_bModelLookupJobs = true;
+}
+
+void Studio_EndModelLookupJobs()
+{
+	Assert( ThreadInMainThread() );
+	s_bModelLookupJobs = false;
+}
+
+int Studio_ModelLookupMisses()
+{
+	return s_nModelLookupMisses;
+}
+
+static modellookup_t FindModelLookup( const void *pOwner, int nType )
+{
+	modellookupkey_t key = { pOwner, nType };
+	int i = s_ModelLookups.Find( key );
+	if ( i == s_ModelLookups.InvalidIndex() )
+	{
+		s_nModelLookupMisses++;
+
+		modellookup_t none = { NULL, 0 };
+		return none;
+	}
+	return s_ModelLookups[i];
+}
+
+static void RecordModelLookup( const void *pOwner, int nType, void *pResult, int nCount = 0 )
+{
+	if ( !s_bRecordModelLookups )
+		return;
+
+	modellookupkey_t key = { pOwner, nType };
+	modellookup_t lookup = { pResult, nCount };
+	s_ModelLookups.InsertOrReplace( key, lookup );
+}
+
 ////////////////////////////////////////////////////////////////////////
 const studiohdr_t *studiohdr_t::FindModel( void **cache, char const *modelname ) const
 {
+	// Only used to build virtual models, which the jobs never do
+	if ( s_bModelLookupJobs )
+	{
+		s_nModelLookupMisses++;
+		return NULL;
+	}
+
 	return modelinfo->FindModel( this, cache, modelname );
 }
 
@@ -22,21 +131,46 @@ virtualmodel_t *studiohdr_t::GetVirtualModel( void ) const
 {
 	if ( numincludemodels == 0 )
 		return NULL;
-	return modelinfo->GetVirtualModel( this );
+
+	if ( s_bModelLookupJobs )
+		return (virtualmodel_t *)FindModelLookup( this, MODEL_LOOKUP_VIRTUAL_MODEL ).m_pResult;
+
+	virtualmodel_t *pVModel = modelinfo->GetVirtualModel( this );
+	RecordModelLookup( this, MODEL_LOOKUP_VIRTUAL_MODEL, pVModel );
+	return pVModel;
 }
 
 const studiohdr_t *virtualgroup_t::GetStudioHdr( ) const
 {
-	return modelinfo->FindModel( this->cache );
+	if ( s_bModelLookupJobs )
+		return (const studiohdr_t *)FindModelLookup( this->cache, MODEL_LOOKUP_GROUP_MODEL ).m_pResult;
+
+	const studiohdr_t *pStudioHdr = modelinfo->FindModel( this->cache );
+	RecordModelLookup( this->cache, MODEL_LOOKUP_GROUP_MODEL, (void *)pStudioHdr );
+	return pStudioHdr;
 }
 
 
 byte *studiohdr_t::GetAnimBlock( int iBlock ) const
 {
-	return modelinfo->GetAnimBlock( this, iBlock );
+	if ( s_bModelLookupJobs )
+		return (byte *)FindModelLookup( this, iBlock ).m_pResult;
+
+	byte *pAnimBlock = modelinfo->GetAnimBlock( this, iBlock );
+	RecordModelLookup( this, iBlock, pAnimBlock );
+	return pAnimBlock;
 }
 
 int	studiohdr_t::GetAutoplayList( unsigned short **pOut ) const
 {
-	return modelinfo->GetAutoplayList( this, pOut );
+	if ( s_bModelLookupJobs )
+	{
+		modellookup_t lookup = FindModelLookup( this, MODEL_LOOKUP_AUTOPLAY_LIST );
+		*pOut = (unsigned short *)lookup.m_pResult;
+		return lookup.m_nCount;
+	}
+
+	int nCount = modelinfo->GetAutoplayList( this, pOut );
+	RecordModelLookup( this, MODEL_LOOKUP_AUTOPLAY_LIST, *pOut, nCount );
+	return nCount;
 }
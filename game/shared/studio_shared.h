@@ -0,0 +1,28 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Model info lookups for code that sets up bones off the main
+//			thread. See studio_shared.cpp.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef STUDIO_SHARED_H
+#define STUDIO_SHARED_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+// Main thread only: true forgets the last recording and records the model
+// info lookups made from then on, false stops recording
+void Studio_RecordModelLookups( bool bRecord );
+
+// Main thread only, around the jobs: answers every lookup from the recording
+// until Studio_EndModelLookupJobs()
+void Studio_BeginModelLookupJobs();
+void Studio_EndModelLookupJobs();
+
+// Lookups the calling thread has made that weren't in the recording
+int Studio_ModelLookupMisses();
+
+#endif // STUDIO_SHARED_H
@@ -18,6 +18,9 @@
 #include "bitvec.h"
 #include "datamanager.h"
 #include "convar.h"
+#include "utlmap.h"
+#include "tier0/threadtools.h"
+#include "mathlib/ssemath.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -157,7 +160,9 @@ short *CBoneCache::CachedToStudio()
 }
 
 // Construct a singleton
-static CDataManager<CBoneCache, bonecacheparams_t> g_StudioBoneCache( 16 * 1024L );
+#define BONE_CACHE_BASE_SIZE	( 16 * 1024L )
+static CDataManager<CBoneCache, bonecacheparams_t> g_StudioBoneCache( BONE_CACHE_BASE_SIZE );
+static unsigned int s_nBoneCachesReserved;
 
 CBoneCache *Studio_GetBoneCache( memhandle_t cacheHandle )
 {
@@ -183,6 +188,26 @@ void Studio_InvalidateBoneCache( memhandle_t cacheHandle )
 	}
 }
 
+void Studio_ReserveBoneCaches( int nCaches, int nBones )
+{
+	unsigned int nCacheSize = sizeof(CBoneCache) + nBones * ( sizeof(short) + sizeof(short) + sizeof(matrix3x4_t) );
+	s_nBoneCachesReserved = nCaches * nCacheSize;
+
+	unsigned int nTargetSize = g_StudioBoneCache.UsedSize() + s_nBoneCachesReserved;
+	if ( nTargetSize > g_StudioBoneCache.TargetSize() )
+	{
+		g_StudioBoneCache.SetTargetSize( nTargetSize );
+	}
+}
+
+void Studio_ReleaseBoneCaches()
+{
+	// Room for the caches that were just created, on top of the usual budget.
+	// Creating the next cache trims the older ones back down to it.
+	g_StudioBoneCache.SetTargetSize( BONE_CACHE_BASE_SIZE + s_nBoneCachesReserved );
+	s_nBoneCachesReserved = 0;
+}
+
 //-----------------------------------------------------------------------------
 // Purpose:
 //-----------------------------------------------------------------------------
@@ -203,76 +228,388 @@ void BuildBoneChain(
 
 
 //-----------------------------------------------------------------------------
-// Purpose: return a sub frame rotation for a single bone
+// Purpose: walks a compressed channel from a run that starts 'k' frames before
+//			the wanted one, and returns the stored values before they're scaled.
+//			Returns false past the end of the channel, where the value is 0.
 //-----------------------------------------------------------------------------
-
-
-void ExtractAnimValue( int frame, 
-						mstudioanimvalue_t *panimvalue,
-						float scale,
-						float &v1, float &v2 )
+static bool ExtractRawAnimValue( int k, const mstudioanimvalue_t *panimvalue, short &v1, short &v2 )
 {
-	if (!panimvalue)
-	{
-		v1 = v2 = 0;
-		return;
-	}
-
-	int k = frame;
-
 	while (panimvalue->num.total <= k)
 	{
 		k -= panimvalue->num.total;
 		panimvalue += panimvalue->num.valid + 1;
 		if ( panimvalue->num.total == 0 )
-		{
-			v1 = v2 = 0;
-			return;
-		}
+			return false;
 	}
 	// Bah, missing blend!
 	if (panimvalue->num.valid > k)
 	{
-		v1 = panimvalue[k+1].value * scale;
+		v1 = panimvalue[k+1].value;
 
 		if (panimvalue->num.valid > k + 1)
 		{
-			v2 = panimvalue[k+2].value * scale;
+			v2 = panimvalue[k+2].value;
 		}
 		else
 		{
 			if (panimvalue->num.total > k + 1)
 				v2 = v1;
 			else
-				v2 = panimvalue[panimvalue->num.valid+2].value * scale;
+				v2 = panimvalue[panimvalue->num.valid+2].value;
 		}
 	}
 	else
 	{
-		v1 = panimvalue[panimvalue->num.valid].value * scale;
+		v1 = panimvalue[panimvalue->num.valid].value;
 		if (panimvalue->num.total > k + 1)
 		{
 			v2 = v1;
 		}
 		else
 		{
-			v2 = panimvalue[panimvalue->num.valid + 2].value * scale;
+			v2 = panimvalue[panimvalue->num.valid + 2].value;
 		}
 	}
+	return true;
 }
 
 
 //-----------------------------------------------------------------------------
 // Purpose: return a sub frame rotation for a single bone
 //-----------------------------------------------------------------------------
-void CalcBoneQuaternion( int frame, float s, 
-						const mstudiobone_t *pbone, const mstudioanim_t *panim, Quaternion &q )
+
+
+void ExtractAnimValue( int frame, 
+						mstudioanimvalue_t *panimvalue,
+						float scale,
+						float &v1, float &v2 )
+{
+	short raw1, raw2;
+	if (!panimvalue || !ExtractRawAnimValue( frame, panimvalue, raw1, raw2 ))
+	{
+		v1 = v2 = 0;
+		return;
+	}
+
+	v1 = raw1 * scale;
+	v2 = raw2 * scale;
+}
+
+
+//-----------------------------------------------------------------------------
+// Decoded animation frames
+//
+// An animation's bones are stored as a list of mstudioanim_t records, whose
+// animated channels are run-length streams that can only be read from frame 0.
+// The seek index remembers where each stream stands every ANIM_SEEK_INTERVAL
+// frames, and the frame cache keeps the decoded values of recently used frames,
+// one array per channel, for every entity playing the animation.
+//
+// Both are built the first time a frame of the animation is needed, and are
+// thrown away by Studio_FlushAnimCaches() when the models may be unloaded.
+//-----------------------------------------------------------------------------
+static ConVar studio_anim_cache( "studio_anim_cache", "1", FCVAR_REPLICATED, "Decode animation frames through the shared seek index and frame cache" );
+
+#define ANIM_SEEK_INTERVAL	16
+#define ANIM_CHANNELS		6		// rotation x, y, z then position x, y, z
+
+struct animcachekey_t
+{
+	const mstudioanimdesc_t	*pAnimdesc;
+	const mstudioanim_t		*pAnim;		// Moves when the animation block is reloaded
+	long					checksum;	// Tells apart models loaded at the same address
+	int						frame;		// -1 for the seek index
+};
+
+static bool AnimCacheKeyLessFunc( const animcachekey_t &lhs, const animcachekey_t &rhs )
+{
+	if ( lhs.pAnimdesc != rhs.pAnimdesc )
+		return lhs.pAnimdesc < rhs.pAnimdesc;
+	if ( lhs.pAnim != rhs.pAnim )
+		return lhs.pAnim < rhs.pAnim;
+	if ( lhs.checksum != rhs.checksum )
+		return lhs.checksum < rhs.checksum;
+	return lhs.frame < rhs.frame;
+}
+
+static inline const mstudioanimvalue_t *AnimChannel( const mstudioanim_t *panim, int iChannel )
+{
+	if ( iChannel < 3 )
+		return ( panim->flags & STUDIO_ANIM_ANIMROT ) ? panim->pRotV()->pAnimvalue( iChannel ) : NULL;
+	return ( panim->flags & STUDIO_ANIM_ANIMPOS ) ? panim->pPosV()->pAnimvalue( iChannel - 3 ) : NULL;
+}
+
+
+//-----------------------------------------------------------------------------
+// Where each channel's stream stands at every ANIM_SEEK_INTERVAL'th frame
+//-----------------------------------------------------------------------------
+class CAnimSeekIndex
+{
+public:
+	CAnimSeekIndex( const mstudioanim_t *panim, int numframes );
+
+	// Same values as ExtractRawAnimValue() from the start of the channel
+	bool			Extract( const mstudioanim_t *panim, int iRecord, int iChannel, int frame, short &v1, short &v2 ) const;
+
+	int				RecordCount() const { return m_nRecords; }
+
+private:
+	struct seekpoint_t
+	{
+		int			offset;		// Run, in values from the start of the channel. -1 once past the end
+		int			frame;		// First frame of the run
+	};
+
+	int				m_nRecords;
+	int				m_nPoints;
+	CUtlVector< seekpoint_t > m_Points;	// [record][channel][point]
+};
+
+CAnimSeekIndex::CAnimSeekIndex( const mstudioanim_t *panim, int numframes )
+{
+	m_nRecords = 0;
+	for ( const mstudioanim_t *pRecord = panim; pRecord; pRecord = pRecord->pNext() )
+	{
+		m_nRecords++;
+	}
+
+	m_nPoints = max( numframes, 1 ) / ANIM_SEEK_INTERVAL + 1;
+	m_Points.SetCount( m_nRecords * ANIM_CHANNELS * m_nPoints );
+
+	seekpoint_t *pPoint = m_Points.Base();
+	for ( const mstudioanim_t *pRecord = panim; pRecord; pRecord = pRecord->pNext() )
+	{
+		for ( int iChannel = 0; iChannel < ANIM_CHANNELS; iChannel++ )
+		{
+			const mstudioanimvalue_t *pStart = AnimChannel( pRecord, iChannel );
+			const mstudioanimvalue_t *panimvalue = pStart;
+			int base = 0;
+
+			// The same steps ExtractRawAnimValue() takes, stopping at each point on the way
+			for ( int i = 0; i < m_nPoints; i++, pPoint++ )
+			{
+				if ( panimvalue )
+				{
+					int k = i * ANIM_SEEK_INTERVAL - base;
+					while ( panimvalue->num.total <= k )
+					{
+						k -= panimvalue->num.total;
+						base += panimvalue->num.total;
+						panimvalue += panimvalue->num.valid + 1;
+						if ( panimvalue->num.total == 0 )
+						{
+							panimvalue = NULL;
+							break;
+						}
+					}
+				}
+
+				pPoint->offset = panimvalue ? (int)( panimvalue - pStart ) : -1;
+				pPoint->frame = base;
+			}
+		}
+	}
+}
+
+bool CAnimSeekIndex::Extract( const mstudioanim_t *panim, int iRecord, int iChannel, int frame, short &v1, short &v2 ) const
+{
+	const mstudioanimvalue_t *panimvalue = AnimChannel( panim, iChannel );
+	if ( !panimvalue )
+		return false;
+
+	// Negative frames read before the first run, so they don't seek
+	if ( frame < 0 )
+		return ExtractRawAnimValue( frame, panimvalue, v1, v2 );
+
+	const seekpoint_t &point = m_Points[ ( iRecord * ANIM_CHANNELS + iChannel ) * m_nPoints + min( frame / ANIM_SEEK_INTERVAL, m_nPoints - 1 ) ];
+	if ( point.offset < 0 )
+		return false;
+
+	return ExtractRawAnimValue( frame - point.frame, panimvalue + point.offset, v1, v2 );
+}
+
+
+//-----------------------------------------------------------------------------
+// One decoded frame of an animation: the unscaled values of every record's
+// channels, as ExtractAnimValue() would find them
+//-----------------------------------------------------------------------------
+struct animframecacheparams_t
+{
+	animcachekey_t			key;
+	const CAnimSeekIndex	*pSeekIndex;
+};
+
+class CAnimFrameCache
+{
+public:
+	// you must implement these static functions for the ResourceManager
+	// -----------------------------------------------------------
+	static CAnimFrameCache *CreateResource( const animframecacheparams_t &params );
+	static unsigned int EstimatedSize( const animframecacheparams_t &params );
+	// -----------------------------------------------------------
+	// member functions that must be present for the ResourceManager
+	void			DestroyResource();
+	CAnimFrameCache	*GetData() { return this; }
+	unsigned int	Size() { return m_size; }
+	// -----------------------------------------------------------
+
+	// Same as ExtractAnimValue() for the record's channel
+	inline void		GetValue( int iRecord, int iChannel, float scale, float &v1, float &v2 ) const
+	{
+		if ( !( ValidMask()[iRecord] & ( 1 << iChannel ) ) )
+		{
+			v1 = v2 = 0;
+			return;
+		}
+
+		v1 = Values1()[iChannel * m_nRecords + iRecord] * scale;
+		v2 = Values2()[iChannel * m_nRecords + iRecord] * scale;
+	}
+
+	animcachekey_t	m_key;
+
+private:
+	short			*Values1() const { return (short *)( this + 1 ); }
+	short			*Values2() const { return Values1() + ANIM_CHANNELS * m_nRecords; }
+	byte			*ValidMask() const { return (byte *)( Values2() + ANIM_CHANNELS * m_nRecords ); }
+
+	unsigned int	m_size;
+	int				m_nRecords;
+};
+
+static CUtlMap< animcachekey_t, CAnimSeekIndex * > s_AnimSeekIndices( 0, 0, AnimCacheKeyLessFunc );
+static CUtlMap< animcachekey_t, memhandle_t > s_AnimFrameHandles( 0, 0, AnimCacheKeyLessFunc );
+
+// Declared after the handle map, so it's destroyed first
+static CDataManager<CAnimFrameCache, animframecacheparams_t> g_AnimFrameCache( 512 * 1024L );
+static CThreadFastMutex s_AnimCacheMutex;
+
+CAnimFrameCache *CAnimFrameCache::CreateResource( const animframecacheparams_t &params )
+{
+	int nRecords = params.pSeekIndex->RecordCount();
+	unsigned int size = EstimatedSize( params );
+
+	CAnimFrameCache *pMem = (CAnimFrameCache *)malloc( size );
+	pMem->m_key = params.key;
+	pMem->m_size = size;
+	pMem->m_nRecords = nRecords;
+
+	short *pValues1 = pMem->Values1();
+	short *pValues2 = pMem->Values2();
+	byte *pValidMask = pMem->ValidMask();
+
+	int iRecord = 0;
+	for ( const mstudioanim_t *panim = params.key.pAnim; panim; panim = panim->pNext(), iRecord++ )
+	{
+		pValidMask[iRecord] = 0;
+		for ( int iChannel = 0; iChannel < ANIM_CHANNELS; iChannel++ )
+		{
+			int iValue = iChannel * nRecords + iRecord;
+			if ( params.pSeekIndex->Extract( panim, iRecord, iChannel, params.key.frame, pValues1[iValue], pValues2[iValue] ) )
+			{
+				pValidMask[iRecord] |= ( 1 << iChannel );
+			}
+			else
+			{
+				pValues1[iValue] = pValues2[iValue] = 0;
+			}
+		}
+	}
+
+	return pMem;
+}
+
+unsigned int CAnimFrameCache::EstimatedSize( const animframecacheparams_t &params )
+{
+	int nRecords = params.pSeekIndex->RecordCount();
+	return sizeof(CAnimFrameCache) + nRecords * ( 2 * ANIM_CHANNELS * sizeof(short) + sizeof(byte) );
+}
+
+void CAnimFrameCache::DestroyResource()
+{
+	// Evicted frames leave the lookup too
+	s_AnimFrameHandles.Remove( m_key );
+	free( this );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: finds or decodes a frame of the animation, and locks it in the cache
+//			until UnlockAnimFrame(). Returns NULL if the cache is turned off.
+//-----------------------------------------------------------------------------
+static const CAnimFrameCache *LockAnimFrame( const mstudioanimdesc_t &animdesc, const mstudioanim_t *panim, int frame, memhandle_t &hFrame )
+{
+	hFrame = NULL;
+	if ( !panim || !studio_anim_cache.GetBool() )
+		return NULL;
+
+	AUTO_LOCK_FM( s_AnimCacheMutex );
+
+	animframecacheparams_t params;
+	params.key.pAnimdesc = &animdesc;
+	params.key.pAnim = panim;
+	params.key.checksum = animdesc.pStudiohdr()->checksum;
+	params.key.frame = frame;
+
+	unsigned short i = s_AnimFrameHandles.Find( params.key );
+	if ( i != s_AnimFrameHandles.InvalidIndex() )
+	{
+		CAnimFrameCache *pFrame = g_AnimFrameCache.LockResource( s_AnimFrameHandles[i] );
+		if ( pFrame )
+		{
+			hFrame = s_AnimFrameHandles[i];
+			return pFrame;
+		}
+	}
+
+	animcachekey_t seekKey = params.key;
+	seekKey.frame = -1;
+	i = s_AnimSeekIndices.Find( seekKey );
+	if ( i == s_AnimSeekIndices.InvalidIndex() )
+	{
+		i = s_AnimSeekIndices.Insert( seekKey, new CAnimSeekIndex( panim, animdesc.numframes ) );
+	}
+	params.pSeekIndex = s_AnimSeekIndices[i];
+
+	hFrame = g_AnimFrameCache.CreateResource( params );
+	s_AnimFrameHandles.InsertOrReplace( params.key, hFrame );
+	return g_AnimFrameCache.LockResource( hFrame );
+}
+
+static void UnlockAnimFrame( memhandle_t hFrame )
+{
+	if ( hFrame )
+	{
+		AUTO_LOCK_FM( s_AnimCacheMutex );
+		g_AnimFrameCache.UnlockResource( hFrame );
+	}
+}
+
+void Studio_FlushAnimCaches()
+{
+	AUTO_LOCK_FM( s_AnimCacheMutex );
+
+	g_AnimFrameCache.FlushAll();
+	s_AnimFrameHandles.RemoveAll();
+
+	for ( unsigned short i = s_AnimSeekIndices.FirstInorder(); i != s_AnimSeekIndices.InvalidIndex(); i = s_AnimSeekIndices.NextInorder( i ) )
+	{
+		delete s_AnimSeekIndices[i];
+	}
+	s_AnimSeekIndices.RemoveAll();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: a bone's rotation when it isn't animated. Returns false if it is.
+//-----------------------------------------------------------------------------
+static inline bool CalcBoneQuaternionFixed( const mstudiobone_t *pbone, const mstudioanim_t *panim, Quaternion &q )
 {
 	if (panim->flags & STUDIO_ANIM_RAWROT)
 	{
 		q = *(panim->pQuat());
 		Assert( q.IsValid() );
-		return;
+		return true;
 	} 
 	else if (!(panim->flags & STUDIO_ANIM_ANIMROT))
 	{
@@ -284,16 +621,19 @@ void CalcBoneQuaternion( int frame, float s,
 		{
 			q = pbone->quat;
 		}
-		return;
+		return true;
 	}
+	return false;
+}
 
-	Quaternion			q1, q2;
-	RadianEuler			angle1, angle2;
-	mstudioanim_valueptr_t *pValuesPtr = panim->pRotV();
 
-	ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 0 ), pbone->rotscale.x, angle1.x, angle2.x );
-	ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 1 ), pbone->rotscale.y, angle1.y, angle2.y );
-	ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 2 ), pbone->rotscale.z, angle1.z, angle2.z );
+//-----------------------------------------------------------------------------
+// Purpose: blends the decoded angles of the frames either side of a sub frame
+//-----------------------------------------------------------------------------
+static void BlendBoneAngles( RadianEuler &angle1, RadianEuler &angle2, float s, 
+						const mstudiobone_t *pbone, const mstudioanim_t *panim, Quaternion &q )
+{
+	Quaternion			q1, q2;
 
 	if (!(panim->flags & STUDIO_ANIM_DELTA))
 	{
@@ -328,17 +668,55 @@ void CalcBoneQuaternion( int frame, float s,
 
 
 //-----------------------------------------------------------------------------
-// Purpose: return a sub frame position for a single bone
+// Purpose: return a sub frame rotation for a single bone
 //-----------------------------------------------------------------------------
-void CalcBonePosition( int frame, float s, 
-	const mstudiobone_t *pbone, const mstudioanim_t *panim, Vector &pos	)
+void CalcBoneQuaternion( int frame, float s, 
+						const mstudiobone_t *pbone, const mstudioanim_t *panim, Quaternion &q )
+{
+	if (CalcBoneQuaternionFixed( pbone, panim, q ))
+		return;
+
+	RadianEuler			angle1, angle2;
+	mstudioanim_valueptr_t *pValuesPtr = panim->pRotV();
+
+	ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 0 ), pbone->rotscale.x, angle1.x, angle2.x );
+	ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 1 ), pbone->rotscale.y, angle1.y, angle2.y );
+	ExtractAnimValue( frame, pValuesPtr->pAnimvalue( 2 ), pbone->rotscale.z, angle1.z, angle2.z );
+
+	BlendBoneAngles( angle1, angle2, s, pbone, panim, q );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: same, for the iRecord'th record of a cached frame
+//-----------------------------------------------------------------------------
+static void CalcBoneQuaternion( const CAnimFrameCache *pFrame, int iRecord, float s, 
+						const mstudiobone_t *pbone, const mstudioanim_t *panim, Quaternion &q )
+{
+	if (CalcBoneQuaternionFixed( pbone, panim, q ))
+		return;
+
+	RadianEuler			angle1, angle2;
+
+	pFrame->GetValue( iRecord, 0, pbone->rotscale.x, angle1.x, angle2.x );
+	pFrame->GetValue( iRecord, 1, pbone->rotscale.y, angle1.y, angle2.y );
+	pFrame->GetValue( iRecord, 2, pbone->rotscale.z, angle1.z, angle2.z );
+
+	BlendBoneAngles( angle1, angle2, s, pbone, panim, q );
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: a bone's position when it isn't animated. Returns false if it is.
+//-----------------------------------------------------------------------------
+static inline bool CalcBonePositionFixed( const mstudiobone_t *pbone, const mstudioanim_t *panim, Vector &pos )
 {
 	if (panim->flags & STUDIO_ANIM_RAWPOS)
 	{
 		pos = *(panim->pPos());
 		Assert( pos.IsValid() );
 
-		return;
+		return true;
 	}
 	else if (!(panim->flags & STUDIO_ANIM_ANIMPOS))
 	{
@@ -350,8 +728,20 @@ void CalcBonePosition( int frame, float s,
 		{
 			pos = pbone->pos;
 		}
-		return;
+		return true;
 	}
+	return false;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: return a sub frame position for a single bone
+//-----------------------------------------------------------------------------
+void CalcBonePosition( int frame, float s, 
+	const mstudiobone_t *pbone, const mstudioanim_t *panim, Vector &pos	)
+{
+	if (CalcBonePositionFixed( pbone, panim, pos ))
+		return;
 
 	mstudioanim_valueptr_t *pPosV = panim->pPosV();
 	int					j;
@@ -374,6 +764,35 @@ void CalcBonePosition( int frame, float s,
 }
 
 
+//-----------------------------------------------------------------------------
+// Purpose: same, for the iRecord'th record of a cached frame
+//-----------------------------------------------------------------------------
+static void CalcBonePosition( const CAnimFrameCache *pFrame, int iRecord, float s, 
+	const mstudiobone_t *pbone, const mstudioanim_t *panim, Vector &pos	)
+{
+	if (CalcBonePositionFixed( pbone, panim, pos ))
+		return;
+
+	int					j;
+	float				v1, v2;
+
+	for (j = 0; j < 3; j++)
+	{
+		pFrame->GetValue( iRecord, 3 + j, pbone->posscale[j], v1, v2 );
+		pos[j] = v1 * (1.0 - s) + v2 * s;
+	}
+
+	if (!(panim->flags & STUDIO_ANIM_DELTA))
+	{
+		pos.x = pos.x + pbone->pos.x;
+		pos.y = pos.y + pbone->pos.y;
+		pos.z = pos.z + pbone->pos.z;
+	}
+
+	Assert( pos.IsValid() );
+}
+
+
 void SetupSingleBoneMatrix( 
 	CStudioHdr *pOwnerHdr, 
 	int nSequence, 
@@ -510,6 +929,10 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 		}
 	}
 
+	memhandle_t hFrame;
+	const CAnimFrameCache *pFrame = LockAnimFrame( animdesc, panim, iFrame, hFrame );
+	int iRecord = 0;
+
 	// FIXME: change encoding so that bone -1 is never the case
 	while (panim && panim->bone < 255)
 	{
@@ -520,12 +943,23 @@ static void CalcVirtualAnimation( virtualmodel_t *pVModel, const CStudioHdr *pSt
 
 			if (k >= 0 && pweight[k] > 0.0f)
 			{
-				CalcBoneQuaternion( iFrame, s, &pAnimbone[panim->bone], panim, q[j] );
-				CalcBonePosition  ( iFrame, s, &pAnimbone[panim->bone], panim, pos[j] );
+				if (pFrame)
+				{
+					CalcBoneQuaternion( pFrame, iRecord, s, &pAnimbone[panim->bone], panim, q[j] );
+					CalcBonePosition  ( pFrame, iRecord, s, &pAnimbone[panim->bone], panim, pos[j] );
+				}
+				else
+				{
+					CalcBoneQuaternion( iFrame, s, &pAnimbone[panim->bone], panim, q[j] );
+					CalcBonePosition  ( iFrame, s, &pAnimbone[panim->bone], panim, pos[j] );
+				}
 			}
 		}
 		panim = panim->pNext();
+		iRecord++;
 	}
+
+	UnlockAnimFrame( hFrame );
 }
 
 
@@ -607,6 +1041,10 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		}
 	}
 
+	memhandle_t hFrame;
+	const CAnimFrameCache *pFrame = LockAnimFrame( animdesc, panim, iFrame, hFrame );
+	int iRecord = 0;
+
 	// BUGBUG: the sequence, the anim, and the model can have all different bone mappings.
 	for (i = 0; i < pStudioHdr->numbones(); i++, pbone++, pweight++)
 	{
@@ -614,10 +1052,19 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 		{
 			if (*pweight > 0 && (pbone->flags & boneMask))
 			{
-				CalcBoneQuaternion( iFrame, s, pbone, panim, q[i] );
-				CalcBonePosition  ( iFrame, s, pbone, panim, pos[i] );
+				if (pFrame)
+				{
+					CalcBoneQuaternion( pFrame, iRecord, s, pbone, panim, q[i] );
+					CalcBonePosition  ( pFrame, iRecord, s, pbone, panim, pos[i] );
+				}
+				else
+				{
+					CalcBoneQuaternion( iFrame, s, pbone, panim, q[i] );
+					CalcBonePosition  ( iFrame, s, pbone, panim, pos[i] );
+				}
 			}
 			panim = panim->pNext();
+			iRecord++;
 		}
 		else if (*pweight > 0 && (pbone->flags & boneMask))
 		{
@@ -633,6 +1080,8 @@ static void CalcAnimation( const CStudioHdr *pStudioHdr,	Vector *pos, Quaternion
 			}
 		}
 	}
+
+	UnlockAnimFrame( hFrame );
 }
 
 
@@ -680,6 +1129,80 @@ void QuaternionAccumulate( const Quaternion &p, float s, const Quaternion &q, Qu
 
 
 
+//-----------------------------------------------------------------------------
+// Scratch bones for the pose and IK functions that used to keep them in
+// statics. Bones get set up on job threads, so each thread gets its own.
+// They're allocated on a thread's first use, and kept until
+// Studio_FreeBoneSetupScratch() frees every thread's at once.
+//-----------------------------------------------------------------------------
+struct BoneSetupScratch_t
+{
+	// CalcPoseSingle()
+	Vector		m_pos2[MAXSTUDIOBONES];
+	Quaternion	m_q2[MAXSTUDIOBONES];
+	Vector		m_pos3[MAXSTUDIOBONES];
+	Quaternion	m_q3[MAXSTUDIOBONES];
+
+	// WorldSpaceSlerp()
+	matrix3x4_t	m_srcBoneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t	m_destBoneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t	m_targetBoneToWorld[MAXSTUDIOBONES];
+
+	// CIKContext::AddSequenceLocks() and SolveSequenceLocks()
+	matrix3x4_t	m_addLockBoneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t	m_solveLockBoneToWorld[MAXSTUDIOBONES];
+
+	// CIKContext::AddAutoplayLocks() and SolveAutoplayLocks()
+	matrix3x4_t	m_addAutoplayLockBoneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t	m_solveAutoplayLockBoneToWorld[MAXSTUDIOBONES];
+
+	// Reentry guards, which only make sense per thread now
+	int			m_nCalcPoseSingle;
+	int			m_nCalcAutoplaySequences;
+	int			m_nSolveSequenceLocks;
+	int			m_nSolveAutoplayLocks;
+	int			m_nSolveDependencies;
+};
+
+static CThreadLocalPtr< BoneSetupScratch_t > s_pBoneSetupScratch;
+static CThreadLocalInt<> s_nBoneSetupScratchGeneration;		// s_nBoneSetupScratchFrees when the thread's was allocated
+static int s_nBoneSetupScratchFrees = 1;
+static CUtlVector< BoneSetupScratch_t * > s_BoneSetupScratches;
+static CThreadFastMutex s_BoneSetupScratchMutex;
+
+static BoneSetupScratch_t *GetBoneSetupScratch()
+{
+	// A thread's pointer is left dangling when Studio_FreeBoneSetupScratch() frees it
+	BoneSetupScratch_t *pScratch = s_pBoneSetupScratch;
+	if ( !pScratch || s_nBoneSetupScratchGeneration != s_nBoneSetupScratchFrees )
+	{
+		pScratch = new BoneSetupScratch_t;
+		memset( pScratch, 0, sizeof( BoneSetupScratch_t ) );
+		s_pBoneSetupScratch = pScratch;
+		s_nBoneSetupScratchGeneration = s_nBoneSetupScratchFrees;
+
+		AUTO_LOCK_FM( s_BoneSetupScratchMutex );
+		s_BoneSetupScratches.AddToTail( pScratch );
+	}
+	return pScratch;
+}
+
+void Studio_FreeBoneSetupScratch()
+{
+	AUTO_LOCK_FM( s_BoneSetupScratchMutex );
+	s_BoneSetupScratches.PurgeAndDeleteElements();
+	s_nBoneSetupScratchFrees++;
+}
+
+#ifdef _DEBUG
+#define ASSERT_NO_REENTRY_ON_THREAD( semaphore ) \
+	Assert( !(semaphore) ); \
+	CReentryGuard ThreadReentryGuard( &(semaphore) )
+#else
+#define ASSERT_NO_REENTRY_ON_THREAD( semaphore )
+#endif
+
+
 //-----------------------------------------------------------------------------
 // Purpose: blend together in world space q1,pos1 with q2,pos2.  Return result in q1,pos1.  
 //			0 returns q1, pos1.  1 returns q2, pos2
@@ -704,14 +1227,16 @@ void WorldSpaceSlerp(
 	matrix3x4_t rootXform;
 	SetIdentityMatrix( rootXform );
 
+	BoneSetupScratch_t *pScratch = GetBoneSetupScratch();
+
 	// matrices for q2, pos2
-	static matrix3x4_t srcBoneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t *srcBoneToWorld = pScratch->m_srcBoneToWorld;
 	CBoneBitList srcBoneComputed;
 
-	static matrix3x4_t destBoneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t *destBoneToWorld = pScratch->m_destBoneToWorld;
 	CBoneBitList destBoneComputed;
 
-	static matrix3x4_t targetBoneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t *targetBoneToWorld = pScratch->m_targetBoneToWorld;
 	CBoneBitList targetBoneComputed;
 
 	virtualmodel_t *pVModel = pStudioHdr->GetVirtualModel();
@@ -803,6 +1328,190 @@ void WorldSpaceSlerp(
 
 
 
+//-----------------------------------------------------------------------------
+// SSE bone loops
+//
+// Poses stay in the Quaternion/Vector arrays the rest of the code passes
+// around; the bones a loop changes are gathered four at a time into
+// FourQuaternions/FourVectors, blended, and scattered back. Results match the
+// scalar loops to within float rounding, and slerps to about 1e-6.
+//-----------------------------------------------------------------------------
+static ConVar studio_simd_bones( "studio_simd_bones", "1", FCVAR_REPLICATED, "Blend bones and build bone matrices four at a time with SSE" );
+
+static inline bool UseSIMDBones()
+{
+	return studio_simd_bones.GetBool() && MathLib_SSEEnabled();
+}
+
+// Lanes past the end of the list repeat its last bone, and aren't stored
+static inline int GatherBoneLanes( const int *pBones, int nBones, int n, int iBone[4] )
+{
+	int nLanes = min( 4, nBones - n );
+	for ( int k = 0; k < 4; k++ )
+	{
+		iBone[k] = pBones[n + min( k, nLanes - 1 )];
+	}
+	return nLanes;
+}
+
+static inline void GatherBonePositions( const Vector pos[], const int iBone[4], FourVectors &v )
+{
+	v.x = _mm_setr_ps( pos[iBone[0]].x, pos[iBone[1]].x, pos[iBone[2]].x, pos[iBone[3]].x );
+	v.y = _mm_setr_ps( pos[iBone[0]].y, pos[iBone[1]].y, pos[iBone[2]].y, pos[iBone[3]].y );
+	v.z = _mm_setr_ps( pos[iBone[0]].z, pos[iBone[1]].z, pos[iBone[2]].z, pos[iBone[3]].z );
+}
+
+static inline void ScatterBones( const FourQuaternions &q, const FourVectors &v, const int iBone[4], int nLanes, Quaternion qOut[], Vector posOut[] )
+{
+	Quaternion lanes[4];
+	q.SwizzleAndStore( lanes[0], lanes[1], lanes[2], lanes[3] );
+	for ( int k = 0; k < nLanes; k++ )
+	{
+		qOut[iBone[k]] = lanes[k];
+		posOut[iBone[k]] = v.Vec( k );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: for each listed bone, q1 = slerp (or blend) from q2 to q1 by 1 - s2,
+//			and pos1 = pos1 * (1 - s2) + pos2 * s2. s2 must be in 0..1.
+//-----------------------------------------------------------------------------
+static void BlendBoneListSSE( 
+	const mstudiobone_t *pbone,
+	Quaternion q1[], 
+	Vector pos1[], 
+	const Quaternion q2[], 
+	const Vector pos2[], 
+	const int *pBones,
+	const float *pWeights,
+	int nBones,
+	bool bSlerp )
+{
+	for ( int n = 0; n < nBones; n += 4 )
+	{
+		int iBone[4];
+		int nLanes = GatherBoneLanes( pBones, nBones, n, iBone );
+
+		float s2[4], align[4];
+		for ( int k = 0; k < 4; k++ )
+		{
+			s2[k] = pWeights[n + min( k, nLanes - 1 )];
+			align[k] = ( pbone[iBone[k]].flags & BONE_FIXED_ALIGNMENT ) ? 0.0f : 1.0f;
+		}
+		__m128 t2 = _mm_loadu_ps( s2 );
+		__m128 t1 = _mm_sub_ps( Four_Ones, t2 );
+
+		FourQuaternions qa, qb;
+		qa.LoadAndSwizzle( q2[iBone[0]], q2[iBone[1]], q2[iBone[2]], q2[iBone[3]] );
+		qb.LoadAndSwizzle( q1[iBone[0]], q1[iBone[1]], q1[iBone[2]], q1[iBone[3]] );
+		qb = QuaternionAlignSSE( qa, qb, _mm_cmpneq_ps( _mm_loadu_ps( align ), Four_Zeros ) );
+
+		FourQuaternions q3 = bSlerp ? QuaternionSlerpNoAlignSSE( qa, qb, t1 ) : QuaternionBlendNoAlignSSE( qa, qb, t1 );
+
+		FourVectors p1, p2;
+		GatherBonePositions( pos1, iBone, p1 );
+		GatherBonePositions( pos2, iBone, p2 );
+		p1 *= t1;
+		p2 *= t2;
+		p1 += p2;
+
+		ScatterBones( q3, p1, iBone, nLanes, q1, pos1 );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: for each listed bone, blend q1 towards the identity by 1 - s, and
+//			scale pos1 by s
+//-----------------------------------------------------------------------------
+static void ScaleBoneListSSE( 
+	Quaternion q1[], 
+	Vector pos1[], 
+	const int *pBones,
+	int nBones,
+	float s )
+{
+	__m128 t2 = MMReplicate( s );
+	__m128 t1 = _mm_sub_ps( Four_Ones, t2 );
+
+	for ( int n = 0; n < nBones; n += 4 )
+	{
+		int iBone[4];
+		int nLanes = GatherBoneLanes( pBones, nBones, n, iBone );
+
+		FourQuaternions qa;
+		qa.LoadAndSwizzle( q1[iBone[0]], q1[iBone[1]], q1[iBone[2]], q1[iBone[3]] );
+		FourQuaternions q3 = QuaternionIdentityBlendSSE( qa, t1 );
+
+		FourVectors p1;
+		GatherBonePositions( pos1, iBone, p1 );
+		p1 *= t2;
+
+		ScatterBones( q3, p1, iBone, nLanes, q1, pos1 );
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: QuaternionMatrix( q[i], pos[i], matrices[i] ) for each listed bone
+//-----------------------------------------------------------------------------
+static void BoneMatrixListSSE( 
+	const Quaternion q[], 
+	const Vector pos[], 
+	const int *pBones,
+	int nBones,
+	matrix3x4_t matrices[] )
+{
+	for ( int n = 0; n < nBones; n += 4 )
+	{
+		int iBone[4];
+		int nLanes = GatherBoneLanes( pBones, nBones, n, iBone );
+
+		FourQuaternions qa;
+		qa.LoadAndSwizzle( q[iBone[0]], q[iBone[1]], q[iBone[2]], q[iBone[3]] );
+		FourVectors p;
+		GatherBonePositions( pos, iBone, p );
+
+		__m128 x2 = _mm_add_ps( qa.x, qa.x );
+		__m128 y2 = _mm_add_ps( qa.y, qa.y );
+		__m128 z2 = _mm_add_ps( qa.z, qa.z );
+		__m128 xx = _mm_mul_ps( qa.x, x2 );
+		__m128 yy = _mm_mul_ps( qa.y, y2 );
+		__m128 zz = _mm_mul_ps( qa.z, z2 );
+		__m128 xy = _mm_mul_ps( qa.x, y2 );
+		__m128 xz = _mm_mul_ps( qa.x, z2 );
+		__m128 yz = _mm_mul_ps( qa.y, z2 );
+		__m128 wx = _mm_mul_ps( qa.w, x2 );
+		__m128 wy = _mm_mul_ps( qa.w, y2 );
+		__m128 wz = _mm_mul_ps( qa.w, z2 );
+
+		// One row of all four matrices at a time, transposed into one row of each
+		__m128 rows[3][4];
+		rows[0][0] = _mm_sub_ps( _mm_sub_ps( Four_Ones, yy ), zz );
+		rows[0][1] = _mm_sub_ps( xy, wz );
+		rows[0][2] = _mm_add_ps( xz, wy );
+		rows[0][3] = p.x;
+
+		rows[1][0] = _mm_add_ps( xy, wz );
+		rows[1][1] = _mm_sub_ps( _mm_sub_ps( Four_Ones, xx ), zz );
+		rows[1][2] = _mm_sub_ps( yz, wx );
+		rows[1][3] = p.y;
+
+		rows[2][0] = _mm_sub_ps( xz, wy );
+		rows[2][1] = _mm_add_ps( yz, wx );
+		rows[2][2] = _mm_sub_ps( _mm_sub_ps( Four_Ones, xx ), yy );
+		rows[2][3] = p.z;
+
+		for ( int r = 0; r < 3; r++ )
+		{
+			_MM_TRANSPOSE4_PS( rows[r][0], rows[r][1], rows[r][2], rows[r][3] );
+			for ( int k = 0; k < nLanes; k++ )
+			{
+				_mm_storeu_ps( matrices[iBone[k]][r], rows[r][k] );
+			}
+		}
+	}
+}
+
+
 //-----------------------------------------------------------------------------
 // Purpose: blend together q1,pos1 with q2,pos2.  Return result in q1,pos1.  
 //			0 returns q1, pos1.  1 returns q2, pos2
@@ -898,6 +1607,11 @@ void SlerpBones(
 	}
 	else
 	{
+		bool bSIMD = UseSIMDBones();
+		int bones[MAXSTUDIOBONES];
+		float weights[MAXSTUDIOBONES];
+		int nBones = 0;
+
 		for (i = 0; i < pStudioHdr->numbones(); i++)
 		{
 			// skip unused bones
@@ -922,7 +1636,15 @@ void SlerpBones(
 			{
 				s2 = s * seqdesc.weight( i );	// blend in based on this animations weights
 			}
-			if (s2 > 0.0)
+
+			// the SSE slerp only takes weights in 0..1
+			if (bSIMD && s2 > 0.0 && s2 <= 1.0)
+			{
+				bones[nBones] = i;
+				weights[nBones] = s2;
+				nBones++;
+			}
+			else if (s2 > 0.0)
 			{
 				s1 = 1.0 - s2;
 
@@ -943,6 +1665,8 @@ void SlerpBones(
 				pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
 			}
 		}
+
+		BlendBoneListSSE( pbone, q1, pos1, q2, pos2, bones, weights, nBones, true );
 	}
 }
 
@@ -1013,6 +1737,11 @@ void BlendBones(
 	float s2 = s;
 	float s1 = 1.0 - s2;
 
+	bool bSIMD = UseSIMDBones();
+	int bones[MAXSTUDIOBONES];
+	float weights[MAXSTUDIOBONES];
+	int nBones = 0;
+
 	for (i = 0; i < pStudioHdr->numbones(); i++)
 	{
 		// skip unused bones
@@ -1032,6 +1761,14 @@ void BlendBones(
 
 		if (j >= 0 && seqdesc.weight( j ) > 0.0)
 		{
+			if (bSIMD)
+			{
+				bones[nBones] = i;
+				weights[nBones] = s2;
+				nBones++;
+				continue;
+			}
+
 			if (pbone[i].flags & BONE_FIXED_ALIGNMENT)
 			{
 				QuaternionBlendNoAlign( q2[i], q1[i], s1, q3 );
@@ -1049,6 +1786,8 @@ void BlendBones(
 			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s2;
 		}
 	}
+
+	BlendBoneListSSE( pbone, q1, pos1, q2, pos2, bones, weights, nBones, false );
 }
 
 
@@ -1081,6 +1820,10 @@ void ScaleBones(
 	float s2 = s;
 	float s1 = 1.0 - s2;
 
+	bool bSIMD = UseSIMDBones();
+	int bones[MAXSTUDIOBONES];
+	int nBones = 0;
+
 	for (i = 0; i < pStudioHdr->numbones(); i++)
 	{
 		// skip unused bones
@@ -1100,10 +1843,18 @@ void ScaleBones(
 
 		if (j >= 0 && seqdesc.weight( j ) > 0.0)
 		{
+			if (bSIMD)
+			{
+				bones[nBones++] = i;
+				continue;
+			}
+
 			QuaternionIdentityBlend( q1[i], s1, q1[i] );
 			VectorScale( pos1[i], s2, pos1[i] );
 		}
 	}
+
+	ScaleBoneListSSE( q1, pos1, bones, nBones, s2 );
 }
 
 //-----------------------------------------------------------------------------
@@ -1250,12 +2001,13 @@ bool CalcPoseSingle(
 	float flTime
 	)
 {
-	ASSERT_NO_REENTRY();
+	BoneSetupScratch_t *pScratch = GetBoneSetupScratch();
+	ASSERT_NO_REENTRY_ON_THREAD( pScratch->m_nCalcPoseSingle );
 	
-	static Vector		pos2[MAXSTUDIOBONES];
-	static Quaternion	q2[MAXSTUDIOBONES];
-	static Vector		pos3[MAXSTUDIOBONES];
-	static Quaternion	q3[MAXSTUDIOBONES];
+	Vector		*pos2 = pScratch->m_pos2;
+	Quaternion	*q2 = pScratch->m_q2;
+	Vector		*pos3 = pScratch->m_pos3;
+	Quaternion	*q3 = pScratch->m_q3;
 
 	if (sequence >= pStudioHdr->GetNumSeq()) 
 	{
@@ -1799,12 +2551,11 @@ public:
 //   (2) Solve for S
 //   (3) Q = Minv(S)         -- rotate back again
 
-   static float Mfwd[3][3];
-   static float Minv[3][3];
-
    static bool solve(float A, float B, float const P[], float const D[], float Q[]) {
+      float Mfwd[3][3];
+      float Minv[3][3];
       float R[3];
-      defineM(P,D);
+      defineM(P,D,Mfwd,Minv);
       rot(Minv,P,R);
 	  float r = length(R);
       float d = findD(A,B,r);
@@ -1819,7 +2570,7 @@ public:
 //
 // Given that constraint, define the forward and inverse of M as follows:
 
-   static void defineM(float const P[], float const D[]) {
+   static void defineM(float const P[], float const D[], float Mfwd[3][3], float Minv[3][3]) {
       float *X = Minv[0], *Y = Minv[1], *Z = Minv[2];
 
 // Minv defines a coordinate system whose x axis contains P, so X = unit(P).
@@ -1872,9 +2623,6 @@ public:
    }
 };
 
-float ik::Mfwd[3][3];
-float ik::Minv[3][3];
-
 
 
 //-----------------------------------------------------------------------------
@@ -2567,7 +3315,7 @@ void CIKContext::AddAutoplayLocks( Vector pos[], Quaternion q[] )
 		return;
 	}
 
-	static matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t *boneToWorld = GetBoneSetupScratch()->m_addAutoplayLockBoneToWorld;
 	CBoneBitList boneComputed;
 
 	int ikOffset = m_ikLock.AddMultipleToTail( m_pStudioHdr->GetNumIKAutoplayLocks() );
@@ -2620,7 +3368,7 @@ void CIKContext::AddSequenceLocks( mstudioseqdesc_t &seqdesc, Vector pos[], Quat
 		return;
 	}
 
-	static matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t *boneToWorld = GetBoneSetupScratch()->m_addLockBoneToWorld;
 	CBoneBitList boneComputed;
 
 	int ikOffset = m_ikLock.AddMultipleToTail( seqdesc.numiklocks );
@@ -3234,7 +3982,7 @@ void CIKContext::AutoIKRelease( void )
 
 void CIKContext::SolveDependencies( Vector pos[], Quaternion q[], matrix3x4_t boneToWorld[], CBoneBitList &boneComputed	)
 {
-	ASSERT_NO_REENTRY();
+	ASSERT_NO_REENTRY_ON_THREAD( GetBoneSetupScratch()->m_nSolveDependencies );
 	
 	matrix3x4_t worldTarget;
 	int i, j;
@@ -3463,9 +4211,10 @@ void CIKContext::SolveAutoplayLocks(
 	Quaternion q[]
 	)
 {
-	ASSERT_NO_REENTRY();
+	BoneSetupScratch_t *pScratch = GetBoneSetupScratch();
+	ASSERT_NO_REENTRY_ON_THREAD( pScratch->m_nSolveAutoplayLocks );
 	
-	static matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t *boneToWorld = pScratch->m_solveAutoplayLockBoneToWorld;
 	CBoneBitList boneComputed;
 	int i;
 
@@ -3527,9 +4276,10 @@ void CIKContext::SolveSequenceLocks(
 	Quaternion q[]
 	)
 {
-	ASSERT_NO_REENTRY();
+	BoneSetupScratch_t *pScratch = GetBoneSetupScratch();
+	ASSERT_NO_REENTRY_ON_THREAD( pScratch->m_nSolveSequenceLocks );
 	
-	static matrix3x4_t boneToWorld[MAXSTUDIOBONES];
+	matrix3x4_t *boneToWorld = pScratch->m_solveLockBoneToWorld;
 	CBoneBitList boneComputed;
 	int i;
 
@@ -3592,7 +4342,7 @@ void CalcAutoplaySequences(
 	float realTime
 	)
 {
-	ASSERT_NO_REENTRY();
+	ASSERT_NO_REENTRY_ON_THREAD( GetBoneSetupScratch()->m_nCalcAutoplaySequences );
 	
 	int			i;
 	if ( pIKContext )
@@ -3669,24 +4419,43 @@ void Studio_BuildMatrices(
 		}
 	}
 
-	matrix3x4_t bonematrix;
 	matrix3x4_t rotationmatrix; // model to world transformation
 	AngleMatrix( angles, origin, rotationmatrix);
 
+	// with SSE, build the local transforms four at a time up front
+	matrix3x4_t bonematrices[MAXSTUDIOBONES];
+	bool bSIMD = UseSIMDBones();
+	if (bSIMD)
+	{
+		int bones[MAXSTUDIOBONES];
+		int nBones = 0;
+		for (j = chainlength - 1; j >= 0; j--)
+		{
+			if (pbones[chain[j]].flags & boneMask)
+			{
+				bones[nBones++] = chain[j];
+			}
+		}
+		BoneMatrixListSSE( q, pos, bones, nBones, bonematrices );
+	}
+
 	for (j = chainlength - 1; j >= 0; j--)
 	{
 		i = chain[j];
 		if (pbones[i].flags & boneMask)
 		{
-			QuaternionMatrix( q[i], pos[i], bonematrix );
+			if (!bSIMD)
+			{
+				QuaternionMatrix( q[i], pos[i], bonematrices[i] );
+			}
 
 			if (pbones[i].parent == -1) 
 			{
-				ConcatTransforms (rotationmatrix, bonematrix, bonetoworld[i]);
+				ConcatTransforms (rotationmatrix, bonematrices[i], bonetoworld[i]);
 			} 
 			else 
 			{
-				ConcatTransforms (bonetoworld[pbones[i].parent], bonematrix, bonetoworld[i]);
+				ConcatTransforms (bonetoworld[pbones[i].parent], bonematrices[i], bonetoworld[i]);
 			}
 		}
 	}
@@ -4441,7 +5210,11 @@ bool TraceToStudio( const Ray_t& ray, CStudioHdr *pStudioHdr, mstudiohitboxset_t
 void Studio_SeqAnims( const CStudioHdr *pStudioHdr, mstudioseqdesc_t &seqdesc, int iSequence, const float poseParameter[], mstudioanimdesc_t *panim[4], float *weight )
 {
 #if _DEBUG
-	VPROF_INCREMENT_COUNTER("SEQ_ANIMS",1);
+	// The counter isn't thread safe
+	if ( ThreadInMainThread() )
+	{
+		VPROF_INCREMENT_COUNTER("SEQ_ANIMS",1);
+	}
 #endif
 	if (!pStudioHdr || iSequence >= pStudioHdr->GetNumSeq())
 	{
@@ -4961,5 +5734,67 @@ bool Studio_PrefetchSequence( const CStudioHdr *pStudioHdr, int iSequence )
 	}
 
 	// Everything for this sequence is resident?
+	return !pendingload;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Like Studio_PrefetchSequence(), for everything AccumulatePose()
+//			reads: the blends AccumulatePose() picks with its own indexing,
+//			and the sequence's layers.
+//-----------------------------------------------------------------------------
+bool Studio_PrefetchPose( const CStudioHdr *pStudioHdr, int iSequence )
+{
+	if ( iSequence < 0 )
+		return true;
+
+	if ( iSequence >= pStudioHdr->GetNumSeq() )
+	{
+		iSequence = 0;
+	}
+
+	bool pendingload = false;
+	mstudioseqdesc_t &seqdesc = pStudioHdr->pSeqdesc( iSequence );
+	for ( int i = 0; i < seqdesc.groupsize[ 0 ]; ++i )
+	{
+		for ( int j = 0; j < seqdesc.groupsize[ 1 ]; ++j )
+		{
+			mstudioanimdesc_t &animdesc = pStudioHdr->pAnimdesc( pStudioHdr->iRelativeAnim( iSequence, seqdesc.anim( i, j ) ) );
+			if ( !animdesc.pAnim() )
+			{
+				pendingload = true;
+			}
+		}
+	}
+
+	for ( int i = 0; i < seqdesc.numautolayers; i++ )
+	{
+		int iLayerSequence = pStudioHdr->iRelativeSeq( iSequence, seqdesc.pAutolayer( i )->iSequence );
+		if ( iLayerSequence != iSequence && !Studio_PrefetchPose( pStudioHdr, iLayerSequence ) )
+		{
+			pendingload = true;
+		}
+	}
+
+	return !pendingload;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Studio_PrefetchPose() for the sequences CalcAutoplaySequences()
+//			plays. Also looks up the model's autoplay list.
+//-----------------------------------------------------------------------------
+bool Studio_PrefetchAutoplaySequences( const CStudioHdr *pStudioHdr )
+{
+	bool pendingload = false;
+
+	unsigned short *pList = NULL;
+	int count = pStudioHdr->GetAutoplayList( &pList );
+	for ( int i = 0; i < count; i++ )
+	{
+		if ( !Studio_PrefetchPose( pStudioHdr, pList[i] ) )
+		{
+			pendingload = true;
+		}
+	}
+
 	return !pendingload;
 }
\ No newline at end of file
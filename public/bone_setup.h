@@ -68,6 +68,35 @@ void SlerpBones(
 	);
 
 
+//-----------------------------------------------------------------------------
+// Purpose: Inter-animation blend, assumes both poses are of the same type
+//-----------------------------------------------------------------------------
+void BlendBones( 
+	const CStudioHdr *pStudioHdr,
+	Quaternion q1[MAXSTUDIOBONES], 
+	Vector pos1[MAXSTUDIOBONES], 
+	mstudioseqdesc_t &seqdesc, 
+	int sequence,
+	const Quaternion q2[MAXSTUDIOBONES], 
+	const Vector pos2[MAXSTUDIOBONES], 
+	float s,
+	int boneMask
+	);
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Scale a delta pose towards the identity
+//-----------------------------------------------------------------------------
+void ScaleBones( 
+	const CStudioHdr *pStudioHdr,
+	Quaternion q1[MAXSTUDIOBONES], 
+	Vector pos1[MAXSTUDIOBONES], 
+	int sequence,
+	float s,
+	int boneMask
+	);
+
+
 void InitPose(
 	const CStudioHdr *pStudioHdr,
 	Vector pos[], 
@@ -469,6 +498,21 @@ memhandle_t Studio_CreateBoneCache( bonecacheparams_t &params );
 void Studio_DestroyBoneCache( memhandle_t cacheHandle );
 void Studio_InvalidateBoneCache( memhandle_t cacheHandle );
 
+// Grows the bone cache's budget so that nCaches more caches, of up to nBones
+// bones each, can be created without evicting any of the current ones.
+// Studio_ReleaseBoneCaches() shrinks it back to the usual budget plus room
+// for those caches, once they've been created.
+void Studio_ReserveBoneCaches( int nCaches, int nBones );
+void Studio_ReleaseBoneCaches();
+
+// Frees the scratch bones of every thread that has set up bones. No thread
+// may be setting up bones, and threads that do later allocate new ones.
+void Studio_FreeBoneSetupScratch();
+
+// Throws away the decoded animation frames and seek indices shared by all models.
+// Call it before models are unloaded.
+void Studio_FlushAnimCaches();
+
 // Given a ray, trace for an intersection with this studiomodel.  Get the array of bones from StudioSetupHitboxBones
 bool TraceToStudio( const Ray_t& ray, CStudioHdr *pStudioHdr, mstudiohitboxset_t *set, matrix3x4_t **hitboxbones, int fContentsMask, trace_t &trace );
 
@@ -477,5 +521,7 @@ void QuaternionSM( float s, const Quaternion &p, const Quaternion &q, Quaternion
 void QuaternionMA( const Quaternion &p, float s, const Quaternion &q, Quaternion &qt );
 
 bool Studio_PrefetchSequence( const CStudioHdr *pStudioHdr, int iSequence );
+bool Studio_PrefetchPose( const CStudioHdr *pStudioHdr, int iSequence );
+bool Studio_PrefetchAutoplaySequences( const CStudioHdr *pStudioHdr );
 
 #endif // BONE_SETUP_H
@@ -0,0 +1,498 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Flattened SendTables for change detection. See dt_send_compiled.h.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include <string.h>
+#include <stdlib.h>
+#include "dt_send_compiled.h"
+#include "tier1/strtools.h"
+
+#if defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 ) || defined( __SSE2__ )
+#define DT_SEND_COMPILED_SSE2
+#include <emmintrin.h>
+#endif
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+#define SNAPSHOT_BLOCK_SIZE		16
+
+
+//-----------------------------------------------------------------------------
+// Returns the number of bytes the proxy reads, or 0 if its output depends on
+// anything but those bytes (entity lookups, string tables, other fields...).
+//-----------------------------------------------------------------------------
+static int GetRawProxySize( SendVarProxyFn fn )
+{
+	const CStandardSendProxies &std = g_StandardSendProxies;
+
+	if ( fn == std.m_Int8ToInt32 || fn == std.m_UInt8ToInt32 )
+		return 1;
+	if ( fn == std.m_Int16ToInt32 || fn == std.m_UInt16ToInt32 )
+		return 2;
+	if ( fn == std.m_Int32ToInt32 || fn == std.m_UInt32ToInt32 )
+		return 4;
+	if ( fn == std.m_FloatToFloat || fn == SendProxy_AngleToFloat )
+		return sizeof( float );
+	if ( fn == std.m_VectorToVector || fn == SendProxy_QAngles )
+		return 3 * sizeof( float );
+	if ( fn == SendProxy_StringToString )
+		return DT_MAX_STRING_BUFFERSIZE;
+
+	return 0;
+}
+
+// Datatable proxies that hand back the pointer they were given
+static bool IsNonModifiedPointerProxy( SendTableProxyFn fn )
+{
+	for ( CNonModifiedPointerProxy *p = *g_StandardSendProxies.m_ppNonModifiedPointerProxies; p; p = p->m_pNext )
+	{
+		if ( p->m_Fn == fn )
+			return true;
+	}
+	return false;
+}
+
+// Vector elements are named "varName[i]"
+static int GetVectorElemIndex( const SendProp *pProp )
+{
+	const char *pName = pProp->GetName();
+	int len = pName ? strlen( pName ) : 0;
+	if ( len >= 3 && pName[len-1] == ']' && pName[len-3] == '[' )
+		return pName[len-2] - '0';
+	return 0;
+}
+
+static void CollectExcludes( SendTable *pTable, CUtlVector<const SendProp *> &excludes )
+{
+	for ( int i = 0; i < pTable->GetNumProps(); i++ )
+	{
+		SendProp *pProp = pTable->GetProp( i );
+		if ( pProp->IsExcludeProp() )
+		{
+			excludes.AddToTail( pProp );
+		}
+		else if ( pProp->GetType() == DPT_DataTable && pProp->GetDataTable() )
+		{
+			CollectExcludes( pProp->GetDataTable(), excludes );
+		}
+	}
+}
+
+static bool IsExcluded( SendTable *pTable, const SendProp *pProp, const CUtlVector<const SendProp *> &excludes )
+{
+	for ( int i = 0; i < excludes.Count(); i++ )
+	{
+		if ( !Q_stricmp( excludes[i]->GetName(), pProp->GetName() ) &&
+			!Q_stricmp( excludes[i]->GetExcludeDTName(), pTable->GetName() ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static int __cdecl CompareCompiledProps( const CompiledSendProp_t *pLeft, const CompiledSendProp_t *pRight )
+{
+	if ( pLeft->m_Offset != pRight->m_Offset )
+		return ( pLeft->m_Offset < pRight->m_Offset ) ? -1 : 1;
+
+	// Keep table order for props that share an offset
+	if ( pLeft->m_iSnapshot != pRight->m_iSnapshot )
+		return ( pLeft->m_iSnapshot < pRight->m_iSnapshot ) ? -1 : 1;
+	return 0;
+}
+
+
+//-----------------------------------------------------------------------------
+// CCompiledSendTable
+//-----------------------------------------------------------------------------
+CCompiledSendTable::CCompiledSendTable()
+{
+	m_pTable = NULL;
+	m_nSnapshotSize = 0;
+	m_pUntrackableReason = NULL;
+	m_bTrackable = false;
+	m_bRecipientProxies = false;
+}
+
+
+bool CCompiledSendTable::Compile( SendTable *pTable )
+{
+	m_pTable = pTable;
+	m_Props.RemoveAll();
+	m_VolatileProps.RemoveAll();
+	m_StringProps.RemoveAll();
+	m_CopyRuns.RemoveAll();
+	m_BlockPropStart.RemoveAll();
+	m_BlockProps.RemoveAll();
+	m_nSnapshotSize = 0;
+	m_pUntrackableReason = NULL;
+	m_bRecipientProxies = false;
+
+	// Excludes apply to the whole tree, no matter where they were declared
+	CUtlVector<const SendProp *> excludes;
+	CollectExcludes( pTable, excludes );
+
+	m_bTrackable = AddTable( pTable, 0, -1, excludes );
+	if ( m_bTrackable )
+	{
+		Link();
+	}
+
+	if ( !m_bTrackable )
+	{
+		m_Props.RemoveAll();
+		m_VolatileProps.RemoveAll();
+		m_StringProps.RemoveAll();
+		m_CopyRuns.RemoveAll();
+		m_nSnapshotSize = 0;
+	}
+	return m_bTrackable;
+}
+
+
+bool CCompiledSendTable::AddTable( SendTable *pTable, int nBaseOffset, int nChangeBase, const CUtlVector<const SendProp *> &excludes )
+{
+	for ( int iProp = 0; iProp < pTable->GetNumProps(); iProp++ )
+	{
+		SendProp *pProp = pTable->GetProp( iProp );
+
+		// Inside-array props are encoded through the DPT_Array prop that follows them
+		if ( pProp->IsExcludeProp() || pProp->IsInsideArray() || IsExcluded( pTable, pProp, excludes ) )
+			continue;
+
+		if ( pProp->GetType() == DPT_DataTable )
+		{
+			SendTableProxyFn fn = pProp->GetDataTableProxyFn();
+			if ( fn == SendProxy_DataTablePtrToDataTable ||
+				( fn != SendProxy_DataTableToDataTable && fn != SendProxy_SendLocalDataTable && !IsNonModifiedPointerProxy( fn ) ) )
+			{
+				m_pUntrackableReason = pProp->GetName();
+				return false;
+			}
+
+			// SendLocalDataTable only depends on the object ID, the others
+			// can change who gets the table whenever they like
+			if ( fn != SendProxy_DataTableToDataTable && fn != SendProxy_SendLocalDataTable )
+			{
+				m_bRecipientProxies = true;
+			}
+
+			// Elements of a SendPropArray3 array report the array itself as changed
+			int nOffset = nBaseOffset + pProp->GetOffset();
+			int nChildChangeBase = nChangeBase;
+			if ( nChildChangeBase < 0 && pProp->GetArrayProp() )
+			{
+				nChildChangeBase = nOffset;
+			}
+
+			if ( !AddTable( pProp->GetDataTable(), nOffset, nChildChangeBase, excludes ) )
+				return false;
+			continue;
+		}
+
+		const SendProp *pArrayElement = NULL;
+		if ( pProp->GetType() == DPT_Array )
+		{
+			pArrayElement = pProp->GetArrayProp();
+			if ( !pArrayElement && iProp > 0 )
+			{
+				pArrayElement = pTable->GetProp( iProp - 1 );
+			}
+			if ( !pArrayElement )
+			{
+				m_pUntrackableReason = pProp->GetName();
+				return false;
+			}
+		}
+
+		if ( !AddProp( pProp, pArrayElement, nBaseOffset, nChangeBase ) )
+			return false;
+	}
+
+	return true;
+}
+
+
+bool CCompiledSendTable::AddProp( const SendProp *pProp, const SendProp *pArrayElement, int nBaseOffset, int nChangeBase )
+{
+	CompiledSendProp_t prop;
+	prop.m_pProp = pProp;
+	prop.m_Type = (unsigned char)pProp->GetType();
+	prop.m_nBits = (unsigned char)pProp->m_nBits;
+	prop.m_Flags = 0;
+
+	int nOffset, nChangeOffset, nBytes;
+	if ( pArrayElement )
+	{
+		// The elements are read from the element prop's offset
+		prop.m_ProxyFn = pArrayElement->GetProxyFn();
+		nOffset = nBaseOffset + pArrayElement->GetOffset();
+		nChangeOffset = nOffset;
+
+		int nElementSize = GetRawProxySize( prop.m_ProxyFn );
+		if ( pProp->GetArrayLengthProxy() || pArrayElement->GetType() == DPT_String || nElementSize == 0 || pProp->GetElementStride() <= 0 )
+		{
+			nBytes = 0;
+		}
+		else
+		{
+			nBytes = pProp->GetElementStride() * ( pProp->GetNumElements() - 1 ) + nElementSize;
+		}
+	}
+	else
+	{
+		prop.m_ProxyFn = pProp->GetProxyFn();
+		nOffset = pProp->GetOffset();
+		nBytes = GetRawProxySize( prop.m_ProxyFn );
+
+		// SENDINFO_VECTORELEM offsets are negative until the engine initializes the table
+		if ( nOffset < 0 || ( pProp->GetFlags() & SPROP_IS_A_VECTOR_ELEM ) )
+		{
+			nOffset = nBaseOffset + abs( nOffset );
+			nChangeOffset = nOffset - GetVectorElemIndex( pProp ) * sizeof( float );
+		}
+		else
+		{
+			nOffset += nBaseOffset;
+			nChangeOffset = nOffset;
+		}
+
+		if ( prop.m_Type == DPT_String && nBytes )
+		{
+			prop.m_Flags |= COMPILEDPROP_STRING;
+		}
+	}
+
+	if ( nChangeBase >= 0 )
+	{
+		nChangeOffset = nChangeBase;
+	}
+
+	if ( nOffset < 0 || nOffset + nBytes > 0xFFFF || nChangeOffset < 0 || m_nSnapshotSize + nBytes > 0xFFFF - SNAPSHOT_BLOCK_SIZE )
+	{
+		m_pUntrackableReason = pProp->GetName();
+		return false;
+	}
+
+	if ( nBytes == 0 )
+	{
+		prop.m_Flags |= COMPILEDPROP_VOLATILE;
+	}
+
+	prop.m_Offset = (unsigned short)nOffset;
+	prop.m_ChangeOffset = (unsigned short)nChangeOffset;
+	prop.m_nBytes = (unsigned short)nBytes;
+	prop.m_iSnapshot = (unsigned short)m_nSnapshotSize;	// Table order until Link() lays the snapshot out
+	m_nSnapshotSize += nBytes;
+
+	m_Props.AddToTail( prop );
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Lays the snapshot out in entity offset order, so neighbouring props become
+// single copy runs, and builds the block to prop lists.
+//-----------------------------------------------------------------------------
+void CCompiledSendTable::Link()
+{
+	if ( m_Props.Count() > 1 )
+	{
+		qsort( m_Props.Base(), m_Props.Count(), sizeof( CompiledSendProp_t ), (int (__cdecl *)(const void *, const void *))CompareCompiledProps );
+	}
+
+	int iSnapshot = 0;
+	for ( int i = 0; i < m_Props.Count(); i++ )
+	{
+		CompiledSendProp_t &prop = m_Props[i];
+		prop.m_iSnapshot = (unsigned short)iSnapshot;
+		iSnapshot += prop.m_nBytes;
+
+		if ( prop.m_Flags & COMPILEDPROP_VOLATILE )
+		{
+			m_VolatileProps.AddToTail( i );
+			continue;
+		}
+
+		if ( prop.m_Flags & COMPILEDPROP_STRING )
+		{
+			m_StringProps.AddToTail( i );
+			continue;
+		}
+
+		if ( m_CopyRuns.Count() )
+		{
+			CopyRun_t &run = m_CopyRuns[m_CopyRuns.Count() - 1];
+			if ( run.m_Offset + run.m_nBytes == prop.m_Offset && run.m_iSnapshot + run.m_nBytes == prop.m_iSnapshot )
+			{
+				run.m_nBytes += prop.m_nBytes;
+				continue;
+			}
+		}
+
+		CopyRun_t run;
+		run.m_Offset = prop.m_Offset;
+		run.m_iSnapshot = prop.m_iSnapshot;
+		run.m_nBytes = prop.m_nBytes;
+		m_CopyRuns.AddToTail( run );
+	}
+
+	m_nSnapshotSize = AlignValue( iSnapshot, SNAPSHOT_BLOCK_SIZE );
+
+	int nBlocks = m_nSnapshotSize / SNAPSHOT_BLOCK_SIZE;
+	m_BlockPropStart.SetCount( nBlocks + 1 );
+
+	int iProp = 0;
+	for ( int iBlock = 0; iBlock < nBlocks; iBlock++ )
+	{
+		m_BlockPropStart[iBlock] = m_BlockProps.Count();
+
+		int nBlockStart = iBlock * SNAPSHOT_BLOCK_SIZE;
+		int nBlockEnd = nBlockStart + SNAPSHOT_BLOCK_SIZE;
+
+		// Skip props that end before this block; the first prop that overlaps
+		// it may have started in an earlier block
+		while ( iProp < m_Props.Count() && m_Props[iProp].m_iSnapshot + m_Props[iProp].m_nBytes <= nBlockStart )
+		{
+			iProp++;
+		}
+
+		for ( int i = iProp; i < m_Props.Count() && m_Props[i].m_iSnapshot < nBlockEnd; i++ )
+		{
+			if ( m_Props[i].m_nBytes )
+			{
+				m_BlockProps.AddToTail( i );
+			}
+		}
+	}
+	m_BlockPropStart[nBlocks] = m_BlockProps.Count();
+}
+
+
+void CCompiledSendTable::Capture( const void *pBase, unsigned char *pSnapshot ) const
+{
+	const unsigned char *pEntity = (const unsigned char *)pBase;
+
+	const CopyRun_t *pRuns = m_CopyRuns.Base();
+	for ( int i = m_CopyRuns.Count(); --i >= 0; )
+	{
+		memcpy( pSnapshot + pRuns[i].m_iSnapshot, pEntity + pRuns[i].m_Offset, pRuns[i].m_nBytes );
+	}
+
+	for ( int i = 0; i < m_StringProps.Count(); i++ )
+	{
+		const CompiledSendProp_t &prop = m_Props[m_StringProps[i]];
+
+		// strncpy zero fills, so stale characters after the terminator never
+		// show up as changes
+		strncpy( (char *)pSnapshot + prop.m_iSnapshot, (const char *)pEntity + prop.m_Offset, prop.m_nBytes - 1 );
+	}
+}
+
+
+inline bool CCompiledSendTable::IsPropChanged( const CompiledSendProp_t &prop, const unsigned char *pOld, const unsigned char *pNew ) const
+{
+	return memcmp( pOld + prop.m_iSnapshot, pNew + prop.m_iSnapshot, prop.m_nBytes ) != 0;
+}
+
+
+static inline bool IsSnapshotBlockEqual( const unsigned char *pOld, const unsigned char *pNew )
+{
+#ifdef DT_SEND_COMPILED_SSE2
+	__m128i a = _mm_loadu_si128( (const __m128i *)pOld );
+	__m128i b = _mm_loadu_si128( (const __m128i *)pNew );
+	return _mm_movemask_epi8( _mm_cmpeq_epi8( a, b ) ) == 0xFFFF;
+#else
+	const unsigned int *a = (const unsigned int *)pOld;
+	const unsigned int *b = (const unsigned int *)pNew;
+	return ( ( a[0] ^ b[0] ) | ( a[1] ^ b[1] ) | ( a[2] ^ b[2] ) | ( a[3] ^ b[3] ) ) == 0;
+#endif
+}
+
+
+static inline bool AddChangeOffset( unsigned short offset, unsigned short *pChangeOffsets, int &nChangeOffsets, int nMaxOffsets )
+{
+	for ( int i = 0; i < nChangeOffsets; i++ )
+	{
+		if ( pChangeOffsets[i] == offset )
+			return true;
+	}
+
+	if ( nChangeOffsets == nMaxOffsets )
+		return false;
+
+	pChangeOffsets[nChangeOffsets++] = offset;
+	return true;
+}
+
+
+int CCompiledSendTable::FindChanges( const unsigned char *pOld, const unsigned char *pNew, unsigned short *pChangeOffsets, int nMaxOffsets ) const
+{
+	int nChangeOffsets = 0;
+	for ( int i = 0; i < m_VolatileProps.Count(); i++ )
+	{
+		if ( !AddChangeOffset( m_Props[m_VolatileProps[i]].m_ChangeOffset, pChangeOffsets, nChangeOffsets, nMaxOffsets ) )
+			return -1;
+	}
+
+	// A prop that straddles two blocks is listed in both; it only needs one look
+	int iLastProp = -1;
+	int nBlocks = m_nSnapshotSize / SNAPSHOT_BLOCK_SIZE;
+	for ( int iBlock = 0; iBlock < nBlocks; iBlock++ )
+	{
+		int nBlockStart = iBlock * SNAPSHOT_BLOCK_SIZE;
+		if ( IsSnapshotBlockEqual( pOld + nBlockStart, pNew + nBlockStart ) )
+			continue;
+
+		for ( int i = m_BlockPropStart[iBlock]; i < m_BlockPropStart[iBlock+1]; i++ )
+		{
+			int iProp = m_BlockProps[i];
+			if ( iProp <= iLastProp )
+				continue;
+
+			iLastProp = iProp;
+			const CompiledSendProp_t &prop = m_Props[iProp];
+			if ( IsPropChanged( prop, pOld, pNew ) &&
+				!AddChangeOffset( prop.m_ChangeOffset, pChangeOffsets, nChangeOffsets, nMaxOffsets ) )
+			{
+				return -1;
+			}
+		}
+	}
+
+	return nChangeOffsets;
+}
+
+
+int CCompiledSendTable::CountChangedProps( const unsigned char *pOld, const unsigned char *pNew ) const
+{
+	int nChanged = 0;
+	int iLastProp = -1;
+	int nBlocks = m_nSnapshotSize / SNAPSHOT_BLOCK_SIZE;
+	for ( int iBlock = 0; iBlock < nBlocks; iBlock++ )
+	{
+		int nBlockStart = iBlock * SNAPSHOT_BLOCK_SIZE;
+		if ( IsSnapshotBlockEqual( pOld + nBlockStart, pNew + nBlockStart ) )
+			continue;
+
+		for ( int i = m_BlockPropStart[iBlock]; i < m_BlockPropStart[iBlock+1]; i++ )
+		{
+			int iProp = m_BlockProps[i];
+			if ( iProp <= iLastProp )
+				continue;
+
+			iLastProp = iProp;
+			if ( IsPropChanged( m_Props[iProp], pOld, pNew ) )
+			{
+				nChanged++;
+			}
+		}
+	}
+	return nChanged;
+}
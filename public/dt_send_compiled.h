@@ -0,0 +1,157 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Flattened, precompiled form of a SendTable that the game DLL uses to
+//			find out which networked properties of an entity really changed
+//			since the last time it was captured.
+//
+//			Compiling walks the table tree once and produces a flat array of
+//			(offset, size, type, proxy) records, plus a list of copy runs that
+//			gather every property into a packed snapshot buffer. Comparing two
+//			snapshots 16 bytes at a time gives the set of changed properties
+//			without calling any send proxies. The changes are reported as the
+//			same offsets NetworkStateChanged() would have reported for them.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef DT_SEND_COMPILED_H
+#define DT_SEND_COMPILED_H
+#pragma once
+
+
+#include "dt_send.h"
+#include "utlvector.h"
+
+
+// CompiledSendProp_t::m_Flags
+#define COMPILEDPROP_VOLATILE	(1<<0)	// The proxy output can't be derived from the bytes at m_Offset,
+										// so this prop is always reported as changed.
+#define COMPILEDPROP_STRING		(1<<1)	// Captured as a zero padded C string.
+
+
+struct CompiledSendProp_t
+{
+	const SendProp	*m_pProp;
+	SendVarProxyFn	m_ProxyFn;
+	unsigned short	m_Offset;			// From the start of the entity.
+	unsigned short	m_ChangeOffset;		// What NetworkStateChanged() reports when this prop changes.
+	unsigned short	m_iSnapshot;		// Where the prop's bytes live in a snapshot.
+	unsigned short	m_nBytes;			// 0 for volatile props.
+	unsigned char	m_Type;				// SendPropType.
+	unsigned char	m_nBits;
+	unsigned char	m_Flags;			// COMPILEDPROP_ flags.
+};
+
+
+class CCompiledSendTable
+{
+public:
+	CCompiledSendTable();
+
+	// Flattens the table. Returns false (and IsTrackable() returns false) if the
+	// table contains a datatable proxy that can move the data pointer, in which
+	// case the prop offsets don't describe the entity and nothing can be tracked.
+	bool			Compile( SendTable *pTable );
+
+	bool			IsTrackable() const;
+	const char		*GetUntrackableReason() const;
+	const char		*GetName() const;
+
+	// True if a datatable proxy in the tree modifies the recipients. The engine
+	// must be allowed to re-run those proxies, so these tables should never be
+	// reported as completely unchanged.
+	bool			HasRecipientProxies() const;
+
+	int				GetNumProps() const;
+	const CompiledSendProp_t &GetProp( int i ) const;
+	int				GetNumVolatileProps() const;
+
+	// Snapshots are padded to a multiple of 16 bytes. Allocate them zeroed.
+	int				GetSnapshotSize() const;
+
+	// Copies every non-volatile prop of the entity at pBase into pSnapshot.
+	void			Capture( const void *pBase, unsigned char *pSnapshot ) const;
+
+	// Writes the change offsets of every prop that differs between the two
+	// snapshots, plus every volatile prop, into pChangeOffsets. Each offset is
+	// written once. Returns the number written, or -1 if there are more than
+	// nMaxOffsets of them.
+	int				FindChanges( const unsigned char *pOld, const unsigned char *pNew, unsigned short *pChangeOffsets, int nMaxOffsets ) const;
+
+	// Same test without building the list. Returns the number of changed
+	// non-volatile props.
+	int				CountChangedProps( const unsigned char *pOld, const unsigned char *pNew ) const;
+
+private:
+	struct CopyRun_t
+	{
+		unsigned short	m_Offset;
+		unsigned short	m_iSnapshot;
+		unsigned short	m_nBytes;
+	};
+
+	bool			AddTable( SendTable *pTable, int nBaseOffset, int nChangeBase, const CUtlVector<const SendProp *> &excludes );
+	bool			AddProp( const SendProp *pProp, const SendProp *pArrayElement, int nBaseOffset, int nChangeBase );
+	void			Link();
+	bool			IsPropChanged( const CompiledSendProp_t &prop, const unsigned char *pOld, const unsigned char *pNew ) const;
+
+	SendTable					*m_pTable;
+	CUtlVector<CompiledSendProp_t>	m_Props;
+	CUtlVector<unsigned short>	m_VolatileProps;
+	CUtlVector<unsigned short>	m_StringProps;
+	CUtlVector<CopyRun_t>		m_CopyRuns;
+
+	// For each 16 byte snapshot block, the props that overlap it are
+	// m_BlockProps[m_BlockPropStart[block]] up to m_BlockPropStart[block+1].
+	CUtlVector<unsigned short>	m_BlockPropStart;
+	CUtlVector<unsigned short>	m_BlockProps;
+
+	int							m_nSnapshotSize;
+	const char					*m_pUntrackableReason;
+	bool						m_bTrackable;
+	bool						m_bRecipientProxies;
+};
+
+
+inline bool CCompiledSendTable::IsTrackable() const
+{
+	return m_bTrackable;
+}
+
+inline const char *CCompiledSendTable::GetUntrackableReason() const
+{
+	return m_pUntrackableReason;
+}
+
+inline const char *CCompiledSendTable::GetName() const
+{
+	return m_pTable ? m_pTable->GetName() : "";
+}
+
+inline bool CCompiledSendTable::HasRecipientProxies() const
+{
+	return m_bRecipientProxies;
+}
+
+inline int CCompiledSendTable::GetNumProps() const
+{
+	return m_Props.Count();
+}
+
+inline const CompiledSendProp_t &CCompiledSendTable::GetProp( int i ) const
+{
+	return m_Props[i];
+}
+
+inline int CCompiledSendTable::GetNumVolatileProps() const
+{
+	return m_VolatileProps.Count();
+}
+
+inline int CCompiledSendTable::GetSnapshotSize() const
+{
+	return m_nSnapshotSize;
+}
+
+
+#endif // DT_SEND_COMPILED_H
@@ -376,6 +376,227 @@ inline __m128 fnegate(__m128 x)
 	return _mm_xor_ps(x,_mm_load_ps((float *) signmask));
 }
 
+/// select a where mask is set, b elsewhere
+inline __m128 MMSelect(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask,a),_mm_andnot_ps(mask,b));
+}
+
+/// sin of 4 angles in -pi..pi, to about 1e-7. There's no range reduction, so angles outside
+/// that range give garbage.
+inline __m128 SinSSE(__m128 x)
+{
+	static __m128 FourPis={3.14159265f,3.14159265f,3.14159265f,3.14159265f};
+	static __m128 FourNegInvFactorial3={-0.166666667f,-0.166666667f,-0.166666667f,-0.166666667f};
+	static __m128 FourInvFactorial5={0.00833333333f,0.00833333333f,0.00833333333f,0.00833333333f};
+	static __m128 FourNegInvFactorial7={-0.000198412698f,-0.000198412698f,-0.000198412698f,-0.000198412698f};
+	static __m128 FourInvFactorial9={2.75573192e-06f,2.75573192e-06f,2.75573192e-06f,2.75573192e-06f};
+	static __m128 FourNegInvFactorial11={-2.50521084e-08f,-2.50521084e-08f,-2.50521084e-08f,-2.50521084e-08f};
+	// sin(-x)=-sin(x), and sin(x)=sin(pi-x) folds 0..pi into 0..pi/2
+	__m128 sign=_mm_xor_ps(x,fabs(x));
+	__m128 u=fabs(x);
+	u=_mm_min_ps(u,_mm_sub_ps(FourPis,u));
+	__m128 u2=_mm_mul_ps(u,u);
+	__m128 poly=_mm_add_ps(FourInvFactorial9,_mm_mul_ps(u2,FourNegInvFactorial11));
+	poly=_mm_add_ps(FourNegInvFactorial7,_mm_mul_ps(u2,poly));
+	poly=_mm_add_ps(FourInvFactorial5,_mm_mul_ps(u2,poly));
+	poly=_mm_add_ps(FourNegInvFactorial3,_mm_mul_ps(u2,poly));
+	poly=_mm_add_ps(Four_Ones,_mm_mul_ps(u2,poly));
+	return _mm_or_ps(sign,_mm_mul_ps(u,poly));
+}
+
+/// acos of 4 values in -1..1, to about 1e-7 (Abramowitz & Stegun 4.4.46)
+inline __m128 ArcCosSSE(__m128 x)
+{
+	static __m128 FourPis={3.14159265f,3.14159265f,3.14159265f,3.14159265f};
+	static __m128 A0={1.5707963050f,1.5707963050f,1.5707963050f,1.5707963050f};
+	static __m128 A1={-0.2145988016f,-0.2145988016f,-0.2145988016f,-0.2145988016f};
+	static __m128 A2={0.0889789874f,0.0889789874f,0.0889789874f,0.0889789874f};
+	static __m128 A3={-0.0501743046f,-0.0501743046f,-0.0501743046f,-0.0501743046f};
+	static __m128 A4={0.0308918810f,0.0308918810f,0.0308918810f,0.0308918810f};
+	static __m128 A5={-0.0170881256f,-0.0170881256f,-0.0170881256f,-0.0170881256f};
+	static __m128 A6={0.0066700901f,0.0066700901f,0.0066700901f,0.0066700901f};
+	static __m128 A7={-0.0012624911f,-0.0012624911f,-0.0012624911f,-0.0012624911f};
+	// acos(-x)=pi-acos(x)
+	__m128 negative=_mm_cmplt_ps(x,Four_Zeros);
+	__m128 u=_mm_min_ps(fabs(x),Four_Ones);
+	__m128 poly=_mm_add_ps(A6,_mm_mul_ps(u,A7));
+	poly=_mm_add_ps(A5,_mm_mul_ps(u,poly));
+	poly=_mm_add_ps(A4,_mm_mul_ps(u,poly));
+	poly=_mm_add_ps(A3,_mm_mul_ps(u,poly));
+	poly=_mm_add_ps(A2,_mm_mul_ps(u,poly));
+	poly=_mm_add_ps(A1,_mm_mul_ps(u,poly));
+	poly=_mm_add_ps(A0,_mm_mul_ps(u,poly));
+	__m128 ret=_mm_mul_ps(_mm_sqrt_ps(_mm_sub_ps(Four_Ones,u)),poly);
+	return MMSelect(negative,_mm_sub_ps(FourPis,ret),ret);
+}
+
+/// class FourQuaternions stores 4 independent quaternions for use by sse processing, in the
+/// format x x x x y y y y z z z z w w w w. The functions below match the scalar Quaternion
+/// functions in mathlib to within float rounding, except slerp, whose trig is approximated.
+class FourQuaternions
+{
+public:
+	__m128 x,y,z,w;											// x x x x y y y y z z z z w w w w
+
+	inline __m128 const & operator[](int idx) const
+	{
+		return *((&x)+idx);
+	}
+
+	inline __m128 & operator[](int idx)
+	{
+		return *((&x)+idx);
+	}
+
+	inline __m128 operator*(FourQuaternions const &b) const	//< 4 dot products
+	{
+		__m128 dot=_mm_mul_ps(x,b.x);
+		dot=_mm_add_ps(dot,_mm_mul_ps(y,b.y));
+		dot=_mm_add_ps(dot,_mm_mul_ps(z,b.z));
+		dot=_mm_add_ps(dot,_mm_mul_ps(w,b.w));
+		return dot;
+	}
+
+	FourQuaternions(void)
+	{
+	}
+
+	/// LoadAndSwizzle - load 4 Quaternions into a FourQuaternions, performing transpose op
+	inline void LoadAndSwizzle(Quaternion const &a, Quaternion const &b, Quaternion const &c, Quaternion const &d)
+	{
+		x=_mm_loadu_ps(&(a.x));
+		y=_mm_loadu_ps(&(b.x));
+		z=_mm_loadu_ps(&(c.x));
+		w=_mm_loadu_ps(&(d.x));
+		_MM_TRANSPOSE4_PS(x,y,z,w);
+	}
+
+	/// SwizzleAndStore - transpose back and store into 4 Quaternions
+	inline void SwizzleAndStore(Quaternion &a, Quaternion &b, Quaternion &c, Quaternion &d) const
+	{
+		__m128 row0=x;
+		__m128 row1=y;
+		__m128 row2=z;
+		__m128 row3=w;
+		_MM_TRANSPOSE4_PS(row0,row1,row2,row3);
+		_mm_storeu_ps(&(a.x),row0);
+		_mm_storeu_ps(&(b.x),row1);
+		_mm_storeu_ps(&(c.x),row2);
+		_mm_storeu_ps(&(d.x),row3);
+	}
+
+	/// take b's quaternions where mask is set
+	inline void MaskedAssign(__m128 mask, FourQuaternions const &b)
+	{
+		x=MMSelect(mask,b.x,x);
+		y=MMSelect(mask,b.y,y);
+		z=MMSelect(mask,b.z,z);
+		w=MMSelect(mask,b.w,w);
+	}
+
+	/// normalize all 4 quaternions in place, leaving zero length ones alone (QuaternionNormalize)
+	inline void Normalize(void)
+	{
+		__m128 radius=(*this)*(*this);
+		__m128 nonzero=_mm_cmpneq_ps(radius,Four_Zeros);
+		__m128 iradius=_mm_div_ps(Four_Ones,_mm_sqrt_ps(radius));
+		x=MMSelect(nonzero,_mm_mul_ps(x,iradius),x);
+		y=MMSelect(nonzero,_mm_mul_ps(y,iradius),y);
+		z=MMSelect(nonzero,_mm_mul_ps(z,iradius),z);
+		w=MMSelect(nonzero,_mm_mul_ps(w,iradius),w);
+	}
+};
+
+/// p*sclp + q*sclq for 4 quaternions
+inline FourQuaternions QuaternionScaleAddSSE(FourQuaternions const &p, __m128 sclp, FourQuaternions const &q, __m128 sclq)
+{
+	FourQuaternions ret;
+	ret.x=_mm_add_ps(_mm_mul_ps(sclp,p.x),_mm_mul_ps(sclq,q.x));
+	ret.y=_mm_add_ps(_mm_mul_ps(sclp,p.y),_mm_mul_ps(sclq,q.y));
+	ret.z=_mm_add_ps(_mm_mul_ps(sclp,p.z),_mm_mul_ps(sclq,q.z));
+	ret.w=_mm_add_ps(_mm_mul_ps(sclp,p.w),_mm_mul_ps(sclq,q.w));
+	return ret;
+}
+
+/// flip the q's that are closer to -p than to p (QuaternionAlign), where mask is set
+inline FourQuaternions QuaternionAlignSSE(FourQuaternions const &p, FourQuaternions const &q, __m128 mask)
+{
+	__m128 a=Four_Zeros;
+	__m128 b=Four_Zeros;
+	for(int i=0;i<4;i++)
+	{
+		__m128 diff=_mm_sub_ps(p[i],q[i]);
+		__m128 sum=_mm_add_ps(p[i],q[i]);
+		a=_mm_add_ps(a,_mm_mul_ps(diff,diff));
+		b=_mm_add_ps(b,_mm_mul_ps(sum,sum));
+	}
+	__m128 flip=_mm_and_ps(mask,_mm_cmpgt_ps(a,b));
+	FourQuaternions ret;
+	for(int i=0;i<4;i++)
+		ret[i]=MMSelect(flip,fnegate(q[i]),q[i]);
+	return ret;
+}
+
+/// 4 normalized lerps from p (t=0) to q (t=1) (QuaternionBlendNoAlign)
+inline FourQuaternions QuaternionBlendNoAlignSSE(FourQuaternions const &p, FourQuaternions const &q, __m128 t)
+{
+	FourQuaternions ret=QuaternionScaleAddSSE(p,_mm_sub_ps(Four_Ones,t),q,t);
+	ret.Normalize();
+	return ret;
+}
+
+/// 4 spherical lerps from p (t=0) to q (t=1), t in 0..1 (QuaternionSlerpNoAlign)
+inline FourQuaternions QuaternionSlerpNoAlignSSE(FourQuaternions const &p, FourQuaternions const &q, __m128 t)
+{
+	static __m128 FourSlerpEpsilons={0.000001f,0.000001f,0.000001f,0.000001f};
+	static __m128 FourHalfPis={1.57079633f,1.57079633f,1.57079633f,1.57079633f};
+	__m128 cosom=p*q;
+	__m128 oneminust=_mm_sub_ps(Four_Ones,t);
+
+	// far enough apart for sin(omega) to divide by
+	__m128 omega=ArcCosSSE(cosom);
+	__m128 isinom=_mm_div_ps(Four_Ones,SinSSE(omega));
+	__m128 sclp=_mm_mul_ps(SinSSE(_mm_mul_ps(oneminust,omega)),isinom);
+	__m128 sclq=_mm_mul_ps(SinSSE(_mm_mul_ps(t,omega)),isinom);
+
+	// nearly the same: lerp
+	__m128 close=_mm_cmple_ps(_mm_sub_ps(Four_Ones,cosom),FourSlerpEpsilons);
+	sclp=MMSelect(close,oneminust,sclp);
+	sclq=MMSelect(close,t,sclq);
+	FourQuaternions ret=QuaternionScaleAddSSE(p,sclp,q,sclq);
+
+	// nearly opposite: go the long way round through a perpendicular quaternion
+	__m128 opposite=_mm_cmple_ps(_mm_add_ps(Four_Ones,cosom),FourSlerpEpsilons);
+	if(!IsAllZeros(opposite))
+	{
+		__m128 oppsclp=SinSSE(_mm_mul_ps(oneminust,FourHalfPis));
+		__m128 oppsclq=SinSSE(_mm_mul_ps(t,FourHalfPis));
+		FourQuaternions perp;
+		perp.x=_mm_add_ps(_mm_mul_ps(oppsclp,p.x),_mm_mul_ps(oppsclq,fnegate(q.y)));
+		perp.y=_mm_add_ps(_mm_mul_ps(oppsclp,p.y),_mm_mul_ps(oppsclq,q.x));
+		perp.z=_mm_add_ps(_mm_mul_ps(oppsclp,p.z),_mm_mul_ps(oppsclq,fnegate(q.w)));
+		perp.w=q.z;
+		ret.MaskedAssign(opposite,perp);
+	}
+	return ret;
+}
+
+/// 4 blends from p (t=0) towards the identity (t=1) (QuaternionIdentityBlend)
+inline FourQuaternions QuaternionIdentityBlendSSE(FourQuaternions const &p, __m128 t)
+{
+	__m128 sclp=_mm_sub_ps(Four_Ones,t);
+	FourQuaternions ret;
+	ret.x=_mm_mul_ps(p.x,sclp);
+	ret.y=_mm_mul_ps(p.y,sclp);
+	ret.z=_mm_mul_ps(p.z,sclp);
+	ret.w=_mm_mul_ps(p.w,sclp);
+	__m128 negative=_mm_cmplt_ps(p.w,Four_Zeros);
+	ret.w=MMSelect(negative,_mm_sub_ps(ret.w,t),_mm_add_ps(ret.w,t));
+	ret.Normalize();
+	return ret;
+}
+
 __m128 PowSSE_FixedPoint_Exponent(__m128 x, int exponent);
 
 // PowSSE - raise an sse register to a power.  This is analogous to the C pow() function, with some
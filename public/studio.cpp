@@ -694,6 +694,20 @@ const studiohdr_t *CStudioHdr::GroupStudioHdr( int i ) const
 }
 
 
+void CStudioHdr::ResolveGroups( void ) const
+{
+	if (m_pVModel == NULL)
+	{
+		return;
+	}
+
+	for (int i = 0; i < m_pStudioHdrCache.Count(); i++)
+	{
+		GroupStudioHdr( i );
+	}
+}
+
+
 const studiohdr_t *CStudioHdr::pSeqStudioHdr( int sequence ) const
 {
 	if (m_pVModel == NULL)
@@ -1593,6 +1593,8 @@ public:
 	inline const studiohdr_t	*GetRenderHdr( void ) const { return m_pStudioHdr; };
 	const studiohdr_t *pSeqStudioHdr( int sequence ) const;
 	const studiohdr_t *pAnimStudioHdr( int animation )const;
+	// Looks up every included model now, instead of on first use
+	void ResolveGroups( void ) const;
 
 private:
 	mutable const studiohdr_t		*m_pStudioHdr;
@@ -4,6 +4,7 @@
 //
 // LIFO from disassembly of Windows API and http://perso.wanadoo.fr/gmem/evenements/jim2002/articles/L17_Fober.pdf
 // FIFO from http://perso.wanadoo.fr/gmem/evenements/jim2002/articles/L17_Fober.pdf
+// Bounded MPMC ring from http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
 //
 //=============================================================================
 
@@ -41,8 +42,13 @@
 #define TSLIST_NODE_ALIGNMENT 4
 #endif
 
+#ifdef _WIN32
 #define TSLIST_HEAD_ALIGN __declspec(align(TSLIST_HEAD_ALIGNMENT))
 #define TSLIST_NODE_ALIGN __declspec(align(TSLIST_NODE_ALIGNMENT))
+#elif _LINUX
+#define TSLIST_HEAD_ALIGN __attribute__((aligned(TSLIST_HEAD_ALIGNMENT)))
+#define TSLIST_NODE_ALIGN __attribute__((aligned(TSLIST_NODE_ALIGNMENT)))
+#endif
 
 //-----------------------------------------------------------------------------
 // Lock free list.
@@ -402,4 +408,201 @@ private:
 };
 
 
+//-----------------------------------------------------------------------------
+// Bounded lock free multi-producer/multi-consumer ring (after D. Vyukov's
+// bounded MPMC queue). Each cell carries a sequence number that says whose
+// turn it is, so the only contended writes are the CAS on the enqueue or
+// dequeue index, and those two live on separate cache lines. Storage is
+// inline; nothing is allocated after construction. CAPACITY must be a
+// power of two.
+//-----------------------------------------------------------------------------
+
+#define TSRING_CACHE_LINE_SIZE 64
+
+#if defined( _X360 )
+#define TSRING_BARRIER() __lwsync()
+#elif defined( _WIN32 )
+extern "C" void _ReadWriteBarrier();
+#pragma intrinsic(_ReadWriteBarrier)
+#define TSRING_BARRIER() _ReadWriteBarrier()
+#elif _LINUX
+#define TSRING_BARRIER() __asm __volatile( "" : : : "memory" )
+#endif
+
+template <typename T, int CAPACITY>
+class CTSRingQueue
+{
+public:
+	CTSRingQueue()
+	{
+		COMPILE_TIME_ASSERT( CAPACITY >= 2 && ( CAPACITY & ( CAPACITY - 1 ) ) == 0 );
+		COMPILE_TIME_ASSERT( sizeof(uint32) == sizeof(long) );
+
+		for ( uint32 i = 0; i < CAPACITY; i++ )
+		{
+			m_Cells[i].sequence = i;
+		}
+		m_iEnqueue = 0;
+		m_iDequeue = 0;
+	}
+
+	//-------------------------------------------------
+	// Returns false if the queue is full
+	//-------------------------------------------------
+	bool PushItem( const T &elem )
+	{
+		return ( PushItems( &elem, 1 ) == 1 );
+	}
+
+	//-------------------------------------------------
+	// Returns false if the queue is empty
+	//-------------------------------------------------
+	bool PopItem( T *pResult )
+	{
+		return ( PopItems( pResult, 1 ) == 1 );
+	}
+
+	//-------------------------------------------------
+	// Claims as many consecutive free cells as are available, up to
+	// nElems, with a single CAS. Returns the number pushed, which is
+	// only zero if the queue is full.
+	//-------------------------------------------------
+	int PushItems( const T *pElems, int nElems )
+	{
+		uint32 iPos;
+		int nClaimed;
+
+		for (;;)
+		{
+			iPos = m_iEnqueue;
+			TSRING_BARRIER();
+
+			nClaimed = 0;
+			while ( nClaimed < nElems )
+			{
+				int32 diff = (int32)( GetCell( iPos + nClaimed ).sequence - ( iPos + nClaimed ) );
+				if ( diff != 0 )
+				{
+					if ( diff > 0 && nClaimed == 0 )
+					{
+						// Another producer got here first, our index is stale
+						nClaimed = -1;
+					}
+					break;
+				}
+				nClaimed++;
+			}
+
+			if ( nClaimed == 0 )
+			{
+				return 0;
+			}
+
+			if ( nClaimed > 0 && AssignIndexIf( &m_iEnqueue, iPos + nClaimed, iPos ) )
+			{
+				break;
+			}
+
+			ThreadPause();
+		}
+
+		for ( int i = 0; i < nClaimed; i++ )
+		{
+			Cell_t &cell = GetCell( iPos + i );
+			cell.elem = pElems[i];
+			TSRING_BARRIER();
+			cell.sequence = iPos + i + 1;
+		}
+
+		return nClaimed;
+	}
+
+	//-------------------------------------------------
+	// Pops up to nMaxElems consecutive ready elements with a single CAS.
+	// Returns the number popped, which is only zero if the queue is empty.
+	//-------------------------------------------------
+	int PopItems( T *pResults, int nMaxElems )
+	{
+		uint32 iPos;
+		int nClaimed;
+
+		for (;;)
+		{
+			iPos = m_iDequeue;
+			TSRING_BARRIER();
+
+			nClaimed = 0;
+			while ( nClaimed < nMaxElems )
+			{
+				int32 diff = (int32)( GetCell( iPos + nClaimed ).sequence - ( iPos + nClaimed + 1 ) );
+				if ( diff != 0 )
+				{
+					if ( diff > 0 && nClaimed == 0 )
+					{
+						nClaimed = -1;
+					}
+					break;
+				}
+				nClaimed++;
+			}
+
+			if ( nClaimed == 0 )
+			{
+				return 0;
+			}
+
+			if ( nClaimed > 0 && AssignIndexIf( &m_iDequeue, iPos + nClaimed, iPos ) )
+			{
+				break;
+			}
+
+			ThreadPause();
+		}
+
+		for ( int i = 0; i < nClaimed; i++ )
+		{
+			Cell_t &cell = GetCell( iPos + i );
+			pResults[i] = cell.elem;
+			TSRING_BARRIER();
+			cell.sequence = iPos + i + CAPACITY;
+		}
+
+		return nClaimed;
+	}
+
+	//-------------------------------------------------
+	// Approximate while other threads are pushing or popping
+	//-------------------------------------------------
+	int Count() const
+	{
+		int32 nCount = (int32)( m_iEnqueue - m_iDequeue );
+		return clamp( nCount, 0, CAPACITY );
+	}
+
+	bool IsEmpty() const	{ return ( Count() == 0 ); }
+	int Capacity() const	{ return CAPACITY; }
+
+private:
+	struct Cell_t
+	{
+		volatile uint32 sequence;
+		T elem;
+	};
+
+	Cell_t &GetCell( uint32 iPos )		{ return m_Cells[iPos & ( CAPACITY - 1 )]; }
+
+	static bool AssignIndexIf( volatile uint32 *pIndex, uint32 value, uint32 comperand )
+	{
+		return ( (uint32)ThreadInterlockedCompareExchange( (volatile long *)pIndex, (long)value, (long)comperand ) == comperand );
+	}
+
+	// Keep the two indices off each other's cache lines and off the cells
+	byte			m_Pad0[TSRING_CACHE_LINE_SIZE];
+	volatile uint32	m_iEnqueue;
+	byte			m_Pad1[TSRING_CACHE_LINE_SIZE - sizeof(uint32)];
+	volatile uint32	m_iDequeue;
+	byte			m_Pad2[TSRING_CACHE_LINE_SIZE - sizeof(uint32)];
+	Cell_t			m_Cells[CAPACITY];
+};
+
 #endif // TSLIST_H
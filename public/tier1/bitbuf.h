@@ -629,6 +629,165 @@ inline unsigned int bf_read::ReadUBitLong( int numbits )
 }
 
 
+//-----------------------------------------------------------------------------
+// CBitWriteAccumulator:
+// description:
+//    Writes a run of fields into a bf_write through a 64 bit register and
+//    stores it a dword at a time, instead of masking the buffer on every
+//    field. The bits land exactly where bf_write::WriteUBitLong would put
+//    them. The bf_write's position isn't updated until Flush() or the
+//    destructor, so don't use the bf_write directly while one is active.
+//-----------------------------------------------------------------------------
+class CBitWriteAccumulator
+{
+public:
+					CBitWriteAccumulator( bf_write &buf );
+					~CBitWriteAccumulator()				{ Flush(); }
+
+	void			WriteUBitLong( unsigned int data, int numbits );
+	void			WriteOneBit( int nValue )			{ WriteUBitLong( nValue ? 1 : 0, 1 ); }
+	void			WriteSBitLong( int data, int numbits );
+	void			WriteBitFloat( float val );
+	void			WriteBitCoord( const float f );
+	void			WriteBitNormal( float f );
+
+	// Stores the partial dword and brings the bf_write's position up to date.
+	// Writing can continue afterwards.
+	void			Flush();
+
+	int				GetNumBitsWritten() const;
+	bool			IsOverflowed() const				{ return m_bOverflow; }
+
+private:
+	void			Overflow();
+
+	bf_write		&m_Buf;
+	unsigned int	*m_pDWord;		// Where the low 32 bits of m_nAccum go
+	uint64			m_nAccum;
+	int				m_nAccumBits;
+	int				m_nBitsLeft;	// Room left in the buffer
+	bool			m_bOverflow;
+};
+
+
+//-----------------------------------------------------------------------------
+// CBitReadAccumulator:
+// description:
+//    The read side of CBitWriteAccumulator. Fields are shifted out of a
+//    64 bit register that is refilled a dword at a time. The bf_read's
+//    position is updated by Flush() or the destructor.
+//-----------------------------------------------------------------------------
+class CBitReadAccumulator
+{
+public:
+					CBitReadAccumulator( bf_read &buf );
+					~CBitReadAccumulator()				{ Flush(); }
+
+	unsigned int	ReadUBitLong( int numbits );
+	int				ReadOneBit()						{ return ReadUBitLong( 1 ); }
+	int				ReadSBitLong( int numbits );
+	float			ReadBitFloat();
+	float			ReadBitCoord();
+	float			ReadBitNormal();
+
+	// Brings the bf_read's position up to date. Reading can continue afterwards.
+	void			Flush();
+
+	int				GetNumBitsRead() const				{ return m_iCurBit; }
+	bool			IsOverflowed() const				{ return m_bOverflow; }
+
+private:
+	void			Overflow();
+
+	bf_read			&m_Buf;
+	const unsigned int *m_pNextDWord;
+	uint64			m_nAccum;
+	int				m_nAccumBits;
+	int				m_iCurBit;
+	bool			m_bOverflow;
+};
+
+
+inline void CBitWriteAccumulator::WriteUBitLong( unsigned int data, int numbits )
+{
+	Assert( numbits >= 0 && numbits <= 32 );
+
+	if ( numbits > m_nBitsLeft )
+	{
+		Overflow();
+		return;
+	}
+
+	m_nBitsLeft -= numbits;
+	m_nAccum |= ( data & ( ( (uint64)1 << numbits ) - 1 ) ) << m_nAccumBits;
+	m_nAccumBits += numbits;
+
+	if ( m_nAccumBits >= 32 )
+	{
+		*m_pDWord++ = (unsigned int)m_nAccum;
+		m_nAccum >>= 32;
+		m_nAccumBits -= 32;
+	}
+}
+
+// Sign bit comes last, as in bf_write::WriteSBitLong
+inline void CBitWriteAccumulator::WriteSBitLong( int data, int numbits )
+{
+	Assert( numbits >= 1 );
+	unsigned int nSign = ( data < 0 ) ? ( 1 << ( numbits - 1 ) ) : 0;
+	WriteUBitLong( ( (unsigned int)data & ( nSign ? nSign - 1 : ~0u ) ) | nSign, numbits );
+}
+
+inline void CBitWriteAccumulator::WriteBitFloat( float val )
+{
+	WriteUBitLong( *( (unsigned int *)&val ), 32 );
+}
+
+inline int CBitWriteAccumulator::GetNumBitsWritten() const
+{
+	return ( ( (unsigned char *)m_pDWord - m_Buf.m_pData ) << 3 ) + m_nAccumBits;
+}
+
+inline unsigned int CBitReadAccumulator::ReadUBitLong( int numbits )
+{
+	Assert( numbits >= 0 && numbits <= 32 );
+
+	if ( m_iCurBit + numbits > m_Buf.m_nDataBits )
+	{
+		Overflow();
+		return 0;
+	}
+
+	m_iCurBit += numbits;
+
+	// The dword is only touched when it holds bits we are reading, so this never reads past the data
+	if ( m_nAccumBits < numbits )
+	{
+		m_nAccum |= (uint64)*m_pNextDWord++ << m_nAccumBits;
+		m_nAccumBits += 32;
+	}
+
+	unsigned int ret = (unsigned int)( m_nAccum & ( ( (uint64)1 << numbits ) - 1 ) );
+	m_nAccum >>= numbits;
+	m_nAccumBits -= numbits;
+	return ret;
+}
+
+inline int CBitReadAccumulator::ReadSBitLong( int numbits )
+{
+	Assert( numbits >= 1 );
+	unsigned int r = ReadUBitLong( numbits );
+	unsigned int nSign = 1u << ( numbits - 1 );
+	return ( r & nSign ) ? (int)( ( r & ( nSign - 1 ) ) - nSign ) : (int)r;
+}
+
+inline float CBitReadAccumulator::ReadBitFloat()
+{
+	unsigned int val = ReadUBitLong( 32 );
+	return *( (float *)&val );
+}
+
+
 #endif
 
 
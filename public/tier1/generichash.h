@@ -17,6 +17,7 @@
 unsigned HashString( const char *pszKey );
 unsigned HashStringCaseless( const char *pszKey );
 unsigned HashStringCaselessConventional( const char *pszKey );
+unsigned HashStringConventional( const char *pszKey );
 unsigned Hash4( const void *pKey );
 unsigned Hash8( const void *pKey );
 unsigned Hash12( const void *pKey );
@@ -51,6 +52,22 @@ template<> inline unsigned HashItem<char *>(char * const &pszKey )
 	return HashString( pszKey );
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// 32 bit integer hash. The Pearson hashes above only produce 16 bits, which
+// is not enough to spread keys over an open addressing table with more than
+// 64K slots.
+
+inline unsigned HashIntConventional( const int n )
+{
+	unsigned hash = (unsigned)n;
+	hash ^= hash >> 16;
+	hash *= 0x85EBCA6B;
+	hash ^= hash >> 13;
+	hash *= 0xC2B2AE35;
+	hash ^= hash >> 16;
+	return hash;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 #endif /* !GENERICHASH_H */
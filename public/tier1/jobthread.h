@@ -17,6 +17,12 @@
 //			communication between the worker and master threads. The nature 
 //			of the work is opaque to the fulfiller.
 //
+//			CAsyncJobPool is the scalable alternative. It runs N worker
+//			threads, each owning one deque per job priority. A worker pops
+//			the newest job off its own deque and, when that runs dry,
+//			steals the oldest job from another worker. Jobs can name other
+//			jobs they depend on and will not be queued until those finish.
+//
 //			CAsyncJob instances actually do the work. The base class 
 //			calls virtual methods for job primitives, so derivations don't 
 //			need to worry about threading models. All of the variants of 
@@ -31,6 +37,7 @@
 #include "tier0/threadtools.h"
 #include "tier1/refcount.h"
 #include "tier1/utllinkedlist.h"
+#include "tier1/utlvector.h"
 
 #ifndef JOBTHREAD_H
 #define JOBTHREAD_H
@@ -187,6 +194,97 @@ private:
 	int							m_nSuspend;
 };
 
+//-----------------------------------------------------------------------------
+//
+// CAsyncJobPool
+//
+//-----------------------------------------------------------------------------
+
+class CAsyncJobPool
+{
+public:
+	CAsyncJobPool();
+	~CAsyncJobPool();
+
+	//-----------------------------------------------------
+	// Thread management. nThreads <= 0 uses one thread per logical
+	// processor, less one for the main thread.
+	//-----------------------------------------------------
+	bool Start( int nThreads = -1, unsigned nBytesStack = 0 );
+	void Stop();
+
+	int NumThreads() const							{ return m_Workers.Count(); }
+	bool IsRunning() const							{ return ( m_Workers.Count() != 0 ); }
+
+	//-----------------------------------------------------
+	// Functions for any thread
+	//-----------------------------------------------------
+
+	// Jobs queued and not yet started
+	unsigned GetJobCount() const					{ return m_nQueued; }
+
+	// Jobs added and not yet finished, including those waiting on dependencies
+	unsigned GetOutstandingJobCount() const			{ return m_nOutstanding; }
+
+	//-----------------------------------------------------
+	// Add a job. If dependencies are supplied the job is held until all
+	// of them have finished. Dependencies must have been added to this
+	// pool or already be finished. If the pool is not running the job
+	// executes immediately on the calling thread.
+	//-----------------------------------------------------
+	void AddJob( CAsyncJob *pJob, CAsyncJob **ppDependencies = NULL, int nDependencies = 0 );
+	void AddJob( CAsyncJob *pJob, CAsyncJob *pDependency )	{ AddJob( pJob, &pDependency, 1 ); }
+
+	//-----------------------------------------------------
+	// Blocking operations. The calling thread services queued jobs while
+	// it waits, so these are safe to call from inside a job.
+	//-----------------------------------------------------
+	void WaitForJob( CAsyncJob *pJob );
+	void WaitForIdle();
+
+	//-----------------------------------------------------
+	// Abort everything that is queued but not yet running
+	//-----------------------------------------------------
+	int AbortAll();
+
+	//-----------------------------------------------------
+	// Run a single queued job on the calling thread, if any
+	//-----------------------------------------------------
+	bool ExecuteOne();
+
+private:
+	struct Worker_t
+	{
+		Worker_t() : m_pOwner( NULL ), m_hThread( NULL ), m_iWorker( -1 ) {}
+
+		CAsyncJobPool *				m_pOwner;
+		ThreadHandle_t				m_hThread;
+		int							m_iWorker;
+		CThreadFastMutex			m_mutex;
+		CUtlLinkedList<CAsyncJob *>	m_queue[AJP_HIGH + 1];
+		CThreadManualEvent			m_Exited;
+	};
+
+	static unsigned WorkerThreadFunc( void *pParam );
+	void WorkerLoop( Worker_t *pWorker );
+
+	void QueueReadyJob( CAsyncJob *pJob );
+	CAsyncJob *GetJob( Worker_t *pWorker );
+	void ExecuteJob( CAsyncJob *pJob );
+	void ReleaseDependents( CAsyncJob *pJob );
+
+	CUtlVector<Worker_t *>		m_Workers;
+	CThreadLocalPtr<Worker_t>	m_pCurrentWorker;
+
+	CThreadFastMutex			m_DependencyMutex;
+	CThreadManualEvent			m_JobSignal;
+	CInterlockedInt				m_nIdle;
+	CInterlockedInt				m_nQueued;
+	CInterlockedInt				m_nOutstanding;
+	CInterlockedInt				m_iNextWorker;
+	volatile bool				m_bExit;
+};
+
 //-----------------------------------------------------------------------------
 // Class to combine the metadata for an operation and the ability to perform
 // the operation
@@ -198,7 +296,9 @@ public:
 	  : m_status( ASYNC_STATUS_UNSERVICED ),
 		m_queueID( -1 ),
 		m_pFulfiller( NULL ),
-		m_priority( priority )
+		m_priority( priority ),
+		m_pPool( NULL ),
+		m_bDependentsReleased( false )
 	{
 	}
 
@@ -238,6 +338,7 @@ public:
 protected:
 	//-----------------------------------------------------
 	friend class CAsyncJobFuliller;
+	friend class CAsyncJobPool;
 
 	AsyncStatus_t		m_status;
 	AsyncJobPriority_t	m_priority;
@@ -245,6 +346,12 @@ protected:
 	CThreadMutex		m_mutex;
 	CAsyncJobFuliller *	m_pFulfiller;
 
+	// Pool scheduling state, guarded by the pool's dependency mutex
+	CAsyncJobPool *		m_pPool;
+	CInterlockedInt		m_nDependencies;
+	CUtlVector<CAsyncJob *> m_Dependents;
+	bool				m_bDependentsReleased;
+
 private:
 	//-----------------------------------------------------
 	CAsyncJob( const CAsyncJob &fromRequest );
@@ -28,6 +28,10 @@
 class IBaseFileSystem;
 class CUtlBuffer;
 class Color;
+class CKeyValuesView;
+class CKeyValuesArena;
+class CKVCompiledStrings;
+struct KVCompiledNode_t;
 typedef void * FileHandle_t;
 
 //-----------------------------------------------------------------------------
@@ -163,6 +167,11 @@ public:
 	bool WriteAsBinary( CUtlBuffer &buffer );
 	bool ReadAsBinary( CUtlBuffer &buffer );
 
+	// Compiled form, see tier1/keyvaluesview.h. Both work on this key and its peers.
+	// Compiling fails on wide string, pointer and uint64 values.
+	bool WriteAsCompiled( CUtlBuffer &buffer );
+	bool LoadFromView( const CKeyValuesView &view );
+
 	// Allocate & create a new copy of the keys
 	KeyValues *MakeCopy( void ) const;
 
@@ -188,17 +197,27 @@ public:
 	types_t GetDataType(const char *keyName = NULL);
 
 	// Virtual deletion function - ensures that KeyValues object is deleted from correct heap
+	// Does nothing for arena keys, which are freed when their arena is reset.
 	void deleteThis();
 
+	// The arena this key was allocated from, or NULL for heap keys (see tier1/keyvaluesarena.h)
+	CKeyValuesArena *GetArena() const;
+
 	void		SetStringValue( char const *strValue );
 
 private:
+	friend class CKeyValuesArena;
+
 	KeyValues( KeyValues& );	// prevent copy constructor being used
 
 	// prevent delete being called except through deleteThis()
 	~KeyValues();
 
 	KeyValues* CreateKey( const char *keyName );
+
+	// Allocates a key from the same place as this one: the heap or this key's arena
+	KeyValues *NewKey( const char *keyName );
+	KeyValues *MakeCopy( CKeyValuesArena *pArena ) const;
 	
 	void RecursiveCopyKeyValues( KeyValues& src );
 	void RemoveEverything();
@@ -211,6 +230,8 @@ private:
 	void WriteConvertedString( IBaseFileSystem *filesystem, FileHandle_t f, CUtlBuffer *pBuf, const char *pszString );
 	
 	void RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &buf );
+	int RecursiveWriteCompiled( CUtlVector< KVCompiledNode_t > &nodes, CKVCompiledStrings &strings );
+	void RecursiveLoadFromView( const CKeyValuesView &view );
 
 	// For handling #include "filename"
 	void AppendIncludedKeys( CUtlVector< KeyValues * >& includedKeys );
@@ -226,7 +247,8 @@ private:
 	void WriteIndents( IBaseFileSystem *filesystem, FileHandle_t f, CUtlBuffer *pBuf, int indentLevel );
 
 	void FreeAllocatedValue();
-	void AllocateValueBlock(int size);
+	char *AllocateValueBlock(int size);
+	wchar_t *AllocateWValueBlock(int nChars);
 
 	int m_iKeyName;	// keyname is a symbol defined in KeyValuesSystem
 
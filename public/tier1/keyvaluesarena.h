@@ -0,0 +1,102 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Bump allocator for short-lived KeyValues trees.
+//
+//			Every key and value string of a tree created in an arena lives in
+//			the arena's memory stacks, and keys added to the tree later are
+//			allocated there too. deleteThis() on an arena key does nothing;
+//			the memory comes back all at once from Reset() or FreeToMark().
+//
+//			Only this module knows about arena keys. A tree that has to
+//			outlive its arena, or is handed to code in another module (vgui,
+//			the engine), must be copied to the heap with Escape() first. Don't
+//			link heap keys and arena keys into the same tree.
+//
+//			Not thread safe. Use one arena per thread.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef KEYVALUESARENA_H
+#define KEYVALUESARENA_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+#include "tier1/keyvalues.h"
+#include "tier1/memstack.h"
+#include "tier1/utlvector.h"
+
+
+#define KEYVALUES_ARENA_BLOCK_SIZE	( 64 * 1024 )
+
+// Arena keys are preceded by a pointer to their arena, padded to keep the key aligned
+#define KEYVALUES_ARENA_HEADER_SIZE	8
+
+
+struct KeyValuesArenaMark_t
+{
+	int					m_iBlock;
+	MemoryStackMark_t	m_nUsed;
+	int					m_nKeys;
+};
+
+
+class CKeyValuesArena
+{
+public:
+	CKeyValuesArena( int nBlockSize = KEYVALUES_ARENA_BLOCK_SIZE );
+	~CKeyValuesArena();
+
+	// Same as new KeyValues( pName ), in the arena
+	KeyValues		*CreateKeyValues( const char *pName );
+
+	// Copies a key and its subkeys into the arena
+	KeyValues		*CopyKeyValues( const KeyValues *pSrc );
+
+	// Returns a heap copy of an arena key, which the caller must deleteThis().
+	// Heap keys are returned as they are.
+	static KeyValues *Escape( KeyValues *pKeyValues );
+
+	// Frees every tree in the arena. Blocks stay allocated for reuse.
+	void			Reset();
+
+	// Frees everything allocated after the mark was taken, so nested users of
+	// one arena can each free their own trees
+	KeyValuesArenaMark_t GetMark() const;
+	void			FreeToMark( const KeyValuesArenaMark_t &mark );
+
+	int				GetNumKeys() const;		// Since the last reset
+	int				GetBytesUsed() const;
+	int				GetNumBlocks() const;	// Each one is a single heap allocation
+
+private:
+	friend class KeyValues;
+
+	void			*Alloc( int nBytes );
+	CMemoryStack	*NextBlock( int nBytes );
+	static int		GetBlockCapacity( CMemoryStack *pBlock );
+
+	CUtlVector<CMemoryStack *> m_Blocks;
+	int				m_iBlock;			// The block allocations come from, -1 before the first
+	int				m_nBlockSize;
+	int				m_nKeys;
+};
+
+
+//-----------------------------------------------------------------------------
+// Inline methods
+//-----------------------------------------------------------------------------
+inline int CKeyValuesArena::GetNumKeys() const
+{
+	return m_nKeys;
+}
+
+inline int CKeyValuesArena::GetNumBlocks() const
+{
+	return m_Blocks.Count();
+}
+
+
+#endif // KEYVALUESARENA_H
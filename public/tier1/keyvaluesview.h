@@ -0,0 +1,300 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compiled binary form of a KeyValues tree, a read-only view that
+//			reads it in place, and the file cache KeyValues::LoadFromFile()
+//			uses to skip parsing text that hasn't changed.
+//
+//			A compiled tree is one contiguous block: a header, an array of
+//			fixed size nodes that link to their first child and next peer by
+//			index, and a pool of zero terminated strings. Nothing in it needs
+//			fixing up after it is loaded, so a block can be used straight out
+//			of the buffer it was read into. Use CKeyValuesView to read it
+//			without creating any KeyValues, or KeyValues::LoadFromView() to
+//			get a mutable copy.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef KEYVALUESVIEW_H
+#define KEYVALUESVIEW_H
+#ifdef _WIN32
+#pragma once
+#endif
+
+
+#include "tier1/keyvalues.h"
+#include "tier1/utldict.h"
+#include "tier1/utlbuffer.h"
+
+
+class IBaseFileSystem;
+
+
+#define KVCOMPILED_ID			(('F'<<24)|('V'<<16)|('K'<<8)|'C')	// "CKVF"
+#define KVCOMPILED_VERSION		1
+#define KVCOMPILED_NO_NODE		-1
+
+
+struct KVCompiledHeader_t
+{
+	int		m_nId;
+	int		m_nVersion;
+	int		m_nNodes;
+	int		m_nStringBytes;
+};
+
+// Nodes are stored in preorder, so children and peers always have a higher
+// index than the node that links to them. Node 0 is the first root.
+struct KVCompiledNode_t
+{
+	int		m_nName;			// Offset of the name in the string pool
+	int		m_nString;			// Offset of the value as text, for GetString()
+	int		m_iFirstChild;		// KVCOMPILED_NO_NODE if there isn't one
+	int		m_iNextPeer;		// KVCOMPILED_NO_NODE if there isn't one
+	union
+	{
+		int				m_iValue;
+		float			m_flValue;
+		unsigned char	m_Color[4];
+	};
+	unsigned char	m_Type;				// KeyValues::types_t
+	unsigned char	m_bEscapeSequences;
+	unsigned char	m_Pad[2];
+};
+
+
+//-----------------------------------------------------------------------------
+// Builds the string pool of a compiled tree. Each distinct string is stored once.
+//-----------------------------------------------------------------------------
+class CKVCompiledStrings
+{
+public:
+	CKVCompiledStrings();
+
+	int				AddString( const char *pString );
+	int				GetSize() const;
+	const void		*Base() const;
+
+private:
+	CUtlBuffer		m_Buffer;
+	CUtlDict<int, int> m_Offsets;
+};
+
+
+//-----------------------------------------------------------------------------
+// Read-only handle to one node of a compiled tree. It's two pointers wide and
+// is meant to be passed by value. The memory the tree lives in must outlive it.
+//-----------------------------------------------------------------------------
+class CKeyValuesView
+{
+public:
+	CKeyValuesView();
+
+	// Validates a compiled block and returns a view of its first root, or an
+	// invalid view if the block is truncated or corrupt.
+	static CKeyValuesView FromMemory( const void *pData, int nSize );
+
+	bool				IsValid() const;
+
+	const char			*GetName() const;
+	KeyValues::types_t	GetDataType() const;
+	bool				HasEscapeSequences() const;
+	int					GetNumNodes() const;		// In the whole tree
+
+	CKeyValuesView		GetFirstSubKey() const;
+	CKeyValuesView		GetNextKey() const;
+
+	// Same search rules as KeyValues::FindKey(), including "a/b" paths, but
+	// never creates anything
+	CKeyValuesView		FindKey( const char *pKeyName ) const;
+
+	// Same conversions as the KeyValues accessors. A NULL key name reads this node.
+	int					GetInt( const char *pKeyName = NULL, int nDefault = 0 ) const;
+	float				GetFloat( const char *pKeyName = NULL, float flDefault = 0.0f ) const;
+	const char			*GetString( const char *pKeyName = NULL, const char *pDefault = "" ) const;
+	Color				GetColor( const char *pKeyName = NULL ) const;
+
+private:
+	CKeyValuesView( const KVCompiledHeader_t *pHeader, int iNode );
+
+	const KVCompiledNode_t	&Node() const;
+	const char			*String( int nOffset ) const;
+
+	const KVCompiledHeader_t	*m_pHeader;
+	int					m_iNode;
+};
+
+
+//-----------------------------------------------------------------------------
+// Compiled copies of text KeyValues files, kept in one pack file per module.
+//
+// The pack is read with a single read at Init() and each entry is used in
+// place. An entry is current while the size and timestamp of its text file
+// match, so a changed file is reparsed and recompiled on its next load.
+// Files that #include others aren't cached, since their result depends on
+// more than one file. New entries are written out by Flush() or Shutdown().
+//-----------------------------------------------------------------------------
+class CKeyValuesFileCache
+{
+public:
+	CKeyValuesFileCache();
+	~CKeyValuesFileCache();
+
+	// pPackName is relative to DEFAULT_WRITE_PATH
+	void			Init( IBaseFileSystem *pFileSystem, const char *pPackName );
+	void			Shutdown();
+	void			Flush();
+
+	bool			IsEnabled() const;
+
+	// Turns lookups off without dropping what's loaded (for benchmarking)
+	void			SetEnabled( bool bEnabled );
+
+	// Returns an invalid view unless there's a current entry for the file
+	CKeyValuesView	Find( const char *pResourceName, const char *pPathID, bool bEscapeSequences, unsigned int nSourceSize, long nSourceTime );
+
+	// Compiles pRoot and its peers, replacing any existing entry
+	void			Add( const char *pResourceName, const char *pPathID, bool bEscapeSequences, unsigned int nSourceSize, long nSourceTime, KeyValues *pRoot );
+
+	// Forgets every entry, so every file is parsed again
+	void			Clear();
+
+	int				GetNumEntries() const;
+	int				GetDataSize() const;		// Bytes of compiled data, in all entries
+	int				GetNumHits() const;
+	int				GetNumMisses() const;
+
+private:
+	struct Entry_t
+	{
+		const void		*m_pData;
+		int				m_nDataSize;
+		unsigned int	m_nSourceSize;
+		long			m_nSourceTime;
+		bool			m_bEscapeSequences;
+		bool			m_bOwnsData;		// false if m_pData points into the pack buffer
+	};
+
+	void			MakeKey( const char *pResourceName, const char *pPathID, char *pKey, int nMaxLen ) const;
+	void			LoadPack();
+	void			FreeEntry( Entry_t &entry );
+
+	IBaseFileSystem	*m_pFileSystem;
+	char			m_szPackName[MAX_PATH];
+	void			*m_pPackBuffer;
+	CUtlDict<Entry_t, int> m_Entries;
+	int				m_nDataSize;
+	int				m_nHits;
+	int				m_nMisses;
+	bool			m_bEnabled;
+	bool			m_bDirty;
+};
+
+// The cache KeyValues::LoadFromFile() uses in this module. It's disabled until
+// Init() is called.
+CKeyValuesFileCache *KeyValuesFileCache();
+
+
+//-----------------------------------------------------------------------------
+// Inline methods
+//-----------------------------------------------------------------------------
+inline CKVCompiledStrings::CKVCompiledStrings() : m_Buffer( 0, 0, 0 ), m_Offsets( false )
+{
+}
+
+inline int CKVCompiledStrings::GetSize() const
+{
+	return m_Buffer.TellPut();
+}
+
+inline const void *CKVCompiledStrings::Base() const
+{
+	return m_Buffer.Base();
+}
+
+inline CKeyValuesView::CKeyValuesView() : m_pHeader( NULL ), m_iNode( KVCOMPILED_NO_NODE )
+{
+}
+
+inline CKeyValuesView::CKeyValuesView( const KVCompiledHeader_t *pHeader, int iNode ) : m_pHeader( pHeader ), m_iNode( iNode )
+{
+}
+
+inline bool CKeyValuesView::IsValid() const
+{
+	return m_iNode != KVCOMPILED_NO_NODE;
+}
+
+inline const KVCompiledNode_t &CKeyValuesView::Node() const
+{
+	Assert( IsValid() );
+	return ( (const KVCompiledNode_t *)( m_pHeader + 1 ) )[m_iNode];
+}
+
+inline const char *CKeyValuesView::String( int nOffset ) const
+{
+	return (const char *)( (const KVCompiledNode_t *)( m_pHeader + 1 ) + m_pHeader->m_nNodes ) + nOffset;
+}
+
+inline const char *CKeyValuesView::GetName() const
+{
+	return String( Node().m_nName );
+}
+
+inline KeyValues::types_t CKeyValuesView::GetDataType() const
+{
+	return (KeyValues::types_t)Node().m_Type;
+}
+
+inline bool CKeyValuesView::HasEscapeSequences() const
+{
+	return Node().m_bEscapeSequences != 0;
+}
+
+inline int CKeyValuesView::GetNumNodes() const
+{
+	return m_pHeader ? m_pHeader->m_nNodes : 0;
+}
+
+inline CKeyValuesView CKeyValuesView::GetFirstSubKey() const
+{
+	return CKeyValuesView( m_pHeader, Node().m_iFirstChild );
+}
+
+inline CKeyValuesView CKeyValuesView::GetNextKey() const
+{
+	return CKeyValuesView( m_pHeader, Node().m_iNextPeer );
+}
+
+inline bool CKeyValuesFileCache::IsEnabled() const
+{
+	return m_bEnabled;
+}
+
+inline void CKeyValuesFileCache::SetEnabled( bool bEnabled )
+{
+	m_bEnabled = bEnabled && m_pFileSystem;
+}
+
+inline int CKeyValuesFileCache::GetNumEntries() const
+{
+	return m_Entries.Count();
+}
+
+inline int CKeyValuesFileCache::GetDataSize() const
+{
+	return m_nDataSize;
+}
+
+inline int CKeyValuesFileCache::GetNumHits() const
+{
+	return m_nHits;
+}
+
+inline int CKeyValuesFileCache::GetNumMisses() const
+{
+	return m_nMisses;
+}
+
+
+#endif // KEYVALUESVIEW_H
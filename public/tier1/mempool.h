@@ -20,15 +20,34 @@
 
 #include "tier0/memalloc.h"
 #include "tier0/platform.h"
+#include "tier0/threadtools.h"
 #include "tier1/utlvector.h"
 #include "tier1/utlrbtree.h"
 
+#define ALIGN_VALUE( val, alignment ) ( ( val + alignment - 1 ) & ~( alignment - 1 ) ) //  need macro for constant expression
+
 //-----------------------------------------------------------------------------
 // Purpose: Optimized pool memory allocator
+//
+//			A thread safe pool puts a small per-thread cache (a magazine of
+//			free blocks) in front of the shared free list, which becomes a
+//			depot guarded by a mutex. Threads only touch the depot to refill
+//			an empty magazine or drain a full one.
 //-----------------------------------------------------------------------------
 
 typedef void (*MemoryPoolReportFunc_t)( char const* pMsg, ... );
 
+struct MemoryPoolStats_t
+{
+	int		m_nAllocs;				// Total allocations over the life of the pool
+	int		m_nFrees;				// Total frees over the life of the pool
+	int		m_nInUse;				// Blocks currently allocated
+	int		m_nPeak;				// High water mark. Thread safe pools measure this at the depot, so it includes cached blocks
+	int		m_nCrossThreadFrees;	// Frees beyond what the freeing thread had allocated (thread safe pools only)
+	int		m_nBlobs;
+	int		m_nBlockSize;
+};
+
 class CMemoryPool
 {
 public:
@@ -41,7 +60,7 @@ public:
 		GROW_SLOW=2			// New blob size is numElements.
 	};
 
-				CMemoryPool(int blockSize, int numElements, int growMode = GROW_FAST, const char *pszAllocOwner = NULL);
+				CMemoryPool(int blockSize, int numElements, int growMode = GROW_FAST, const char *pszAllocOwner = NULL, int nAlignment = 0, bool bThreadSafe = false);
 				~CMemoryPool();
 
 	void*		Alloc();	// Allocate the element size you specified in the constructor.
@@ -50,14 +69,17 @@ public:
 	void*		AllocZero( size_t amount );
 	void		Free(void *pMem);
 	
-	// Frees everything
+	// Frees everything. Not safe against concurrent Alloc/Free, even for thread safe pools.
 	void		Clear();
 
 	// Error reporting... 
 	static void SetErrorReportFunc( MemoryPoolReportFunc_t func );
 
 	// returns number of allocated blocks
-	int Count() { return m_BlocksAllocated; }
+	int Count() { return ( m_pThreadCache ) ? CountThreadSafe() : m_BlocksAllocated; }
+
+	bool IsThreadSafe() const	{ return ( m_pThreadCache != NULL ); }
+	void GetStats( MemoryPoolStats_t &stats );
 
 protected:
 	class CBlob
@@ -68,14 +90,36 @@ protected:
 		char	m_Data[1];
 	};
 
+	// Per-thread magazine for thread safe pools. Padded so the caches of
+	// different threads never share a cache line.
+	struct ThreadCache_t
+	{
+		void *	m_pHeadOfFreeList;
+		int		m_nBlocks;
+		int		m_nAllocs;
+		int		m_nFrees;
+		int		m_nCrossThreadFrees;
+		byte	m_Pad[64 - sizeof(void *) - 4 * sizeof(int)];
+	};
+
+	// First block of a blob, respecting the pool's alignment
+	char		*GetBlobData( CBlob *pBlob ) { return (char *)ALIGN_VALUE( (size_t)pBlob->m_Data, (size_t)m_Alignment ); }
 
 	// Resets the pool
 	void		Init();
 	void		AddNewBlob();
 	void		ReportLeaks();
 
+	// Thread safe path
+	void		*AllocThreadSafe();
+	void		FreeThreadSafe( void *pMem );
+	ThreadCache_t *GetThreadCache();
+	void		FlushThreadCaches();
+	int			CountThreadSafe();
+
 	int			m_BlockSize;
 	int			m_BlocksPerBlob;
+	int			m_Alignment;
 
 	int			m_GrowMode;	// GROW_ enum.
 
@@ -84,9 +128,17 @@ protected:
 	void			*m_pHeadOfFreeList;
 	int				m_BlocksAllocated;
 	int				m_PeakAlloc;
+	int				m_TotalAllocs;
+	int				m_TotalFrees;
 	unsigned short	m_NumBlobs;
 	const char *	m_pszAllocOwner;
 
+	// Thread safe pools only
+	CThreadLocalPtr<ThreadCache_t> *m_pThreadCache;
+	CUtlVector<ThreadCache_t *>		m_ThreadCaches;
+	int								m_nMagazineSize;
+	CThreadFastMutex				m_Mutex;
+
 	static MemoryPoolReportFunc_t g_ReportFunc;
 };
 
@@ -99,8 +151,8 @@ template< class T >
 class CClassMemoryPool : public CMemoryPool
 {
 public:
-	CClassMemoryPool(int numElements, int growMode = GROW_FAST)	:
-		CMemoryPool( sizeof(T), numElements, growMode, MEM_ALLOC_CLASSNAME(T) ) {}
+	CClassMemoryPool(int numElements, int growMode = GROW_FAST, int nAlignment = 0, bool bThreadSafe = false)	:
+		CMemoryPool( sizeof(T), numElements, growMode, MEM_ALLOC_CLASSNAME(T), nAlignment, bThreadSafe ) {}
 
 	T*		Alloc();
 	T*		AllocZero();
@@ -113,9 +165,6 @@ public:
 // Specialized pool for aligned data management (e.g., Xbox cubemaps)
 //-----------------------------------------------------------------------------
 
-#define ALIGN_VALUE( val, alignment ) ( ( val + alignment - 1 ) & ~( alignment - 1 ) ) //  need macro for constant expression
-
-
 template <int ITEM_SIZE, int ALIGNMENT, int CHUNK_SIZE, class CAllocator, int COMPACT_THRESHOLD = 4 >
 class CAlignedMemPool
 {
@@ -212,6 +261,12 @@ inline void CClassMemoryPool<T>::Clear()
 	CUtlRBTree<void *> freeBlocks;
 	SetDefLessFunc( freeBlocks );
 
+	// Cached blocks are free too
+	if ( m_pThreadCache )
+	{
+		FlushThreadCaches();
+	}
+
 	void *pCurFree = m_pHeadOfFreeList;
 	while ( pCurFree != NULL )
 	{
@@ -221,15 +276,15 @@ inline void CClassMemoryPool<T>::Clear()
 
 	for( CBlob *pCur=m_BlobHead.m_pNext; pCur != &m_BlobHead; pCur=pCur->m_pNext )
 	{
-		T *p = (T *)pCur->m_Data;
-		T *pLimit = (T *)(pCur->m_Data + pCur->m_NumBytes);
+		char *p = GetBlobData( pCur );
+		char *pLimit = p + pCur->m_NumBytes;
 		while ( p < pLimit )
 		{
 			if ( freeBlocks.Find( p ) == freeBlocks.InvalidIndex() )
 			{
-				Destruct( p );
+				Destruct( (T *)p );
 			}
-			p++;
+			p += m_BlockSize;
 		}
 	}
 
@@ -254,6 +309,13 @@ inline void CClassMemoryPool<T>::Clear()
 #define DEFINE_FIXEDSIZE_ALLOCATOR( _class, _initsize, _grow )					\
    CMemoryPool   _class::s_Allocator(sizeof(_class), _initsize, _grow, #_class " pool")
 
+// Same as above, but new and delete may be called from any thread
+#define DECLARE_FIXEDSIZE_ALLOCATOR_MT( _class )								\
+	DECLARE_FIXEDSIZE_ALLOCATOR( _class )
+
+#define DEFINE_FIXEDSIZE_ALLOCATOR_MT( _class, _initsize, _grow )				\
+   CMemoryPool   _class::s_Allocator(sizeof(_class), _initsize, _grow, #_class " pool", 0, true)
+
 
 //-----------------------------------------------------------------------------
 // Macros that make it simple to make a class use a fixed-size allocator
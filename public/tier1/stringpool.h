@@ -14,10 +14,13 @@
 
 #include "utlrbtree.h"
 #include "utlvector.h"
+#include "utlstringinterner.h"
 
 //-----------------------------------------------------------------------------
 // Purpose: Allocates memory for strings, checking for duplicates first,
-//			reusing exising strings if duplicate found.
+//			reusing exising strings if duplicate found. Comparisons are
+//			case insensitive. Find and Allocate of an existing string are
+//			lock free and safe to call from any thread.
 //-----------------------------------------------------------------------------
 
 class CStringPool
@@ -35,9 +38,7 @@ public:
 	const char * CStringPool::Find( const char *pszValue );
 
 protected:
-	typedef CUtlRBTree<const char *, unsigned short> CStrSet;
-
-	CStrSet m_Strings;
+	CUtlStringInterner m_Strings;
 };
 
 //-----------------------------------------------------------------------------
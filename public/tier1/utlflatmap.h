@@ -0,0 +1,751 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Open addressing hash map and set. Keys and elements are stored
+//			inline in a single slot array, with a parallel array of one-byte
+//			control values that is probed sixteen slots at a time (with SSE2
+//			where the compiler targets it). Interface follows CUtlMap so call
+//			sites can switch between the two.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef UTLFLATMAP_H
+#define UTLFLATMAP_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include "tier0/dbg.h"
+#include "tier0/platform.h"
+#include "tier0/memalloc.h"
+#include "tier0/commonmacros.h"
+#include "tier1/generichash.h"
+#include "tier1/strtools.h"
+
+#if defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 ) || defined( __SSE2__ )
+#define UTLFLATMAP_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// Default hash and compare functors. Integer, enum and pointer keys are hashed
+// into the full 32 bits; strings are hashed and compared by contents, case
+// sensitively. Other keys need a hash functor of their own: hashing their
+// bytes can disagree with their operator==, through padding or pointers.
+//-----------------------------------------------------------------------------
+inline unsigned FlatHashKey( int n )				{ return HashIntConventional( n ); }
+inline unsigned FlatHashKey( unsigned int n )		{ return HashIntConventional( (int)n ); }
+inline unsigned FlatHashKey( int64 n )				{ return HashIntConventional( (int)( n >> 32 ) ^ (int)HashIntConventional( (int)n ) ); }
+inline unsigned FlatHashKey( uint64 n )				{ return FlatHashKey( (int64)n ); }
+inline unsigned FlatHashKey( long n )				{ return FlatHashKey( (int64)n ); }
+inline unsigned FlatHashKey( unsigned long n )		{ return FlatHashKey( (int64)n ); }
+
+template <typename T>
+inline unsigned FlatHashKey( T *p )					{ return FlatHashKey( (int64)(intp)p ); }
+
+template <typename K>
+class CDefFlatHashFunctor
+{
+public:
+	unsigned operator()( const K &key ) const
+	{
+		// Smaller integers and enums promote to int. Anything else doesn't compile.
+		return FlatHashKey( key );
+	}
+};
+
+template <typename K>
+class CDefFlatEqualFunctor
+{
+public:
+	bool operator()( const K &left, const K &right ) const
+	{
+		return left == right;
+	}
+};
+
+template <>
+class CDefFlatHashFunctor<const char *>
+{
+public:
+	unsigned operator()( const char * const &pszKey ) const	{ return HashStringConventional( pszKey ); }
+};
+
+template <>
+class CDefFlatHashFunctor<char *>
+{
+public:
+	unsigned operator()( char * const &pszKey ) const			{ return HashStringConventional( pszKey ); }
+};
+
+template <>
+class CDefFlatEqualFunctor<const char *>
+{
+public:
+	bool operator()( const char * const &pszLeft, const char * const &pszRight ) const	{ return !Q_strcmp( pszLeft, pszRight ); }
+};
+
+template <>
+class CDefFlatEqualFunctor<char *>
+{
+public:
+	bool operator()( char * const &pszLeft, char * const &pszRight ) const	{ return !Q_strcmp( pszLeft, pszRight ); }
+};
+
+// Case insensitive string keys, for replacing CUtlDict
+class CFlatCaselessStringHashFunctor
+{
+public:
+	unsigned operator()( const char *pszKey ) const			{ return HashStringCaselessConventional( pszKey ); }
+};
+
+class CFlatCaselessStringEqualFunctor
+{
+public:
+	bool operator()( const char *pszLeft, const char *pszRight ) const	{ return !Q_stricmp( pszLeft, pszRight ); }
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: The table shared by CUtlFlatMap and CUtlFlatSet. N is the slot
+//			type and must have a member named key.
+//
+// Slots are grouped sixteen at a time. Each slot has a control byte that is
+// either empty, deleted, or seven bits of a secondary hash of the key.
+// A lookup loads a whole group of control bytes, compares all of them against
+// the secondary hash at once, and only touches the slots that match. Probing
+// moves from group to group until it finds a group with an empty slot.
+//
+// Indices stay valid until the table grows, so unlike CUtlMap an index must
+// not be held across an Insert. Removing elements never moves other elements,
+// so it is safe to remove the current element while iterating.
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+class CUtlFlatHashTable
+{
+public:
+	typedef K KeyType_t;
+	typedef int IndexType_t;
+
+	enum
+	{
+		GROUP_SIZE = 16,
+	};
+
+	CUtlFlatHashTable( int initSize, const H &hashFunc, const E &equalFunc );
+	~CUtlFlatHashTable();
+
+	// Makes sure num elements can be inserted without the table growing
+	void EnsureCapacity( int num );
+
+	KeyType_t &			Key( IndexType_t i )				{ Assert( IsValidIndex( i ) ); return m_pSlots[i].key; }
+	const KeyType_t &	Key( IndexType_t i ) const			{ Assert( IsValidIndex( i ) ); return m_pSlots[i].key; }
+
+	// Num elements
+	unsigned int Count() const								{ return m_nCount; }
+
+	// One past the highest index that can be valid
+	IndexType_t MaxElement() const							{ return m_nSlots; }
+
+	// Checks if a slot is valid and in the table
+	bool IsValidIndex( IndexType_t i ) const				{ return ( i >= 0 ) && ( i < m_nSlots ) && IsFull( m_pControl[i] ); }
+
+	// Invalid index
+	static IndexType_t InvalidIndex()						{ return -1; }
+
+	// Find method
+	IndexType_t Find( const KeyType_t &key ) const			{ return m_nCount ? Find( key, m_Hash( key ) ) : InvalidIndex(); }
+
+	// Remove methods
+	void RemoveAt( IndexType_t i );
+	bool Remove( const KeyType_t &key );
+	void RemoveAll();
+	void Purge();
+
+	// Iteration. The order is unrelated to the order of the keys or of insertion.
+	IndexType_t First() const								{ return NextFull( 0 ); }
+	IndexType_t Next( IndexType_t i ) const					{ return NextFull( i + 1 ); }
+
+	void SetHashFunc( const H &hashFunc )					{ Assert( !m_nCount ); m_Hash = hashFunc; }
+	void SetEqualFunc( const E &equalFunc )					{ m_Equal = equalFunc; }
+
+protected:
+	enum
+	{
+		CTRL_EMPTY = 0x80,
+		CTRL_DELETED = 0xFE,
+	};
+
+	static bool IsFull( uint8 ctrl )						{ return ( ctrl & 0x80 ) == 0; }
+	static uint8 SecondaryHash( unsigned hash )				{ return (uint8)( ( hash * 0x9E3779B1 ) >> 25 ); }
+	static int FirstBit( unsigned mask );
+
+	// Bit i of the result is set when control byte i of the group matches
+	static unsigned MatchByte( const uint8 *pGroup, uint8 ctrl );
+	static unsigned MatchEmpty( const uint8 *pGroup );
+	static unsigned MatchFull( const uint8 *pGroup );
+
+	IndexType_t NextFull( IndexType_t i ) const;
+	IndexType_t Find( const KeyType_t &key, unsigned hash ) const;
+	IndexType_t FindFreeSlot( unsigned hash ) const;
+
+	// Returns the key's slot, or claims a new one for it. A new slot's
+	// contents are left unconstructed; the caller must construct them.
+	IndexType_t FindOrAllocSlot( const KeyType_t &key, bool *pInserted );
+
+	void Rehash( int nSlots );
+
+	uint8 *	m_pControl;
+	N *		m_pSlots;
+	int		m_nSlots;
+	int		m_nCount;
+	int		m_nGrowthLeft;
+	H		m_Hash;
+	E		m_Equal;
+
+private:
+	// Not copyable
+	CUtlFlatHashTable( const CUtlFlatHashTable & );
+	CUtlFlatHashTable &operator=( const CUtlFlatHashTable & );
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: An associative container with unique keys and no ordering.
+//-----------------------------------------------------------------------------
+template <typename K, typename T, typename H = CDefFlatHashFunctor<K>, typename E = CDefFlatEqualFunctor<K> >
+class CUtlFlatMap
+{
+public:
+	struct Node_t
+	{
+		Node_t()
+		{
+		}
+
+		Node_t( const Node_t &from )
+		  : key( from.key ),
+			elem( from.elem )
+		{
+		}
+
+		K	key;
+		T	elem;
+	};
+
+	typedef CUtlFlatHashTable<K, Node_t, H, E> CTable;
+	typedef K KeyType_t;
+	typedef T ElemType_t;
+	typedef int IndexType_t;
+
+	CUtlFlatMap( int initSize = 0, const H &hashFunc = H(), const E &equalFunc = E() )
+	 : m_Table( initSize, hashFunc, equalFunc )
+	{
+	}
+
+	void EnsureCapacity( int num )							{ m_Table.EnsureCapacity( num ); }
+
+	// gets particular elements
+	ElemType_t &		Element( IndexType_t i )			{ return m_Table.Slot( i ).elem; }
+	const ElemType_t &	Element( IndexType_t i ) const		{ return m_Table.Slot( i ).elem; }
+	ElemType_t &		operator[]( IndexType_t i )			{ return m_Table.Slot( i ).elem; }
+	const ElemType_t &	operator[]( IndexType_t i ) const	{ return m_Table.Slot( i ).elem; }
+	KeyType_t &			Key( IndexType_t i )				{ return m_Table.Key( i ); }
+	const KeyType_t &	Key( IndexType_t i ) const			{ return m_Table.Key( i ); }
+
+	unsigned int Count() const								{ return m_Table.Count(); }
+	IndexType_t MaxElement() const							{ return m_Table.MaxElement(); }
+	bool IsValidIndex( IndexType_t i ) const				{ return m_Table.IsValidIndex( i ); }
+	static IndexType_t InvalidIndex()						{ return CTable::InvalidIndex(); }
+
+	// Inserts the key if it isn't already present, and returns its index.
+	// An existing element is left untouched.
+	IndexType_t Insert( const KeyType_t &key, const ElemType_t &insert )
+	{
+		bool bInserted;
+		IndexType_t i = m_Table.FindOrAllocSlot( key, &bInserted );
+		if ( bInserted )
+		{
+			Node_t *pNode = &m_Table.Slot( i );
+			CopyConstruct( &pNode->key, key );
+			CopyConstruct( &pNode->elem, insert );
+		}
+		return i;
+	}
+
+	IndexType_t Insert( const KeyType_t &key )
+	{
+		bool bInserted;
+		IndexType_t i = m_Table.FindOrAllocSlot( key, &bInserted );
+		if ( bInserted )
+		{
+			Node_t *pNode = &m_Table.Slot( i );
+			CopyConstruct( &pNode->key, key );
+			Construct( &pNode->elem );
+		}
+		return i;
+	}
+
+	IndexType_t InsertOrReplace( const KeyType_t &key, const ElemType_t &insert )
+	{
+		bool bInserted;
+		IndexType_t i = m_Table.FindOrAllocSlot( key, &bInserted );
+		if ( bInserted )
+		{
+			Node_t *pNode = &m_Table.Slot( i );
+			CopyConstruct( &pNode->key, key );
+			CopyConstruct( &pNode->elem, insert );
+		}
+		else
+		{
+			Element( i ) = insert;
+		}
+		return i;
+	}
+
+	IndexType_t Find( const KeyType_t &key ) const			{ return m_Table.Find( key ); }
+
+	void RemoveAt( IndexType_t i )							{ m_Table.RemoveAt( i ); }
+	bool Remove( const KeyType_t &key )						{ return m_Table.Remove( key ); }
+	void RemoveAll()										{ m_Table.RemoveAll(); }
+	void Purge()											{ m_Table.Purge(); }
+
+	// Iteration
+	IndexType_t First() const								{ return m_Table.First(); }
+	IndexType_t Next( IndexType_t i ) const					{ return m_Table.Next( i ); }
+
+	CTable *AccessTable()	{ return &m_Table; }
+
+protected:
+	class CAccessTable : public CTable
+	{
+	public:
+		CAccessTable( int initSize, const H &hashFunc, const E &equalFunc ) : CTable( initSize, hashFunc, equalFunc ) {}
+
+		Node_t &Slot( IndexType_t i )						{ Assert( this->IsValidIndex( i ) ); return this->m_pSlots[i]; }
+		const Node_t &Slot( IndexType_t i ) const			{ Assert( this->IsValidIndex( i ) ); return this->m_pSlots[i]; }
+		IndexType_t FindOrAllocSlot( const KeyType_t &key, bool *pInserted )	{ return CTable::FindOrAllocSlot( key, pInserted ); }
+	};
+
+	CAccessTable m_Table;
+};
+
+
+//-----------------------------------------------------------------------------
+// Purpose: A set of unique keys with no ordering.
+//-----------------------------------------------------------------------------
+template <typename K, typename H = CDefFlatHashFunctor<K>, typename E = CDefFlatEqualFunctor<K> >
+class CUtlFlatSet
+{
+public:
+	struct Node_t
+	{
+		K	key;
+	};
+
+	typedef CUtlFlatHashTable<K, Node_t, H, E> CTable;
+	typedef K KeyType_t;
+	typedef int IndexType_t;
+
+	CUtlFlatSet( int initSize = 0, const H &hashFunc = H(), const E &equalFunc = E() )
+	 : m_Table( initSize, hashFunc, equalFunc )
+	{
+	}
+
+	void EnsureCapacity( int num )							{ m_Table.EnsureCapacity( num ); }
+
+	KeyType_t &			Key( IndexType_t i )				{ return m_Table.Key( i ); }
+	const KeyType_t &	Key( IndexType_t i ) const			{ return m_Table.Key( i ); }
+	KeyType_t &			operator[]( IndexType_t i )			{ return m_Table.Key( i ); }
+	const KeyType_t &	operator[]( IndexType_t i ) const	{ return m_Table.Key( i ); }
+
+	unsigned int Count() const								{ return m_Table.Count(); }
+	IndexType_t MaxElement() const							{ return m_Table.MaxElement(); }
+	bool IsValidIndex( IndexType_t i ) const				{ return m_Table.IsValidIndex( i ); }
+	static IndexType_t InvalidIndex()						{ return CTable::InvalidIndex(); }
+
+	// Inserts the key if it isn't already present, and returns its index
+	IndexType_t Insert( const KeyType_t &key )
+	{
+		bool bInserted;
+		IndexType_t i = m_Table.FindOrAllocSlot( key, &bInserted );
+		if ( bInserted )
+		{
+			CopyConstruct( &m_Table.Key( i ), key );
+		}
+		return i;
+	}
+
+	IndexType_t Find( const KeyType_t &key ) const			{ return m_Table.Find( key ); }
+	bool HasElement( const KeyType_t &key ) const			{ return m_Table.Find( key ) != InvalidIndex(); }
+
+	void RemoveAt( IndexType_t i )							{ m_Table.RemoveAt( i ); }
+	bool Remove( const KeyType_t &key )						{ return m_Table.Remove( key ); }
+	void RemoveAll()										{ m_Table.RemoveAll(); }
+	void Purge()											{ m_Table.Purge(); }
+
+	IndexType_t First() const								{ return m_Table.First(); }
+	IndexType_t Next( IndexType_t i ) const					{ return m_Table.Next( i ); }
+
+protected:
+	class CAccessTable : public CTable
+	{
+	public:
+		CAccessTable( int initSize, const H &hashFunc, const E &equalFunc ) : CTable( initSize, hashFunc, equalFunc ) {}
+
+		IndexType_t FindOrAllocSlot( const KeyType_t &key, bool *pInserted )	{ return CTable::FindOrAllocSlot( key, pInserted ); }
+	};
+
+	CAccessTable m_Table;
+};
+
+
+//-----------------------------------------------------------------------------
+// constructor, destructor
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+CUtlFlatHashTable<K, N, H, E>::CUtlFlatHashTable( int initSize, const H &hashFunc, const E &equalFunc )
+ : m_pControl( NULL ), m_pSlots( NULL ), m_nSlots( 0 ), m_nCount( 0 ), m_nGrowthLeft( 0 ),
+   m_Hash( hashFunc ), m_Equal( equalFunc )
+{
+	if ( initSize > 0 )
+	{
+		EnsureCapacity( initSize );
+	}
+}
+
+template <typename K, typename N, typename H, typename E>
+CUtlFlatHashTable<K, N, H, E>::~CUtlFlatHashTable()
+{
+	Purge();
+}
+
+
+//-----------------------------------------------------------------------------
+// Group matching
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+inline int CUtlFlatHashTable<K, N, H, E>::FirstBit( unsigned mask )
+{
+	static const int s_DeBruijnBits[32] =
+	{
+		 0,  1, 28,  2, 29, 14, 24,  3, 30, 22, 20, 15, 25, 17,  4,  8,
+		31, 27, 13, 23, 21, 19, 16,  7, 26, 12, 18,  6, 11,  5, 10,  9
+	};
+
+	Assert( mask );
+	return s_DeBruijnBits[ ( ( mask & ( 0 - mask ) ) * 0x077CB531U ) >> 27 ];
+}
+
+#ifdef UTLFLATMAP_SSE2
+
+template <typename K, typename N, typename H, typename E>
+inline unsigned CUtlFlatHashTable<K, N, H, E>::MatchByte( const uint8 *pGroup, uint8 ctrl )
+{
+	__m128i group = _mm_loadu_si128( (const __m128i *)pGroup );
+	return (unsigned)_mm_movemask_epi8( _mm_cmpeq_epi8( group, _mm_set1_epi8( (char)ctrl ) ) );
+}
+
+template <typename K, typename N, typename H, typename E>
+inline unsigned CUtlFlatHashTable<K, N, H, E>::MatchEmpty( const uint8 *pGroup )
+{
+	return MatchByte( pGroup, CTRL_EMPTY );
+}
+
+template <typename K, typename N, typename H, typename E>
+inline unsigned CUtlFlatHashTable<K, N, H, E>::MatchFull( const uint8 *pGroup )
+{
+	// Full slots are the ones without the high bit set
+	__m128i group = _mm_loadu_si128( (const __m128i *)pGroup );
+	return (unsigned)_mm_movemask_epi8( group ) ^ 0xFFFF;
+}
+
+#else
+
+template <typename K, typename N, typename H, typename E>
+inline unsigned CUtlFlatHashTable<K, N, H, E>::MatchByte( const uint8 *pGroup, uint8 ctrl )
+{
+	unsigned mask = 0;
+	for ( int i = 0; i < GROUP_SIZE; i++ )
+	{
+		mask |= ( pGroup[i] == ctrl ) << i;
+	}
+	return mask;
+}
+
+template <typename K, typename N, typename H, typename E>
+inline unsigned CUtlFlatHashTable<K, N, H, E>::MatchEmpty( const uint8 *pGroup )
+{
+	return MatchByte( pGroup, CTRL_EMPTY );
+}
+
+template <typename K, typename N, typename H, typename E>
+inline unsigned CUtlFlatHashTable<K, N, H, E>::MatchFull( const uint8 *pGroup )
+{
+	unsigned mask = 0;
+	for ( int i = 0; i < GROUP_SIZE; i++ )
+	{
+		mask |= ( ( pGroup[i] & 0x80 ) == 0 ) << i;
+	}
+	return mask;
+}
+
+#endif // UTLFLATMAP_SSE2
+
+
+//-----------------------------------------------------------------------------
+// Find the first used slot at or after i
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+int CUtlFlatHashTable<K, N, H, E>::NextFull( IndexType_t i ) const
+{
+	if ( i >= m_nSlots )
+		return InvalidIndex();
+
+	int iGroup = i & ~( GROUP_SIZE - 1 );
+	unsigned mask = MatchFull( m_pControl + iGroup ) & ( 0xFFFF << ( i - iGroup ) );
+	for ( ;; )
+	{
+		if ( mask )
+			return iGroup + FirstBit( mask );
+
+		iGroup += GROUP_SIZE;
+		if ( iGroup >= m_nSlots )
+			return InvalidIndex();
+
+		mask = MatchFull( m_pControl + iGroup );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Find method
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+int CUtlFlatHashTable<K, N, H, E>::Find( const KeyType_t &key, unsigned hash ) const
+{
+	uint8 ctrl = SecondaryHash( hash );
+	unsigned nGroupMask = ( m_nSlots / GROUP_SIZE ) - 1;
+	unsigned iGroup = hash & nGroupMask;
+
+	// Triangular probing visits every group once when the group count is a
+	// power of two, and the load factor guarantees an empty slot somewhere
+	for ( unsigned nStep = 1; ; nStep++ )
+	{
+		const uint8 *pGroup = m_pControl + iGroup * GROUP_SIZE;
+		unsigned mask = MatchByte( pGroup, ctrl );
+		while ( mask )
+		{
+			int i = iGroup * GROUP_SIZE + FirstBit( mask );
+			if ( m_Equal( m_pSlots[i].key, key ) )
+				return i;
+			mask &= mask - 1;
+		}
+
+		if ( MatchEmpty( pGroup ) )
+			return InvalidIndex();
+
+		iGroup = ( iGroup + nStep ) & nGroupMask;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Finds the first empty or deleted slot along the key's probe sequence
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+int CUtlFlatHashTable<K, N, H, E>::FindFreeSlot( unsigned hash ) const
+{
+	unsigned nGroupMask = ( m_nSlots / GROUP_SIZE ) - 1;
+	unsigned iGroup = hash & nGroupMask;
+
+	for ( unsigned nStep = 1; ; nStep++ )
+	{
+		unsigned mask = MatchFull( m_pControl + iGroup * GROUP_SIZE ) ^ 0xFFFF;
+		if ( mask )
+			return iGroup * GROUP_SIZE + FirstBit( mask );
+
+		iGroup = ( iGroup + nStep ) & nGroupMask;
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Finds the key, or claims a slot for it
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+int CUtlFlatHashTable<K, N, H, E>::FindOrAllocSlot( const KeyType_t &key, bool *pInserted )
+{
+	unsigned hash = m_Hash( key );
+	if ( m_nCount )
+	{
+		int i = Find( key, hash );
+		if ( i != InvalidIndex() )
+		{
+			*pInserted = false;
+			return i;
+		}
+	}
+
+	if ( !m_nGrowthLeft )
+	{
+		// If most of the used slots are tombstones, clean them out in place
+		// rather than doubling
+		if ( m_nSlots && m_nCount * 32 <= m_nSlots * 25 / 2 )
+		{
+			Rehash( m_nSlots );
+		}
+		else
+		{
+			Rehash( m_nSlots ? m_nSlots * 2 : GROUP_SIZE );
+		}
+	}
+
+	int i = FindFreeSlot( hash );
+	if ( m_pControl[i] == CTRL_EMPTY )
+	{
+		--m_nGrowthLeft;
+	}
+	m_pControl[i] = SecondaryHash( hash );
+	++m_nCount;
+	*pInserted = true;
+	return i;
+}
+
+
+//-----------------------------------------------------------------------------
+// Makes sure num elements can be inserted without the table growing
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+void CUtlFlatHashTable<K, N, H, E>::EnsureCapacity( int num )
+{
+	// Tables are kept at most 7/8 full
+	int nSlots = GROUP_SIZE;
+	while ( nSlots - nSlots / 8 < num )
+	{
+		nSlots *= 2;
+	}
+
+	if ( nSlots > m_nSlots )
+	{
+		Rehash( nSlots );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Moves every element into a freshly allocated table of the given size
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+void CUtlFlatHashTable<K, N, H, E>::Rehash( int nSlots )
+{
+	Assert( IsPowerOfTwo( nSlots ) && nSlots >= GROUP_SIZE );
+	Assert( nSlots - nSlots / 8 >= m_nCount );
+
+	uint8 *pOldControl = m_pControl;
+	N *pOldSlots = m_pSlots;
+	int nOldSlots = m_nSlots;
+
+	MEM_ALLOC_CREDIT_CLASS();
+	m_pControl = (uint8 *)malloc( nSlots );
+	m_pSlots = (N *)malloc( nSlots * sizeof(N) );
+	m_nSlots = nSlots;
+	m_nGrowthLeft = nSlots - nSlots / 8 - m_nCount;
+	memset( m_pControl, CTRL_EMPTY, nSlots );
+
+	for ( int i = 0; i < nOldSlots; i++ )
+	{
+		if ( !IsFull( pOldControl[i] ) )
+			continue;
+
+		unsigned hash = m_Hash( pOldSlots[i].key );
+		int iNew = FindFreeSlot( hash );
+		m_pControl[iNew] = SecondaryHash( hash );
+		CopyConstruct( &m_pSlots[iNew], pOldSlots[i] );
+		Destruct( &pOldSlots[i] );
+	}
+
+	if ( pOldControl )
+	{
+		free( pOldControl );
+		free( pOldSlots );
+	}
+}
+
+
+//-----------------------------------------------------------------------------
+// Remove methods
+//-----------------------------------------------------------------------------
+template <typename K, typename N, typename H, typename E>
+void CUtlFlatHashTable<K, N, H, E>::RemoveAt( IndexType_t i )
+{
+	Assert( IsValidIndex( i ) );
+
+	Destruct( &m_pSlots[i] );
+	--m_nCount;
+
+	// If the group already has an empty slot, no probe sequence continues past
+	// it, so the slot can go straight back to empty instead of becoming a
+	// tombstone
+	if ( MatchEmpty( m_pControl + ( i & ~( GROUP_SIZE - 1 ) ) ) )
+	{
+		m_pControl[i] = CTRL_EMPTY;
+		++m_nGrowthLeft;
+	}
+	else
+	{
+		m_pControl[i] = CTRL_DELETED;
+	}
+}
+
+template <typename K, typename N, typename H, typename E>
+bool CUtlFlatHashTable<K, N, H, E>::Remove( const KeyType_t &key )
+{
+	IndexType_t i = Find( key );
+	if ( i == InvalidIndex() )
+		return false;
+
+	RemoveAt( i );
+	return true;
+}
+
+template <typename K, typename N, typename H, typename E>
+void CUtlFlatHashTable<K, N, H, E>::RemoveAll()
+{
+	for ( IndexType_t i = First(); i != InvalidIndex(); i = Next( i ) )
+	{
+		Destruct( &m_pSlots[i] );
+	}
+
+	if ( m_nSlots )
+	{
+		memset( m_pControl, CTRL_EMPTY, m_nSlots );
+	}
+	m_nCount = 0;
+	m_nGrowthLeft = m_nSlots - m_nSlots / 8;
+}
+
+template <typename K, typename N, typename H, typename E>
+void CUtlFlatHashTable<K, N, H, E>::Purge()
+{
+	RemoveAll();
+
+	if ( m_pControl )
+	{
+		free( m_pControl );
+		free( m_pSlots );
+	}
+	m_pControl = NULL;
+	m_pSlots = NULL;
+	m_nSlots = 0;
+	m_nGrowthLeft = 0;
+}
+
+#include "tier0/memdbgoff.h"
+
+#endif // UTLFLATMAP_H
@@ -0,0 +1,139 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Thread safe string interner. Maps strings to dense 32 bit handles
+//			and back. Lookups of strings that are already interned never
+//			take a lock; inserts lock one of several shards.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#ifndef UTLSTRINGINTERNER_H
+#define UTLSTRINGINTERNER_H
+
+#ifdef _WIN32
+#pragma once
+#endif
+
+#include "tier0/threadtools.h"
+#include "tier1/utlvector.h"
+
+//-----------------------------------------------------------------------------
+// Handles are assigned sequentially from zero, so they can be used to index
+// side tables. They stay valid until RemoveAll().
+//-----------------------------------------------------------------------------
+typedef unsigned int UtlInternHandle_t;
+
+#define UTL_INVAL_INTERN_HANDLE ((UtlInternHandle_t)~0)
+
+
+//-----------------------------------------------------------------------------
+// CUtlStringInterner:
+// description:
+//    Strings are distributed across shards by hash. Each shard has its own
+//    lock, string storage and open addressing table of string pointers.
+//    Readers load the shard's current table and probe it without locking;
+//    writers fill in the string and its handle before publishing the table
+//    slot, and tables that are outgrown are retired rather than freed so a
+//    concurrent reader never sees freed memory. Retired tables are released
+//    by RemoveAll() or the destructor.
+//
+//    String data never moves, so the pointers returned by String() and
+//    Intern() remain valid until RemoveAll().
+//-----------------------------------------------------------------------------
+class CUtlStringInterner
+{
+public:
+	CUtlStringInterner( bool bCaseInsensitive = false );
+	~CUtlStringInterner();
+
+	// Finds and/or creates a handle for the string. Returns UTL_INVAL_INTERN_HANDLE
+	// if the string is new and the interner is full.
+	UtlInternHandle_t AddString( const char *pString );
+
+	// Finds the handle for the string, or UTL_INVAL_INTERN_HANDLE. Never locks.
+	UtlInternHandle_t Find( const char *pString ) const;
+
+	// Look up the string for a handle. Never locks. Returns NULL for an invalid handle.
+	const char *String( UtlInternHandle_t handle ) const;
+
+	// Returns the pooled copy of a string, adding it if necessary. NULL if it's full.
+	const char *Intern( const char *pString );
+
+	// Returns the pooled copy of a string, or NULL if it has not been added
+	const char *FindString( const char *pString ) const;
+
+	// Number of strings. Handles below this have been handed out.
+	int GetNumStrings() const								{ return m_nStrings; }
+
+	bool IsCaseInsensitive() const							{ return m_bCaseInsensitive; }
+
+	// Frees all strings. Not safe to call while other threads use the interner.
+	void RemoveAll();
+
+private:
+	enum
+	{
+		NUM_SHARDS = 16,
+		SHARD_SHIFT = 28,			// Top 4 bits of the hash pick the shard
+
+		PAGE_SHIFT = 12,
+		PAGE_SIZE = ( 1 << PAGE_SHIFT ),
+		MAX_PAGES = 1024,			// 4M strings
+
+		MIN_TABLE_SIZE = 16,
+		MIN_CHUNK_SIZE = 1024,
+		MAX_CHUNK_SIZE = 64 * 1024,
+	};
+
+	// Precedes every string in the string storage
+	struct StringHeader_t
+	{
+		unsigned			m_nHash;
+		UtlInternHandle_t	m_Handle;
+	};
+
+	struct Table_t
+	{
+		Table_t *			m_pRetired;		// Next older table of the shard
+		int					m_nMask;
+		const char * volatile m_pSlots[1];	// Actually m_nMask + 1 slots
+	};
+
+	struct Shard_t
+	{
+		Shard_t();
+
+		CThreadFastMutex	m_Mutex;
+		Table_t * volatile	m_pTable;
+		int					m_nCount;
+		char *				m_pChunk;
+		int					m_nChunkLeft;
+		CUtlVector<char *>	m_Chunks;
+
+		// Keep shards written by different threads off each other's cache lines
+		byte				m_Pad[64];
+	};
+
+	unsigned HashString( const char *pString ) const;
+	bool StringsEqual( const char *pLeft, const char *pRight ) const;
+
+	const char *FindInShard( const Shard_t &shard, const char *pString, unsigned nHash ) const;
+	const char *AddToShard( Shard_t &shard, const char *pString, unsigned nHash );
+
+	char *AllocString( Shard_t &shard, int nBytes );
+	void GrowTable( Shard_t &shard );
+	void SetHandleString( UtlInternHandle_t handle, const char *pString );
+
+	static const StringHeader_t *Header( const char *pString )	{ return (const StringHeader_t *)pString - 1; }
+
+	Shard_t						m_Shards[NUM_SHARDS];
+	const char ** volatile		m_pPages[MAX_PAGES];
+	CInterlockedInt				m_nStrings;
+	bool						m_bCaseInsensitive;
+
+	// Not copyable
+	CUtlStringInterner( const CUtlStringInterner & );
+	CUtlStringInterner &operator=( const CUtlStringInterner & );
+};
+
+#endif // UTLSTRINGINTERNER_H
@@ -12,6 +12,7 @@
 #include "tier0/threadtools.h"
 #include "tier1/utlrbtree.h"
 #include "tier1/utlvector.h"
+#include "tier1/utlstringinterner.h"
 
 //-----------------------------------------------------------------------------
 // forward declarations
@@ -174,40 +175,71 @@ private:
 		
 };
 
-class CUtlSymbolTableMT : private CUtlSymbolTable
+//-----------------------------------------------------------------------------
+// CUtlSymbolTableMT:
+// description:
+//    Thread safe symbol table backed by CUtlStringInterner, so Find and String
+//    never lock and AddString only locks when the string is new. Symbol ids
+//    are the interner's handles, which must stay below UTL_INVAL_SYMBOL to
+//    fit in a CUtlSymbol. CUtlSymbol is shared with prebuilt binaries and
+//    can't be widened, so a table that outgrows it is a fatal error; use the
+//    interner directly for larger tables.
+//-----------------------------------------------------------------------------
+class CUtlSymbolTableMT
 {
 public:
 	CUtlSymbolTableMT( int growSize = 0, int initSize = 32, bool caseInsensitive = false )
-		: CUtlSymbolTable( growSize, initSize, caseInsensitive )
+		: m_Interner( caseInsensitive )
 	{
 	}
 
 	CUtlSymbol AddString( char const* pString )
 	{
-		m_mutex.Lock();
-		CUtlSymbol result = CUtlSymbolTable::AddString( pString );
-		m_mutex.Unlock();
-		return result;
+		return ToSymbol( m_Interner.AddString( pString ) );
 	}
 
-	CUtlSymbol Find( char const* pString )
+	CUtlSymbol Find( char const* pString ) const
 	{
-		m_mutex.Lock();
-		CUtlSymbol result = CUtlSymbolTable::Find( pString );
-		m_mutex.Unlock();
-		return result;
+		return ToSymbol( m_Interner.Find( pString ) );
 	}
 
 	char const* String( CUtlSymbol id ) const
 	{
-		m_mutex.Lock();
-		const char *pszResult = CUtlSymbolTable::String( id );
-		m_mutex.Unlock();
-		return pszResult;
+		if ( !id.IsValid() )
+			return "";
+		return m_Interner.String( (UtlSymId_t)id );
+	}
+
+	void RemoveAll()
+	{
+		m_Interner.RemoveAll();
+	}
+
+	int GetNumStrings( void ) const
+	{
+		return m_Interner.GetNumStrings();
+	}
+
+	CUtlStringInterner *GetInterner()
+	{
+		return &m_Interner;
 	}
 
 private:
-	CThreadMutex m_mutex;
+	static CUtlSymbol ToSymbol( UtlInternHandle_t handle )
+	{
+		if ( handle == UTL_INVAL_INTERN_HANDLE )
+			return CUtlSymbol();
+
+		if ( handle >= UTL_INVAL_SYMBOL )
+		{
+			Error( "CUtlSymbolTableMT overflow!\n" );
+			return CUtlSymbol();
+		}
+		return CUtlSymbol( (UtlSymId_t)handle );
+	}
+
+	CUtlStringInterner m_Interner;
 };
 
 
@@ -232,6 +264,7 @@ class CUtlFilenameSymbolTable
 	// Internal representation of a FileHandle_t
 	//  If we get more than 64K filenames, we'll have to revisit...
 	// Right now CUtlSymbol is a short, so this packs into an int/void * pointer size...
+	// Both parts are stored as symbol + 1 so that a valid handle is never NULL.
 	struct FileNameHandleInternal_t
 	{
 		FileNameHandleInternal_t()
@@ -250,6 +283,11 @@ class CUtlFilenameSymbolTable
 	CUtlSymbolTableMT	m_FileNames;
 
 public:
+	// File names match whatever their case, as they do on Windows
+	CUtlFilenameSymbolTable() : m_FileNames( 0, 32, true )
+	{
+	}
+
 	FileNameHandle_t	FindOrAddFileName( char const *pFileName );
 	FileNameHandle_t	FindFileName( char const *pFileName );
 	int					PathIndex(const FileNameHandle_t &handle) { return (( const FileNameHandleInternal_t * )&handle)->path; }
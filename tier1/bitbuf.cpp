@@ -72,6 +72,208 @@ public:
 CBitWriteMasksInit g_BitWriteMasksInit;
 
 
+// ---------------------------------------------------------------------------------------- //
+// Coordinate and normal encoding, shared by the buffers and the accumulators. Each value is
+// packed into one field with the flags, sign, integer and fraction in the same order (lowest
+// bits first) as writing them one at a time, so the stream format is unchanged.
+// ---------------------------------------------------------------------------------------- //
+
+template< class WRITER >
+static inline void WriteBitCoordField( WRITER &writer, const float f )
+{
+	int		signbit = (f <= -COORD_RESOLUTION);
+	int		intval = (int)abs(f);
+	int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
+
+	// The flags that indicate whether we have an integer part and/or a fraction part.
+	unsigned int bits = ( intval ? 1 : 0 ) | ( fractval ? 2 : 0 );
+	int numbits = 2;
+
+	if ( intval || fractval )
+	{
+		bits |= signbit << numbits;
+		numbits++;
+
+		if ( intval )
+		{
+			// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
+			bits |= ( (unsigned int)( intval - 1 ) & g_ExtraMasks[COORD_INTEGER_BITS] ) << numbits;
+			numbits += COORD_INTEGER_BITS;
+		}
+
+		if ( fractval )
+		{
+			bits |= (unsigned int)fractval << numbits;
+			numbits += COORD_FRACTIONAL_BITS;
+		}
+	}
+
+	writer.WriteUBitLong( bits, numbits );
+}
+
+template< class READER >
+static inline float ReadBitCoordField( READER &reader )
+{
+	// Read the required integer and fraction flags
+	unsigned int flags = reader.ReadUBitLong( 2 );
+
+	// If we got either parse them, otherwise it's a zero.
+	if ( !flags )
+		return 0.0f;
+
+	// The sign, integer and fraction come in as one field
+	int numbits = 1;
+	if ( flags & 1 )
+		numbits += COORD_INTEGER_BITS;
+	if ( flags & 2 )
+		numbits += COORD_FRACTIONAL_BITS;
+
+	unsigned int bits = reader.ReadUBitLong( numbits );
+	int signbit = bits & 1;
+	bits >>= 1;
+
+	int intval = 0;
+	if ( flags & 1 )
+	{
+		// Adjust the integers from [0..MAX_COORD_VALUE-1] to [1..MAX_COORD_VALUE]
+		intval = ( bits & g_ExtraMasks[COORD_INTEGER_BITS] ) + 1;
+		bits >>= COORD_INTEGER_BITS;
+	}
+
+	int fractval = ( flags & 2 ) ? bits : 0;
+
+	// Calculate the correct floating point value
+	float value = intval + ((float)fractval * COORD_RESOLUTION);
+
+	// Fixup the sign if negative.
+	if ( signbit )
+		value = -value;
+
+	return value;
+}
+
+template< class WRITER >
+static inline void WriteBitNormalField( WRITER &writer, float f )
+{
+	int	signbit = (f <= -NORMAL_RESOLUTION);
+
+	// NOTE: Since +/-1 are valid values for a normal, I'm going to encode that as all ones
+	unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
+
+	// clamp..
+	if (fractval > NORMAL_DENOMINATOR)
+		fractval = NORMAL_DENOMINATOR;
+
+	// Sign bit, then the fractional component
+	writer.WriteUBitLong( signbit | ( fractval << 1 ), 1 + NORMAL_FRACTIONAL_BITS );
+}
+
+template< class READER >
+static inline float ReadBitNormalField( READER &reader )
+{
+	unsigned int bits = reader.ReadUBitLong( 1 + NORMAL_FRACTIONAL_BITS );
+
+	// Calculate the correct floating point value
+	float value = (float)( bits >> 1 ) * NORMAL_RESOLUTION;
+
+	// Fixup the sign if negative.
+	if ( bits & 1 )
+		value = -value;
+
+	return value;
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// CBitWriteAccumulator
+// ---------------------------------------------------------------------------------------- //
+
+CBitWriteAccumulator::CBitWriteAccumulator( bf_write &buf ) : m_Buf( buf )
+{
+	int iCurBit = buf.m_iCurBit;
+	m_pDWord = (unsigned int *)buf.m_pData + ( iCurBit >> 5 );
+	m_nAccumBits = iCurBit & 31;
+	m_nBitsLeft = buf.m_nDataBits - iCurBit;
+	m_bOverflow = false;
+
+	// Carry the bits already in the current dword, so it can be stored whole
+	m_nAccum = ( m_nAccumBits ) ? ( *m_pDWord & g_ExtraMasks[m_nAccumBits] ) : 0;
+}
+
+void CBitWriteAccumulator::Overflow()
+{
+	m_bOverflow = true;
+	m_nBitsLeft = 0;
+	m_Buf.SetOverflowFlag();
+	CallErrorHandler( BITBUFERROR_BUFFER_OVERRUN, m_Buf.GetDebugName() );
+}
+
+void CBitWriteAccumulator::Flush()
+{
+	// Merge the partial dword, keeping whatever is above it
+	if ( m_nAccumBits )
+	{
+		*m_pDWord = ( *m_pDWord & ~g_ExtraMasks[m_nAccumBits] ) | (unsigned int)m_nAccum;
+	}
+
+	m_Buf.m_iCurBit = ( m_bOverflow ) ? m_Buf.m_nDataBits : GetNumBitsWritten();
+}
+
+void CBitWriteAccumulator::WriteBitCoord( const float f )
+{
+	WriteBitCoordField( *this, f );
+}
+
+void CBitWriteAccumulator::WriteBitNormal( float f )
+{
+	WriteBitNormalField( *this, f );
+}
+
+
+// ---------------------------------------------------------------------------------------- //
+// CBitReadAccumulator
+// ---------------------------------------------------------------------------------------- //
+
+CBitReadAccumulator::CBitReadAccumulator( bf_read &buf ) : m_Buf( buf )
+{
+	m_iCurBit = buf.m_iCurBit;
+	m_pNextDWord = (const unsigned int *)buf.m_pData + ( m_iCurBit >> 5 );
+	m_nAccum = 0;
+	m_nAccumBits = 0;
+	m_bOverflow = false;
+
+	// Start partway into the current dword
+	int nSkip = m_iCurBit & 31;
+	if ( nSkip )
+	{
+		m_nAccum = *m_pNextDWord++ >> nSkip;
+		m_nAccumBits = 32 - nSkip;
+	}
+}
+
+void CBitReadAccumulator::Overflow()
+{
+	m_bOverflow = true;
+	m_iCurBit = m_Buf.m_nDataBits;
+	m_Buf.SetOverflowFlag();
+}
+
+void CBitReadAccumulator::Flush()
+{
+	m_Buf.m_iCurBit = m_iCurBit;
+}
+
+float CBitReadAccumulator::ReadBitCoord()
+{
+	return ReadBitCoordField( *this );
+}
+
+float CBitReadAccumulator::ReadBitNormal()
+{
+	return ReadBitNormalField( *this );
+}
+
+
 // ---------------------------------------------------------------------------------------- //
 // bf_write
 // ---------------------------------------------------------------------------------------- //
@@ -160,8 +362,9 @@ void bf_write::WriteSBitLong( int data, int numbits )
 	// Do we have a valid # of bits to encode with?
 	Assert( numbits >= 1 );
 
-	// Note: it does this wierdness here so it's bit-compatible with regular integer data in the buffer.
-	// (Some old code writes direct integers right into the buffer).
+	// The sign bit sits just above the value, so both go out as one field
+	unsigned int nSignBit = 1u << (numbits - 1);
+
 	if(data < 0)
 	{
 #ifdef _DEBUG
@@ -179,15 +382,17 @@ void bf_write::WriteSBitLong( int data, int numbits )
 		}
 	}
 #endif
-
-		WriteUBitLong( (unsigned int)(0x80000000 + data), numbits - 1, false );
-		WriteOneBit( 1 );
 	}
-	else
+#ifdef _DEBUG
+	else if( (unsigned int)data >= nSignBit )
 	{
-		WriteUBitLong((unsigned int)data, numbits - 1);
-		WriteOneBit( 0 );
+		CallErrorHandler( BITBUFERROR_VALUE_OUT_OF_RANGE, GetDebugName() );
 	}
+#endif
+
+	// Note: it does this wierdness here so it's bit-compatible with regular integer data in the buffer.
+	// (Some old code writes direct integers right into the buffer).
+	WriteUBitLong( ((unsigned int)data & (nSignBit - 1)) | ((data < 0) ? nSignBit : 0), numbits, false );
 }
 
 // writes an unsigned integer with variable bit length
@@ -269,12 +474,16 @@ bool bf_write::WriteBits(const void *pInData, int nBits)
 		m_iCurBit += numbits;
 	}
 
-	// Read dwords.
-	while(nBitsLeft >= 32)
+	// Shift whole dwords in through the accumulator.
+	if(nBitsLeft >= 32)
 	{
-		WriteUBitLong( *((unsigned long*)pOut), 32, false );
-		pOut += sizeof(unsigned long);
-		nBitsLeft -= 32;
+		CBitWriteAccumulator writer( *this );
+		while(nBitsLeft >= 32)
+		{
+			writer.WriteUBitLong( *((unsigned long*)pOut), 32 );
+			pOut += sizeof(unsigned long);
+			nBitsLeft -= 32;
+		}
 	}
 
 	// Read the remaining bytes.
@@ -297,14 +506,28 @@ bool bf_write::WriteBits(const void *pInData, int nBits)
 
 bool bf_write::WriteBitsFromBuffer( bf_read *pIn, int nBits )
 {
-	// This could be optimized a little by
+	// If both sides are byte aligned, copy the whole bytes straight across
+	if ( nBits >= 32 && (m_iCurBit & 7) == 0 && (pIn->m_iCurBit & 7) == 0 &&
+		 (m_iCurBit+nBits) <= m_nDataBits && (pIn->m_iCurBit+nBits) <= pIn->m_nDataBits )
+	{
+		int numbytes = nBits >> 3;
+		Q_memcpy( m_pData+(m_iCurBit>>3), pIn->m_pData+(pIn->m_iCurBit>>3), numbytes );
+		m_iCurBit += numbytes << 3;
+		pIn->m_iCurBit += numbytes << 3;
+		nBits -= numbytes << 3;
+	}
+
+	CBitReadAccumulator reader( *pIn );
+	CBitWriteAccumulator writer( *this );
 	while ( nBits > 32 )
 	{
-		WriteUBitLong( pIn->ReadUBitLong( 32 ), 32 );
+		writer.WriteUBitLong( reader.ReadUBitLong( 32 ), 32 );
 		nBits -= 32;
 	}
 
-	WriteUBitLong( pIn->ReadUBitLong( nBits ), nBits );
+	writer.WriteUBitLong( reader.ReadUBitLong( nBits ), nBits );
+	writer.Flush();
+	reader.Flush();
 	return !IsOverflowed() && !pIn->IsOverflowed();
 }
 
@@ -329,34 +552,7 @@ void bf_write::WriteBitCoord (const float f)
 #if defined( BB_PROFILING )
 	VPROF( "bf_write::WriteBitCoord" );
 #endif
-	int		signbit = (f <= -COORD_RESOLUTION);
-	int		intval = (int)abs(f);
-	int		fractval = abs((int)(f*COORD_DENOMINATOR)) & (COORD_DENOMINATOR-1);
-
-
-	// Send the bit flags that indicate whether we have an integer part and/or a fraction part.
-	WriteOneBit( intval );
-	WriteOneBit( fractval );
-
-	if ( intval || fractval )
-	{
-		// Send the sign bit
-		WriteOneBit( signbit );
-
-		// Send the integer if we have one.
-		if ( intval )
-		{
-			// Adjust the integers from [1..MAX_COORD_VALUE] to [0..MAX_COORD_VALUE-1]
-			intval--;
-			WriteUBitLong( (unsigned int)intval, COORD_INTEGER_BITS );
-		}
-		
-		// Send the fraction if we have one
-		if ( fractval )
-		{
-			WriteUBitLong( (unsigned int)fractval, COORD_FRACTIONAL_BITS );
-		}
-	}
+	WriteBitCoordField( *this, f );
 }
 
 void bf_write::WriteBitFloat(float val)
@@ -378,34 +574,20 @@ void bf_write::WriteBitVec3Coord( const Vector& fa )
 	yflag = (fa[1] >= COORD_RESOLUTION) || (fa[1] <= -COORD_RESOLUTION);
 	zflag = (fa[2] >= COORD_RESOLUTION) || (fa[2] <= -COORD_RESOLUTION);
 
-	WriteOneBit( xflag );
-	WriteOneBit( yflag );
-	WriteOneBit( zflag );
+	CBitWriteAccumulator writer( *this );
+	writer.WriteUBitLong( xflag | (yflag << 1) | (zflag << 2), 3 );
 
 	if ( xflag )
-		WriteBitCoord( fa[0] );
+		writer.WriteBitCoord( fa[0] );
 	if ( yflag )
-		WriteBitCoord( fa[1] );
+		writer.WriteBitCoord( fa[1] );
 	if ( zflag )
-		WriteBitCoord( fa[2] );
+		writer.WriteBitCoord( fa[2] );
 }
 
 void bf_write::WriteBitNormal( float f )
 {
-	int	signbit = (f <= -NORMAL_RESOLUTION);
-
-	// NOTE: Since +/-1 are valid values for a normal, I'm going to encode that as all ones
-	unsigned int fractval = abs( (int)(f*NORMAL_DENOMINATOR) );
-
-	// clamp..
-	if (fractval > NORMAL_DENOMINATOR)
-		fractval = NORMAL_DENOMINATOR;
-
-	// Send the sign bit
-	WriteOneBit( signbit );
-
-	// Send the fractional component
-	WriteUBitLong( fractval, NORMAL_FRACTIONAL_BITS );
+	WriteBitNormalField( *this, f );
 }
 
 void bf_write::WriteBitVec3Normal( const Vector& fa )
@@ -415,17 +597,17 @@ void bf_write::WriteBitVec3Normal( const Vector& fa )
 	xflag = (fa[0] >= NORMAL_RESOLUTION) || (fa[0] <= -NORMAL_RESOLUTION);
 	yflag = (fa[1] >= NORMAL_RESOLUTION) || (fa[1] <= -NORMAL_RESOLUTION);
 
-	WriteOneBit( xflag );
-	WriteOneBit( yflag );
+	CBitWriteAccumulator writer( *this );
+	writer.WriteUBitLong( xflag | (yflag << 1), 2 );
 
 	if ( xflag )
-		WriteBitNormal( fa[0] );
+		writer.WriteBitNormal( fa[0] );
 	if ( yflag )
-		WriteBitNormal( fa[1] );
+		writer.WriteBitNormal( fa[1] );
 	
 	// Write z sign bit
 	int	signbit = (fa[2] <= -NORMAL_RESOLUTION);
-	WriteOneBit( signbit );
+	writer.WriteOneBit( signbit );
 }
 
 void bf_write::WriteBitAngles( const QAngle& fa )
@@ -584,6 +766,17 @@ bool bf_read::ReadBits(void *pOutData, int nBits)
 	unsigned char *pOut = (unsigned char*)pOutData;
 	int nBitsLeft = nBits;
 
+	// check if we can use fast memcpy if m_iCurBit is byte aligned
+	if ( (nBitsLeft >= 32) && (m_iCurBit & 7) == 0 && (m_iCurBit+nBits) <= m_nDataBits )
+	{
+		int numbytes = (nBitsLeft >> 3);
+		int numbits = numbytes << 3;
+
+		Q_memcpy( pOut, m_pData+(m_iCurBit>>3), numbytes );
+		pOut += numbytes;
+		nBitsLeft -= numbits;
+		m_iCurBit += numbits;
+	}
 	
 	// Get output dword-aligned.
 	while(((unsigned long)pOut & 3) != 0 && nBitsLeft >= 8)
@@ -593,12 +786,16 @@ bool bf_read::ReadBits(void *pOutData, int nBits)
 		nBitsLeft -= 8;
 	}
 
-	// Read dwords.
-	while(nBitsLeft >= 32)
+	// Shift whole dwords out through the accumulator.
+	if(nBitsLeft >= 32)
 	{
-		*((unsigned long*)pOut) = ReadUBitLong(32);
-		pOut += sizeof(unsigned long);
-		nBitsLeft -= 32;
+		CBitReadAccumulator reader( *this );
+		while(nBitsLeft >= 32)
+		{
+			*((unsigned long*)pOut) = reader.ReadUBitLong(32);
+			pOut += sizeof(unsigned long);
+			nBitsLeft -= 32;
+		}
 	}
 
 	// Read the remaining bytes.
@@ -668,17 +865,16 @@ unsigned int bf_read::PeekUBitLong( int numbits )
 // Append numbits least significant bits from data to the current bit stream
 int bf_read::ReadSBitLong( int numbits )
 {
-	int r, sign;
-
-	r = ReadUBitLong(numbits - 1);
+	// The value and the sign bit above it are read as one field.
+	unsigned int r = ReadUBitLong(numbits);
+	unsigned int nSignBit = 1u << (numbits - 1);
 
 	// Note: it does this wierdness here so it's bit-compatible with regular integer data in the buffer.
 	// (Some old code writes direct integers right into the buffer).
-	sign = ReadOneBit();
-	if(sign)
-		r = -((1 << (numbits-1)) - r);
+	if(r & nSignBit)
+		return (int)((r & (nSignBit - 1)) - nSignBit);
 
-	return r;
+	return (int)r;
 }
 
 unsigned int bf_read::ReadUBitVar()
@@ -714,42 +910,7 @@ float bf_read::ReadBitCoord (void)
 #if defined( BB_PROFILING )
 	VPROF( "bf_write::ReadBitCoord" );
 #endif
-	int		intval=0,fractval=0,signbit=0;
-	float	value = 0.0;
-
-
-	// Read the required integer and fraction flags
-	intval = ReadOneBit();
-	fractval = ReadOneBit();
-
-	// If we got either parse them, otherwise it's a zero.
-	if ( intval || fractval )
-	{
-		// Read the sign bit
-		signbit = ReadOneBit();
-
-		// If there's an integer, read it in
-		if ( intval )
-		{
-			// Adjust the integers from [0..MAX_COORD_VALUE-1] to [1..MAX_COORD_VALUE]
-			intval = ReadUBitLong( COORD_INTEGER_BITS ) + 1;
-		}
-
-		// If there's a fraction, read it in
-		if ( fractval )
-		{
-			fractval = ReadUBitLong( COORD_FRACTIONAL_BITS );
-		}
-
-		// Calculate the correct floating point value
-		value = intval + ((float)fractval * COORD_RESOLUTION);
-
-		// Fixup the sign if negative.
-		if ( signbit )
-			value = -value;
-	}
-
-	return value;
+	return ReadBitCoordField( *this );
 }
 
 void bf_read::ReadBitVec3Coord( Vector& fa )
@@ -760,53 +921,45 @@ void bf_read::ReadBitVec3Coord( Vector& fa )
 	// the corresponding component will not be read and will be stack garbage.
 	fa.Init( 0, 0, 0 );
 
-	xflag = ReadOneBit();
-	yflag = ReadOneBit(); 
-	zflag = ReadOneBit();
+	CBitReadAccumulator reader( *this );
+	int flags = reader.ReadUBitLong( 3 );
+	xflag = flags & 1;
+	yflag = flags & 2; 
+	zflag = flags & 4;
 
 	if ( xflag )
-		fa[0] = ReadBitCoord();
+		fa[0] = reader.ReadBitCoord();
 	if ( yflag )
-		fa[1] = ReadBitCoord();
+		fa[1] = reader.ReadBitCoord();
 	if ( zflag )
-		fa[2] = ReadBitCoord();
+		fa[2] = reader.ReadBitCoord();
 }
 
 float bf_read::ReadBitNormal (void)
 {
-	// Read the sign bit
-	int	signbit = ReadOneBit();
-
-	// Read the fractional part
-	unsigned int fractval = ReadUBitLong( NORMAL_FRACTIONAL_BITS );
-
-	// Calculate the correct floating point value
-	float value = (float)fractval * NORMAL_RESOLUTION;
-
-	// Fixup the sign if negative.
-	if ( signbit )
-		value = -value;
-
-	return value;
+	return ReadBitNormalField( *this );
 }
 
 void bf_read::ReadBitVec3Normal( Vector& fa )
 {
-	int xflag = ReadOneBit();
-	int yflag = ReadOneBit(); 
+	CBitReadAccumulator reader( *this );
+	int flags = reader.ReadUBitLong( 2 );
+	int xflag = flags & 1;
+	int yflag = flags & 2; 
 
 	if (xflag)
-		fa[0] = ReadBitNormal();
+		fa[0] = reader.ReadBitNormal();
 	else
 		fa[0] = 0.0f;
 
 	if (yflag)
-		fa[1] = ReadBitNormal();
+		fa[1] = reader.ReadBitNormal();
 	else
 		fa[1] = 0.0f;
 
 	// The first two imply the third (but not its sign)
-	int znegative = ReadOneBit();
+	int znegative = reader.ReadOneBit();
+	reader.Flush();
 
 	float fafafbfb = fa[0] * fa[0] + fa[1] * fa[1];
 	if (fafafbfb < 1.0f)
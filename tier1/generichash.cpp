@@ -132,6 +132,21 @@ unsigned HashStringCaselessConventional( const char *pszKey )
 	return hash;
 }
 
+//-----------------------------------------------------------------------------
+// 32 bit conventional case-sensitive string 
+//-----------------------------------------------------------------------------
+unsigned HashStringConventional( const char *pszKey )
+{
+	unsigned hash = 0xAAAAAAAA; // Alternating 1's and 0's to maximize the effect of the later multiply and add
+
+	for( ; *pszKey ; pszKey++ )
+	{
+		hash = ( ( hash << 5 ) + hash ) + (uint8)*pszKey;
+	}
+
+	return hash;
+}
+
 //-----------------------------------------------------------------------------
 // Case-insensitive string 
 //-----------------------------------------------------------------------------
@@ -17,6 +17,7 @@
 
 #include "tier0/dbg.h"
 #include "tier1/jobthread.h"
+#include "minmax.h" // max()
 
 #include "tier1/utlvector.h"
 
@@ -584,6 +585,366 @@ int CAsyncJobFuliller::Run()
 	return 0;
 }
 
+//-----------------------------------------------------------------------------
+//
+// CAsyncJobPool
+//
+//-----------------------------------------------------------------------------
+
+CAsyncJobPool::CAsyncJobPool()
+  :	m_bExit( false )
+{
+}
+
+//---------------------------------------------------------
+
+CAsyncJobPool::~CAsyncJobPool()
+{
+	Stop();
+}
+
+//---------------------------------------------------------
+
+bool CAsyncJobPool::Start( int nThreads, unsigned nBytesStack )
+{
+	if ( IsRunning() )
+	{
+		AssertMsg( 0, "Job pool already started" );
+		return false;
+	}
+
+	if ( nThreads <= 0 )
+	{
+		nThreads = max( 1, GetCPUInformation().m_nLogicalProcessors - 1 );
+	}
+
+	m_bExit = false;
+	m_JobSignal.Reset();
+
+	// Create all the worker records before any thread runs, so stealing
+	// never sees a partially built list
+	int i;
+	for ( i = 0; i < nThreads; i++ )
+	{
+		Worker_t *pWorker = new Worker_t;
+		pWorker->m_pOwner = this;
+		pWorker->m_iWorker = i;
+		m_Workers.AddToTail( pWorker );
+	}
+
+	for ( i = 0; i < nThreads; i++ )
+	{
+		m_Workers[i]->m_hThread = CreateSimpleThread( WorkerThreadFunc, m_Workers[i], nBytesStack );
+		if ( !m_Workers[i]->m_hThread )
+		{
+			Warning( "CAsyncJobPool: failed to create worker thread %d\n", i );
+			m_Workers[i]->m_Exited.Set();
+		}
+	}
+
+	return true;
+}
+
+//---------------------------------------------------------
+
+void CAsyncJobPool::Stop()
+{
+	if ( !IsRunning() )
+	{
+		return;
+	}
+
+	// Let the workers drain what is already queued, then release them
+	WaitForIdle();
+
+	m_bExit = true;
+	m_JobSignal.Set();
+
+	int i;
+	for ( i = 0; i < m_Workers.Count(); i++ )
+	{
+		m_Workers[i]->m_Exited.Wait();
+	}
+
+	for ( i = 0; i < m_Workers.Count(); i++ )
+	{
+		delete m_Workers[i];
+	}
+	m_Workers.RemoveAll();
+}
+
+//---------------------------------------------------------
+// Add a job, holding it back until its dependencies finish
+//---------------------------------------------------------
+
+void CAsyncJobPool::AddJob( CAsyncJob *pJob, CAsyncJob **ppDependencies, int nDependencies )
+{
+	if ( !pJob )
+	{
+		return;
+	}
+
+	if ( !IsRunning() )
+	{
+		for ( int i = 0; i < nDependencies; i++ )
+		{
+			AssertMsg( ppDependencies[i]->IsFinished(), "Job dependency was never executed" );
+		}
+		pJob->Execute();
+		return;
+	}
+
+	pJob->AddRef();
+	++m_nOutstanding;
+
+	pJob->m_pPool = this;
+	pJob->m_status = ASYNC_STATUS_PENDING;
+	pJob->m_bDependentsReleased = false;
+
+	// Hold one count for ourselves so the job can't be queued while we are
+	// still walking the dependency list
+	pJob->m_nDependencies = 1;
+
+	for ( int i = 0; i < nDependencies; i++ )
+	{
+		CAsyncJob *pDependency = ppDependencies[i];
+		if ( !pDependency || pDependency == pJob )
+		{
+			continue;
+		}
+
+		AssertMsg( pDependency->m_pPool == this || pDependency->IsFinished(), "Job dependency not scheduled in this pool" );
+
+		AUTO_LOCK( m_DependencyMutex );
+		if ( !pDependency->m_bDependentsReleased && pDependency->m_pPool == this )
+		{
+			pJob->AddRef();
+			++pJob->m_nDependencies;
+			pDependency->m_Dependents.AddToTail( pJob );
+		}
+	}
+
+	if ( --pJob->m_nDependencies == 0 )
+	{
+		QueueReadyJob( pJob );
+	}
+}
+
+//---------------------------------------------------------
+// Push a job whose dependencies are satisfied. Jobs spawned
+// from a worker stay on that worker, others are dealt out
+// round robin.
+//---------------------------------------------------------
+
+void CAsyncJobPool::QueueReadyJob( CAsyncJob *pJob )
+{
+	Worker_t *pWorker = m_pCurrentWorker;
+	if ( !pWorker || pWorker->m_pOwner != this )
+	{
+		unsigned iWorker = (unsigned)( m_iNextWorker++ );
+		pWorker = m_Workers[iWorker % m_Workers.Count()];
+	}
+
+	pWorker->m_mutex.Lock();
+	pWorker->m_queue[pJob->GetPriority()].AddToTail( pJob );
+	pWorker->m_mutex.Unlock();
+
+	++m_nQueued;
+
+	if ( m_nIdle > 0 )
+	{
+		m_JobSignal.Set();
+	}
+}
+
+//---------------------------------------------------------
+// Highest priority first. Within a priority, a worker takes
+// the newest job from its own deque, then steals the oldest
+// job from the others.
+//---------------------------------------------------------
+
+CAsyncJob *CAsyncJobPool::GetJob( Worker_t *pWorker )
+{
+	if ( m_nQueued <= 0 )
+	{
+		return NULL;
+	}
+
+	int nWorkers = m_Workers.Count();
+	int iFirst = ( pWorker ) ? pWorker->m_iWorker : (unsigned)m_iNextWorker % nWorkers;
+
+	for ( int iPriority = AJP_HIGH; iPriority >= AJP_LOW; iPriority-- )
+	{
+		for ( int i = 0; i < nWorkers; i++ )
+		{
+			Worker_t *pVictim = m_Workers[( iFirst + i ) % nWorkers];
+			CUtlLinkedList<CAsyncJob *> &queue = pVictim->m_queue[iPriority];
+
+			if ( !queue.Count() )
+			{
+				continue;
+			}
+
+			CAsyncJob *pJob = NULL;
+
+			pVictim->m_mutex.Lock();
+			if ( queue.Count() )
+			{
+				unsigned iJob = ( pVictim == pWorker ) ? queue.Tail() : queue.Head();
+				pJob = queue[iJob];
+				queue.Remove( iJob );
+			}
+			pVictim->m_mutex.Unlock();
+
+			if ( pJob )
+			{
+				--m_nQueued;
+				return pJob;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+//---------------------------------------------------------
+
+void CAsyncJobPool::ExecuteJob( CAsyncJob *pJob )
+{
+	// Execute() is a no-op if someone else already ran or aborted the job
+	pJob->Execute();
+	ReleaseDependents( pJob );
+	pJob->Release();
+	--m_nOutstanding;
+}
+
+//---------------------------------------------------------
+
+void CAsyncJobPool::ReleaseDependents( CAsyncJob *pJob )
+{
+	CUtlVector<CAsyncJob *> dependents;
+
+	m_DependencyMutex.Lock();
+	pJob->m_bDependentsReleased = true;
+	pJob->m_pPool = NULL;
+	dependents.AddVectorToTail( pJob->m_Dependents );
+	pJob->m_Dependents.RemoveAll();
+	m_DependencyMutex.Unlock();
+
+	for ( int i = 0; i < dependents.Count(); i++ )
+	{
+		CAsyncJob *pDependent = dependents[i];
+		if ( --pDependent->m_nDependencies == 0 )
+		{
+			QueueReadyJob( pDependent );
+		}
+		pDependent->Release();
+	}
+}
+
+//---------------------------------------------------------
+
+bool CAsyncJobPool::ExecuteOne()
+{
+	CAsyncJob *pJob = ( IsRunning() ) ? GetJob( m_pCurrentWorker ) : NULL;
+	if ( !pJob )
+	{
+		return false;
+	}
+
+	ExecuteJob( pJob );
+	return true;
+}
+
+//---------------------------------------------------------
+
+void CAsyncJobPool::WaitForJob( CAsyncJob *pJob )
+{
+	while ( !pJob->IsFinished() )
+	{
+		if ( !ExecuteOne() )
+		{
+			ThreadPause();
+			ThreadSleep( 0 );
+		}
+	}
+}
+
+//---------------------------------------------------------
+
+void CAsyncJobPool::WaitForIdle()
+{
+	while ( m_nOutstanding > 0 )
+	{
+		if ( !ExecuteOne() )
+		{
+			ThreadPause();
+			ThreadSleep( 0 );
+		}
+	}
+}
+
+//---------------------------------------------------------
+
+int CAsyncJobPool::AbortAll()
+{
+	int nAborted = 0;
+	CAsyncJob *pJob;
+
+	while ( IsRunning() && ( pJob = GetJob( NULL ) ) != NULL )
+	{
+		// Dependents still get released, they see an aborted parent
+		pJob->Abort();
+		ReleaseDependents( pJob );
+		pJob->Release();
+		--m_nOutstanding;
+		nAborted++;
+	}
+
+	return nAborted;
+}
+
+//---------------------------------------------------------
+// Worker thread functions
+//---------------------------------------------------------
+
+unsigned CAsyncJobPool::WorkerThreadFunc( void *pParam )
+{
+	Worker_t *pWorker = (Worker_t *)pParam;
+	pWorker->m_pOwner->WorkerLoop( pWorker );
+	pWorker->m_Exited.Set();
+	return 0;
+}
+
+//---------------------------------------------------------
+
+void CAsyncJobPool::WorkerLoop( Worker_t *pWorker )
+{
+	m_pCurrentWorker = pWorker;
+
+	while ( !m_bExit )
+	{
+		CAsyncJob *pJob = GetJob( pWorker );
+		if ( pJob )
+		{
+			ExecuteJob( pJob );
+			continue;
+		}
+
+		// Announce idleness before re-checking the queue, so a producer
+		// either sees us idle and signals, or we see its job
+		++m_nIdle;
+		m_JobSignal.Reset();
+		if ( m_nQueued <= 0 && !m_bExit )
+		{
+			m_JobSignal.Wait();
+		}
+		--m_nIdle;
+	}
+
+	m_pCurrentWorker = (Worker_t *)NULL;
+}
+
 //-----------------------------------------------------------------------------
 //
 // CAsyncJob
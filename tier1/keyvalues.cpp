@@ -20,6 +20,8 @@
 #include <KeyValues.h>
 #include "filesystem.h"
 #include <vstdlib/IKeyValuesSystem.h>
+#include "keyvaluesview.h"
+#include "keyvaluesarena.h"
 
 #include <Color.h>
 #include <stdlib.h>
@@ -311,6 +313,16 @@ KeyValues::~KeyValues()
 //-----------------------------------------------------------------------------
 void KeyValues::RemoveEverything()
 {
+	// Everything an arena key points at is in the arena too
+	if ( GetArena() )
+	{
+		m_pSub = NULL;
+		m_pPeer = NULL;
+		m_sValue = NULL;
+		m_wsValue = NULL;
+		return;
+	}
+
 	KeyValues *dat;
 	KeyValues *datNext = NULL;
 	for ( dat = m_pSub; dat != NULL; dat = datNext )
@@ -468,6 +480,29 @@ bool KeyValues::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceN
 	Assert(filesystem);
 	Assert( IsXbox() || ( IsPC() && _heapchk() == _HEAPOK ) );
 
+	// The cache only covers loads into an empty key, which is all a compiled
+	// tree can stand in for
+	CKeyValuesFileCache *pCache = KeyValuesFileCache();
+	bool bUseCache = pCache->IsEnabled() && !m_pSub && !m_pPeer && m_iDataType == TYPE_NONE;
+	unsigned int nSourceSize = 0;
+	long nSourceTime = 0;
+	if ( bUseCache )
+	{
+		nSourceTime = filesystem->GetFileTime( resourceName, pathID );
+		nSourceSize = filesystem->Size( resourceName, pathID );
+		bUseCache = ( nSourceTime != 0 );
+	}
+
+	if ( bUseCache )
+	{
+		CKeyValuesView view = pCache->Find( resourceName, pathID, m_bHasEscapeSequences != 0, nSourceSize, nSourceTime );
+		if ( view.IsValid() )
+		{
+			s_LastFileLoadingFrom = (char*)resourceName;
+			return LoadFromView( view );
+		}
+	}
+
 	FileHandle_t f = filesystem->Open(resourceName, "rb", pathID);
 	if (!f)
 		return false;
@@ -488,8 +523,15 @@ bool KeyValues::LoadFromFile( IBaseFileSystem *filesystem, const char *resourceN
 
 	filesystem->Close( f );	// close file after reading
 
+	bool bEscapeSequences = m_bHasEscapeSequences != 0;
 	bool retOK = LoadFromBuffer( resourceName, buffer, filesystem );
 
+	// An #include pulls in other files, which the cache can't check for changes
+	if ( retOK && bUseCache && (unsigned int)fileSize == nSourceSize && !Q_stristr( buffer, "#include" ) )
+	{
+		pCache->Add( resourceName, pathID, bEscapeSequences, nSourceSize, nSourceTime, this );
+	}
+
 	((IFileSystem *)filesystem)->FreeOptimalReadBuffer( buffer );
 
 	return retOK;
@@ -765,7 +807,7 @@ KeyValues *KeyValues::FindKey(const char *keyName, bool bCreate)
 		if (bCreate)
 		{
 			// we need to create a new key
-			dat = new KeyValues( searchStr );
+			dat = NewKey( searchStr );
 //			Assert(dat != NULL);
 
 			// insert new key at end of list
@@ -832,7 +874,7 @@ KeyValues *KeyValues::CreateNewKey()
 KeyValues* KeyValues::CreateKey( const char *keyName )
 {
 	// key wasn't found so just create a new one
-	KeyValues* dat = new KeyValues( keyName );
+	KeyValues* dat = NewKey( keyName );
 
 	dat->UsesEscapeSequences( m_bHasEscapeSequences != 0 ); // use same format as parent does
 	
@@ -843,6 +885,64 @@ KeyValues* KeyValues::CreateKey( const char *keyName )
 }
 
 
+//-----------------------------------------------------------------------------
+// Allocates a key from the same place as this one
+//-----------------------------------------------------------------------------
+KeyValues *KeyValues::NewKey( const char *keyName )
+{
+	CKeyValuesArena *pArena = GetArena();
+	if ( pArena )
+		return pArena->CreateKeyValues( keyName );
+
+	return new KeyValues( keyName );
+}
+
+
+//-----------------------------------------------------------------------------
+// Arena keys have a flag in reserved[0] and a pointer to the arena just before them
+//-----------------------------------------------------------------------------
+CKeyValuesArena *KeyValues::GetArena() const
+{
+	if ( !reserved[0] )
+		return NULL;
+
+	return *(CKeyValuesArena **)( (unsigned char *)this - KEYVALUES_ARENA_HEADER_SIZE );
+}
+
+
+//-----------------------------------------------------------------------------
+// Value strings come from the heap or this key's arena
+//-----------------------------------------------------------------------------
+char *KeyValues::AllocateValueBlock( int size )
+{
+	CKeyValuesArena *pArena = GetArena();
+	if ( pArena )
+		return (char *)pArena->Alloc( size );
+
+	return new char[size];
+}
+
+wchar_t *KeyValues::AllocateWValueBlock( int nChars )
+{
+	CKeyValuesArena *pArena = GetArena();
+	if ( pArena )
+		return (wchar_t *)pArena->Alloc( nChars * sizeof( wchar_t ) );
+
+	return new wchar_t[nChars];
+}
+
+void KeyValues::FreeAllocatedValue()
+{
+	if ( !GetArena() )
+	{
+		delete [] m_sValue;
+		delete [] m_wsValue;
+	}
+	m_sValue = NULL;
+	m_wsValue = NULL;
+}
+
+
 //-----------------------------------------------------------------------------
 // Adds a subkey. Make sure the subkey isn't a child of some other keyvalues
 //-----------------------------------------------------------------------------
@@ -851,6 +951,9 @@ void KeyValues::AddSubKey( KeyValues *pSubkey )
 	// Make sure the subkey isn't a child of some other keyvalues
 	Assert( pSubkey->m_pPeer == NULL );
 
+	// Heap and arena keys can't share a tree
+	Assert( pSubkey->GetArena() == GetArena() );
+
 	// add into subkey list
 	if ( m_pSub == NULL )
 	{
@@ -925,6 +1028,7 @@ KeyValues *KeyValues::GetNextKey()
 //-----------------------------------------------------------------------------
 void KeyValues::SetNextKey( KeyValues *pDat )
 {
+	Assert( !pDat || pDat->GetArena() == GetArena() );
 	m_pPeer = pDat;
 }
 
@@ -1254,11 +1358,8 @@ void KeyValues::SetColor( const char *keyName, Color value)
 
 void KeyValues::SetStringValue( char const *strValue )
 {
-	// delete the old value
-	delete [] m_sValue;
-	// make sure we're not storing the WSTRING  - as we're converting over to STRING
-	delete [] m_wsValue;
-	m_wsValue = NULL;
+	// delete the old value, and make sure we're not storing the WSTRING - as we're converting over to STRING
+	FreeAllocatedValue();
 
 	if (!strValue)
 	{
@@ -1268,7 +1369,7 @@ void KeyValues::SetStringValue( char const *strValue )
 
 	// allocate memory for the new value and copy it in
 	int len = Q_strlen( strValue );
-	m_sValue = new char[len + 1];
+	m_sValue = AllocateValueBlock( len + 1 );
 	Q_memcpy( m_sValue, strValue, len+1 );
 
 	m_iDataType = TYPE_STRING;
@@ -1283,11 +1384,8 @@ void KeyValues::SetString( const char *keyName, const char *value )
 
 	if ( dat )
 	{
-		// delete the old value
-		delete [] dat->m_sValue;
-		// make sure we're not storing the WSTRING  - as we're converting over to STRING
-		delete [] dat->m_wsValue;
-		dat->m_wsValue = NULL;
+		// delete the old value, and make sure we're not storing the WSTRING - as we're converting over to STRING
+		dat->FreeAllocatedValue();
 
 		if (!value)
 		{
@@ -1297,7 +1395,7 @@ void KeyValues::SetString( const char *keyName, const char *value )
 
 		// allocate memory for the new value and copy it in
 		int len = Q_strlen( value );
-		dat->m_sValue = new char[len + 1];
+		dat->m_sValue = dat->AllocateValueBlock( len + 1 );
 		Q_memcpy( dat->m_sValue, value, len+1 );
 
 		dat->m_iDataType = TYPE_STRING;
@@ -1312,11 +1410,8 @@ void KeyValues::SetWString( const char *keyName, const wchar_t *value )
 	KeyValues *dat = FindKey( keyName, true );
 	if ( dat )
 	{
-		// delete the old value
-		delete [] dat->m_wsValue;
-		// make sure we're not storing the STRING  - as we're converting over to WSTRING
-		delete [] dat->m_sValue;
-		dat->m_sValue = NULL;
+		// delete the old value, and make sure we're not storing the STRING - as we're converting over to WSTRING
+		dat->FreeAllocatedValue();
 
 		if (!value)
 		{
@@ -1326,7 +1421,7 @@ void KeyValues::SetWString( const char *keyName, const wchar_t *value )
 
 		// allocate memory for the new value and copy it in
 		int len = wcslen( value );
-		dat->m_wsValue = new wchar_t[len + 1];
+		dat->m_wsValue = dat->AllocateWValueBlock( len + 1 );
 		Q_memcpy( dat->m_wsValue, value, (len+1) * sizeof(wchar_t) );
 
 		dat->m_iDataType = TYPE_WSTRING;
@@ -1356,13 +1451,10 @@ void KeyValues::SetUint64( const char *keyName, uint64 value )
 
 	if ( dat )
 	{
-		// delete the old value
-		delete [] dat->m_sValue;
-		// make sure we're not storing the WSTRING  - as we're converting over to STRING
-		delete [] dat->m_wsValue;
-		dat->m_wsValue = NULL;
+		// delete the old value, and make sure we're not storing the WSTRING - as we're converting over to STRING
+		dat->FreeAllocatedValue();
 
-		dat->m_sValue = new char[sizeof(uint64)];
+		dat->m_sValue = dat->AllocateValueBlock( sizeof(uint64) );
 		*((uint64 *)dat->m_sValue) = value;
 		dat->m_iDataType = TYPE_UINT64;
 	}
@@ -1419,7 +1511,7 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 			if( src.m_sValue )
 			{
 				int len = Q_strlen(src.m_sValue) + 1;
-				m_sValue = new char[len];
+				m_sValue = AllocateValueBlock( len );
 				Q_strncpy( m_sValue, src.m_sValue, len );
 			}
 			break;
@@ -1428,7 +1520,7 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 				m_iValue = src.m_iValue;
 				Q_snprintf( buf,sizeof(buf), "%d", m_iValue );
 				int len = Q_strlen(buf) + 1;
-				m_sValue = new char[len];
+				m_sValue = AllocateValueBlock( len );
 				Q_strncpy( m_sValue, buf, len  );
 			}
 			break;
@@ -1437,7 +1529,7 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 				m_flValue = src.m_flValue;
 				Q_snprintf( buf,sizeof(buf), "%f", m_flValue );
 				int len = Q_strlen(buf) + 1;
-				m_sValue = new char[len];
+				m_sValue = AllocateValueBlock( len );
 				Q_strncpy( m_sValue, buf, len );
 			}
 			break;
@@ -1448,7 +1540,7 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 			break;
 		case TYPE_UINT64:
 			{
-				m_sValue = new char[sizeof(uint64)];
+				m_sValue = AllocateValueBlock( sizeof(uint64) );
 				Q_memcpy( m_sValue, src.m_sValue, sizeof(uint64) );
 			}
 			break;
@@ -1493,22 +1585,24 @@ void KeyValues::RecursiveCopyKeyValues( KeyValues& src )
 	// Handle the immediate child
 	if( src.m_pSub )
 	{
-		m_pSub = new KeyValues( NULL );
+		m_pSub = NewKey( NULL );
 		m_pSub->RecursiveCopyKeyValues( *src.m_pSub );
 	}
 
 	// Handle the immediate peer
 	if( src.m_pPeer )
 	{
-		m_pPeer = new KeyValues( NULL );
+		m_pPeer = NewKey( NULL );
 		m_pPeer->RecursiveCopyKeyValues( *src.m_pPeer );
 	}
 }
 
 KeyValues& KeyValues::operator=( KeyValues& src )
 {
+	char bArena = reserved[0];
 	RemoveEverything();
 	Init();	// reset all values
+	reserved[0] = bArena;
 	RecursiveCopyKeyValues( src );
 	return *this;
 }
@@ -1524,8 +1618,8 @@ void KeyValues::CopySubkeys( KeyValues *pParent ) const
 	KeyValues *pPrev = NULL;
 	for ( KeyValues *sub = m_pSub; sub != NULL; sub = sub->m_pPeer )
 	{
-		// take a copy of the subkey
-		KeyValues *dat = sub->MakeCopy();
+		// take a copy of the subkey, from wherever the parent was allocated
+		KeyValues *dat = sub->MakeCopy( pParent->GetArena() );
 		 
 		// add into subkey list
 		if (pPrev)
@@ -1547,7 +1641,15 @@ void KeyValues::CopySubkeys( KeyValues *pParent ) const
 //-----------------------------------------------------------------------------
 KeyValues *KeyValues::MakeCopy( void ) const
 {
-	KeyValues *newKeyValue = new KeyValues(GetName());
+	return MakeCopy( NULL );
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Makes a copy in pArena, or on the heap if pArena is NULL
+//-----------------------------------------------------------------------------
+KeyValues *KeyValues::MakeCopy( CKeyValuesArena *pArena ) const
+{
+	KeyValues *newKeyValue = pArena ? pArena->CreateKeyValues( GetName() ) : new KeyValues( GetName() );
 
 	// copy data
 	newKeyValue->m_iDataType = m_iDataType;
@@ -1559,7 +1661,7 @@ KeyValues *KeyValues::MakeCopy( void ) const
 			{
 				int len = Q_strlen( m_sValue );
 				Assert( !newKeyValue->m_sValue );
-				newKeyValue->m_sValue = new char[len + 1];
+				newKeyValue->m_sValue = newKeyValue->AllocateValueBlock( len + 1 );
 				Q_memcpy( newKeyValue->m_sValue, m_sValue, len+1 );
 			}
 		}
@@ -1569,7 +1671,7 @@ KeyValues *KeyValues::MakeCopy( void ) const
 			if ( m_wsValue )
 			{
 				int len = wcslen( m_wsValue );
-				newKeyValue->m_wsValue = new wchar_t[len+1];
+				newKeyValue->m_wsValue = newKeyValue->AllocateWValueBlock( len+1 );
 				Q_memcpy( newKeyValue->m_wsValue, m_wsValue, (len+1)*sizeof(wchar_t));
 			}
 		}
@@ -1595,7 +1697,7 @@ KeyValues *KeyValues::MakeCopy( void ) const
 		break;
 
 	case TYPE_UINT64:
-		newKeyValue->m_sValue = new char[sizeof(uint64)];
+		newKeyValue->m_sValue = newKeyValue->AllocateValueBlock( sizeof(uint64) );
 		Q_memcpy( newKeyValue->m_sValue, m_sValue, sizeof(uint64) );
 		break;
 	};
@@ -1626,7 +1728,10 @@ bool KeyValues::IsEmpty(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::Clear( void )
 {
-	delete m_pSub;
+	if ( !GetArena() )
+	{
+		delete m_pSub;
+	}
 	m_pSub = NULL;
 	m_iDataType = TYPE_NONE;
 }
@@ -1648,6 +1753,9 @@ KeyValues::types_t KeyValues::GetDataType(const char *keyName)
 //-----------------------------------------------------------------------------
 void KeyValues::deleteThis()
 {
+	if ( GetArena() )
+		return;
+
 	delete this;
 }
 
@@ -1716,7 +1824,7 @@ void KeyValues::ParseIncludedKeys( char const *resourceName, const char *filetoi
 	// Append included file
 	Q_strncat( fullpath, filetoinclude, sizeof( fullpath ), COPY_ALL_CHARACTERS );
 
-	KeyValues *newKV = new KeyValues( fullpath );
+	KeyValues *newKV = NewKey( fullpath );
 
 	// CUtlSymbol save = s_CurrentFileSymbol;	// did that had any use ???
 
@@ -1772,7 +1880,7 @@ bool KeyValues::LoadFromBuffer( char const *resourceName, CUtlBuffer &buf, IBase
 
 		if ( !pCurrentKey )
 		{
-			pCurrentKey = new KeyValues( s );
+			pCurrentKey = NewKey( s );
 			Assert( pCurrentKey );
 
 			pCurrentKey->UsesEscapeSequences( m_bHasEscapeSequences != 0 ); // same format has parent use
@@ -1884,11 +1992,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 		}
 		else 
 		{
-			if (dat->m_sValue)
-			{
-				delete[] dat->m_sValue;
-				dat->m_sValue = NULL;
-			}
+			dat->FreeAllocatedValue();
 
 			int len = Q_strlen( value );
 
@@ -1922,7 +2026,7 @@ void KeyValues::RecursiveLoadFromBuffer( char const *resourceName, CUtlBuffer &b
 			if (dat->m_iDataType == TYPE_STRING)
 			{
 				// copy in the string information
-				dat->m_sValue = new char[len+1];
+				dat->m_sValue = dat->AllocateValueBlock( len+1 );
 				Q_memcpy( dat->m_sValue, value, len+1 );
 			}
 		}
@@ -2027,8 +2131,10 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer )
 	if ( !buffer.IsValid() ) // must be valid, no overflows etc
 		return false;
 
+	char bArena = reserved[0];
 	RemoveEverything(); // remove current content
 	Init();	// reset
+	reserved[0] = bArena;
 	
 	char		token[KEYVALUES_TOKEN_SIZE];
 	KeyValues	*dat = this;
@@ -2051,7 +2157,7 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer )
 		{
 		case TYPE_NONE:
 			{
-				dat->m_pSub = new KeyValues("");
+				dat->m_pSub = dat->NewKey("");
 				dat->m_pSub->ReadAsBinary( buffer );
 				break;
 			}
@@ -2061,7 +2167,7 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer )
 				token[KEYVALUES_TOKEN_SIZE-1] = 0;
 
 				int len = Q_strlen( token );
-				dat->m_sValue = new char[len + 1];
+				dat->m_sValue = dat->AllocateValueBlock( len + 1 );
 				Q_memcpy( dat->m_sValue, token, len+1 );
 								
 				break;
@@ -2080,7 +2186,7 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer )
 
 		case TYPE_UINT64:
 			{
-				dat->m_sValue = new char[sizeof(uint64)];
+				dat->m_sValue = dat->AllocateValueBlock( sizeof(uint64) );
 				*((double *)dat->m_sValue) = buffer.GetDouble();
 			}
 
@@ -2115,13 +2221,203 @@ bool KeyValues::ReadAsBinary( CUtlBuffer &buffer )
 			break;
 
 		// new peer follows
-		dat->m_pPeer = new KeyValues("");
+		dat->m_pPeer = dat->NewKey("");
 		dat = dat->m_pPeer;
 	}
 
 	return buffer.IsValid();
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Writes this key and its peers as a compiled tree (see keyvaluesview.h)
+//-----------------------------------------------------------------------------
+bool KeyValues::WriteAsCompiled( CUtlBuffer &buffer )
+{
+	if ( buffer.IsText() ) // must be a binary buffer
+		return false;
+
+	CUtlVector< KVCompiledNode_t > nodes;
+	CKVCompiledStrings strings;
+	if ( RecursiveWriteCompiled( nodes, strings ) != 0 )
+		return false;
+
+	KVCompiledHeader_t header;
+	header.m_nId = KVCOMPILED_ID;
+	header.m_nVersion = KVCOMPILED_VERSION;
+	header.m_nNodes = nodes.Count();
+	header.m_nStringBytes = strings.GetSize();
+
+	buffer.Put( &header, sizeof( header ) );
+	buffer.Put( nodes.Base(), nodes.Count() * sizeof( KVCompiledNode_t ) );
+	buffer.Put( strings.Base(), strings.GetSize() );
+	return buffer.IsValid();
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Appends this key and its peers to nodes in preorder. Returns the
+//			index of this key, or -1 if a value can't be compiled.
+//-----------------------------------------------------------------------------
+int KeyValues::RecursiveWriteCompiled( CUtlVector< KVCompiledNode_t > &nodes, CKVCompiledStrings &strings )
+{
+	int iFirst = nodes.Count();
+	int iPrev = KVCOMPILED_NO_NODE;
+	for ( KeyValues *dat = this; dat != NULL; dat = dat->m_pPeer )
+	{
+		KVCompiledNode_t node;
+		memset( &node, 0, sizeof( node ) );
+		node.m_nName = strings.AddString( dat->GetName() );
+		node.m_iFirstChild = KVCOMPILED_NO_NODE;
+		node.m_iNextPeer = KVCOMPILED_NO_NODE;
+		node.m_Type = dat->m_iDataType;
+		node.m_bEscapeSequences = dat->m_bHasEscapeSequences;
+
+		// Numbers keep the text GetString() would make for them
+		char buf[64];
+		switch ( dat->m_iDataType )
+		{
+		case TYPE_NONE:
+			node.m_nString = strings.AddString( "" );
+			break;
+		case TYPE_STRING:
+			node.m_nString = strings.AddString( dat->m_sValue ? dat->m_sValue : "" );
+			break;
+		case TYPE_INT:
+			node.m_iValue = dat->m_iValue;
+			Q_snprintf( buf, sizeof( buf ), "%d", dat->m_iValue );
+			node.m_nString = strings.AddString( buf );
+			break;
+		case TYPE_FLOAT:
+			node.m_flValue = dat->m_flValue;
+			Q_snprintf( buf, sizeof( buf ), "%f", dat->m_flValue );
+			node.m_nString = strings.AddString( buf );
+			break;
+		case TYPE_COLOR:
+			memcpy( node.m_Color, dat->m_Color, sizeof( node.m_Color ) );
+			node.m_nString = strings.AddString( "" );
+			break;
+		default:
+			return -1;
+		}
+
+		int iNode = nodes.AddToTail( node );
+		if ( iPrev != KVCOMPILED_NO_NODE )
+		{
+			nodes[iPrev].m_iNextPeer = iNode;
+		}
+		iPrev = iNode;
+
+		if ( dat->m_iDataType == TYPE_NONE && dat->m_pSub )
+		{
+			int iChild = dat->m_pSub->RecursiveWriteCompiled( nodes, strings );
+			if ( iChild < 0 )
+				return -1;
+			nodes[iNode].m_iFirstChild = iChild;
+		}
+	}
+
+	return iFirst;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Copies a compiled tree into this key and new peers, the same way
+//			LoadFromBuffer() fills them from text
+//-----------------------------------------------------------------------------
+bool KeyValues::LoadFromView( const CKeyValuesView &view )
+{
+	if ( !view.IsValid() )
+		return false;
+
+	KeyValues *pPreviousKey = NULL;
+	KeyValues *pCurrentKey = this;
+	for ( CKeyValuesView peer = view; peer.IsValid(); peer = peer.GetNextKey() )
+	{
+		if ( !pCurrentKey )
+		{
+			pCurrentKey = NewKey( peer.GetName() );
+			pPreviousKey->SetNextKey( pCurrentKey );
+		}
+		else
+		{
+			pCurrentKey->SetName( peer.GetName() );
+		}
+
+		pCurrentKey->RecursiveLoadFromView( peer );
+
+		pPreviousKey = pCurrentKey;
+		pCurrentKey = NULL;
+	}
+
+	return true;
+}
+
+
+//-----------------------------------------------------------------------------
+// Purpose: Sets the value of this key from view and appends its subkeys
+//-----------------------------------------------------------------------------
+void KeyValues::RecursiveLoadFromView( const CKeyValuesView &view )
+{
+	m_bHasEscapeSequences = view.HasEscapeSequences();
+
+	switch ( view.GetDataType() )
+	{
+	case TYPE_STRING:
+		{
+			const char *pValue = view.GetString();
+			int len = Q_strlen( pValue );
+			FreeAllocatedValue();
+			m_sValue = AllocateValueBlock( len + 1 );
+			Q_memcpy( m_sValue, pValue, len + 1 );
+			m_iDataType = TYPE_STRING;
+		}
+		return;
+	case TYPE_INT:
+		m_iValue = view.GetInt();
+		m_iDataType = TYPE_INT;
+		return;
+	case TYPE_FLOAT:
+		m_flValue = view.GetFloat();
+		m_iDataType = TYPE_FLOAT;
+		return;
+	case TYPE_COLOR:
+		{
+			Color color = view.GetColor();
+			for ( int i = 0; i < 4; i++ )
+			{
+				m_Color[i] = color[i];
+			}
+			m_iDataType = TYPE_COLOR;
+		}
+		return;
+	default:
+		break;
+	}
+
+	// Link subkeys directly instead of through AddSubKey(), which walks the list
+	KeyValues *pLastSub = m_pSub;
+	while ( pLastSub && pLastSub->m_pPeer )
+	{
+		pLastSub = pLastSub->m_pPeer;
+	}
+
+	for ( CKeyValuesView sub = view.GetFirstSubKey(); sub.IsValid(); sub = sub.GetNextKey() )
+	{
+		KeyValues *dat = NewKey( sub.GetName() );
+		dat->RecursiveLoadFromView( sub );
+
+		if ( pLastSub )
+		{
+			pLastSub->m_pPeer = dat;
+		}
+		else
+		{
+			m_pSub = dat;
+		}
+		pLastSub = dat;
+	}
+}
+
 #include "tier0/memdbgoff.h"
 
 //-----------------------------------------------------------------------------
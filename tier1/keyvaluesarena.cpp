@@ -0,0 +1,159 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Bump allocator for short-lived KeyValues trees. See keyvaluesarena.h.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "keyvaluesarena.h"
+#include "tier0/dbg.h"
+#include "minmax.h" // min(), max()
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+// Blocks commit this much more than they hand out. CMemoryStack can't commit
+// the last page of its reservation.
+#define KEYVALUES_ARENA_COMMIT_SIZE	( 16 * 1024 )
+
+
+CKeyValuesArena::CKeyValuesArena( int nBlockSize )
+{
+	m_nBlockSize = AlignValue( max( nBlockSize, KEYVALUES_ARENA_COMMIT_SIZE ), KEYVALUES_ARENA_COMMIT_SIZE );
+	m_iBlock = -1;
+	m_nKeys = 0;
+}
+
+
+CKeyValuesArena::~CKeyValuesArena()
+{
+	for ( int i = 0; i < m_Blocks.Count(); i++ )
+	{
+		m_Blocks[i]->Term();
+		delete m_Blocks[i];
+	}
+}
+
+
+int CKeyValuesArena::GetBlockCapacity( CMemoryStack *pBlock )
+{
+	return pBlock->GetMaxSize() - KEYVALUES_ARENA_COMMIT_SIZE;
+}
+
+
+//-----------------------------------------------------------------------------
+// Moves on to the next block with room for nBytes, creating one if needed
+//-----------------------------------------------------------------------------
+CMemoryStack *CKeyValuesArena::NextBlock( int nBytes )
+{
+	while ( ++m_iBlock < m_Blocks.Count() )
+	{
+		CMemoryStack *pBlock = m_Blocks[m_iBlock];
+		pBlock->FreeToAllocPoint( 0 );
+		if ( nBytes <= GetBlockCapacity( pBlock ) )
+			return pBlock;
+	}
+
+	// Oversized allocations get a block of their own. The whole block is
+	// committed up front so resets never give memory back to the OS.
+	int nCapacity = max( m_nBlockSize, (int)AlignValue( nBytes, KEYVALUES_ARENA_COMMIT_SIZE ) );
+	CMemoryStack *pBlock = new CMemoryStack;
+	pBlock->Init( nCapacity + KEYVALUES_ARENA_COMMIT_SIZE, KEYVALUES_ARENA_COMMIT_SIZE, nCapacity, KEYVALUES_ARENA_HEADER_SIZE );
+	m_iBlock = m_Blocks.AddToTail( pBlock );
+	return pBlock;
+}
+
+
+void *CKeyValuesArena::Alloc( int nBytes )
+{
+	nBytes = AlignValue( nBytes, KEYVALUES_ARENA_HEADER_SIZE );
+
+	CMemoryStack *pBlock = ( m_iBlock >= 0 ) ? m_Blocks[m_iBlock] : NULL;
+	if ( !pBlock || pBlock->GetUsed() + nBytes > GetBlockCapacity( pBlock ) )
+	{
+		pBlock = NextBlock( nBytes );
+	}
+
+	return pBlock->Alloc( nBytes );
+}
+
+
+KeyValues *CKeyValuesArena::CreateKeyValues( const char *pName )
+{
+	unsigned char *pMem = (unsigned char *)Alloc( KEYVALUES_ARENA_HEADER_SIZE + sizeof( KeyValues ) );
+	*(CKeyValuesArena **)pMem = this;
+
+	// KeyValues has no virtuals, so this is all its constructor does
+	KeyValues *pKeyValues = (KeyValues *)( pMem + KEYVALUES_ARENA_HEADER_SIZE );
+	pKeyValues->Init();
+	pKeyValues->reserved[0] = 1;
+	pKeyValues->SetName( pName );
+
+	m_nKeys++;
+	return pKeyValues;
+}
+
+
+KeyValues *CKeyValuesArena::CopyKeyValues( const KeyValues *pSrc )
+{
+	return pSrc->MakeCopy( this );
+}
+
+
+KeyValues *CKeyValuesArena::Escape( KeyValues *pKeyValues )
+{
+	if ( !pKeyValues || !pKeyValues->GetArena() )
+		return pKeyValues;
+
+	return pKeyValues->MakeCopy();
+}
+
+
+void CKeyValuesArena::Reset()
+{
+	// Later blocks are emptied when NextBlock() moves on to them
+	if ( m_Blocks.Count() )
+	{
+		m_Blocks[0]->FreeToAllocPoint( 0 );
+		m_iBlock = 0;
+	}
+	m_nKeys = 0;
+}
+
+
+KeyValuesArenaMark_t CKeyValuesArena::GetMark() const
+{
+	KeyValuesArenaMark_t mark;
+	mark.m_iBlock = m_iBlock;
+	mark.m_nUsed = ( m_iBlock >= 0 ) ? m_Blocks[m_iBlock]->GetCurrentAllocPoint() : 0;
+	mark.m_nKeys = m_nKeys;
+	return mark;
+}
+
+
+void CKeyValuesArena::FreeToMark( const KeyValuesArenaMark_t &mark )
+{
+	Assert( mark.m_iBlock <= m_iBlock );
+	if ( mark.m_iBlock >= 0 )
+	{
+		m_Blocks[mark.m_iBlock]->FreeToAllocPoint( mark.m_nUsed );
+		m_iBlock = mark.m_iBlock;
+	}
+	else
+	{
+		Reset();
+	}
+	m_nKeys = mark.m_nKeys;
+}
+
+
+int CKeyValuesArena::GetBytesUsed() const
+{
+	int nBytes = 0;
+	for ( int i = 0; i <= m_iBlock; i++ )
+	{
+		nBytes += m_Blocks[i]->GetUsed();
+	}
+	return nBytes;
+}
@@ -0,0 +1,504 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Compiled KeyValues view and file cache. See keyvaluesview.h.
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "keyvaluesview.h"
+#include "filesystem.h"
+#include "checksum_crc.h"
+#include "strtools.h"
+#include <stdlib.h>
+#include <stdio.h>
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+
+#define KVCACHE_PACK_ID			(('K'<<24)|('C'<<16)|('V'<<8)|'K')	// "KVCK"
+#define KVCACHE_PACK_VERSION	1
+
+struct KVCachePackHeader_t
+{
+	int		m_nId;
+	int		m_nVersion;
+	int		m_nEntries;
+};
+
+// Followed by the zero terminated key and then the compiled data, each padded
+// to 4 bytes
+struct KVCachePackEntry_t
+{
+	unsigned int	m_nSourceSize;
+	int				m_nSourceTime;
+	int				m_nFlags;
+	int				m_nKeyBytes;
+	int				m_nDataSize;
+	CRC32_t			m_DataCRC;
+};
+
+#define KVCACHE_ENTRY_ESCAPE_SEQUENCES	(1<<0)
+
+
+//-----------------------------------------------------------------------------
+// String pool
+//-----------------------------------------------------------------------------
+int CKVCompiledStrings::AddString( const char *pString )
+{
+	if ( !pString )
+	{
+		pString = "";
+	}
+
+	int i = m_Offsets.Find( pString );
+	if ( i != m_Offsets.InvalidIndex() )
+		return m_Offsets[i];
+
+	int nOffset = m_Buffer.TellPut();
+	m_Buffer.Put( pString, Q_strlen( pString ) + 1 );
+	m_Offsets.Insert( pString, nOffset );
+	return nOffset;
+}
+
+
+//-----------------------------------------------------------------------------
+// View
+//-----------------------------------------------------------------------------
+CKeyValuesView CKeyValuesView::FromMemory( const void *pData, int nSize )
+{
+	const KVCompiledHeader_t *pHeader = (const KVCompiledHeader_t *)pData;
+	if ( !pData || nSize < (int)sizeof( KVCompiledHeader_t ) )
+		return CKeyValuesView();
+
+	if ( pHeader->m_nId != KVCOMPILED_ID || pHeader->m_nVersion != KVCOMPILED_VERSION )
+		return CKeyValuesView();
+
+	int nNodes = pHeader->m_nNodes;
+	int nStringBytes = pHeader->m_nStringBytes;
+	int nMaxNodes = ( nSize - (int)sizeof( KVCompiledHeader_t ) ) / (int)sizeof( KVCompiledNode_t );
+	if ( nNodes <= 0 || nNodes > nMaxNodes || nStringBytes <= 0 )
+		return CKeyValuesView();
+	if ( nStringBytes > nSize - (int)sizeof( KVCompiledHeader_t ) - nNodes * (int)sizeof( KVCompiledNode_t ) )
+		return CKeyValuesView();
+
+	const KVCompiledNode_t *pNodes = (const KVCompiledNode_t *)( pHeader + 1 );
+	const char *pStrings = (const char *)( pNodes + nNodes );
+	if ( pStrings[nStringBytes - 1] != 0 )
+		return CKeyValuesView();
+
+	// Links only point forward, so a tree that passes this can't loop
+	for ( int i = 0; i < nNodes; i++ )
+	{
+		const KVCompiledNode_t &node = pNodes[i];
+		if ( node.m_nName < 0 || node.m_nName >= nStringBytes || node.m_nString < 0 || node.m_nString >= nStringBytes )
+			return CKeyValuesView();
+		if ( node.m_iFirstChild != KVCOMPILED_NO_NODE && ( node.m_iFirstChild <= i || node.m_iFirstChild >= nNodes ) )
+			return CKeyValuesView();
+		if ( node.m_iNextPeer != KVCOMPILED_NO_NODE && ( node.m_iNextPeer <= i || node.m_iNextPeer >= nNodes ) )
+			return CKeyValuesView();
+		if ( node.m_Type >= KeyValues::TYPE_NUMTYPES )
+			return CKeyValuesView();
+	}
+
+	return CKeyValuesView( pHeader, 0 );
+}
+
+
+CKeyValuesView CKeyValuesView::FindKey( const char *pKeyName ) const
+{
+	if ( !pKeyName || !pKeyName[0] )
+		return *this;
+
+	if ( !IsValid() )
+		return CKeyValuesView();
+
+	// Match one '/' delimited part at a time
+	const char *pPart = pKeyName;
+	CKeyValuesView parent = *this;
+	while ( 1 )
+	{
+		const char *pEnd = strchr( pPart, '/' );
+		int nLen = pEnd ? pEnd - pPart : Q_strlen( pPart );
+
+		CKeyValuesView dat;
+		for ( dat = parent.GetFirstSubKey(); dat.IsValid(); dat = dat.GetNextKey() )
+		{
+			const char *pName = dat.GetName();
+			if ( !Q_strnicmp( pName, pPart, nLen ) && pName[nLen] == 0 )
+				break;
+		}
+
+		if ( !pEnd || !dat.IsValid() )
+			return dat;
+
+		parent = dat;
+		pPart = pEnd + 1;
+	}
+}
+
+
+int CKeyValuesView::GetInt( const char *pKeyName, int nDefault ) const
+{
+	CKeyValuesView dat = FindKey( pKeyName );
+	if ( !dat.IsValid() )
+		return nDefault;
+
+	const KVCompiledNode_t &node = dat.Node();
+	switch ( node.m_Type )
+	{
+	case KeyValues::TYPE_STRING:
+		return atoi( dat.String( node.m_nString ) );
+	case KeyValues::TYPE_FLOAT:
+		return (int)node.m_flValue;
+	case KeyValues::TYPE_INT:
+	default:
+		return node.m_iValue;
+	}
+}
+
+
+float CKeyValuesView::GetFloat( const char *pKeyName, float flDefault ) const
+{
+	CKeyValuesView dat = FindKey( pKeyName );
+	if ( !dat.IsValid() )
+		return flDefault;
+
+	const KVCompiledNode_t &node = dat.Node();
+	switch ( node.m_Type )
+	{
+	case KeyValues::TYPE_STRING:
+		return (float)atof( dat.String( node.m_nString ) );
+	case KeyValues::TYPE_FLOAT:
+		return node.m_flValue;
+	case KeyValues::TYPE_INT:
+		return (float)node.m_iValue;
+	default:
+		return 0.0f;
+	}
+}
+
+
+const char *CKeyValuesView::GetString( const char *pKeyName, const char *pDefault ) const
+{
+	CKeyValuesView dat = FindKey( pKeyName );
+	if ( !dat.IsValid() )
+		return pDefault;
+
+	// Numbers were printed into the pool when the tree was compiled
+	const KVCompiledNode_t &node = dat.Node();
+	switch ( node.m_Type )
+	{
+	case KeyValues::TYPE_STRING:
+	case KeyValues::TYPE_INT:
+	case KeyValues::TYPE_FLOAT:
+		return dat.String( node.m_nString );
+	default:
+		return pDefault;
+	}
+}
+
+
+Color CKeyValuesView::GetColor( const char *pKeyName ) const
+{
+	Color color( 0, 0, 0, 0 );
+	CKeyValuesView dat = FindKey( pKeyName );
+	if ( !dat.IsValid() )
+		return color;
+
+	const KVCompiledNode_t &node = dat.Node();
+	switch ( node.m_Type )
+	{
+	case KeyValues::TYPE_COLOR:
+		color.SetColor( node.m_Color[0], node.m_Color[1], node.m_Color[2], node.m_Color[3] );
+		break;
+	case KeyValues::TYPE_FLOAT:
+		color[0] = node.m_flValue;
+		break;
+	case KeyValues::TYPE_INT:
+		color[0] = node.m_iValue;
+		break;
+	case KeyValues::TYPE_STRING:
+		{
+			float a = 0, b = 0, c = 0, d = 0;
+			sscanf( dat.String( node.m_nString ), "%f %f %f %f", &a, &b, &c, &d );
+			color.SetColor( (unsigned char)a, (unsigned char)b, (unsigned char)c, (unsigned char)d );
+		}
+		break;
+	}
+	return color;
+}
+
+
+//-----------------------------------------------------------------------------
+// File cache
+//-----------------------------------------------------------------------------
+static CKeyValuesFileCache s_KeyValuesFileCache;
+
+CKeyValuesFileCache *KeyValuesFileCache()
+{
+	return &s_KeyValuesFileCache;
+}
+
+
+CKeyValuesFileCache::CKeyValuesFileCache() : m_Entries( true )
+{
+	m_pFileSystem = NULL;
+	m_szPackName[0] = 0;
+	m_pPackBuffer = NULL;
+	m_nDataSize = 0;
+	m_nHits = 0;
+	m_nMisses = 0;
+	m_bEnabled = false;
+	m_bDirty = false;
+}
+
+
+CKeyValuesFileCache::~CKeyValuesFileCache()
+{
+	// Nothing gets written this late, and the file system may already be gone,
+	// so a pack buffer that Shutdown() didn't free is left alone
+	for ( int i = m_Entries.First(); i != m_Entries.InvalidIndex(); i = m_Entries.Next( i ) )
+	{
+		FreeEntry( m_Entries[i] );
+	}
+}
+
+
+void CKeyValuesFileCache::Init( IBaseFileSystem *pFileSystem, const char *pPackName )
+{
+	Shutdown();
+
+	m_pFileSystem = pFileSystem;
+	Q_strncpy( m_szPackName, pPackName, sizeof( m_szPackName ) );
+	Q_FixSlashes( m_szPackName );
+	m_bEnabled = true;
+
+	LoadPack();
+}
+
+
+void CKeyValuesFileCache::Shutdown()
+{
+	Flush();
+	Clear();
+
+	m_pFileSystem = NULL;
+	m_bEnabled = false;
+}
+
+
+void CKeyValuesFileCache::Clear()
+{
+	for ( int i = m_Entries.First(); i != m_Entries.InvalidIndex(); i = m_Entries.Next( i ) )
+	{
+		FreeEntry( m_Entries[i] );
+	}
+	m_Entries.RemoveAll();
+
+	if ( m_pPackBuffer )
+	{
+		( (IFileSystem *)m_pFileSystem )->FreeOptimalReadBuffer( m_pPackBuffer );
+		m_pPackBuffer = NULL;
+	}
+
+	m_nDataSize = 0;
+	m_bDirty = m_pFileSystem != NULL;
+}
+
+
+void CKeyValuesFileCache::FreeEntry( Entry_t &entry )
+{
+	if ( entry.m_bOwnsData )
+	{
+		delete [] (unsigned char *)entry.m_pData;
+	}
+	m_nDataSize -= entry.m_nDataSize;
+	entry.m_pData = NULL;
+	entry.m_nDataSize = 0;
+}
+
+
+void CKeyValuesFileCache::MakeKey( const char *pResourceName, const char *pPathID, char *pKey, int nMaxLen ) const
+{
+	Q_snprintf( pKey, nMaxLen, "%s|%s", pPathID ? pPathID : "", pResourceName );
+	Q_FixSlashes( pKey );
+}
+
+
+void CKeyValuesFileCache::LoadPack()
+{
+	FileHandle_t f = m_pFileSystem->Open( m_szPackName, "rb", "DEFAULT_WRITE_PATH" );
+	if ( !f )
+		return;
+
+	IFileSystem *pFileSystem = (IFileSystem *)m_pFileSystem;
+	int nFileSize = m_pFileSystem->Size( f );
+	unsigned nBufSize = pFileSystem->GetOptimalReadSize( f, nFileSize );
+	m_pPackBuffer = pFileSystem->AllocOptimalReadBuffer( f, nBufSize );
+	int nRead = pFileSystem->ReadEx( m_pPackBuffer, nBufSize, nFileSize, f );
+	m_pFileSystem->Close( f );
+
+	const unsigned char *pBase = (const unsigned char *)m_pPackBuffer;
+	const KVCachePackHeader_t *pHeader = (const KVCachePackHeader_t *)pBase;
+	if ( nRead != nFileSize || nFileSize < (int)sizeof( KVCachePackHeader_t ) ||
+		pHeader->m_nId != KVCACHE_PACK_ID || pHeader->m_nVersion != KVCACHE_PACK_VERSION )
+	{
+		// Stale or damaged; it gets rewritten at the next flush
+		m_bDirty = true;
+		return;
+	}
+
+	int nOffset = sizeof( KVCachePackHeader_t );
+	for ( int i = 0; i < pHeader->m_nEntries; i++ )
+	{
+		if ( nOffset + (int)sizeof( KVCachePackEntry_t ) > nFileSize )
+			break;
+
+		const KVCachePackEntry_t *pPackEntry = (const KVCachePackEntry_t *)( pBase + nOffset );
+		nOffset += sizeof( KVCachePackEntry_t );
+
+		int nKeyBytes = AlignValue( pPackEntry->m_nKeyBytes, 4 );
+		int nDataBytes = AlignValue( pPackEntry->m_nDataSize, 4 );
+		if ( pPackEntry->m_nKeyBytes <= 0 || pPackEntry->m_nDataSize <= 0 || nKeyBytes > nFileSize - nOffset || nDataBytes > nFileSize - nOffset - nKeyBytes )
+			break;
+
+		const char *pKey = (const char *)( pBase + nOffset );
+		const void *pData = pBase + nOffset + nKeyBytes;
+		nOffset += nKeyBytes + nDataBytes;
+
+		if ( pKey[pPackEntry->m_nKeyBytes - 1] != 0 )
+			break;
+
+		if ( CRC32_ProcessSingleBuffer( pData, pPackEntry->m_nDataSize ) != pPackEntry->m_DataCRC ||
+			!CKeyValuesView::FromMemory( pData, pPackEntry->m_nDataSize ).IsValid() )
+		{
+			m_bDirty = true;
+			continue;
+		}
+
+		Entry_t entry;
+		entry.m_pData = pData;
+		entry.m_nDataSize = pPackEntry->m_nDataSize;
+		entry.m_nSourceSize = pPackEntry->m_nSourceSize;
+		entry.m_nSourceTime = pPackEntry->m_nSourceTime;
+		entry.m_bEscapeSequences = ( pPackEntry->m_nFlags & KVCACHE_ENTRY_ESCAPE_SEQUENCES ) != 0;
+		entry.m_bOwnsData = false;
+		m_Entries.Insert( pKey, entry );
+		m_nDataSize += entry.m_nDataSize;
+	}
+}
+
+
+void CKeyValuesFileCache::Flush()
+{
+	if ( !m_pFileSystem || !m_bDirty )
+		return;
+
+	CUtlBuffer buf;
+	KVCachePackHeader_t header;
+	header.m_nId = KVCACHE_PACK_ID;
+	header.m_nVersion = KVCACHE_PACK_VERSION;
+	header.m_nEntries = m_Entries.Count();
+	buf.Put( &header, sizeof( header ) );
+
+	static const char s_Padding[4] = { 0, 0, 0, 0 };
+	for ( int i = m_Entries.First(); i != m_Entries.InvalidIndex(); i = m_Entries.Next( i ) )
+	{
+		const Entry_t &entry = m_Entries[i];
+		const char *pKey = m_Entries.GetElementName( i );
+
+		KVCachePackEntry_t packEntry;
+		packEntry.m_nSourceSize = entry.m_nSourceSize;
+		packEntry.m_nSourceTime = entry.m_nSourceTime;
+		packEntry.m_nFlags = entry.m_bEscapeSequences ? KVCACHE_ENTRY_ESCAPE_SEQUENCES : 0;
+		packEntry.m_nKeyBytes = Q_strlen( pKey ) + 1;
+		packEntry.m_nDataSize = entry.m_nDataSize;
+		packEntry.m_DataCRC = CRC32_ProcessSingleBuffer( entry.m_pData, entry.m_nDataSize );
+		buf.Put( &packEntry, sizeof( packEntry ) );
+
+		buf.Put( pKey, packEntry.m_nKeyBytes );
+		buf.Put( s_Padding, AlignValue( packEntry.m_nKeyBytes, 4 ) - packEntry.m_nKeyBytes );
+		buf.Put( entry.m_pData, entry.m_nDataSize );
+		buf.Put( s_Padding, AlignValue( entry.m_nDataSize, 4 ) - entry.m_nDataSize );
+	}
+
+	char szDir[MAX_PATH];
+	Q_ExtractFilePath( m_szPackName, szDir, sizeof( szDir ) );
+	if ( szDir[0] )
+	{
+		( (IFileSystem *)m_pFileSystem )->CreateDirHierarchy( szDir, "DEFAULT_WRITE_PATH" );
+	}
+
+	FileHandle_t f = m_pFileSystem->Open( m_szPackName, "wb", "DEFAULT_WRITE_PATH" );
+	if ( !f )
+	{
+		Warning( "Couldn't write KeyValues cache %s\n", m_szPackName );
+		return;
+	}
+
+	m_pFileSystem->Write( buf.Base(), buf.TellPut(), f );
+	m_pFileSystem->Close( f );
+	m_bDirty = false;
+}
+
+
+CKeyValuesView CKeyValuesFileCache::Find( const char *pResourceName, const char *pPathID, bool bEscapeSequences, unsigned int nSourceSize, long nSourceTime )
+{
+	if ( !m_bEnabled )
+		return CKeyValuesView();
+
+	char szKey[MAX_PATH * 2];
+	MakeKey( pResourceName, pPathID, szKey, sizeof( szKey ) );
+
+	int i = m_Entries.Find( szKey );
+	if ( i != m_Entries.InvalidIndex() )
+	{
+		const Entry_t &entry = m_Entries[i];
+		if ( entry.m_nSourceSize == nSourceSize && entry.m_nSourceTime == nSourceTime && entry.m_bEscapeSequences == bEscapeSequences )
+		{
+			m_nHits++;
+			return CKeyValuesView::FromMemory( entry.m_pData, entry.m_nDataSize );
+		}
+	}
+
+	m_nMisses++;
+	return CKeyValuesView();
+}
+
+
+void CKeyValuesFileCache::Add( const char *pResourceName, const char *pPathID, bool bEscapeSequences, unsigned int nSourceSize, long nSourceTime, KeyValues *pRoot )
+{
+	if ( !m_bEnabled )
+		return;
+
+	CUtlBuffer buf;
+	if ( !pRoot->WriteAsCompiled( buf ) )
+		return;
+
+	char szKey[MAX_PATH * 2];
+	MakeKey( pResourceName, pPathID, szKey, sizeof( szKey ) );
+
+	int i = m_Entries.Find( szKey );
+	if ( i == m_Entries.InvalidIndex() )
+	{
+		i = m_Entries.Insert( szKey );
+	}
+	else
+	{
+		FreeEntry( m_Entries[i] );
+	}
+
+	Entry_t &entry = m_Entries[i];
+	unsigned char *pData = new unsigned char[buf.TellPut()];
+	Q_memcpy( pData, buf.Base(), buf.TellPut() );
+	entry.m_pData = pData;
+	entry.m_nDataSize = buf.TellPut();
+	entry.m_nSourceSize = nSourceSize;
+	entry.m_nSourceTime = nSourceTime;
+	entry.m_bEscapeSequences = bEscapeSequences;
+	entry.m_bOwnsData = true;
+
+	m_nDataSize += entry.m_nDataSize;
+	m_bDirty = true;
+}
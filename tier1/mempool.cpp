@@ -32,7 +32,7 @@ void CMemoryPool::SetErrorReportFunc( MemoryPoolReportFunc_t func )
 // Purpose: Constructor
 //-----------------------------------------------------------------------------
 
-CMemoryPool::CMemoryPool(int blockSize, int numElements, int growMode, const char *pszAllocOwner)
+CMemoryPool::CMemoryPool(int blockSize, int numElements, int growMode, const char *pszAllocOwner, int nAlignment, bool bThreadSafe)
 {
 #ifdef _XBOX
 	if( numElements > 0 && growMode != GROW_NONE )
@@ -41,10 +41,27 @@ CMemoryPool::CMemoryPool(int blockSize, int numElements, int growMode, const cha
 	}
 #endif
 
+	Assert( nAlignment == 0 || IsPowerOfTwo( nAlignment ) );
+	m_Alignment = ( nAlignment > 1 ) ? nAlignment : 1;
+
 	m_BlockSize = blockSize < sizeof(void*) ? sizeof(void*) : blockSize;
+	m_BlockSize = ALIGN_VALUE( m_BlockSize, m_Alignment );
 	m_BlocksPerBlob = numElements;
 	m_PeakAlloc = 0;
+	m_TotalAllocs = 0;
+	m_TotalFrees = 0;
 	m_GrowMode = growMode;
+
+	m_pThreadCache = NULL;
+	m_nMagazineSize = 0;
+	if ( bThreadSafe )
+	{
+		m_pThreadCache = new CThreadLocalPtr<ThreadCache_t>;
+
+		// Aim for a few KB per magazine
+		m_nMagazineSize = clamp( 4096 / m_BlockSize, 8, 64 );
+	}
+
 	Init();
 	if ( !pszAllocOwner )
 		pszAllocOwner = __FILE__;
@@ -59,11 +76,28 @@ CMemoryPool::CMemoryPool(int blockSize, int numElements, int growMode, const cha
 //-----------------------------------------------------------------------------
 CMemoryPool::~CMemoryPool()
 {
+	if ( m_pThreadCache )
+	{
+		FlushThreadCaches();
+	}
+
 	if (m_BlocksAllocated > 0)
 	{
 		ReportLeaks();
 	}
 	Clear();
+
+	if ( m_pThreadCache )
+	{
+		for ( int i = 0; i < m_ThreadCaches.Count(); i++ )
+		{
+			MemAlloc_FreeAligned( m_ThreadCaches[i] );
+		}
+		m_ThreadCaches.Purge();
+
+		delete m_pThreadCache;
+		m_pThreadCache = NULL;
+	}
 }
 
 
@@ -84,6 +118,12 @@ void CMemoryPool::Init()
 //-----------------------------------------------------------------------------
 void CMemoryPool::Clear()
 {
+	// Cached blocks belong to blobs we're about to free
+	if ( m_pThreadCache )
+	{
+		FlushThreadCaches();
+	}
+
 	// Free everything..
 	CBlob *pNext;
 	for( CBlob *pCur = m_BlobHead.m_pNext; pCur != &m_BlobHead; pCur = pNext )
@@ -119,8 +159,8 @@ void CMemoryPool::ReportLeaks()
 	for( CBlob *pCur=m_BlobHead.m_pNext; pCur != &m_BlobHead; pCur=pCur->m_pNext )
 	{
 		// scan the memory block and dump the leaks
-		char *scanPoint = (char *)pCur->m_Data;
-		char *scanEnd = pCur->m_Data + pCur->m_NumBytes;
+		char *scanPoint = GetBlobData( pCur );
+		char *scanEnd = scanPoint + pCur->m_NumBytes;
 		bool needSpace = false;
 
 		while (scanPoint < scanEnd)
@@ -178,7 +218,7 @@ void CMemoryPool::AddNewBlob()
 	// maybe use something other than malloc?
 	int nElements = m_BlocksPerBlob * sizeMultiplier;
 	int blobSize = m_BlockSize * nElements;
-	CBlob *pBlob = (CBlob*)malloc( sizeof(CBlob) + blobSize - 1 );
+	CBlob *pBlob = (CBlob*)malloc( sizeof(CBlob) + blobSize - 1 + ( m_Alignment - 1 ) );
 	Assert( pBlob );
 	
 	// Link it in at the end of the blob list.
@@ -188,7 +228,7 @@ void CMemoryPool::AddNewBlob()
 	pBlob->m_pNext->m_pPrev = pBlob->m_pPrev->m_pNext = pBlob;
 
 	// setup the free list
-	m_pHeadOfFreeList = pBlob->m_Data;
+	m_pHeadOfFreeList = GetBlobData( pBlob );
 	Assert (m_pHeadOfFreeList);
 
 	void **newBlob = (void**)m_pHeadOfFreeList;
@@ -227,6 +267,9 @@ void *CMemoryPool::Alloc( unsigned int amount )
 	if ( amount > (unsigned int)m_BlockSize )
 		return NULL;
 
+	if ( m_pThreadCache )
+		return AllocThreadSafe();
+
 	if( !m_pHeadOfFreeList )
 	{
 		// returning NULL is fine in GROW_NONE
@@ -247,6 +290,7 @@ void *CMemoryPool::Alloc( unsigned int amount )
 		}
 	}
 	m_BlocksAllocated++;
+	m_TotalAllocs++;
 	m_PeakAlloc = max(m_PeakAlloc, m_BlocksAllocated);
 
 	returnBlock = m_pHeadOfFreeList;
@@ -283,13 +327,22 @@ void CMemoryPool::Free( void *memBlock )
 #ifdef _DEBUG
 	// check to see if the memory is from the allocated range
 	bool bOK = false;
+	if ( m_pThreadCache )
+	{
+		m_Mutex.Lock();
+	}
 	for( CBlob *pCur=m_BlobHead.m_pNext; pCur != &m_BlobHead; pCur=pCur->m_pNext )
 	{
-		if (memBlock >= pCur->m_Data && (char*)memBlock < (pCur->m_Data + pCur->m_NumBytes))
+		char *pData = GetBlobData( pCur );
+		if (memBlock >= pData && (char*)memBlock < (pData + pCur->m_NumBytes))
 		{
 			bOK = true;
 		}
 	}
+	if ( m_pThreadCache )
+	{
+		m_Mutex.Unlock();
+	}
 	Assert (bOK);
 #endif // _DEBUG
 
@@ -298,7 +351,14 @@ void CMemoryPool::Free( void *memBlock )
 	memset( memBlock, 0xDD, m_BlockSize );
 #endif
 
+	if ( m_pThreadCache )
+	{
+		FreeThreadSafe( memBlock );
+		return;
+	}
+
 	m_BlocksAllocated--;
+	m_TotalFrees++;
 
 	// make the block point to the first item in the list
 	*((void**)memBlock) = m_pHeadOfFreeList;
@@ -307,4 +367,181 @@ void CMemoryPool::Free( void *memBlock )
 	m_pHeadOfFreeList = memBlock;
 }
 
+//-----------------------------------------------------------------------------
+// Purpose: Reports usage counters
+//-----------------------------------------------------------------------------
+void CMemoryPool::GetStats( MemoryPoolStats_t &stats )
+{
+	memset( &stats, 0, sizeof(stats) );
+
+	if ( m_pThreadCache )
+	{
+		AUTO_LOCK( m_Mutex );
+		for ( int i = 0; i < m_ThreadCaches.Count(); i++ )
+		{
+			stats.m_nAllocs += m_ThreadCaches[i]->m_nAllocs;
+			stats.m_nFrees += m_ThreadCaches[i]->m_nFrees;
+			stats.m_nCrossThreadFrees += m_ThreadCaches[i]->m_nCrossThreadFrees;
+		}
+		stats.m_nInUse = stats.m_nAllocs - stats.m_nFrees;
+	}
+	else
+	{
+		stats.m_nAllocs = m_TotalAllocs;
+		stats.m_nFrees = m_TotalFrees;
+		stats.m_nInUse = m_BlocksAllocated;
+	}
+
+	stats.m_nPeak = m_PeakAlloc;
+	stats.m_nBlobs = m_NumBlobs;
+	stats.m_nBlockSize = m_BlockSize;
+}
 
+//-----------------------------------------------------------------------------
+// Thread safe pools. m_pHeadOfFreeList is the depot and is guarded by
+// m_Mutex, as are the blobs and m_BlocksAllocated, which here counts blocks
+// that have left the depot (in use or sitting in some thread's magazine).
+//-----------------------------------------------------------------------------
+CMemoryPool::ThreadCache_t *CMemoryPool::GetThreadCache()
+{
+	ThreadCache_t *pCache = *m_pThreadCache;
+	if ( !pCache )
+	{
+		pCache = (ThreadCache_t *)MemAlloc_AllocAligned( sizeof(ThreadCache_t), 64 );
+		memset( pCache, 0, sizeof(ThreadCache_t) );
+		*m_pThreadCache = pCache;
+
+		AUTO_LOCK( m_Mutex );
+		m_ThreadCaches.AddToTail( pCache );
+	}
+	return pCache;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Pops from this thread's magazine, refilling half of it from
+//			the depot when empty
+//-----------------------------------------------------------------------------
+void *CMemoryPool::AllocThreadSafe()
+{
+	ThreadCache_t *pCache = GetThreadCache();
+
+	if ( !pCache->m_pHeadOfFreeList )
+	{
+		AUTO_LOCK( m_Mutex );
+
+		int nWanted = m_nMagazineSize / 2;
+		while ( pCache->m_nBlocks < nWanted )
+		{
+			if( !m_pHeadOfFreeList )
+			{
+				// Hand out what we have in GROW_NONE
+				if( m_GrowMode == GROW_NONE )
+					break;
+
+				AddNewBlob();
+
+				if( !m_pHeadOfFreeList )
+				{
+					Assert( !"CMemoryPool::Alloc: ran out of memory" );
+					break;
+				}
+			}
+
+			void *pBlock = m_pHeadOfFreeList;
+			m_pHeadOfFreeList = *((void**)pBlock);
+
+			*((void**)pBlock) = pCache->m_pHeadOfFreeList;
+			pCache->m_pHeadOfFreeList = pBlock;
+			pCache->m_nBlocks++;
+			m_BlocksAllocated++;
+		}
+
+		m_PeakAlloc = max(m_PeakAlloc, m_BlocksAllocated);
+
+		if ( !pCache->m_pHeadOfFreeList )
+			return NULL;
+	}
+
+	void *returnBlock = pCache->m_pHeadOfFreeList;
+	pCache->m_pHeadOfFreeList = *((void**)returnBlock);
+	pCache->m_nBlocks--;
+	pCache->m_nAllocs++;
+
+	return returnBlock;
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Pushes onto this thread's magazine, draining half of it back
+//			to the depot when full
+//-----------------------------------------------------------------------------
+void CMemoryPool::FreeThreadSafe( void *memBlock )
+{
+	ThreadCache_t *pCache = GetThreadCache();
+
+	// A thread can't free more of its own blocks than it allocated
+	if ( pCache->m_nFrees - pCache->m_nCrossThreadFrees >= pCache->m_nAllocs )
+	{
+		pCache->m_nCrossThreadFrees++;
+	}
+	pCache->m_nFrees++;
+
+	*((void**)memBlock) = pCache->m_pHeadOfFreeList;
+	pCache->m_pHeadOfFreeList = memBlock;
+	pCache->m_nBlocks++;
+
+	if ( pCache->m_nBlocks >= m_nMagazineSize )
+	{
+		AUTO_LOCK( m_Mutex );
+
+		int nKeep = m_nMagazineSize / 2;
+		while ( pCache->m_nBlocks > nKeep )
+		{
+			void *pBlock = pCache->m_pHeadOfFreeList;
+			pCache->m_pHeadOfFreeList = *((void**)pBlock);
+			pCache->m_nBlocks--;
+
+			*((void**)pBlock) = m_pHeadOfFreeList;
+			m_pHeadOfFreeList = pBlock;
+			m_BlocksAllocated--;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Returns every cached block to the depot. Owning threads must not
+//			be using the pool at the same time.
+//-----------------------------------------------------------------------------
+void CMemoryPool::FlushThreadCaches()
+{
+	AUTO_LOCK( m_Mutex );
+
+	for ( int i = 0; i < m_ThreadCaches.Count(); i++ )
+	{
+		ThreadCache_t *pCache = m_ThreadCaches[i];
+		while ( pCache->m_pHeadOfFreeList )
+		{
+			void *pBlock = pCache->m_pHeadOfFreeList;
+			pCache->m_pHeadOfFreeList = *((void**)pBlock);
+
+			*((void**)pBlock) = m_pHeadOfFreeList;
+			m_pHeadOfFreeList = pBlock;
+			m_BlocksAllocated--;
+		}
+		pCache->m_nBlocks = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+// Purpose: Blocks actually handed out to callers, excluding cached ones
+//-----------------------------------------------------------------------------
+int CMemoryPool::CountThreadSafe()
+{
+	AUTO_LOCK( m_Mutex );
+
+	int nCount = m_BlocksAllocated;
+	for ( int i = 0; i < m_ThreadCaches.Count(); i++ )
+	{
+		nCount -= m_ThreadCaches[i]->m_nBlocks;
+	}
+	return nCount;
+}
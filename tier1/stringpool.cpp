@@ -27,7 +27,7 @@ bool StrLess( const char * const &pszLeft, const char * const &pszRight )
 //-----------------------------------------------------------------------------
 
 CStringPool::CStringPool()
-  : m_Strings( 32, 256, StrLess )
+  : m_Strings( true )
 {
 }
 
@@ -44,36 +44,19 @@ CStringPool::~CStringPool()
 
 unsigned int CStringPool::Count() const
 {
-	return m_Strings.Count();
+	return m_Strings.GetNumStrings();
 }
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 const char * CStringPool::Find( const char *pszValue )
 {
-	unsigned short i = m_Strings.Find(pszValue);
-	if ( m_Strings.IsValidIndex(i) )
-		return m_Strings[i];
-
-	return NULL;
+	return m_Strings.FindString( pszValue );
 }
 
 const char * CStringPool::Allocate( const char *pszValue )
 {
-	char	*pszNew;
-
-	unsigned short i 	= m_Strings.Find(pszValue);
-	bool		   bNew = (i == m_Strings.InvalidIndex());
-
-	if ( !bNew )
-		return m_Strings[i];
-
-	pszNew = strdup( pszValue );
-
-	if ( bNew )
-		m_Strings.Insert( pszNew );
-
-	return pszNew;
+	return m_Strings.Intern( pszValue );
 }
 
 //-----------------------------------------------------------------------------
@@ -81,12 +64,6 @@ const char * CStringPool::Allocate( const char *pszValue )
 
 void CStringPool::FreeAll()
 {
-	unsigned short i = m_Strings.FirstInorder();
-	while ( i != m_Strings.InvalidIndex() )
-	{
-		free( (void *)m_Strings[i] );
-		i = m_Strings.NextInorder(i);
-	}
 	m_Strings.RemoveAll();
 }
 
@@ -0,0 +1,306 @@
+//========= Copyright  1996-2005, Valve Corporation, All rights reserved. ============//
+//
+// Purpose: Thread safe string interner
+//
+// $NoKeywords: $
+//=============================================================================//
+
+#include "utlstringinterner.h"
+#include "tier0/tslist.h"
+#include "generichash.h"
+#include "strtools.h"
+#include "minmax.h" // min(), max()
+
+// memdbgon must be the last include file in a .cpp file!!!
+#include "tier0/memdbgon.h"
+
+//-----------------------------------------------------------------------------
+// constructor, destructor
+//-----------------------------------------------------------------------------
+CUtlStringInterner::Shard_t::Shard_t() :
+	m_pTable( NULL ), m_nCount( 0 ), m_pChunk( NULL ), m_nChunkLeft( 0 )
+{
+}
+
+CUtlStringInterner::CUtlStringInterner( bool bCaseInsensitive ) :
+	m_bCaseInsensitive( bCaseInsensitive )
+{
+	memset( (void *)m_pPages, 0, sizeof( m_pPages ) );
+	m_nStrings = 0;
+}
+
+CUtlStringInterner::~CUtlStringInterner()
+{
+	RemoveAll();
+}
+
+
+//-----------------------------------------------------------------------------
+// Hashing and comparison
+//-----------------------------------------------------------------------------
+unsigned CUtlStringInterner::HashString( const char *pString ) const
+{
+	// The conventional hashes are weak in the high bits, which pick the shard
+	unsigned nHash = m_bCaseInsensitive ? HashStringCaselessConventional( pString ) : HashStringConventional( pString );
+	return HashIntConventional( (int)nHash );
+}
+
+inline bool CUtlStringInterner::StringsEqual( const char *pLeft, const char *pRight ) const
+{
+	return m_bCaseInsensitive ? !Q_stricmp( pLeft, pRight ) : !Q_strcmp( pLeft, pRight );
+}
+
+
+//-----------------------------------------------------------------------------
+// Lock free lookup
+//-----------------------------------------------------------------------------
+const char *CUtlStringInterner::FindInShard( const Shard_t &shard, const char *pString, unsigned nHash ) const
+{
+	const Table_t *pTable = shard.m_pTable;
+	TSRING_BARRIER();
+	if ( !pTable )
+		return NULL;
+
+	for ( int i = nHash & pTable->m_nMask; ; i = ( i + 1 ) & pTable->m_nMask )
+	{
+		const char *pCandidate = pTable->m_pSlots[i];
+		if ( !pCandidate )
+			return NULL;
+
+		TSRING_BARRIER();
+		if ( Header( pCandidate )->m_nHash == nHash && StringsEqual( pCandidate, pString ) )
+			return pCandidate;
+	}
+}
+
+UtlInternHandle_t CUtlStringInterner::Find( const char *pString ) const
+{
+	const char *pFound = FindString( pString );
+	return ( pFound ) ? Header( pFound )->m_Handle : UTL_INVAL_INTERN_HANDLE;
+}
+
+const char *CUtlStringInterner::FindString( const char *pString ) const
+{
+	if ( !pString )
+		return NULL;
+
+	unsigned nHash = HashString( pString );
+	return FindInShard( m_Shards[nHash >> SHARD_SHIFT], pString, nHash );
+}
+
+const char *CUtlStringInterner::String( UtlInternHandle_t handle ) const
+{
+	if ( handle == UTL_INVAL_INTERN_HANDLE )
+		return NULL;
+
+	Assert( (int)handle < m_nStrings );
+	const char **pPage = m_pPages[handle >> PAGE_SHIFT];
+	Assert( pPage );
+	return pPage[handle & ( PAGE_SIZE - 1 )];
+}
+
+
+//-----------------------------------------------------------------------------
+// Finds and/or creates a handle for the string
+//-----------------------------------------------------------------------------
+UtlInternHandle_t CUtlStringInterner::AddString( const char *pString )
+{
+	const char *pInterned = Intern( pString );
+	return ( pInterned ) ? Header( pInterned )->m_Handle : UTL_INVAL_INTERN_HANDLE;
+}
+
+const char *CUtlStringInterner::Intern( const char *pString )
+{
+	if ( !pString )
+		return NULL;
+
+	unsigned nHash = HashString( pString );
+	Shard_t &shard = m_Shards[nHash >> SHARD_SHIFT];
+
+	// Almost every call is for a string that is already there
+	const char *pFound = FindInShard( shard, pString, nHash );
+	if ( pFound )
+		return pFound;
+
+	CAutoLockT<CThreadFastMutex> lock( shard.m_Mutex );
+
+	// Someone may have added it while we waited for the lock
+	pFound = FindInShard( shard, pString, nHash );
+	if ( pFound )
+		return pFound;
+
+	return AddToShard( shard, pString, nHash );
+}
+
+
+//-----------------------------------------------------------------------------
+// Adds a string known not to be in the shard. Shard lock must be held.
+//-----------------------------------------------------------------------------
+const char *CUtlStringInterner::AddToShard( Shard_t &shard, const char *pString, unsigned nHash )
+{
+	// The handle is claimed first, so a full interner fails before touching the shard
+	UtlInternHandle_t handle = (UtlInternHandle_t)( ++m_nStrings - 1 );
+	if ( handle >= MAX_PAGES * PAGE_SIZE )
+	{
+		AssertMsg( false, "CUtlStringInterner is full" );
+		--m_nStrings;
+		return NULL;
+	}
+
+	// Tables are kept at most half full, which keeps linear probes short
+	if ( !shard.m_pTable || ( shard.m_nCount + 1 ) * 2 > shard.m_pTable->m_nMask + 1 )
+	{
+		GrowTable( shard );
+	}
+
+	int nLen = Q_strlen( pString ) + 1;
+	char *pData = AllocString( shard, sizeof( StringHeader_t ) + nLen );
+	StringHeader_t *pHeader = (StringHeader_t *)pData;
+	char *pNew = pData + sizeof( StringHeader_t );
+
+	pHeader->m_nHash = nHash;
+	pHeader->m_Handle = handle;
+	memcpy( pNew, pString, nLen );
+	SetHandleString( handle, pNew );
+
+	// Everything a reader can reach from the slot must be written before the slot is
+	TSRING_BARRIER();
+
+	Table_t *pTable = shard.m_pTable;
+	int i = nHash & pTable->m_nMask;
+	while ( pTable->m_pSlots[i] )
+	{
+		i = ( i + 1 ) & pTable->m_nMask;
+	}
+	pTable->m_pSlots[i] = pNew;
+	shard.m_nCount++;
+
+	return pNew;
+}
+
+
+//-----------------------------------------------------------------------------
+// Records the string for a handle, creating the handle's page if needed.
+// Shards assign handles concurrently, so pages are created with a CAS.
+//-----------------------------------------------------------------------------
+void CUtlStringInterner::SetHandleString( UtlInternHandle_t handle, const char *pString )
+{
+	const char ** volatile *ppPage = &m_pPages[handle >> PAGE_SHIFT];
+	if ( !*ppPage )
+	{
+		const char **pNewPage = (const char **)malloc( PAGE_SIZE * sizeof( const char * ) );
+		memset( pNewPage, 0, PAGE_SIZE * sizeof( const char * ) );
+		if ( ThreadInterlockedCompareExchangePointer( (void * volatile *)ppPage, pNewPage, NULL ) != NULL )
+		{
+			free( pNewPage );
+		}
+	}
+
+	(*ppPage)[handle & ( PAGE_SIZE - 1 )] = pString;
+}
+
+
+//-----------------------------------------------------------------------------
+// Allocates string storage from the shard's current chunk
+//-----------------------------------------------------------------------------
+char *CUtlStringInterner::AllocString( Shard_t &shard, int nBytes )
+{
+	// Keep the headers aligned
+	nBytes = ( nBytes + sizeof( unsigned ) - 1 ) & ~( sizeof( unsigned ) - 1 );
+
+	if ( shard.m_nChunkLeft < nBytes )
+	{
+		// Chunks double in size so small tables stay small
+		int nChunkSize = min( MIN_CHUNK_SIZE << min( shard.m_Chunks.Count(), 6 ), MAX_CHUNK_SIZE );
+		nChunkSize = max( nChunkSize, nBytes );
+
+		MEM_ALLOC_CREDIT_CLASS();
+		shard.m_pChunk = (char *)malloc( nChunkSize );
+		shard.m_nChunkLeft = nChunkSize;
+		shard.m_Chunks.AddToTail( shard.m_pChunk );
+	}
+
+	char *pResult = shard.m_pChunk;
+	shard.m_pChunk += nBytes;
+	shard.m_nChunkLeft -= nBytes;
+	return pResult;
+}
+
+
+//-----------------------------------------------------------------------------
+// Replaces the shard's table with one twice the size. The old table stays
+// allocated for readers that may still be probing it.
+//-----------------------------------------------------------------------------
+void CUtlStringInterner::GrowTable( Shard_t &shard )
+{
+	Table_t *pOld = shard.m_pTable;
+	int nSlots = ( pOld ) ? ( pOld->m_nMask + 1 ) * 2 : MIN_TABLE_SIZE;
+
+	MEM_ALLOC_CREDIT_CLASS();
+	Table_t *pNew = (Table_t *)malloc( sizeof( Table_t ) + ( nSlots - 1 ) * sizeof( const char * ) );
+	pNew->m_pRetired = pOld;
+	pNew->m_nMask = nSlots - 1;
+	memset( (void *)pNew->m_pSlots, 0, nSlots * sizeof( const char * ) );
+
+	if ( pOld )
+	{
+		for ( int iOld = 0; iOld <= pOld->m_nMask; iOld++ )
+		{
+			const char *pString = pOld->m_pSlots[iOld];
+			if ( !pString )
+				continue;
+
+			int i = Header( pString )->m_nHash & pNew->m_nMask;
+			while ( pNew->m_pSlots[i] )
+			{
+				i = ( i + 1 ) & pNew->m_nMask;
+			}
+			pNew->m_pSlots[i] = pString;
+		}
+	}
+
+	TSRING_BARRIER();
+	shard.m_pTable = pNew;
+}
+
+
+//-----------------------------------------------------------------------------
+// Frees all strings
+//-----------------------------------------------------------------------------
+void CUtlStringInterner::RemoveAll()
+{
+	int i;
+	for ( i = 0; i < NUM_SHARDS; i++ )
+	{
+		Shard_t &shard = m_Shards[i];
+
+		Table_t *pTable = shard.m_pTable;
+		while ( pTable )
+		{
+			Table_t *pRetired = pTable->m_pRetired;
+			free( pTable );
+			pTable = pRetired;
+		}
+		shard.m_pTable = NULL;
+
+		for ( int j = 0; j < shard.m_Chunks.Count(); j++ )
+		{
+			free( shard.m_Chunks[j] );
+		}
+		shard.m_Chunks.Purge();
+		shard.m_pChunk = NULL;
+		shard.m_nChunkLeft = 0;
+		shard.m_nCount = 0;
+	}
+
+	for ( i = 0; i < MAX_PAGES; i++ )
+	{
+		if ( m_pPages[i] )
+		{
+			free( (void *)m_pPages[i] );
+			m_pPages[i] = NULL;
+		}
+	}
+
+	m_nStrings = 0;
+}
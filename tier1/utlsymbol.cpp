@@ -14,7 +14,6 @@
 #include "KeyValues.h"
 #include "tier0/threadtools.h"
 #include "tier0/memdbgon.h"
-#include "stringpool.h"
 
 // memdbgon must be the last include file in a .cpp file!!!
 #include "tier0/memdbgon.h"
@@ -296,9 +295,14 @@ FileNameHandle_t CUtlFilenameSymbolTable::FindOrAddFileName( char const *pFileNa
 	char filename[ MAX_PATH ];
 	Q_strncpy( filename, fn + Q_strlen( basepath ), sizeof( filename ) );
 
+	CUtlSymbol path = m_FileNames.AddString( basepath );
+	CUtlSymbol file = m_FileNames.AddString( filename );
+	if ( !path.IsValid() || !file.IsValid() )
+		return NULL;
+
 	FileNameHandleInternal_t handle;
-	handle.path = g_CountedStringPool.ReferenceStringHandle(basepath);
-	handle.file = g_CountedStringPool.ReferenceStringHandle(filename );
+	handle.path = (UtlSymId_t)path + 1;
+	handle.file = (UtlSymId_t)file + 1;
 
 	return *( FileNameHandle_t * )( &handle );
 }
@@ -325,13 +329,15 @@ FileNameHandle_t CUtlFilenameSymbolTable::FindFileName( char const *pFileName )
 	char filename[ MAX_PATH ];
 	Q_strncpy( filename, fn + Q_strlen( basepath ), sizeof( filename ) );
 
-	FileNameHandleInternal_t handle;
-	handle.path = g_CountedStringPool.FindStringHandle(basepath);
-	handle.file = g_CountedStringPool.FindStringHandle(filename);
-
-	if( handle.path == NULL || handle.file == NULL )
+	CUtlSymbol path = m_FileNames.Find( basepath );
+	CUtlSymbol file = m_FileNames.Find( filename );
+	if ( !path.IsValid() || !file.IsValid() )
 		return NULL;
 
+	FileNameHandleInternal_t handle;
+	handle.path = (UtlSymId_t)path + 1;
+	handle.file = (UtlSymId_t)file + 1;
+
 	return *( FileNameHandle_t * )( &handle );
 }
 
@@ -345,21 +351,14 @@ bool CUtlFilenameSymbolTable::String( const FileNameHandle_t& handle, char *buf,
 	buf[ 0 ] = 0;
 
 	FileNameHandleInternal_t *internal = ( FileNameHandleInternal_t * )&handle;
-	if ( !internal )
+	if ( !internal || !internal->path || !internal->file )
 	{
 		return false;
 	}
 
-	char const *path = g_CountedStringPool.HandleToString(internal->path);
-	if ( !path )
-		return false;
-
+	char const *path = m_FileNames.String( CUtlSymbol( internal->path - 1 ) );
 	Q_strncpy( buf, path, buflen );
-	char const *fn = g_CountedStringPool.HandleToString(internal->file);
-	if ( !fn )
-	{
-		return false;
-	}
+	char const *fn = m_FileNames.String( CUtlSymbol( internal->file - 1 ) );
 
 	Q_strncat( buf, fn, buflen, COPY_ALL_CHARACTERS );
 